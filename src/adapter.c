@@ -97,6 +97,7 @@ tapAdapterContextAllocate(
     if(adapter)
     {
         NET_BUFFER_LIST_POOL_PARAMETERS  nblPoolParameters = {0};
+        ULONG                            i;
 
         NdisZeroMemory(adapter,sizeof(TAP_ADAPTER_CONTEXT));
 
@@ -122,14 +123,65 @@ tapAdapterContextAllocate(
             return NULL;
         }
 
-        // Initialize cancel-safe IRP queue
-        tapIrpCsqInitialize(&adapter->PendingReadIrpQueue);
+        adapter->FilterLock = NdisAllocateRWLock(adapter->MiniportAdapterHandle);
 
-        // Initialize TAP send packet queue.
-        tapPacketQueueInitialize(&adapter->SendPacketQueue);
+        if (adapter->FilterLock == NULL)
+        {
+            DEBUGP (("[TAP] Couldn't allocate adapter filter lock\n"));
+            NdisFreeNetBufferListPool(adapter->ReceiveNblPool);
+            NdisFreeMemory(adapter,0,0);
+            return NULL;
+        }
+
+        if (tapDropStatsInitialize(&adapter->DropStats) != NDIS_STATUS_SUCCESS)
+        {
+            DEBUGP (("[TAP] Couldn't allocate adapter drop counters\n"));
+            NdisFreeRWLock(adapter->FilterLock);
+            NdisFreeNetBufferListPool(adapter->ReceiveNblPool);
+            NdisFreeMemory(adapter,0,0);
+            return NULL;
+        }
+
+        // Initialize the per-handle read queues: cancel-safe IRP queue,
+        // TAP send packet queue and flow control.
+        for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+        {
+            tapQueueInitialize(&adapter->Queues[i]);
+        }
+
+        adapter->QueueLimit = 1;
+
+        // Reads return one frame each until coalescing is configured.
+        tapReadCoalesceInitialize(adapter);
+
+        // Lock statistics start off.
+        tapLockStatsInitialize(adapter);
+
+        // The statistics page is allocated when first mapped.
+        tapStatsPageInitialize(adapter);
+
+        // No metrics requests wait until one asks to.
+        tapMetricsInitialize(adapter);
+
+        // Initialize the queue for driver-generated receive indications.
+        tapInjectQueueInitialize(adapter);
+
+        // Prebuild the TUN write header MDLs. Writes fall back to
+        // allocating an MDL if this comes up short.
+        tapHeaderMdlCacheInitialize(adapter);
+
+        // DHCP reply templates are built on CONFIG_DHCP_MASQ.
+        KeInitializeSpinLock(&adapter->m_dhcp_templates_lock);
+
+        // DHCP pool mode starts disabled.
+        KeInitializeSpinLock(&adapter->m_dhcp_pool_lock);
+
+        // Proxy ARP starts disabled.
+        KeInitializeSpinLock(&adapter->ProxyArpLock);
+        KeInitializeSpinLock(&adapter->NdProxyLock);
 
-        // Initialize flow control
-        KeInitializeSpinLock(&adapter->FlowControlLock);
+        // Frame capture starts disabled.
+        tapCaptureInitialize(&adapter->Capture);
 
         // Allocate the adapter lock.
         NdisAllocateSpinLock(&adapter->AdapterLock);
@@ -147,6 +199,8 @@ tapAdapterContextAllocate(
 
         // Safe for multiple removes.
         NdisInitializeListHead(&adapter->AdapterListLink);
+        NdisInitializeListHead(&adapter->DeviceHashEntry.Link);
+        NdisInitializeListHead(&adapter->DiagDeviceHashEntry.Link);
 
         //
         // The miniport adapter is initially powered up
@@ -296,6 +350,15 @@ tapReadConfiguration(
                     DEBUGP (("[TAP] NetCfgInstanceId ANSI name conversion failed\n"));
                     status = NDIS_STATUS_RESOURCES;
                 }
+
+                // And as a GUID, which identifies the adapter in metrics.
+                if (RtlGUIDFromString (
+                        &Adapter->NetCfgInstanceId,
+                        &Adapter->NetCfgInstanceGuid) != STATUS_SUCCESS
+                    )
+                {
+                    DEBUGP (("[TAP] NetCfgInstanceId is not a GUID\n"));
+                }
             }
             else
             {
@@ -457,6 +520,39 @@ tapReadConfiguration(
     return status;
 }
 
+static ULONG
+tapAdapterHashDeviceObject(
+    __in PDEVICE_OBJECT DeviceObject
+    )
+{
+    // Multiplicative hash; the low pointer bits are alignment.
+    return (ULONG )((((ULONG64 )(ULONG_PTR )DeviceObject >> 4) * 0x9E3779B97F4A7C15ULL)
+                        >> (64 - TAP_ADAPTER_HASH_BITS));
+}
+
+// Call with GlobalData.Lock held for write.
+static VOID
+tapAdapterHashInsert(
+    __in PTAP_ADAPTER_CONTEXT       Adapter,
+    __in PTAP_ADAPTER_HASH_ENTRY    Entry,
+    __in PDEVICE_OBJECT             DeviceObject
+    )
+{
+    if(DeviceObject == NULL)
+    {
+        // No diag device.
+        return;
+    }
+
+    Entry->DeviceObject = DeviceObject;
+    Entry->Adapter = Adapter;
+
+    InsertTailList(
+        &GlobalData.AdapterHash[tapAdapterHashDeviceObject(DeviceObject)],
+        &Entry->Link
+        );
+}
+
 VOID
 tapAdapterContextAddToGlobalList(
     __in PTAP_ADAPTER_CONTEXT       Adapter
@@ -481,6 +577,10 @@ tapAdapterContextAddToGlobalList(
     // Add the adapter context to the global list.
     InsertTailList(&GlobalData.AdapterList,&Adapter->AdapterListLink);
 
+    // And index it for tapAdapterContextFromDeviceObject.
+    tapAdapterHashInsert(Adapter, &Adapter->DeviceHashEntry, Adapter->DeviceObject);
+    tapAdapterHashInsert(Adapter, &Adapter->DiagDeviceHashEntry, Adapter->DiagDeviceObject);
+
     // Release global adapter list lock.
     NdisReleaseRWLock(GlobalData.Lock, &lockState);
 }
@@ -505,6 +605,12 @@ tapAdapterContextRemoveFromGlobalList(
     // Safe for multiple removes.
     NdisInitializeListHead(&Adapter->AdapterListLink);
 
+    RemoveEntryList(&Adapter->DeviceHashEntry.Link);
+    NdisInitializeListHead(&Adapter->DeviceHashEntry.Link);
+
+    RemoveEntryList(&Adapter->DiagDeviceHashEntry.Link);
+    NdisInitializeListHead(&Adapter->DiagDeviceHashEntry.Link);
+
     // Remove reference added in tapAdapterContextAddToGlobalList.
     tapAdapterContextDereference(Adapter);
 
@@ -519,6 +625,8 @@ tapAdapterContextFromDeviceObject(
     )
 {
     LOCK_STATE_EX           lockState;
+    PLIST_ENTRY             bucket;
+    PLIST_ENTRY             entry;
 
     if(DeviceObject == NULL)
     {
@@ -533,30 +641,24 @@ tapAdapterContextFromDeviceObject(
         0
         );
 
-    if (!IsListEmpty(&GlobalData.AdapterList))
+    bucket = &GlobalData.AdapterHash[tapAdapterHashDeviceObject(DeviceObject)];
+
+    for(entry = bucket->Flink; entry != bucket; entry = entry->Flink)
     {
-        PLIST_ENTRY             entry = GlobalData.AdapterList.Flink;
-        PTAP_ADAPTER_CONTEXT    adapter;
+        PTAP_ADAPTER_HASH_ENTRY hashEntry;
 
-        while (entry != &GlobalData.AdapterList)
-        {
-            adapter = CONTAINING_RECORD(entry, TAP_ADAPTER_CONTEXT, AdapterListLink);
+        hashEntry = CONTAINING_RECORD(entry, TAP_ADAPTER_HASH_ENTRY, Link);
 
-            // Match on DeviceObject or DiagDeviceObject
-            if(adapter->DeviceObject == DeviceObject ||
-               adapter->DiagDeviceObject == DeviceObject)
-            {
-                // Add reference to adapter context.
-                tapAdapterContextReference(adapter);
+        // Keyed by either the DeviceObject or the DiagDeviceObject
+        if(hashEntry->DeviceObject == DeviceObject)
+        {
+            // Add reference to adapter context.
+            tapAdapterContextReference(hashEntry->Adapter);
 
-                // Release global adapter list lock.
-                NdisReleaseRWLock(GlobalData.Lock,&lockState);
+            // Release global adapter list lock.
+            NdisReleaseRWLock(GlobalData.Lock,&lockState);
 
-                return adapter;
-            }
-
-            // Move to next entry
-            entry = entry->Flink;
+            return hashEntry->Adapter;
         }
     }
 
@@ -1089,8 +1191,10 @@ Return Value:
     // that have been indicated to the host but have not yet been
     // returned.
     //
-    // Wait here for all in-flight receive indications to be returned.
+    // Wait here for all in-flight receive indications to be returned,
+    // after letting a running injection DPC finish its indication.
     //
+    tapInjectQueueFlush(adapter);
     tapWaitForReceiveNblInFlightCountZeroEvent(adapter);
 
     //
@@ -1232,7 +1336,7 @@ Return Value:
         return FALSE;
     }
 
-    if(Adapter->TapFileObject == NULL)
+    if(Adapter->ActiveQueueCount == 0)
     {
         // TAP application file object not open.
         return FALSE;
@@ -1575,11 +1679,14 @@ tapAdapterContextFree(
     )
 {
     PLIST_ENTRY listEntry = &Adapter->AdapterListLink;
+    ULONG       i;
 
     DEBUGP (("[TAP] --> tapAdapterContextFree\n"));
 
     // Adapter context should already be removed.
     ASSERT( (listEntry->Flink == listEntry) && (listEntry->Blink == listEntry ) );
+    ASSERT(IsListEmpty(&Adapter->DeviceHashEntry.Link));
+    ASSERT(IsListEmpty(&Adapter->DiagDeviceHashEntry.Link));
 
     // Insure that adapter context has been removed from global adapter list.
     RemoveEntryList(&Adapter->AdapterListLink);
@@ -1595,6 +1702,14 @@ tapAdapterContextFree(
 
     Adapter->NetCfgInstanceIdAnsi.Buffer = NULL;
 
+    // Free anything left on the injection queue. This also waits out
+    // any read coalescing DPC; the timers were cancelled when the TAP
+    // device was destroyed.
+    tapInjectQueueFlush(Adapter);
+
+    // Free the TUN write header MDLs.
+    tapHeaderMdlCacheFree(Adapter);
+
     // Free the receive NBL pool.
     if(Adapter->ReceiveNblPool != NULL )
     {
@@ -1604,7 +1719,41 @@ tapAdapterContextFree(
     Adapter->ReceiveNblPool = NULL;
 
     // Flow control related
-    ASSERT(Adapter->FlowControlList == NULL);
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        ASSERT(Adapter->Queues[i].FlowControlList == NULL);
+    }
+
+    // Free the capture ring, if any.
+    tapCaptureFree(&Adapter->Capture);
+
+    // Free the DHCP address pool, if any.
+    tapDhcpPoolConfigure(Adapter, 0, 0);
+
+    // Free the proxy ARP table, if any.
+    tapProxyArpConfigure(Adapter, 0, NULL, 0);
+    tapNdProxyConfigure(Adapter, NULL, 0);
+
+    // Free any attached filters.
+    tapAdapterFreeFilters(Adapter);
+
+    // Free the stage statistics and latency histograms, if they were
+    // ever enabled.
+    tapStageStatsFree(&Adapter->StageStats);
+    tapLatencyStatsFree(&Adapter->Latency);
+
+    tapDropStatsFree(&Adapter->DropStats);
+
+    tapStatsPageFree(Adapter);
+
+    tapMetricsFree(Adapter);
+
+    if(Adapter->FilterLock != NULL)
+    {
+        NdisFreeRWLock(Adapter->FilterLock);
+    }
+
+    Adapter->FilterLock = NULL;
 
     NdisFreeMemory(Adapter,0,0);
 
@@ -1814,7 +1963,24 @@ tapAdapterAcquireLock(
     __in    BOOLEAN                 DispatchLevel
     )
 {
+    PTAP_LOCK_STAT  stat = &Adapter->LockStats[TAP_WIN_LOCK_ADAPTER];
+
     ASSERT(!DispatchLevel || (DISPATCH_LEVEL == KeGetCurrentIrql()));
+
+    if (stat->Enabled)
+    {
+        KIRQL   irql = DISPATCH_LEVEL;
+
+        // Same as NdisAcquireSpinLock, but timed.
+        if (!DispatchLevel)
+        {
+            KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        }
+
+        Adapter->AdapterLockAcquiredAt = tapLockStatAcquire(&Adapter->AdapterLock.SpinLock, stat);
+        Adapter->AdapterLockIrql = irql;
+        return;
+    }
    
     if (DispatchLevel)
     {
@@ -1824,6 +1990,8 @@ tapAdapterAcquireLock(
     {
         NdisAcquireSpinLock(&Adapter->AdapterLock);
     }
+
+    Adapter->AdapterLockAcquiredAt = 0;
 }
 
 _Requires_lock_held_(Adapter->AdapterLock)
@@ -1837,6 +2005,24 @@ tapAdapterReleaseLock(
     )
 {
     ASSERT(!DispatchLevel || (DISPATCH_LEVEL == KeGetCurrentIrql()));
+
+    if (Adapter->AdapterLockAcquiredAt != 0)
+    {
+        KIRQL   irql = Adapter->AdapterLockIrql;
+
+        tapLockStatRelease(
+            &Adapter->LockStats[TAP_WIN_LOCK_ADAPTER],
+            Adapter->AdapterLockAcquiredAt
+            );
+
+        KeReleaseSpinLockFromDpcLevel(&Adapter->AdapterLock.SpinLock);
+
+        if (!DispatchLevel)
+        {
+            KeLowerIrql(irql);
+        }
+        return;
+    }
    
     if (DispatchLevel)
     {
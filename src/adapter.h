@@ -42,6 +42,20 @@
 #define TAP_RX_NBL_FLAGS_IS_P2P             0x00001000
 #define TAP_RX_NBL_FLAGS_IS_INJECTED        0x00002000
 
+// Prebuilt MDL over one of the TUN mode Ethernet headers, chained in front
+// of the user's payload MDL on writes. NBL MiniportReserved[1] points to
+// the entry while the MDL is in use.
+typedef struct _TAP_HEADER_MDL
+{
+    SLIST_ENTRY                 Link;
+    PMDL                        Mdl;
+    ULONG                       Index;      // TAP_TUN_HEADER_*
+} TAP_HEADER_MDL, *PTAP_HEADER_MDL;
+
+#define TAP_TUN_HEADER_IPV4     0           // m_UserToTap
+#define TAP_TUN_HEADER_IPV6     1           // m_UserToTap_IPv6
+#define TAP_TUN_HEADER_COUNT    2
+
 
 // True iff the given address was assigned by the local administrator
 #define NIC_ADDR_IS_LOCALLY_ADMINISTERED(_addr) \
@@ -81,6 +95,28 @@ enum _TAP_MINIPORT_ADAPTER_STATE
     MiniportRestartingState
 } TAP_MINIPORT_ADAPTER_STATE, *PTAP_MINIPORT_ADAPTER_STATE;
 
+//
+// Read coalescing policy (TAP_WIN_IOCTL_SET_READ_COALESCING). Set without
+// a lock; each pass over a send packet queue works from one copy.
+//
+typedef struct _TAP_READ_COALESCE_POLICY
+{
+    ULONG                           MaxFrames;
+    ULONG                           MaxBytes;
+    ULONG                           Microseconds;
+} TAP_READ_COALESCE_POLICY, *PTAP_READ_COALESCE_POLICY;
+
+//
+// Links an adapter into a GlobalData.AdapterHash bucket under one of its
+// device objects.
+//
+typedef struct _TAP_ADAPTER_HASH_ENTRY
+{
+    LIST_ENTRY                      Link;
+    PDEVICE_OBJECT                  DeviceObject;
+    struct _TAP_ADAPTER_CONTEXT     *Adapter;
+} TAP_ADAPTER_HASH_ENTRY, *PTAP_ADAPTER_HASH_ENTRY;
+
 //
 // Each adapter managed by this driver has a TapAdapter struct.
 // ------------------------------------------------------------
@@ -91,11 +127,35 @@ typedef struct _TAP_ADAPTER_CONTEXT
 {
     LIST_ENTRY                  AdapterListLink;
 
+    // Under GlobalData.Lock, while in AdapterListLink.
+    TAP_ADAPTER_HASH_ENTRY      DeviceHashEntry;
+    TAP_ADAPTER_HASH_ENTRY      DiagDeviceHashEntry;
+
     volatile LONG               RefCount;
 
     NDIS_HANDLE                 MiniportAdapterHandle;
 
     NDIS_SPIN_LOCK              AdapterLock;    // Lock for protection of state and outstanding sends and recvs
+    ULONG64                     AdapterLockAcquiredAt;
+    KIRQL                       AdapterLockIrql;    // To restore, when AdapterLockAcquiredAt != 0
+
+    // Lock statistics, indexed by TAP_WIN_LOCK_*.
+    TAP_LOCK_STAT               LockStats[TAP_WIN_LOCK_COUNT];
+
+    // Sampled per-stage cycle counts of the data paths.
+    TAP_STAGE_STATS             StageStats;
+
+    // Time frames wait for a read, and time the stack holds indications.
+    TAP_LATENCY_STATS           Latency;
+
+    // Discarded frames, per CPU, indexed by TAP_WIN_DROP_*.
+    TAP_DROP_STATS              DropStats;
+
+    // Statistics page mapped by monitors through the diag device.
+    TAP_STATS_PAGE              StatsPage;
+
+    // TAP_WIN_IOCTL_GET_METRICS requests waiting on the diag device.
+    TAP_METRICS_WAIT_QUEUE      MetricsWait;
 
     //
     // All fields that are protected by the AdapterLock are included
@@ -126,6 +186,7 @@ typedef struct _TAP_ADAPTER_CONTEXT
 
 # define MINIPORT_INSTANCE_ID(a) ((a)->NetCfgInstanceIdAnsi.Buffer)
     ANSI_STRING                 NetCfgInstanceIdAnsi;   // Used occasionally
+    GUID                        NetCfgInstanceGuid;     // Zero if not a GUID
 
     ULONG                       MtuSize;        // 1500 byte (typical)
 
@@ -156,7 +217,6 @@ typedef struct _TAP_ADAPTER_CONTEXT
     PDEVICE_OBJECT              DeviceObject;
     BOOLEAN                     TapDeviceCreated;   // WAS: m_TapIsRunning
 
-    PFILE_OBJECT                TapFileObject;      // Exclusive access
     BOOLEAN                     TapFileIsOpen;      // WAS: m_TapOpens
     LONG                        TapFileOpenCount;   // WAS: m_NumTapOpens
 
@@ -169,17 +229,25 @@ typedef struct _TAP_ADAPTER_CONTEXT
     NDIS_HANDLE                 DiagDeviceHandle;
     PDEVICE_OBJECT              DiagDeviceObject;
 
-    // Cancel-Safe read IRP queue.
-    TAP_IRP_CSQ                 PendingReadIrpQueue;
+    // Per-handle read queues, each holding TAP packets representing host
+    // send NBs until they are read by the user-mode application. Up to
+    // QueueLimit handles may be open, each owning one slot. ActiveQueues
+    // lists the slots of handles not yet cleaned up; transmit hashes flows
+    // over its first ActiveQueueCount entries. Both are changed under
+    // AdapterLock and read without it.
+    TAP_QUEUE                   Queues[TAP_WIN_MAX_QUEUES];
+    ULONG                       QueueLimit;
+    volatile LONG               ActiveQueueCount;
+    UCHAR                       ActiveQueues[TAP_WIN_MAX_QUEUES];
+
+    // Reads return one frame each unless ReadCoalesce.MaxFrames > 1.
+    TAP_READ_COALESCE_POLICY    ReadCoalesce;
 
-    // Queue containing TAP packets representing host send NBs. These are
-    // waiting to be read by user-mode application.
-    TAP_PACKET_QUEUE            SendPacketQueue;
+    // TAP_WIN_TIMESTAMP_* flags (TAP_WIN_IOCTL_SET_TIMESTAMPS).
+    ULONG                       TimestampFlags;
 
-    // Transmit flow control
-    KSPIN_LOCK                  FlowControlLock;
-    PNET_BUFFER_LIST            FlowControlList;
-    BOOLEAN                     FlowControlHasPackets;
+    // Driver-generated frames waiting to be indicated to the host.
+    TAP_INJECT_QUEUE            InjectPacketQueue;
 
     // NBL pool for making TAP receive indications.
     NDIS_HANDLE                 ReceiveNblPool;
@@ -197,6 +265,11 @@ typedef struct _TAP_ADAPTER_CONTEXT
     ETH_HEADER                  m_UserToTap;
     ETH_HEADER                  m_UserToTap_IPv6; // same as UserToTap but proto=ipv6
 
+    // Free header MDLs over m_UserToTap and m_UserToTap_IPv6, so TUN
+    // writes allocate no MDL. Kept next to the headers they describe.
+    SLIST_HEADER                UserToTapMdlList[TAP_TUN_HEADER_COUNT];
+    PTAP_HEADER_MDL             UserToTapMdls;
+
     // Info for DHCP server masquerade
     BOOLEAN                     m_dhcp_enabled;
     IPADDR                      m_dhcp_addr;
@@ -210,6 +283,25 @@ typedef struct _TAP_ADAPTER_CONTEXT
     BOOLEAN                     m_dhcp_received_discover;
     ULONG                       m_dhcp_bad_requests;
 
+    // Prebuilt OFFER, ACK and NAK replies; see BuildDHCPTemplates.
+    // The sequence is 0 until they are first built and odd while they
+    // are rebuilt, which only one thread does at a time, under the lock.
+    KSPIN_LOCK                  m_dhcp_templates_lock;
+    DHCPMsg                     m_dhcp_templates[3];
+    volatile LONG               m_dhcp_templates_sequence;
+
+    // Address pool for other clients; NULL unless pool mode is on.
+    KSPIN_LOCK                  m_dhcp_pool_lock;
+    PTAP_DHCP_POOL              m_dhcp_pool;
+
+    // TAP mode proxy ARP table; NULL unless configured.
+    KSPIN_LOCK                  ProxyArpLock;
+    PTAP_PROXY_ARP              ProxyArp;
+
+    // IPv6 ND proxy table; NULL unless configured.
+    KSPIN_LOCK                  NdProxyLock;
+    PTAP_ND_PROXY               NdProxy;
+
     // Multicast list. Fixed size.
     ULONG                       ulMCListSize;
     UCHAR                       MCList[TAP_MAX_MCAST_LIST][MACADDR_SIZE];
@@ -219,6 +311,16 @@ typedef struct _TAP_ADAPTER_CONTEXT
 
     ULONG                       PriorityBehavior;
 
+    // Frame capture, configured and drained through the diag device.
+    TAP_CAPTURE                 Capture;
+
+    // Classic BPF filters, attached through TAP_WIN_IOCTL_SET_FILTER.
+    // FilterLock is held shared while a program runs and exclusive while
+    // one is replaced.
+    PNDIS_RW_LOCK_EX            FilterLock;
+    PTAP_BPF_PROGRAM            TxFilter;
+    PTAP_BPF_PROGRAM            RxFilter;
+
     //
     // Statistics
     // -------------------------------------------------------------------------
@@ -364,6 +466,35 @@ tapGetNetBufferCountsFromNetBufferList(
     __out_opt PULONG        TotalByteCount      // Of all linked NBs
     );
 
+NTSTATUS
+tapAdapterSetFilter(
+    __in PTAP_ADAPTER_CONTEXT                   Adapter,
+    __in ULONG                                  Direction,
+    __in_ecount(Count) const TAP_WIN_BPF_INSN   *Code,
+    __in ULONG                                  Count
+    );
+
+VOID
+tapAdapterFreeFilters(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+ULONG
+tapAdapterFilterTransmit(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PNET_BUFFER            NetBuffer,
+    __in BOOLEAN                DispatchLevel
+    );
+
+ULONG
+tapAdapterFilterWrite(
+    __in PTAP_ADAPTER_CONTEXT                   Adapter,
+    __in_bcount_opt(PrefixLength) const UCHAR   *Prefix,
+    __in ULONG                                  PrefixLength,
+    __in_bcount(DataLength) const UCHAR         *Data,
+    __in ULONG                                  DataLength
+    );
+
 // Prototypes for standard NDIS miniport entry points
 MINIPORT_SET_OPTIONS                AdapterSetOptions;
 MINIPORT_INITIALIZE                 AdapterCreate;
@@ -0,0 +1,646 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-------------------
+// CLASSIC BPF FILTERS
+//-------------------
+
+#include "tap.h"
+
+//
+// Classic BPF instruction encoding.
+//
+#define BPF_CLASS(code)     ((code) & 0x07)
+#define BPF_LD              0x00
+#define BPF_LDX             0x01
+#define BPF_ST              0x02
+#define BPF_STX             0x03
+#define BPF_ALU             0x04
+#define BPF_JMP             0x05
+#define BPF_RET             0x06
+#define BPF_MISC            0x07
+
+#define BPF_W               0x00
+#define BPF_H               0x08
+#define BPF_B               0x10
+
+#define BPF_IMM             0x00
+#define BPF_ABS             0x20
+#define BPF_IND             0x40
+#define BPF_MEM             0x60
+#define BPF_LEN             0x80
+#define BPF_MSH             0xa0
+
+#define BPF_ADD             0x00
+#define BPF_SUB             0x10
+#define BPF_MUL             0x20
+#define BPF_DIV             0x30
+#define BPF_OR              0x40
+#define BPF_AND             0x50
+#define BPF_LSH             0x60
+#define BPF_RSH             0x70
+#define BPF_NEG             0x80
+#define BPF_MOD             0x90
+#define BPF_XOR             0xa0
+
+#define BPF_JA              0x00
+#define BPF_JEQ             0x10
+#define BPF_JGT             0x20
+#define BPF_JGE             0x30
+#define BPF_JSET            0x40
+
+#define BPF_K               0x00
+#define BPF_X               0x08
+#define BPF_A               0x10
+
+#define BPF_TAX             0x00
+#define BPF_TXA             0x80
+
+#define TAP_BPF_TAG         'BpaT'
+
+NTSTATUS
+tapBpfCompile(
+    __in_ecount(Count) const TAP_WIN_BPF_INSN   *Code,
+    __in ULONG                                  Count,
+    __out PTAP_BPF_PROGRAM                      *Program
+    )
+/*++
+
+Routine Description:
+
+    Verifies a classic BPF program and translates it into the pre-decoded
+    form run by tapBpfRun.
+
+    Verification guarantees that tapBpfRun terminates and never touches
+    memory outside the frame view and scratch words: all jumps are forward
+    and land inside the program, the last instruction returns, scratch
+    memory indexes are in range and constant divisors and shift counts are
+    valid. Packet loads, including the X + k offset of indexed loads, are
+    bounds-checked at run time.
+
+Return Value:
+
+    STATUS_SUCCESS, STATUS_INVALID_PARAMETER or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PTAP_BPF_PROGRAM    program;
+    ULONG               pc;
+
+    *Program = NULL;
+
+    if(Count == 0 || Count > TAP_WIN_FILTER_MAX_INSTRUCTIONS)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    program = (PTAP_BPF_PROGRAM )MemAlloc(TAP_BPF_PROGRAM_SIZE(Count), TRUE);
+
+    if(program == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    program->Count = Count;
+
+    for(pc = 0; pc < Count; ++pc)
+    {
+        const TAP_WIN_BPF_INSN  *code = &Code[pc];
+        PTAP_BPF_INSN           insn = &program->Insns[pc];
+        ULONG                   remaining = Count - pc - 1;
+        BOOLEAN                 valid = TRUE;
+
+        insn->K = code->k;
+        insn->Jt = insn->Jf = pc + 1;
+
+        switch(code->code)
+        {
+        case BPF_RET|BPF_K:             insn->Op = TAP_BPF_OP_RET_K; break;
+        case BPF_RET|BPF_A:             insn->Op = TAP_BPF_OP_RET_A; break;
+
+        case BPF_LD|BPF_W|BPF_ABS:      insn->Op = TAP_BPF_OP_LD_W_ABS; break;
+        case BPF_LD|BPF_H|BPF_ABS:      insn->Op = TAP_BPF_OP_LD_H_ABS; break;
+        case BPF_LD|BPF_B|BPF_ABS:      insn->Op = TAP_BPF_OP_LD_B_ABS; break;
+        case BPF_LD|BPF_W|BPF_IND:      insn->Op = TAP_BPF_OP_LD_W_IND; break;
+        case BPF_LD|BPF_H|BPF_IND:      insn->Op = TAP_BPF_OP_LD_H_IND; break;
+        case BPF_LD|BPF_B|BPF_IND:      insn->Op = TAP_BPF_OP_LD_B_IND; break;
+        case BPF_LD|BPF_W|BPF_LEN:      insn->Op = TAP_BPF_OP_LD_W_LEN; break;
+        case BPF_LD|BPF_IMM:            insn->Op = TAP_BPF_OP_LD_IMM; break;
+        case BPF_LDX|BPF_W|BPF_IMM:     insn->Op = TAP_BPF_OP_LDX_IMM; break;
+        case BPF_LDX|BPF_W|BPF_LEN:     insn->Op = TAP_BPF_OP_LDX_LEN; break;
+        case BPF_LDX|BPF_B|BPF_MSH:     insn->Op = TAP_BPF_OP_LDX_MSH; break;
+
+        case BPF_LD|BPF_MEM:            insn->Op = TAP_BPF_OP_LD_MEM; valid = code->k < TAP_BPF_MEMWORDS; break;
+        case BPF_LDX|BPF_W|BPF_MEM:     insn->Op = TAP_BPF_OP_LDX_MEM; valid = code->k < TAP_BPF_MEMWORDS; break;
+        case BPF_ST:                    insn->Op = TAP_BPF_OP_ST; valid = code->k < TAP_BPF_MEMWORDS; break;
+        case BPF_STX:                   insn->Op = TAP_BPF_OP_STX; valid = code->k < TAP_BPF_MEMWORDS; break;
+
+        case BPF_ALU|BPF_ADD|BPF_K:     insn->Op = TAP_BPF_OP_ADD_K; break;
+        case BPF_ALU|BPF_SUB|BPF_K:     insn->Op = TAP_BPF_OP_SUB_K; break;
+        case BPF_ALU|BPF_MUL|BPF_K:     insn->Op = TAP_BPF_OP_MUL_K; break;
+        case BPF_ALU|BPF_DIV|BPF_K:     insn->Op = TAP_BPF_OP_DIV_K; valid = code->k != 0; break;
+        case BPF_ALU|BPF_MOD|BPF_K:     insn->Op = TAP_BPF_OP_MOD_K; valid = code->k != 0; break;
+        case BPF_ALU|BPF_AND|BPF_K:     insn->Op = TAP_BPF_OP_AND_K; break;
+        case BPF_ALU|BPF_OR|BPF_K:      insn->Op = TAP_BPF_OP_OR_K; break;
+        case BPF_ALU|BPF_XOR|BPF_K:     insn->Op = TAP_BPF_OP_XOR_K; break;
+        case BPF_ALU|BPF_LSH|BPF_K:     insn->Op = TAP_BPF_OP_LSH_K; valid = code->k < 32; break;
+        case BPF_ALU|BPF_RSH|BPF_K:     insn->Op = TAP_BPF_OP_RSH_K; valid = code->k < 32; break;
+        case BPF_ALU|BPF_ADD|BPF_X:     insn->Op = TAP_BPF_OP_ADD_X; break;
+        case BPF_ALU|BPF_SUB|BPF_X:     insn->Op = TAP_BPF_OP_SUB_X; break;
+        case BPF_ALU|BPF_MUL|BPF_X:     insn->Op = TAP_BPF_OP_MUL_X; break;
+        case BPF_ALU|BPF_DIV|BPF_X:     insn->Op = TAP_BPF_OP_DIV_X; break;
+        case BPF_ALU|BPF_MOD|BPF_X:     insn->Op = TAP_BPF_OP_MOD_X; break;
+        case BPF_ALU|BPF_AND|BPF_X:     insn->Op = TAP_BPF_OP_AND_X; break;
+        case BPF_ALU|BPF_OR|BPF_X:      insn->Op = TAP_BPF_OP_OR_X; break;
+        case BPF_ALU|BPF_XOR|BPF_X:     insn->Op = TAP_BPF_OP_XOR_X; break;
+        case BPF_ALU|BPF_LSH|BPF_X:     insn->Op = TAP_BPF_OP_LSH_X; break;
+        case BPF_ALU|BPF_RSH|BPF_X:     insn->Op = TAP_BPF_OP_RSH_X; break;
+        case BPF_ALU|BPF_NEG:           insn->Op = TAP_BPF_OP_NEG; break;
+
+        case BPF_JMP|BPF_JA:
+            insn->Op = TAP_BPF_OP_JA;
+            valid = code->k < remaining;
+            insn->Jt = insn->Jf = pc + 1 + code->k;
+            break;
+
+        case BPF_JMP|BPF_JEQ|BPF_K:     insn->Op = TAP_BPF_OP_JEQ_K; goto conditional;
+        case BPF_JMP|BPF_JGT|BPF_K:     insn->Op = TAP_BPF_OP_JGT_K; goto conditional;
+        case BPF_JMP|BPF_JGE|BPF_K:     insn->Op = TAP_BPF_OP_JGE_K; goto conditional;
+        case BPF_JMP|BPF_JSET|BPF_K:    insn->Op = TAP_BPF_OP_JSET_K; goto conditional;
+        case BPF_JMP|BPF_JEQ|BPF_X:     insn->Op = TAP_BPF_OP_JEQ_X; goto conditional;
+        case BPF_JMP|BPF_JGT|BPF_X:     insn->Op = TAP_BPF_OP_JGT_X; goto conditional;
+        case BPF_JMP|BPF_JGE|BPF_X:     insn->Op = TAP_BPF_OP_JGE_X; goto conditional;
+        case BPF_JMP|BPF_JSET|BPF_X:    insn->Op = TAP_BPF_OP_JSET_X; goto conditional;
+conditional:
+            valid = code->jt < remaining && code->jf < remaining;
+            insn->Jt = pc + 1 + code->jt;
+            insn->Jf = pc + 1 + code->jf;
+            break;
+
+        case BPF_MISC|BPF_TAX:          insn->Op = TAP_BPF_OP_TAX; break;
+        case BPF_MISC|BPF_TXA:          insn->Op = TAP_BPF_OP_TXA; break;
+
+        default:
+            valid = FALSE;
+            break;
+        }
+
+        if(!valid)
+        {
+            DEBUGP (("[TAP] tapBpfCompile: Invalid instruction %d, code 0x%x\n",
+                pc, code->code));
+
+            tapBpfFree(program);
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    // Every path must end in a return; with forward-only jumps it is enough
+    // that the last instruction is one.
+    if(program->Insns[Count - 1].Op != TAP_BPF_OP_RET_K
+        && program->Insns[Count - 1].Op != TAP_BPF_OP_RET_A)
+    {
+        tapBpfFree(program);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Program = program;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapBpfFree(
+    __in PTAP_BPF_PROGRAM   Program
+    )
+{
+    MemFree(Program, TAP_BPF_PROGRAM_SIZE(Program->Count));
+}
+
+//
+// Packet load bounds. A load inside the view proceeds. A load past the view
+// but inside the frame cannot be evaluated, so the whole frame is accepted.
+// A load past the end of the frame rejects it, as in classic BPF, and so
+// does an indexed load whose offset X + k wraps around.
+//
+#define TAP_BPF_IN_VIEW(offset, size) \
+    ((offset) <= ViewLength && (size) <= ViewLength - (offset))
+
+#define TAP_BPF_LOAD_FAILED(offset, size) \
+    (((offset) <= WireLength && (size) <= WireLength - (offset)) ? WireLength : 0)
+
+ULONG
+tapBpfRun(
+    __in const TAP_BPF_PROGRAM              *Program,
+    __in_bcount(ViewLength) const UCHAR     *Frame,
+    __in ULONG                              ViewLength,
+    __in ULONG                              WireLength
+    )
+/*++
+
+Routine Description:
+
+    Runs a verified program over a frame. Frame holds the first ViewLength
+    bytes of a WireLength byte frame.
+
+Return Value:
+
+    The classic BPF result: 0 to drop the frame, otherwise the number of
+    leading bytes to keep.
+
+--*/
+{
+    const TAP_BPF_INSN  *insn;
+    ULONG               pc = 0;
+    ULONG               A = 0;
+    ULONG               X = 0;
+    ULONG               k;
+    ULONG               mem[TAP_BPF_MEMWORDS];
+
+    // The verifier does not track initialization of scratch memory.
+    NdisZeroMemory(mem, sizeof(mem));
+
+    for(;;)
+    {
+        insn = &Program->Insns[pc++];
+
+        switch(insn->Op)
+        {
+        case TAP_BPF_OP_RET_K:
+            return insn->K;
+
+        case TAP_BPF_OP_RET_A:
+            return A;
+
+        case TAP_BPF_OP_LD_W_ABS:
+            k = insn->K;
+            goto load_word;
+
+        case TAP_BPF_OP_LD_W_IND:
+            if(X > MAXULONG - insn->K)
+            {
+                return 0;
+            }
+            k = X + insn->K;
+load_word:
+            if(!TAP_BPF_IN_VIEW(k, 4))
+            {
+                return TAP_BPF_LOAD_FAILED(k, 4);
+            }
+            A = ((ULONG )Frame[k] << 24) | ((ULONG )Frame[k + 1] << 16)
+                | ((ULONG )Frame[k + 2] << 8) | Frame[k + 3];
+            break;
+
+        case TAP_BPF_OP_LD_H_ABS:
+            k = insn->K;
+            goto load_half;
+
+        case TAP_BPF_OP_LD_H_IND:
+            if(X > MAXULONG - insn->K)
+            {
+                return 0;
+            }
+            k = X + insn->K;
+load_half:
+            if(!TAP_BPF_IN_VIEW(k, 2))
+            {
+                return TAP_BPF_LOAD_FAILED(k, 2);
+            }
+            A = ((ULONG )Frame[k] << 8) | Frame[k + 1];
+            break;
+
+        case TAP_BPF_OP_LD_B_ABS:
+            k = insn->K;
+            goto load_byte;
+
+        case TAP_BPF_OP_LD_B_IND:
+            if(X > MAXULONG - insn->K)
+            {
+                return 0;
+            }
+            k = X + insn->K;
+load_byte:
+            if(!TAP_BPF_IN_VIEW(k, 1))
+            {
+                return TAP_BPF_LOAD_FAILED(k, 1);
+            }
+            A = Frame[k];
+            break;
+
+        case TAP_BPF_OP_LDX_MSH:
+            k = insn->K;
+            if(!TAP_BPF_IN_VIEW(k, 1))
+            {
+                return TAP_BPF_LOAD_FAILED(k, 1);
+            }
+            X = (Frame[k] & 0x0F) << 2;
+            break;
+
+        case TAP_BPF_OP_LD_W_LEN:   A = WireLength; break;
+        case TAP_BPF_OP_LD_IMM:     A = insn->K; break;
+        case TAP_BPF_OP_LD_MEM:     A = mem[insn->K]; break;
+        case TAP_BPF_OP_LDX_IMM:    X = insn->K; break;
+        case TAP_BPF_OP_LDX_MEM:    X = mem[insn->K]; break;
+        case TAP_BPF_OP_LDX_LEN:    X = WireLength; break;
+        case TAP_BPF_OP_ST:         mem[insn->K] = A; break;
+        case TAP_BPF_OP_STX:        mem[insn->K] = X; break;
+
+        case TAP_BPF_OP_ADD_K:      A += insn->K; break;
+        case TAP_BPF_OP_SUB_K:      A -= insn->K; break;
+        case TAP_BPF_OP_MUL_K:      A *= insn->K; break;
+        case TAP_BPF_OP_DIV_K:      A /= insn->K; break;
+        case TAP_BPF_OP_MOD_K:      A %= insn->K; break;
+        case TAP_BPF_OP_AND_K:      A &= insn->K; break;
+        case TAP_BPF_OP_OR_K:       A |= insn->K; break;
+        case TAP_BPF_OP_XOR_K:      A ^= insn->K; break;
+        case TAP_BPF_OP_LSH_K:      A <<= insn->K; break;
+        case TAP_BPF_OP_RSH_K:      A >>= insn->K; break;
+        case TAP_BPF_OP_ADD_X:      A += X; break;
+        case TAP_BPF_OP_SUB_X:      A -= X; break;
+        case TAP_BPF_OP_MUL_X:      A *= X; break;
+        case TAP_BPF_OP_AND_X:      A &= X; break;
+        case TAP_BPF_OP_OR_X:       A |= X; break;
+        case TAP_BPF_OP_XOR_X:      A ^= X; break;
+        case TAP_BPF_OP_LSH_X:      A = (X < 32) ? A << X : 0; break;
+        case TAP_BPF_OP_RSH_X:      A = (X < 32) ? A >> X : 0; break;
+        case TAP_BPF_OP_NEG:        A = (ULONG )(-(LONG )A); break;
+
+        case TAP_BPF_OP_DIV_X:
+            if(X == 0)
+            {
+                return 0;
+            }
+            A /= X;
+            break;
+
+        case TAP_BPF_OP_MOD_X:
+            if(X == 0)
+            {
+                return 0;
+            }
+            A %= X;
+            break;
+
+        case TAP_BPF_OP_JA:         pc = insn->Jt; break;
+        case TAP_BPF_OP_JEQ_K:      pc = (A == insn->K) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JGT_K:      pc = (A > insn->K) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JGE_K:      pc = (A >= insn->K) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JSET_K:     pc = (A & insn->K) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JEQ_X:      pc = (A == X) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JGT_X:      pc = (A > X) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JGE_X:      pc = (A >= X) ? insn->Jt : insn->Jf; break;
+        case TAP_BPF_OP_JSET_X:     pc = (A & X) ? insn->Jt : insn->Jf; break;
+
+        case TAP_BPF_OP_TAX:        X = A; break;
+        case TAP_BPF_OP_TXA:        A = X; break;
+
+        default:
+            // Not reachable for a verified program.
+            ASSERT(FALSE);
+            return 0;
+        }
+    }
+}
+
+//======================================================================
+// Adapter filter attachment
+//======================================================================
+
+NTSTATUS
+tapAdapterSetFilter(
+    __in PTAP_ADAPTER_CONTEXT                   Adapter,
+    __in ULONG                                  Direction,
+    __in_ecount(Count) const TAP_WIN_BPF_INSN   *Code,
+    __in ULONG                                  Count
+    )
+/*++
+
+Routine Description:
+
+    Attaches a program to one direction, replacing and freeing any program
+    already attached. A Count of zero detaches.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_BPF_PROGRAM    program = NULL;
+    PTAP_BPF_PROGRAM    oldProgram;
+    PTAP_BPF_PROGRAM    *slot;
+    LOCK_STATE_EX       lockState;
+    NTSTATUS            status;
+
+    switch(Direction)
+    {
+    case TAP_WIN_FILTER_TX:
+        slot = &Adapter->TxFilter;
+        break;
+
+    case TAP_WIN_FILTER_RX:
+        slot = &Adapter->RxFilter;
+        break;
+
+    default:
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if(Count > 0)
+    {
+        status = tapBpfCompile(Code, Count, &program);
+
+        if(!NT_SUCCESS(status))
+        {
+            return status;
+        }
+    }
+
+    // The write lock waits out any data path still running the old program.
+    NdisAcquireRWLockWrite(Adapter->FilterLock, &lockState, 0);
+
+    oldProgram = *slot;
+    *slot = program;
+
+    NdisReleaseRWLock(Adapter->FilterLock, &lockState);
+
+    if(oldProgram != NULL)
+    {
+        tapBpfFree(oldProgram);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapAdapterFreeFilters(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    if(Adapter->TxFilter != NULL)
+    {
+        tapBpfFree(Adapter->TxFilter);
+        Adapter->TxFilter = NULL;
+    }
+
+    if(Adapter->RxFilter != NULL)
+    {
+        tapBpfFree(Adapter->RxFilter);
+        Adapter->RxFilter = NULL;
+    }
+}
+
+static ULONG
+tapAdapterRunFilter(
+    __in PTAP_ADAPTER_CONTEXT               Adapter,
+    __in PTAP_BPF_PROGRAM                   *Slot,
+    __in_bcount(ViewLength) const UCHAR     *Frame,
+    __in ULONG                              ViewLength,
+    __in ULONG                              WireLength,
+    __in BOOLEAN                            DispatchLevel
+    )
+{
+    LOCK_STATE_EX       lockState;
+    ULONG               accepted = WireLength;
+
+    NdisAcquireRWLockRead(
+        Adapter->FilterLock,
+        &lockState,
+        DispatchLevel ? NDIS_RWL_AT_DISPATCH_LEVEL : 0
+        );
+
+    if(*Slot != NULL)
+    {
+        accepted = tapBpfRun(*Slot, Frame, ViewLength, WireLength);
+    }
+
+    NdisReleaseRWLock(Adapter->FilterLock, &lockState);
+
+    return min(accepted, WireLength);
+}
+
+ULONG
+tapAdapterFilterTransmit(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PNET_BUFFER            NetBuffer,
+    __in BOOLEAN                DispatchLevel
+    )
+/*++
+
+Routine Description:
+
+    Runs the transmit filter over a net buffer before it is copied.
+
+Return Value:
+
+    Number of leading bytes to keep; zero drops the frame.
+
+--*/
+{
+    UCHAR       storage[TAP_BPF_MAX_SCAN];
+    ULONG       length = NET_BUFFER_DATA_LENGTH(NetBuffer);
+    ULONG       viewLength = length;
+    PUCHAR      view;
+
+    // Use the frame in place if it is contiguous, else gather its head.
+    view = (PUCHAR )NdisGetDataBuffer(NetBuffer, length, NULL, 1, 0);
+
+    if(view == NULL)
+    {
+        viewLength = min(length, TAP_BPF_MAX_SCAN);
+        view = (PUCHAR )NdisGetDataBuffer(NetBuffer, viewLength, storage, 1, 0);
+
+        if(view == NULL)
+        {
+            // Cannot be inspected; let the normal path deal with it.
+            return length;
+        }
+    }
+
+    return tapAdapterRunFilter(
+                Adapter,
+                &Adapter->TxFilter,
+                view,
+                viewLength,
+                length,
+                DispatchLevel
+                );
+}
+
+ULONG
+tapAdapterFilterWrite(
+    __in PTAP_ADAPTER_CONTEXT                   Adapter,
+    __in_bcount_opt(PrefixLength) const UCHAR   *Prefix,
+    __in ULONG                                  PrefixLength,
+    __in_bcount(DataLength) const UCHAR         *Data,
+    __in ULONG                                  DataLength
+    )
+/*++
+
+Routine Description:
+
+    Runs the receive filter over a frame written by the TAP handle, given as
+    an optional prefix (the TUN mode Ethernet header) followed by data.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Return Value:
+
+    Number of leading bytes of prefix and data to keep; zero drops the frame.
+
+--*/
+{
+    UCHAR       storage[TAP_BPF_MAX_SCAN];
+    ULONG       viewLength;
+
+    if(PrefixLength == 0)
+    {
+        return tapAdapterRunFilter(
+                    Adapter,
+                    &Adapter->RxFilter,
+                    Data,
+                    DataLength,
+                    DataLength,
+                    FALSE
+                    );
+    }
+
+    viewLength = min(PrefixLength, TAP_BPF_MAX_SCAN);
+    NdisMoveMemory(storage, Prefix, viewLength);
+
+    if(viewLength < TAP_BPF_MAX_SCAN)
+    {
+        ULONG more = min(DataLength, TAP_BPF_MAX_SCAN - viewLength);
+
+        NdisMoveMemory(storage + viewLength, Data, more);
+        viewLength += more;
+    }
+
+    return tapAdapterRunFilter(
+                Adapter,
+                &Adapter->RxFilter,
+                storage,
+                viewLength,
+                PrefixLength + DataLength,
+                FALSE
+                );
+}
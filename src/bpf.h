@@ -0,0 +1,138 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_BPF_H_
+#define __TAP_BPF_H_
+
+//======================================================================
+// Classic BPF frame filters.
+//
+// Programs supplied through TAP_WIN_IOCTL_SET_FILTER are verified once
+// and translated into TAP_BPF_INSNs: each opcode is mapped to a dense
+// TAP_BPF_OP so the interpreter dispatches through a single switch, and
+// jump offsets are resolved to absolute instruction indexes.
+//======================================================================
+
+#define TAP_BPF_MEMWORDS        16
+
+// Leading bytes of a non-contiguous or prefixed frame gathered for the
+// filter. Loads past this window but inside the frame accept the frame.
+#define TAP_BPF_MAX_SCAN        256
+
+typedef enum _TAP_BPF_OP
+{
+    TAP_BPF_OP_RET_K,
+    TAP_BPF_OP_RET_A,
+
+    TAP_BPF_OP_LD_W_ABS,
+    TAP_BPF_OP_LD_H_ABS,
+    TAP_BPF_OP_LD_B_ABS,
+    TAP_BPF_OP_LD_W_IND,
+    TAP_BPF_OP_LD_H_IND,
+    TAP_BPF_OP_LD_B_IND,
+    TAP_BPF_OP_LD_W_LEN,
+    TAP_BPF_OP_LD_IMM,
+    TAP_BPF_OP_LD_MEM,
+    TAP_BPF_OP_LDX_IMM,
+    TAP_BPF_OP_LDX_MEM,
+    TAP_BPF_OP_LDX_LEN,
+    TAP_BPF_OP_LDX_MSH,
+    TAP_BPF_OP_ST,
+    TAP_BPF_OP_STX,
+
+    TAP_BPF_OP_ADD_K,
+    TAP_BPF_OP_SUB_K,
+    TAP_BPF_OP_MUL_K,
+    TAP_BPF_OP_DIV_K,
+    TAP_BPF_OP_MOD_K,
+    TAP_BPF_OP_AND_K,
+    TAP_BPF_OP_OR_K,
+    TAP_BPF_OP_XOR_K,
+    TAP_BPF_OP_LSH_K,
+    TAP_BPF_OP_RSH_K,
+    TAP_BPF_OP_ADD_X,
+    TAP_BPF_OP_SUB_X,
+    TAP_BPF_OP_MUL_X,
+    TAP_BPF_OP_DIV_X,
+    TAP_BPF_OP_MOD_X,
+    TAP_BPF_OP_AND_X,
+    TAP_BPF_OP_OR_X,
+    TAP_BPF_OP_XOR_X,
+    TAP_BPF_OP_LSH_X,
+    TAP_BPF_OP_RSH_X,
+    TAP_BPF_OP_NEG,
+
+    TAP_BPF_OP_JA,
+    TAP_BPF_OP_JEQ_K,
+    TAP_BPF_OP_JGT_K,
+    TAP_BPF_OP_JGE_K,
+    TAP_BPF_OP_JSET_K,
+    TAP_BPF_OP_JEQ_X,
+    TAP_BPF_OP_JGT_X,
+    TAP_BPF_OP_JGE_X,
+    TAP_BPF_OP_JSET_X,
+
+    TAP_BPF_OP_TAX,
+    TAP_BPF_OP_TXA,
+} TAP_BPF_OP;
+
+typedef struct _TAP_BPF_INSN
+{
+    ULONG           Op;         // TAP_BPF_OP
+    ULONG           K;
+    ULONG           Jt;         // Absolute index of the next instruction if true
+    ULONG           Jf;         // Absolute index of the next instruction if false
+} TAP_BPF_INSN, *PTAP_BPF_INSN;
+
+typedef struct _TAP_BPF_PROGRAM
+{
+    ULONG           Count;
+
+    // Count entries.
+    TAP_BPF_INSN    Insns[];
+} TAP_BPF_PROGRAM, *PTAP_BPF_PROGRAM;
+
+#define TAP_BPF_PROGRAM_SIZE(count) (sizeof(TAP_BPF_PROGRAM) + (count) * sizeof(TAP_BPF_INSN))
+
+NTSTATUS
+tapBpfCompile(
+    __in_ecount(Count) const TAP_WIN_BPF_INSN   *Code,
+    __in ULONG                                  Count,
+    __out PTAP_BPF_PROGRAM                      *Program
+    );
+
+VOID
+tapBpfFree(
+    __in PTAP_BPF_PROGRAM   Program
+    );
+
+ULONG
+tapBpfRun(
+    __in const TAP_BPF_PROGRAM              *Program,
+    __in_bcount(ViewLength) const UCHAR     *Frame,
+    __in ULONG                              ViewLength,
+    __in ULONG                              WireLength
+    );
+
+#endif // __TAP_BPF_H_
@@ -0,0 +1,603 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//---------------
+// FRAME CAPTURE
+//---------------
+
+#include "tap.h"
+
+//
+// pcapng (draft-tuexen-opsawg-pcapng). Blocks are written in host (little
+// endian) byte order and are always a multiple of 4 bytes long.
+//
+#define PCAPNG_SHB_TYPE             0x0A0D0D0A
+#define PCAPNG_IDB_TYPE             0x00000001
+#define PCAPNG_ISB_TYPE             0x00000005
+#define PCAPNG_EPB_TYPE             0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET    1
+
+#define PCAPNG_OPT_ENDOFOPT         0
+#define PCAPNG_OPT_IF_TSRESOL       9
+#define PCAPNG_OPT_EPB_FLAGS        2
+#define PCAPNG_OPT_ISB_IFRECV       4
+#define PCAPNG_OPT_ISB_IFDROP       5
+
+#define PCAPNG_EPB_FLAGS_INBOUND    0x1
+#define PCAPNG_EPB_FLAGS_OUTBOUND   0x2
+
+#define PCAPNG_PAD(len)             (((len) + 3) & ~3)
+
+#define PCAPNG_SHB_LENGTH           28
+#define PCAPNG_IDB_LENGTH           32  // With if_tsresol
+#define PCAPNG_ISB_LENGTH           52  // With isb_ifrecv and isb_ifdrop
+#define PCAPNG_EPB_LENGTH(capLen)   (44 + PCAPNG_PAD(capLen))  // With epb_flags
+
+// 100ns intervals from 1601-01-01 to 1970-01-01.
+#define TAP_CAPTURE_UNIX_EPOCH      116444736000000000LL
+
+VOID
+tapCaptureInitialize(
+    __in PTAP_CAPTURE   Capture
+    )
+{
+    NdisZeroMemory(Capture, sizeof(TAP_CAPTURE));
+    KeInitializeSpinLock(&Capture->Lock);
+}
+
+NTSTATUS
+tapCaptureConfigure(
+    __in PTAP_CAPTURE                   Capture,
+    __in const TAP_WIN_CAPTURE_CONFIG   *Config
+    )
+/*++
+
+Routine Description:
+
+    Stops any capture in progress, discards its ring and, unless
+    Config->Flags is zero, starts a new capture with an empty ring.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PUCHAR      newBuffer = NULL;
+    ULONG       newBufferSize = 0;
+    PUCHAR      oldBuffer;
+    ULONG       oldBufferSize;
+    KIRQL       irql;
+
+    if(Config->Flags & ~(TAP_WIN_CAPTURE_TX | TAP_WIN_CAPTURE_RX))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if(Config->Flags != 0)
+    {
+        newBufferSize = Config->BufferSize;
+
+        if(newBufferSize == 0)
+        {
+            newBufferSize = TAP_CAPTURE_DEFAULT_BUFFER_SIZE;
+        }
+
+        if(newBufferSize < TAP_CAPTURE_MIN_BUFFER_SIZE
+            || newBufferSize > TAP_CAPTURE_MAX_BUFFER_SIZE)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        newBuffer = (PUCHAR )MemAlloc(newBufferSize, FALSE);
+
+        if(newBuffer == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    KeAcquireSpinLock(&Capture->Lock, &irql);
+
+    Capture->Flags = 0;
+
+    oldBuffer = Capture->Buffer;
+    oldBufferSize = Capture->BufferSize;
+
+    Capture->Buffer = newBuffer;
+    Capture->BufferSize = newBufferSize;
+    Capture->Head = 0;
+    Capture->Tail = 0;
+    Capture->Used = 0;
+    Capture->HeaderPending = TRUE;
+    Capture->FramesCaptured = 0;
+    Capture->FramesDropped = 0;
+    Capture->FramesDroppedReported = 0;
+
+    Capture->SnapLength = Config->SnapLength;
+
+    if(Capture->SnapLength == 0 || Capture->SnapLength > TAP_CAPTURE_MAX_SNAP_LENGTH)
+    {
+        Capture->SnapLength = TAP_CAPTURE_MAX_SNAP_LENGTH;
+    }
+
+    Capture->EtherType = Config->EtherType;
+    Capture->IpProtocol = Config->IpProtocol;
+    Capture->Port = Config->Port;
+    Capture->SampleRate = Config->SampleRate;
+    Capture->SampleCount = 0;
+
+    Capture->Flags = Config->Flags;
+
+    KeReleaseSpinLock(&Capture->Lock, irql);
+
+    if(oldBuffer != NULL)
+    {
+        MemFree(oldBuffer, oldBufferSize);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapCaptureFree(
+    __in PTAP_CAPTURE   Capture
+    )
+{
+    Capture->Flags = 0;
+
+    if(Capture->Buffer != NULL)
+    {
+        MemFree(Capture->Buffer, Capture->BufferSize);
+    }
+
+    Capture->Buffer = NULL;
+    Capture->BufferSize = 0;
+}
+
+static BOOLEAN
+tapCaptureMatch(
+    __in PTAP_CAPTURE                   Capture,
+    __in_bcount(Length) const UCHAR     *Frame,
+    __in ULONG                          Length
+    )
+/*++
+
+Routine Description:
+
+    Applies the EtherType, IP protocol and port filter to the leading bytes
+    of a frame. A single 802.1Q tag is skipped. Fields that are zero in the
+    filter match anything.
+
+--*/
+{
+    ULONG   offset = ETHERNET_HEADER_SIZE;
+    USHORT  etherType;
+    UCHAR   ipProtocol;
+    ULONG   portOffset;
+
+    if(Capture->EtherType == 0 && Capture->IpProtocol == 0 && Capture->Port == 0)
+    {
+        return TRUE;
+    }
+
+    if(Length < ETHERNET_HEADER_SIZE)
+    {
+        return FALSE;
+    }
+
+    etherType = ntohs(((const ETH_HEADER *)Frame)->proto);
+
+    if(etherType == ETHERTYPE_8021Q && Length >= ETHERNET_HEADER_SIZE + sizeof(ETH_8021Q_HEADER))
+    {
+        etherType = ntohs(((const ETH_8021Q_HEADER *)(Frame + ETHERNET_HEADER_SIZE))->EtherType);
+        offset += sizeof(ETH_8021Q_HEADER);
+    }
+
+    if(Capture->EtherType != 0 && Capture->EtherType != etherType)
+    {
+        return FALSE;
+    }
+
+    if(Capture->IpProtocol == 0 && Capture->Port == 0)
+    {
+        return TRUE;
+    }
+
+    if(etherType == NDIS_ETH_TYPE_IPV4 && Length >= offset + IP_HEADER_SIZE)
+    {
+        const IPHDR *ip = (const IPHDR *)(Frame + offset);
+
+        ipProtocol = ip->protocol;
+        portOffset = offset + IPH_GET_LEN(ip->version_len);
+    }
+    else if(etherType == NDIS_ETH_TYPE_IPV6 && Length >= offset + IPV6_HEADER_SIZE)
+    {
+        const IPV6HDR *ip6 = (const IPV6HDR *)(Frame + offset);
+
+        // Extension headers are not followed.
+        ipProtocol = ip6->nexthdr;
+        portOffset = offset + IPV6_HEADER_SIZE;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    if(Capture->IpProtocol != 0 && Capture->IpProtocol != ipProtocol)
+    {
+        return FALSE;
+    }
+
+    if(Capture->Port != 0)
+    {
+        USHORT  port = htons(Capture->Port);
+
+        if(ipProtocol != IPPROTO_TCP && ipProtocol != IPPROTO_UDP)
+        {
+            return FALSE;
+        }
+
+        // Source and destination ports lead both TCP and UDP headers.
+        if(Length < portOffset + 2 * sizeof(USHORT))
+        {
+            return FALSE;
+        }
+
+        if(*(UNALIGNED USHORT *)(Frame + portOffset) != port
+            && *(UNALIGNED USHORT *)(Frame + portOffset + sizeof(USHORT)) != port)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+tapCaptureSample(
+    __in PTAP_CAPTURE   Capture
+    )
+// Returns TRUE for every SampleRate'th matching frame. Call with Lock held.
+{
+    if(Capture->SampleRate <= 1)
+    {
+        return TRUE;
+    }
+
+    if(++Capture->SampleCount < Capture->SampleRate)
+    {
+        return FALSE;
+    }
+
+    Capture->SampleCount = 0;
+
+    return TRUE;
+}
+
+static VOID
+tapCaptureRingWrite(
+    __in PTAP_CAPTURE                   Capture,
+    __in_bcount(Length) const VOID      *Source,
+    __in ULONG                          Length
+    )
+// Appends Length bytes at Head, wrapping if needed. Caller checked space.
+{
+    ULONG   first = min(Length, Capture->BufferSize - Capture->Head);
+
+    NdisMoveMemory(Capture->Buffer + Capture->Head, Source, first);
+
+    if(first < Length)
+    {
+        NdisMoveMemory(Capture->Buffer, (const UCHAR *)Source + first, Length - first);
+    }
+
+    Capture->Head = (Capture->Head + Length) % Capture->BufferSize;
+    Capture->Used += Length;
+}
+
+static VOID
+tapCaptureRingPeek(
+    __in PTAP_CAPTURE                   Capture,
+    __in ULONG                          Offset,
+    __out_bcount(Length) VOID           *Destination,
+    __in ULONG                          Length
+    )
+// Copies Length bytes starting Offset bytes past Tail, without consuming.
+{
+    ULONG   start = (Capture->Tail + Offset) % Capture->BufferSize;
+    ULONG   first = min(Length, Capture->BufferSize - start);
+
+    NdisMoveMemory(Destination, Capture->Buffer + start, first);
+
+    if(first < Length)
+    {
+        NdisMoveMemory((PUCHAR )Destination + first, Capture->Buffer, Length - first);
+    }
+}
+
+VOID
+tapCaptureFrame(
+    __in PTAP_CAPTURE                   Capture,
+    __in ULONG                          Direction,
+    __in_bcount_opt(PrefixLength) PUCHAR Prefix,
+    __in ULONG                          PrefixLength,
+    __in_bcount(DataLength) PUCHAR      Data,
+    __in ULONG                          DataLength
+    )
+/*++
+
+Routine Description:
+
+    Records one frame, given as an optional prefix (the TUN mode Ethernet
+    header) followed by data, if it passes the capture filter.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+--*/
+{
+    TAP_CAPTURE_RECORD  record;
+    UCHAR               filterBytes[TAP_CAPTURE_FILTER_BYTES];
+    const UCHAR         *filterFrame;
+    ULONG               filterLength;
+    ULONG               capturedLength;
+    KIRQL               irql;
+
+    //
+    // Gather the leading bytes of the frame for the filter. Only the TUN
+    // path supplies a prefix, so the common case avoids the copy.
+    //
+    if(PrefixLength == 0)
+    {
+        filterFrame = Data;
+        filterLength = DataLength;
+    }
+    else
+    {
+        filterLength = min(PrefixLength, sizeof(filterBytes));
+        NdisMoveMemory(filterBytes, Prefix, filterLength);
+
+        if(filterLength < sizeof(filterBytes))
+        {
+            ULONG more = min(DataLength, sizeof(filterBytes) - filterLength);
+
+            NdisMoveMemory(filterBytes + filterLength, Data, more);
+            filterLength += more;
+        }
+
+        filterFrame = filterBytes;
+    }
+
+    KeAcquireSpinLock(&Capture->Lock, &irql);
+
+    if((Capture->Flags & Direction) && Capture->Buffer != NULL
+        && tapCaptureMatch(Capture, filterFrame, filterLength)
+        && tapCaptureSample(Capture))
+    {
+        record.OriginalLength = PrefixLength + DataLength;
+        capturedLength = min(record.OriginalLength, Capture->SnapLength);
+
+        if(Capture->BufferSize - Capture->Used >= sizeof(TAP_CAPTURE_RECORD) + capturedLength)
+        {
+            KeQuerySystemTime((PLARGE_INTEGER )&record.Timestamp);
+            record.CapturedLength = (USHORT )capturedLength;
+            record.Direction = (UCHAR )Direction;
+            record.Reserved = 0;
+
+            tapCaptureRingWrite(Capture, &record, sizeof(TAP_CAPTURE_RECORD));
+
+            if(capturedLength <= PrefixLength)
+            {
+                tapCaptureRingWrite(Capture, Prefix, capturedLength);
+            }
+            else
+            {
+                if(PrefixLength > 0)
+                {
+                    tapCaptureRingWrite(Capture, Prefix, PrefixLength);
+                }
+
+                tapCaptureRingWrite(Capture, Data, capturedLength - PrefixLength);
+            }
+
+            ++Capture->FramesCaptured;
+        }
+        else
+        {
+            ++Capture->FramesDropped;
+        }
+    }
+
+    KeReleaseSpinLock(&Capture->Lock, irql);
+}
+
+static PUCHAR
+tapCapturePutUlong(
+    __in PUCHAR     Buffer,
+    __in ULONG      Value
+    )
+{
+    *(UNALIGNED ULONG *)Buffer = Value;
+    return Buffer + sizeof(ULONG);
+}
+
+static PUCHAR
+tapCapturePutTimestamp(
+    __in PUCHAR     Buffer,
+    __in LONGLONG   SystemTime
+    )
+// pcapng timestamps are high word first, in if_tsresol units since 1970.
+{
+    ULONG64 timestamp = (ULONG64 )(SystemTime - TAP_CAPTURE_UNIX_EPOCH);
+
+    Buffer = tapCapturePutUlong(Buffer, (ULONG )(timestamp >> 32));
+    return tapCapturePutUlong(Buffer, (ULONG )timestamp);
+}
+
+NTSTATUS
+tapCaptureRead(
+    __in PTAP_CAPTURE                   Capture,
+    __out_bcount(BufferLength) PUCHAR   Buffer,
+    __in ULONG                          BufferLength,
+    __out PULONG                        BytesWritten
+    )
+/*++
+
+Routine Description:
+
+    Drains as many captured frames as fit in Buffer, formatted as pcapng
+    enhanced packet blocks. The section header and interface description
+    blocks are emitted first after each configure, and an interface
+    statistics block follows whenever the ring has been emptied and frames
+    were dropped since the last one.
+
+Return Value:
+
+    STATUS_SUCCESS, possibly with *BytesWritten == 0 if nothing is pending.
+
+    STATUS_INVALID_DEVICE_STATE if capture is not configured.
+
+    STATUS_BUFFER_TOO_SMALL if Buffer cannot hold the next block.
+
+--*/
+{
+    PUCHAR      p = Buffer;
+    PUCHAR      end = Buffer + BufferLength;
+    NTSTATUS    status = STATUS_SUCCESS;
+    KIRQL       irql;
+
+    *BytesWritten = 0;
+
+    KeAcquireSpinLock(&Capture->Lock, &irql);
+
+    if(Capture->Buffer == NULL)
+    {
+        KeReleaseSpinLock(&Capture->Lock, irql);
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    if(Capture->HeaderPending)
+    {
+        if(BufferLength < PCAPNG_SHB_LENGTH + PCAPNG_IDB_LENGTH)
+        {
+            KeReleaseSpinLock(&Capture->Lock, irql);
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        // Section header block, section length unspecified.
+        p = tapCapturePutUlong(p, PCAPNG_SHB_TYPE);
+        p = tapCapturePutUlong(p, PCAPNG_SHB_LENGTH);
+        p = tapCapturePutUlong(p, PCAPNG_BYTE_ORDER_MAGIC);
+        p = tapCapturePutUlong(p, 1);           // Major 1, minor 0
+        p = tapCapturePutUlong(p, 0xFFFFFFFF);
+        p = tapCapturePutUlong(p, 0xFFFFFFFF);
+        p = tapCapturePutUlong(p, PCAPNG_SHB_LENGTH);
+
+        // Interface description block, 100ns timestamps.
+        p = tapCapturePutUlong(p, PCAPNG_IDB_TYPE);
+        p = tapCapturePutUlong(p, PCAPNG_IDB_LENGTH);
+        p = tapCapturePutUlong(p, PCAPNG_LINKTYPE_ETHERNET);
+        p = tapCapturePutUlong(p, Capture->SnapLength);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_IF_TSRESOL | (1 << 16));
+        p = tapCapturePutUlong(p, 7);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_ENDOFOPT);
+        p = tapCapturePutUlong(p, PCAPNG_IDB_LENGTH);
+
+        Capture->HeaderPending = FALSE;
+    }
+
+    while(Capture->Used > 0)
+    {
+        TAP_CAPTURE_RECORD  record;
+        ULONG               blockLength;
+
+        tapCaptureRingPeek(Capture, 0, &record, sizeof(TAP_CAPTURE_RECORD));
+
+        blockLength = PCAPNG_EPB_LENGTH(record.CapturedLength);
+
+        if((ULONG )(end - p) < blockLength)
+        {
+            if(p == Buffer)
+            {
+                status = STATUS_BUFFER_TOO_SMALL;
+            }
+            break;
+        }
+
+        // Enhanced packet block on interface 0.
+        p = tapCapturePutUlong(p, PCAPNG_EPB_TYPE);
+        p = tapCapturePutUlong(p, blockLength);
+        p = tapCapturePutUlong(p, 0);
+        p = tapCapturePutTimestamp(p, record.Timestamp);
+        p = tapCapturePutUlong(p, record.CapturedLength);
+        p = tapCapturePutUlong(p, record.OriginalLength);
+
+        tapCaptureRingPeek(Capture, sizeof(TAP_CAPTURE_RECORD), p, record.CapturedLength);
+        NdisZeroMemory(p + record.CapturedLength,
+            PCAPNG_PAD(record.CapturedLength) - record.CapturedLength);
+        p += PCAPNG_PAD(record.CapturedLength);
+
+        // Frames sent by the host leave it; frames written by the TAP handle enter it.
+        p = tapCapturePutUlong(p, PCAPNG_OPT_EPB_FLAGS | (4 << 16));
+        p = tapCapturePutUlong(p, (record.Direction == TAP_WIN_CAPTURE_TX)
+                                    ? PCAPNG_EPB_FLAGS_OUTBOUND : PCAPNG_EPB_FLAGS_INBOUND);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_ENDOFOPT);
+        p = tapCapturePutUlong(p, blockLength);
+
+        Capture->Tail = (Capture->Tail + sizeof(TAP_CAPTURE_RECORD) + record.CapturedLength)
+                            % Capture->BufferSize;
+        Capture->Used -= sizeof(TAP_CAPTURE_RECORD) + record.CapturedLength;
+    }
+
+    if(Capture->Used == 0
+        && Capture->FramesDropped != Capture->FramesDroppedReported
+        && (ULONG )(end - p) >= PCAPNG_ISB_LENGTH)
+    {
+        LARGE_INTEGER   now;
+
+        KeQuerySystemTime(&now);
+
+        // Interface statistics block.
+        p = tapCapturePutUlong(p, PCAPNG_ISB_TYPE);
+        p = tapCapturePutUlong(p, PCAPNG_ISB_LENGTH);
+        p = tapCapturePutUlong(p, 0);
+        p = tapCapturePutTimestamp(p, now.QuadPart);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_ISB_IFRECV | (8 << 16));
+        NdisMoveMemory(p, &Capture->FramesCaptured, sizeof(ULONG64));
+        p += sizeof(ULONG64);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_ISB_IFDROP | (8 << 16));
+        NdisMoveMemory(p, &Capture->FramesDropped, sizeof(ULONG64));
+        p += sizeof(ULONG64);
+        p = tapCapturePutUlong(p, PCAPNG_OPT_ENDOFOPT);
+        p = tapCapturePutUlong(p, PCAPNG_ISB_LENGTH);
+
+        Capture->FramesDroppedReported = Capture->FramesDropped;
+    }
+
+    KeReleaseSpinLock(&Capture->Lock, irql);
+
+    *BytesWritten = (ULONG )(p - Buffer);
+
+    return status;
+}
@@ -0,0 +1,133 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_CAPTURE_H_
+#define __TAP_CAPTURE_H_
+
+//======================================================================
+// Frame capture ring.
+//
+// Frames seen by tapAdapterTransmit and TapDeviceWrite are copied, up to
+// the snap length, into a per-adapter byte ring that is drained as pcapng
+// through the diag device. Capture is off unless configured; the data
+// paths then test a single flags word. When on, a frame that does not
+// fit in the ring is counted and dropped, so memory stays bounded and a
+// slow reader never stalls the data path.
+//======================================================================
+
+#define TAP_CAPTURE_DEFAULT_BUFFER_SIZE     0x100000    // 1 MB
+#define TAP_CAPTURE_MIN_BUFFER_SIZE         0x10000     // 64 KB
+#define TAP_CAPTURE_MAX_BUFFER_SIZE         0x1000000   // 16 MB
+#define TAP_CAPTURE_MAX_SNAP_LENGTH         0xFFFF
+
+// Bytes of leading frame data gathered to evaluate the header filter.
+// Enough for Ethernet, an 802.1Q tag, a maximal IPv4 header and the ports.
+#define TAP_CAPTURE_FILTER_BYTES            96
+
+// Header stored in the ring in front of each captured frame.
+typedef struct _TAP_CAPTURE_RECORD
+{
+    LONGLONG        Timestamp;          // System time, 100ns units since 1601
+    ULONG           OriginalLength;
+    USHORT          CapturedLength;
+    UCHAR           Direction;          // TAP_WIN_CAPTURE_TX or TAP_WIN_CAPTURE_RX
+    UCHAR           Reserved;
+} TAP_CAPTURE_RECORD, *PTAP_CAPTURE_RECORD;
+
+typedef struct _TAP_CAPTURE
+{
+    // Directions being captured. Tested without the lock on the data paths.
+    volatile ULONG      Flags;
+
+    KSPIN_LOCK          Lock;
+
+    // Filter, sampling and snap length. Fixed while Flags is non-zero.
+    ULONG               SnapLength;
+    USHORT              EtherType;
+    UCHAR               IpProtocol;
+    USHORT              Port;
+    ULONG               SampleRate;     // 0 or 1 records every frame
+
+    // Matching frames since the last one recorded, protected by Lock.
+    ULONG               SampleCount;
+
+    // Byte ring of TAP_CAPTURE_RECORD + frame data, protected by Lock.
+    PUCHAR              Buffer;
+    ULONG               BufferSize;
+    ULONG               Head;           // Write offset
+    ULONG               Tail;           // Read offset
+    ULONG               Used;           // Bytes between Tail and Head
+
+    // pcapng section/interface header still owed to the reader.
+    BOOLEAN             HeaderPending;
+
+    ULONG64             FramesCaptured;
+    ULONG64             FramesDropped;
+    ULONG64             FramesDroppedReported;
+} TAP_CAPTURE, *PTAP_CAPTURE;
+
+VOID
+tapCaptureInitialize(
+    __in PTAP_CAPTURE   Capture
+    );
+
+NTSTATUS
+tapCaptureConfigure(
+    __in PTAP_CAPTURE                   Capture,
+    __in const TAP_WIN_CAPTURE_CONFIG   *Config
+    );
+
+VOID
+tapCaptureFree(
+    __in PTAP_CAPTURE   Capture
+    );
+
+VOID
+tapCaptureFrame(
+    __in PTAP_CAPTURE                   Capture,
+    __in ULONG                          Direction,
+    __in_bcount_opt(PrefixLength) PUCHAR Prefix,
+    __in ULONG                          PrefixLength,
+    __in_bcount(DataLength) PUCHAR      Data,
+    __in ULONG                          DataLength
+    );
+
+NTSTATUS
+tapCaptureRead(
+    __in PTAP_CAPTURE                   Capture,
+    __out_bcount(BufferLength) PUCHAR   Buffer,
+    __in ULONG                          BufferLength,
+    __out PULONG                        BytesWritten
+    );
+
+#define TAP_CAPTURE_FRAME(capture, direction, prefix, prefixLength, data, dataLength)  \
+{                                                                                   \
+    if ((capture)->Flags & (direction))                                             \
+    {                                                                               \
+        tapCaptureFrame ((capture), (direction), (prefix), (prefixLength),          \
+            (data), (dataLength));                                                  \
+    }                                                                               \
+}
+
+#endif // __TAP_CAPTURE_H_
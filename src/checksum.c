@@ -0,0 +1,173 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// INTERNET CHECKSUM
+//-----------------
+
+#include "tap.h"
+
+//
+// The one's complement sum is byte-order independent (RFC 1071, 2.(B)):
+// words are summed as loaded and the folded result is swapped to host
+// order once. Four 32 bit words are added per iteration into a 64 bit
+// accumulator, which cannot overflow for any buffer this driver handles,
+// so carries are only folded at the end.
+//
+// The driver targets little-endian processors only.
+//
+
+ULONG64
+tapChecksumAdd(
+    __in_bcount(Length) const VOID  *Buffer,
+    __in ULONG                      Length,
+    __in ULONG64                    Sum
+    )
+{
+    const UCHAR     *p = (const UCHAR *)Buffer;
+
+    while(Length >= 16)
+    {
+        Sum += *(const ULONG UNALIGNED *)(p);
+        Sum += *(const ULONG UNALIGNED *)(p + 4);
+        Sum += *(const ULONG UNALIGNED *)(p + 8);
+        Sum += *(const ULONG UNALIGNED *)(p + 12);
+        p += 16;
+        Length -= 16;
+    }
+
+    while(Length >= 4)
+    {
+        Sum += *(const ULONG UNALIGNED *)p;
+        p += 4;
+        Length -= 4;
+    }
+
+    if(Length >= 2)
+    {
+        Sum += *(const USHORT UNALIGNED *)p;
+        p += 2;
+        Length -= 2;
+    }
+
+    if(Length)
+    {
+        // Trailing byte is the high-order byte of a zero-padded word.
+        Sum += *p;
+    }
+
+    return Sum;
+}
+
+USHORT
+tapChecksumFold(
+    __in ULONG64    Sum
+    )
+{
+    ULONG   sum32;
+
+    Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+    Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+
+    sum32 = (ULONG )Sum;
+    sum32 = (sum32 & 0xFFFF) + (sum32 >> 16);
+    sum32 = (sum32 & 0xFFFF) + (sum32 >> 16);
+
+    return ntohs((USHORT )~sum32);
+}
+
+USHORT
+tapChecksumIPv4Header(
+    __in_bcount(Length) const UCHAR *Header,
+    __in ULONG                      Length
+    )
+{
+    return tapChecksumFold(tapChecksumAdd(Header, Length, 0));
+}
+
+USHORT
+tapChecksumIPv4Pseudo(
+    __in_bcount(Length) const UCHAR *Buffer,
+    __in ULONG                      Length,
+    __in UCHAR                      Protocol,
+    __in const UCHAR                *SourceAddress,
+    __in const UCHAR                *DestinationAddress
+    )
+{
+    ULONG64     sum;
+
+    sum = tapChecksumAdd(SourceAddress, 4, 0);
+    sum = tapChecksumAdd(DestinationAddress, 4, sum);
+    sum += htons((USHORT )Protocol);
+    sum += htons((USHORT )Length);
+
+    return tapChecksumFold(tapChecksumAdd(Buffer, Length, sum));
+}
+
+USHORT
+tapChecksumIPv6Pseudo(
+    __in_bcount(Length) const UCHAR *Buffer,
+    __in ULONG                      Length,
+    __in UCHAR                      NextHeader,
+    __in const UCHAR                *SourceAddress,
+    __in const UCHAR                *DestinationAddress
+    )
+{
+    ULONG64     sum;
+
+    sum = tapChecksumAdd(SourceAddress, 16, 0);
+    sum = tapChecksumAdd(DestinationAddress, 16, sum);
+    sum += htons((USHORT )NextHeader);
+    sum += htonl(Length);
+
+    return tapChecksumFold(tapChecksumAdd(Buffer, Length, sum));
+}
+
+USHORT
+tapChecksumUpdate16(
+    __in USHORT     Checksum,
+    __in USHORT     Old,
+    __in USHORT     New
+    )
+{
+    // HC' = ~(~HC + ~m + m')
+    ULONG   sum = (USHORT )~Checksum + (USHORT )~Old + (ULONG )New;
+
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (USHORT )~sum;
+}
+
+USHORT
+tapChecksumUpdate32(
+    __in USHORT     Checksum,
+    __in ULONG      Old,
+    __in ULONG      New
+    )
+{
+    Checksum = tapChecksumUpdate16(Checksum, (USHORT )(Old >> 16), (USHORT )(New >> 16));
+
+    return tapChecksumUpdate16(Checksum, (USHORT )Old, (USHORT )New);
+}
@@ -0,0 +1,98 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef __TAP_CHECKSUM_H_
+#define __TAP_CHECKSUM_H_
+
+//======================================================================
+// Internet checksum (RFC 1071).
+//
+// Partial sums are accumulated over native-order loads and are only
+// meaningful to tapChecksumAdd and tapChecksumFold. Results returned by
+// the other routines are in host byte order, ready for htons() into a
+// header field.
+//======================================================================
+
+// Adds Length bytes at Buffer to a partial sum. When a checksum spans
+// several buffers only the last may have an odd length.
+ULONG64
+tapChecksumAdd(
+    __in_bcount(Length) const VOID  *Buffer,
+    __in ULONG                      Length,
+    __in ULONG64                    Sum
+    );
+
+// Folds a partial sum to 16 bits and returns its one's complement.
+USHORT
+tapChecksumFold(
+    __in ULONG64    Sum
+    );
+
+USHORT
+tapChecksumIPv4Header(
+    __in_bcount(Length) const UCHAR *Header,
+    __in ULONG                      Length
+    );
+
+// Transport checksum over Buffer with the IPv4 pseudo header.
+USHORT
+tapChecksumIPv4Pseudo(
+    __in_bcount(Length) const UCHAR *Buffer,
+    __in ULONG                      Length,
+    __in UCHAR                      Protocol,
+    __in const UCHAR                *SourceAddress,         // 4 bytes
+    __in const UCHAR                *DestinationAddress     // 4 bytes
+    );
+
+// Transport checksum over Buffer with the IPv6 pseudo header.
+USHORT
+tapChecksumIPv6Pseudo(
+    __in_bcount(Length) const UCHAR *Buffer,
+    __in ULONG                      Length,
+    __in UCHAR                      NextHeader,
+    __in const UCHAR                *SourceAddress,         // 16 bytes
+    __in const UCHAR                *DestinationAddress     // 16 bytes
+    );
+
+//
+// Incremental update (RFC 1624, eqn. 3) of a checksum field after a
+// 16 or 32 bit field it covers changes from Old to New. All values are in
+// host byte order.
+//
+USHORT
+tapChecksumUpdate16(
+    __in USHORT     Checksum,
+    __in USHORT     Old,
+    __in USHORT     New
+    );
+
+USHORT
+tapChecksumUpdate32(
+    __in USHORT     Checksum,
+    __in ULONG      Old,
+    __in ULONG      New
+    );
+
+#endif // __TAP_CHECKSUM_H_
@@ -173,5 +173,6 @@
 #define PACKET_QUEUE_SIZE           64 // tap -> userspace queue size
 #define IRP_QUEUE_SIZE              16 // max number of simultaneous i/o operations from userspace
 #define INJECT_QUEUE_SIZE           16 // DHCP/ARP -> tap injection queue
+#define TUN_HEADER_MDL_CACHE_SIZE   64 // prebuilt TUN write header MDLs, per ethertype
 
 #define TAP_LITTLE_ENDIAN      // affects ntohs, htonl, etc. functions
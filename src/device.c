@@ -40,6 +40,7 @@
 #pragma alloc_text( PAGE, TapDeviceClose)
 #pragma alloc_text( PAGE, TapDiagDeviceCreate)
 #pragma alloc_text( PAGE, TapDiagDeviceControl)
+#pragma alloc_text( PAGE, TapDiagDeviceCleanup)
 #pragma alloc_text( PAGE, TapDiagDeviceClose)
 #endif // ALLOC_PRAGMA
 
@@ -71,6 +72,140 @@ VOID tapResetAdapterState(
   Adapter->m_dhcp_received_discover = FALSE;
   Adapter->m_dhcp_bad_requests = 0;
   NdisZeroMemory (Adapter->m_dhcp_server_mac, MACADDR_SIZE);
+
+  // One frame per read
+  NdisZeroMemory (&Adapter->ReadCoalesce, sizeof (Adapter->ReadCoalesce));
+
+  // No frame timestamps
+  Adapter->TimestampFlags = 0;
+}
+
+// Claim a free queue for a new handle, within the queue limit.
+static PTAP_QUEUE
+tapQueueOpen(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject,
+    __out PBOOLEAN              FirstOpen
+    )
+{
+    PTAP_QUEUE  queue = NULL;
+    ULONG       i;
+
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    // The queue limit lasts until every handle is closed.
+    *FirstOpen = (Adapter->TapFileOpenCount == 0);
+
+    if(*FirstOpen)
+    {
+        Adapter->QueueLimit = 1;
+    }
+
+    if((ULONG )Adapter->TapFileOpenCount < Adapter->QueueLimit)
+    {
+        for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+        {
+            if(Adapter->Queues[i].FileObject == NULL)
+            {
+                queue = &Adapter->Queues[i];
+                break;
+            }
+        }
+    }
+
+    if(queue != NULL)
+    {
+        queue->FileObject = FileObject;
+        queue->SendPacketQueue.Closed = FALSE;
+
+        ++Adapter->TapFileOpenCount;
+
+        // Publish the slot before the count that covers it.
+        Adapter->ActiveQueues[Adapter->ActiveQueueCount] = (UCHAR )i;
+        InterlockedIncrement(&Adapter->ActiveQueueCount);
+    }
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+
+    return queue;
+}
+
+// Stop transmit from selecting a queue. Returns TRUE if no other
+// handle is still active.
+static BOOLEAN
+tapQueueDeactivate(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
+    )
+{
+    UCHAR       slot = (UCHAR )(Queue - Adapter->Queues);
+    LONG        i;
+    BOOLEAN     lastQueue;
+
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    for(i = 0; i < Adapter->ActiveQueueCount; ++i)
+    {
+        if(Adapter->ActiveQueues[i] == slot)
+        {
+            // Fill the hole with the last entry. A racing transmit may
+            // still pick this slot; its packet is refused once the queue
+            // is flushed.
+            Adapter->ActiveQueues[i] =
+                Adapter->ActiveQueues[Adapter->ActiveQueueCount - 1];
+
+            InterlockedDecrement(&Adapter->ActiveQueueCount);
+            break;
+        }
+    }
+
+    lastQueue = (Adapter->ActiveQueueCount == 0);
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+
+    return lastQueue;
+}
+
+// Free the queue slot of a closed handle for another handle.
+static VOID
+tapQueueClose(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
+    )
+{
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    Queue->FileObject = NULL;
+    --Adapter->TapFileOpenCount;
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+}
+
+// Set how many handles may be open at once. Fails if more are open.
+static NTSTATUS
+tapQueueSetLimit(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in ULONG                  QueueLimit
+    )
+{
+    NTSTATUS    status = STATUS_INVALID_PARAMETER;
+
+    if(QueueLimit == 0 || QueueLimit > TAP_WIN_MAX_QUEUES)
+    {
+        return status;
+    }
+
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    if(QueueLimit >= (ULONG )Adapter->TapFileOpenCount)
+    {
+        Adapter->QueueLimit = QueueLimit;
+        status = STATUS_SUCCESS;
+    }
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+
+    return status;
 }
 
 // IRP_MJ_CREATE
@@ -103,7 +238,8 @@ Return Value:
     NDIS_STATUS             status;
     PIO_STACK_LOCATION      irpSp;// Pointer to current stack location
     PTAP_ADAPTER_CONTEXT    adapter = NULL;
-    PFILE_OBJECT            originalFileObject;
+    PTAP_QUEUE              queue;
+    BOOLEAN                 firstOpen;
 
     PAGED_CODE();
 
@@ -149,16 +285,13 @@ Return Value:
         adapter->TapFileIsOpen
         ));
 
-    // Enforce exclusive access
-    originalFileObject = InterlockedCompareExchangePointer(
-                    &adapter->TapFileObject,
-                    irpSp->FileObject,
-                    NULL
-                    );
+    // Enforce exclusive access, unless multi-queue mode admits more handles.
+    queue = tapQueueOpen(adapter,irpSp->FileObject,&firstOpen);
 
-    if(originalFileObject == NULL)
+    if(queue != NULL)
     {
         irpSp->FileObject->FsContext = adapter; // Quick reference
+        irpSp->FileObject->FsContext2 = queue;
 
         status = STATUS_SUCCESS;
     }
@@ -167,13 +300,13 @@ Return Value:
         status = STATUS_UNSUCCESSFUL;
     }
 
-    // Release the lock.
-    //tapAdapterReleaseLock(adapter,FALSE);
-
     if(status == STATUS_SUCCESS)
     {
-        // Reset adapter state on successful open.
-        tapResetAdapterState(adapter);
+        // Reset adapter state when the first handle is opened.
+        if(firstOpen)
+        {
+            tapResetAdapterState(adapter);
+        }
 
         adapter->TapFileIsOpen = 1;    // Legacy...
 
@@ -516,6 +649,9 @@ Return Value:
                 adapter->m_dhcp_server_arp = FALSE;
                 adapter->m_dhcp_user_supplied_options_buffer_len = 0;
 
+                // Pool reservations depend on the addresses below.
+                tapDhcpPoolConfigure(adapter, 0, 0);
+
                 // Adapter IP addr / netmask
                 adapter->m_dhcp_addr =
                     ((IPADDR*) (Irp->AssociatedIrp.SystemBuffer))[0];
@@ -536,6 +672,8 @@ Return Value:
                     2
                     );
 
+                BuildDHCPTemplates (adapter);
+
                 adapter->m_dhcp_enabled = TRUE;
                 adapter->m_dhcp_server_arp = TRUE;
 
@@ -569,6 +707,8 @@ Return Value:
                 adapter->m_dhcp_user_supplied_options_buffer_len = 
                     inBufLength;
 
+                BuildDHCPTemplates (adapter);
+
                 Irp->IoStatus.Information = 1; // Simple boolean value
 
                 DEBUGP (("[TAP] Set DHCP OPT.\n"));
@@ -581,9 +721,311 @@ Return Value:
         }
         break;
 
+    case TAP_WIN_IOCTL_CONFIG_DHCP_POOL:
+        {
+            if(inBufLength >= sizeof(TAP_WIN_DHCP_POOL)
+                && adapter->m_dhcp_enabled)
+            {
+                TAP_WIN_DHCP_POOL *pool = (TAP_WIN_DHCP_POOL *)Irp->AssociatedIrp.SystemBuffer;
+
+                ntStatus = tapDhcpPoolConfigure(
+                                adapter,
+                                pool->StartAddress,
+                                pool->Count
+                                );
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Configured DHCP pool of %d addresses.\n", pool->Count));
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_CONFIG_PROXY_ARP:
+        {
+            TAP_WIN_PROXY_ARP   *config = (TAP_WIN_PROXY_ARP *)Irp->AssociatedIrp.SystemBuffer;
+
+            if(inBufLength >= FIELD_OFFSET(TAP_WIN_PROXY_ARP, Entries)
+                && config->EntryCount <= TAP_WIN_PROXY_ARP_MAX_ENTRIES
+                && inBufLength >= FIELD_OFFSET(TAP_WIN_PROXY_ARP, Entries)
+                    + config->EntryCount * sizeof(TAP_WIN_PROXY_ARP_ENTRY))
+            {
+                ntStatus = tapProxyArpConfigure(
+                                adapter,
+                                config->Flags,
+                                config->Entries,
+                                config->EntryCount
+                                );
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Configured proxy ARP, %d entries.\n", config->EntryCount));
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_CONFIG_ND_PROXY:
+        {
+            TAP_WIN_ND_PROXY    *config = (TAP_WIN_ND_PROXY *)Irp->AssociatedIrp.SystemBuffer;
+
+            if(inBufLength >= FIELD_OFFSET(TAP_WIN_ND_PROXY, Entries)
+                && config->EntryCount <= TAP_WIN_ND_PROXY_MAX_ENTRIES
+                && inBufLength >= FIELD_OFFSET(TAP_WIN_ND_PROXY, Entries)
+                    + config->EntryCount * sizeof(TAP_WIN_ND_PROXY_ENTRY))
+            {
+                ntStatus = tapNdProxyConfigure(
+                                adapter,
+                                config->Entries,
+                                config->EntryCount
+                                );
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Configured ND proxy, %d entries.\n", config->EntryCount));
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_SET_QUEUE_COUNT:
+        {
+            if(inBufLength >= sizeof(ULONG))
+            {
+                ULONG parm = ((PULONG) (Irp->AssociatedIrp.SystemBuffer))[0];
+
+                ntStatus = tapQueueSetLimit(adapter, parm);
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Set queue count to %d.\n", parm));
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_SET_READ_COALESCING:
+        {
+            if(inBufLength >= sizeof(TAP_WIN_READ_COALESCING))
+            {
+                TAP_WIN_READ_COALESCING *config = (TAP_WIN_READ_COALESCING *)Irp->AssociatedIrp.SystemBuffer;
+
+                ntStatus = tapReadCoalesceConfigure(adapter, config);
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Read coalescing: %d frames, %d bytes, %d us.\n",
+                        config->MaxFrames, config->MaxBytes, config->MaxMicroseconds));
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_SET_TIMESTAMPS:
+        {
+            if(inBufLength >= sizeof(ULONG))
+            {
+                ULONG   flags = ((PULONG) (Irp->AssociatedIrp.SystemBuffer))[0];
+
+                if((flags & ~TAP_WIN_TIMESTAMP_FLAGS) == 0
+                    && (!(flags & TAP_WIN_TIMESTAMP_QUEUE_DELAY) || (flags & TAP_WIN_TIMESTAMP_READ)))
+                {
+                    adapter->TimestampFlags = flags;
+
+                    Irp->IoStatus.Information = 1; // Simple boolean value
+
+                    DEBUGP (("[TAP] Frame timestamps: 0x%x\n", flags));
+                    break;
+                }
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus = STATUS_INVALID_PARAMETER;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_GET_LOCK_STATS:
+        {
+            if(outBufLength >= sizeof(TAP_WIN_LOCK_STATS))
+            {
+                ULONG   flags = 0;
+
+                // METHOD_BUFFERED: read the flags before the output
+                // overwrites them.
+                if(inBufLength >= sizeof(ULONG))
+                {
+                    flags = ((PULONG) (Irp->AssociatedIrp.SystemBuffer))[0];
+                }
+
+                ntStatus = tapLockStatsQuery(
+                                adapter,
+                                inBufLength >= sizeof(ULONG) ? &flags : NULL,
+                                (TAP_WIN_LOCK_STATS *)Irp->AssociatedIrp.SystemBuffer
+                                );
+
+                Irp->IoStatus.Information = sizeof(TAP_WIN_LOCK_STATS);
+            }
+            else
+            {
+                NOTE_ERROR();
+                Irp->IoStatus.Status = ntStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+        break;
+
+    case TAP_WIN_IOCTL_GET_STAGE_STATS:
+        {
+            TAP_WIN_STAGE_STATS_CONTROL     control;
+            ULONG                           bytesWritten = 0;
+
+            // METHOD_BUFFERED: copy the control before the output
+            // overwrites it.
+            if(inBufLength >= sizeof(TAP_WIN_STAGE_STATS_CONTROL))
+            {
+                NdisMoveMemory(&control, Irp->AssociatedIrp.SystemBuffer, sizeof(control));
+            }
+
+            ntStatus = tapStageStatsQuery(
+                            &adapter->StageStats,
+                            inBufLength >= sizeof(TAP_WIN_STAGE_STATS_CONTROL) ? &control : NULL,
+                            (PUCHAR )Irp->AssociatedIrp.SystemBuffer,
+                            outBufLength,
+                            &bytesWritten
+                            );
+
+            if(ntStatus != STATUS_SUCCESS)
+            {
+                NOTE_ERROR();
+            }
+
+            Irp->IoStatus.Information = bytesWritten;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_GET_LATENCY_STATS:
+        {
+            if(outBufLength >= sizeof(TAP_WIN_LATENCY_STATS))
+            {
+                ULONG   flags = 0;
+
+                // METHOD_BUFFERED: read the flags before the output
+                // overwrites them.
+                if(inBufLength >= sizeof(ULONG))
+                {
+                    flags = ((PULONG) (Irp->AssociatedIrp.SystemBuffer))[0];
+                }
+
+                ntStatus = tapLatencyStatsQuery(
+                                adapter,
+                                inBufLength >= sizeof(ULONG) ? &flags : NULL,
+                                (TAP_WIN_LATENCY_STATS *)Irp->AssociatedIrp.SystemBuffer
+                                );
+
+                Irp->IoStatus.Information = sizeof(TAP_WIN_LATENCY_STATS);
+            }
+            else
+            {
+                NOTE_ERROR();
+                Irp->IoStatus.Status = ntStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+        break;
+
+    case TAP_WIN_IOCTL_GET_DROP_STATS:
+        {
+            if(outBufLength >= sizeof(TAP_WIN_DROP_STATS))
+            {
+                ULONG   flags = 0;
+
+                // METHOD_BUFFERED: read the flags before the output
+                // overwrites them.
+                if(inBufLength >= sizeof(ULONG))
+                {
+                    flags = ((PULONG) (Irp->AssociatedIrp.SystemBuffer))[0];
+                }
+
+                tapDropStatsQuery(
+                    &adapter->DropStats,
+                    flags,
+                    (TAP_WIN_DROP_STATS *)Irp->AssociatedIrp.SystemBuffer
+                    );
+
+                Irp->IoStatus.Information = sizeof(TAP_WIN_DROP_STATS);
+            }
+            else
+            {
+                NOTE_ERROR();
+                Irp->IoStatus.Status = ntStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+        break;
+
     case TAP_WIN_IOCTL_GET_INFO:
         {
             char state[16];
+            ULONG irpCount = 0, irpMaxCount = 0;
+            ULONG packetCount = 0, packetMaxCount = 0;
+            ULONG i;
+
+            // Totals over all queues, and the deepest any queue has been.
+            for (i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+            {
+                irpCount += adapter->Queues[i].PendingReadIrpQueue.Count;
+                irpMaxCount = max(irpMaxCount, adapter->Queues[i].PendingReadIrpQueue.MaxCount);
+                packetCount += adapter->Queues[i].SendPacketQueue.Count;
+                packetMaxCount = max(packetMaxCount, adapter->Queues[i].SendPacketQueue.MaxCount);
+            }
 
             // Fetch adapter (miniport) state.
             if (tapAdapterSendAndReceiveReady(adapter) == NDIS_STATUS_SUCCESS)
@@ -633,16 +1075,16 @@ Return Value:
 #if PACKET_TRUNCATION_CHECK
                 (int)adapter->m_RxTrunc,
 #endif
-                (int)adapter->PendingReadIrpQueue.Count,
-                (int)adapter->PendingReadIrpQueue.MaxCount,
+                (int)irpCount,
+                (int)irpMaxCount,
                 (int)IRP_QUEUE_SIZE,        // Ignored in NDIS 6 driver...
 
-                (int)adapter->SendPacketQueue.Count,
-                (int)adapter->SendPacketQueue.MaxCount,
+                (int)packetCount,
+                (int)packetMaxCount,
                 (int)PACKET_QUEUE_SIZE,
 
-                (int)0,         // adapter->InjectPacketQueue.Count - Unused
-                (int)0,         // adapter->InjectPacketQueue.MaxCount - Unused
+                (int)adapter->InjectPacketQueue.Count,
+                (int)adapter->InjectPacketQueue.MaxCount,
                 (int)INJECT_QUEUE_SIZE
                 );
 
@@ -653,10 +1095,9 @@ Return Value:
         }
         break;
 
-#if DBG
     case TAP_WIN_IOCTL_GET_LOG_LINE:
         {
-            if (GetDebugLine( (LPTSTR)Irp->AssociatedIrp.SystemBuffer,outBufLength))
+            if (tapTraceReadLine( (char *)Irp->AssociatedIrp.SystemBuffer,outBufLength))
             {
                 Irp->IoStatus.Status = ntStatus = STATUS_SUCCESS;
             }
@@ -669,7 +1110,23 @@ Return Value:
 
             break;
         }
-#endif
+
+    case TAP_WIN_IOCTL_GET_TRACE:
+        {
+            if (outBufLength >= sizeof(TAP_WIN_TRACE_HEADER))
+            {
+                Irp->IoStatus.Information = tapTraceRead(
+                    (PUCHAR )Irp->AssociatedIrp.SystemBuffer,
+                    outBufLength
+                    );
+            }
+            else
+            {
+                NOTE_ERROR();
+                Irp->IoStatus.Status = ntStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+        break;
 
     case TAP_WIN_IOCTL_SET_MEDIA_STATUS:
         {
@@ -704,6 +1161,38 @@ Return Value:
         }
         break;
 
+    case TAP_WIN_IOCTL_SET_FILTER:
+        {
+            TAP_WIN_FILTER_PROGRAM  *program = (TAP_WIN_FILTER_PROGRAM *)Irp->AssociatedIrp.SystemBuffer;
+
+            if(inBufLength >= FIELD_OFFSET(TAP_WIN_FILTER_PROGRAM, Instructions)
+                && program->InstructionCount <= TAP_WIN_FILTER_MAX_INSTRUCTIONS
+                && inBufLength >= FIELD_OFFSET(TAP_WIN_FILTER_PROGRAM, Instructions)
+                    + program->InstructionCount * sizeof(TAP_WIN_BPF_INSN))
+            {
+                ntStatus = tapAdapterSetFilter(
+                                adapter,
+                                program->Direction,
+                                program->Instructions,
+                                program->InstructionCount
+                                );
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = 1;
+                    break;
+                }
+            }
+            else
+            {
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+
+            NOTE_ERROR();
+            Irp->IoStatus.Status = ntStatus;
+        }
+        break;
+
     default:
 
         //
@@ -727,14 +1216,14 @@ Return Value:
 // Flush the pending read IRP queue.
 VOID
 tapFlushIrpQueues(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_QUEUE             Queue
     )
 {
 
     DEBUGP (("[TAP] tapFlushIrpQueues: Flushing %d pending read IRPs\n",
-        Adapter->PendingReadIrpQueue.Count));
+        Queue->PendingReadIrpQueue.Count));
 
-    tapIrpCsqFlush(&Adapter->PendingReadIrpQueue);
+    tapIrpCsqFlush(&Queue->PendingReadIrpQueue);
 }
 
 // IRP_MJ_CLEANUP
@@ -806,29 +1295,38 @@ Return Value:
 
     if(adapter != NULL )
     {
-        adapter->TapFileIsOpen = 0;    // Legacy...
+        PTAP_QUEUE  queue = (PTAP_QUEUE )(irpSp->FileObject)->FsContext2;
+
+        ASSERT(queue);
 
-        // Disconnect from media.
-        tapSetMediaConnectStatus(adapter,FALSE);
+        // Stop sending to this handle. The adapter stays up until the
+        // last handle goes.
+        if(tapQueueDeactivate(adapter,queue))
+        {
+            adapter->TapFileIsOpen = 0;    // Legacy...
+
+            // Disconnect from media.
+            tapSetMediaConnectStatus(adapter,FALSE);
 
-        // Reset adapter state when cleaning up;
-        tapResetAdapterState(adapter);
+            // Reset adapter state when cleaning up;
+            tapResetAdapterState(adapter);
+        }
 
         // BUGBUG!!! Use RemoveLock???
 
         //
         // Flush pending send TAP packet queue.
         //
-        tapFlushSendPacketQueue(adapter);
+        tapFlushSendPacketQueue(adapter,queue);
 
-        ASSERT(adapter->SendPacketQueue.Count == 0);
+        ASSERT(queue->SendPacketQueue.Count == 0);
 
         //
         // Flush the pending IRP queues
         //
-        tapFlushIrpQueues(adapter);
+        tapFlushIrpQueues(queue);
 
-        ASSERT(adapter->PendingReadIrpQueue.Count == 0);
+        ASSERT(queue->PendingReadIrpQueue.Count == 0);
     }
 
     // Complete the IRP.
@@ -902,7 +1400,9 @@ Return Value:
 
     if(adapter != NULL )
     {
-        if(adapter->TapFileObject == NULL)
+        PTAP_QUEUE  queue = (PTAP_QUEUE )(irpSp->FileObject)->FsContext2;
+
+        if(queue == NULL)
         {
             // Should never happen!!!
             ASSERT(FALSE);
@@ -911,10 +1411,11 @@ Return Value:
         {
             ASSERT(irpSp->FileObject->FsContext == adapter);
 
-            ASSERT(adapter->TapFileObject == irpSp->FileObject);
+            ASSERT(queue->FileObject == irpSp->FileObject);
+
+            tapQueueClose(adapter,queue);
         }
 
-        adapter->TapFileObject = NULL;
         irpSp->FileObject = NULL;
 
         // Remove reference added by when handle was opened.
@@ -1009,6 +1510,11 @@ Return Value:
 
     irpSp->FileObject->FsContext = adapter; // Quick reference
 
+    // The only process that may map the statistics page through this
+    // handle.
+    irpSp->FileObject->FsContext2 = PsGetCurrentProcess();
+    ObReferenceObject(irpSp->FileObject->FsContext2);
+
     // NOTE!!! Reference added by tapAdapterContextFromDeviceObject
     // will be removed when file is closed.
 
@@ -1070,6 +1576,11 @@ Return Value:
     {
         case TAP_WIN_IOCTL_SET_MEDIA_STATUS:
         case TAP_WIN_IOCTL_PRIORITY_BEHAVIOR:
+        case TAP_WIN_IOCTL_SET_FILTER:
+        case TAP_WIN_IOCTL_GET_LOCK_STATS:
+        case TAP_WIN_IOCTL_GET_STAGE_STATS:
+        case TAP_WIN_IOCTL_GET_LATENCY_STATS:
+        case TAP_WIN_IOCTL_GET_DROP_STATS:
             return TapDeviceControl(DeviceObject, Irp);
     }
     //
@@ -1089,12 +1600,95 @@ Return Value:
     //
     switch ( irpSp->Parameters.DeviceIoControl.IoControlCode )
     {
+    case TAP_WIN_IOCTL_CAPTURE_CONFIG:
+        {
+            if(inBufLength >= sizeof(TAP_WIN_CAPTURE_CONFIG))
+            {
+                ntStatus = tapCaptureConfigure(
+                    &adapter->Capture,
+                    (TAP_WIN_CAPTURE_CONFIG *)Irp->AssociatedIrp.SystemBuffer
+                    );
+
+                if(!NT_SUCCESS(ntStatus))
+                {
+                    NOTE_ERROR();
+                }
+            }
+            else
+            {
+                NOTE_ERROR();
+                ntStatus = STATUS_INVALID_PARAMETER;
+            }
+        }
+        break;
+
+    case TAP_WIN_IOCTL_CAPTURE_READ:
+        {
+            ULONG   bytesWritten = 0;
+
+            ntStatus = tapCaptureRead(
+                &adapter->Capture,
+                (PUCHAR )Irp->AssociatedIrp.SystemBuffer,
+                outBufLength,
+                &bytesWritten
+                );
+
+            Irp->IoStatus.Information = bytesWritten;
+        }
+        break;
+
+    case TAP_WIN_IOCTL_MAP_STATS_PAGE:
+        {
+            if(Irp->RequestorMode != UserMode)
+            {
+                NOTE_ERROR();
+                ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+            }
+            else if(outBufLength >= sizeof(ULONG64))
+            {
+                ntStatus = tapStatsPageMap(
+                    adapter,
+                    irpSp->FileObject,
+                    (PULONG64 )Irp->AssociatedIrp.SystemBuffer
+                    );
+
+                if(NT_SUCCESS(ntStatus))
+                {
+                    Irp->IoStatus.Information = sizeof(ULONG64);
+                }
+                else
+                {
+                    NOTE_ERROR();
+                }
+            }
+            else
+            {
+                NOTE_ERROR();
+                ntStatus = STATUS_BUFFER_TOO_SMALL;
+            }
+        }
+        break;
+
+    case TAP_WIN_IOCTL_GET_METRICS:
+        {
+            ntStatus = tapMetricsRequest(adapter, Irp);
+
+            if(ntStatus == STATUS_PENDING)
+            {
+                return ntStatus;
+            }
+
+            if(!NT_SUCCESS(ntStatus))
+            {
+                NOTE_ERROR();
+            }
+        }
+        break;
+
         //
         // Future: Diag device can handle additional IOCTLs here.
         //
 
-
-
     default:
 
         //
@@ -1116,6 +1710,62 @@ Return Value:
 }
 
 
+// IRP_MJ_CLEANUP
+NTSTATUS
+TapDiagDeviceCleanup(
+    PDEVICE_OBJECT DeviceObject,
+    PIRP Irp
+    )
+/*++
+
+Routine Description:
+
+    Receipt of this request indicates that the last handle for a file
+    object that is associated with the target device object has been
+    closed. It arrives in the context of the closing process, so any
+    statistics page mapping the handle made is removed here if that is
+    the process it was made in, and any metrics request it left waiting
+    is cancelled.
+
+Arguments:
+
+    DeviceObject - a pointer to the object that represents the device
+    to be cleaned up.
+
+    Irp - a pointer to the I/O Request Packet for this request.
+
+Return Value:
+
+    NT status code
+
+--*/
+{
+    PIO_STACK_LOCATION      irpSp;  // Pointer to current stack location
+    PTAP_ADAPTER_CONTEXT    adapter = NULL;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    PAGED_CODE();
+
+    irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+    adapter = (PTAP_ADAPTER_CONTEXT )(irpSp->FileObject)->FsContext;
+
+    if(adapter != NULL )
+    {
+        tapStatsPageUnmap(adapter, irpSp->FileObject);
+        tapMetricsFlush(adapter, irpSp->FileObject);
+    }
+
+    // Complete the IRP.
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = 0;
+
+    IoCompleteRequest( Irp, IO_NO_INCREMENT );
+
+    return STATUS_SUCCESS;
+}
+
 // IRP_MJ_CLOSE
 NTSTATUS
 TapDiagDeviceClose(
@@ -1176,6 +1826,9 @@ Return Value:
 
     if(adapter != NULL )
     {
+        // Owner reference taken when handle was opened.
+        ObDereferenceObject(irpSp->FileObject->FsContext2);
+
         irpSp->FileObject = NULL;
 
         // Remove reference added by when handle was opened.
@@ -1413,6 +2066,7 @@ CreateTapDevice(
             NdisZeroMemory(dispatchTable, (IRP_MJ_MAXIMUM_FUNCTION+1) * sizeof(PDRIVER_DISPATCH));
 
             dispatchTable[IRP_MJ_CREATE] = TapDiagDeviceCreate;
+            dispatchTable[IRP_MJ_CLEANUP] = TapDiagDeviceCleanup;
             dispatchTable[IRP_MJ_CLOSE] = TapDiagDeviceClose;
             dispatchTable[IRP_MJ_DEVICE_CONTROL] = TapDiagDeviceControl;
 
@@ -1456,6 +2110,8 @@ DestroyTapDevice(
     __in PTAP_ADAPTER_CONTEXT   Adapter
    )
 {
+    ULONG   i;
+
     DEBUGP (("[TAP] --> DestroyTapDevice; Adapter: %wZ\n",
         &Adapter->NetCfgInstanceId));
 
@@ -1465,11 +2121,14 @@ DestroyTapDevice(
     Adapter->TapDeviceCreated = FALSE;
 
     //
-    // Flush pending send TAP packet queue.
+    // Flush pending send TAP packet queues.
     //
-    tapFlushSendPacketQueue(Adapter);
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        tapFlushSendPacketQueue(Adapter,&Adapter->Queues[i]);
 
-    ASSERT(Adapter->SendPacketQueue.Count == 0);
+        ASSERT(Adapter->Queues[i].SendPacketQueue.Count == 0);
+    }
 
     //
     // Flush IRP queues. Wait for pending I/O. Etc.
@@ -1494,9 +2153,12 @@ DestroyTapDevice(
     // result in the TapDeviceCleanup call being made, followed by the a call to
     // the TapDeviceClose callback.
     //
-    tapFlushIrpQueues(Adapter);
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        tapFlushIrpQueues(&Adapter->Queues[i]);
 
-    ASSERT(Adapter->PendingReadIrpQueue.Count == 0);
+        ASSERT(Adapter->Queues[i].PendingReadIrpQueue.Count == 0);
+    }
 
     //
     // Deregister the Win32 device.
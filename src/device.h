@@ -53,6 +53,9 @@ DRIVER_DISPATCH TapDiagDeviceCreate;
 __drv_dispatchType(IRP_MJ_DEVICE_CONTROL)
 DRIVER_DISPATCH TapDiagDeviceControl;
 
+__drv_dispatchType(IRP_MJ_CLEANUP)
+DRIVER_DISPATCH TapDiagDeviceCleanup;
+
 __drv_dispatchType(IRP_MJ_CLOSE)
 DRIVER_DISPATCH TapDiagDeviceClose;
 
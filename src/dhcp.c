@@ -91,84 +91,6 @@ SetDHCPOpt32(
     SetDHCPOpt (msg, &opt, sizeof (opt));
 }
 
-//==============
-// Checksum code
-//==============
-
-USHORT
-ip_checksum(
-    __in const UCHAR *buf,
-    __in const int len_ip_header
-    )
-{
-    USHORT word16;
-    ULONG sum = 0;
-    int i;
-
-    // make 16 bit words out of every two adjacent 8 bit words in the packet
-    // and add them up
-    for (i = 0; i < len_ip_header - 1; i += 2)
-    {
-        word16 = ((buf[i] << 8) & 0xFF00) + (buf[i+1] & 0xFF);
-        sum += (ULONG) word16;
-    }
-
-    // take only 16 bits out of the 32 bit sum and add up the carries
-    while (sum >> 16)
-    {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    // one's complement the result
-    return ((USHORT) ~sum);
-}
-
-USHORT
-udp_checksum (
-    __in const UCHAR *buf,
-    __in const int len_udp,
-    __in const UCHAR *src_addr,
-    __in const UCHAR *dest_addr
-    )
-{
-    USHORT word16;
-    ULONG sum = 0;
-    int i;
-
-    // make 16 bit words out of every two adjacent 8 bit words and 
-    // calculate the sum of all 16 bit words
-    for (i = 0; i < len_udp; i += 2)
-    {
-        word16 = ((buf[i] << 8) & 0xFF00) + ((i + 1 < len_udp) ? (buf[i+1] & 0xFF) : 0);
-        sum += word16;
-    }
-
-    // add the UDP pseudo header which contains the IP source and destination addresses
-    for (i = 0; i < 4; i += 2)
-    {
-        word16 =((src_addr[i] << 8) & 0xFF00) + (src_addr[i+1] & 0xFF);
-        sum += word16;
-    }
-
-    for (i = 0; i < 4; i += 2)
-    {
-        word16 =((dest_addr[i] << 8) & 0xFF00) + (dest_addr[i+1] & 0xFF);
-        sum += word16; 	
-    }
-
-    // the protocol number and the length of the UDP packet
-    sum += (USHORT) IPPROTO_UDP + (USHORT) len_udp;
-
-    // keep only the last 16 bits of the 32 bit calculated sum and add the carries
-    while (sum >> 16)
-    {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    // Take the one's complement of sum
-    return ((USHORT) ~sum);
-}
-
 //================================
 // Set IP and UDP packet checksums
 //================================
@@ -179,11 +101,12 @@ SetChecksumDHCPMsg(
     )
 {
     // Set IP checksum
-    m->msg.pre.ip.check = htons (ip_checksum ((UCHAR *) &m->msg.pre.ip, sizeof (IPHDR)));
+    m->msg.pre.ip.check = htons (tapChecksumIPv4Header ((UCHAR *) &m->msg.pre.ip, sizeof (IPHDR)));
 
     // Set UDP Checksum
-    m->msg.pre.udp.check = htons (udp_checksum ((UCHAR *) &m->msg.pre.udp, 
+    m->msg.pre.udp.check = htons (tapChecksumIPv4Pseudo ((UCHAR *) &m->msg.pre.udp, 
         sizeof (UDPHDR) + sizeof (DHCP) + m->optlen,
+        IPPROTO_UDP,
         (UCHAR *)&m->msg.pre.ip.saddr,
         (UCHAR *)&m->msg.pre.ip.daddr));
 }
@@ -231,6 +154,44 @@ GetDHCPMessageType(
     return -1;
 }
 
+// Find a 4 byte option, e.g. DHCP_IP or DHCP_SERVER_ID.
+BOOLEAN
+GetDHCPOpt32(
+    __in const DHCP *dhcp,
+    __in const int optlen,
+    __in const int type,
+    __out ULONG *data
+    )
+{
+    const UCHAR *p = (UCHAR *) (dhcp + 1);
+    int i;
+
+    for (i = 0; i < optlen; ++i)
+    {
+        const UCHAR t = p[i];
+        const int room = optlen - i - 1;
+
+        if (t == DHCP_END)
+            return FALSE;
+        else if (t == DHCP_PAD)
+            ;
+        else if (room < 1)
+            return FALSE;
+        else if (t == type)
+        {
+            if (p[i+1] == sizeof (ULONG) && room >= 1 + sizeof (ULONG))
+            {
+                NdisMoveMemory (data, &p[i+2], sizeof (ULONG));
+                return TRUE;
+            }
+            return FALSE;
+        }
+        else
+            i += (p[i+1] + 1);
+    }
+    return FALSE;
+}
+
 BOOLEAN
 DHCPMessageOurs (
     __in const PTAP_ADAPTER_CONTEXT Adapter,
@@ -246,8 +207,8 @@ DHCPMessageOurs (
         return FALSE;
     }
 
-    // Source MAC must be our adapter
-    if (!MAC_EQUAL (eth->src, Adapter->CurrentAddress))
+    // Source MAC must be our adapter, unless other clients are served from the pool
+    if (!MAC_EQUAL (eth->src, Adapter->CurrentAddress) && Adapter->m_dhcp_pool == NULL)
     {
         return FALSE;
     }
@@ -272,7 +233,7 @@ DHCPMessageOurs (
         return FALSE;
     }
 
-    // Hardware address must match our adapter
+    // Hardware address must match the sender
     if (!MAC_EQUAL (eth->src, dhcp->chaddr))
     {
         return FALSE;
@@ -296,7 +257,8 @@ BuildDHCPPre (
     __in const UDPHDR *udp,
     __in const DHCP *dhcp,
     __in const int optlen,
-    __in const int type)
+    __in const int type,
+    __in const IPADDR yiaddr)
 {
     // Should we broadcast or direct to a specific MAC / IP address?
     const BOOLEAN broadcast = (type == DHCPNAK
@@ -337,7 +299,7 @@ BuildDHCPPre (
     }
     else
     {
-        p->ip.daddr = Adapter->m_dhcp_addr;
+        p->ip.daddr = yiaddr;
     }
 
     //
@@ -365,7 +327,7 @@ BuildDHCPPre (
     }
     else
     {
-        p->dhcp.yiaddr = Adapter->m_dhcp_addr;
+        p->dhcp.yiaddr = yiaddr;
     }
 
     p->dhcp.siaddr = Adapter->m_dhcp_server_ip;
@@ -378,6 +340,244 @@ BuildDHCPPre (
 // Build specific DHCP messages
 //=============================
 
+//
+// Reply templates
+// ---------------
+// Everything in an OFFER, ACK or NAK except the destination, xid and
+// chaddr depends only on the DHCP masquerade configuration. Complete
+// replies are built once per TAP_WIN_IOCTL_CONFIG_DHCP_MASQ or
+// TAP_WIN_IOCTL_CONFIG_DHCP_SET_OPT, with xid and chaddr zero and (except
+// for NAK) a unicast destination. Each request copies a template and
+// patches those fields, and the client address in pool mode, updating the
+// IP and UDP checksums incrementally.
+//
+
+static ULONG
+DHCPTemplateIndex (
+    __in const int type
+    )
+{
+    switch (type)
+    {
+    case DHCPOFFER:
+        return 0;
+
+    case DHCPACK:
+        return 1;
+
+    default:
+        return 2;
+    }
+}
+
+static VOID
+BuildDHCPMsg(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __inout DHCPMsg *pkt,
+    __in const int type,
+    __in const ETH_HEADER *eth,
+    __in const IPHDR *ip,
+    __in const UDPHDR *udp,
+    __in const DHCP *dhcp,
+    __in const IPADDR yiaddr
+    )
+{
+    //-----------------------
+    // Build DHCP options
+    //-----------------------
+
+    // Message Type
+    SetDHCPOpt8 (pkt, DHCP_MSG_TYPE, type);
+
+    // Server ID
+    SetDHCPOpt32 (pkt, DHCP_SERVER_ID, Adapter->m_dhcp_server_ip);
+
+    if (type == DHCPOFFER || type == DHCPACK)
+    {
+        // Lease Time
+        SetDHCPOpt32 (pkt, DHCP_LEASE_TIME, htonl (Adapter->m_dhcp_lease_time));
+
+        // Netmask
+        SetDHCPOpt32 (pkt, DHCP_NETMASK, Adapter->m_dhcp_netmask);
+
+        // Other user-defined options
+        SetDHCPOpt (
+            pkt,
+            Adapter->m_dhcp_user_supplied_options_buffer,
+            Adapter->m_dhcp_user_supplied_options_buffer_len);
+    }
+
+    // End
+    SetDHCPOpt0 (pkt, DHCP_END);
+
+    if (!DHCPMSG_OVERFLOW (pkt))
+    {
+        // The initial part of the DHCP message (not including options) gets built here
+        BuildDHCPPre (
+            Adapter,
+            &pkt->msg.pre,
+            eth,
+            ip,
+            udp,
+            dhcp,
+            DHCPMSG_LEN_OPT (pkt),
+            type,
+            yiaddr);
+
+        SetChecksumDHCPMsg (pkt);
+    }
+}
+
+VOID
+BuildDHCPTemplates(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Rebuilds the OFFER, ACK and NAK templates from the adapter's DHCP
+    configuration. Senders copy a template under its sequence count and
+    build from scratch while it is odd, or if it moved during the copy.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    static const int types[] = { DHCPOFFER, DHCPACK, DHCPNAK };
+    ETH_HEADER  eth;
+    DHCP        dhcp;
+    KIRQL       irql;
+    int         i;
+
+    // A unicast request from an all-zero MAC with xid 0.
+    NdisZeroMemory (&eth, sizeof (eth));
+    NdisZeroMemory (&dhcp, sizeof (dhcp));
+
+    // Two handles may configure at once; keep the sequence count odd
+    // for the whole of each rebuild.
+    KeAcquireSpinLock (&Adapter->m_dhcp_templates_lock, &irql);
+
+    InterlockedIncrement (&Adapter->m_dhcp_templates_sequence);
+
+    for (i = 0; i < sizeof (types) / sizeof (types[0]); ++i)
+    {
+        DHCPMsg *pkt = &Adapter->m_dhcp_templates[DHCPTemplateIndex (types[i])];
+
+        NdisZeroMemory (pkt, sizeof (DHCPMsg));
+
+        BuildDHCPMsg (Adapter, pkt, types[i], &eth, NULL, NULL, &dhcp, Adapter->m_dhcp_addr);
+    }
+
+    InterlockedIncrement (&Adapter->m_dhcp_templates_sequence);
+
+    KeReleaseSpinLock (&Adapter->m_dhcp_templates_lock, irql);
+}
+
+// Copy the template for type into pkt. Returns FALSE if there is none,
+// it is being rebuilt, or it was rebuilt during every attempted copy.
+static BOOLEAN
+CopyDHCPTemplate(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __out DHCPMsg *pkt,
+    __in const int type
+    )
+{
+    const DHCPMsg   *tmpl = &Adapter->m_dhcp_templates[DHCPTemplateIndex (type)];
+    LONG            sequence;
+    int             attempt;
+
+    for (attempt = 0; attempt < DHCP_TEMPLATE_COPY_ATTEMPTS; ++attempt)
+    {
+        sequence = Adapter->m_dhcp_templates_sequence;
+        KeMemoryBarrier ();
+
+        if (sequence == 0 || (sequence & 1))
+        {
+            return FALSE;
+        }
+
+        // A length read mid-rebuild is still one the template had, so
+        // within the options buffer; the copy is discarded below.
+        pkt->optlen = tmpl->optlen;
+        pkt->overflow = tmpl->overflow;
+
+        if (!DHCPMSG_OVERFLOW (pkt))
+        {
+            NdisMoveMemory (DHCPMSG_BUF (pkt), DHCPMSG_BUF (tmpl), DHCPMSG_LEN_FULL (pkt));
+        }
+
+        KeMemoryBarrier ();
+
+        if (Adapter->m_dhcp_templates_sequence == sequence)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID
+PatchDHCPMsg(
+    __inout DHCPMsg *pkt,
+    __in const int type,
+    __in const ETH_HEADER *eth,
+    __in const DHCP *dhcp,
+    __in const IPADDR yiaddr
+    )
+{
+    DHCPPre *p = &pkt->msg.pre;
+    USHORT  ipCheck = ntohs (p->ip.check);
+    USHORT  udpCheck = ntohs (p->udp.check);
+    int     i;
+
+    // xid and chaddr are zero in the template and covered by the UDP checksum only.
+    p->dhcp.xid = dhcp->xid;
+    udpCheck = tapChecksumUpdate32 (udpCheck, 0, ntohl (dhcp->xid));
+
+    ETH_COPY_NETWORK_ADDRESS (p->dhcp.chaddr, eth->src);
+
+    for (i = 0; i < sizeof (MACADDR); i += 2)
+    {
+        udpCheck = tapChecksumUpdate16 (udpCheck, 0,
+            (USHORT) ((eth->src[i] << 8) | eth->src[i + 1]));
+    }
+
+    // NAK templates are already broadcast and carry no client address.
+    if (type != DHCPNAK)
+    {
+        // The template is addressed to its yiaddr.
+        const IPADDR daddr = ETH_IS_BROADCAST(eth->dest) ? ~0 : yiaddr;
+
+        if (yiaddr != p->dhcp.yiaddr)
+        {
+            udpCheck = tapChecksumUpdate32 (udpCheck, ntohl (p->dhcp.yiaddr), ntohl (yiaddr));
+            p->dhcp.yiaddr = yiaddr;
+        }
+
+        // The destination address is in the IP header and the UDP pseudo header.
+        if (daddr != p->ip.daddr)
+        {
+            ipCheck = tapChecksumUpdate32 (ipCheck, ntohl (p->ip.daddr), ntohl (daddr));
+            udpCheck = tapChecksumUpdate32 (udpCheck, ntohl (p->ip.daddr), ntohl (daddr));
+            p->ip.daddr = daddr;
+        }
+
+        if (ETH_IS_BROADCAST(eth->dest))
+        {
+            memset (p->eth.dest, 0xFF, ETH_LENGTH_OF_ADDRESS);
+        }
+        else
+        {
+            ETH_COPY_NETWORK_ADDRESS (p->eth.dest, eth->src);
+        }
+    }
+
+    p->ip.check = htons (ipCheck);
+    p->udp.check = htons (udpCheck);
+}
+
 VOID
 SendDHCPMsg(
     __in PTAP_ADAPTER_CONTEXT   Adapter,
@@ -385,7 +585,8 @@ SendDHCPMsg(
     __in const ETH_HEADER *eth,
     __in const IPHDR *ip,
     __in const UDPHDR *udp,
-    __in const DHCP *dhcp
+    __in const DHCP *dhcp,
+    __in const IPADDR yiaddr
     )
 {
     DHCPMsg *pkt;
@@ -396,53 +597,26 @@ SendDHCPMsg(
         return;
     }
 
-    pkt = (DHCPMsg *) MemAlloc (sizeof (DHCPMsg), TRUE);
+    pkt = (DHCPMsg *) MemAlloc (sizeof (DHCPMsg), FALSE);
 
     if(pkt)
     {
-        //-----------------------
-        // Build DHCP options
-        //-----------------------
-
-        // Message Type
-        SetDHCPOpt8 (pkt, DHCP_MSG_TYPE, type);
-
-        // Server ID
-        SetDHCPOpt32 (pkt, DHCP_SERVER_ID, Adapter->m_dhcp_server_ip);
-
-        if (type == DHCPOFFER || type == DHCPACK)
+        if (CopyDHCPTemplate (Adapter, pkt, type))
         {
-            // Lease Time
-            SetDHCPOpt32 (pkt, DHCP_LEASE_TIME, htonl (Adapter->m_dhcp_lease_time));
-
-            // Netmask
-            SetDHCPOpt32 (pkt, DHCP_NETMASK, Adapter->m_dhcp_netmask);
-
-            // Other user-defined options
-            SetDHCPOpt (
-                pkt,
-                Adapter->m_dhcp_user_supplied_options_buffer,
-                Adapter->m_dhcp_user_supplied_options_buffer_len);
+            if (!DHCPMSG_OVERFLOW (pkt))
+            {
+                PatchDHCPMsg (pkt, type, eth, dhcp, yiaddr);
+            }
         }
+        else
+        {
+            NdisZeroMemory (pkt, sizeof (DHCPMsg));
 
-        // End
-        SetDHCPOpt0 (pkt, DHCP_END);
+            BuildDHCPMsg (Adapter, pkt, type, eth, ip, udp, dhcp, yiaddr);
+        }
 
         if (!DHCPMSG_OVERFLOW (pkt))
         {
-            // The initial part of the DHCP message (not including options) gets built here
-            BuildDHCPPre (
-                Adapter,
-                &pkt->msg.pre,
-                eth,
-                ip,
-                udp,
-                dhcp,
-                DHCPMSG_LEN_OPT (pkt),
-                type);
-
-            SetChecksumDHCPMsg (pkt);
-
             DUMP_PACKET ("DHCPMsg",
                 DHCPMSG_BUF (pkt),
                 DHCPMSG_LEN_FULL (pkt));
@@ -463,6 +637,81 @@ SendDHCPMsg(
     }
 }
 
+//===================================================================
+// Answer a client other than the adapter itself from the address
+// pool (see dhcppool.c). Unlike the single-client case, every
+// message type a client sends is handled here.
+//===================================================================
+
+static VOID
+ProcessDHCPPool(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const int msg_type,
+    __in const ETH_HEADER *eth,
+    __in const IPHDR *ip,
+    __in const UDPHDR *udp,
+    __in const DHCP *dhcp,
+    __in const int optlen
+    )
+{
+    IPADDR requested = 0;
+    IPADDR server = 0;
+    IPADDR addr;
+
+    switch (msg_type)
+    {
+    case DHCPDISCOVER:
+        if (tapDhcpPoolOffer (Adapter, eth->src, &addr))
+        {
+            SendDHCPMsg (Adapter, DHCPOFFER, eth, ip, udp, dhcp, addr);
+        }
+        else
+        {
+            DEBUGP (("[TAP] DHCP pool exhausted\n"));
+        }
+        break;
+
+    case DHCPREQUEST:
+        // A client that selected another server's offer says so; ignore it.
+        if (GetDHCPOpt32 (dhcp, optlen, DHCP_SERVER_ID, &server)
+            && server != Adapter->m_dhcp_server_ip)
+        {
+            break;
+        }
+
+        // SELECTING and INIT-REBOOT clients name the address in an
+        // option, RENEWING and REBINDING clients in ciaddr.
+        if (!GetDHCPOpt32 (dhcp, optlen, DHCP_IP, &requested))
+        {
+            requested = dhcp->ciaddr;
+        }
+
+        if (tapDhcpPoolRequest (Adapter, eth->src, requested, &addr))
+        {
+            SendDHCPMsg (Adapter, DHCPACK, eth, ip, udp, dhcp, addr);
+        }
+        else
+        {
+            SendDHCPMsg (Adapter, DHCPNAK, eth, ip, udp, dhcp, 0);
+        }
+        break;
+
+    case DHCPRELEASE:
+        tapDhcpPoolRelease (Adapter, eth->src, dhcp->ciaddr, FALSE);
+        break;
+
+    case DHCPDECLINE:
+        if (GetDHCPOpt32 (dhcp, optlen, DHCP_IP, &requested))
+        {
+            tapDhcpPoolRelease (Adapter, eth->src, requested, TRUE);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
 //===================================================================
 // Handle a BOOTPS packet produced by the local system to
 // resolve the address/netmask of this adapter.
@@ -504,6 +753,13 @@ ProcessDHCP(
         return TRUE;
     }
 
+    // Clients other than the adapter itself are served from the pool
+    if (!MAC_EQUAL (eth->src, Adapter->CurrentAddress))
+    {
+        ProcessDHCPPool (Adapter, msg_type, eth, ip, udp, dhcp, optlen);
+        return TRUE;
+    }
+
     // Drop any messages except DHCPDISCOVER or DHCPREQUEST
     if (!(msg_type == DHCPDISCOVER || msg_type == DHCPREQUEST))
     {
@@ -519,7 +775,8 @@ ProcessDHCP(
         SendDHCPMsg(
             Adapter,
             DHCPNAK,
-            eth, ip, udp, dhcp
+            eth, ip, udp, dhcp,
+            Adapter->m_dhcp_addr
             );
     }
     else
@@ -527,7 +784,8 @@ ProcessDHCP(
         SendDHCPMsg(
             Adapter,
             (msg_type == DHCPDISCOVER ? DHCPOFFER : DHCPACK),
-            eth, ip, udp, dhcp
+            eth, ip, udp, dhcp,
+            Adapter->m_dhcp_addr
             );
     }
 
@@ -685,10 +943,11 @@ DumpDHCP (
 
     DEBUGP ((" ttl=%d", ip->ttl));
     DEBUGP ((" ic=0x%04x [0x%04x]", ntohs (ip->check),
-        ip_checksum ((UCHAR*)ip, sizeof (IPHDR))));
+        tapChecksumIPv4Header ((UCHAR*)ip, sizeof (IPHDR))));
     DEBUGP ((" uc=0x%04x [0x%04x/%d]", ntohs (udp->check),
-        udp_checksum ((UCHAR *) udp,
+        tapChecksumIPv4Pseudo ((UCHAR *) udp,
         sizeof (UDPHDR) + sizeof (DHCP) + optlen,
+        IPPROTO_UDP,
         (UCHAR *) &ip->saddr,
         (UCHAR *) &ip->daddr),
         optlen));
@@ -42,6 +42,13 @@
 #define DHCP_USER_SUPPLIED_OPTIONS_BUFFER_SIZE 256
 #define DHCP_OPTIONS_BUFFER_SIZE               256
 
+//================================================
+// Copies of a reply template a sender tries while
+// it is rebuilt, before building its own reply.
+//================================================
+
+#define DHCP_TEMPLATE_COPY_ATTEMPTS 4
+
 //===================================
 // UDP port numbers of DHCP messages.
 //===================================
@@ -0,0 +1,441 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//--------------------------
+// DHCP MASQUERADE ADDRESS POOL
+//--------------------------
+
+#include "tap.h"
+
+static ULONG
+tapDhcpPoolNow()
+{
+    // Interrupt time is in 100ns units and does not jump with the wall clock.
+    return (ULONG )(KeQueryInterruptTime() / 10000000);
+}
+
+static __inline ULONG
+tapDhcpPoolHash(
+    __in const UCHAR    *Mac
+    )
+{
+    ULONG   h = ((ULONG )Mac[0] << 8 | Mac[1]) ^ *(const ULONG UNALIGNED *)(Mac + 2);
+
+    return (h * 2654435761U) >> 22;     // Top 10 bits: TAP_DHCP_POOL_BUCKETS
+}
+
+static PTAP_DHCP_LEASE
+tapDhcpPoolLookup(
+    __in PTAP_DHCP_POOL Pool,
+    __in const UCHAR    *Mac
+    )
+{
+    PLIST_ENTRY bucket = &Pool->Buckets[tapDhcpPoolHash(Mac)];
+    PLIST_ENTRY link;
+
+    for(link = bucket->Flink; link != bucket; link = link->Flink)
+    {
+        PTAP_DHCP_LEASE lease = CONTAINING_RECORD(link, TAP_DHCP_LEASE, HashLink);
+
+        if(MAC_EQUAL(lease->Mac, Mac))
+        {
+            return lease;
+        }
+    }
+
+    return NULL;
+}
+
+static VOID
+tapDhcpPoolSchedule(
+    __in PTAP_DHCP_POOL     Pool,
+    __in PTAP_DHCP_LEASE    Lease,
+    __in ULONG              Expiry
+    )
+{
+    RemoveEntryList(&Lease->WheelLink);
+
+    Lease->Expiry = Expiry;
+    InsertTailList(&Pool->Wheel[Expiry & (TAP_DHCP_WHEEL_SLOTS - 1)], &Lease->WheelLink);
+}
+
+static VOID
+tapDhcpPoolFreeLease(
+    __in PTAP_DHCP_POOL     Pool,
+    __in PTAP_DHCP_LEASE    Lease
+    )
+{
+    if(Lease->State == TapDhcpLeaseOffered || Lease->State == TapDhcpLeaseBound)
+    {
+        RemoveEntryList(&Lease->HashLink);
+        InitializeListHead(&Lease->HashLink);
+    }
+
+    RemoveEntryList(&Lease->WheelLink);
+    InsertTailList(&Pool->FreeList, &Lease->WheelLink);
+
+    Lease->State = TapDhcpLeaseFree;
+}
+
+static VOID
+tapDhcpPoolAdvance(
+    __in PTAP_DHCP_POOL Pool,
+    __in ULONG          Now
+    )
+/*++
+
+Routine Description:
+
+    Expires every lease whose time has come since the wheel was last
+    advanced. Each slot also holds leases expiring in later turns of the
+    wheel; those are skipped.
+
+--*/
+{
+    ULONG   elapsed = Now - Pool->Tick;
+    ULONG   tick;
+
+    if(elapsed == 0)
+    {
+        return;
+    }
+
+    // After a full turn every slot needs looking at once.
+    elapsed = min(elapsed, TAP_DHCP_WHEEL_SLOTS);
+
+    for(tick = Now - elapsed + 1; elapsed > 0; ++tick, --elapsed)
+    {
+        PLIST_ENTRY slot = &Pool->Wheel[tick & (TAP_DHCP_WHEEL_SLOTS - 1)];
+        PLIST_ENTRY link = slot->Flink;
+
+        while(link != slot)
+        {
+            PTAP_DHCP_LEASE lease = CONTAINING_RECORD(link, TAP_DHCP_LEASE, WheelLink);
+
+            link = link->Flink;
+
+            if((LONG )(lease->Expiry - Now) <= 0)
+            {
+                tapDhcpPoolFreeLease(Pool, lease);
+            }
+        }
+    }
+
+    Pool->Tick = Now;
+}
+
+static VOID
+tapDhcpPoolAssign(
+    __in PTAP_DHCP_POOL     Pool,
+    __in PTAP_DHCP_LEASE    Lease,
+    __in const UCHAR        *Mac
+    )
+{
+    ASSERT(Lease->State == TapDhcpLeaseFree);
+
+    ETH_COPY_NETWORK_ADDRESS(Lease->Mac, Mac);
+    InsertTailList(&Pool->Buckets[tapDhcpPoolHash(Mac)], &Lease->HashLink);
+}
+
+static __inline IPADDR
+tapDhcpPoolAddress(
+    __in PTAP_DHCP_POOL     Pool,
+    __in PTAP_DHCP_LEASE    Lease
+    )
+{
+    return htonl(Pool->Start + (ULONG )(Lease - Pool->Leases));
+}
+
+static __inline PTAP_DHCP_LEASE
+tapDhcpPoolLeaseFromAddress(
+    __in PTAP_DHCP_POOL Pool,
+    __in IPADDR         Address
+    )
+{
+    ULONG   index = ntohl(Address) - Pool->Start;
+
+    return (index < Pool->Count) ? &Pool->Leases[index] : NULL;
+}
+
+NTSTATUS
+tapDhcpPoolConfigure(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in IPADDR                 Start,
+    __in ULONG                  Count
+    )
+/*++
+
+Routine Description:
+
+    Replaces the address pool with an empty one of Count addresses starting
+    at Start (network order). A Count of zero disables pool mode. The
+    adapter's own address and the server address are never handed out.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_DHCP_POOL  pool = NULL;
+    PTAP_DHCP_POOL  oldPool;
+    KIRQL           irql;
+    ULONG           i;
+
+    if(Count > TAP_WIN_DHCP_POOL_MAX || ntohl(Start) + Count < ntohl(Start))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if(Count > 0)
+    {
+        pool = (PTAP_DHCP_POOL )MemAlloc(TAP_DHCP_POOL_SIZE(Count), TRUE);
+
+        if(pool == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        pool->Start = ntohl(Start);
+        pool->Count = Count;
+        pool->Tick = tapDhcpPoolNow();
+
+        InitializeListHead(&pool->FreeList);
+
+        for(i = 0; i < TAP_DHCP_WHEEL_SLOTS; ++i)
+        {
+            InitializeListHead(&pool->Wheel[i]);
+        }
+
+        for(i = 0; i < TAP_DHCP_POOL_BUCKETS; ++i)
+        {
+            InitializeListHead(&pool->Buckets[i]);
+        }
+
+        for(i = 0; i < Count; ++i)
+        {
+            PTAP_DHCP_LEASE lease = &pool->Leases[i];
+
+            InitializeListHead(&lease->HashLink);
+            InitializeListHead(&lease->WheelLink);
+
+            if(tapDhcpPoolAddress(pool, lease) == Adapter->m_dhcp_addr
+                || tapDhcpPoolAddress(pool, lease) == Adapter->m_dhcp_server_ip)
+            {
+                lease->State = TapDhcpLeaseReserved;
+            }
+            else
+            {
+                lease->State = TapDhcpLeaseFree;
+                InsertTailList(&pool->FreeList, &lease->WheelLink);
+            }
+        }
+    }
+
+    KeAcquireSpinLock(&Adapter->m_dhcp_pool_lock, &irql);
+    oldPool = Adapter->m_dhcp_pool;
+    Adapter->m_dhcp_pool = pool;
+    KeReleaseSpinLock(&Adapter->m_dhcp_pool_lock, irql);
+
+    if(oldPool != NULL)
+    {
+        MemFree(oldPool, TAP_DHCP_POOL_SIZE(oldPool->Count));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+tapDhcpPoolOffer(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __out IPADDR                *Address
+    )
+/*++
+
+Routine Description:
+
+    Picks the address to offer a client: the one it already holds or has
+    been offered, else the least recently freed one. A new offer is held
+    for TAP_DHCP_OFFER_HOLD seconds.
+
+Return Value:
+
+    FALSE if pool mode is off or the pool is exhausted.
+
+--*/
+{
+    PTAP_DHCP_POOL  pool;
+    PTAP_DHCP_LEASE lease = NULL;
+    ULONG           now = tapDhcpPoolNow();
+    KIRQL           irql;
+
+    KeAcquireSpinLock(&Adapter->m_dhcp_pool_lock, &irql);
+
+    pool = Adapter->m_dhcp_pool;
+
+    if(pool != NULL)
+    {
+        tapDhcpPoolAdvance(pool, now);
+
+        lease = tapDhcpPoolLookup(pool, Mac);
+
+        if(lease == NULL && !IsListEmpty(&pool->FreeList))
+        {
+            lease = CONTAINING_RECORD(pool->FreeList.Flink, TAP_DHCP_LEASE, WheelLink);
+
+            tapDhcpPoolAssign(pool, lease, Mac);
+            lease->State = TapDhcpLeaseOffered;
+        }
+
+        if(lease != NULL)
+        {
+            if(lease->State == TapDhcpLeaseOffered)
+            {
+                tapDhcpPoolSchedule(pool, lease, now + TAP_DHCP_OFFER_HOLD);
+            }
+
+            *Address = tapDhcpPoolAddress(pool, lease);
+        }
+    }
+
+    KeReleaseSpinLock(&Adapter->m_dhcp_pool_lock, irql);
+
+    return (lease != NULL);
+}
+
+BOOLEAN
+tapDhcpPoolRequest(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __in IPADDR                 Requested,
+    __out IPADDR                *Address
+    )
+/*++
+
+Routine Description:
+
+    Binds (or renews) a lease for a DHCPREQUEST. Requested is the address
+    the client asked for, or zero if it did not say. A client without a
+    lease may claim a free address it asks for, e.g. after a reboot.
+
+Return Value:
+
+    FALSE if the request must be NAKed.
+
+--*/
+{
+    PTAP_DHCP_POOL  pool;
+    PTAP_DHCP_LEASE lease = NULL;
+    ULONG           now = tapDhcpPoolNow();
+    KIRQL           irql;
+
+    KeAcquireSpinLock(&Adapter->m_dhcp_pool_lock, &irql);
+
+    pool = Adapter->m_dhcp_pool;
+
+    if(pool != NULL)
+    {
+        tapDhcpPoolAdvance(pool, now);
+
+        lease = tapDhcpPoolLookup(pool, Mac);
+
+        if(lease == NULL)
+        {
+            lease = tapDhcpPoolLeaseFromAddress(pool, Requested);
+
+            if(lease != NULL && lease->State == TapDhcpLeaseFree)
+            {
+                tapDhcpPoolAssign(pool, lease, Mac);
+            }
+            else
+            {
+                lease = NULL;
+            }
+        }
+        else if(Requested != 0 && Requested != tapDhcpPoolAddress(pool, lease))
+        {
+            // The client wants an address other than its own; make it start over.
+            tapDhcpPoolFreeLease(pool, lease);
+            lease = NULL;
+        }
+
+        if(lease != NULL)
+        {
+            lease->State = TapDhcpLeaseBound;
+            tapDhcpPoolSchedule(pool, lease, now + min(Adapter->m_dhcp_lease_time, MAXLONG));
+
+            *Address = tapDhcpPoolAddress(pool, lease);
+        }
+    }
+
+    KeReleaseSpinLock(&Adapter->m_dhcp_pool_lock, irql);
+
+    return (lease != NULL);
+}
+
+VOID
+tapDhcpPoolRelease(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __in IPADDR                 Address,
+    __in BOOLEAN                Declined
+    )
+/*++
+
+Routine Description:
+
+    Handles DHCPRELEASE and DHCPDECLINE. A released address is freed at
+    once. A declined address is in use by someone else, so it is kept out
+    of the pool for one lease time.
+
+--*/
+{
+    PTAP_DHCP_POOL  pool;
+    PTAP_DHCP_LEASE lease;
+    ULONG           now = tapDhcpPoolNow();
+    KIRQL           irql;
+
+    KeAcquireSpinLock(&Adapter->m_dhcp_pool_lock, &irql);
+
+    pool = Adapter->m_dhcp_pool;
+
+    if(pool != NULL)
+    {
+        tapDhcpPoolAdvance(pool, now);
+
+        lease = tapDhcpPoolLookup(pool, Mac);
+
+        if(lease != NULL && tapDhcpPoolAddress(pool, lease) == Address)
+        {
+            tapDhcpPoolFreeLease(pool, lease);
+
+            if(Declined)
+            {
+                lease->State = TapDhcpLeaseDeclined;
+                tapDhcpPoolSchedule(pool, lease, now + min(Adapter->m_dhcp_lease_time, MAXLONG));
+            }
+        }
+    }
+
+    KeReleaseSpinLock(&Adapter->m_dhcp_pool_lock, irql);
+}
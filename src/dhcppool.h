@@ -0,0 +1,87 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef __TAP_DHCP_POOL_H_
+#define __TAP_DHCP_POOL_H_
+
+//======================================================================
+// DHCP masquerade address pool.
+//
+// In pool mode the DHCP masquerade server answers clients other than the
+// adapter itself (e.g. VMs bridged behind it) from a range of addresses
+// configured through TAP_WIN_IOCTL_CONFIG_DHCP_POOL.
+//
+// Lease i holds address Start + i. Leases owned by a client are found by
+// MAC through a hash table. Leases that are offered, bound or declined
+// sit on a timer wheel of one second slots keyed by expiry; the wheel is
+// advanced whenever the pool is used, so an idle pool costs nothing.
+// Expired leases go to the tail of the free list, which is allocated
+// from the head, so a returning client usually gets its old address
+// back.
+//======================================================================
+
+#define TAP_DHCP_POOL_BUCKETS       1024        // Power of two
+#define TAP_DHCP_WHEEL_SLOTS        256         // Power of two
+#define TAP_DHCP_OFFER_HOLD         30          // Seconds an offered address is held
+
+typedef enum _TAP_DHCP_LEASE_STATE
+{
+    TapDhcpLeaseFree,
+    TapDhcpLeaseOffered,
+    TapDhcpLeaseBound,
+    TapDhcpLeaseDeclined,
+    TapDhcpLeaseReserved,   // The adapter or server address; never handed out
+} TAP_DHCP_LEASE_STATE;
+
+typedef struct _TAP_DHCP_LEASE
+{
+    // Hash bucket chain while owned by a client (offered or bound).
+    LIST_ENTRY              HashLink;
+
+    // Timer wheel slot while offered, bound or declined; free list while free.
+    LIST_ENTRY              WheelLink;
+
+    ULONG                   Expiry;     // Seconds, see tapDhcpPoolNow
+    MACADDR                 Mac;
+    UCHAR                   State;      // TAP_DHCP_LEASE_STATE
+} TAP_DHCP_LEASE, *PTAP_DHCP_LEASE;
+
+typedef struct _TAP_DHCP_POOL
+{
+    ULONG                   Start;      // First address, host order
+    ULONG                   Count;
+    ULONG                   Tick;       // Last second the wheel was advanced to
+
+    LIST_ENTRY              FreeList;
+    LIST_ENTRY              Wheel[TAP_DHCP_WHEEL_SLOTS];
+    LIST_ENTRY              Buckets[TAP_DHCP_POOL_BUCKETS];
+
+    // Count entries.
+    TAP_DHCP_LEASE          Leases[];
+} TAP_DHCP_POOL, *PTAP_DHCP_POOL;
+
+#define TAP_DHCP_POOL_SIZE(count) (sizeof(TAP_DHCP_POOL) + (count) * sizeof(TAP_DHCP_LEASE))
+
+#endif // __TAP_DHCP_POOL_H_
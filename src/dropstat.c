@@ -0,0 +1,157 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// DROP STATISTICS
+//-----------------
+
+#include "tap.h"
+
+NDIS_STATUS
+tapDropStatsInitialize(
+    __in PTAP_DROP_STATS    Stats
+    )
+/*++
+
+Routine Description:
+
+    Allocates one cache aligned block of counters per possible processor.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Return Value:
+
+    NDIS_STATUS_SUCCESS or NDIS_STATUS_RESOURCES.
+
+--*/
+{
+    ULONG   cpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    ULONG   allocationSize = cpuCount * sizeof(TAP_DROP_CPU) + TAP_DROP_CACHE_LINE - 1;
+
+    // Pool allocations are only aligned to 16 bytes or so.
+    Stats->Allocation = MemAlloc(allocationSize, TRUE);
+
+    if(Stats->Allocation == NULL)
+    {
+        DEBUGP (("[TAP] tapDropStatsInitialize: Counter allocation failed\n"));
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    Stats->AllocationSize = allocationSize;
+    Stats->Cpus = (PTAP_DROP_CPU )(((ULONG_PTR )Stats->Allocation + TAP_DROP_CACHE_LINE - 1)
+                    & ~(ULONG_PTR )(TAP_DROP_CACHE_LINE - 1));
+    Stats->CpuCount = cpuCount;
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+tapDropStatsFree(
+    __in PTAP_DROP_STATS    Stats
+    )
+{
+    if(Stats->Allocation != NULL)
+    {
+        MemFree(Stats->Allocation, Stats->AllocationSize);
+    }
+
+    Stats->Cpus = NULL;
+    Stats->Allocation = NULL;
+    Stats->AllocationSize = 0;
+    Stats->CpuCount = 0;
+}
+
+VOID
+tapDropStatsQuery(
+    __in PTAP_DROP_STATS        Stats,
+    __in ULONG                  Flags,
+    __out TAP_WIN_DROP_STATS    *Copy
+    )
+/*++
+
+Routine Description:
+
+    Handles TAP_WIN_IOCTL_GET_DROP_STATS: sums the per-CPU counters. With
+    TAP_WIN_DROP_STATS_RESET each counter is zeroed as it is read, so no
+    drop is lost between the two.
+
+--*/
+{
+    BOOLEAN     reset = (Flags & TAP_WIN_DROP_STATS_RESET) ? TRUE : FALSE;
+    ULONG       cpu;
+    ULONG       reason;
+
+    NdisZeroMemory(Copy, sizeof(TAP_WIN_DROP_STATS));
+
+    Copy->DropCount = TAP_WIN_DROP_COUNT;
+
+    for(cpu = 0; cpu < Stats->CpuCount; ++cpu)
+    {
+        PTAP_DROP_CPU   counters = &Stats->Cpus[cpu];
+
+        for(reason = 0; reason < TAP_DROP_COUNTERS; ++reason)
+        {
+            ULONG64     count;
+
+            if(reset)
+            {
+                count = InterlockedExchange64(&counters->Counters[reason], 0);
+            }
+            else
+            {
+                count = counters->Counters[reason];
+            }
+
+            if(reason == TAP_DROP_HANDLED)
+            {
+                Copy->Handled += count;
+            }
+            else
+            {
+                Copy->Drops[reason] += count;
+            }
+        }
+    }
+}
+
+// All drops, for any reason; frames handled in the driver are not drops.
+ULONG64
+tapDropStatsTotal(
+    __in PTAP_DROP_STATS    Stats
+    )
+{
+    ULONG64     total = 0;
+    ULONG       cpu;
+    ULONG       reason;
+
+    for(cpu = 0; cpu < Stats->CpuCount; ++cpu)
+    {
+        for(reason = 0; reason < TAP_WIN_DROP_COUNT; ++reason)
+        {
+            total += Stats->Cpus[cpu].Counters[reason];
+        }
+    }
+
+    return total;
+}
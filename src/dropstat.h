@@ -0,0 +1,115 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_DROPSTAT_H_
+#define __TAP_DROPSTAT_H_
+
+//======================================================================
+// Drop counters.
+//
+// Every point where a frame is discarded counts it under a
+// TAP_WIN_DROP_* reason, and frames the driver answers itself are
+// counted as handled, apart from the drops. Each CPU counts in its own
+// cache aligned block so the counters are not shared between
+// processors. A count made at PASSIVE_LEVEL may land in another CPU's
+// block if the thread moves, hence the interlocked add.
+//======================================================================
+
+#define TAP_DROP_HANDLED        TAP_WIN_DROP_COUNT  // Not a drop; see TAP_HANDLED
+#define TAP_DROP_COUNTERS       (TAP_WIN_DROP_COUNT + 1)
+
+#define TAP_DROP_CACHE_LINE     64
+
+typedef struct _TAP_DROP_CPU
+{
+    // Padded to a whole number of cache lines; blocks are allocated
+    // cache aligned.
+    volatile LONG64     Counters[(TAP_DROP_COUNTERS + 7) & ~7];
+} TAP_DROP_CPU, *PTAP_DROP_CPU;
+
+C_ASSERT(sizeof(TAP_DROP_CPU) % TAP_DROP_CACHE_LINE == 0);
+
+typedef struct _TAP_DROP_STATS
+{
+    PTAP_DROP_CPU       Cpus;           // In Allocation, cache aligned
+    PVOID               Allocation;
+    ULONG               AllocationSize;
+    ULONG               CpuCount;
+} TAP_DROP_STATS, *PTAP_DROP_STATS;
+
+NDIS_STATUS
+tapDropStatsInitialize(
+    __in PTAP_DROP_STATS    Stats
+    );
+
+VOID
+tapDropStatsFree(
+    __in PTAP_DROP_STATS    Stats
+    );
+
+VOID
+tapDropStatsQuery(
+    __in PTAP_DROP_STATS        Stats,
+    __in ULONG                  Flags,
+    __out TAP_WIN_DROP_STATS    *Copy
+    );
+
+ULONG64
+tapDropStatsTotal(
+    __in PTAP_DROP_STATS    Stats
+    );
+
+// Counts Count frames under a TAP_WIN_DROP_* reason, or TAP_DROP_HANDLED.
+static __forceinline VOID
+tapDropCount(
+    __in PTAP_DROP_STATS    Stats,
+    __in ULONG              Reason,
+    __in ULONG              Count
+    )
+{
+    ULONG   cpu;
+
+    if(Stats->Cpus == NULL || Stats->CpuCount == 0)
+    {
+        return;
+    }
+
+    cpu = KeGetCurrentProcessorNumberEx(NULL);
+
+    if(cpu >= Stats->CpuCount)
+    {
+        cpu = 0;
+    }
+
+    InterlockedExchangeAdd64(&Stats->Cpus[cpu].Counters[Reason], Count);
+}
+
+#define TAP_DROP(_adapter, _reason) \
+    tapDropCount (&(_adapter)->DropStats, (_reason), 1)
+
+// A frame sent that the driver answered itself.
+#define TAP_HANDLED(_adapter) \
+    tapDropCount (&(_adapter)->DropStats, TAP_DROP_HANDLED, 1)
+
+#endif // __TAP_DROPSTAT_H_
@@ -44,18 +44,6 @@ extern int g_LastErrorLineNumber;
 
 #if DBG
 
-typedef struct
-{
-    unsigned int in;
-    unsigned int out;
-    unsigned int capacity;
-    char *text;
-    BOOLEAN error;
-    MUTEX lock;
-} DebugOutput;
-
-VOID MyDebugPrint (const unsigned char* format, ...);
-
 VOID PrMac (const MACADDR mac);
 
 VOID PrIP (IPADDR ip_addr);
@@ -83,10 +71,14 @@ DumpPacket2(
 
 #define CAN_WE_PRINT (DEBUGP_AT_DISPATCH || KeGetCurrentIrql () < DISPATCH_LEVEL)
 
+//
+// Text output goes to the kernel debugger only. Anything worth keeping in a
+// release build belongs in the binary trace ring (trace.h) instead.
+//
 #if ALSO_DBGPRINT
-#define DEBUGP(fmt) { MyDebugPrint fmt; if (CAN_WE_PRINT) DbgPrint fmt; }
+#define DEBUGP(fmt) { if (CAN_WE_PRINT) DbgPrint fmt; }
 #else
-#define DEBUGP(fmt) { MyDebugPrint fmt; }
+#define DEBUGP(fmt)
 #endif
 
 #ifdef ALLOW_PACKET_DUMP
@@ -99,12 +91,6 @@ DumpPacket2(
 
 #endif
 
-BOOLEAN
-GetDebugLine (
-    __in char *buf,
-    __in const int len
-    );
-
 #else 
 
 #define DEBUGP(fmt)
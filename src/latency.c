@@ -0,0 +1,237 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// LATENCY STATISTICS
+//-----------------
+
+#include "tap.h"
+
+VOID
+tapLatencyCount(
+    __in PTAP_LATENCY_STATS     Stats,
+    __in ULONG                  Histogram,
+    __in ULONG64                Ticks
+    )
+{
+    PTAP_LATENCY_CPU        cpus = Stats->Cpus;
+    PTAP_LATENCY_HISTOGRAM  histogram;
+    ULONG                   cpu;
+
+    if(cpus == NULL)
+    {
+        return;
+    }
+
+    cpu = KeGetCurrentProcessorNumberEx(NULL);
+
+    if(cpu >= Stats->CpuCount)
+    {
+        cpu = 0;
+    }
+
+    histogram = &cpus[cpu].Histograms[Histogram];
+
+    InterlockedIncrement64(&histogram->Count);
+    InterlockedExchangeAdd64(&histogram->Sum, (LONG64 )Ticks);
+    InterlockedIncrement64(&histogram->Buckets[tapLatencyBucket(Ticks)]);
+}
+
+// Adds one CPU's histogram to Total, zeroing each counter as it is read
+// with Reset.
+static VOID
+tapLatencyAdd(
+    __in PTAP_LATENCY_HISTOGRAM     Histogram,
+    __inout TAP_WIN_LATENCY_HISTOGRAM *Total,
+    __in BOOLEAN                    Reset
+    )
+{
+    ULONG   i;
+
+    if(Reset)
+    {
+        Total->Count += InterlockedExchange64(&Histogram->Count, 0);
+        Total->Sum += InterlockedExchange64(&Histogram->Sum, 0);
+
+        for(i = 0; i < TAP_WIN_LATENCY_BUCKETS; ++i)
+        {
+            Total->Buckets[i] += InterlockedExchange64(&Histogram->Buckets[i], 0);
+        }
+    }
+    else
+    {
+        Total->Count += Histogram->Count;
+        Total->Sum += Histogram->Sum;
+
+        for(i = 0; i < TAP_WIN_LATENCY_BUCKETS; ++i)
+        {
+            Total->Buckets[i] += Histogram->Buckets[i];
+        }
+    }
+}
+
+static NTSTATUS
+tapLatencyStatsEnable(
+    __in PTAP_LATENCY_STATS     Stats,
+    __in BOOLEAN                Enable
+    )
+/*++
+
+Routine Description:
+
+    Turns collection on or off, allocating the per-CPU histograms the
+    first time it is turned on. They are kept until the adapter is
+    freed, as the data paths may be using them.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    if(Enable && Stats->Cpus == NULL)
+    {
+        ULONG               cpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        PTAP_LATENCY_CPU    cpus;
+
+        cpus = (PTAP_LATENCY_CPU )MemAlloc(cpuCount * sizeof(TAP_LATENCY_CPU), TRUE);
+
+        if(cpus == NULL)
+        {
+            DEBUGP (("[TAP] tapLatencyStatsEnable: Histogram allocation failed\n"));
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Stats->CpuCount = cpuCount;
+
+        // Another request may have got there first.
+        if(InterlockedCompareExchangePointer(
+                (PVOID *)&Stats->Cpus,
+                cpus,
+                NULL
+                ) != NULL)
+        {
+            MemFree(cpus, cpuCount * sizeof(TAP_LATENCY_CPU));
+        }
+    }
+
+    Stats->Enabled = Enable;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+tapLatencyStatsQuery(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in_opt const ULONG        *Flags,
+    __out TAP_WIN_LATENCY_STATS *Stats
+    )
+/*++
+
+Routine Description:
+
+    Handles TAP_WIN_IOCTL_GET_LATENCY_STATS: sums the per-CPU latency
+    histograms, finds the oldest frame waiting for a read, then applies
+    the optional flags.
+
+    Flags must not point into Stats.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_LATENCY_STATS  latency = &Adapter->Latency;
+    PTAP_LATENCY_CPU    cpus = latency->Cpus;
+    BOOLEAN             reset = (Flags != NULL && (*Flags & TAP_WIN_LATENCY_STATS_RESET));
+    LARGE_INTEGER       frequency;
+    ULONG64             now;
+    ULONG               i;
+
+    now = KeQueryPerformanceCounter(&frequency).QuadPart;
+
+    NdisZeroMemory(Stats, sizeof(TAP_WIN_LATENCY_STATS));
+
+    Stats->Frequency = frequency.QuadPart;
+    Stats->Enabled = latency->Enabled;
+
+    // The head of each queue is its oldest frame.
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        PTAP_PACKET_QUEUE   packetQueue = &Adapter->Queues[i].SendPacketQueue;
+        KIRQL               irql;
+
+        tapPacketQueueAcquireLock(packetQueue,&irql);
+
+        if(!IsListEmpty(&packetQueue->Queue))
+        {
+            PTAP_PACKET tapPacket = CONTAINING_RECORD(
+                                        packetQueue->Queue.Flink,
+                                        TAP_PACKET,
+                                        QueueLink
+                                        );
+
+            // A frame may have been queued since the counter was read.
+            if(tapPacket->m_EnqueueTime < now
+                && now - tapPacket->m_EnqueueTime > Stats->OldestQueuedAge)
+            {
+                Stats->OldestQueuedAge = now - tapPacket->m_EnqueueTime;
+            }
+        }
+
+        tapPacketQueueReleaseLock(packetQueue,irql);
+    }
+
+    if(cpus != NULL)
+    {
+        for(i = 0; i < latency->CpuCount; ++i)
+        {
+            tapLatencyAdd(&cpus[i].Histograms[TAP_LATENCY_QUEUE_DELAY], &Stats->QueueDelay, reset);
+            tapLatencyAdd(&cpus[i].Histograms[TAP_LATENCY_STACK_HOLD], &Stats->StackHold, reset);
+            tapLatencyAdd(&cpus[i].Histograms[TAP_LATENCY_WRITE_INDICATE], &Stats->WriteToIndicate, reset);
+        }
+    }
+
+    if(Flags != NULL)
+    {
+        return tapLatencyStatsEnable(
+                    latency,
+                    (*Flags & TAP_WIN_LATENCY_STATS_ENABLE) ? TRUE : FALSE
+                    );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapLatencyStatsFree(
+    __in PTAP_LATENCY_STATS     Stats
+    )
+{
+    Stats->Enabled = FALSE;
+
+    if(Stats->Cpus != NULL)
+    {
+        MemFree(Stats->Cpus, Stats->CpuCount * sizeof(TAP_LATENCY_CPU));
+
+        Stats->Cpus = NULL;
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_LATENCY_H_
+#define __TAP_LATENCY_H_
+
+//======================================================================
+// Packet latency histograms.
+//
+// Frames queued for userspace are stamped with the performance counter
+// when queued and measured when a read takes them. Receive indications
+// are stamped in their first NB's MiniportReserved and measured when
+// the stack returns them. Writes carrying a timestamp are measured from
+// it to their indication.
+//
+// Collection is off until enabled through TAP_WIN_IOCTL_GET_LATENCY_STATS;
+// while it is off each record is one test, and indications are not
+// stamped. Each CPU has its own histograms, allocated when collection is
+// first enabled and summed when read. A frame measured at PASSIVE_LEVEL
+// may be counted in another CPU's histograms if the thread moves, hence
+// the interlocked adds.
+//======================================================================
+
+#define TAP_LATENCY_QUEUE_DELAY     0   // Queued until read
+#define TAP_LATENCY_STACK_HOLD      1   // Indicated until returned
+#define TAP_LATENCY_WRITE_INDICATE  2   // Writer's timestamp until indicated
+#define TAP_LATENCY_COUNT           3
+
+typedef struct _TAP_LATENCY_HISTOGRAM
+{
+    volatile LONG64     Count;
+    volatile LONG64     Sum;
+    volatile LONG64     Buckets[TAP_WIN_LATENCY_BUCKETS];
+} TAP_LATENCY_HISTOGRAM, *PTAP_LATENCY_HISTOGRAM;
+
+typedef struct _TAP_LATENCY_CPU
+{
+    TAP_LATENCY_HISTOGRAM   Histograms[TAP_LATENCY_COUNT];
+} TAP_LATENCY_CPU, *PTAP_LATENCY_CPU;
+
+typedef struct _TAP_LATENCY_STATS
+{
+    PTAP_LATENCY_CPU    Cpus;           // NULL until collection is first enabled
+    ULONG               CpuCount;
+    volatile BOOLEAN    Enabled;
+} TAP_LATENCY_STATS, *PTAP_LATENCY_STATS;
+
+// Indication timestamp of a receive NBL, 0 if not stamped. Pointer
+// sized, so it wraps on 32 bit systems; differences are taken modulo
+// pointer size.
+#define TAP_RX_NBL_SET_INDICATE_TIME(_NBL, _T) \
+    (NET_BUFFER_MINIPORT_RESERVED(NET_BUFFER_LIST_FIRST_NB(_NBL))[0] = (PVOID )(ULONG_PTR )(_T))
+
+#define TAP_RX_NBL_INDICATE_TIME(_NBL) \
+    ((ULONG_PTR )NET_BUFFER_MINIPORT_RESERVED(NET_BUFFER_LIST_FIRST_NB(_NBL))[0])
+
+// Log-linear bucket of Ticks, as described for TAP_WIN_LATENCY_STATS.
+static __inline ULONG
+tapLatencyBucket(
+    __in ULONG64    Ticks
+    )
+{
+    ULONG   magnitude = 0;
+    ULONG   bucket;
+    ULONG64 value;
+
+    if(Ticks < TAP_WIN_LATENCY_SUB_BUCKETS)
+    {
+        return (ULONG )Ticks;
+    }
+
+    // Index of the highest bit set, TAP_WIN_LATENCY_SUB_BUCKET_BITS or more.
+    for(value = Ticks >> 1; value != 0; value >>= 1)
+    {
+        ++magnitude;
+    }
+
+    bucket = TAP_WIN_LATENCY_SUB_BUCKETS * (magnitude - TAP_WIN_LATENCY_SUB_BUCKET_BITS)
+        + (ULONG )(Ticks >> (magnitude - TAP_WIN_LATENCY_SUB_BUCKET_BITS));
+
+    return min(bucket, TAP_WIN_LATENCY_BUCKETS - 1);
+}
+
+VOID
+tapLatencyCount(
+    __in PTAP_LATENCY_STATS     Stats,
+    __in ULONG                  Histogram,
+    __in ULONG64                Ticks
+    );
+
+// Records Ticks in one of the TAP_LATENCY_* histograms of the current CPU.
+static __forceinline VOID
+tapLatencyRecord(
+    __in PTAP_LATENCY_STATS     Stats,
+    __in ULONG                  Histogram,
+    __in ULONG64                Ticks
+    )
+{
+    if(Stats->Enabled)
+    {
+        tapLatencyCount(Stats, Histogram, Ticks);
+    }
+}
+
+VOID
+tapLatencyStatsFree(
+    __in PTAP_LATENCY_STATS     Stats
+    );
+
+#endif // __TAP_LATENCY_H_
@@ -0,0 +1,180 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//-----------------
+// LOCK STATISTICS
+//-----------------
+
+#include "tap.h"
+
+ULONG64
+tapLockStatAcquire(
+    __in PKSPIN_LOCK        Lock,
+    __in PTAP_LOCK_STAT     Stat
+    )
+{
+    ULONG64     acquiredAt;
+
+    InterlockedIncrement64(&Stat->Acquisitions);
+
+    if(KeTryToAcquireSpinLockAtDpcLevel(Lock))
+    {
+        acquiredAt = KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+    else
+    {
+        ULONG64     waitStart = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        KeAcquireSpinLockAtDpcLevel(Lock);
+
+        acquiredAt = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        InterlockedIncrement64(&Stat->Contended);
+        InterlockedIncrement64(&Stat->WaitHistogram[
+            tapHistogramBucket(acquiredAt - waitStart, TAP_WIN_LOCK_HISTOGRAM_BUCKETS)]);
+    }
+
+    // 0 means "not timed" to tapSpinLockRelease.
+    return acquiredAt != 0 ? acquiredAt : 1;
+}
+
+VOID
+tapLockStatRelease(
+    __in PTAP_LOCK_STAT     Stat,
+    __in ULONG64            AcquiredAt
+    )
+{
+    ULONG64     now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    InterlockedIncrement64(&Stat->HoldHistogram[
+        tapHistogramBucket(now - AcquiredAt, TAP_WIN_LOCK_HISTOGRAM_BUCKETS)]);
+}
+
+VOID
+tapLockStatCopy(
+    __in PTAP_LOCK_STAT         Stat,
+    __out TAP_WIN_LOCK_STAT     *Copy,
+    __in BOOLEAN                Reset
+    )
+/*++
+
+Routine Description:
+
+    Copies the counters of one lock out. With Reset, each counter is
+    zeroed as it is read, so no acquisition is lost between the two;
+    the copy is not a consistent snapshot across counters.
+
+--*/
+{
+    ULONG   i;
+
+    if(Reset)
+    {
+        Copy->Acquisitions = InterlockedExchange64(&Stat->Acquisitions, 0);
+        Copy->Contended = InterlockedExchange64(&Stat->Contended, 0);
+
+        for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS; ++i)
+        {
+            Copy->WaitHistogram[i] = InterlockedExchange64(&Stat->WaitHistogram[i], 0);
+            Copy->HoldHistogram[i] = InterlockedExchange64(&Stat->HoldHistogram[i], 0);
+        }
+    }
+    else
+    {
+        Copy->Acquisitions = Stat->Acquisitions;
+        Copy->Contended = Stat->Contended;
+
+        for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS; ++i)
+        {
+            Copy->WaitHistogram[i] = Stat->WaitHistogram[i];
+            Copy->HoldHistogram[i] = Stat->HoldHistogram[i];
+        }
+    }
+}
+
+NTSTATUS
+tapLockStatsQuery(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in_opt const ULONG        *Flags,
+    __out TAP_WIN_LOCK_STATS    *Stats
+    )
+/*++
+
+Routine Description:
+
+    Handles TAP_WIN_IOCTL_GET_LOCK_STATS: copies the adapter's lock
+    statistics out, then applies the optional flags.
+
+--*/
+{
+    LARGE_INTEGER   frequency;
+    BOOLEAN         reset = (Flags != NULL && (*Flags & TAP_WIN_LOCK_STATS_RESET));
+    ULONG           i;
+
+    KeQueryPerformanceCounter(&frequency);
+
+    Stats->Frequency = frequency.QuadPart;
+    Stats->Enabled = Adapter->LockStats[0].Enabled;
+    Stats->LockCount = TAP_WIN_LOCK_COUNT;
+
+    for(i = 0; i < TAP_WIN_LOCK_COUNT; ++i)
+    {
+        tapLockStatCopy(&Adapter->LockStats[i], &Stats->Locks[i], reset);
+
+        if(Flags != NULL)
+        {
+            Adapter->LockStats[i].Enabled = (*Flags & TAP_WIN_LOCK_STATS_ENABLE) ? TRUE : FALSE;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapLockStatsInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Points each per-handle queue at the adapter's statistics for its
+    kind of lock. Collection starts off.
+
+--*/
+{
+    ULONG   i;
+
+    NdisZeroMemory(Adapter->LockStats, sizeof(Adapter->LockStats));
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        PTAP_QUEUE  queue = &Adapter->Queues[i];
+
+        queue->SendPacketQueue.LockStat = &Adapter->LockStats[TAP_WIN_LOCK_SEND_QUEUE];
+        queue->PendingReadIrpQueue.LockStat = &Adapter->LockStats[TAP_WIN_LOCK_READ_IRP_QUEUE];
+        queue->FlowControlLockStat = &Adapter->LockStats[TAP_WIN_LOCK_FLOW_CONTROL];
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef __TAP_LOCKSTAT_H_
+#define __TAP_LOCKSTAT_H_
+
+//======================================================================
+// Spin lock statistics.
+//
+// The adapter's hot spin locks are taken through tapSpinLockAcquire and
+// tapSpinLockRelease. While collection is off these are KeAcquireSpinLock
+// and KeReleaseSpinLock behind one test of the Enabled flag. While it is
+// on, an acquisition first tries the lock; if that fails it is counted
+// as contended and the wait is timed. The hold time is measured from the
+// acquisition, whose timestamp is kept in the structure the lock guards
+// until release. A lock acquired while collection was off is released
+// without being timed.
+//======================================================================
+
+typedef struct _TAP_LOCK_STAT
+{
+    volatile BOOLEAN    Enabled;
+
+    volatile LONG64     Acquisitions;
+    volatile LONG64     Contended;
+    volatile LONG64     WaitHistogram[TAP_WIN_LOCK_HISTOGRAM_BUCKETS];
+    volatile LONG64     HoldHistogram[TAP_WIN_LOCK_HISTOGRAM_BUCKETS];
+} TAP_LOCK_STAT, *PTAP_LOCK_STAT;
+
+// Log2 histogram bucket: 0 for 0, i for 2^(i-1) <= Value < 2^i, the
+// last bucket for anything larger.
+static __inline ULONG
+tapHistogramBucket(
+    __in ULONG64    Value,
+    __in ULONG      BucketCount
+    )
+{
+    ULONG   bucket = 0;
+
+    while(Value != 0 && bucket < BucketCount - 1)
+    {
+        Value >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+// Acquire Lock at DISPATCH_LEVEL, counting it in Stat. Returns the
+// acquisition timestamp, never 0.
+ULONG64
+tapLockStatAcquire(
+    __in PKSPIN_LOCK        Lock,
+    __in PTAP_LOCK_STAT     Stat
+    );
+
+// Count the hold time of a lock acquired at AcquiredAt.
+VOID
+tapLockStatRelease(
+    __in PTAP_LOCK_STAT     Stat,
+    __in ULONG64            AcquiredAt
+    );
+
+VOID
+tapLockStatCopy(
+    __in PTAP_LOCK_STAT         Stat,
+    __out TAP_WIN_LOCK_STAT     *Copy,
+    __in BOOLEAN                Reset
+    );
+
+_IRQL_raises_(DISPATCH_LEVEL)
+static __forceinline VOID
+tapSpinLockAcquire(
+    __in PKSPIN_LOCK        Lock,
+    __in_opt PTAP_LOCK_STAT Stat,
+    __out PULONG64          AcquiredAt,
+    __out PKIRQL            Irql
+    )
+{
+    if(Stat != NULL && Stat->Enabled)
+    {
+        KeRaiseIrql(DISPATCH_LEVEL, Irql);
+
+        *AcquiredAt = tapLockStatAcquire(Lock, Stat);
+    }
+    else
+    {
+        KeAcquireSpinLock(Lock, Irql);
+
+        *AcquiredAt = 0;
+    }
+}
+
+_IRQL_requires_(DISPATCH_LEVEL)
+static __forceinline VOID
+tapSpinLockRelease(
+    __in PKSPIN_LOCK        Lock,
+    __in_opt PTAP_LOCK_STAT Stat,
+    __in ULONG64            AcquiredAt,
+    __in KIRQL              Irql
+    )
+{
+    if(AcquiredAt != 0)
+    {
+        tapLockStatRelease(Stat, AcquiredAt);
+
+        KeReleaseSpinLockFromDpcLevel(Lock);
+        KeLowerIrql(Irql);
+    }
+    else
+    {
+        KeReleaseSpinLock(Lock, Irql);
+    }
+}
+
+#endif // __TAP_LOCKSTAT_H_
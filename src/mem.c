@@ -87,7 +87,7 @@ MemFree(
 // TAP Packet Queue Support
 //======================================================================
 
-VOID
+BOOLEAN
 tapPacketQueueInsertTail(
     __in PTAP_PACKET_QUEUE  TapPacketQueue,
     __in PTAP_PACKET        TapPacket
@@ -95,7 +95,13 @@ tapPacketQueueInsertTail(
 {
     KIRQL  irql;
 
-    KeAcquireSpinLock(&TapPacketQueue->QueueLock,&irql);
+    tapPacketQueueAcquireLock(TapPacketQueue,&irql);
+
+    if(TapPacketQueue->Closed)
+    {
+        tapPacketQueueReleaseLock(TapPacketQueue,irql);
+        return FALSE;
+    }
 
     InsertTailList(&TapPacketQueue->Queue,&TapPacket->QueueLink);
 
@@ -112,11 +118,12 @@ tapPacketQueueInsertTail(
     {
         TapPacketQueue->MaxCount = TapPacketQueue->Count;
 
-        DEBUGP (("[TAP] tapPacketQueueInsertTail: New MAX queued packet count = %d\n",
-            TapPacketQueue->MaxCount));
+        TAP_TRACE_VERBOSE (TAP_WIN_TRACE_TX_QUEUE_MAX, TapPacketQueue->MaxCount, 0);
     }
 
-    KeReleaseSpinLock(&TapPacketQueue->QueueLock,irql);
+    tapPacketQueueReleaseLock(TapPacketQueue,irql);
+
+    return TRUE;
 }
 
 // Call with QueueLock held
@@ -150,6 +157,12 @@ tapPacketQueueInitialize(
     KeInitializeSpinLock(&TapPacketQueue->QueueLock);
 
     NdisInitializeListHead(&TapPacketQueue->Queue);
+
+    // Opened along with the handle that reads it.
+    TapPacketQueue->Closed = TRUE;
+
+    // Not instrumented unless given a lock statistic.
+    TapPacketQueue->LockStat = NULL;
 }
 
 //======================================================================
@@ -178,8 +191,7 @@ tapIrpCsqInsert (
     {
         tapIrpCsq->MaxCount = tapIrpCsq->Count;
 
-        DEBUGP (("[TAP] tapIrpCsqInsert: New MAX queued IRP count = %d\n",
-            tapIrpCsq->MaxCount));
+        TAP_TRACE_VERBOSE (TAP_WIN_TRACE_IRP_QUEUE_MAX, tapIrpCsq->MaxCount, 0);
     }
 }
 
@@ -292,7 +304,7 @@ tapIrpCsqAcquireQueueLock(
     // part of TAP_ADAPTER_CONTEXT structure.
     //
 #pragma prefast(suppress: __WARNING_BUFFER_UNDERFLOW, "Underflow using expression 'adapter->PendingReadCsqQueueLock'")
-    KeAcquireSpinLock(&tapIrpCsq->QueueLock, Irql);
+    tapSpinLockAcquire(&tapIrpCsq->QueueLock, tapIrpCsq->LockStat, &tapIrpCsq->LockAcquiredAt, Irql);
 }
 
 //
@@ -325,7 +337,7 @@ tapIrpCsqReleaseQueueLock(
     // part of TAP_ADAPTER_CONTEXT structure.
     //
 #pragma prefast(suppress: __WARNING_BUFFER_UNDERFLOW, "Underflow using expression 'adapter->PendingReadCsqQueueLock'")
-    KeReleaseSpinLock(&tapIrpCsq->QueueLock, Irql);
+    tapSpinLockRelease(&tapIrpCsq->QueueLock, tapIrpCsq->LockStat, tapIrpCsq->LockAcquiredAt, Irql);
 }
 
 VOID
@@ -350,6 +362,9 @@ tapIrpCsqInitialize(
 
     NdisInitializeListHead(&TapIrpCsq->Queue);
 
+    // Not instrumented unless given a lock statistic.
+    TapIrpCsq->LockStat = NULL;
+
     IoCsqInitialize(
         &TapIrpCsq->CsqQueue,
         tapIrpCsqInsert,
@@ -391,3 +406,25 @@ tapIrpCsqFlush(
 
     ASSERT(IsListEmpty(&TapIrpCsq->Queue));
 }
+
+//======================================================================
+// TAP Per-handle Queue Support
+//======================================================================
+
+VOID
+tapQueueInitialize(
+    __in PTAP_QUEUE  TapQueue
+    )
+{
+    TapQueue->FileObject = NULL;
+
+    tapIrpCsqInitialize(&TapQueue->PendingReadIrpQueue);
+
+    tapPacketQueueInitialize(&TapQueue->SendPacketQueue);
+
+    KeInitializeSpinLock(&TapQueue->FlowControlLock);
+    TapQueue->FlowControlLockStat = NULL;
+    TapQueue->FlowControlList = NULL;
+    TapQueue->FlowControlTail = NULL;
+    TapQueue->FlowControlHasPackets = FALSE;
+}
@@ -52,6 +52,9 @@ struct _TAP_PACKET
 #   define TP_SIZE_MASK      (~TP_TUN)
     ULONG                       m_SizeFlags;
 
+    // Performance counter when queued for a read.
+    ULONG64                     m_EnqueueTime;
+
     // m_Data must be the last struct member
     UCHAR                       m_Data [];
 } TAP_PACKET, *PTAP_PACKET;
@@ -65,9 +68,20 @@ typedef struct _TAP_PACKET_QUEUE
     ULONG           Count;          // Count of currently queued items
     ULONG           TotalBytes;     // Total length of queued packets
     ULONG           MaxCount;
+    BOOLEAN         Closed;         // No more packets are accepted
+
+    PTAP_LOCK_STAT  LockStat;
+    ULONG64         LockAcquiredAt; // Under QueueLock
 } TAP_PACKET_QUEUE, *PTAP_PACKET_QUEUE;
 
-VOID
+#define tapPacketQueueAcquireLock(_q, _irql) \
+    tapSpinLockAcquire(&(_q)->QueueLock, (_q)->LockStat, &(_q)->LockAcquiredAt, (_irql))
+
+#define tapPacketQueueReleaseLock(_q, _irql) \
+    tapSpinLockRelease(&(_q)->QueueLock, (_q)->LockStat, (_q)->LockAcquiredAt, (_irql))
+
+// Returns FALSE, without queuing the packet, if the queue is closed.
+BOOLEAN
 tapPacketQueueInsertTail(
     __in PTAP_PACKET_QUEUE  TapPacketQueue,
     __in PTAP_PACKET        TapPacket
@@ -96,6 +110,9 @@ typedef struct _TAP_IRP_CSQ
     LIST_ENTRY      Queue;
     ULONG           Count;   // Count of currently queued items
     ULONG           MaxCount;
+
+    PTAP_LOCK_STAT  LockStat;
+    ULONG64         LockAcquiredAt; // Under QueueLock
 } TAP_IRP_CSQ, *PTAP_IRP_CSQ;
 
 VOID
@@ -107,3 +124,47 @@ VOID
 tapIrpCsqFlush(
     __in PTAP_IRP_CSQ  TapIrpCsq
     );
+
+//----------------------
+// Per-handle Queue
+//----------------------
+
+//
+// Each open TAP handle reads from its own queue: the TAP packets waiting
+// for it, its pending read IRPs and the NBLs held back by flow control
+// until its packet queue drains.
+//
+typedef struct _TAP_QUEUE
+{
+    PFILE_OBJECT        FileObject;     // Owning handle, NULL if free
+    TAP_IRP_CSQ         PendingReadIrpQueue;
+    TAP_PACKET_QUEUE    SendPacketQueue;
+
+    // Transmit flow control
+    KSPIN_LOCK          FlowControlLock;
+    PTAP_LOCK_STAT      FlowControlLockStat;
+    ULONG64             FlowControlLockAcquiredAt;
+    PNET_BUFFER_LIST    FlowControlList;
+    PNET_BUFFER_LIST    FlowControlTail;
+    BOOLEAN             FlowControlHasPackets;
+
+    // Read coalescing, under the send packet queue lock. The deadline is
+    // in interrupt time, 0 while the queue is empty.
+    ULONGLONG           CoalesceDeadline;
+    BOOLEAN             CoalesceTimerArmed;
+    KTIMER              CoalesceTimer;
+    KDPC                CoalesceDpc;
+} TAP_QUEUE, *PTAP_QUEUE;
+
+#define tapQueueAcquireFlowControlLock(_q, _irql) \
+    tapSpinLockAcquire(&(_q)->FlowControlLock, (_q)->FlowControlLockStat, \
+        &(_q)->FlowControlLockAcquiredAt, (_irql))
+
+#define tapQueueReleaseFlowControlLock(_q, _irql) \
+    tapSpinLockRelease(&(_q)->FlowControlLock, (_q)->FlowControlLockStat, \
+        (_q)->FlowControlLockAcquiredAt, (_irql))
+
+VOID
+tapQueueInitialize(
+    __in PTAP_QUEUE  TapQueue
+    );
@@ -0,0 +1,402 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//---------
+// METRICS
+//---------
+
+#include "tap.h"
+
+C_ASSERT(sizeof (TAP_METRICS_WAITER) <= sizeof (TAP_WIN_METRICS));
+
+static KDEFERRED_ROUTINE tapMetricsDpc;
+
+VOID
+tapMetricsInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    PTAP_METRICS_WAIT_QUEUE     wait = &Adapter->MetricsWait;
+
+    tapIrpCsqInitialize(&wait->Queue);
+
+    KeInitializeTimer(&wait->Timer);
+    KeInitializeDpc(&wait->Dpc, tapMetricsDpc, Adapter);
+}
+
+VOID
+tapMetricsFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Stops the timer, if it ever ran. Every waiting request holds an
+    adapter reference through its handle, so none is left.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_METRICS_WAIT_QUEUE     wait = &Adapter->MetricsWait;
+
+    ASSERT(IsListEmpty(&wait->Queue.Queue));
+
+    if(wait->TimerUsed)
+    {
+        KeCancelTimer(&wait->Timer);
+        KeFlushQueuedDpcs();
+    }
+}
+
+// Fill Record from Adapter. Returns the frames the adapter has sent,
+// received and dropped.
+static ULONG64
+tapMetricsEncodeAdapter(
+    __in PTAP_ADAPTER_CONTEXT       Adapter,
+    __out TAP_WIN_ADAPTER_METRICS   *Record
+    )
+{
+    ULONG   i;
+
+    NdisZeroMemory(Record, sizeof (TAP_WIN_ADAPTER_METRICS));
+
+    NdisMoveMemory(Record->InstanceId, &Adapter->NetCfgInstanceGuid, sizeof (Record->InstanceId));
+
+    Record->State = tapAdapterStatsState(Adapter);
+    Record->ActiveQueueCount = Adapter->ActiveQueueCount;
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        Record->QueuedFrames += Adapter->Queues[i].SendPacketQueue.Count;
+        Record->PendingReads += Adapter->Queues[i].PendingReadIrpQueue.Count;
+    }
+
+    Record->FramesTx = Adapter->FramesTxDirected
+        + Adapter->FramesTxMulticast
+        + Adapter->FramesTxBroadcast;
+    Record->BytesTx = Adapter->BytesTxDirected
+        + Adapter->BytesTxMulticast
+        + Adapter->BytesTxBroadcast;
+    Record->FramesRx = Adapter->FramesRxDirected
+        + Adapter->FramesRxMulticast
+        + Adapter->FramesRxBroadcast;
+    Record->BytesRx = Adapter->BytesRxDirected
+        + Adapter->BytesRxMulticast
+        + Adapter->BytesRxBroadcast;
+    Record->Errors = (ULONG64 )Adapter->TransmitFailuresOther + Adapter->RxResourceErrors;
+    Record->Drops = tapDropStatsTotal(&Adapter->DropStats);
+
+    return Record->FramesTx + Record->FramesRx + Record->Drops;
+}
+
+// Encode every adapter into Buffer, as many records as fit, or with a
+// NULL Buffer only total their activity and sign their states. A
+// Buffer must hold at least a TAP_WIN_METRICS.
+static VOID
+tapMetricsCollect(
+    __out_opt PUCHAR    Buffer,
+    __in ULONG          BufferLength,
+    __out PULONG        BytesWritten,
+    __out PULONG64      Activity,
+    __out PULONG        Signature
+    )
+{
+    TAP_WIN_METRICS         *metrics = (TAP_WIN_METRICS *)Buffer;
+    TAP_WIN_ADAPTER_METRICS *records = (TAP_WIN_ADAPTER_METRICS *)(metrics + 1);
+    TAP_WIN_ADAPTER_METRICS scratch;
+    LOCK_STATE_EX           lockState;
+    PLIST_ENTRY             entry;
+    LARGE_INTEGER           frequency;
+    ULONG                   capacity = 0;
+    ULONG                   count = 0;
+    ULONG                   signature = 0;
+    ULONG64                 activity = 0;
+
+    if(Buffer != NULL)
+    {
+        capacity = (BufferLength - sizeof (TAP_WIN_METRICS)) / sizeof (TAP_WIN_ADAPTER_METRICS);
+    }
+
+    NdisAcquireRWLockRead(
+        GlobalData.Lock,
+        &lockState,
+        (KeGetCurrentIrql() == DISPATCH_LEVEL) ? NDIS_RWL_AT_DISPATCH_LEVEL : 0
+        );
+
+    for(entry = GlobalData.AdapterList.Flink;
+        entry != &GlobalData.AdapterList;
+        entry = entry->Flink)
+    {
+        PTAP_ADAPTER_CONTEXT    adapter;
+        TAP_WIN_ADAPTER_METRICS *record;
+
+        adapter = CONTAINING_RECORD(entry, TAP_ADAPTER_CONTEXT, AdapterListLink);
+        record = (count < capacity) ? &records[count] : &scratch;
+
+        activity += tapMetricsEncodeAdapter(adapter, record);
+
+        // Changes if an adapter comes, goes or changes state.
+        signature = signature * 31 + record->State + 1;
+
+        ++count;
+    }
+
+    NdisReleaseRWLock(GlobalData.Lock, &lockState);
+
+    *Activity = activity;
+    *Signature = signature;
+    *BytesWritten = 0;
+
+    if(Buffer != NULL)
+    {
+        metrics->AdapterCount = count;
+        metrics->AdapterReturned = min(count, capacity);
+        metrics->RecordLength = sizeof (TAP_WIN_ADAPTER_METRICS);
+        metrics->Reserved = 0;
+        metrics->Timestamp = KeQueryPerformanceCounter(&frequency).QuadPart;
+        metrics->Frequency = frequency.QuadPart;
+
+        *BytesWritten = sizeof (TAP_WIN_METRICS)
+            + metrics->AdapterReturned * sizeof (TAP_WIN_ADAPTER_METRICS);
+    }
+}
+
+// Complete a metrics request with a snapshot.
+static VOID
+tapMetricsComplete(
+    __in PIRP   Irp
+    )
+{
+    PIO_STACK_LOCATION  irpSp = IoGetCurrentIrpStackLocation(Irp);
+    ULONG               bytesWritten;
+    ULONG64             activity;
+    ULONG               signature;
+
+    tapMetricsCollect(
+        (PUCHAR )Irp->AssociatedIrp.SystemBuffer,
+        irpSp->Parameters.DeviceIoControl.OutputBufferLength,
+        &bytesWritten,
+        &activity,
+        &signature
+        );
+
+    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Information = bytesWritten;
+
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+static VOID
+tapMetricsDpc(
+    __in PKDPC  Dpc,
+    __in PVOID  DeferredContext,
+    __in PVOID  SystemArgument1,
+    __in PVOID  SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Completes the waiting requests whose change or period has come, and
+    stops the timer once none are left.
+
+    Runs at IRQL = DISPATCH_LEVEL.
+
+--*/
+{
+    PTAP_ADAPTER_CONTEXT        adapter = (PTAP_ADAPTER_CONTEXT )DeferredContext;
+    PTAP_METRICS_WAIT_QUEUE     wait = &adapter->MetricsWait;
+    LIST_ENTRY                  held;
+    PIRP                        irp;
+    ULONGLONG                   now = KeQueryInterruptTime();
+    ULONG                       bytesWritten;
+    ULONG64                     activity;
+    ULONG                       signature;
+    KIRQL                       irql;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    tapMetricsCollect(NULL, 0, &bytesWritten, &activity, &signature);
+
+    // Take the waiting requests off the queue, so they can't be
+    // cancelled while they are looked at.
+    InitializeListHead(&held);
+
+    while((irp = IoCsqRemoveNextIrp(&wait->Queue.CsqQueue, NULL)) != NULL)
+    {
+        InsertTailList(&held, &irp->Tail.Overlay.ListEntry);
+    }
+
+    while(!IsListEmpty(&held))
+    {
+        PTAP_METRICS_WAITER waiter;
+        ULONG64             change;
+
+        irp = CONTAINING_RECORD(RemoveHeadList(&held), IRP, Tail.Overlay.ListEntry);
+        waiter = (PTAP_METRICS_WAITER )irp->AssociatedIrp.SystemBuffer;
+
+        // Removing an adapter takes its counts away.
+        change = (activity >= waiter->Activity)
+            ? activity - waiter->Activity
+            : waiter->Activity - activity;
+
+        if(now >= waiter->Deadline
+            || change > waiter->Threshold
+            || signature != waiter->Signature)
+        {
+            tapMetricsComplete(irp);
+        }
+        else
+        {
+            // Completes it if it was cancelled meanwhile.
+            IoCsqInsertIrp(&wait->Queue.CsqQueue, irp, NULL);
+        }
+    }
+
+    KeAcquireSpinLock(&wait->Queue.QueueLock, &irql);
+
+    if(wait->Queue.Count == 0 && wait->TimerArmed)
+    {
+        KeCancelTimer(&wait->Timer);
+        wait->TimerArmed = FALSE;
+    }
+
+    KeReleaseSpinLock(&wait->Queue.QueueLock, irql);
+}
+
+NTSTATUS
+tapMetricsRequest(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PIRP                   Irp
+    )
+/*++
+
+Routine Description:
+
+    Handles TAP_WIN_IOCTL_GET_METRICS: completes the request with a
+    snapshot of all adapters, or queues it on Adapter to wait for a
+    change.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Return Value:
+
+    STATUS_PENDING if the request was queued; the caller must not
+    complete it.
+
+--*/
+{
+    PTAP_METRICS_WAIT_QUEUE     wait = &Adapter->MetricsWait;
+    PIO_STACK_LOCATION          irpSp = IoGetCurrentIrpStackLocation(Irp);
+    ULONG                       inBufLength = irpSp->Parameters.DeviceIoControl.InputBufferLength;
+    ULONG                       outBufLength = irpSp->Parameters.DeviceIoControl.OutputBufferLength;
+    TAP_WIN_METRICS_REQUEST     request = {0};
+    PTAP_METRICS_WAITER         waiter;
+    ULONG                       bytesWritten;
+    ULONG64                     activity;
+    ULONG                       signature;
+    LARGE_INTEGER               dueTime;
+    KIRQL                       irql;
+
+    if(outBufLength < sizeof (TAP_WIN_METRICS))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    // METHOD_BUFFERED: read the request before anything overwrites it.
+    if(inBufLength >= sizeof (TAP_WIN_METRICS_REQUEST))
+    {
+        NdisMoveMemory(&request, Irp->AssociatedIrp.SystemBuffer, sizeof (request));
+    }
+
+    if(!(request.Flags & TAP_WIN_METRICS_WAIT))
+    {
+        tapMetricsCollect(
+            (PUCHAR )Irp->AssociatedIrp.SystemBuffer,
+            outBufLength,
+            &bytesWritten,
+            &activity,
+            &signature
+            );
+
+        Irp->IoStatus.Information = bytesWritten;
+
+        return STATUS_SUCCESS;
+    }
+
+    if(request.Period == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    tapMetricsCollect(NULL, 0, &bytesWritten, &activity, &signature);
+
+    waiter = (PTAP_METRICS_WAITER )Irp->AssociatedIrp.SystemBuffer;
+    waiter->Activity = activity;
+    waiter->Threshold = request.Threshold;
+    waiter->Deadline = KeQueryInterruptTime() + (ULONGLONG )request.Period * 10000;
+    waiter->Signature = signature;
+
+    // Note: IoCsqInsertIrp marks the IRP pending.
+    IoCsqInsertIrp(&wait->Queue.CsqQueue, Irp, NULL);
+
+    KeAcquireSpinLock(&wait->Queue.QueueLock, &irql);
+
+    if(!wait->TimerArmed)
+    {
+        dueTime.QuadPart = -10000LL * TAP_METRICS_POLL_INTERVAL;
+
+        KeSetTimerEx(&wait->Timer, dueTime, TAP_METRICS_POLL_INTERVAL, &wait->Dpc);
+
+        wait->TimerArmed = TRUE;
+        wait->TimerUsed = TRUE;
+    }
+
+    KeReleaseSpinLock(&wait->Queue.QueueLock, irql);
+
+    return STATUS_PENDING;
+}
+
+// Cancel FileObject's waiting requests. Called on IRP_MJ_CLEANUP.
+VOID
+tapMetricsFlush(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject
+    )
+{
+    PTAP_METRICS_WAIT_QUEUE     wait = &Adapter->MetricsWait;
+    PIRP                        irp;
+
+    while((irp = IoCsqRemoveNextIrp(&wait->Queue.CsqQueue, FileObject)) != NULL)
+    {
+        irp->IoStatus.Status = STATUS_CANCELLED;
+        irp->IoStatus.Information = 0;
+
+        IoCompleteRequest(irp, IO_NO_INCREMENT);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_METRICS_H_
+#define __TAP_METRICS_H_
+
+//======================================================================
+// Metrics requests.
+//
+// TAP_WIN_IOCTL_GET_METRICS requests that wait for a change are held on
+// the diag device's adapter, and checked by a timer that runs only
+// while any are held.
+//======================================================================
+
+#define TAP_METRICS_POLL_INTERVAL   50      // milliseconds between checks
+
+typedef struct _TAP_METRICS_WAIT_QUEUE
+{
+    TAP_IRP_CSQ         Queue;
+
+    // Under the queue lock.
+    BOOLEAN             TimerArmed;
+    BOOLEAN             TimerUsed;
+
+    KTIMER              Timer;
+    KDPC                Dpc;
+} TAP_METRICS_WAIT_QUEUE, *PTAP_METRICS_WAIT_QUEUE;
+
+// What a waiting request is waiting for. Kept at the start of its
+// system buffer, which the snapshot overwrites when it completes.
+typedef struct _TAP_METRICS_WAITER
+{
+    ULONG64             Activity;   // frames sent, received and dropped
+    ULONG64             Threshold;
+    ULONGLONG           Deadline;   // interrupt time
+    ULONG               Signature;  // of the adapters and their states
+} TAP_METRICS_WAITER, *PTAP_METRICS_WAITER;
+
+#endif // __TAP_METRICS_H_
@@ -0,0 +1,305 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------------
+// IPv6 ND PROXY TABLE
+//-----------------------
+
+#include "tap.h"
+
+static IPV6ADDR IPV6_ALL_NODES =
+    { 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static VOID
+tapNdProxyMask(
+    __out IPV6ADDR      Prefix,
+    __in const UCHAR    *Address,
+    __in ULONG          PrefixLength
+    )
+{
+    ULONG   i;
+
+    for(i = 0; i < sizeof(IPV6ADDR); ++i)
+    {
+        if(PrefixLength >= 8)
+        {
+            Prefix[i] = Address[i];
+            PrefixLength -= 8;
+        }
+        else
+        {
+            Prefix[i] = Address[i] & (UCHAR )(0xFF00 >> PrefixLength);
+            PrefixLength = 0;
+        }
+    }
+}
+
+static __inline PTAP_ND_PROXY_ENTRY *
+tapNdProxyBucket(
+    __in PTAP_ND_PROXY  Table,
+    __in const IPV6ADDR Prefix,
+    __in ULONG          PrefixLength
+    )
+{
+    ULONG   h = PrefixLength;
+    ULONG   i;
+
+    for(i = 0; i < sizeof(IPV6ADDR); i += sizeof(ULONG))
+    {
+        h = (h ^ *(UNALIGNED ULONG *)&Prefix[i]) * 2654435761U;
+    }
+
+    return &Table->Buckets[h >> 22];    // Top 10 bits: TAP_ND_PROXY_BUCKETS
+}
+
+static PTAP_ND_PROXY_ENTRY
+tapNdProxyFind(
+    __in PTAP_ND_PROXY  Table,
+    __in const IPV6ADDR Prefix,
+    __in ULONG          PrefixLength
+    )
+{
+    PTAP_ND_PROXY_ENTRY entry = *tapNdProxyBucket(Table, Prefix, PrefixLength);
+
+    while(entry != NULL
+        && !(entry->PrefixLength == PrefixLength
+            && memcmp(entry->Prefix, Prefix, sizeof(IPV6ADDR)) == 0))
+    {
+        entry = entry->Next;
+    }
+
+    return entry;
+}
+
+NTSTATUS
+tapNdProxyConfigure(
+    __in PTAP_ADAPTER_CONTEXT                       Adapter,
+    __in_ecount(Count) const TAP_WIN_ND_PROXY_ENTRY *Entries,
+    __in ULONG                                      Count
+    )
+/*++
+
+Routine Description:
+
+    Replaces the ND proxy table.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_ND_PROXY   table = NULL;
+    PTAP_ND_PROXY   oldTable;
+    UCHAR           used[129];
+    KIRQL           irql;
+    ULONG           i;
+    LONG            length;
+
+    if(Count > TAP_WIN_ND_PROXY_MAX_ENTRIES)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for(i = 0; i < Count; ++i)
+    {
+        if(Entries[i].PrefixLength > 128)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    if(Count > 0)
+    {
+        table = (PTAP_ND_PROXY )MemAlloc(TAP_ND_PROXY_SIZE(Count), TRUE);
+
+        if(table == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        table->Count = Count;
+        NdisZeroMemory(used, sizeof(used));
+
+        for(i = 0; i < Count; ++i)
+        {
+            PTAP_ND_PROXY_ENTRY entry = &table->Entries[i];
+            PTAP_ND_PROXY_ENTRY *bucket;
+
+            entry->PrefixLength = Entries[i].PrefixLength;
+            tapNdProxyMask(entry->Prefix, Entries[i].Address, entry->PrefixLength);
+            ETH_COPY_NETWORK_ADDRESS(entry->Mac, Entries[i].Mac);
+
+            // Duplicates: the first one wins.
+            if(tapNdProxyFind(table, entry->Prefix, entry->PrefixLength) == NULL)
+            {
+                bucket = tapNdProxyBucket(table, entry->Prefix, entry->PrefixLength);
+                entry->Next = *bucket;
+                *bucket = entry;
+
+                used[entry->PrefixLength] = TRUE;
+            }
+        }
+
+        for(length = 128; length >= 0; --length)
+        {
+            if(used[length])
+            {
+                table->Lengths[table->LengthCount++] = (UCHAR )length;
+            }
+        }
+    }
+
+    KeAcquireSpinLock(&Adapter->NdProxyLock, &irql);
+    oldTable = Adapter->NdProxy;
+    Adapter->NdProxy = table;
+    KeReleaseSpinLock(&Adapter->NdProxyLock, irql);
+
+    if(oldTable != NULL)
+    {
+        MemFree(oldTable, TAP_ND_PROXY_SIZE(oldTable->Count));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static PTAP_ND_PROXY_ENTRY
+tapNdProxyLookup(
+    __in PTAP_ND_PROXY  Table,
+    __in const UCHAR    *Address
+    )
+{
+    ULONG   i;
+
+    for(i = 0; i < Table->LengthCount; ++i)
+    {
+        PTAP_ND_PROXY_ENTRY entry;
+        IPV6ADDR            prefix;
+
+        tapNdProxyMask(prefix, Address, Table->Lengths[i]);
+
+        entry = tapNdProxyFind(Table, prefix, Table->Lengths[i]);
+
+        if(entry != NULL)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+BOOLEAN
+tapNdProxyProcess(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in UCHAR                  *m_Data,
+    __in ULONG                  packetLength
+    )
+/*++
+
+Routine Description:
+
+    Answers a neighbor solicitation sent by the host if its target is
+    covered by the ND proxy table. m_Data is an untagged Ethernet frame
+    carrying IPv6.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Return Value:
+
+    TRUE if the solicitation was answered and must not be passed on.
+
+--*/
+{
+    const ETH_HEADER    *eth = (ETH_HEADER *) m_Data;
+    const IPV6HDR       *ipv6 = (IPV6HDR *) (m_Data + sizeof (ETH_HEADER));
+    const ICMPV6_NS     *ns = (ICMPV6_NS *) (m_Data + sizeof (ETH_HEADER) + sizeof (IPV6HDR));
+    PTAP_ND_PROXY_ENTRY entry;
+    MACADDR             mac;
+    BOOLEAN             dad;
+    UCHAR               rso_bits = 0;
+    KIRQL               irql;
+
+    // RFC 4861 7.1.1: an NS that may be answered.
+    if (packetLength < sizeof (ETH_HEADER) + sizeof (IPV6HDR) + sizeof (ICMPV6_NS)
+        || ipv6->nexthdr != IPPROTO_ICMPV6
+        || ipv6->hop_limit != 255
+        || ntohs (ipv6->payload_len) < sizeof (ICMPV6_NS)
+        || ns->type != ICMPV6_TYPE_NS
+        || ns->code != ICMPV6_CODE_0
+        || ns->target_addr[0] == 0xff)
+    {
+        return FALSE;
+    }
+
+    dad = (ipv6->saddr[0] == 0 && memcmp (ipv6->saddr, ipv6->saddr + 1, sizeof (IPV6ADDR) - 1) == 0);
+
+    // Sent to the target's solicited-node address, ff02::1:ffXX:XXXX,
+    // or, when not a DAD probe, to the target itself.
+    if (!(memcmp (ipv6->daddr, IPV6_ALL_NODES, 11) == 0
+            && ipv6->daddr[11] == 0x01
+            && ipv6->daddr[12] == 0xff
+            && memcmp (ipv6->daddr + 13, ns->target_addr + 13, 3) == 0)
+        && !(!dad && memcmp (ipv6->daddr, ns->target_addr, sizeof (IPV6ADDR)) == 0))
+    {
+        return FALSE;
+    }
+
+    KeAcquireSpinLock(&Adapter->NdProxyLock, &irql);
+
+    entry = (Adapter->NdProxy != NULL)
+        ? tapNdProxyLookup(Adapter->NdProxy, ns->target_addr)
+        : NULL;
+
+    if (entry != NULL)
+    {
+        ETH_COPY_NETWORK_ADDRESS (mac, Adapter->m_tun ? Adapter->m_TapToUser.dest : entry->Mac);
+
+        // Only a /128 speaks for the target itself: it may override a
+        // cached address and defend the target against DAD.
+        if (entry->PrefixLength == 128)
+        {
+            rso_bits |= ICMPV6_NA_OVERRIDE;
+        }
+        else if (dad)
+        {
+            entry = NULL;
+        }
+    }
+
+    KeReleaseSpinLock(&Adapter->NdProxyLock, irql);
+
+    if (entry == NULL)
+    {
+        return FALSE;
+    }
+
+    if (!dad)
+    {
+        rso_bits |= ICMPV6_NA_SOLICITED;
+    }
+
+    IndicateNeighborAdvertisement (Adapter, eth, ipv6, ns->target_addr, mac, rso_bits);
+
+    return TRUE;
+}
@@ -0,0 +1,63 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __TAP_ND_PROXY_H_
+#define __TAP_ND_PROXY_H_
+
+//======================================================================
+// IPv6 neighbor discovery proxy table.
+//
+// Entries are hashed by (masked prefix, prefix length). Lengths holds the
+// distinct prefix lengths in use, longest first; a lookup probes one
+// bucket per length, so thousands of entries cost no more than a few.
+// The table is immutable once built and is replaced as a whole.
+//======================================================================
+
+#define TAP_ND_PROXY_BUCKETS        1024        // Power of two
+
+typedef struct _TAP_ND_PROXY_ENTRY
+{
+    // Hash bucket chain.
+    struct _TAP_ND_PROXY_ENTRY  *Next;
+
+    IPV6ADDR                    Prefix;         // Masked
+    UCHAR                       PrefixLength;
+    MACADDR                     Mac;
+} TAP_ND_PROXY_ENTRY, *PTAP_ND_PROXY_ENTRY;
+
+typedef struct _TAP_ND_PROXY
+{
+    ULONG                       Count;
+
+    ULONG                       LengthCount;
+    UCHAR                       Lengths[129];   // Longest first
+
+    PTAP_ND_PROXY_ENTRY         Buckets[TAP_ND_PROXY_BUCKETS];
+
+    TAP_ND_PROXY_ENTRY          Entries[];
+} TAP_ND_PROXY, *PTAP_ND_PROXY;
+
+#define TAP_ND_PROXY_SIZE(count) \
+    (sizeof(TAP_ND_PROXY) + (count) * sizeof(TAP_ND_PROXY_ENTRY))
+
+#endif // __TAP_ND_PROXY_H_
@@ -204,6 +204,9 @@ typedef struct {
 # define ICMPV6_CODE_0	0		// no specific sub-code for NS/NA
   USHORT   checksum;
   UCHAR    rso_bits;			// Router(0), Solicited(2), Ovrrd(4)
+#define ICMPV6_NA_ROUTER    0x80
+#define ICMPV6_NA_SOLICITED 0x40
+#define ICMPV6_NA_OVERRIDE  0x20
   UCHAR	   reserved[3];
   IPV6ADDR target_addr;
 // always include "Target Link-layer Address" option (RFC 4861 4.6.1)
@@ -51,20 +51,23 @@ DestroyTapDevice(
     __in PTAP_ADAPTER_CONTEXT   Adapter
    );
 
-// Flush the pending send TAP packet queue.
+// Flush the pending send TAP packet queue and close it to new packets.
 VOID
 tapFlushSendPacketQueue(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
     );
 
 VOID
 tapCompleteFlowControlPackets(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
     );
 
 VOID
 tapCheckFlowControl(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
     );
 
 VOID
@@ -74,6 +77,147 @@ IndicateReceivePacket(
     __in const unsigned int packetLength
     );
 
+VOID
+tapHeaderMdlCacheInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapHeaderMdlCacheFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapLockStatsInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+NTSTATUS
+tapLockStatsQuery(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in_opt const ULONG        *Flags,
+    __out TAP_WIN_LOCK_STATS    *Stats
+    );
+
+NTSTATUS
+tapLatencyStatsQuery(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in_opt const ULONG        *Flags,
+    __out TAP_WIN_LATENCY_STATS *Stats
+    );
+
+VOID
+tapStatsMappingsInitialize();
+
+VOID
+tapStatsMappingsFree();
+
+VOID
+tapStatsPageInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapStatsPageFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+NTSTATUS
+tapStatsPageMap(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject,
+    __out PULONG64              UserAddress
+    );
+
+VOID
+tapStatsPageUnmap(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject
+    );
+
+ULONG
+tapAdapterStatsState(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapMetricsInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapMetricsFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+NTSTATUS
+tapMetricsRequest(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PIRP                   Irp
+    );
+
+VOID
+tapMetricsFlush(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject
+    );
+
+VOID
+tapReadCoalesceInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+NTSTATUS
+tapReadCoalesceConfigure(
+    __in PTAP_ADAPTER_CONTEXT           Adapter,
+    __in const TAP_WIN_READ_COALESCING  *Config
+    );
+
+VOID
+tapInjectQueueInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+tapInjectQueueFlush(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+VOID
+BuildDHCPTemplates(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    );
+
+NTSTATUS
+tapDhcpPoolConfigure(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in IPADDR                 Start,
+    __in ULONG                  Count
+    );
+
+BOOLEAN
+tapDhcpPoolOffer(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __out IPADDR                *Address
+    );
+
+BOOLEAN
+tapDhcpPoolRequest(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __in IPADDR                 Requested,
+    __out IPADDR                *Address
+    );
+
+VOID
+tapDhcpPoolRelease(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const UCHAR            *Mac,
+    __in IPADDR                 Address,
+    __in BOOLEAN                Declined
+    );
+
 BOOLEAN
 ProcessDHCP(
     __in PTAP_ADAPTER_CONTEXT   Adapter,
@@ -84,6 +228,57 @@ ProcessDHCP(
     __in int optlen
     );
 
+VOID
+IndicateARPReply(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET *src,
+    __in const MACADDR mac
+    );
+
+NTSTATUS
+tapProxyArpConfigure(
+    __in PTAP_ADAPTER_CONTEXT                           Adapter,
+    __in ULONG                                          Flags,
+    __in_ecount(Count) const TAP_WIN_PROXY_ARP_ENTRY    *Entries,
+    __in ULONG                                          Count
+    );
+
+BOOLEAN
+tapProxyArpProcess(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET       *Request
+    );
+
+VOID
+tapProxyArpLearn(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET       *Frame
+    );
+
+VOID
+IndicateNeighborAdvertisement(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ETH_HEADER *eth,
+    __in const IPV6HDR *ipv6,
+    __in const UCHAR *target,
+    __in const MACADDR mac,
+    __in UCHAR rso_bits
+    );
+
+NTSTATUS
+tapNdProxyConfigure(
+    __in PTAP_ADAPTER_CONTEXT                       Adapter,
+    __in_ecount(Count) const TAP_WIN_ND_PROXY_ENTRY *Entries,
+    __in ULONG                                      Count
+    );
+
+BOOLEAN
+tapNdProxyProcess(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in UCHAR                  *m_Data,
+    __in ULONG                  packetLength
+    );
+
 BOOLEAN
 ProcessARP(
     __in PTAP_ADAPTER_CONTEXT   Adapter,
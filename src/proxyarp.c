@@ -0,0 +1,350 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//----------------
+// PROXY ARP TABLE
+//----------------
+
+#include "tap.h"
+
+static ULONG
+tapProxyArpNow()
+{
+    return (ULONG )(KeQueryInterruptTime() / 10000000);
+}
+
+static __inline IPADDR
+tapProxyArpMask(
+    __in ULONG  PrefixLength
+    )
+{
+    return (PrefixLength == 0) ? 0 : htonl(0xFFFFFFFF << (32 - PrefixLength));
+}
+
+static __inline PTAP_PROXY_ARP_ENTRY *
+tapProxyArpBucket(
+    __in PTAP_PROXY_ARP Table,
+    __in IPADDR         Prefix,
+    __in ULONG          PrefixLength
+    )
+{
+    ULONG   h = (Prefix ^ PrefixLength) * 2654435761U;
+
+    return &Table->Buckets[h >> 22];    // Top 10 bits: TAP_PROXY_ARP_BUCKETS
+}
+
+static PTAP_PROXY_ARP_ENTRY
+tapProxyArpFind(
+    __in PTAP_PROXY_ARP Table,
+    __in IPADDR         Prefix,
+    __in ULONG          PrefixLength
+    )
+{
+    PTAP_PROXY_ARP_ENTRY    entry = *tapProxyArpBucket(Table, Prefix, PrefixLength);
+
+    while(entry != NULL
+        && !(entry->Prefix == Prefix && entry->PrefixLength == PrefixLength))
+    {
+        entry = entry->Next;
+    }
+
+    return entry;
+}
+
+static VOID
+tapProxyArpInsert(
+    __in PTAP_PROXY_ARP         Table,
+    __in PTAP_PROXY_ARP_ENTRY   Entry
+    )
+{
+    PTAP_PROXY_ARP_ENTRY    *bucket = tapProxyArpBucket(Table, Entry->Prefix, Entry->PrefixLength);
+
+    Entry->Next = *bucket;
+    *bucket = Entry;
+
+    Table->PrefixLengths |= (ULONG64 )1 << Entry->PrefixLength;
+}
+
+static VOID
+tapProxyArpRemove(
+    __in PTAP_PROXY_ARP         Table,
+    __in PTAP_PROXY_ARP_ENTRY   Entry
+    )
+{
+    PTAP_PROXY_ARP_ENTRY    *link = tapProxyArpBucket(Table, Entry->Prefix, Entry->PrefixLength);
+
+    while(*link != Entry)
+    {
+        link = &(*link)->Next;
+    }
+
+    *link = Entry->Next;
+    Entry->Next = NULL;
+}
+
+NTSTATUS
+tapProxyArpConfigure(
+    __in PTAP_ADAPTER_CONTEXT                           Adapter,
+    __in ULONG                                          Flags,
+    __in_ecount(Count) const TAP_WIN_PROXY_ARP_ENTRY    *Entries,
+    __in ULONG                                          Count
+    )
+/*++
+
+Routine Description:
+
+    Replaces the proxy ARP table. Learned entries are dropped.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_PROXY_ARP  table = NULL;
+    PTAP_PROXY_ARP  oldTable;
+    KIRQL           irql;
+    ULONG           i;
+
+    if((Flags & ~TAP_WIN_PROXY_ARP_LEARN) != 0 || Count > TAP_WIN_PROXY_ARP_MAX_ENTRIES)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for(i = 0; i < Count; ++i)
+    {
+        if(Entries[i].PrefixLength > 32)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    if(Flags != 0 || Count > 0)
+    {
+        table = (PTAP_PROXY_ARP )MemAlloc(TAP_PROXY_ARP_SIZE(Count), TRUE);
+
+        if(table == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        table->Flags = Flags;
+        table->StaticCount = Count;
+
+        InitializeListHead(&table->LearnedList);
+        InitializeListHead(&table->LearnedFree);
+
+        for(i = 0; i < Count; ++i)
+        {
+            PTAP_PROXY_ARP_ENTRY    entry = &table->Entries[i];
+
+            entry->PrefixLength = Entries[i].PrefixLength;
+            entry->Prefix = Entries[i].Address & tapProxyArpMask(entry->PrefixLength);
+            ETH_COPY_NETWORK_ADDRESS(entry->Mac, Entries[i].Mac);
+
+            // Duplicates: the first one wins.
+            if(tapProxyArpFind(table, entry->Prefix, entry->PrefixLength) == NULL)
+            {
+                tapProxyArpInsert(table, entry);
+            }
+        }
+
+        for(i = Count; i < Count + TAP_PROXY_ARP_MAX_LEARNED; ++i)
+        {
+            table->Entries[i].Learned = TRUE;
+            InsertTailList(&table->LearnedFree, &table->Entries[i].AgeLink);
+        }
+    }
+
+    KeAcquireSpinLock(&Adapter->ProxyArpLock, &irql);
+    oldTable = Adapter->ProxyArp;
+    Adapter->ProxyArp = table;
+    KeReleaseSpinLock(&Adapter->ProxyArpLock, irql);
+
+    if(oldTable != NULL)
+    {
+        MemFree(oldTable, TAP_PROXY_ARP_SIZE(oldTable->StaticCount));
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static BOOLEAN
+tapProxyArpLookup(
+    __in PTAP_PROXY_ARP Table,
+    __in IPADDR         Address,
+    __in ULONG          Now,
+    __out_bcount(sizeof(MACADDR)) UCHAR *Mac
+    )
+{
+    ULONG64 lengths = Table->PrefixLengths;
+    LONG    length;
+
+    for(length = 32; length >= 0; --length)
+    {
+        PTAP_PROXY_ARP_ENTRY    entry;
+
+        if(!(lengths & ((ULONG64 )1 << length)))
+        {
+            continue;
+        }
+
+        entry = tapProxyArpFind(Table, Address & tapProxyArpMask(length), length);
+
+        if(entry != NULL
+            && !(entry->Learned && Now - entry->LastSeen > TAP_PROXY_ARP_LEARN_AGE))
+        {
+            ETH_COPY_NETWORK_ADDRESS(Mac, entry->Mac);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+tapProxyArpProcess(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET       *Request
+    )
+/*++
+
+Routine Description:
+
+    Answers an ARP request sent by the host if the target is covered by
+    the proxy ARP table.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+Return Value:
+
+    TRUE if the request was answered and must not be passed on.
+
+--*/
+{
+    MACADDR     mac;
+    BOOLEAN     found = FALSE;
+    KIRQL       irql;
+
+    if(!(Request->m_ARP_Operation == htons (ARP_REQUEST)
+        && Request->m_MAC_AddressType == htons (MAC_ADDR_TYPE)
+        && Request->m_MAC_AddressSize == sizeof (MACADDR)
+        && Request->m_PROTO_AddressType == htons (NDIS_ETH_TYPE_IPV4)
+        && Request->m_PROTO_AddressSize == sizeof (IPADDR)
+        // Leave address probes and announcements alone.
+        && Request->m_ARP_IP_Source != 0
+        && Request->m_ARP_IP_Source != Request->m_ARP_IP_Destination))
+    {
+        return FALSE;
+    }
+
+    KeAcquireSpinLock(&Adapter->ProxyArpLock, &irql);
+
+    if(Adapter->ProxyArp != NULL)
+    {
+        found = tapProxyArpLookup(
+                    Adapter->ProxyArp,
+                    Request->m_ARP_IP_Destination,
+                    tapProxyArpNow(),
+                    mac
+                    );
+    }
+
+    KeReleaseSpinLock(&Adapter->ProxyArpLock, irql);
+
+    if(found)
+    {
+        IndicateARPReply(Adapter, Request, mac);
+    }
+
+    return found;
+}
+
+VOID
+tapProxyArpLearn(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET       *Frame
+    )
+/*++
+
+Routine Description:
+
+    Learns the sender of an ARP frame written by the TAP handle.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_PROXY_ARP          table;
+    PTAP_PROXY_ARP_ENTRY    entry;
+    IPADDR                  address = Frame->m_ARP_IP_Source;
+    KIRQL                   irql;
+
+    if(!(Frame->m_PROTO_AddressType == htons (NDIS_ETH_TYPE_IPV4)
+        && Frame->m_MAC_AddressSize == sizeof (MACADDR)
+        && Frame->m_PROTO_AddressSize == sizeof (IPADDR)
+        && address != 0
+        && !ETH_IS_MULTICAST(Frame->m_ARP_MAC_Source)))
+    {
+        return;
+    }
+
+    KeAcquireSpinLock(&Adapter->ProxyArpLock, &irql);
+
+    table = Adapter->ProxyArp;
+
+    if(table != NULL && (table->Flags & TAP_WIN_PROXY_ARP_LEARN))
+    {
+        entry = tapProxyArpFind(table, address, 32);
+
+        if(entry == NULL)
+        {
+            // Reuse a free entry, else the least recently seen one.
+            PLIST_ENTRY link = IsListEmpty(&table->LearnedFree)
+                ? table->LearnedList.Flink
+                : table->LearnedFree.Flink;
+
+            entry = CONTAINING_RECORD(link, TAP_PROXY_ARP_ENTRY, AgeLink);
+
+            if(link != table->LearnedFree.Flink)
+            {
+                tapProxyArpRemove(table, entry);
+            }
+
+            entry->Prefix = address;
+            entry->PrefixLength = 32;
+            tapProxyArpInsert(table, entry);
+        }
+
+        // Configured /32s take precedence over learned ones.
+        if(entry->Learned)
+        {
+            ETH_COPY_NETWORK_ADDRESS(entry->Mac, Frame->m_ARP_MAC_Source);
+            entry->LastSeen = tapProxyArpNow();
+
+            RemoveEntryList(&entry->AgeLink);
+            InsertTailList(&table->LearnedList, &entry->AgeLink);
+        }
+    }
+
+    KeReleaseSpinLock(&Adapter->ProxyArpLock, irql);
+}
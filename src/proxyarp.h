@@ -0,0 +1,80 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef __TAP_PROXY_ARP_H_
+#define __TAP_PROXY_ARP_H_
+
+//======================================================================
+// Proxy ARP table (TAP mode).
+//
+// Configured prefixes and learned hosts share one hash table keyed by
+// (masked address, prefix length). A lookup probes one bucket per prefix
+// length in use, longest first, so its cost does not grow with the
+// number of entries. Learned entries are /32s taken from ARP frames
+// written by the TAP handle; they are recycled least recently seen first
+// and ignored once older than TAP_PROXY_ARP_LEARN_AGE.
+//======================================================================
+
+#define TAP_PROXY_ARP_BUCKETS       1024        // Power of two
+#define TAP_PROXY_ARP_MAX_LEARNED   1024
+#define TAP_PROXY_ARP_LEARN_AGE     300         // Seconds
+
+typedef struct _TAP_PROXY_ARP_ENTRY
+{
+    // Hash bucket chain.
+    struct _TAP_PROXY_ARP_ENTRY *Next;
+
+    // Learned entries only: in-use list, least recently seen first, or free list.
+    LIST_ENTRY                  AgeLink;
+
+    IPADDR                      Prefix;         // Masked, network order
+    UCHAR                       PrefixLength;
+    BOOLEAN                     Learned;
+    MACADDR                     Mac;
+    ULONG                       LastSeen;       // Learned entries, seconds
+} TAP_PROXY_ARP_ENTRY, *PTAP_PROXY_ARP_ENTRY;
+
+typedef struct _TAP_PROXY_ARP
+{
+    ULONG                       Flags;          // TAP_WIN_PROXY_ARP_*
+    ULONG                       StaticCount;
+
+    // Bit n is set if any entry has prefix length n.
+    ULONG64                     PrefixLengths;
+
+    LIST_ENTRY                  LearnedList;
+    LIST_ENTRY                  LearnedFree;
+
+    PTAP_PROXY_ARP_ENTRY        Buckets[TAP_PROXY_ARP_BUCKETS];
+
+    // StaticCount configured entries followed by TAP_PROXY_ARP_MAX_LEARNED
+    // learned ones.
+    TAP_PROXY_ARP_ENTRY         Entries[];
+} TAP_PROXY_ARP, *PTAP_PROXY_ARP;
+
+#define TAP_PROXY_ARP_SIZE(count) \
+    (sizeof(TAP_PROXY_ARP) + ((count) + TAP_PROXY_ARP_MAX_LEARNED) * sizeof(TAP_PROXY_ARP_ENTRY))
+
+#endif // __TAP_PROXY_ARP_H_
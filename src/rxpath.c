@@ -40,6 +40,10 @@
 // Used in cases where internally generated packets such as
 // ARP or DHCP replies must be returned to the kernel, to be
 // seen as an incoming packet "arriving" on the interface.
+//
+// The packet is copied to the injection queue and indicated
+// later by tapInjectDpc, so the caller - typically the send
+// path - never indicates from within its own call.
 //===============================================================
 
 VOID
@@ -49,7 +53,10 @@ IndicateReceivePacket(
     __in const unsigned int packetLength
     )
 {
-    PUCHAR  injectBuffer;
+    PTAP_INJECT_QUEUE   injectQueue = &Adapter->InjectPacketQueue;
+    InjectPacketPointer injectPacket;
+    KIRQL               irql;
+    BOOLEAN             queued = FALSE;
     unsigned int paddedPacketLength = packetLength;
     if(paddedPacketLength < TAP_MIN_FRAME_SIZE)
     {
@@ -66,130 +73,285 @@ IndicateReceivePacket(
     // That is: The device interface may be "up", but the NDIS miniport send/receive
     // interface may be temporarily "down".
     //
-    // BUGBUG!!! In the initial implementation of the NDIS 6 TapOas inject path
-    // the code below will simply ignore inject packets passed to the driver while
-    // the miniport is in the Paused state.
-    //
-    // The correct implementation is to go ahead and build the NBLs corresponding
-    // to the inject packet - but queue them. When Restart is entered the
-    // queued NBLs would be dequeued and indicated to the host.
+    // Inject packets passed to the driver while the miniport is not running
+    // are simply dropped, here or, if the miniport pauses while they are
+    // queued, by tapInjectDpc.
     //
     if(tapAdapterSendAndReceiveReady(Adapter) != NDIS_STATUS_SUCCESS)
     {
-        DEBUGP (("[%s] Lying send in IndicateReceivePacket while adapter paused\n",
-            MINIPORT_INSTANCE_ID (Adapter)));
+        TAP_TRACE_INFO (TAP_WIN_TRACE_INJECT_PAUSED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_INJECT);
 
         return;
     }
 
-    // Allocate flat buffer for packet data.
-    injectBuffer = (PUCHAR )NdisAllocateMemoryWithTagPriority(
+    // Allocate the queue entry, which also holds the flat packet buffer.
+    injectPacket = (InjectPacketPointer )NdisAllocateMemoryWithTagPriority(
                         Adapter->MiniportAdapterHandle,
-                        paddedPacketLength,
+                        INJECT_PACKET_SIZE(paddedPacketLength),
                         TAP_RX_INJECT_BUFFER_TAG,
                         NormalPoolPriority
                         );
 
-    if( injectBuffer)
+    if(injectPacket == NULL)
     {
-        PMDL    mdl;
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_INJECT_ALLOC_FAILED, 1, packetLength);
+        TAP_DROP(Adapter,TAP_WIN_DROP_INJECT);
+        NOTE_ERROR ();
+        return;
+    }
 
-        // Copy packet data to flat buffer.
-        NdisMoveMemory (injectBuffer, packetData, packetLength);
-        if(packetLength < paddedPacketLength)
+    // Copy packet data to flat buffer.
+    injectPacket->m_Size = paddedPacketLength;
+    NdisMoveMemory (injectPacket->m_Data, packetData, packetLength);
+    if(packetLength < paddedPacketLength)
+    {
+        NdisZeroMemory(injectPacket->m_Data + packetLength, paddedPacketLength - packetLength);
+    }
+
+    KeAcquireSpinLock(&injectQueue->QueueLock, &irql);
+
+    if(injectQueue->Count < INJECT_QUEUE_SIZE)
+    {
+        InsertTailList(&injectQueue->Queue, &injectPacket->QueueLink);
+
+        if(++injectQueue->Count > injectQueue->MaxCount)
         {
-            NdisZeroMemory(injectBuffer + packetLength, paddedPacketLength - packetLength);
+            injectQueue->MaxCount = injectQueue->Count;
         }
 
-        // Allocate MDL for flat buffer.
-        mdl = NdisAllocateMdl(
-                Adapter->MiniportAdapterHandle,
-                injectBuffer,
-                paddedPacketLength
-                );
+        queued = TRUE;
+    }
 
-        if( mdl )
-        {
-            PNET_BUFFER_LIST    netBufferList;
-
-            mdl->Next = NULL;   // No next MDL
-
-            // Allocate the NBL and NB. Link MDL chain to NB.
-            netBufferList = NdisAllocateNetBufferAndNetBufferList(
-                                Adapter->ReceiveNblPool,
-                                0,                  // ContextSize
-                                0,                  // ContextBackFill
-                                mdl,                // MDL chain
-                                0,
-                                paddedPacketLength
-                                );
+    KeReleaseSpinLock(&injectQueue->QueueLock, irql);
 
-            if(netBufferList != NULL)
-            {
-                ULONG       receiveFlags = 0;
-                LONG        nblCount;
+    if(!queued)
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_INJECT_QUEUE_FULL, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_INJECT);
+        NOTE_ERROR ();
 
-                NET_BUFFER_LIST_NEXT_NBL(netBufferList) = NULL; // Only one NBL
+        INJECT_PACKET_FREE(injectPacket);
+        return;
+    }
 
-                if(KeGetCurrentIrql() == DISPATCH_LEVEL)
-                {
-                    receiveFlags |= NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL;
-                }
+    // Does nothing if the DPC is already queued; it will pick this one up.
+    KeInsertQueueDpc(&injectQueue->Dpc, NULL, NULL);
+}
 
-                // Set flag indicating that this is an injected packet
-                TAP_RX_NBL_FLAGS_CLEAR_ALL(netBufferList);
-                TAP_RX_NBL_FLAG_SET(netBufferList,TAP_RX_NBL_FLAGS_IS_INJECTED);
+// Wraps one queued inject packet in an MDL and NBL ready for indication.
+static PNET_BUFFER_LIST
+tapInjectPacketToNetBufferList(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in InjectPacketPointer    InjectPacket
+    )
+{
+    PMDL                mdl;
+    PNET_BUFFER_LIST    netBufferList;
+
+    // Allocate MDL for flat buffer.
+    mdl = NdisAllocateMdl(
+            Adapter->MiniportAdapterHandle,
+            InjectPacket->m_Data,
+            InjectPacket->m_Size
+            );
 
-                netBufferList->MiniportReserved[0] = NULL;
-                netBufferList->MiniportReserved[1] = NULL;
+    if(mdl == NULL)
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_INJECT_ALLOC_FAILED, 2, InjectPacket->m_Size);
+        NOTE_ERROR ();
+        return NULL;
+    }
 
-                // Increment in-flight receive NBL count.
-                nblCount = NdisInterlockedIncrement(&Adapter->ReceiveNblInFlightCount);
-                ASSERT(nblCount > 0 );
+    mdl->Next = NULL;   // No next MDL
 
-                netBufferList->SourceHandle = Adapter->MiniportAdapterHandle;
+    // Allocate the NBL and NB. Link MDL chain to NB.
+    netBufferList = NdisAllocateNetBufferAndNetBufferList(
+                        Adapter->ReceiveNblPool,
+                        0,                  // ContextSize
+                        0,                  // ContextBackFill
+                        mdl,                // MDL chain
+                        0,
+                        InjectPacket->m_Size
+                        );
 
-                //
-                // Indicate the packet
-                // -------------------
-                // Irp->AssociatedIrp.SystemBuffer with length irpSp->Parameters.Write.Length
-                // contains the complete packet including Ethernet header and payload.
-                //
-                NdisMIndicateReceiveNetBufferLists(
-                    Adapter->MiniportAdapterHandle,
-                    netBufferList,
-                    NDIS_DEFAULT_PORT_NUMBER,
-                    1,      // NumberOfNetBufferLists
-                    receiveFlags
-                    );
+    if(netBufferList == NULL)
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_INJECT_ALLOC_FAILED, 3, InjectPacket->m_Size);
+        NOTE_ERROR ();
 
-                return;
-            }
-            else
-            {
-                DEBUGP (("[%s] NdisAllocateNetBufferAndNetBufferList failed in IndicateReceivePacket\n",
-                    MINIPORT_INSTANCE_ID (Adapter)));
-                NOTE_ERROR ();
+        NdisFreeMdl(mdl);
+        return NULL;
+    }
 
-                NdisFreeMdl(mdl);
-                NdisFreeMemory(injectBuffer,0,0);
-            }
+    NET_BUFFER_LIST_NEXT_NBL(netBufferList) = NULL;
+
+    // Set flag indicating that this is an injected packet
+    TAP_RX_NBL_FLAGS_CLEAR_ALL(netBufferList);
+    TAP_RX_NBL_FLAG_SET(netBufferList,TAP_RX_NBL_FLAGS_IS_INJECTED);
+
+    // No IRP; the queue entry owning the buffer is freed on return.
+    netBufferList->MiniportReserved[0] = NULL;
+    netBufferList->MiniportReserved[1] = InjectPacket;
+
+    netBufferList->SourceHandle = Adapter->MiniportAdapterHandle;
+
+    return netBufferList;
+}
+
+static VOID
+tapInjectDpc(
+    __in PKDPC  Dpc,
+    __in PVOID  DeferredContext,
+    __in PVOID  SystemArgument1,
+    __in PVOID  SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Drains the injection queue, indicating everything that was queued as
+    one chain of NBLs.
+
+    Runs at IRQL = DISPATCH_LEVEL.
+
+--*/
+{
+    PTAP_ADAPTER_CONTEXT    adapter = (PTAP_ADAPTER_CONTEXT )DeferredContext;
+    PTAP_INJECT_QUEUE       injectQueue = &adapter->InjectPacketQueue;
+    LIST_ENTRY              batch;
+    PNET_BUFFER_LIST        head = NULL;
+    PNET_BUFFER_LIST        *tail = &head;
+    ULONG                   nblCount = 0;
+    LONG                    inFlight;
+    BOOLEAN                 ready;
+    ULONG64                 indicateTime;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    // Take the whole queue.
+    KeAcquireSpinLockAtDpcLevel(&injectQueue->QueueLock);
+
+    if(IsListEmpty(&injectQueue->Queue))
+    {
+        KeReleaseSpinLockFromDpcLevel(&injectQueue->QueueLock);
+        return;
+    }
+
+    batch.Flink = injectQueue->Queue.Flink;
+    batch.Blink = injectQueue->Queue.Blink;
+    batch.Flink->Blink = &batch;
+    batch.Blink->Flink = &batch;
+    InitializeListHead(&injectQueue->Queue);
+    injectQueue->Count = 0;
+
+    KeReleaseSpinLockFromDpcLevel(&injectQueue->QueueLock);
+
+    // AdapterPause flushes this DPC after leaving the Running state, so
+    // nothing is indicated once the pause has waited for in-flight NBLs.
+    ready = (tapAdapterSendAndReceiveReady(adapter) == NDIS_STATUS_SUCCESS);
+
+    indicateTime = adapter->Latency.Enabled ? KeQueryPerformanceCounter(NULL).QuadPart : 0;
+
+    while(!IsListEmpty(&batch))
+    {
+        InjectPacketPointer injectPacket;
+        PNET_BUFFER_LIST    netBufferList = NULL;
+
+        injectPacket = CONTAINING_RECORD(RemoveHeadList(&batch), InjectPacket, QueueLink);
+
+        if(ready)
+        {
+            netBufferList = tapInjectPacketToNetBufferList(adapter, injectPacket);
         }
         else
         {
-            DEBUGP (("[%s] NdisAllocateMdl failed in IndicateReceivePacket\n",
-                MINIPORT_INSTANCE_ID (Adapter)));
-            NOTE_ERROR ();
+            TAP_TRACE_INFO (TAP_WIN_TRACE_INJECT_PAUSED, injectPacket->m_Size, 0);
+        }
 
-            NdisFreeMemory(injectBuffer,0,0);
+        if(netBufferList == NULL)
+        {
+            INJECT_PACKET_FREE(injectPacket);
+            TAP_DROP(adapter,TAP_WIN_DROP_INJECT);
+            continue;
         }
+
+        TAP_RX_NBL_SET_INDICATE_TIME(netBufferList, indicateTime);
+
+        // Keep queue order in the chain.
+        *tail = netBufferList;
+        tail = &NET_BUFFER_LIST_NEXT_NBL(netBufferList);
+        ++nblCount;
     }
-    else
+
+    if(nblCount == 0)
     {
-        DEBUGP (("[%s] NdisAllocateMemoryWithTagPriority failed in IndicateReceivePacket\n",
-            MINIPORT_INSTANCE_ID (Adapter)));
-        NOTE_ERROR ();
+        return;
     }
+
+    // Increment in-flight receive NBL count.
+    inFlight = InterlockedExchangeAdd(&adapter->ReceiveNblInFlightCount, (LONG )nblCount);
+    ASSERT(inFlight >= 0 );
+
+    NdisMIndicateReceiveNetBufferLists(
+        adapter->MiniportAdapterHandle,
+        head,
+        NDIS_DEFAULT_PORT_NUMBER,
+        nblCount,
+        NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL
+        );
+}
+
+VOID
+tapInjectQueueInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    PTAP_INJECT_QUEUE   injectQueue = &Adapter->InjectPacketQueue;
+
+    KeInitializeSpinLock(&injectQueue->QueueLock);
+    InitializeListHead(&injectQueue->Queue);
+    injectQueue->Count = 0;
+    injectQueue->MaxCount = 0;
+    KeInitializeDpc(&injectQueue->Dpc, tapInjectDpc, Adapter);
+}
+
+VOID
+tapInjectQueueFlush(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Waits for a running injection DPC to finish and frees anything still
+    queued. Called once the adapter has left the Running state.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_INJECT_QUEUE   injectQueue = &Adapter->InjectPacketQueue;
+    KIRQL               irql;
+
+    KeFlushQueuedDpcs();
+
+    KeAcquireSpinLock(&injectQueue->QueueLock, &irql);
+
+    while(!IsListEmpty(&injectQueue->Queue))
+    {
+        InjectPacketPointer injectPacket;
+
+        injectPacket = CONTAINING_RECORD(RemoveHeadList(&injectQueue->Queue), InjectPacket, QueueLink);
+        --injectQueue->Count;
+
+        INJECT_PACKET_FREE(injectPacket);
+        TAP_DROP(Adapter,TAP_WIN_DROP_INJECT);
+    }
+
+    KeReleaseSpinLock(&injectQueue->QueueLock, irql);
 }
 
 VOID
@@ -241,18 +403,31 @@ tapCompleteIrpAndFreeReceiveNetBufferList(
     //
     // Handle P2P Packet
     // -----------------
-    // Free MDL allocated for P2P Ethernet header.
+    // Return the prebuilt P2P Ethernet header MDL to its list, or free
+    // the MDL allocated for it.
     //
     if(TAP_RX_NBL_FLAG_TEST(NetBufferList,TAP_RX_NBL_FLAGS_IS_P2P))
     {
         PNET_BUFFER     netBuffer;
         PMDL            mdl;
+        PTAP_HEADER_MDL headerMdl = (PTAP_HEADER_MDL )NetBufferList->MiniportReserved[1];
 
         netBuffer = NET_BUFFER_LIST_FIRST_NB(NetBufferList);
         mdl = NET_BUFFER_FIRST_MDL(netBuffer);
         mdl->Next = NULL;
 
-        NdisFreeMdl(mdl);
+        if(headerMdl != NULL)
+        {
+            ASSERT(headerMdl->Mdl == mdl);
+            InterlockedPushEntrySList(
+                &Adapter->UserToTapMdlList[headerMdl->Index],
+                &headerMdl->Link
+                );
+        }
+        else
+        {
+            NdisFreeMdl(mdl);
+        }
     }
 
     //
@@ -282,11 +457,19 @@ tapCompleteIrpAndFreeReceiveNetBufferList(
             pagePriority |= MdlMappingNoExecute;
         }
 
-        injectBuffer = (PUCHAR )MmGetSystemAddressForMdlSafe(mdl,pagePriority);
-
-        if(injectBuffer)
+        if(NetBufferList->MiniportReserved[1] != NULL)
         {
-            NdisFreeMemory(injectBuffer,0,0);
+            // Queue entry from IndicateReceivePacket; holds the buffer.
+            INJECT_PACKET_FREE((InjectPacketPointer )NetBufferList->MiniportReserved[1]);
+        }
+        else
+        {
+            injectBuffer = (PUCHAR )MmGetSystemAddressForMdlSafe(mdl,pagePriority);
+
+            if(injectBuffer)
+            {
+                NdisFreeMemory(injectBuffer,0,0);
+            }
         }
 
         NdisFreeMdl(mdl);
@@ -324,9 +507,14 @@ AdapterReturnNetBufferLists(
 {
     PTAP_ADAPTER_CONTEXT    adapter = (PTAP_ADAPTER_CONTEXT )MiniportAdapterContext;
     PNET_BUFFER_LIST        currentNbl;
+    ULONG_PTR               returnTime;
 
     UNREFERENCED_PARAMETER(ReturnFlags);
 
+    returnTime = adapter->Latency.Enabled
+                    ? (ULONG_PTR )KeQueryPerformanceCounter(NULL).QuadPart
+                    : 0;
+
     //
     // Process each NBL individually
     //
@@ -338,6 +526,16 @@ AdapterReturnNetBufferLists(
         nextNbl = NET_BUFFER_LIST_NEXT_NBL(currentNbl);
         NET_BUFFER_LIST_NEXT_NBL(currentNbl) = NULL;
 
+        // Not stamped if collection was off when it was indicated.
+        if(returnTime != 0 && TAP_RX_NBL_INDICATE_TIME(currentNbl) != 0)
+        {
+            tapLatencyRecord(
+                &adapter->Latency,
+                TAP_LATENCY_STACK_HOLD,
+                (ULONG_PTR )(returnTime - TAP_RX_NBL_INDICATE_TIME(currentNbl))
+                );
+        }
+
         // Complete write IRP and free NBL and associated resources.
         tapCompleteIrpAndFreeReceiveNetBufferList(
             adapter,
@@ -386,6 +584,98 @@ TapStrip8021Q(
     return priorityInfo.Value;
 }
 
+VOID
+tapHeaderMdlCacheInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Builds TUN_HEADER_MDL_CACHE_SIZE MDLs over each of m_UserToTap and
+    m_UserToTap_IPv6. The headers are rewritten in place by
+    TAP_WIN_IOCTL_CONFIG_TUN and CONFIG_POINT_TO_POINT, so the MDLs
+    stay valid.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    ULONG   i;
+
+    for(i = 0; i < TAP_TUN_HEADER_COUNT; ++i)
+    {
+        InitializeSListHead(&Adapter->UserToTapMdlList[i]);
+    }
+
+    Adapter->UserToTapMdls = (PTAP_HEADER_MDL )MemAlloc(
+                                TAP_TUN_HEADER_COUNT * TUN_HEADER_MDL_CACHE_SIZE * sizeof(TAP_HEADER_MDL),
+                                TRUE
+                                );
+
+    if(Adapter->UserToTapMdls == NULL)
+    {
+        return;
+    }
+
+    for(i = 0; i < TAP_TUN_HEADER_COUNT * TUN_HEADER_MDL_CACHE_SIZE; ++i)
+    {
+        PTAP_HEADER_MDL entry = &Adapter->UserToTapMdls[i];
+
+        entry->Index = i / TUN_HEADER_MDL_CACHE_SIZE;
+        entry->Mdl = NdisAllocateMdl(
+                        Adapter->MiniportAdapterHandle,
+                        (entry->Index == TAP_TUN_HEADER_IPV6)
+                            ? &Adapter->m_UserToTap_IPv6
+                            : &Adapter->m_UserToTap,
+                        sizeof(ETH_HEADER)
+                        );
+
+        if(entry->Mdl != NULL)
+        {
+            InterlockedPushEntrySList(&Adapter->UserToTapMdlList[entry->Index], &entry->Link);
+        }
+    }
+}
+
+VOID
+tapHeaderMdlCacheFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Frees the TUN write header MDLs. All receive NBLs must have been
+    returned.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    ULONG   i;
+
+    if(Adapter->UserToTapMdls == NULL)
+    {
+        return;
+    }
+
+    for(i = 0; i < TAP_TUN_HEADER_COUNT * TUN_HEADER_MDL_CACHE_SIZE; ++i)
+    {
+        if(Adapter->UserToTapMdls[i].Mdl != NULL)
+        {
+            NdisFreeMdl(Adapter->UserToTapMdls[i].Mdl);
+        }
+    }
+
+    MemFree(
+        Adapter->UserToTapMdls,
+        TAP_TUN_HEADER_COUNT * TUN_HEADER_MDL_CACHE_SIZE * sizeof(TAP_HEADER_MDL)
+        );
+
+    Adapter->UserToTapMdls = NULL;
+}
+
 static NTSTATUS
 TapSharedSendPacket(
     __in PTAP_ADAPTER_CONTEXT Adapter,
@@ -394,14 +684,18 @@ TapSharedSendPacket(
     __in ULONG PacketLength,
     __in_opt PVOID PacketPriority,
     __in_opt const PUCHAR PrefixData,
-    __in const unsigned int PrefixLength
+    __in const unsigned int PrefixLength,
+    __in ULONG64 WriteTime,
+    __inout PTAP_STAGE_TIMER Timer
     )
 {
     PIO_STACK_LOCATION      irpSp;
     unsigned int            fullLength;
     PNET_BUFFER_LIST        netBufferList = NULL;
     PMDL                    mdl = NULL;    // Head of MDL chain.
+    PTAP_HEADER_MDL         headerMdl = NULL;
     LONG                    nblCount;
+    ULONG64                 indicateTime = 0;
 
 
     irpSp = IoGetCurrentIrpStackLocation( Irp );
@@ -425,8 +719,8 @@ TapSharedSendPacket(
 
         if(allocBuffer == NULL)
         {
-            DEBUGP (("[%s] NdisAllocateMemoryWithTagPriority failed in IRP_MJ_WRITE\n",
-                MINIPORT_INSTANCE_ID (Adapter)));
+            TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 1, fullLength);
+            TAP_DROP(Adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
             NOTE_ERROR ();
 
             // Fail the IRP
@@ -451,8 +745,8 @@ TapSharedSendPacket(
 
         if(mdl == NULL)
         {
-            DEBUGP (("[%s] NdisAllocateMdl failed in IRP_MJ_WRITE\n",
-                MINIPORT_INSTANCE_ID (Adapter)));
+            TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 2, fullLength);
+            TAP_DROP(Adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
             NOTE_ERROR ();
 
             NdisFreeMemory(allocBuffer,0,0);
@@ -476,8 +770,8 @@ TapSharedSendPacket(
 
         if(netBufferList == NULL)
         {
-            DEBUGP (("[%s] NdisAllocateNetBufferAndNetBufferList failed in IRP_MJ_WRITE\n",
-                MINIPORT_INSTANCE_ID (Adapter)));
+            TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 3, fullLength);
+            TAP_DROP(Adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
             NOTE_ERROR ();
 
             NdisFreeMdl(mdl);
@@ -498,22 +792,48 @@ TapSharedSendPacket(
         if(PrefixLength > 0)
         {
             //
-            // Allocate MDL for Ethernet header
-            // --------------------------------
+            // Get MDL for Ethernet header
+            // ---------------------------
             // Irp->AssociatedIrp.SystemBuffer with length irpSp->Parameters.Write.Length
             // contains the only the Ethernet payload. Prepend the user-mode provided
             // payload with the Ethernet header pointed to by p_UserToTap.
             //
-            mdl = NdisAllocateMdl(
-                Adapter->MiniportAdapterHandle,
-                PrefixData,
-                PrefixLength
-                );
+            // The TUN headers have prebuilt MDLs; allocate one only if those
+            // run out or for any other prefix.
+            //
+            if(PrefixLength == sizeof(ETH_HEADER)
+                && (PrefixData == (PUCHAR)&Adapter->m_UserToTap
+                    || PrefixData == (PUCHAR)&Adapter->m_UserToTap_IPv6))
+            {
+                PSLIST_ENTRY    link;
+
+                link = InterlockedPopEntrySList(
+                            &Adapter->UserToTapMdlList[
+                                (PrefixData == (PUCHAR)&Adapter->m_UserToTap_IPv6)
+                                    ? TAP_TUN_HEADER_IPV6
+                                    : TAP_TUN_HEADER_IPV4]
+                            );
+
+                if(link != NULL)
+                {
+                    headerMdl = CONTAINING_RECORD(link, TAP_HEADER_MDL, Link);
+                    mdl = headerMdl->Mdl;
+                }
+            }
+
+            if(mdl == NULL)
+            {
+                mdl = NdisAllocateMdl(
+                    Adapter->MiniportAdapterHandle,
+                    PrefixData,
+                    PrefixLength
+                    );
+            }
 
             if(mdl == NULL)            
             {
-                DEBUGP (("[%s] NdisAllocateMdl failed in IRP_MJ_WRITE\n",
-                    MINIPORT_INSTANCE_ID (Adapter)));
+                TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 2, fullLength);
+                TAP_DROP(Adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
                 NOTE_ERROR ();
 
                 // Fail the IRP
@@ -541,14 +861,22 @@ TapSharedSendPacket(
 
         if(netBufferList == NULL)
         {
-            if(mdl != NULL)
+            if(headerMdl != NULL)
+            {
+                mdl->Next = NULL;
+                InterlockedPushEntrySList(
+                    &Adapter->UserToTapMdlList[headerMdl->Index],
+                    &headerMdl->Link
+                    );
+            }
+            else if(mdl != NULL)
             {
                 mdl->Next = NULL;
                 NdisFreeMdl(mdl);
             }
 
-            DEBUGP (("[%s] NdisAllocateNetBufferAndNetBufferList failed in IRP_MJ_WRITE\n",
-                MINIPORT_INSTANCE_ID (Adapter)));
+            TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 3, fullLength);
+            TAP_DROP(Adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
             NOTE_ERROR ();
 
             // Fail the IRP
@@ -573,14 +901,35 @@ TapSharedSendPacket(
 
     // Stash IRP pointer in NBL MiniportReserved[0] field.
     netBufferList->MiniportReserved[0] = Irp;
-    netBufferList->MiniportReserved[1] = NULL;
+    netBufferList->MiniportReserved[1] = headerMdl;   // NULL unless prebuilt
 
     NET_BUFFER_LIST_INFO(netBufferList, Ieee8021QNetBufferListInfo) = PacketPriority;
 
+    // The stack hold time runs from here. The writer's timestamp, if it
+    // sent one, only measures the time taken to get here; one from a
+    // clock ahead of ours counts as no time.
+    if(Adapter->Latency.Enabled)
+    {
+        indicateTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        if(WriteTime != 0)
+        {
+            tapLatencyCount(
+                &Adapter->Latency,
+                TAP_LATENCY_WRITE_INDICATE,
+                indicateTime - min(WriteTime, indicateTime)
+                );
+        }
+    }
+
+    TAP_RX_NBL_SET_INDICATE_TIME(netBufferList, indicateTime);
+
     // Increment in-flight receive NBL count.
     nblCount = NdisInterlockedIncrement(&Adapter->ReceiveNblInFlightCount);
     ASSERT(nblCount > 0 );
 
+    tapStageTimerMark(Timer,TAP_WIN_STAGE_WRITE_BUILD_NBL);
+
     //
     // Indicate the packet
     // -------------------
@@ -594,6 +943,8 @@ TapSharedSendPacket(
         0       // ReceiveFlags
         );
 
+    tapStageTimerMark(Timer,TAP_WIN_STAGE_WRITE_INDICATE);
+
     return STATUS_PENDING;
 }
 
@@ -608,6 +959,9 @@ TapDeviceWrite(
     PIO_STACK_LOCATION      irpSp;// Pointer to current stack location
     PTAP_ADAPTER_CONTEXT    adapter = NULL;
     ULONG                   dataLength;
+    ULONG                   writeLength;
+    ULONG64                 writeTime = 0;
+    TAP_STAGE_TIMER         timer;
 
     PAGED_CODE();
 
@@ -630,6 +984,7 @@ TapDeviceWrite(
         //DEBUGP (("[%s] Interface is down in IRP_MJ_WRITE\n",
         //    MINIPORT_INSTANCE_ID (adapter)));
         //NOTE_ERROR();
+        TAP_DROP(adapter,TAP_WIN_DROP_WRITE_NOT_READY);
 
         Irp->IoStatus.Status = ntStatus = STATUS_CANCELLED;
         Irp->IoStatus.Information = 0;
@@ -643,8 +998,8 @@ TapDeviceWrite(
 
     if (Irp->MdlAddress == NULL)
     {
-        DEBUGP (("[%s] MdlAddress is NULL for IRP_MJ_WRITE\n",
-            MINIPORT_INSTANCE_ID (adapter)));
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_NO_MDL, 0, 0);
+        TAP_DROP(adapter,TAP_WIN_DROP_WRITE_BAD_SIZE);
 
         NOTE_ERROR();
         Irp->IoStatus.Status = ntStatus = STATUS_INVALID_PARAMETER;
@@ -654,6 +1009,8 @@ TapDeviceWrite(
         return ntStatus;
     }
 
+    tapStageTimerStart(&adapter->StageStats,&timer);
+
     //
     // Try to get a virtual address for the MDL.
     //
@@ -666,8 +1023,8 @@ TapDeviceWrite(
 
     if (Irp->AssociatedIrp.SystemBuffer == NULL)
     {
-        DEBUGP (("[%s] Could not map address in IRP_MJ_WRITE\n",
-            MINIPORT_INSTANCE_ID (adapter)));
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_WRITE_MAP_FAILED, 0, 0);
+        TAP_DROP(adapter,TAP_WIN_DROP_WRITE_NO_RESOURCES);
 
         NOTE_ERROR();
         Irp->IoStatus.Status = ntStatus = STATUS_INSUFFICIENT_RESOURCES;
@@ -679,8 +1036,29 @@ TapDeviceWrite(
 
     ASSERT(dataLength == irpSp->Parameters.Write.Length);
 
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_WRITE_MAP);
+
     Irp->IoStatus.Information = irpSp->Parameters.Write.Length;
 
+    //
+    // Strip the timestamp trailer
+    // ---------------------------
+    // A write too short to hold one is left to fail the size checks below.
+    //
+    writeLength = irpSp->Parameters.Write.Length;
+
+    if ((adapter->TimestampFlags & TAP_WIN_TIMESTAMP_WRITE)
+        && writeLength >= sizeof (TAP_WIN_WRITE_TIMESTAMP))
+    {
+        writeLength -= sizeof (TAP_WIN_WRITE_TIMESTAMP);
+
+        NdisMoveMemory(
+            &writeTime,
+            (PUCHAR) Irp->AssociatedIrp.SystemBuffer + writeLength,
+            sizeof (writeTime)
+            );
+    }
+
     //
     // Handle miniport Pause
     // ---------------------
@@ -701,25 +1079,57 @@ TapDeviceWrite(
     //
     if(tapAdapterSendAndReceiveReady(adapter) == NDIS_STATUS_SUCCESS)
     {
-        if (!adapter->m_tun && ((irpSp->Parameters.Write.Length) >= ETHERNET_HEADER_SIZE))
+        if (!adapter->m_tun && (writeLength >= ETHERNET_HEADER_SIZE))
         {
             // TAP mode - Send raw ethernet frame received.
             unsigned char* packetBuffer = (unsigned char *) Irp->AssociatedIrp.SystemBuffer;
-            ULONG packetLength = irpSp->Parameters.Write.Length;
+            ULONG packetLength = writeLength;
             PVOID packetPriority = 0;
 
             DUMP_PACKET ("IRP_MJ_WRITE ETH",
                 packetBuffer,
                 packetLength);
 
+            TAP_CAPTURE_FRAME (&adapter->Capture, TAP_WIN_CAPTURE_RX,
+                NULL, 0, packetBuffer, packetLength);
+
+            //=====================================================
+            // Run the receive filter, if attached. It may drop or
+            // truncate the frame; a frame cut short of its Ethernet
+            // header is dropped below.
+            //=====================================================
+            if(adapter->RxFilter != NULL)
+            {
+                packetLength = tapAdapterFilterWrite(
+                                    adapter,
+                                    NULL,
+                                    0,
+                                    packetBuffer,
+                                    packetLength);
+            }
+
+            //=====================================================
+            // Learn remote hosts for proxy ARP.
+            //=====================================================
+            if(adapter->ProxyArp != NULL
+                && packetLength >= sizeof (ARP_PACKET)
+                && ((ETH_HEADER *) packetBuffer)->proto == htons (NDIS_ETH_TYPE_ARP))
+            {
+                tapProxyArpLearn(adapter, (PARP_PACKET) packetBuffer);
+            }
+
             //=====================================================
             // Check incoming packet for an 802.1Q VLAN/Priority header
             // If one exists, remove it in place.
             // This may change the packet buffer pointer and length.
             //=====================================================
 
+            tapStageTimerSkip(&timer);
+
             packetPriority = TapStrip8021Q(&packetBuffer, &packetLength);
 
+            tapStageTimerMark(&timer,TAP_WIN_STAGE_WRITE_STRIP_8021Q);
+
 
             //=====================================================
             // If IPv4 packet, check whether or not packet
@@ -736,6 +1146,8 @@ TapDeviceWrite(
 #endif
             (Irp->MdlAddress)->Next = NULL; // No next MDL
 
+            tapStageTimerSkip(&timer);
+
             // Determine frame type for packet filtering
             ULONG frameType = 0;
 
@@ -748,7 +1160,16 @@ TapDeviceWrite(
                                 packetLength);
             }
 
-            if((adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS) ||  
+            tapStageTimerMark(&timer,TAP_WIN_STAGE_WRITE_FILTER);
+
+            if(packetLength < ETHERNET_HEADER_SIZE)
+            {
+                TAP_TRACE_VERBOSE (TAP_WIN_TRACE_WRITE_BPF_DROPPED, writeLength, 0);
+                TAP_DROP(adapter,TAP_WIN_DROP_WRITE_FILTERED);
+
+                ntStatus = STATUS_SUCCESS;
+            }
+            else if((adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS) ||  
                (frameType & adapter->PacketFilter))
             {
                 // frame type bit is enabled in the packet filter.
@@ -760,14 +1181,16 @@ TapDeviceWrite(
                     packetLength,
                     packetPriority,
                     NULL,
-                    0
+                    0,
+                    writeTime,
+                    &timer
                     );
 
             }
             else
             {
-                DEBUGP (("[%s] Filtered send in IRP_MJ_WRITE frameType 0x%x, PacketFilter 0x%x\n",
-                    MINIPORT_INSTANCE_ID (adapter), frameType, adapter->PacketFilter));
+                TAP_TRACE_VERBOSE (TAP_WIN_TRACE_WRITE_FILTERED, frameType, adapter->PacketFilter);
+                TAP_DROP(adapter,TAP_WIN_DROP_WRITE_PACKET_FILTER);
 
                 ntStatus = STATUS_SUCCESS;
             }
@@ -776,10 +1199,11 @@ TapDeviceWrite(
 
 
         }
-        else if (adapter->m_tun && ((irpSp->Parameters.Write.Length) >= IP_HEADER_SIZE))
+        else if (adapter->m_tun && (writeLength >= IP_HEADER_SIZE))
         {
             // TUN mode - Prepend an ethernet header 
             PETH_HEADER         p_UserToTap = &adapter->m_UserToTap;
+            ULONG               packetLength = writeLength;
 
             // For IPv6, need to use Ethernet header with IPv6 proto
             if ( IPH_GET_VER( ((IPHDR*) Irp->AssociatedIrp.SystemBuffer)->version_len) == 6 )
@@ -790,7 +1214,12 @@ TapDeviceWrite(
             DUMP_PACKET2 ("IRP_MJ_WRITE P2P",
                 p_UserToTap,
                 (unsigned char *) Irp->AssociatedIrp.SystemBuffer,
-                irpSp->Parameters.Write.Length);
+                writeLength);
+
+            TAP_CAPTURE_FRAME (&adapter->Capture, TAP_WIN_CAPTURE_RX,
+                (PUCHAR) p_UserToTap, sizeof (ETH_HEADER),
+                (PUCHAR) Irp->AssociatedIrp.SystemBuffer,
+                writeLength);
 
             //=====================================================
             // If IPv4 packet, check whether or not packet
@@ -799,40 +1228,66 @@ TapDeviceWrite(
 #if PACKET_TRUNCATION_CHECK
             IPv4PacketSizeVerify (
                 (unsigned char *) Irp->AssociatedIrp.SystemBuffer,
-                irpSp->Parameters.Write.Length,
+                writeLength,
                 TRUE,
                 "RX",
                 &adapter->m_RxTrunc
                 );
 #endif
 
-            if(adapter->PacketFilter & (NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_PROMISCUOUS))
+            //=====================================================
+            // Run the receive filter, if attached, over the frame
+            // as indicated: synthesized Ethernet header and payload.
+            //=====================================================
+            if(adapter->RxFilter != NULL)
+            {
+                ULONG accepted = tapAdapterFilterWrite(
+                                    adapter,
+                                    (PUCHAR)p_UserToTap,
+                                    sizeof(ETH_HEADER),
+                                    (PUCHAR)Irp->AssociatedIrp.SystemBuffer,
+                                    packetLength);
+
+                packetLength = (accepted > sizeof(ETH_HEADER)) ? accepted - sizeof(ETH_HEADER) : 0;
+            }
+
+            if(packetLength == 0)
+            {
+                TAP_TRACE_VERBOSE (TAP_WIN_TRACE_WRITE_BPF_DROPPED, writeLength, 0);
+                TAP_DROP(adapter,TAP_WIN_DROP_WRITE_FILTERED);
+
+                ntStatus = STATUS_SUCCESS;
+            }
+            else if(adapter->PacketFilter & (NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_PROMISCUOUS))
             {
                 // All packets are directed - only send directed packets if the packet filter enables this.
 
+                tapStageTimerSkip(&timer);
+
                 ntStatus = TapSharedSendPacket(
                     adapter,
                     Irp,
                     (unsigned char *) Irp->AssociatedIrp.SystemBuffer,
-                    irpSp->Parameters.Write.Length,
+                    packetLength,
                     NULL,
                     (PUCHAR)p_UserToTap,
-                    sizeof(ETH_HEADER)
+                    sizeof(ETH_HEADER),
+                    writeTime,
+                    &timer
                     );
             }
             else
             {
-                DEBUGP (("[%s] Filtered send in IRP_MJ_WRITE while directed packets are disabled\n",
-                    MINIPORT_INSTANCE_ID (adapter)));
+                TAP_TRACE_VERBOSE (TAP_WIN_TRACE_WRITE_FILTERED, NDIS_PACKET_TYPE_DIRECTED, adapter->PacketFilter);
+                TAP_DROP(adapter,TAP_WIN_DROP_WRITE_PACKET_FILTER);
 
                 ntStatus = STATUS_SUCCESS;
             }
         }
         else
         {
-            DEBUGP (("[%s] Bad buffer size in IRP_MJ_WRITE, len=%d\n",
-                MINIPORT_INSTANCE_ID (adapter),
-                irpSp->Parameters.Write.Length));
+            TAP_TRACE_WARNING (TAP_WIN_TRACE_WRITE_BAD_SIZE, writeLength, 0);
+            TAP_DROP(adapter,TAP_WIN_DROP_WRITE_BAD_SIZE);
             NOTE_ERROR ();
 
             Irp->IoStatus.Information = 0;	// ETHERNET_HEADER_SIZE;
@@ -841,8 +1296,8 @@ TapDeviceWrite(
     }
     else
     {
-        DEBUGP (("[%s] Lying send in IRP_MJ_WRITE while adapter paused\n",
-            MINIPORT_INSTANCE_ID (adapter)));
+        TAP_TRACE_INFO (TAP_WIN_TRACE_WRITE_PAUSED, writeLength, 0);
+        TAP_DROP(adapter,TAP_WIN_DROP_WRITE_PAUSED);
 
         ntStatus = STATUS_SUCCESS;
     }
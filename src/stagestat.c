@@ -0,0 +1,276 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// STAGE STATISTICS
+//-----------------
+
+#include "tap.h"
+
+PTAP_STAGE_CPU
+tapStageSample(
+    __in PTAP_STAGE_STATS   Stats
+    )
+{
+    PTAP_STAGE_CPU  cpus = Stats->Cpus;
+    PTAP_STAGE_CPU  cpu;
+    ULONG           index;
+
+    if(cpus == NULL)
+    {
+        return NULL;
+    }
+
+    index = KeGetCurrentProcessorNumberEx(NULL);
+
+    if(index >= Stats->CpuCount)
+    {
+        return NULL;
+    }
+
+    cpu = &cpus[index];
+
+    if(--cpu->SampleCountdown > 0)
+    {
+        return NULL;
+    }
+
+    cpu->SampleCountdown = Stats->SampleInterval;
+
+    return cpu;
+}
+
+VOID
+tapStageRecord(
+    __in PTAP_STAGE_CPU     Cpu,
+    __in ULONG              Stage,
+    __in ULONG64            Cycles
+    )
+{
+    InterlockedIncrement64(&Cpu->Samples[Stage]);
+    InterlockedExchangeAdd64(&Cpu->Cycles[Stage], (LONG64 )Cycles);
+    InterlockedIncrement64(&Cpu->Histogram[Stage][
+        tapHistogramBucket(Cycles, TAP_WIN_STAGE_HISTOGRAM_BUCKETS)]);
+}
+
+// Copies one stage of one CPU out, zeroing each counter as it is read
+// with Reset.
+static VOID
+tapStageStatCopy(
+    __in PTAP_STAGE_CPU         Cpu,
+    __in ULONG                  Stage,
+    __out TAP_WIN_STAGE_STAT    *Copy,
+    __in BOOLEAN                Reset
+    )
+{
+    ULONG   i;
+
+    if(Reset)
+    {
+        Copy->Samples = InterlockedExchange64(&Cpu->Samples[Stage], 0);
+        Copy->Cycles = InterlockedExchange64(&Cpu->Cycles[Stage], 0);
+
+        for(i = 0; i < TAP_WIN_STAGE_HISTOGRAM_BUCKETS; ++i)
+        {
+            Copy->Histogram[i] = InterlockedExchange64(&Cpu->Histogram[Stage][i], 0);
+        }
+    }
+    else
+    {
+        Copy->Samples = Cpu->Samples[Stage];
+        Copy->Cycles = Cpu->Cycles[Stage];
+
+        for(i = 0; i < TAP_WIN_STAGE_HISTOGRAM_BUCKETS; ++i)
+        {
+            Copy->Histogram[i] = Cpu->Histogram[Stage][i];
+        }
+    }
+}
+
+static NTSTATUS
+tapStageStatsSetInterval(
+    __in PTAP_STAGE_STATS   Stats,
+    __in ULONG              SampleInterval
+    )
+/*++
+
+Routine Description:
+
+    Sets the sampling interval, allocating the per-CPU counters the first
+    time sampling is enabled. They are kept until the adapter is freed,
+    as the data paths may be using them.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_STAGE_CPU  cpus;
+    ULONG           i;
+
+    if(SampleInterval > MAXLONG)
+    {
+        SampleInterval = MAXLONG;
+    }
+
+    if(SampleInterval != 0 && Stats->Cpus == NULL)
+    {
+        ULONG   cpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+        cpus = (PTAP_STAGE_CPU )MemAlloc(cpuCount * sizeof(TAP_STAGE_CPU), TRUE);
+
+        if(cpus == NULL)
+        {
+            DEBUGP (("[TAP] tapStageStatsSetInterval: Counter allocation failed\n"));
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Stats->CpuCount = cpuCount;
+
+        // Another request may have got there first.
+        if(InterlockedCompareExchangePointer(
+                (PVOID *)&Stats->Cpus,
+                cpus,
+                NULL
+                ) != NULL)
+        {
+            MemFree(cpus, cpuCount * sizeof(TAP_STAGE_CPU));
+        }
+    }
+
+    cpus = Stats->Cpus;
+
+    if(cpus != NULL)
+    {
+        for(i = 0; i < Stats->CpuCount; ++i)
+        {
+            cpus[i].SampleCountdown = (LONG )SampleInterval;
+        }
+    }
+
+    InterlockedExchange(&Stats->SampleInterval, (LONG )SampleInterval);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+tapStageStatsQuery(
+    __in PTAP_STAGE_STATS                       Stats,
+    __in_opt const TAP_WIN_STAGE_STATS_CONTROL  *Control,
+    __out_bcount(BufferLength) PUCHAR           Buffer,
+    __in ULONG                                  BufferLength,
+    __out PULONG                                BytesWritten
+    )
+/*++
+
+Routine Description:
+
+    Copies the stage statistics out, summed over CPUs and then per CPU
+    for as many CPUs as fit, and applies the optional control.
+
+    Control must not point into Buffer.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    TAP_WIN_STAGE_STATS         *stats = (TAP_WIN_STAGE_STATS *)Buffer;
+    TAP_WIN_STAGE_CPU_STATS     *cpuStats = (TAP_WIN_STAGE_CPU_STATS *)(stats + 1);
+    PTAP_STAGE_CPU              cpus = Stats->Cpus;
+    BOOLEAN                     reset = (Control != NULL && (Control->Flags & TAP_WIN_STAGE_STATS_RESET));
+    ULONG                       cpuReturned = 0;
+    ULONG                       cpu;
+    ULONG                       stage;
+    ULONG                       i;
+
+    *BytesWritten = 0;
+
+    if(BufferLength < sizeof(TAP_WIN_STAGE_STATS))
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    NdisZeroMemory(stats, sizeof(TAP_WIN_STAGE_STATS));
+
+    stats->SampleInterval = Stats->SampleInterval;
+    stats->StageCount = TAP_WIN_STAGE_COUNT;
+    stats->CpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    if(cpus != NULL)
+    {
+        cpuReturned = min(
+            Stats->CpuCount,
+            (BufferLength - sizeof(TAP_WIN_STAGE_STATS)) / sizeof(TAP_WIN_STAGE_CPU_STATS)
+            );
+
+        for(cpu = 0; cpu < Stats->CpuCount; ++cpu)
+        {
+            for(stage = 0; stage < TAP_WIN_STAGE_COUNT; ++stage)
+            {
+                TAP_WIN_STAGE_STAT  copy;
+                TAP_WIN_STAGE_STAT  *total = &stats->Stages[stage];
+
+                tapStageStatCopy(&cpus[cpu], stage, &copy, reset);
+
+                total->Samples += copy.Samples;
+                total->Cycles += copy.Cycles;
+
+                for(i = 0; i < TAP_WIN_STAGE_HISTOGRAM_BUCKETS; ++i)
+                {
+                    total->Histogram[i] += copy.Histogram[i];
+                }
+
+                if(cpu < cpuReturned)
+                {
+                    cpuStats[cpu].Stages[stage] = copy;
+                }
+            }
+        }
+    }
+
+    stats->CpuReturned = cpuReturned;
+
+    *BytesWritten = sizeof(TAP_WIN_STAGE_STATS) + cpuReturned * sizeof(TAP_WIN_STAGE_CPU_STATS);
+
+    if(Control != NULL && (Control->Flags & TAP_WIN_STAGE_STATS_SET_INTERVAL))
+    {
+        return tapStageStatsSetInterval(Stats, Control->SampleInterval);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapStageStatsFree(
+    __in PTAP_STAGE_STATS   Stats
+    )
+{
+    Stats->SampleInterval = 0;
+
+    if(Stats->Cpus != NULL)
+    {
+        MemFree(Stats->Cpus, Stats->CpuCount * sizeof(TAP_STAGE_CPU));
+
+        Stats->Cpus = NULL;
+    }
+}
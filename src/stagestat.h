@@ -0,0 +1,151 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_STAGESTAT_H_
+#define __TAP_STAGESTAT_H_
+
+//======================================================================
+// Per-stage cycle accounting.
+//
+// The send, write and read completion paths are divided into the
+// TAP_WIN_STAGE_* stages. One operation in SampleInterval on each CPU is
+// timed: tapStageTimerStart reads the timestamp counter, and each
+// tapStageTimerMark charges the cycles since the previous mark to one
+// stage. Work between stages that belongs to none of them is skipped
+// with tapStageTimerSkip. While sampling is off, or for an operation
+// that is not sampled, each call is one test.
+//
+// Each CPU has its own counters, allocated when sampling is first
+// enabled. An operation at PASSIVE_LEVEL may move to another CPU while
+// it is timed. Timestamp counters of different CPUs need not agree, so
+// a stage that started on one CPU and ended on another is discarded,
+// and timing goes on from the new CPU. The samples still go to the CPU
+// the operation started on, which is why the counters are updated with
+// interlocked operations.
+//======================================================================
+
+typedef struct _TAP_STAGE_CPU
+{
+    // Operations left until the next sample. Updated without a lock; a
+    // lost update only moves a sample.
+    LONG                SampleCountdown;
+
+    volatile LONG64     Samples[TAP_WIN_STAGE_COUNT];
+    volatile LONG64     Cycles[TAP_WIN_STAGE_COUNT];
+    volatile LONG64     Histogram[TAP_WIN_STAGE_COUNT][TAP_WIN_STAGE_HISTOGRAM_BUCKETS];
+} TAP_STAGE_CPU, *PTAP_STAGE_CPU;
+
+typedef struct _TAP_STAGE_STATS
+{
+    PTAP_STAGE_CPU      Cpus;           // NULL until sampling is first enabled
+    ULONG               CpuCount;
+    volatile LONG       SampleInterval; // 0: sampling off
+} TAP_STAGE_STATS, *PTAP_STAGE_STATS;
+
+typedef struct _TAP_STAGE_TIMER
+{
+    PTAP_STAGE_CPU      Cpu;            // NULL: not sampled
+    ULONG               Processor;      // Where Last was read
+    ULONG64             Last;
+} TAP_STAGE_TIMER, *PTAP_STAGE_TIMER;
+
+// Returns the current CPU's counters if this operation is to be sampled.
+PTAP_STAGE_CPU
+tapStageSample(
+    __in PTAP_STAGE_STATS   Stats
+    );
+
+VOID
+tapStageRecord(
+    __in PTAP_STAGE_CPU     Cpu,
+    __in ULONG              Stage,
+    __in ULONG64            Cycles
+    );
+
+static __forceinline VOID
+tapStageTimerStart(
+    __in PTAP_STAGE_STATS   Stats,
+    __out PTAP_STAGE_TIMER  Timer
+    )
+{
+    Timer->Cpu = NULL;
+
+    if(Stats->SampleInterval != 0)
+    {
+        Timer->Cpu = tapStageSample(Stats);
+        Timer->Processor = KeGetCurrentProcessorNumberEx(NULL);
+        Timer->Last = ReadTimeStampCounter();
+    }
+}
+
+static __forceinline VOID
+tapStageTimerMark(
+    __inout PTAP_STAGE_TIMER    Timer,
+    __in ULONG                  Stage
+    )
+{
+    if(Timer->Cpu != NULL)
+    {
+        ULONG       processor = KeGetCurrentProcessorNumberEx(NULL);
+        ULONG64     now = ReadTimeStampCounter();
+
+        if(processor == Timer->Processor)
+        {
+            tapStageRecord(Timer->Cpu, Stage, now - Timer->Last);
+        }
+
+        Timer->Processor = processor;
+        Timer->Last = now;
+    }
+}
+
+static __forceinline VOID
+tapStageTimerSkip(
+    __inout PTAP_STAGE_TIMER    Timer
+    )
+{
+    if(Timer->Cpu != NULL)
+    {
+        Timer->Processor = KeGetCurrentProcessorNumberEx(NULL);
+        Timer->Last = ReadTimeStampCounter();
+    }
+}
+
+VOID
+tapStageStatsFree(
+    __in PTAP_STAGE_STATS   Stats
+    );
+
+// Handles TAP_WIN_IOCTL_GET_STAGE_STATS. Buffer holds the optional
+// control on input and receives the statistics.
+NTSTATUS
+tapStageStatsQuery(
+    __in PTAP_STAGE_STATS                       Stats,
+    __in_opt const TAP_WIN_STAGE_STATS_CONTROL  *Control,
+    __out_bcount(BufferLength) PUCHAR           Buffer,
+    __in ULONG                                  BufferLength,
+    __out PULONG                                BytesWritten
+    );
+
+#endif // __TAP_STAGESTAT_H_
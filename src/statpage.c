@@ -0,0 +1,617 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// STATISTICS PAGE
+//-----------------
+
+#include "tap.h"
+
+C_ASSERT(sizeof (TAP_WIN_STATS_PAGE) <= PAGE_SIZE);
+
+static KDEFERRED_ROUTINE tapStatsPageDpc;
+
+static VOID
+tapStatsMappingProcessNotify(
+    __in PEPROCESS              Process,
+    __in HANDLE                 ProcessId,
+    __in_opt PPS_CREATE_NOTIFY_INFO CreateInfo
+    );
+
+VOID
+tapStatsMappingsInitialize()
+/*++
+
+Routine Description:
+
+    Sets up the driver-wide list of mappings and the process exit
+    callback that removes them. Without the callback the page cannot
+    be mapped, as a process could exit with it still mapped.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    NTSTATUS    status;
+
+    NdisInitializeListHead(&GlobalData.StatsMappings);
+    NdisAllocateSpinLock(&GlobalData.StatsMappingLock);
+
+    status = PsSetCreateProcessNotifyRoutineEx(tapStatsMappingProcessNotify, FALSE);
+
+    if(NT_SUCCESS(status))
+    {
+        GlobalData.StatsMappingNotify = TRUE;
+    }
+    else
+    {
+        DEBUGP (("[TAP] tapStatsMappingsInitialize: No process notify routine: %8.8X\n", status));
+    }
+}
+
+VOID
+tapStatsMappingsFree()
+{
+    // All adapters are gone, and every mapping held a reference on one.
+    ASSERT(IsListEmpty(&GlobalData.StatsMappings));
+
+    if(GlobalData.StatsMappingNotify)
+    {
+        PsSetCreateProcessNotifyRoutineEx(tapStatsMappingProcessNotify, TRUE);
+        GlobalData.StatsMappingNotify = FALSE;
+    }
+
+    NdisFreeSpinLock(&GlobalData.StatsMappingLock);
+}
+
+VOID
+tapStatsPageInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    PTAP_STATS_PAGE     stats = &Adapter->StatsPage;
+
+    KeInitializeTimer(&stats->Timer);
+    KeInitializeDpc(&stats->Dpc, tapStatsPageDpc, Adapter);
+}
+
+VOID
+tapStatsPageFree(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+/*++
+
+Routine Description:
+
+    Frees the page, if it was ever mapped. Every mapping holds an
+    adapter reference, so none is left.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_STATS_PAGE     stats = &Adapter->StatsPage;
+
+    if(stats->Mdl == NULL)
+    {
+        return;
+    }
+
+    ASSERT(stats->MappingCount == 0);
+
+    // The last unmap cancelled the timer; wait out a DPC it had queued.
+    KeCancelTimer(&stats->Timer);
+    KeFlushQueuedDpcs();
+
+    IoFreeMdl(stats->Mdl);
+    MemFree(stats->Page, PAGE_SIZE);
+
+    stats->Mdl = NULL;
+    stats->Page = NULL;
+}
+
+// The adapter's TAP_WIN_STATS_STATE_* flags.
+ULONG
+tapAdapterStatsState(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    ULONG   state = 0;
+
+    if(tapAdapterSendAndReceiveReady(Adapter) == NDIS_STATUS_SUCCESS)
+    {
+        state |= TAP_WIN_STATS_STATE_RUNNING;
+    }
+
+    if(tapAdapterReadAndWriteReady(Adapter))
+    {
+        state |= TAP_WIN_STATS_STATE_INTERFACE_UP;
+    }
+
+    if(Adapter->LogicalMediaState)
+    {
+        state |= TAP_WIN_STATS_STATE_MEDIA_CONNECTED;
+    }
+
+    if(Adapter->MediaStateAlwaysConnected)
+    {
+        state |= TAP_WIN_STATS_STATE_ALWAYS_CONNECTED;
+    }
+
+    return state;
+}
+
+// Rewrite the page from the adapter's current state.
+static VOID
+tapStatsPageUpdate(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    PTAP_STATS_PAGE     stats = &Adapter->StatsPage;
+    TAP_WIN_STATS_PAGE  *page = stats->Page;
+    TAP_WIN_DROP_STATS  drops;
+    ULONG               state;
+    ULONG               i;
+
+    // A DPC queued again while it runs may get here on another
+    // processor. There must be only one writer.
+    if(InterlockedExchange(&stats->Updating, 1) != 0)
+    {
+        return;
+    }
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+
+    state = tapAdapterStatsState(Adapter);
+
+    // Odd while the page is inconsistent.
+    page->Sequence++;
+    KeMemoryBarrier();
+
+    page->UpdateTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    page->State = state;
+    page->PowerState = Adapter->CurrentPowerState;
+    page->ActiveQueueCount = Adapter->ActiveQueueCount;
+    page->QueueLimit = Adapter->QueueLimit;
+    page->InjectQueued = Adapter->InjectPacketQueue.Count;
+    page->ReceivesInFlight = Adapter->ReceiveNblInFlightCount;
+
+    page->FramesTxDirected = Adapter->FramesTxDirected;
+    page->FramesTxMulticast = Adapter->FramesTxMulticast;
+    page->FramesTxBroadcast = Adapter->FramesTxBroadcast;
+    page->BytesTxDirected = Adapter->BytesTxDirected;
+    page->BytesTxMulticast = Adapter->BytesTxMulticast;
+    page->BytesTxBroadcast = Adapter->BytesTxBroadcast;
+    page->FramesRxDirected = Adapter->FramesRxDirected;
+    page->FramesRxMulticast = Adapter->FramesRxMulticast;
+    page->FramesRxBroadcast = Adapter->FramesRxBroadcast;
+    page->BytesRxDirected = Adapter->BytesRxDirected;
+    page->BytesRxMulticast = Adapter->BytesRxMulticast;
+    page->BytesRxBroadcast = Adapter->BytesRxBroadcast;
+    page->TxErrors = Adapter->TransmitFailuresOther;
+    page->RxErrors = Adapter->RxResourceErrors;
+
+    NdisMoveMemory(page->Drops, drops.Drops, sizeof (page->Drops));
+    page->Handled = drops.Handled;
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        PTAP_QUEUE                  queue = &Adapter->Queues[i];
+        TAP_WIN_STATS_PAGE_QUEUE    *copy = &page->Queues[i];
+
+        copy->Open = (queue->FileObject != NULL);
+        copy->FlowControlled = queue->FlowControlHasPackets;
+        copy->PendingReads = queue->PendingReadIrpQueue.Count;
+        copy->PendingReadsMax = queue->PendingReadIrpQueue.MaxCount;
+        copy->QueuedFrames = queue->SendPacketQueue.Count;
+        copy->QueuedFramesMax = queue->SendPacketQueue.MaxCount;
+        copy->QueuedBytes = queue->SendPacketQueue.TotalBytes;
+    }
+
+    KeMemoryBarrier();
+    page->Sequence++;
+
+    InterlockedExchange(&stats->Updating, 0);
+}
+
+static VOID
+tapStatsPageDpc(
+    __in PKDPC  Dpc,
+    __in PVOID  DeferredContext,
+    __in PVOID  SystemArgument1,
+    __in PVOID  SystemArgument2
+    )
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    tapStatsPageUpdate((PTAP_ADAPTER_CONTEXT )DeferredContext);
+}
+
+// Allocate the page and its MDL, unless another request got there first.
+static NTSTATUS
+tapStatsPageAllocate(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    PTAP_STATS_PAGE     stats = &Adapter->StatsPage;
+    TAP_WIN_STATS_PAGE  *page;
+    PMDL                mdl;
+    LARGE_INTEGER       frequency;
+
+    // A whole page, so nothing else shares it.
+    page = (TAP_WIN_STATS_PAGE *)MemAlloc(PAGE_SIZE, TRUE);
+
+    if(page == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    mdl = IoAllocateMdl(page, PAGE_SIZE, FALSE, FALSE, NULL);
+
+    if(mdl == NULL)
+    {
+        MemFree(page, PAGE_SIZE);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MmBuildMdlForNonPagedPool(mdl);
+
+    KeQueryPerformanceCounter(&frequency);
+
+    page->Version = TAP_WIN_STATS_PAGE_VERSION;
+    page->Length = sizeof (TAP_WIN_STATS_PAGE);
+    page->UpdateInterval = TAP_STATS_PAGE_INTERVAL;
+    page->Frequency = frequency.QuadPart;
+
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    if(stats->Mdl == NULL)
+    {
+        stats->Page = page;
+        stats->Mdl = mdl;
+        page = NULL;
+    }
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+
+    if(page != NULL)
+    {
+        IoFreeMdl(mdl);
+        MemFree(page, PAGE_SIZE);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// FileObject's mapping, if it has one. Called with StatsMappingLock held.
+static PTAP_STATS_MAPPING
+tapStatsMappingFind(
+    __in PFILE_OBJECT           FileObject
+    )
+{
+    PLIST_ENTRY     entry;
+
+    for(entry = GlobalData.StatsMappings.Flink;
+        entry != &GlobalData.StatsMappings;
+        entry = entry->Flink)
+    {
+        PTAP_STATS_MAPPING  mapping = CONTAINING_RECORD(entry, TAP_STATS_MAPPING, Link);
+
+        if(mapping->FileObject == FileObject)
+        {
+            return mapping;
+        }
+    }
+
+    return NULL;
+}
+
+// Unmap a mapping taken off the list, in its own process, and stop the
+// updates with the last.
+static VOID
+tapStatsMappingRemove(
+    __in PTAP_STATS_MAPPING     Mapping
+    )
+{
+    PTAP_ADAPTER_CONTEXT    adapter = Mapping->Adapter;
+    PTAP_STATS_PAGE         stats = &adapter->StatsPage;
+
+    ASSERT(Mapping->Process == PsGetCurrentProcess());
+
+    MmUnmapLockedPages(Mapping->UserAddress, stats->Mdl);
+
+    tapAdapterAcquireLock(adapter,FALSE);
+
+    if(--stats->MappingCount == 0)
+    {
+        KeCancelTimer(&stats->Timer);
+    }
+
+    tapAdapterReleaseLock(adapter,FALSE);
+
+    ObDereferenceObject(Mapping->Process);
+    MemFree(Mapping, sizeof (TAP_STATS_MAPPING));
+
+    tapAdapterContextDereference(adapter);
+}
+
+NTSTATUS
+tapStatsPageMap(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject,
+    __out PULONG64              UserAddress
+    )
+/*++
+
+Routine Description:
+
+    Handles TAP_WIN_IOCTL_MAP_STATS_PAGE: maps the statistics page
+    read-only into the current process for FileObject, or returns the
+    mapping the handle already has, and keeps the page updated while
+    any mapping exists.
+
+    Runs at IRQL = PASSIVE_LEVEL, in the context of the requesting
+    process.
+
+Return Value:
+
+    STATUS_NOT_SUPPORTED before Windows 8, which cannot map an MDL
+    read-only, or without the process exit callback; STATUS_ACCESS_DENIED
+    if the current process did not open the handle.
+
+--*/
+{
+    PTAP_STATS_PAGE     stats = &Adapter->StatsPage;
+    PTAP_STATS_MAPPING  mapping;
+    PTAP_STATS_MAPPING  existing;
+    PVOID               address = NULL;
+    LARGE_INTEGER       dueTime;
+    KIRQL               irql;
+    NTSTATUS            status;
+
+    *UserAddress = 0;
+
+    if(GlobalData.RunningWindows8OrGreater == FALSE
+        || GlobalData.StatsMappingNotify == FALSE)
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    // The handle's owner, from TapDiagDeviceCreate.
+    if(FileObject->FsContext2 != PsGetCurrentProcess())
+    {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    NdisAcquireSpinLock(&GlobalData.StatsMappingLock);
+    existing = tapStatsMappingFind(FileObject);
+    if(existing != NULL)
+    {
+        *UserAddress = (ULONG64 )(ULONG_PTR )existing->UserAddress;
+    }
+    NdisReleaseSpinLock(&GlobalData.StatsMappingLock);
+
+    if(existing != NULL)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    if(stats->Mdl == NULL)
+    {
+        status = tapStatsPageAllocate(Adapter);
+
+        if(!NT_SUCCESS(status))
+        {
+            return status;
+        }
+    }
+
+    mapping = (PTAP_STATS_MAPPING )MemAlloc(sizeof (TAP_STATS_MAPPING), TRUE);
+
+    if(mapping == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    __try
+    {
+        address = MmMapLockedPagesSpecifyCache(
+                    stats->Mdl,
+                    UserMode,
+                    MmCached,
+                    NULL,
+                    FALSE,
+                    NormalPagePriority | MdlMappingNoWrite
+                    );
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        address = NULL;
+    }
+
+    if(address == NULL)
+    {
+        MemFree(mapping, sizeof (TAP_STATS_MAPPING));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    mapping->Adapter = Adapter;
+    mapping->FileObject = FileObject;
+    mapping->Process = PsGetCurrentProcess();
+    mapping->UserAddress = address;
+
+    ObReferenceObject(mapping->Process);
+    tapAdapterContextReference(Adapter);
+
+    tapAdapterAcquireLock(Adapter,FALSE);
+
+    if(stats->MappingCount++ == 0)
+    {
+        dueTime.QuadPart = -10000LL * TAP_STATS_PAGE_INTERVAL;
+
+        KeSetTimerEx(&stats->Timer, dueTime, TAP_STATS_PAGE_INTERVAL, &stats->Dpc);
+    }
+
+    tapAdapterReleaseLock(Adapter,FALSE);
+
+    // Two requests on one handle; keep the first.
+    NdisAcquireSpinLock(&GlobalData.StatsMappingLock);
+    existing = tapStatsMappingFind(FileObject);
+    if(existing == NULL)
+    {
+        InsertTailList(&GlobalData.StatsMappings, &mapping->Link);
+    }
+    NdisReleaseSpinLock(&GlobalData.StatsMappingLock);
+
+    if(existing != NULL)
+    {
+        tapStatsMappingRemove(mapping);
+
+        return tapStatsPageMap(Adapter, FileObject, UserAddress);
+    }
+
+    // Fill the page now rather than at the first tick.
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    tapStatsPageUpdate(Adapter);
+    KeLowerIrql(irql);
+
+    *UserAddress = (ULONG64 )(ULONG_PTR )address;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapStatsPageUnmap(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PFILE_OBJECT           FileObject
+    )
+/*++
+
+Routine Description:
+
+    Removes FileObject's mapping, if it has one. Called on
+    IRP_MJ_CLEANUP.
+
+    If the last handle was closed in a process other than the one that
+    mapped the page, which can only unmap it in its own context, the
+    mapping is left for tapStatsMappingProcessNotify to remove when
+    that process exits.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    PTAP_STATS_MAPPING  mapping;
+
+    UNREFERENCED_PARAMETER(Adapter);
+
+    if(!GlobalData.StatsMappingNotify)
+    {
+        return;
+    }
+
+    NdisAcquireSpinLock(&GlobalData.StatsMappingLock);
+
+    mapping = tapStatsMappingFind(FileObject);
+
+    if(mapping != NULL)
+    {
+        if(mapping->Process == PsGetCurrentProcess())
+        {
+            RemoveEntryList(&mapping->Link);
+        }
+        else
+        {
+            mapping->FileObject = NULL;
+            mapping = NULL;
+        }
+    }
+
+    NdisReleaseSpinLock(&GlobalData.StatsMappingLock);
+
+    if(mapping != NULL)
+    {
+        tapStatsMappingRemove(mapping);
+    }
+}
+
+static VOID
+tapStatsMappingProcessNotify(
+    __in PEPROCESS              Process,
+    __in HANDLE                 ProcessId,
+    __in_opt PPS_CREATE_NOTIFY_INFO CreateInfo
+    )
+/*++
+
+Routine Description:
+
+    Process creation and exit callback. On exit, which is reported in
+    the exiting process, removes every mapping the process still has,
+    whether or not its handle is still open elsewhere.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+--*/
+{
+    LIST_ENTRY      exiting;
+    PLIST_ENTRY     entry;
+
+    UNREFERENCED_PARAMETER(ProcessId);
+
+    if(CreateInfo != NULL)
+    {
+        return;
+    }
+
+    NdisInitializeListHead(&exiting);
+
+    NdisAcquireSpinLock(&GlobalData.StatsMappingLock);
+
+    for(entry = GlobalData.StatsMappings.Flink;
+        entry != &GlobalData.StatsMappings;
+        )
+    {
+        PTAP_STATS_MAPPING  mapping = CONTAINING_RECORD(entry, TAP_STATS_MAPPING, Link);
+
+        entry = entry->Flink;
+
+        if(mapping->Process == Process)
+        {
+            RemoveEntryList(&mapping->Link);
+            InsertTailList(&exiting, &mapping->Link);
+        }
+    }
+
+    NdisReleaseSpinLock(&GlobalData.StatsMappingLock);
+
+    while(!IsListEmpty(&exiting))
+    {
+        entry = RemoveHeadList(&exiting);
+
+        tapStatsMappingRemove(CONTAINING_RECORD(entry, TAP_STATS_MAPPING, Link));
+    }
+}
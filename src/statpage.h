@@ -0,0 +1,69 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_STATPAGE_H_
+#define __TAP_STATPAGE_H_
+
+//======================================================================
+// Statistics page.
+//
+// A nonpaged page holding a TAP_WIN_STATS_PAGE, mapped read-only into
+// monitoring processes through the diag device. A periodic DPC, the
+// only writer, rewrites it under the page's sequence count while any
+// handle has it mapped.
+//
+// Only the process that opened a diag handle may map the page through
+// it. A mapping can only be removed in its own process: when the handle
+// is cleaned up there, or otherwise when that process exits, so every
+// mapping is also kept on a driver-wide list the process exit callback
+// searches.
+//======================================================================
+
+#define TAP_STATS_PAGE_INTERVAL     100     // milliseconds between updates
+
+typedef struct _TAP_STATS_PAGE
+{
+    TAP_WIN_STATS_PAGE  *Page;      // NULL until first mapped
+    PMDL                Mdl;
+
+    // Mappings of the page, under AdapterLock. The timer runs while
+    // this is non-zero.
+    LONG                MappingCount;
+
+    volatile LONG       Updating;
+    KTIMER              Timer;
+    KDPC                Dpc;
+} TAP_STATS_PAGE, *PTAP_STATS_PAGE;
+
+// One handle's mapping, on GlobalData.StatsMappings.
+typedef struct _TAP_STATS_MAPPING
+{
+    LIST_ENTRY                      Link;       // Under GlobalData.StatsMappingLock
+    struct _TAP_ADAPTER_CONTEXT     *Adapter;   // referenced
+    PFILE_OBJECT                    FileObject; // NULL once the handle is cleaned up
+    PEPROCESS                       Process;    // referenced; the mapping's
+    PVOID                           UserAddress;
+} TAP_STATS_MAPPING, *PTAP_STATS_MAPPING;
+
+#endif // __TAP_STATPAGE_H_
@@ -58,6 +58,752 @@
 #define TAP_PRIORITY_BEHAVIOR_ADDALWAYS     2
 #define TAP_PRIORITY_BEHAVIOR_MAX           2
 
+/* Added in 9.25 */
+
+/* Drain binary trace records in bulk (see TAP_WIN_TRACE_RECORD below) */
+#define TAP_WIN_IOCTL_GET_TRACE             TAP_WIN_CONTROL_CODE (12, METHOD_BUFFERED)
+
+/* Diag device only: frame capture, read back as a pcapng stream */
+#define TAP_WIN_IOCTL_CAPTURE_CONFIG        TAP_WIN_CONTROL_CODE (13, METHOD_BUFFERED)
+#define TAP_WIN_IOCTL_CAPTURE_READ          TAP_WIN_CONTROL_CODE (14, METHOD_BUFFERED)
+
+/* Attach or detach a classic BPF program (see TAP_WIN_FILTER_PROGRAM below) */
+#define TAP_WIN_IOCTL_SET_FILTER            TAP_WIN_CONTROL_CODE (15, METHOD_BUFFERED)
+
+/* Serve other DHCP clients from an address pool (see TAP_WIN_DHCP_POOL below) */
+#define TAP_WIN_IOCTL_CONFIG_DHCP_POOL      TAP_WIN_CONTROL_CODE (16, METHOD_BUFFERED)
+
+/* TAP mode: answer ARP for remote addresses locally (see TAP_WIN_PROXY_ARP below) */
+#define TAP_WIN_IOCTL_CONFIG_PROXY_ARP      TAP_WIN_CONTROL_CODE (17, METHOD_BUFFERED)
+
+/* Answer IPv6 neighbor solicitations for remote addresses locally (see TAP_WIN_ND_PROXY below) */
+#define TAP_WIN_IOCTL_CONFIG_ND_PROXY       TAP_WIN_CONTROL_CODE (18, METHOD_BUFFERED)
+
+/* Allow more handles to be opened, each reading its own share of flows (see below) */
+#define TAP_WIN_IOCTL_SET_QUEUE_COUNT       TAP_WIN_CONTROL_CODE (19, METHOD_BUFFERED)
+
+/* Return several frames per read, completing reads in batches (see TAP_WIN_READ_COALESCING below) */
+#define TAP_WIN_IOCTL_SET_READ_COALESCING   TAP_WIN_CONTROL_CODE (20, METHOD_BUFFERED)
+
+/* Spin lock acquisition and hold time statistics (see TAP_WIN_LOCK_STATS below) */
+#define TAP_WIN_IOCTL_GET_LOCK_STATS        TAP_WIN_CONTROL_CODE (21, METHOD_BUFFERED)
+
+/* Sampled per-stage cycle counts of the send and write paths (see TAP_WIN_STAGE_STATS below) */
+#define TAP_WIN_IOCTL_GET_STAGE_STATS       TAP_WIN_CONTROL_CODE (22, METHOD_BUFFERED)
+
+/* Queueing delay and stack hold time histograms (see TAP_WIN_LATENCY_STATS below) */
+#define TAP_WIN_IOCTL_GET_LATENCY_STATS     TAP_WIN_CONTROL_CODE (23, METHOD_BUFFERED)
+
+/* Timestamp frames read and written (see TAP_WIN_READ_TIMESTAMP below) */
+#define TAP_WIN_IOCTL_SET_TIMESTAMPS        TAP_WIN_CONTROL_CODE (24, METHOD_BUFFERED)
+
+/* Frames discarded, by reason (see TAP_WIN_DROP_STATS below) */
+#define TAP_WIN_IOCTL_GET_DROP_STATS        TAP_WIN_CONTROL_CODE (25, METHOD_BUFFERED)
+
+/* Map the read-only statistics page (see TAP_WIN_STATS_PAGE below) */
+#define TAP_WIN_IOCTL_MAP_STATS_PAGE        TAP_WIN_CONTROL_CODE (26, METHOD_BUFFERED)
+
+/* Counters of every adapter in one call, optionally waiting for a change (see TAP_WIN_METRICS below) */
+#define TAP_WIN_IOCTL_GET_METRICS           TAP_WIN_CONTROL_CODE (27, METHOD_BUFFERED)
+
+/*
+ * =================
+ * Trace records
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_TRACE returns a TAP_WIN_TRACE_HEADER followed by
+ * RecordCount TAP_WIN_TRACE_RECORDs.  Records are ordered by Sequence
+ * within a CPU only; sort on Timestamp to merge CPUs.  Timestamps are
+ * performance counter ticks, TimestampFrequency ticks per second.  Cpu is
+ * the processor index across all groups.  RecordSize is the size of a
+ * record.
+ */
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_TRACE_HEADER
+{
+    unsigned long       RecordCount;
+    unsigned long       RecordsLost;        /* overwritten before being drained */
+    unsigned long       RecordsSuppressed;  /* dropped by rate limiting */
+    unsigned long       RecordSize;         /* sizeof (TAP_WIN_TRACE_RECORD) */
+    unsigned __int64    TimestampFrequency;
+} TAP_WIN_TRACE_HEADER;
+
+typedef struct _TAP_WIN_TRACE_RECORD
+{
+    unsigned __int64    Timestamp;
+    unsigned long       Sequence;
+    unsigned short      EventId;
+    unsigned char       Level;
+    unsigned char       Reserved;
+    unsigned long       Cpu;
+    unsigned long       Reserved2;
+    unsigned __int64    Args[4];
+} TAP_WIN_TRACE_RECORD;
+
+#pragma pack(pop)
+
+#define TAP_WIN_TRACE_LEVEL_ERROR           1
+#define TAP_WIN_TRACE_LEVEL_WARNING         2
+#define TAP_WIN_TRACE_LEVEL_INFO            3
+#define TAP_WIN_TRACE_LEVEL_VERBOSE         4
+
+/* Event ids; Args[] meaning is given after each id */
+#define TAP_WIN_TRACE_TX_ALLOC_FAILED       1   /* length */
+#define TAP_WIN_TRACE_TX_GET_DATA_FAILED    2   /* length */
+#define TAP_WIN_TRACE_TX_FLUSH              3   /* queued packets */
+#define TAP_WIN_TRACE_TX_QUEUE_MAX          4   /* new max count */
+#define TAP_WIN_TRACE_IRP_QUEUE_MAX         5   /* new max count */
+#define TAP_WIN_TRACE_READ_NO_MDL           6
+#define TAP_WIN_TRACE_READ_MAP_FAILED       7
+#define TAP_WIN_TRACE_INJECT_PAUSED         8   /* length */
+#define TAP_WIN_TRACE_INJECT_ALLOC_FAILED   9   /* stage (1 buffer, 2 MDL, 3 NBL), length */
+#define TAP_WIN_TRACE_WRITE_NO_MDL          10
+#define TAP_WIN_TRACE_WRITE_MAP_FAILED      11
+#define TAP_WIN_TRACE_WRITE_ALLOC_FAILED    12  /* stage (1 buffer, 2 MDL, 3 NBL), length */
+#define TAP_WIN_TRACE_WRITE_FILTERED        13  /* frame type, packet filter */
+#define TAP_WIN_TRACE_WRITE_BAD_SIZE        14  /* length */
+#define TAP_WIN_TRACE_WRITE_PAUSED          15  /* length */
+#define TAP_WIN_TRACE_TX_BPF_DROPPED        16  /* length */
+#define TAP_WIN_TRACE_WRITE_BPF_DROPPED     17  /* length */
+#define TAP_WIN_TRACE_INJECT_QUEUE_FULL     18  /* length */
+#define TAP_WIN_TRACE_MAX_EVENT             18
+
+/*
+ * =================
+ * Frame capture
+ * =================
+ *
+ * TAP_WIN_IOCTL_CAPTURE_CONFIG takes a TAP_WIN_CAPTURE_CONFIG and (re)starts
+ * capture with an empty ring; Flags == 0 stops capture and frees the ring.
+ *
+ * TAP_WIN_IOCTL_CAPTURE_READ drains the ring as pcapng.  The first read
+ * after a configure starts with the section header and interface
+ * description blocks, so concatenating the output of successive reads
+ * gives a valid pcapng file.  Frames that did not fit in the ring are
+ * reported through interface statistics blocks (isb_ifdrop).
+ *
+ * The ring is the diag device's own: when it is full frames are dropped
+ * from the capture only, never held back from the TAP handle or the
+ * host.  SampleRate thins the capture to every Nth frame that passes the
+ * filter.
+ */
+
+#define TAP_WIN_CAPTURE_TX                  0x1 /* host -> TAP handle (read path) */
+#define TAP_WIN_CAPTURE_RX                  0x2 /* TAP handle -> host (write path) */
+
+typedef struct _TAP_WIN_CAPTURE_CONFIG
+{
+    unsigned long       Flags;          /* TAP_WIN_CAPTURE_* */
+    unsigned long       SnapLength;     /* 0 = whole frame */
+    unsigned long       BufferSize;     /* ring size in bytes, 0 = default */
+    unsigned short      EtherType;      /* host order, 0 = any */
+    unsigned char       IpProtocol;     /* 0 = any */
+    unsigned char       Reserved;
+    unsigned short      Port;           /* TCP/UDP source or destination, host order, 0 = any */
+    unsigned short      Reserved2;
+    unsigned long       SampleRate;     /* record 1 in N matching frames, 0 = all */
+} TAP_WIN_CAPTURE_CONFIG;
+
+/*
+ * =================
+ * Frame filters
+ * =================
+ *
+ * TAP_WIN_IOCTL_SET_FILTER attaches a classic BPF program (the same
+ * instruction encoding as struct bpf_insn / struct sock_filter) to one
+ * direction, replacing any program already attached.  InstructionCount == 0
+ * detaches.  The program sees the Ethernet frame, including the synthesized
+ * header in TUN mode, and returns 0 to drop the frame or the number of
+ * bytes to keep.  Programs are verified when attached: jumps must be forward
+ * and in range, the last instruction must be a return, and scratch memory
+ * indexes and constant divisors must be valid.  A fragmented frame is
+ * filtered on its first 256 bytes; a load beyond those keeps the whole frame.
+ */
+
+#define TAP_WIN_FILTER_TX                   0x1 /* host -> TAP handle, before the frame is queued */
+#define TAP_WIN_FILTER_RX                   0x2 /* TAP handle -> host, before the frame is indicated */
+
+#define TAP_WIN_FILTER_MAX_INSTRUCTIONS     4096
+
+typedef struct _TAP_WIN_BPF_INSN
+{
+    unsigned short      code;
+    unsigned char       jt;
+    unsigned char       jf;
+    unsigned long       k;
+} TAP_WIN_BPF_INSN;
+
+typedef struct _TAP_WIN_FILTER_PROGRAM
+{
+    unsigned long       Direction;          /* TAP_WIN_FILTER_TX or TAP_WIN_FILTER_RX */
+    unsigned long       InstructionCount;
+    TAP_WIN_BPF_INSN    Instructions[1];    /* InstructionCount entries */
+} TAP_WIN_FILTER_PROGRAM;
+
+/*
+ * =================
+ * DHCP address pool
+ * =================
+ *
+ * By default the DHCP masquerade server (TAP_WIN_IOCTL_CONFIG_DHCP_MASQ)
+ * only answers the adapter itself.  TAP_WIN_IOCTL_CONFIG_DHCP_POOL, issued
+ * after TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, makes it also lease addresses to
+ * any other client seen on the adapter, e.g. VMs bridged to it, using the
+ * masquerade netmask, server address and lease time.  Count == 0 turns
+ * pool mode off; TAP_WIN_IOCTL_CONFIG_DHCP_MASQ also turns it off.
+ * Reconfiguring the pool drops all leases.
+ */
+
+#define TAP_WIN_DHCP_POOL_MAX               8192
+
+typedef struct _TAP_WIN_DHCP_POOL
+{
+    unsigned long       StartAddress;   /* network order */
+    unsigned long       Count;          /* addresses, 0 = pool mode off */
+} TAP_WIN_DHCP_POOL;
+
+/*
+ * =================
+ * Proxy ARP
+ * =================
+ *
+ * TAP_WIN_IOCTL_CONFIG_PROXY_ARP replaces the proxy ARP table of a TAP
+ * mode adapter.  ARP requests from the host for an address covered by an
+ * entry are answered by the driver with the entry's MAC instead of being
+ * passed to the TAP handle; the longest matching prefix wins.  With
+ * TAP_WIN_PROXY_ARP_LEARN, the sender of every ARP frame written to the
+ * TAP handle is also learned as a /32 entry for a few minutes, so repeat
+ * resolutions of remote peers stay local.  Flags == 0 and EntryCount == 0
+ * turns proxy ARP off.
+ */
+
+#define TAP_WIN_PROXY_ARP_LEARN             0x1
+
+#define TAP_WIN_PROXY_ARP_MAX_ENTRIES       4096
+
+typedef struct _TAP_WIN_PROXY_ARP_ENTRY
+{
+    unsigned long       Address;        /* network order */
+    unsigned char       PrefixLength;   /* 0 - 32 */
+    unsigned char       Mac[6];
+    unsigned char       Reserved;
+} TAP_WIN_PROXY_ARP_ENTRY;
+
+typedef struct _TAP_WIN_PROXY_ARP
+{
+    unsigned long           Flags;      /* TAP_WIN_PROXY_ARP_* */
+    unsigned long           EntryCount;
+    TAP_WIN_PROXY_ARP_ENTRY Entries[1]; /* EntryCount entries */
+} TAP_WIN_PROXY_ARP;
+
+/*
+ * =================
+ * IPv6 ND proxy
+ * =================
+ *
+ * TAP_WIN_IOCTL_CONFIG_ND_PROXY replaces the neighbor discovery proxy
+ * table.  Neighbor solicitations from the host for a target covered by an
+ * entry, sent to the target's solicited-node multicast address or to the
+ * target itself, are answered by the driver with a neighbor advertisement
+ * instead of being passed to the handle; the longest matching prefix
+ * wins.  In TAP mode the advertised link-layer address is the entry's
+ * Mac; in TUN mode it is the point-to-point peer's, as for fe80::8.
+ * Duplicate address detection probes are answered for /128 entries only,
+ * so the host can still configure its own addresses inside a proxied
+ * prefix.  EntryCount == 0 turns the ND proxy off.
+ */
+
+#define TAP_WIN_ND_PROXY_MAX_ENTRIES        4096
+
+typedef struct _TAP_WIN_ND_PROXY_ENTRY
+{
+    unsigned char       Address[16];
+    unsigned char       PrefixLength;   /* 0 - 128 */
+    unsigned char       Mac[6];         /* TAP mode only */
+    unsigned char       Reserved;
+} TAP_WIN_ND_PROXY_ENTRY;
+
+typedef struct _TAP_WIN_ND_PROXY
+{
+    unsigned long           EntryCount;
+    TAP_WIN_ND_PROXY_ENTRY  Entries[1]; /* EntryCount entries */
+} TAP_WIN_ND_PROXY;
+
+/*
+ * =================
+ * Multi-queue mode
+ * =================
+ *
+ * A TAP device normally admits a single handle.  TAP_WIN_IOCTL_SET_QUEUE_COUNT,
+ * issued on an open handle with an unsigned long count, lets up to that many
+ * handles be open at once.  Each handle has its own read queue; frames sent
+ * by the host are spread over the handles by a hash of their addresses and,
+ * for TCP and UDP, ports that is the same in both directions, so each flow is
+ * read in order from one handle.  Frames that are not IP go to one handle.
+ * Writes are accepted on any handle.  The count cannot be set below the
+ * number of handles already open, and reverts to 1 when the last one closes.
+ */
+
+#define TAP_WIN_MAX_QUEUES                  8
+
+/*
+ * =================
+ * Read coalescing
+ * =================
+ *
+ * TAP_WIN_IOCTL_SET_READ_COALESCING switches reads to multi-frame mode when
+ * MaxFrames > 1.  A pending read then completes only once MaxFrames frames
+ * or MaxBytes bytes of frames are queued for its handle, or the oldest has
+ * waited MaxMicroseconds (rounded up to the system timer resolution).  The
+ * read returns as many queued frames as fit in its buffer, up to MaxFrames
+ * and, after the first, MaxBytes.  Each frame is preceded by a
+ * TAP_WIN_READ_FRAME header and the next header starts at the following
+ * TAP_WIN_READ_FRAME_ALIGN boundary.  A frame too large for the buffer is
+ * dropped and the read fails, as in single-frame mode.  MaxBytes == 0 means
+ * no byte threshold.  MaxFrames <= 1 restores one frame per read; that is
+ * also the setting each time the device is first opened.
+ */
+
+#define TAP_WIN_READ_COALESCING_MAX_FRAMES  1024
+#define TAP_WIN_READ_COALESCING_MAX_DELAY   100000  /* microseconds */
+
+typedef struct _TAP_WIN_READ_COALESCING
+{
+    unsigned long       MaxFrames;
+    unsigned long       MaxBytes;
+    unsigned long       MaxMicroseconds;
+} TAP_WIN_READ_COALESCING;
+
+#define TAP_WIN_READ_FRAME_ALIGN            4
+
+typedef struct _TAP_WIN_READ_FRAME
+{
+    unsigned long       Length;         /* frame bytes following this header */
+} TAP_WIN_READ_FRAME;
+
+/*
+ * =================
+ * Frame timestamps
+ * =================
+ *
+ * TAP_WIN_IOCTL_SET_TIMESTAMPS takes an unsigned long of
+ * TAP_WIN_TIMESTAMP_* flags; 0, the setting each time the device is first
+ * opened, turns timestamps off.  Timestamps are performance counter
+ * values, as from QueryPerformanceCounter.
+ *
+ * With READ, each frame read is preceded by a TAP_WIN_READ_TIMESTAMP
+ * giving when the frame was queued for the read, and with QUEUE_DELAY
+ * also how long it then waited.  Without QUEUE_DELAY only EnqueueTime is
+ * present; TAP_WIN_READ_TIMESTAMP_LENGTH gives the length either way.  In
+ * multi-frame reads the timestamp follows the TAP_WIN_READ_FRAME header
+ * and is not counted in its Length.  It may be unaligned.
+ *
+ * With WRITE, each write ends with a TAP_WIN_WRITE_TIMESTAMP that is
+ * removed before the frame is indicated.  A non-zero Timestamp is when
+ * the writer produced the frame, and the time from it to the indication
+ * is counted in WriteToIndicate (see TAP_WIN_LATENCY_STATS).  It is a
+ * trailer so the frame ahead of it can still be indicated in place.
+ */
+
+#define TAP_WIN_TIMESTAMP_READ              0x1
+#define TAP_WIN_TIMESTAMP_QUEUE_DELAY       0x2
+#define TAP_WIN_TIMESTAMP_WRITE             0x4
+#define TAP_WIN_TIMESTAMP_FLAGS             0x7
+
+#pragma pack(push, 4)
+
+typedef struct _TAP_WIN_READ_TIMESTAMP
+{
+    unsigned __int64    EnqueueTime;
+    unsigned __int64    QueueDelay;     /* ticks; only with TAP_WIN_TIMESTAMP_QUEUE_DELAY */
+} TAP_WIN_READ_TIMESTAMP;
+
+typedef struct _TAP_WIN_WRITE_TIMESTAMP
+{
+    unsigned __int64    Timestamp;
+} TAP_WIN_WRITE_TIMESTAMP;
+
+#pragma pack(pop)
+
+#define TAP_WIN_READ_TIMESTAMP_LENGTH(_flags) \
+    (((_flags) & TAP_WIN_TIMESTAMP_QUEUE_DELAY) \
+        ? sizeof (TAP_WIN_READ_TIMESTAMP) : sizeof (unsigned __int64))
+
+/*
+ * =================
+ * Lock statistics
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_LOCK_STATS, on the TAP or diag device, returns a
+ * TAP_WIN_LOCK_STATS for the adapter.  Collection is off until enabled: an
+ * optional input unsigned long of TAP_WIN_LOCK_STATS_* flags turns it on
+ * (ENABLE set) or off (ENABLE clear), and RESET zeroes the counters after
+ * they are copied out.  Without input the state is left alone.  Each entry
+ * of Locks covers one kind of lock, summed over the adapter's per-handle
+ * queues.  Wait time is counted only for contended acquisitions.  Bucket 0
+ * of a histogram counts times under one tick; bucket i > 0 counts times of
+ * 2^(i-1) up to 2^i ticks, the last bucket everything longer.  Ticks are
+ * performance counter ticks, Frequency ticks per second.
+ */
+
+#define TAP_WIN_LOCK_STATS_ENABLE           0x1
+#define TAP_WIN_LOCK_STATS_RESET            0x2
+
+#define TAP_WIN_LOCK_ADAPTER                0   /* AdapterLock */
+#define TAP_WIN_LOCK_SEND_QUEUE             1   /* send packet queue QueueLock */
+#define TAP_WIN_LOCK_READ_IRP_QUEUE         2   /* read IRP CSQ QueueLock */
+#define TAP_WIN_LOCK_FLOW_CONTROL           3   /* FlowControlLock */
+#define TAP_WIN_LOCK_COUNT                  4
+
+#define TAP_WIN_LOCK_HISTOGRAM_BUCKETS      24
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_LOCK_STAT
+{
+    unsigned __int64    Acquisitions;
+    unsigned __int64    Contended;
+    unsigned __int64    WaitHistogram[TAP_WIN_LOCK_HISTOGRAM_BUCKETS];
+    unsigned __int64    HoldHistogram[TAP_WIN_LOCK_HISTOGRAM_BUCKETS];
+} TAP_WIN_LOCK_STAT;
+
+typedef struct _TAP_WIN_LOCK_STATS
+{
+    unsigned __int64    Frequency;
+    unsigned long       Enabled;
+    unsigned long       LockCount;      /* TAP_WIN_LOCK_COUNT */
+    TAP_WIN_LOCK_STAT   Locks[TAP_WIN_LOCK_COUNT];
+} TAP_WIN_LOCK_STATS;
+
+#pragma pack(pop)
+
+/*
+ * =================
+ * Stage statistics
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_STAGE_STATS, on the TAP or diag device, returns a
+ * TAP_WIN_STAGE_STATS for the adapter, summed over CPUs, followed by one
+ * TAP_WIN_STAGE_CPU_STATS per CPU for as many CPUs as fit in the output
+ * buffer (CpuReturned of CpuCount).  Sampling is off until an input
+ * TAP_WIN_STAGE_STATS_CONTROL with SET_INTERVAL gives a SampleInterval:
+ * each CPU then times one send, write or read completion in every
+ * SampleInterval, stage by stage.  SampleInterval 0 turns sampling off.
+ * RESET zeroes the counters after they are copied out.  Times are CPU
+ * timestamp counter cycles; Cycles is their sum, for the mean.  A stage
+ * during which the operation moved to another CPU is not counted, as the
+ * two CPUs' counters need not agree.  Histogram buckets are as for lock
+ * statistics, counted in cycles.
+ */
+
+#define TAP_WIN_STAGE_STATS_SET_INTERVAL    0x1
+#define TAP_WIN_STAGE_STATS_RESET           0x2
+
+#define TAP_WIN_STAGE_TX_ALLOCATE           0   /* TAP packet allocation */
+#define TAP_WIN_STAGE_TX_COPY               1   /* NdisGetDataBuffer and copy */
+#define TAP_WIN_STAGE_TX_VLAN               2   /* 802.1Q header insertion */
+#define TAP_WIN_STAGE_TX_INSPECT            3   /* DHCP, ARP and ND handling */
+#define TAP_WIN_STAGE_TX_QUEUE              4   /* send packet queue insert */
+#define TAP_WIN_STAGE_TX_COMPLETE           5   /* read IRP completion */
+#define TAP_WIN_STAGE_WRITE_MAP             6   /* write MDL mapping */
+#define TAP_WIN_STAGE_WRITE_STRIP_8021Q     7   /* 802.1Q header removal */
+#define TAP_WIN_STAGE_WRITE_FILTER          8   /* frame type filtering */
+#define TAP_WIN_STAGE_WRITE_BUILD_NBL       9   /* MDL and NBL allocation */
+#define TAP_WIN_STAGE_WRITE_INDICATE        10  /* receive indication */
+#define TAP_WIN_STAGE_COUNT                 11
+
+#define TAP_WIN_STAGE_HISTOGRAM_BUCKETS     32
+
+typedef struct _TAP_WIN_STAGE_STATS_CONTROL
+{
+    unsigned long       Flags;          /* TAP_WIN_STAGE_STATS_* */
+    unsigned long       SampleInterval;
+} TAP_WIN_STAGE_STATS_CONTROL;
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_STAGE_STAT
+{
+    unsigned __int64    Samples;
+    unsigned __int64    Cycles;
+    unsigned __int64    Histogram[TAP_WIN_STAGE_HISTOGRAM_BUCKETS];
+} TAP_WIN_STAGE_STAT;
+
+typedef struct _TAP_WIN_STAGE_CPU_STATS
+{
+    TAP_WIN_STAGE_STAT  Stages[TAP_WIN_STAGE_COUNT];
+} TAP_WIN_STAGE_CPU_STATS;
+
+typedef struct _TAP_WIN_STAGE_STATS
+{
+    unsigned long       SampleInterval;
+    unsigned long       StageCount;     /* TAP_WIN_STAGE_COUNT */
+    unsigned long       CpuCount;
+    unsigned long       CpuReturned;    /* TAP_WIN_STAGE_CPU_STATS following */
+    TAP_WIN_STAGE_STAT  Stages[TAP_WIN_STAGE_COUNT];
+} TAP_WIN_STAGE_STATS;
+
+#pragma pack(pop)
+
+/*
+ * =================
+ * Latency statistics
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_LATENCY_STATS, on the TAP or diag device, returns a
+ * TAP_WIN_LATENCY_STATS for the adapter.  QueueDelay is the time frames
+ * wait in a send packet queue between being queued for userspace and
+ * being taken by a read.  StackHold is the time the stack holds frames
+ * the adapter indicated, written or driver generated, before returning
+ * them.  WriteToIndicate is the time from the TAP_WIN_WRITE_TIMESTAMP of
+ * a write, if non-zero, to the frame's indication; a timestamp later
+ * than the indication counts as 0.  OldestQueuedAge is the age of the
+ * oldest frame still waiting for a read, 0 if none is, and is measured
+ * whether or not the histograms are collected.  Collection is off until
+ * enabled: an optional input unsigned long of TAP_WIN_LATENCY_STATS_*
+ * flags turns it on (ENABLE set) or off (ENABLE clear), and RESET zeroes
+ * the histograms after they are copied out.  Without input the state is
+ * left alone.  Times are performance counter ticks, Frequency per
+ * second.
+ *
+ * The histograms are log-linear, each power of two split into
+ * TAP_WIN_LATENCY_SUB_BUCKETS buckets, so a bucket's width is at most
+ * 1/TAP_WIN_LATENCY_SUB_BUCKETS of its lower bound.  With S sub-buckets,
+ * bucket i < S holds the value i; bucket i >= S starts at
+ * (S + i % S) << (i / S - 1) and is 1 << (i / S - 1) wide.  The last
+ * bucket also counts everything larger.
+ */
+
+#define TAP_WIN_LATENCY_STATS_ENABLE        0x1
+#define TAP_WIN_LATENCY_STATS_RESET         0x2
+
+#define TAP_WIN_LATENCY_SUB_BUCKET_BITS     3
+#define TAP_WIN_LATENCY_SUB_BUCKETS         (1 << TAP_WIN_LATENCY_SUB_BUCKET_BITS)
+#define TAP_WIN_LATENCY_BUCKETS             256
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_LATENCY_HISTOGRAM
+{
+    unsigned __int64    Count;
+    unsigned __int64    Sum;
+    unsigned __int64    Buckets[TAP_WIN_LATENCY_BUCKETS];
+} TAP_WIN_LATENCY_HISTOGRAM;
+
+typedef struct _TAP_WIN_LATENCY_STATS
+{
+    unsigned __int64            Frequency;
+    unsigned __int64            OldestQueuedAge;
+    unsigned long               Enabled;
+    unsigned long               Reserved;
+    TAP_WIN_LATENCY_HISTOGRAM   QueueDelay;
+    TAP_WIN_LATENCY_HISTOGRAM   StackHold;
+    TAP_WIN_LATENCY_HISTOGRAM   WriteToIndicate;
+} TAP_WIN_LATENCY_STATS;
+
+#pragma pack(pop)
+
+/*
+ * =================
+ * Drop statistics
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_DROP_STATS, on the TAP or diag device, returns a
+ * TAP_WIN_DROP_STATS counting the frames the adapter discarded, indexed
+ * by TAP_WIN_DROP_*.  Handled counts the frames sent that the driver
+ * answered itself (ARP, DHCP or ND) rather than passing them on; they
+ * are not drops.  An optional input unsigned long of
+ * TAP_WIN_DROP_STATS_* flags may RESET the counters after they are
+ * copied out.  Counting is always on.
+ */
+
+#define TAP_WIN_DROP_STATS_RESET            0x1
+
+#define TAP_WIN_DROP_TX_NO_READER           0   /* sent with no handle open */
+#define TAP_WIN_DROP_TX_NOT_READY           1   /* sent while paused or powered down */
+#define TAP_WIN_DROP_TX_BAD_LENGTH          2   /* sent in an NBL with a bad NB length */
+#define TAP_WIN_DROP_TX_ALLOC_FAILED        3   /* TAP packet allocation failed */
+#define TAP_WIN_DROP_TX_GET_DATA_FAILED     4   /* NdisGetDataBuffer or copy failed */
+#define TAP_WIN_DROP_TX_FILTERED            5   /* transmit filter */
+#define TAP_WIN_DROP_TX_TUN_PROTOCOL        6   /* TUN mode, not ARP, IPv4 or IPv6 */
+#define TAP_WIN_DROP_TX_TUN_BAD_SIZE        7   /* TUN mode, too short for its protocol */
+#define TAP_WIN_DROP_TX_TUN_NOT_DIRECTED    8   /* TUN mode, IPv4 not sent to or ARP not for the peer */
+#define TAP_WIN_DROP_TX_NO_QUEUE            9   /* no open handle's queue took it */
+#define TAP_WIN_DROP_TX_FLUSHED             10  /* unread when its handle closed */
+#define TAP_WIN_DROP_READ_TOO_SMALL         11  /* larger than the read buffer */
+#define TAP_WIN_DROP_WRITE_NOT_READY        12  /* written with the interface down */
+#define TAP_WIN_DROP_WRITE_PAUSED           13  /* written while paused */
+#define TAP_WIN_DROP_WRITE_BAD_SIZE         14  /* written too short, or empty */
+#define TAP_WIN_DROP_WRITE_FILTERED         15  /* receive filter */
+#define TAP_WIN_DROP_WRITE_PACKET_FILTER    16  /* frame type not in the packet filter */
+#define TAP_WIN_DROP_WRITE_NO_RESOURCES     17  /* mapping or allocation failed */
+#define TAP_WIN_DROP_INJECT                 18  /* driver generated, not indicated */
+#define TAP_WIN_DROP_TX_MALFORMED           19  /* DHCP masquerade, request without options */
+#define TAP_WIN_DROP_COUNT                  20
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_DROP_STATS
+{
+    unsigned long       DropCount;      /* TAP_WIN_DROP_COUNT */
+    unsigned long       Reserved;
+    unsigned __int64    Handled;
+    unsigned __int64    Drops[TAP_WIN_DROP_COUNT];
+} TAP_WIN_DROP_STATS;
+
+#pragma pack(pop)
+
+/*
+ * =================
+ * Statistics page
+ * =================
+ *
+ * TAP_WIN_IOCTL_MAP_STATS_PAGE, on the diag device only, maps the
+ * adapter's TAP_WIN_STATS_PAGE read-only into the calling process and
+ * returns its address as an unsigned __int64.  Only the process that
+ * opened the handle may map the page through it.  The mapping lasts
+ * until the handle is closed in that process, or the process exits;
+ * asking again on the same handle returns the same address.  Needs
+ * Windows 8 or later.
+ *
+ * While any handle has the page mapped the driver rewrites it every
+ * UpdateInterval milliseconds.  Sequence is odd during an update.  A
+ * reader copies what it needs and retries until it sees the same even
+ * Sequence before and after the copy:
+ *
+ *     do {
+ *         seq = page->Sequence;
+ *         MemoryBarrier ();
+ *         copy = *page;
+ *         MemoryBarrier ();
+ *     } while ((seq & 1) || seq != page->Sequence);
+ *
+ * Check Version before using anything past Length.  Later versions
+ * only add fields at the end.
+ */
+
+#define TAP_WIN_STATS_PAGE_VERSION          1
+
+/* TAP_WIN_STATS_PAGE.State */
+#define TAP_WIN_STATS_STATE_RUNNING         0x1     /* miniport sending and receiving */
+#define TAP_WIN_STATS_STATE_INTERFACE_UP    0x2     /* a handle is open and active */
+#define TAP_WIN_STATS_STATE_MEDIA_CONNECTED 0x4
+#define TAP_WIN_STATS_STATE_ALWAYS_CONNECTED 0x8
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_STATS_PAGE_QUEUE
+{
+    unsigned long       Open;           /* a handle owns this queue */
+    unsigned long       FlowControlled; /* sends held until it drains */
+    unsigned long       PendingReads;
+    unsigned long       PendingReadsMax;
+    unsigned long       QueuedFrames;
+    unsigned long       QueuedFramesMax;
+    unsigned long       QueuedBytes;
+    unsigned long       Reserved;
+} TAP_WIN_STATS_PAGE_QUEUE;
+
+typedef struct _TAP_WIN_STATS_PAGE
+{
+    volatile unsigned long  Sequence;
+    unsigned long       Version;        /* TAP_WIN_STATS_PAGE_VERSION */
+    unsigned long       Length;         /* bytes in use */
+    unsigned long       UpdateInterval; /* milliseconds */
+    unsigned __int64    Frequency;      /* of UpdateTime */
+    unsigned __int64    UpdateTime;     /* performance counter */
+
+    unsigned long       State;          /* TAP_WIN_STATS_STATE_* */
+    unsigned long       PowerState;     /* NDIS_DEVICE_POWER_STATE, 1 is D0 */
+    unsigned long       ActiveQueueCount;
+    unsigned long       QueueLimit;
+    unsigned long       InjectQueued;
+    unsigned long       ReceivesInFlight; /* indicated, not yet returned */
+
+    unsigned __int64    FramesTxDirected;
+    unsigned __int64    FramesTxMulticast;
+    unsigned __int64    FramesTxBroadcast;
+    unsigned __int64    BytesTxDirected;
+    unsigned __int64    BytesTxMulticast;
+    unsigned __int64    BytesTxBroadcast;
+    unsigned __int64    FramesRxDirected;
+    unsigned __int64    FramesRxMulticast;
+    unsigned __int64    FramesRxBroadcast;
+    unsigned __int64    BytesRxDirected;
+    unsigned __int64    BytesRxMulticast;
+    unsigned __int64    BytesRxBroadcast;
+    unsigned __int64    TxErrors;
+    unsigned __int64    RxErrors;
+
+    unsigned __int64    Drops[TAP_WIN_DROP_COUNT];
+
+    TAP_WIN_STATS_PAGE_QUEUE Queues[TAP_WIN_MAX_QUEUES];
+
+    unsigned __int64    Handled;        /* as TAP_WIN_DROP_STATS Handled */
+} TAP_WIN_STATS_PAGE;
+
+#pragma pack(pop)
+
+/*
+ * =================
+ * Metrics
+ * =================
+ *
+ * TAP_WIN_IOCTL_GET_METRICS, on the diag device of any adapter, returns
+ * a TAP_WIN_METRICS followed by AdapterReturned records of RecordLength
+ * bytes, each a TAP_WIN_ADAPTER_METRICS, for all the driver's adapters.
+ * AdapterCount says how many there are; a short buffer gets only the
+ * first records.  Skip records by RecordLength, which only grows.
+ *
+ * With an input TAP_WIN_METRICS_REQUEST whose Flags include
+ * TAP_WIN_METRICS_WAIT the request pends until, since it was made,
+ * either the frames sent, received and dropped by all adapters together
+ * have changed by more than Threshold, or an adapter's State has
+ * changed or an adapter has come or gone, or Period milliseconds have
+ * passed.  It then returns the snapshot as above.  Cancelling it, or
+ * closing the handle, completes it with STATUS_CANCELLED.
+ */
+
+#define TAP_WIN_METRICS_WAIT                0x1
+
+#pragma pack(push, 8)
+
+typedef struct _TAP_WIN_METRICS_REQUEST
+{
+    unsigned long       Flags;          /* TAP_WIN_METRICS_* */
+    unsigned long       Period;         /* milliseconds, at least 1 */
+    unsigned __int64    Threshold;      /* frames */
+} TAP_WIN_METRICS_REQUEST;
+
+typedef struct _TAP_WIN_METRICS
+{
+    unsigned long       AdapterCount;
+    unsigned long       AdapterReturned;
+    unsigned long       RecordLength;   /* sizeof (TAP_WIN_ADAPTER_METRICS) */
+    unsigned long       Reserved;
+    unsigned __int64    Frequency;      /* of Timestamp */
+    unsigned __int64    Timestamp;      /* performance counter */
+} TAP_WIN_METRICS;
+
+typedef struct _TAP_WIN_ADAPTER_METRICS
+{
+    unsigned char       InstanceId[16]; /* NetCfgInstanceId, as a GUID */
+    unsigned long       State;          /* TAP_WIN_STATS_STATE_* */
+    unsigned long       ActiveQueueCount;
+    unsigned long       QueuedFrames;   /* waiting for reads, all queues */
+    unsigned long       PendingReads;   /* all queues */
+    unsigned __int64    FramesTx;
+    unsigned __int64    BytesTx;
+    unsigned __int64    FramesRx;
+    unsigned __int64    BytesRx;
+    unsigned __int64    Errors;         /* transmit and receive */
+    unsigned __int64    Drops;          /* all TAP_WIN_DROP_* reasons */
+} TAP_WIN_ADAPTER_METRICS;
+
+#pragma pack(pop)
+
 /*
  * =================
  * Registry keys
@@ -30,20 +30,33 @@
 #include <netioapi.h>
 
 #include "config.h"
+#include "tap-windows.h"
 #include "lock.h"
 #include "constants.h"
 #include "proto.h"
+#include "lockstat.h"
+#include "stagestat.h"
+#include "latency.h"
+#include "dropstat.h"
+#include "statpage.h"
 #include "mem.h"
+#include "metrics.h"
 #include "macinfo.h"
 #include "dhcp.h"
 #include "error.h"
 #include "endian.h"
+#include "checksum.h"
 #include "dhcp.h"
 #include "types.h"
+#include "dhcppool.h"
+#include "proxyarp.h"
+#include "ndproxy.h"
+#include "capture.h"
+#include "bpf.h"
 #include "adapter.h"
 #include "device.h"
 #include "prototypes.h"
-#include "tap-windows.h"
+#include "trace.h"
 
 //========================================================
 // Check for truncated IPv4 packets, log errors if found.
@@ -60,6 +73,10 @@
 //========================================================
 #define ENABLE_NONADMIN 1
 
+// Buckets in GlobalData.AdapterHash.
+#define TAP_ADAPTER_HASH_BITS   8
+#define TAP_ADAPTER_HASH_SIZE   (1 << TAP_ADAPTER_HASH_BITS)
+
 //
 // The driver has exactly one instance of the TAP_GLOBAL structure.  NDIS keeps
 // an opaque handle to this data, (it doesn't attempt to read or interpret this
@@ -70,6 +87,9 @@ typedef struct _TAP_GLOBAL
 {
     LIST_ENTRY          AdapterList;
 
+    // The adapters in AdapterList, indexed by each of their device objects.
+    LIST_ENTRY          AdapterHash[TAP_ADAPTER_HASH_SIZE];
+
     PNDIS_RW_LOCK_EX    Lock;
 
     NDIS_HANDLE         NdisDriverHandle;   // From NdisMRegisterMiniportDriver
@@ -80,6 +100,12 @@ typedef struct _TAP_GLOBAL
 
     BOOLEAN             EnableTapDiag;
 
+    // Statistics page mappings of all adapters (see statpage.h), and
+    // whether the process exit callback that removes them is set.
+    LIST_ENTRY          StatsMappings;
+    NDIS_SPIN_LOCK      StatsMappingLock;
+    BOOLEAN             StatsMappingNotify;
+
 } TAP_GLOBAL, *PTAP_GLOBAL;
 
 
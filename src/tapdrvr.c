@@ -79,6 +79,7 @@ Arguments:
     ULONGLONG                               conditionMask;
     RTL_OSVERSIONINFOEXW                    osInfo = { 0 };
     NTSTATUS                                status;
+    ULONG                                   i;
 
     UNREFERENCED_PARAMETER(RegistryPath);
 
@@ -118,6 +119,26 @@ Arguments:
     //
     NdisInitializeListHead(&GlobalData.AdapterList);
 
+    for(i = 0; i < TAP_ADAPTER_HASH_SIZE; ++i)
+    {
+        NdisInitializeListHead(&GlobalData.AdapterHash[i]);
+    }
+
+    //
+    // Allocate the per-processor trace rings before anything can log.
+    //
+    status = tapTraceInitialize();
+    if (!NT_SUCCESS(status))
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    //
+    // Statistics page mappings, which outlive their handles until the
+    // process that made them unmaps them or exits.
+    //
+    tapStatsMappingsInitialize();
+
     //
     // Determine whether to enable TapDiag devices
     //
@@ -267,7 +288,7 @@ Arguments:
             }
 
             //
-            // This lock protects the AdapterList.
+            // This lock protects the AdapterList and AdapterHash.
             //
             GlobalData.Lock = NdisAllocateRWLock(GlobalData.NdisDriverHandle);
             if (GlobalData.Lock == NULL)
@@ -345,6 +366,10 @@ Return Value:
         NdisMDeregisterMiniportDriver(GlobalData.NdisDriverHandle);
     }
 
+    tapStatsMappingsFree();
+
+    tapTraceFree();
+
     DEBUGP (("[TAP] <-- TapDriverUnload\n"));
 }
 
@@ -0,0 +1,389 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//-----------------
+// BINARY TRACE RING
+//-----------------
+
+#include "tap.h"
+
+TAP_TRACE_CONTEXT g_TapTrace;
+
+// The layout user mode decodes (see tap-windows.h).
+C_ASSERT(sizeof (TAP_WIN_TRACE_RECORD) == 56);
+
+static const char *g_TapTraceEventNames[TAP_WIN_TRACE_MAX_EVENT + 1] =
+{
+    "NONE",
+    "TX_ALLOC_FAILED",
+    "TX_GET_DATA_FAILED",
+    "TX_FLUSH",
+    "TX_QUEUE_MAX",
+    "IRP_QUEUE_MAX",
+    "READ_NO_MDL",
+    "READ_MAP_FAILED",
+    "INJECT_PAUSED",
+    "INJECT_ALLOC_FAILED",
+    "WRITE_NO_MDL",
+    "WRITE_MAP_FAILED",
+    "WRITE_ALLOC_FAILED",
+    "WRITE_FILTERED",
+    "WRITE_BAD_SIZE",
+    "WRITE_PAUSED",
+    "TX_BPF_DROPPED",
+    "WRITE_BPF_DROPPED",
+    "INJECT_QUEUE_FULL",
+};
+
+NTSTATUS
+tapTraceInitialize()
+/*++
+
+Routine Description:
+
+    Allocates one trace ring per possible processor. Called from DriverEntry.
+
+    Runs at IRQL = PASSIVE_LEVEL.
+
+Return Value:
+
+    STATUS_SUCCESS or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    LARGE_INTEGER   frequency;
+    ULONG           ringCount;
+
+    NdisZeroMemory(&g_TapTrace, sizeof(g_TapTrace));
+
+    KeInitializeSpinLock(&g_TapTrace.ReadLock);
+
+    KeQueryPerformanceCounter(&frequency);
+    g_TapTrace.Frequency = frequency.QuadPart;
+
+    ringCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    g_TapTrace.Rings = (PTAP_TRACE_RING )MemAlloc(
+                            ringCount * sizeof(TAP_TRACE_RING),
+                            TRUE
+                            );
+
+    if(g_TapTrace.Rings == NULL)
+    {
+        DEBUGP (("[TAP] tapTraceInitialize: Trace ring allocation failed\n"));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    g_TapTrace.RingCount = ringCount;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+tapTraceFree()
+{
+    PTAP_TRACE_RING rings = g_TapTrace.Rings;
+    ULONG           ringCount = g_TapTrace.RingCount;
+
+    g_TapTrace.Rings = NULL;
+    g_TapTrace.RingCount = 0;
+
+    if(rings != NULL)
+    {
+        MemFree(rings, ringCount * sizeof(TAP_TRACE_RING));
+    }
+}
+
+VOID
+tapTraceWrite(
+    __in USHORT     EventId,
+    __in UCHAR      Level,
+    __in ULONG64    Arg0,
+    __in ULONG64    Arg1,
+    __in ULONG64    Arg2,
+    __in ULONG64    Arg3
+    )
+/*++
+
+Routine Description:
+
+    Appends a record to the current processor's trace ring.
+
+    The caller's IRQL is raised to DISPATCH_LEVEL for the duration so that
+    the processor, and therefore the ring, cannot change underneath us and
+    no other writer can run on this ring.
+
+    Readers on other processors validate each record they copy against
+    the ring head after the copy (see tapTraceDrainRing), so the only
+    ordering required here is that the record is complete before the new
+    head is published.
+
+    Runs at IRQL <= DISPATCH_LEVEL.
+
+--*/
+{
+    PTAP_TRACE_RING         ring;
+    TAP_WIN_TRACE_RECORD    *record;
+    LARGE_INTEGER           tickCount;
+    KIRQL                   irql;
+    ULONG                   cpu;
+    ULONG                   head;
+
+    if(g_TapTrace.Rings == NULL)
+    {
+        return;
+    }
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+
+    cpu = KeGetCurrentProcessorNumberEx(NULL);
+
+    if(cpu < g_TapTrace.RingCount)
+    {
+        ring = &g_TapTrace.Rings[cpu];
+
+        // Rate limit per clock tick.
+        KeQueryTickCount(&tickCount);
+
+        if(ring->RateTick != tickCount.LowPart)
+        {
+            ring->RateTick = tickCount.LowPart;
+            ring->RateCount = 0;
+        }
+
+        if(ring->RateCount < TAP_TRACE_RATE_LIMIT)
+        {
+            ++ring->RateCount;
+
+            head = ring->Head;
+            record = &ring->Records[head & (TAP_TRACE_RING_SIZE - 1)];
+
+            record->Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+            record->Sequence = head;
+            record->EventId = EventId;
+            record->Level = Level;
+            record->Cpu = cpu;
+            record->Args[0] = Arg0;
+            record->Args[1] = Arg1;
+            record->Args[2] = Arg2;
+            record->Args[3] = Arg3;
+
+            // Publish the record.
+            KeMemoryBarrier();
+            ring->Head = head + 1;
+        }
+        else
+        {
+            InterlockedIncrement(&ring->Suppressed);
+        }
+    }
+
+    KeLowerIrql(irql);
+}
+
+static ULONG
+tapTraceDrainRing(
+    __in PTAP_TRACE_RING                                ring,
+    __out_ecount(MaxRecords) TAP_WIN_TRACE_RECORD *     Records,
+    __in ULONG                                          MaxRecords,
+    __inout PULONG                                      RecordsLost
+    )
+/*++
+
+Routine Description:
+
+    Copies up to MaxRecords undrained records out of one ring.
+
+    A record copied at index i is only valid if the writer has not yet begun
+    to overwrite its slot, i.e. if the head read after the copy is still
+    less than i + TAP_TRACE_RING_SIZE. Records failing that check, and any
+    the writer lapped before we got to them, are counted as lost.
+
+    Called with g_TapTrace.ReadLock held.
+
+--*/
+{
+    ULONG   head;
+    ULONG   count = 0;
+
+    head = ring->Head;
+    KeMemoryBarrier();
+
+    if(head - ring->Tail > TAP_TRACE_RING_SIZE)
+    {
+        *RecordsLost += head - ring->Tail - TAP_TRACE_RING_SIZE;
+        ring->Tail = head - TAP_TRACE_RING_SIZE;
+    }
+
+    while(ring->Tail != head && count < MaxRecords)
+    {
+        Records[count] = ring->Records[ring->Tail & (TAP_TRACE_RING_SIZE - 1)];
+
+        KeMemoryBarrier();
+
+        if(ring->Head - ring->Tail < TAP_TRACE_RING_SIZE)
+        {
+            ++count;
+        }
+        else
+        {
+            ++(*RecordsLost);
+        }
+
+        ++ring->Tail;
+    }
+
+    return count;
+}
+
+ULONG
+tapTraceRead(
+    __out_bcount(BufferLength) PUCHAR   Buffer,
+    __in ULONG                          BufferLength
+    )
+{
+    TAP_WIN_TRACE_HEADER    *header = (TAP_WIN_TRACE_HEADER *)Buffer;
+    TAP_WIN_TRACE_RECORD    *records;
+    ULONG                   maxRecords;
+    ULONG                   i;
+    KIRQL                   irql;
+
+    if(BufferLength < sizeof(TAP_WIN_TRACE_HEADER))
+    {
+        return 0;
+    }
+
+    NdisZeroMemory(header, sizeof(TAP_WIN_TRACE_HEADER));
+    header->RecordSize = sizeof(TAP_WIN_TRACE_RECORD);
+    header->TimestampFrequency = g_TapTrace.Frequency;
+
+    records = (TAP_WIN_TRACE_RECORD *)(header + 1);
+    maxRecords = (BufferLength - sizeof(TAP_WIN_TRACE_HEADER)) / sizeof(TAP_WIN_TRACE_RECORD);
+
+    KeAcquireSpinLock(&g_TapTrace.ReadLock, &irql);
+
+    // Start at a different ring each call so a busy CPU cannot starve
+    // the others when the caller's buffer is small.
+    for(i = 0; i < g_TapTrace.RingCount; ++i)
+    {
+        PTAP_TRACE_RING ring;
+
+        ring = &g_TapTrace.Rings[(g_TapTrace.NextReadRing + i) % g_TapTrace.RingCount];
+
+        header->RecordsSuppressed += (ULONG )InterlockedExchange(&ring->Suppressed, 0);
+
+        header->RecordCount += tapTraceDrainRing(
+                                ring,
+                                records + header->RecordCount,
+                                maxRecords - header->RecordCount,
+                                &header->RecordsLost
+                                );
+    }
+
+    if(g_TapTrace.RingCount > 0)
+    {
+        g_TapTrace.NextReadRing = (g_TapTrace.NextReadRing + 1) % g_TapTrace.RingCount;
+    }
+
+    KeReleaseSpinLock(&g_TapTrace.ReadLock, irql);
+
+    return sizeof(TAP_WIN_TRACE_HEADER) + header->RecordCount * sizeof(TAP_WIN_TRACE_RECORD);
+}
+
+BOOLEAN
+tapTraceReadLine(
+    __out_bcount(BufferLength) char *   Buffer,
+    __in ULONG                          BufferLength
+    )
+/*++
+
+Routine Description:
+
+    Text front end for TAP_WIN_IOCTL_GET_LOG_LINE. Drains the oldest record
+    of the next ring that has one and formats it as a single line.
+
+Return Value:
+
+    TRUE if a line was returned.
+
+--*/
+{
+    TAP_WIN_TRACE_RECORD    record;
+    ULONG                   lost = 0;
+    ULONG                   count = 0;
+    ULONG                   i;
+    KIRQL                   irql;
+    const char              *name;
+
+    if(BufferLength == 0)
+    {
+        return FALSE;
+    }
+
+    NdisZeroMemory(Buffer, BufferLength);
+
+    KeAcquireSpinLock(&g_TapTrace.ReadLock, &irql);
+
+    for(i = 0; i < g_TapTrace.RingCount && count == 0; ++i)
+    {
+        count = tapTraceDrainRing(
+                    &g_TapTrace.Rings[(g_TapTrace.NextReadRing + i) % g_TapTrace.RingCount],
+                    &record,
+                    1,
+                    &lost
+                    );
+    }
+
+    if(g_TapTrace.RingCount > 0)
+    {
+        g_TapTrace.NextReadRing = (g_TapTrace.NextReadRing + 1) % g_TapTrace.RingCount;
+    }
+
+    KeReleaseSpinLock(&g_TapTrace.ReadLock, irql);
+
+    if(count == 0)
+    {
+        return FALSE;
+    }
+
+    name = (record.EventId <= TAP_WIN_TRACE_MAX_EVENT)
+                ? g_TapTraceEventNames[record.EventId] : "???";
+
+    RtlStringCchPrintfA(
+        Buffer,
+        BufferLength,
+        "[TAP] %I64u cpu=%u L%u %s %I64x %I64x %I64x %I64x%s",
+        record.Timestamp,
+        record.Cpu,
+        (ULONG )record.Level,
+        name,
+        record.Args[0],
+        record.Args[1],
+        record.Args[2],
+        record.Args[3],
+        lost ? " [RECORDS LOST]" : ""
+        );
+
+    return TRUE;
+}
@@ -0,0 +1,133 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __TAP_TRACE_H_
+#define __TAP_TRACE_H_
+
+//======================================================================
+// Binary trace ring.
+//
+// Each CPU owns a fixed-size ring of TAP_WIN_TRACE_RECORDs.  Writers run
+// at DISPATCH_LEVEL on their own CPU's ring so no lock is needed; when a
+// ring wraps, the oldest records are overwritten.  Records carry an event
+// id and up to four integer arguments, never strings, so logging is a
+// timestamp read plus a few stores and can be left on in release builds.
+//
+// Levels above TAP_TRACE_LEVEL compile to nothing.  Each CPU accepts at
+// most TAP_TRACE_RATE_LIMIT records per clock tick; the excess is counted
+// and dropped so a packet storm cannot flush the interesting records.
+//======================================================================
+
+#ifndef TAP_TRACE_LEVEL
+#if DBG
+#define TAP_TRACE_LEVEL         TAP_WIN_TRACE_LEVEL_VERBOSE
+#else
+#define TAP_TRACE_LEVEL         TAP_WIN_TRACE_LEVEL_INFO
+#endif
+#endif
+
+#define TAP_TRACE_RING_SIZE     256     // Records per CPU. Must be a power of 2.
+#define TAP_TRACE_RATE_LIMIT    64      // Records per CPU per clock tick.
+
+typedef struct _TAP_TRACE_RING
+{
+    // Written only by the owning CPU at DISPATCH_LEVEL.
+    volatile ULONG          Head;
+    ULONG                   RateTick;
+    ULONG                   RateCount;
+    volatile LONG           Suppressed;
+
+    // Written only by the reader, under TAP_TRACE_CONTEXT.ReadLock.
+    ULONG                   Tail;
+
+    TAP_WIN_TRACE_RECORD    Records[TAP_TRACE_RING_SIZE];
+} TAP_TRACE_RING, *PTAP_TRACE_RING;
+
+typedef struct _TAP_TRACE_CONTEXT
+{
+    PTAP_TRACE_RING         Rings;
+    ULONG                   RingCount;
+
+    ULONG64                 Frequency;
+
+    // Serializes readers only.
+    KSPIN_LOCK              ReadLock;
+    ULONG                   NextReadRing;
+} TAP_TRACE_CONTEXT, *PTAP_TRACE_CONTEXT;
+
+extern TAP_TRACE_CONTEXT g_TapTrace;
+
+NTSTATUS
+tapTraceInitialize();
+
+VOID
+tapTraceFree();
+
+VOID
+tapTraceWrite(
+    __in USHORT     EventId,
+    __in UCHAR      Level,
+    __in ULONG64    Arg0,
+    __in ULONG64    Arg1,
+    __in ULONG64    Arg2,
+    __in ULONG64    Arg3
+    );
+
+// Copies out as many records as fit after the TAP_WIN_TRACE_HEADER.
+// Returns the number of bytes written to Buffer.
+ULONG
+tapTraceRead(
+    __out_bcount(BufferLength) PUCHAR   Buffer,
+    __in ULONG                          BufferLength
+    );
+
+// Formats the oldest undrained record as a text line.
+BOOLEAN
+tapTraceReadLine(
+    __out_bcount(BufferLength) char *   Buffer,
+    __in ULONG                          BufferLength
+    );
+
+#define TAP_TRACE(level, event, a0, a1, a2, a3)                 \
+{                                                               \
+    if ((level) <= TAP_TRACE_LEVEL)                             \
+    {                                                           \
+        tapTraceWrite ((event), (level), (ULONG64)(a0),         \
+            (ULONG64)(a1), (ULONG64)(a2), (ULONG64)(a3));       \
+    }                                                           \
+}
+
+#define TAP_TRACE_ERROR(event, a0, a1) \
+    TAP_TRACE (TAP_WIN_TRACE_LEVEL_ERROR, event, a0, a1, 0, 0)
+
+#define TAP_TRACE_WARNING(event, a0, a1) \
+    TAP_TRACE (TAP_WIN_TRACE_LEVEL_WARNING, event, a0, a1, 0, 0)
+
+#define TAP_TRACE_INFO(event, a0, a1) \
+    TAP_TRACE (TAP_WIN_TRACE_LEVEL_INFO, event, a0, a1, 0, 0)
+
+#define TAP_TRACE_VERBOSE(event, a0, a1) \
+    TAP_TRACE (TAP_WIN_TRACE_LEVEL_VERBOSE, event, a0, a1, 0, 0)
+
+#endif // __TAP_TRACE_H_
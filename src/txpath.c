@@ -36,61 +36,106 @@
 #pragma alloc_text( PAGE, TapDeviceRead)
 #endif // ALLOC_PRAGMA
 
-// checksum code for ICMPv6 packet, taken from dhcp.c / udp_checksum
-// see RFC 4443, 2.3, and RFC 2460, 8.1
-USHORT
-icmpv6_checksum(
-    __in const UCHAR *buf,
-    __in const int len_icmpv6,
-    __in const UCHAR *saddr6,
-    __in const UCHAR *daddr6
+// check IPv6 packet for "is this an IPv6 Neighbor Solicitation that
+// the tap driver needs to answer?"
+// see RFC 4861 4.3 for the different cases
+static IPV6ADDR IPV6_NS_TARGET_MCAST =
+	{ 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x01, 0xff, 0x00, 0x00, 0x08 };
+static IPV6ADDR IPV6_NS_TARGET_UNICAST =
+	{ 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08 };
+
+//===================================================
+// Indicate a neighbor advertisement for target, with
+// link-layer address mac, in reply to a neighbor
+// solicitation. DAD probes are answered to all-nodes.
+//===================================================
+VOID
+IndicateNeighborAdvertisement(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ETH_HEADER *eth,
+    __in const IPV6HDR *ipv6,
+    __in const UCHAR *target,
+    __in const MACADDR mac,
+    __in UCHAR rso_bits
     )
 {
-    USHORT word16;
-    ULONG sum = 0;
-    int i;
+    ICMPV6_NA_PKT *na;
+    USHORT icmpv6_len, icmpv6_csum;
 
-    // make 16 bit words out of every two adjacent 8 bit words and
-    // calculate the sum of all 16 bit words
-    for (i = 0; i < len_icmpv6; i += 2)
-    {
-        word16 = ((buf[i] << 8) & 0xFF00) + ((i + 1 < len_icmpv6) ? (buf[i+1] & 0xFF) : 0);
-        sum += word16;
-    }
+    na = (ICMPV6_NA_PKT *) MemAlloc (sizeof (ICMPV6_NA_PKT), TRUE);
+    if ( !na ) return;
+
+    //------------------------------------------------
+    // Initialize Neighbour Advertisement reply packet
+    //------------------------------------------------
+
+    // ethernet header
+    na->eth.proto = htons(NDIS_ETH_TYPE_IPV6);
+    ETH_COPY_NETWORK_ADDRESS(na->eth.dest, eth->src);
+    ETH_COPY_NETWORK_ADDRESS(na->eth.src, mac);
+
+    // IPv6 header
+    na->ipv6.version_prio = ipv6->version_prio;
+    NdisMoveMemory( na->ipv6.flow_lbl, ipv6->flow_lbl,
+        sizeof(na->ipv6.flow_lbl) );
+    icmpv6_len = sizeof(ICMPV6_NA_PKT) - sizeof(ETH_HEADER) - sizeof(IPV6HDR);
+    na->ipv6.payload_len = htons(icmpv6_len);
+    na->ipv6.nexthdr = IPPROTO_ICMPV6;
+    na->ipv6.hop_limit = 255;
+    NdisMoveMemory( na->ipv6.saddr, target,
+        sizeof(IPV6ADDR) );
 
-    // add the IPv6 pseudo header which contains the IP source and destination addresses
-    for (i = 0; i < 16; i += 2)
+    if ( rso_bits & ICMPV6_NA_SOLICITED )
     {
-        word16 =((saddr6[i] << 8) & 0xFF00) + (saddr6[i+1] & 0xFF);
-        sum += word16;
+        NdisMoveMemory( na->ipv6.daddr, ipv6->saddr,
+            sizeof(IPV6ADDR) );
     }
-
-    for (i = 0; i < 16; i += 2)
+    else
     {
-        word16 =((daddr6[i] << 8) & 0xFF00) + (daddr6[i+1] & 0xFF);
-        sum += word16;
+        // RFC 4861 7.2.4: unsolicited reply to a DAD probe
+        static const MACADDR all_nodes_mac = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x01 };
+
+        ETH_COPY_NETWORK_ADDRESS(na->eth.dest, all_nodes_mac);
+        na->ipv6.daddr[0] = 0xff;
+        na->ipv6.daddr[1] = 0x02;
+        na->ipv6.daddr[15] = 0x01;
     }
 
-    // the next-header number and the length of the ICMPv6 packet
-    sum += (USHORT) IPPROTO_ICMPV6 + (USHORT) len_icmpv6;
+    // ICMPv6
+    na->icmpv6.type = ICMPV6_TYPE_NA;
+    na->icmpv6.code = ICMPV6_CODE_0;
+    na->icmpv6.checksum = 0;
+    na->icmpv6.rso_bits = rso_bits;
+    NdisZeroMemory( na->icmpv6.reserved, sizeof(na->icmpv6.reserved) );
+    NdisMoveMemory( na->icmpv6.target_addr, target,
+        sizeof(IPV6ADDR) );
 
-    // keep only the last 16 bits of the 32 bit calculated sum and add the carries
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    // ICMPv6 option "Target Link Layer Address"
+    na->icmpv6.opt_type = ICMPV6_OPTION_TLLA;
+    na->icmpv6.opt_length = ICMPV6_LENGTH_TLLA;
+    ETH_COPY_NETWORK_ADDRESS( na->icmpv6.target_macaddr, mac );
 
-    // Take the one's complement of sum
-    return ((USHORT) ~sum);
-}
+    // calculate and set checksum
+    icmpv6_csum = tapChecksumIPv6Pseudo (
+                    (UCHAR*) &(na->icmpv6),
+                    icmpv6_len,
+                    IPPROTO_ICMPV6,
+                    na->ipv6.saddr,
+                    na->ipv6.daddr
+                    );
 
-// check IPv6 packet for "is this an IPv6 Neighbor Solicitation that
-// the tap driver needs to answer?"
-// see RFC 4861 4.3 for the different cases
-static IPV6ADDR IPV6_NS_TARGET_MCAST =
-	{ 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-          0x00, 0x00, 0x00, 0x01, 0xff, 0x00, 0x00, 0x08 };
-static IPV6ADDR IPV6_NS_TARGET_UNICAST =
-	{ 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08 };
+    na->icmpv6.checksum = htons( icmpv6_csum );
+
+    DUMP_PACKET ("IndicateNeighborAdvertisement",
+        (unsigned char *) na,
+        sizeof (ICMPV6_NA_PKT));
+
+    IndicateReceivePacket (Adapter, (UCHAR *) na, sizeof (ICMPV6_NA_PKT));
+
+    MemFree (na, sizeof (ICMPV6_NA_PKT));
+}
 
 BOOLEAN
 HandleIPv6NeighborDiscovery(
@@ -101,13 +146,18 @@ HandleIPv6NeighborDiscovery(
 {
     const IPV6HDR *ipv6 = (IPV6HDR *) (m_Data + sizeof (ETH_HEADER));
     const ICMPV6_NS * icmpv6_ns = (ICMPV6_NS *) (m_Data + sizeof (ETH_HEADER) + sizeof (IPV6HDR));
-    ICMPV6_NA_PKT *na;
-    USHORT icmpv6_len, icmpv6_csum;
 
     // we don't really care about the destination MAC address here
     // - it's either a multicast MAC, or the userland destination MAC
     // but since the TAP driver is point-to-point, all packets are "for us"
 
+    // Targets covered by the ND proxy table are answered first
+    if ( Adapter->NdProxy != NULL &&
+        tapNdProxyProcess( Adapter, m_Data, packetLength ) )
+    {
+        return TRUE;
+    }
+
     // IPv6 target address must be ff02::1:ff00:8 (multicast for
     // initial NS) or fe80::8 (unicast for recurrent NUD)
     if ( memcmp( ipv6->daddr, IPV6_NS_TARGET_MCAST,
@@ -145,68 +195,63 @@ HandleIPv6NeighborDiscovery(
         return FALSE;				// not for us
     }
 
-    // packet identified, build magic response packet
-
-    na = (ICMPV6_NA_PKT *) MemAlloc (sizeof (ICMPV6_NA_PKT), TRUE);
-    if ( !na ) return FALSE;
-
-    //------------------------------------------------
-    // Initialize Neighbour Advertisement reply packet
-    //------------------------------------------------
-
-    // ethernet header
-    na->eth.proto = htons(NDIS_ETH_TYPE_IPV6);
-    ETH_COPY_NETWORK_ADDRESS(na->eth.dest, Adapter->PermanentAddress);
-    ETH_COPY_NETWORK_ADDRESS(na->eth.src, Adapter->m_TapToUser.dest);
-
-    // IPv6 header
-    na->ipv6.version_prio = ipv6->version_prio;
-    NdisMoveMemory( na->ipv6.flow_lbl, ipv6->flow_lbl,
-        sizeof(na->ipv6.flow_lbl) );
-    icmpv6_len = sizeof(ICMPV6_NA_PKT) - sizeof(ETH_HEADER) - sizeof(IPV6HDR);
-    na->ipv6.payload_len = htons(icmpv6_len);
-    na->ipv6.nexthdr = IPPROTO_ICMPV6;
-    na->ipv6.hop_limit = 255;
-    NdisMoveMemory( na->ipv6.saddr, IPV6_NS_TARGET_UNICAST,
-        sizeof(IPV6ADDR) );
-    NdisMoveMemory( na->ipv6.daddr, ipv6->saddr,
-        sizeof(IPV6ADDR) );
-
-    // ICMPv6
-    na->icmpv6.type = ICMPV6_TYPE_NA;
-    na->icmpv6.code = ICMPV6_CODE_0;
-    na->icmpv6.checksum = 0;
-    na->icmpv6.rso_bits = 0x60;		// Solicited + Override
-    NdisZeroMemory( na->icmpv6.reserved, sizeof(na->icmpv6.reserved) );
-    NdisMoveMemory( na->icmpv6.target_addr, IPV6_NS_TARGET_UNICAST,
-        sizeof(IPV6ADDR) );
-
-    // ICMPv6 option "Target Link Layer Address"
-    na->icmpv6.opt_type = ICMPV6_OPTION_TLLA;
-    na->icmpv6.opt_length = ICMPV6_LENGTH_TLLA;
-    ETH_COPY_NETWORK_ADDRESS( na->icmpv6.target_macaddr, Adapter->m_TapToUser.dest );
-
-    // calculate and set checksum
-    icmpv6_csum = icmpv6_checksum (
-                    (UCHAR*) &(na->icmpv6),
-                    icmpv6_len,
-                    na->ipv6.saddr,
-                    na->ipv6.daddr
-                    );
-
-    na->icmpv6.checksum = htons( icmpv6_csum );
-
-    DUMP_PACKET ("HandleIPv6NeighborDiscovery",
-        (unsigned char *) na,
-        sizeof (ICMPV6_NA_PKT));
-
-    IndicateReceivePacket (Adapter, (UCHAR *) na, sizeof (ICMPV6_NA_PKT));
-
-    MemFree (na, sizeof (ICMPV6_NA_PKT));
+    // packet identified, send magic response packet
+    IndicateNeighborAdvertisement (
+        Adapter,
+        (ETH_HEADER *) m_Data,
+        ipv6,
+        IPV6_NS_TARGET_UNICAST,
+        Adapter->m_TapToUser.dest,
+        ICMPV6_NA_SOLICITED | ICMPV6_NA_OVERRIDE
+        );
 
     return TRUE;				// all fine
 }
 
+//===================================================
+// Indicate the reply to an ARP request, resolving
+// its target address to mac.
+//===================================================
+VOID
+IndicateARPReply(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in const ARP_PACKET *src,
+    __in const MACADDR mac
+    )
+{
+    ARP_PACKET *arp = (ARP_PACKET *) MemAlloc (sizeof (ARP_PACKET), TRUE);
+    if (arp)
+    {
+        //----------------------------------------------
+        // Initialize ARP reply fields
+        //----------------------------------------------
+        arp->m_Proto = htons (NDIS_ETH_TYPE_ARP);
+        arp->m_MAC_AddressType = htons (MAC_ADDR_TYPE);
+        arp->m_PROTO_AddressType = htons (NDIS_ETH_TYPE_IPV4);
+        arp->m_MAC_AddressSize = sizeof (MACADDR);
+        arp->m_PROTO_AddressSize = sizeof (IPADDR);
+        arp->m_ARP_Operation = htons (ARP_REPLY);
+
+        //----------------------------------------------
+        // ARP addresses
+        //----------------------------------------------      
+        ETH_COPY_NETWORK_ADDRESS (arp->m_MAC_Source, mac);
+        ETH_COPY_NETWORK_ADDRESS (arp->m_MAC_Destination, src->m_ARP_MAC_Source);
+        ETH_COPY_NETWORK_ADDRESS (arp->m_ARP_MAC_Source, mac);
+        ETH_COPY_NETWORK_ADDRESS (arp->m_ARP_MAC_Destination, src->m_ARP_MAC_Source);
+        arp->m_ARP_IP_Source = src->m_ARP_IP_Destination;
+        arp->m_ARP_IP_Destination = src->m_ARP_IP_Source;
+
+        DUMP_PACKET ("ProcessARP",
+            (unsigned char *) arp,
+            sizeof (ARP_PACKET));
+
+        IndicateReceivePacket (Adapter, (UCHAR *) arp, sizeof (ARP_PACKET));
+
+        MemFree (arp, sizeof (ARP_PACKET));
+    }
+}
+
 //===================================================
 // Generate an ARP reply message for specific kinds
 // ARP queries.
@@ -237,37 +282,7 @@ ProcessARP(
         && (src->m_ARP_IP_Destination & ip_netmask) == ip_network
         && src->m_ARP_IP_Destination != adapter_ip)
     {
-        ARP_PACKET *arp = (ARP_PACKET *) MemAlloc (sizeof (ARP_PACKET), TRUE);
-        if (arp)
-        {
-            //----------------------------------------------
-            // Initialize ARP reply fields
-            //----------------------------------------------
-            arp->m_Proto = htons (NDIS_ETH_TYPE_ARP);
-            arp->m_MAC_AddressType = htons (MAC_ADDR_TYPE);
-            arp->m_PROTO_AddressType = htons (NDIS_ETH_TYPE_IPV4);
-            arp->m_MAC_AddressSize = sizeof (MACADDR);
-            arp->m_PROTO_AddressSize = sizeof (IPADDR);
-            arp->m_ARP_Operation = htons (ARP_REPLY);
-
-            //----------------------------------------------
-            // ARP addresses
-            //----------------------------------------------      
-            ETH_COPY_NETWORK_ADDRESS (arp->m_MAC_Source, mac);
-            ETH_COPY_NETWORK_ADDRESS (arp->m_MAC_Destination, Adapter->PermanentAddress);
-            ETH_COPY_NETWORK_ADDRESS (arp->m_ARP_MAC_Source, mac);
-            ETH_COPY_NETWORK_ADDRESS (arp->m_ARP_MAC_Destination, Adapter->PermanentAddress);
-            arp->m_ARP_IP_Source = src->m_ARP_IP_Destination;
-            arp->m_ARP_IP_Destination = adapter_ip;
-
-            DUMP_PACKET ("ProcessARP",
-                (unsigned char *) arp,
-                sizeof (ARP_PACKET));
-
-            IndicateReceivePacket (Adapter, (UCHAR *) arp, sizeof (ARP_PACKET));
-
-            MemFree (arp, sizeof (ARP_PACKET));
-        }
+        IndicateARPReply (Adapter, src, mac);
 
         return TRUE;
     }
@@ -285,152 +300,1004 @@ ProcessARP(
 // Use the ethernet packet to satisfy the IRP.
 //=============================================================
 
+// Store the TAP_WIN_READ_TIMESTAMP of a frame read at ReadTime, which
+// may be unaligned.
+static VOID
+tapCopyReadTimestamp(
+    __out PUCHAR        Buffer,
+    __in PTAP_PACKET    TapPacket,
+    __in ULONG          TimestampFlags,
+    __in ULONG64        ReadTime
+    )
+{
+    TAP_WIN_READ_TIMESTAMP  timestamp;
+    ULONG                   length = TAP_WIN_READ_TIMESTAMP_LENGTH(TimestampFlags);
+
+    timestamp.EnqueueTime = TapPacket->m_EnqueueTime;
+    timestamp.QueueDelay = ReadTime - TapPacket->m_EnqueueTime;
+
+    NdisMoveMemory(Buffer, &timestamp, length);
+}
+
 VOID
 tapCompletePendingReadIrp(
+    __in PTAP_ADAPTER_CONTEXT Adapter,
     __in PIRP Irp,
-    __in PTAP_PACKET TapPacket
+    __in PTAP_PACKET TapPacket,
+    __in ULONG64 ReadTime
     )
 {
     int offset;
     int len;
+    int headerLength = 0;
+    ULONG       timestampFlags = Adapter->TimestampFlags;
     NTSTATUS    status = STATUS_UNSUCCESSFUL;
 
     ASSERT(Irp);
     ASSERT(TapPacket);
 
+    if(timestampFlags & TAP_WIN_TIMESTAMP_READ)
+    {
+        headerLength = TAP_WIN_READ_TIMESTAMP_LENGTH(timestampFlags);
+    }
+
     //-------------------------------------------
-    // While TapPacket always contains a
-    // full ethernet packet, including the
-    // ethernet header, in point-to-point mode,
-    // we only want to return the IPv4
-    // component.
+    // In point-to-point mode (TP_TUN) TapPacket
+    // holds only the IP packet; otherwise the
+    // full ethernet frame. Either way it is
+    // returned as is.
     //-------------------------------------------
 
-    if (TapPacket->m_SizeFlags & TP_TUN)
+    offset = 0;
+    len = (TapPacket->m_SizeFlags & TP_SIZE_MASK);
+
+    if (len < 0 || (int) Irp->IoStatus.Information < headerLength + len)
     {
-        offset = ETHERNET_HEADER_SIZE;
-        len = (int) (TapPacket->m_SizeFlags & TP_SIZE_MASK) - ETHERNET_HEADER_SIZE;
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = status = STATUS_BUFFER_OVERFLOW;
+        TAP_DROP(Adapter,TAP_WIN_DROP_READ_TOO_SMALL);
+        NOTE_ERROR ();
     }
     else
     {
-        offset = 0;
-        len = (TapPacket->m_SizeFlags & TP_SIZE_MASK);
+        Irp->IoStatus.Information = headerLength + len;
+        Irp->IoStatus.Status = status = STATUS_SUCCESS;
+
+        if (headerLength > 0)
+        {
+            tapCopyReadTimestamp(
+                (PUCHAR) Irp->AssociatedIrp.SystemBuffer,
+                TapPacket,
+                timestampFlags,
+                ReadTime
+                );
+        }
+
+        // Copy packet data
+        NdisMoveMemory(
+            (PUCHAR) Irp->AssociatedIrp.SystemBuffer + headerLength,
+            TapPacket->m_Data + offset,
+            len
+            );
+    }
+
+    // Free the TAP packet
+    NdisFreeMemory(TapPacket,0,0);
+
+    // Complete the IRP
+    IoCompleteRequest (Irp, IO_NETWORK_INCREMENT);
+}
+
+//=============================================================
+// Multi-frame counterpart of tapCompletePendingReadIrp: fill
+// the read buffer with as many queued frames as the coalescing
+// policy and the buffer allow, each behind a TAP_WIN_READ_FRAME
+// header.
+//
+// Call with the send packet queue lock held.
+//=============================================================
+
+static VOID
+tapCompletePendingReadIrpCoalesced(
+    __in PTAP_ADAPTER_CONTEXT               Adapter,
+    __in PIRP                               Irp,
+    __in PTAP_QUEUE                         Queue,
+    __in const TAP_READ_COALESCE_POLICY     *Policy,
+    __in ULONG64                            ReadTime
+    )
+{
+    PUCHAR      buffer = (PUCHAR )Irp->AssociatedIrp.SystemBuffer;
+    ULONG       bufferLength = (ULONG )Irp->IoStatus.Information;
+    ULONG       offset = 0;
+    ULONG       end = 0;
+    ULONG       frames = 0;
+    ULONG       bytes = 0;
+    ULONG       timestampFlags = Adapter->TimestampFlags;
+    ULONG       headerLength = sizeof (TAP_WIN_READ_FRAME);
+    BOOLEAN     tooLarge = FALSE;
+    PTAP_PACKET tapPacket;
+
+    if(timestampFlags & TAP_WIN_TIMESTAMP_READ)
+    {
+        headerLength += TAP_WIN_READ_TIMESTAMP_LENGTH(timestampFlags);
+    }
+
+    while(frames < Policy->MaxFrames
+        && Queue->SendPacketQueue.Count > 0)
+    {
+        ULONG   len;
+
+        tapPacket = CONTAINING_RECORD(
+                        Queue->SendPacketQueue.Queue.Flink,
+                        TAP_PACKET,
+                        QueueLink
+                        );
+
+        len = (tapPacket->m_SizeFlags & TP_SIZE_MASK);
+
+        // Leave frames that don't fit for the next read.
+        if(offset > bufferLength
+            || bufferLength - offset < headerLength + len)
+        {
+            tooLarge = (frames == 0);
+            break;
+        }
+
+        if(frames > 0
+            && Policy->MaxBytes != 0
+            && bytes + len > Policy->MaxBytes)
+        {
+            break;
+        }
+
+        tapPacket = tapPacketRemoveHeadLocked(&Queue->SendPacketQueue);
+
+        tapLatencyRecord(&Adapter->Latency,TAP_LATENCY_QUEUE_DELAY,ReadTime - tapPacket->m_EnqueueTime);
+
+        ((TAP_WIN_READ_FRAME *) (buffer + offset))->Length = len;
+
+        if(timestampFlags & TAP_WIN_TIMESTAMP_READ)
+        {
+            tapCopyReadTimestamp(
+                buffer + offset + sizeof (TAP_WIN_READ_FRAME),
+                tapPacket,
+                timestampFlags,
+                ReadTime
+                );
+        }
+
+        NdisMoveMemory(
+            buffer + offset + headerLength,
+            tapPacket->m_Data,
+            len
+            );
+
+        NdisFreeMemory(tapPacket,0,0);
+
+        end = offset + headerLength + len;
+        offset = (end + TAP_WIN_READ_FRAME_ALIGN - 1) & ~(TAP_WIN_READ_FRAME_ALIGN - 1);
+
+        ++frames;
+        bytes += len;
     }
 
-    if (len < 0 || (int) Irp->IoStatus.Information < len)
+    if(tooLarge)
     {
+        // The oldest frame can never fit this buffer; drop it, as a
+        // single-frame read would.
+        tapPacket = tapPacketRemoveHeadLocked(&Queue->SendPacketQueue);
+
+        NdisFreeMemory(tapPacket,0,0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_READ_TOO_SMALL);
+
         Irp->IoStatus.Information = 0;
-        Irp->IoStatus.Status = status = STATUS_BUFFER_OVERFLOW;
+        Irp->IoStatus.Status = STATUS_BUFFER_OVERFLOW;
         NOTE_ERROR ();
     }
     else
     {
-        Irp->IoStatus.Information = len;
-        Irp->IoStatus.Status = status = STATUS_SUCCESS;
+        // A policy of at least two frames always takes one that fits.
+        ASSERT(frames > 0);
+
+        Irp->IoStatus.Information = end;
+        Irp->IoStatus.Status = STATUS_SUCCESS;
+    }
+
+    // Complete the IRP
+    IoCompleteRequest (Irp, IO_NETWORK_INCREMENT);
+}
+
+// Restart the coalescing delay with the next frame seen, and stop the
+// timer waiting on the current one.
+//
+// Call with the send packet queue lock held.
+static VOID
+tapReadCoalesceRestart(
+    __in PTAP_QUEUE             Queue
+    )
+{
+    Queue->CoalesceDeadline = 0;
+
+    if(Queue->CoalesceTimerArmed)
+    {
+        KeCancelTimer(&Queue->CoalesceTimer);
+        Queue->CoalesceTimerArmed = FALSE;
+    }
+}
+
+static BOOLEAN
+tapReadCoalesceDue(
+    __in const TAP_READ_COALESCE_POLICY     *Policy,
+    __in PTAP_QUEUE                         Queue,
+    __in ULONGLONG                          Now
+    )
+/*++
+
+Routine Description:
+
+    Decides whether a read should be completed now from the frames
+    queued, or wait for more. The delay is counted from the first
+    frame seen since the last read completed or the queue was last
+    empty, so each batch waits out its own delay and none waits
+    longer than the policy allows once a read is pending.
+
+    Call with the send packet queue lock held and frames queued.
+
+Arguments:
+
+    Now                         Current interrupt time, 100ns units
+
+--*/
+{
+    if(Queue->CoalesceDeadline == 0)
+    {
+        Queue->CoalesceDeadline = Now + (ULONGLONG )Policy->Microseconds * 10;
+    }
+
+    return Queue->SendPacketQueue.Count >= Policy->MaxFrames
+        || (Policy->MaxBytes != 0
+            && Queue->SendPacketQueue.TotalBytes >= Policy->MaxBytes)
+        || Now >= Queue->CoalesceDeadline;
+}
+
+VOID
+tapProcessSendPacketQueue(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
+    )
+{
+    KIRQL                       irql;
+    TAP_READ_COALESCE_POLICY    policy;
+    BOOLEAN                     coalesce;
+    ULONGLONG                   now = 0;
+    ULONG64                     readTime = 0;
+
+    // SET_READ_COALESCING may change the policy meanwhile; this pass
+    // keeps to the one it started with.
+    policy = *(volatile TAP_READ_COALESCE_POLICY *)&Adapter->ReadCoalesce;
+    coalesce = (policy.MaxFrames > 1);
+
+    // Process the send packet queue
+    tapPacketQueueAcquireLock(&Queue->SendPacketQueue,&irql);
+
+    if(coalesce)
+    {
+        now = KeQueryInterruptTime();
+    }
+
+    if(Queue->SendPacketQueue.Count > 0)
+    {
+        // Frames taken by reads below have waited until now.
+        readTime = KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+
+    while(Queue->SendPacketQueue.Count > 0 )
+    {
+        PIRP            irp;
+        PTAP_PACKET     tapPacket;
+        TAP_STAGE_TIMER timer;
+
+        if(coalesce && !tapReadCoalesceDue(&policy,Queue,now))
+        {
+            // Come back when the oldest frame has waited long enough.
+            if(!Queue->CoalesceTimerArmed)
+            {
+                LARGE_INTEGER   dueTime;
+
+                dueTime.QuadPart = -(LONGLONG )(Queue->CoalesceDeadline - now);
+
+                KeSetTimer(&Queue->CoalesceTimer,dueTime,&Queue->CoalesceDpc);
+
+                Queue->CoalesceTimerArmed = TRUE;
+            }
+            break;
+        }
+
+        // Fetch a read IRP
+        irp = IoCsqRemoveNextIrp(
+                &Queue->PendingReadIrpQueue.CsqQueue,
+                NULL
+                );
+
+        if( irp == NULL )
+        {
+            // No IRP to satisfy
+            break;
+        }
+
+        if(coalesce)
+        {
+            // Complete the read IRP with as many frames as it takes.
+            tapStageTimerStart(&Adapter->StageStats,&timer);
+            tapCompletePendingReadIrpCoalesced(Adapter,irp,Queue,&policy,readTime);
+            tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_COMPLETE);
+
+            // Frames left over start the next batch.
+            tapReadCoalesceRestart(Queue);
+            continue;
+        }
+
+        // Fetch a queued TAP send packet
+        tapPacket = tapPacketRemoveHeadLocked(
+                        &Queue->SendPacketQueue
+                        );
+
+        ASSERT(tapPacket);
+
+        tapLatencyRecord(&Adapter->Latency,TAP_LATENCY_QUEUE_DELAY,readTime - tapPacket->m_EnqueueTime);
+
+        // BUGBUG!!! Investigate whether release/reacquire can cause
+        // out-of-order IRP completion. Also, whether user-mode can
+        // tolerate out-of-order packets.
+
+        // Release packet queue lock while completing the IRP
+        //tapPacketQueueReleaseLock(&Queue->SendPacketQueue,irql);
+
+        // Complete the read IRP from queued TAP send packet.
+        tapStageTimerStart(&Adapter->StageStats,&timer);
+        tapCompletePendingReadIrp(Adapter,irp,tapPacket,readTime);
+        tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_COMPLETE);
+
+        // Reqcquire packet queue lock after completing the IRP
+        //tapPacketQueueAcquireLock(&Queue->SendPacketQueue,&irql);
+    }
+
+    if(Queue->SendPacketQueue.Count == 0)
+    {
+        tapReadCoalesceRestart(Queue);
+    }
+
+    tapPacketQueueReleaseLock(&Queue->SendPacketQueue,irql);
+
+    tapCheckFlowControl(Adapter,Queue);
+}
+
+static VOID
+tapReadCoalesceDpc(
+    __in PKDPC  Dpc,
+    __in PVOID  DeferredContext,
+    __in PVOID  SystemArgument1,
+    __in PVOID  SystemArgument2
+    )
+/*++
+
+Routine Description:
+
+    Fires when the oldest frame on a queue has waited out the coalescing
+    delay, and completes a pending read with whatever is queued.
+
+    Runs at IRQL = DISPATCH_LEVEL.
+
+--*/
+{
+    PTAP_ADAPTER_CONTEXT    adapter = (PTAP_ADAPTER_CONTEXT )DeferredContext;
+    PTAP_QUEUE              queue = CONTAINING_RECORD(Dpc, TAP_QUEUE, CoalesceDpc);
+    KIRQL                   irql;
+
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    tapPacketQueueAcquireLock(&queue->SendPacketQueue,&irql);
+    queue->CoalesceTimerArmed = FALSE;
+    tapPacketQueueReleaseLock(&queue->SendPacketQueue,irql);
+
+    tapProcessSendPacketQueue(adapter,queue);
+}
+
+VOID
+tapReadCoalesceInitialize(
+    __in PTAP_ADAPTER_CONTEXT   Adapter
+    )
+{
+    ULONG   i;
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        PTAP_QUEUE  queue = &Adapter->Queues[i];
+
+        queue->CoalesceDeadline = 0;
+        queue->CoalesceTimerArmed = FALSE;
+        KeInitializeTimer(&queue->CoalesceTimer);
+        KeInitializeDpc(&queue->CoalesceDpc, tapReadCoalesceDpc, Adapter);
+    }
+}
+
+NTSTATUS
+tapReadCoalesceConfigure(
+    __in PTAP_ADAPTER_CONTEXT           Adapter,
+    __in const TAP_WIN_READ_COALESCING  *Config
+    )
+/*++
+
+Routine Description:
+
+    Sets the adapter read coalescing policy, then completes any reads the
+    new policy makes due.
+
+--*/
+{
+    ULONG   i;
+
+    if(Config->MaxFrames > TAP_WIN_READ_COALESCING_MAX_FRAMES
+        || Config->MaxMicroseconds > TAP_WIN_READ_COALESCING_MAX_DELAY)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Adapter->ReadCoalesce.MaxBytes = Config->MaxBytes;
+    Adapter->ReadCoalesce.Microseconds = Config->MaxMicroseconds;
+    Adapter->ReadCoalesce.MaxFrames = Config->MaxFrames;
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        tapProcessSendPacketQueue(Adapter,&Adapter->Queues[i]);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Flush the pending send TAP packet queue and close it to new packets.
+VOID
+tapFlushSendPacketQueue(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
+    )
+{
+    KIRQL  irql;
+
+    // Process the send packet queue
+    tapPacketQueueAcquireLock(&Queue->SendPacketQueue,&irql);
+
+    TAP_TRACE_INFO (TAP_WIN_TRACE_TX_FLUSH, Queue->SendPacketQueue.Count, 0);
+
+    Queue->SendPacketQueue.Closed = TRUE;
+
+    // Nothing left to coalesce.
+    KeCancelTimer(&Queue->CoalesceTimer);
+    Queue->CoalesceTimerArmed = FALSE;
+    Queue->CoalesceDeadline = 0;
+
+    if(Queue->SendPacketQueue.Count > 0)
+    {
+        tapDropCount(
+            &Adapter->DropStats,
+            TAP_WIN_DROP_TX_FLUSHED,
+            Queue->SendPacketQueue.Count
+            );
+    }
+
+    while(Queue->SendPacketQueue.Count > 0 )
+    {
+        PTAP_PACKET     tapPacket;
+
+        // Fetch a queued TAP send packet
+        tapPacket = tapPacketRemoveHeadLocked(
+                        &Queue->SendPacketQueue
+                        );
+
+        ASSERT(tapPacket);
+
+        // Free the TAP packet
+        NdisFreeMemory(tapPacket,0,0);
+    }
+
+    tapPacketQueueReleaseLock(&Queue->SendPacketQueue,irql);
+
+    tapCompleteFlowControlPackets(Adapter,Queue);
+}
+
+// Fold Length bytes into a hash. XOR is order independent, so
+// source and destination may be folded in either order.
+static __inline ULONG
+tapFlowHashBytes(
+    __in ULONG      Hash,
+    __in PUCHAR     Data,
+    __in ULONG      Length
+    )
+{
+    ULONG   i;
+
+    for(i = 0; i < Length; ++i)
+    {
+        Hash ^= (ULONG )Data[i] << ((i & 3) * 8);
+    }
+
+    return Hash;
+}
+
+static ULONG
+tapFlowHash(
+    __in PTAP_PACKET    TapPacket
+    )
+/*++
+
+Routine Description:
+
+    Hash the IP addresses, protocol and, for unfragmented TCP and UDP,
+    ports of a TAP packet. Swapping source and destination does not
+    change the hash, so both directions of a flow land on one queue.
+    Frames that are not IP hash to 0.
+
+--*/
+{
+    PUCHAR      data = TapPacket->m_Data;
+    ULONG       length = TapPacket->m_SizeFlags & TP_SIZE_MASK;
+    UCHAR       version;
+    UCHAR       protocol;
+    ULONG       headerLength;
+    ULONG       hash;
+
+    if(!(TapPacket->m_SizeFlags & TP_TUN))
+    {
+        USHORT  etherType;
+
+        // TAP mode packets keep the Ethernet header, and perhaps a tag.
+        if(length < ETHERNET_HEADER_SIZE)
+        {
+            return 0;
+        }
+
+        etherType = ((ETH_HEADER *) data)->proto;
+        data += ETHERNET_HEADER_SIZE;
+        length -= ETHERNET_HEADER_SIZE;
+
+        if(etherType == htons(0x8100) && length >= VLAN_TAG_SIZE)
+        {
+            etherType = ((ETH_8021Q_HEADER *) data)->EtherType;
+            data += VLAN_TAG_SIZE;
+            length -= VLAN_TAG_SIZE;
+        }
+
+        if(etherType != htons(NDIS_ETH_TYPE_IPV4)
+            && etherType != htons(NDIS_ETH_TYPE_IPV6))
+        {
+            return 0;
+        }
+    }
+
+    if(length < IP_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    version = IPH_GET_VER(data[0]);
+
+    if(version == 4)
+    {
+        const IPHDR *ip = (IPHDR *) data;
+
+        headerLength = IPH_GET_LEN(ip->version_len);
+        protocol = ip->protocol;
+
+        hash = tapFlowHashBytes(0, (PUCHAR) &ip->saddr, 2 * sizeof (ULONG));
+
+        // Fragments carry no ports, and all of them must stay together.
+        if(ip->frag_off & htons(IP_OFFMASK | 0x2000))
+        {
+            protocol = 0;
+        }
+    }
+    else if(version == 6 && length >= IPV6_HEADER_SIZE)
+    {
+        const IPV6HDR *ipv6 = (IPV6HDR *) data;
+
+        headerLength = IPV6_HEADER_SIZE;
+        protocol = ipv6->nexthdr;
+
+        hash = tapFlowHashBytes(0, (PUCHAR) &ipv6->saddr, 2 * sizeof (IPV6ADDR));
+    }
+    else
+    {
+        return 0;
+    }
+
+    if((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP)
+        && length >= headerLength + 2 * sizeof (USHORT))
+    {
+        const UDPHDR *udp = (UDPHDR *) (data + headerLength);
+
+        hash ^= (ULONG )(udp->source ^ udp->dest) << 8;
+    }
+
+    hash ^= protocol;
+
+    // Spread the bits before the caller reduces the hash.
+    hash *= 0x9E3779B1;
+
+    return hash ^ (hash >> 16);
+}
+
+// Select the queue a TAP packet is read from.
+static PTAP_QUEUE
+tapAdapterSelectQueue(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_PACKET            TapPacket
+    )
+{
+    LONG    queueCount = Adapter->ActiveQueueCount;
+    ULONG   index = 0;
+
+    if(queueCount <= 0)
+    {
+        return NULL;
+    }
+
+    if(queueCount > 1)
+    {
+        index = tapFlowHash(TapPacket) % (ULONG )queueCount;
+    }
+
+    return &Adapter->Queues[Adapter->ActiveQueues[index]];
+}
+
+// Queue a TAP packet for a read from userspace, or drop it if
+// there is no one to read it. Returns the queue used, or NULL.
+static PTAP_QUEUE
+tapAdapterQueueTapPacket(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_PACKET            TapPacket
+    )
+{
+    PTAP_QUEUE  queue = NULL;
+
+    if(tapAdapterReadAndWriteReady(Adapter))
+    {
+        queue = tapAdapterSelectQueue(Adapter,TapPacket);
+    }
+
+    TapPacket->m_EnqueueTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    if(queue != NULL
+        && tapPacketQueueInsertTail(&queue->SendPacketQueue,TapPacket))
+    {
+        return queue;
+    }
+
+    //
+    // Tragedy. All this work and the packet is of no use... 
+    //
+    NdisFreeMemory(TapPacket,0,0);
+    TAP_DROP(Adapter,TAP_WIN_DROP_TX_NO_QUEUE);
+
+    return NULL;
+}
+
+// Copy Length bytes starting Offset bytes into the NB data to Dest.
+static BOOLEAN
+tapCopyNetBufferData(
+    __in PNET_BUFFER    NetBuffer,
+    __in ULONG          Offset,
+    __in ULONG          Length,
+    __out_bcount(Length) PUCHAR Dest
+    )
+{
+    PMDL    mdl = NET_BUFFER_CURRENT_MDL(NetBuffer);
+    ULONG   mdlOffset = NET_BUFFER_CURRENT_MDL_OFFSET(NetBuffer) + Offset;
+    ULONG   pagePriority = NormalPagePriority;
+
+    if (GlobalData.RunningWindows8OrGreater != FALSE) {
+        pagePriority |= MdlMappingNoExecute;
+    }
+
+    while(Length > 0)
+    {
+        ULONG   mdlLength;
+        ULONG   copyLength;
+        PUCHAR  mdlData;
+
+        if(mdl == NULL)
+        {
+            return FALSE;
+        }
+
+        mdlLength = MmGetMdlByteCount(mdl);
+
+        if(mdlOffset >= mdlLength)
+        {
+            mdlOffset -= mdlLength;
+            mdl = mdl->Next;
+            continue;
+        }
+
+        mdlData = (PUCHAR )MmGetSystemAddressForMdlSafe(mdl,pagePriority);
+
+        if(mdlData == NULL)
+        {
+            return FALSE;
+        }
+
+        copyLength = min(mdlLength - mdlOffset, Length);
+
+        NdisMoveMemory(Dest, mdlData + mdlOffset, copyLength);
+
+        Dest += copyLength;
+        Length -= copyLength;
+        mdlOffset = 0;
+        mdl = mdl->Next;
+    }
+
+    return TRUE;
+}
+
+static PTAP_QUEUE
+tapAdapterTransmitTun(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PNET_BUFFER            NetBuffer,
+    __in ULONG                  packetLength
+    )
+/*++
+
+Routine Description:
+
+    Point-to-point mode counterpart of tapAdapterTransmit. ARP is
+    answered locally, IPv4 and IPv6 are queued for userspace, and all
+    other protocols are dropped.
+
+    The Ethernet header and the few headers the decision needs are
+    examined in place through NdisGetDataBuffer. Only the L3 payload is
+    copied into the TAP packet, so it can be handed to the reader as is.
+
+    Runs at IRQL <= DISPATCH_LEVEL
+
+--*/
+{
+    // Large enough for ARP, and for IPv6 neighbor solicitations.
+    UCHAR           headerStorage[ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE + sizeof (ICMPV6_NS)];
+    ULONG           headerLength;
+    PUCHAR          header;
+    ETH_HEADER      *e;
+    PTAP_PACKET     tapPacket;
+    ULONG           payloadLength;
+    BOOLEAN         directed = TRUE;
+    ULONG           dropReason = TAP_WIN_DROP_TX_TUN_NOT_DIRECTED;
+    TAP_STAGE_TIMER timer;
+    PTAP_QUEUE      queue;
+
+    headerLength = min(packetLength, sizeof (headerStorage));
+
+    header = (PUCHAR )NdisGetDataBuffer(NetBuffer,headerLength,headerStorage,1,0);
+
+    if(header == NULL)
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_TX_GET_DATA_FAILED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_GET_DATA_FAILED);
+        return NULL;
+    }
+
+    e = (ETH_HEADER *) header;
+
+    switch (ntohs (e->proto))
+    {
+    case NDIS_ETH_TYPE_ARP:
+
+        // Make sure that packet is the right size for ARP.
+        if (packetLength != sizeof (ARP_PACKET))
+        {
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_BAD_SIZE);
+            return NULL;
+        }
+
+        DUMP_PACKET ("AdapterTransmit", header, packetLength);
+
+        TAP_CAPTURE_FRAME (&Adapter->Capture, TAP_WIN_CAPTURE_TX,
+            NULL, 0, header, packetLength);
+
+        // Resolve the address of our virtual DHCP server?
+        if (Adapter->m_dhcp_enabled
+            && Adapter->m_dhcp_server_arp
+            && ProcessARP(
+                    Adapter,
+                    (PARP_PACKET) header,
+                    Adapter->m_dhcp_addr,
+                    Adapter->m_dhcp_server_ip,
+                    ~0,
+                    Adapter->m_dhcp_server_mac)
+            )
+        {
+            TAP_HANDLED(Adapter);
+            return NULL;
+        }
+
+        // Answered for the peer, or not something the peer can answer.
+        if (ProcessARP (
+                Adapter,
+                (PARP_PACKET) header,
+                Adapter->m_localIP,
+                Adapter->m_remoteNetwork,
+                Adapter->m_remoteNetmask,
+                Adapter->m_TapToUser.dest)
+            )
+        {
+            TAP_HANDLED(Adapter);
+        }
+        else
+        {
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_NOT_DIRECTED);
+        }
+        return NULL;
+
+    default:
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_PROTOCOL);
+        return NULL;
 
-        // Copy packet data
-        NdisMoveMemory(
-            Irp->AssociatedIrp.SystemBuffer,
-            TapPacket->m_Data + offset,
-            len
-            );
-    }
+    case NDIS_ETH_TYPE_IPV4:
 
-    // Free the TAP packet
-    NdisFreeMemory(TapPacket,0,0);
+        // Make sure that packet is large enough to be IPv4.
+        if (packetLength < (ETHERNET_HEADER_SIZE + IP_HEADER_SIZE))
+        {
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_BAD_SIZE);
+            return NULL;
+        }
 
-    // Complete the IRP
-    IoCompleteRequest (Irp, IO_NETWORK_INCREMENT);
-}
+        // Only accept directed packets, not broadcasts - except
+        // DHCP requests to the masquerading DHCP server, below.
+        directed = (memcmp (e, &Adapter->m_TapToUser, ETHERNET_HEADER_SIZE) == 0);
 
-VOID
-tapProcessSendPacketQueue(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
-    )
-{
-    KIRQL  irql;
+        if (!directed && !Adapter->m_dhcp_enabled)
+        {
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_NOT_DIRECTED);
+            return NULL;
+        }
+        break;
 
-    // Process the send packet queue
-    KeAcquireSpinLock(&Adapter->SendPacketQueue.QueueLock,&irql);
+    case NDIS_ETH_TYPE_IPV6:
 
-    while(Adapter->SendPacketQueue.Count > 0 )
-    {
-        PIRP            irp;
-        PTAP_PACKET     tapPacket;
+        // Make sure that packet is large enough to be IPv6.
+        if (packetLength < (ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE))
+        {
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_TUN_BAD_SIZE);
+            return NULL;
+        }
 
-        // Fetch a read IRP
-        irp = IoCsqRemoveNextIrp(
-                &Adapter->PendingReadIrpQueue.CsqQueue,
-                NULL
-                );
+        // Neighbor solicitations for proxied targets, sent to the
+        // solicited-node multicast address or unicast, are answered
+        // here; other multicasts are passed on.
 
-        if( irp == NULL )
+        // Neighbor discovery packets to fe80::8 are special
+        // OpenVPN sets this next-hop to signal "handled by tapdrv"
+        if ( ((IPV6HDR *) (header + ETHERNET_HEADER_SIZE))->nexthdr == IPPROTO_ICMPV6
+            && HandleIPv6NeighborDiscovery(Adapter,header,packetLength) )
         {
-            // No IRP to satisfy
-            break;
+            TAP_HANDLED(Adapter);
+            return NULL;
         }
+        break;
+    }
 
-        // Fetch a queued TAP send packet
-        tapPacket = tapPacketRemoveHeadLocked(
-                        &Adapter->SendPacketQueue
-                        );
+    //
+    // Copy the L3 payload
+    // -------------------
+    // The TAP packet holds only what the reader gets: the frame less
+    // its Ethernet header.
+    //
+    payloadLength = packetLength - ETHERNET_HEADER_SIZE;
 
-        ASSERT(tapPacket);
+    tapStageTimerStart(&Adapter->StageStats,&timer);
 
-        // BUGBUG!!! Investigate whether release/reacquire can cause
-        // out-of-order IRP completion. Also, whether user-mode can
-        // tolerate out-of-order packets.
+    tapPacket = (PTAP_PACKET )NdisAllocateMemoryWithTagPriority(
+                    Adapter->MiniportAdapterHandle,
+                    TAP_PACKET_SIZE (payloadLength),
+                    TAP_PACKET_TAG,
+                    NormalPoolPriority
+                    );
 
-        // Release packet queue lock while completing the IRP
-        //KeReleaseSpinLock(&Adapter->SendPacketQueue.QueueLock,irql);
+    if(tapPacket == NULL)
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_TX_ALLOC_FAILED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_ALLOC_FAILED);
+        return NULL;
+    }
 
-        // Complete the read IRP from queued TAP send packet.
-        tapCompletePendingReadIrp(irp,tapPacket);
+    tapPacket->m_SizeFlags = (payloadLength & TP_SIZE_MASK) | TP_TUN;
 
-        // Reqcquire packet queue lock after completing the IRP
-        //KeAcquireSpinLock(&Adapter->SendPacketQueue.QueueLock,&irql);
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_ALLOCATE);
+
+    if(!tapCopyNetBufferData(NetBuffer,ETHERNET_HEADER_SIZE,payloadLength,tapPacket->m_Data))
+    {
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_TX_GET_DATA_FAILED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_GET_DATA_FAILED);
+
+        NdisFreeMemory(tapPacket,0,0);
+
+        return NULL;
     }
 
-    KeReleaseSpinLock(&Adapter->SendPacketQueue.QueueLock,irql);
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_COPY);
 
-    tapCheckFlowControl(Adapter);
-}
+    DUMP_PACKET2 ("AdapterTransmit", e, tapPacket->m_Data, payloadLength);
 
-// Flush the pending send TAP packet queue.
-VOID
-tapFlushSendPacketQueue(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
-    )
-{
-    KIRQL  irql;
+    TAP_CAPTURE_FRAME (&Adapter->Capture, TAP_WIN_CAPTURE_TX,
+        (PUCHAR) e, ETHERNET_HEADER_SIZE, tapPacket->m_Data, payloadLength);
 
-    // Process the send packet queue
-    KeAcquireSpinLock(&Adapter->SendPacketQueue.QueueLock,&irql);
+#if PACKET_TRUNCATION_CHECK
+    IPv4PacketSizeVerify(
+        tapPacket->m_Data,
+        payloadLength,
+        TRUE,
+        "TX",
+        &Adapter->m_TxTrunc
+        );
+#endif
 
-    DEBUGP (("[TAP] tapFlushSendPacketQueue: Flushing %d TAP packets\n",
-        Adapter->SendPacketQueue.Count));
+    tapStageTimerSkip(&timer);
 
-    while(Adapter->SendPacketQueue.Count > 0 )
+    //=====================================================
+    // Are we running in DHCP server masquerade mode?
+    //
+    // If so, catch DHCP requests.
+    //=====================================================
+    if (Adapter->m_dhcp_enabled && e->proto == htons (NDIS_ETH_TYPE_IPV4))
     {
-        PTAP_PACKET     tapPacket;
+        const IPHDR *ip = (IPHDR *) tapPacket->m_Data;
+        const UDPHDR *udp = (UDPHDR *) (tapPacket->m_Data + sizeof (IPHDR));
 
-        // Fetch a queued TAP send packet
-        tapPacket = tapPacketRemoveHeadLocked(
-                        &Adapter->SendPacketQueue
-                        );
+        if (payloadLength >= sizeof (IPHDR) + sizeof (UDPHDR) + sizeof (DHCP)
+            && ip->version_len == 0x45 // IPv4, 20 byte header
+            && ip->protocol == IPPROTO_UDP
+            && udp->dest == htons (BOOTPS_PORT)
+            )
+        {
+            const DHCP *dhcp = (DHCP *) (tapPacket->m_Data
+                + sizeof (IPHDR)
+                + sizeof (UDPHDR));
 
-        ASSERT(tapPacket);
+            const int optlen = payloadLength
+                - sizeof (IPHDR)
+                - sizeof (UDPHDR)
+                - sizeof (DHCP);
 
-        // Free the TAP packet
+            // we must have at least one DHCP option
+            if (optlen <= 0)
+            {
+                directed = FALSE;
+                dropReason = TAP_WIN_DROP_TX_MALFORMED;
+            }
+            else if (ProcessDHCP (Adapter, e, ip, udp, dhcp, optlen))
+            {
+                directed = FALSE;
+                dropReason = TAP_DROP_HANDLED;
+            }
+        }
+    }
+
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_INSPECT);
+
+    if (!directed)
+    {
         NdisFreeMemory(tapPacket,0,0);
+        TAP_DROP(Adapter,dropReason);
+        return NULL;
     }
 
-    KeReleaseSpinLock(&Adapter->SendPacketQueue.QueueLock,irql);
+    // Packet looks like IPv4 or IPv6, queue it. :-)
+    queue = tapAdapterQueueTapPacket(Adapter,tapPacket);
+
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_QUEUE);
 
-    tapCompleteFlowControlPackets(Adapter);
+    return queue;
 }
 
-VOID
+PTAP_QUEUE
 tapAdapterTransmit(
     __in PTAP_ADAPTER_CONTEXT   Adapter,
     __in PNET_BUFFER            NetBuffer,
@@ -468,7 +1335,7 @@ Arguments:
 
 Return Value:
 
-    None.
+    The queue the packet was placed on, or NULL if it was not queued.
 
     In the Microsoft NDIS 6 architecture there is no per-packet status.
 
@@ -479,9 +1346,32 @@ Return Value:
     PTAP_PACKET     tapPacket;
     PVOID           packetData;
     ULONG           addHeaderSize;
+    TAP_STAGE_TIMER timer;
+    PTAP_QUEUE      queue;
+    ULONG           dropReason = TAP_DROP_HANDLED;
 
     packetLength = NET_BUFFER_DATA_LENGTH(NetBuffer);
 
+    // Run the transmit filter, if attached, before anything is allocated.
+    // It may drop the frame or truncate it.
+    if(Adapter->TxFilter != NULL)
+    {
+        packetLength = tapAdapterFilterTransmit(Adapter,NetBuffer,DispatchLevel);
+
+        if(packetLength == 0)
+        {
+            TAP_TRACE_VERBOSE (TAP_WIN_TRACE_TX_BPF_DROPPED, NET_BUFFER_DATA_LENGTH(NetBuffer), 0);
+            TAP_DROP(Adapter,TAP_WIN_DROP_TX_FILTERED);
+            return NULL;
+        }
+    }
+
+    // Point-to-point mode keeps only the L3 payload.
+    if (Adapter->m_tun)
+    {
+        return tapAdapterTransmitTun(Adapter,NetBuffer,packetLength);
+    }
+
     // Determine if we need to add an 802.1Q header
     NDIS_NET_BUFFER_LIST_8021Q_INFO packetPriority;
     packetPriority.Value = NET_BUFFER_LIST_INFO(NetBufferList, Ieee8021QNetBufferListInfo);
@@ -509,6 +1399,8 @@ Return Value:
         }
     }
 
+    tapStageTimerStart(&Adapter->StageStats,&timer);
+
     // Allocate TAP packet memory
     tapPacket = (PTAP_PACKET )NdisAllocateMemoryWithTagPriority(
                     Adapter->MiniportAdapterHandle,
@@ -519,12 +1411,15 @@ Return Value:
 
     if(tapPacket == NULL)
     {
-        DEBUGP (("[TAP] tapAdapterTransmit: TAP packet allocation failed\n"));
-        return;
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_TX_ALLOC_FAILED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_ALLOC_FAILED);
+        return NULL;
     }
 
     tapPacket->m_SizeFlags = ((packetLength+addHeaderSize) & TP_SIZE_MASK);
 
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_ALLOCATE);
+
     //
     // Reassemble packet contents
     // --------------------------
@@ -543,11 +1438,12 @@ Return Value:
 
     if(packetData == NULL)
     {
-        DEBUGP (("[TAP] tapAdapterTransmit: Could not get packet data\n"));
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_TX_GET_DATA_FAILED, packetLength, 0);
+        TAP_DROP(Adapter,TAP_WIN_DROP_TX_GET_DATA_FAILED);
 
         NdisFreeMemory(tapPacket,0,0);
 
-        return;
+        return NULL;
     }
 
     if(packetData != (tapPacket->m_Data+addHeaderSize))
@@ -555,7 +1451,9 @@ Return Value:
         // Packet data was contiguous and not yet copied to m_Data.
         NdisMoveMemory(tapPacket->m_Data+addHeaderSize,packetData,packetLength);
     }
-    
+
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_COPY);
+
     if(addHeaderSize > 0)
     {
         // Add an 802.1Q header between the ethernet header and the payload
@@ -569,11 +1467,16 @@ Return Value:
         tag->Tag = tagValue;
 
         packetLength += addHeaderSize;
+
+        tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_VLAN);
     }
 
 
     DUMP_PACKET ("AdapterTransmit", tapPacket->m_Data, packetLength);
 
+    TAP_CAPTURE_FRAME (&Adapter->Capture, TAP_WIN_CAPTURE_TX,
+        NULL, 0, tapPacket->m_Data, packetLength);
+
     //=====================================================
     // If IPv4 packet, check whether or not packet
     // was truncated.
@@ -588,6 +1491,8 @@ Return Value:
         );
 #endif
 
+    tapStageTimerSkip(&timer);
+
     //=====================================================
     // Are we running in DHCP server masquerade mode?
     //
@@ -647,84 +1552,37 @@ Return Value:
             }
             else
             {
+                dropReason = TAP_WIN_DROP_TX_MALFORMED;
                 goto no_queue;
             }
         }
     }
 
-    //===============================================
-    // In Point-To-Point mode, check to see whether
-    // packet is ARP (handled) or IPv4 (sent to app).
-    // IPv6 packets are inspected for neighbour discovery
-    // (to be handled locally), and the rest is forwarded
-    // all other protocols are dropped
-    //===============================================
-    if (Adapter->m_tun)
+    //=====================================================
+    // In TAP mode, answer ARP queries for remote hosts
+    // covered by the proxy ARP table.
+    //=====================================================
+    if (Adapter->ProxyArp != NULL
+        && packetLength >= sizeof (ARP_PACKET)
+        && ((ETH_HEADER *) tapPacket->m_Data)->proto == htons (NDIS_ETH_TYPE_ARP))
     {
-        ETH_HEADER *e;
-
-        e = (ETH_HEADER *) tapPacket->m_Data;
-
-        switch (ntohs (e->proto))
+        if (tapProxyArpProcess (Adapter, (PARP_PACKET) tapPacket->m_Data))
         {
-        case NDIS_ETH_TYPE_ARP:
-
-            // Make sure that packet is the right size for ARP.
-            if (packetLength != sizeof (ARP_PACKET))
-            {
-                goto no_queue;
-            }
-
-            ProcessARP (
-                Adapter,
-                (PARP_PACKET) tapPacket->m_Data,
-                Adapter->m_localIP,
-                Adapter->m_remoteNetwork,
-                Adapter->m_remoteNetmask,
-                Adapter->m_TapToUser.dest
-                );
-
-        default:
             goto no_queue;
+        }
+    }
 
-        case NDIS_ETH_TYPE_IPV4:
-
-            // Make sure that packet is large enough to be IPv4.
-            if (packetLength < (ETHERNET_HEADER_SIZE + IP_HEADER_SIZE))
-            {
-                goto no_queue;
-            }
-
-            // Only accept directed packets, not broadcasts.
-            if (memcmp (e, &Adapter->m_TapToUser, ETHERNET_HEADER_SIZE))
-            {
-                goto no_queue;
-            }
-
-            // Packet looks like IPv4, queue it. :-)
-            tapPacket->m_SizeFlags |= TP_TUN;
-            break;
-
-        case NDIS_ETH_TYPE_IPV6:
-            // Make sure that packet is large enough to be IPv6.
-            if (packetLength < (ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE))
-            {
-                goto no_queue;
-            }
-
-            // Broadcasts and multicasts are handled specially
-            // (to be implemented)
-
-            // Neighbor discovery packets to fe80::8 are special
-            // OpenVPN sets this next-hop to signal "handled by tapdrv"
-            if ( HandleIPv6NeighborDiscovery(Adapter,tapPacket->m_Data,
-                                             packetLength) )
-            {
-                goto no_queue;
-            }
-
-            // Packet looks like IPv6, queue it. :-)
-            tapPacket->m_SizeFlags |= TP_TUN;
+    //=====================================================
+    // In TAP mode, answer neighbor solicitations for
+    // remote hosts covered by the ND proxy table.
+    //=====================================================
+    if (Adapter->NdProxy != NULL
+        && packetLength >= ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE
+        && ((ETH_HEADER *) tapPacket->m_Data)->proto == htons (NDIS_ETH_TYPE_IPV6))
+    {
+        if (tapNdProxyProcess (Adapter, tapPacket->m_Data, packetLength))
+        {
+            goto no_queue;
         }
     }
 
@@ -732,29 +1590,28 @@ Return Value:
     // Push packet onto queue to wait for read from
     // userspace.
     //===============================================
-    if(tapAdapterReadAndWriteReady(Adapter))
-    {
-        tapPacketQueueInsertTail(&Adapter->SendPacketQueue,tapPacket);
-    }
-    else
-    {
-        //
-        // Tragedy. All this work and the packet is of no use... 
-        //
-        NdisFreeMemory(tapPacket,0,0);
-    }
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_INSPECT);
 
     // Return after queuing or freeing TAP packet.
-    return;
+    queue = tapAdapterQueueTapPacket(Adapter,tapPacket);
+
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_QUEUE);
+
+    return queue;
 
     // Free TAP packet without queuing.
 no_queue:
+    tapStageTimerMark(&timer,TAP_WIN_STAGE_TX_INSPECT);
+
     if(tapPacket != NULL )
     {
         NdisFreeMemory(tapPacket,0,0);
     }
+
+    // Answered in the driver, or thrown away as malformed.
+    TAP_DROP(Adapter,dropReason);
   
-    return;
+    return NULL;
 }
 
 VOID
@@ -932,20 +1789,22 @@ Return Value:
 
 VOID
 tapCompleteFlowControlPackets(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
     )
 {
     KIRQL  irql;
     PNET_BUFFER_LIST completeList = NULL;
 
-    KeAcquireSpinLock(&Adapter->FlowControlLock,&irql);
+    tapQueueAcquireFlowControlLock(Queue,&irql);
 
 
-    completeList = Adapter->FlowControlList;
-    Adapter->FlowControlList = NULL;
-    Adapter->FlowControlHasPackets = FALSE;
+    completeList = Queue->FlowControlList;
+    Queue->FlowControlList = NULL;
+    Queue->FlowControlTail = NULL;
+    Queue->FlowControlHasPackets = FALSE;
 
-    KeReleaseSpinLock(&Adapter->FlowControlLock,irql);
+    tapQueueReleaseFlowControlLock(Queue,irql);
 
     if(completeList != NULL)
     {
@@ -960,14 +1819,77 @@ tapCompleteFlowControlPackets(
 
 VOID
 tapCheckFlowControl(
-    __in PTAP_ADAPTER_CONTEXT   Adapter
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PTAP_QUEUE             Queue
+    )
+{
+    if(Queue->FlowControlHasPackets &&
+        Queue->SendPacketQueue.TotalBytes < TAP_BUFFER_SIZE)
+    {
+        tapCompleteFlowControlPackets(Adapter,Queue);
+    }
+}
+
+// Hold an NBL until the queue drains below buffer size. Returns FALSE,
+// without holding it, if the queue has been flushed.
+static BOOLEAN
+tapHoldFlowControlPacket(
+    __in PTAP_QUEUE             Queue,
+    __in PNET_BUFFER_LIST       NetBufferList
+    )
+{
+    KIRQL   irql;
+    BOOLEAN held = FALSE;
+
+    tapQueueAcquireFlowControlLock(Queue,&irql);
+
+    if(!Queue->SendPacketQueue.Closed)
+    {
+        // Append the NBL at the end of the existing list of NBLs
+        if(Queue->FlowControlList == NULL)
+        {
+            Queue->FlowControlList = NetBufferList;
+        }
+        else
+        {
+            NET_BUFFER_LIST_NEXT_NBL(Queue->FlowControlTail) = NetBufferList;
+        }
+
+        Queue->FlowControlTail = NetBufferList;
+        Queue->FlowControlHasPackets = TRUE;
+
+        held = TRUE;
+    }
+
+    tapQueueReleaseFlowControlLock(Queue,irql);
+
+    return held;
+}
+
+// Count every NB in a chain of NBLs as dropped for Reason.
+static VOID
+tapDropNetBufferLists(
+    __in PTAP_ADAPTER_CONTEXT   Adapter,
+    __in PNET_BUFFER_LIST       NetBufferLists,
+    __in ULONG                  Reason
     )
 {
-    if(Adapter->FlowControlHasPackets &&
-        Adapter->SendPacketQueue.TotalBytes < TAP_BUFFER_SIZE)
+    PNET_BUFFER_LIST    currentNbl;
+    ULONG               netBufferCount = 0;
+
+    for(currentNbl = NetBufferLists;
+        currentNbl != NULL;
+        currentNbl = NET_BUFFER_LIST_NEXT_NBL(currentNbl))
     {
-        tapCompleteFlowControlPackets(Adapter);
+        ULONG   byteCount;
+
+        netBufferCount += tapGetNetBufferCountsFromNetBufferList(
+                            currentNbl,
+                            &byteCount
+                            );
     }
+
+    tapDropCount(&Adapter->DropStats,Reason,netBufferCount);
 }
 
 VOID
@@ -1017,6 +1939,10 @@ Return Value:
     PTAP_ADAPTER_CONTEXT    adapter = (PTAP_ADAPTER_CONTEXT )MiniportAdapterContext;
     BOOLEAN                 DispatchLevel = (SendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL);
     PNET_BUFFER_LIST        currentNbl;
+    PNET_BUFFER_LIST        completeList = NULL;
+    PNET_BUFFER_LIST        *completeTail = &completeList;
+    ULONG                   queuesUsed = 0;
+    ULONG                   i;
     BOOLEAN                 validNbLengths;
 
     UNREFERENCED_PARAMETER(NetBufferLists);
@@ -1031,8 +1957,10 @@ Return Value:
     // Just perform a "lying send" and return packets as if they
     // were successfully sent.
     //
-    if(adapter->TapFileObject == NULL)
+    if(adapter->ActiveQueueCount == 0)
     {
+        tapDropNetBufferLists(adapter,NetBufferLists,TAP_WIN_DROP_TX_NO_READER);
+
         //
         // Complete all NBLs and return if adapter not ready.
         //
@@ -1053,6 +1981,8 @@ Return Value:
 
     if(status != NDIS_STATUS_SUCCESS)
     {
+        tapDropNetBufferLists(adapter,NetBufferLists,TAP_WIN_DROP_TX_NOT_READY);
+
         //
         // Complete all NBLs and return if adapter not ready.
         //
@@ -1084,6 +2014,8 @@ Return Value:
 
     if(!validNbLengths)
     {
+        tapDropNetBufferLists(adapter,NetBufferLists,TAP_WIN_DROP_TX_BAD_LENGTH);
+
         //
         // Complete all NBLs and return if and NB length is invalid.
         //
@@ -1106,9 +2038,12 @@ Return Value:
     {
         PNET_BUFFER_LIST    nextNbl;
         PNET_BUFFER         currentNb;
+        PTAP_QUEUE          nblQueue = NULL;
 
-        // Locate next NBL
+        // Locate next NBL, and unlink this one so that it can be
+        // completed or held on its own.
         nextNbl = NET_BUFFER_LIST_NEXT_NBL(currentNbl);
+        NET_BUFFER_LIST_NEXT_NBL(currentNbl) = NULL;
 
         // Locate first NB (aka "packet")
         currentNb = NET_BUFFER_LIST_FIRST_NB(currentNbl);
@@ -1117,60 +2052,60 @@ Return Value:
         while(currentNb)
         {
             PNET_BUFFER nextNb;
+            PTAP_QUEUE  queue;
 
             // Locate next NB
             nextNb = NET_BUFFER_NEXT_NB(currentNb);
 
             // Transmit the NB
-            tapAdapterTransmit(adapter,currentNb,currentNbl,DispatchLevel);
+            queue = tapAdapterTransmit(adapter,currentNb,currentNbl,DispatchLevel);
+
+            if(queue != NULL)
+            {
+                nblQueue = queue;
+                queuesUsed |= (ULONG )1 << (ULONG )(queue - adapter->Queues);
+            }
 
             // Move to next NB
             currentNb = nextNb;
         }
 
-        // Move to next NBL
-        currentNbl = nextNbl;
-    }
-
-    if(adapter->SendPacketQueue.TotalBytes > TAP_BUFFER_SIZE)
-    {
-        // Flow control - Don't complete NBLs until transmit buffer drains below buffer size.
-        KIRQL  irql;
-
-        KeAcquireSpinLock(&adapter->FlowControlLock,&irql);
-
-        if(adapter->FlowControlList == NULL)
-        {
-            adapter->FlowControlList = NetBufferLists;
-        }
-        else
+        //
+        // Flow control - Don't complete the NBL until the queue its last
+        // packet went to drains below buffer size.
+        //
+        if(nblQueue == NULL
+            || nblQueue->SendPacketQueue.TotalBytes <= TAP_BUFFER_SIZE
+            || !tapHoldFlowControlPacket(nblQueue,currentNbl))
         {
-            PNET_BUFFER_LIST flowControlList = adapter->FlowControlList;
-            while(flowControlList->Next)
-            {
-                flowControlList = flowControlList->Next;
-            }
-            // Append new NBLs at the end of the existing list of NBLs
-            flowControlList->Next = NetBufferLists;
+            *completeTail = currentNbl;
+            completeTail = &NET_BUFFER_LIST_NEXT_NBL(currentNbl);
         }
-        adapter->FlowControlHasPackets = TRUE;
 
-        KeReleaseSpinLock(&adapter->FlowControlLock,irql);
+        // Move to next NBL
+        currentNbl = nextNbl;
     }
-    else
+
+    if(completeList != NULL)
     {
-        // Complete all NBLs
+        // Complete all NBLs not held for flow control
         tapSendNetBufferListsComplete(
             adapter,
-            NetBufferLists,
+            completeList,
             NDIS_STATUS_SUCCESS,
             DispatchLevel
             );
     }
 
     // Attempt to complete pending read IRPs from pending TAP 
-    // send packet queue.
-    tapProcessSendPacketQueue(adapter);
+    // send packet queues.
+    for(i = 0; queuesUsed != 0; ++i, queuesUsed >>= 1)
+    {
+        if(queuesUsed & 1)
+        {
+            tapProcessSendPacketQueue(adapter,&adapter->Queues[i]);
+        }
+    }
 }
 
 VOID
@@ -1203,6 +2138,7 @@ TapDeviceRead(
     NTSTATUS                ntStatus = STATUS_SUCCESS;// Assume success
     PIO_STACK_LOCATION      irpSp;// Pointer to current stack location
     PTAP_ADAPTER_CONTEXT    adapter = NULL;
+    PTAP_QUEUE              queue;
     ULONG                   pagePriority;
 
     PAGED_CODE();
@@ -1218,6 +2154,11 @@ TapDeviceRead(
 
     ASSERT(adapter);
 
+    // Each handle reads from its own queue.
+    queue = (PTAP_QUEUE )(irpSp->FileObject)->FsContext2;
+
+    ASSERT(queue);
+
     //
     // Sanity checks on state variables
     //
@@ -1239,8 +2180,7 @@ TapDeviceRead(
 
     if (Irp->MdlAddress == NULL)
     {
-        DEBUGP (("[%s] MdlAddress is NULL for IRP_MJ_READ\n",
-            MINIPORT_INSTANCE_ID (adapter)));
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_READ_NO_MDL, 0, 0);
 
         NOTE_ERROR();
         Irp->IoStatus.Status = ntStatus = STATUS_INVALID_PARAMETER;
@@ -1269,8 +2209,7 @@ TapDeviceRead(
                 ) ) == NULL
         )
     {
-        DEBUGP (("[%s] Could not map address in IRP_MJ_READ\n",
-            MINIPORT_INSTANCE_ID (adapter)));
+        TAP_TRACE_ERROR (TAP_WIN_TRACE_READ_MAP_FAILED, 0, 0);
 
         NOTE_ERROR();
         Irp->IoStatus.Status = ntStatus = STATUS_INSUFFICIENT_RESOURCES;
@@ -1293,11 +2232,11 @@ TapDeviceRead(
     //
     // Is this needed???
     //
-    IoCsqInsertIrp(&adapter->PendingReadIrpQueue.CsqQueue, Irp, NULL);
+    IoCsqInsertIrp(&queue->PendingReadIrpQueue.CsqQueue, Irp, NULL);
 
     // Attempt to complete pending read IRPs from pending TAP 
     // send packet queue.
-    tapProcessSendPacketQueue(adapter);
+    tapProcessSendPacketQueue(adapter,queue);
 
     ntStatus = STATUS_PENDING;
 
@@ -82,9 +82,25 @@ typedef struct _InjectPacket
    {
 #   define INJECT_PACKET_SIZE(data_size) (sizeof (InjectPacket) + (data_size))
 #   define INJECT_PACKET_FREE(ib)  NdisFreeMemory ((ib), INJECT_PACKET_SIZE ((ib)->m_Size), 0)
+    LIST_ENTRY QueueLink;
     ULONG m_Size;
     UCHAR m_Data []; // m_Data must be the last struct member
    }
 InjectPacket, *InjectPacketPointer;
 
+//======================================================================
+// Injection queue: frames generated by the driver itself (ARP, DHCP and
+// ND replies) wait here, at most INJECT_QUEUE_SIZE of them, to be
+// indicated to the host by the queue's DPC.
+//======================================================================
+
+typedef struct _TAP_INJECT_QUEUE
+{
+    KSPIN_LOCK      QueueLock;
+    LIST_ENTRY      Queue;
+    ULONG           Count;          // Count of currently queued items
+    ULONG           MaxCount;
+    KDPC            Dpc;
+} TAP_INJECT_QUEUE, *PTAP_INJECT_QUEUE;
+
 #endif
@@ -0,0 +1,217 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Opening handles with many adapters: tapAdapterContextFromDeviceObject
+// through GlobalData.AdapterHash against the walk of AdapterList it
+// replaced, at 10 to 1,000 adapters with a diag device each, then
+// TAP and diag handle open and close end to end at 1,000. Reports ns
+// per lookup or open, and the longest and mean hash bucket.
+//
+//  adapter_lookup [--quick]
+//
+// Lookups cycle over every device object, so a walk averages half the
+// list. The host's RW lock is uncontended here; under a reconnect storm
+// the walk also holds it that much longer.
+//======================================================================
+
+#include "taphost.h"
+
+#include <time.h>
+
+#define LOOKUP_MAX_ADAPTERS     1000
+
+static ULONG Lookups = 2000000;
+static ULONG Opens = 200000;
+
+static PTAP_ADAPTER_CONTEXT Adapters[LOOKUP_MAX_ADAPTERS];
+static PDEVICE_OBJECT DeviceObjects[2 * LOOKUP_MAX_ADAPTERS];
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+// The lookup before AdapterHash: every adapter, under the same lock.
+static PTAP_ADAPTER_CONTEXT
+LinearLookup(PDEVICE_OBJECT DeviceObject)
+{
+    LOCK_STATE_EX lockState;
+    PLIST_ENTRY entry;
+
+    NdisAcquireRWLockRead(GlobalData.Lock, &lockState, 0);
+
+    for(entry = GlobalData.AdapterList.Flink;
+        entry != &GlobalData.AdapterList;
+        entry = entry->Flink)
+    {
+        PTAP_ADAPTER_CONTEXT adapter = CONTAINING_RECORD(entry, TAP_ADAPTER_CONTEXT, AdapterListLink);
+
+        if(DeviceObject == adapter->DeviceObject
+            || DeviceObject == adapter->DiagDeviceObject)
+        {
+            tapAdapterContextReference(adapter);
+            NdisReleaseRWLock(GlobalData.Lock, &lockState);
+            return adapter;
+        }
+    }
+
+    NdisReleaseRWLock(GlobalData.Lock, &lockState);
+
+    return NULL;
+}
+
+static double
+MeasureLookups(ULONG DeviceCount, BOOLEAN Hashed)
+{
+    ULONGLONG start = NowNs();
+    ULONG i;
+
+    for(i = 0; i < Lookups; ++i)
+    {
+        PDEVICE_OBJECT deviceObject = DeviceObjects[i % DeviceCount];
+        PTAP_ADAPTER_CONTEXT adapter;
+
+        adapter = Hashed
+            ? tapAdapterContextFromDeviceObject(deviceObject)
+            : LinearLookup(deviceObject);
+
+        CHECK(adapter != NULL);
+        tapAdapterContextDereference(adapter);
+    }
+
+    return (double)(NowNs() - start) / Lookups;
+}
+
+static VOID
+BucketStats(ULONG *Longest, double *Mean)
+{
+    ULONG used = 0;
+    ULONG total = 0;
+    ULONG i;
+
+    *Longest = 0;
+
+    for(i = 0; i < TAP_ADAPTER_HASH_SIZE; ++i)
+    {
+        PLIST_ENTRY bucket = &GlobalData.AdapterHash[i];
+        PLIST_ENTRY entry;
+        ULONG length = 0;
+
+        for(entry = bucket->Flink; entry != bucket; entry = entry->Flink)
+        {
+            ++length;
+        }
+
+        *Longest = max(*Longest, length);
+        total += length;
+        used += (length != 0);
+    }
+
+    // Over the buckets a lookup can land in.
+    *Mean = used ? (double)total / used : 0;
+}
+
+// Opens and closes a handle on each device object of the adapters in
+// turn.
+static double
+MeasureOpens(ULONG AdapterCount, BOOLEAN Diag)
+{
+    ULONGLONG start = NowNs();
+    ULONG i;
+
+    for(i = 0; i < Opens; ++i)
+    {
+        PTAP_ADAPTER_CONTEXT adapter = Adapters[(i * 7) % AdapterCount];
+        PFILE_OBJECT file;
+
+        file = TapHostOpen(Diag ? adapter->DiagDeviceObject : adapter->DeviceObject);
+        CHECK(file != NULL);
+        TapHostClose(file);
+    }
+
+    return (double)(NowNs() - start) / Opens;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const ULONG counts[] = {10, 100, 250, 500, LOOKUP_MAX_ADAPTERS};
+    ULONG created = 0;
+    ULONG i;
+
+    if(argc > 1 && strcmp(argv[1], "--quick") == 0)
+    {
+        Lookups = 20000;
+        Opens = 2000;
+    }
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+
+    printf("adapter lookups, %u each; ns per lookup:\n", Lookups);
+    printf("  %8s %10s %10s %8s %8s\n", "adapters", "hash", "walk", "longest", "mean");
+
+    for(i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+    {
+        double hashNs;
+        double walkNs;
+        double mean;
+        ULONG longest;
+
+        for(; created < counts[i]; ++created)
+        {
+            Adapters[created] = TapHostCreateAdapter(created + 1);
+            CHECK(Adapters[created] != NULL);
+            CHECK(Adapters[created]->DiagDeviceObject != NULL);
+
+            DeviceObjects[2 * created] = Adapters[created]->DeviceObject;
+            DeviceObjects[2 * created + 1] = Adapters[created]->DiagDeviceObject;
+        }
+
+        hashNs = MeasureLookups(2 * created, TRUE);
+        walkNs = MeasureLookups(2 * created, FALSE);
+        BucketStats(&longest, &mean);
+
+        printf("  %8u %10.1f %10.1f %8u %8.2f\n", created, hashNs, walkNs, longest, mean);
+    }
+
+    printf("open and close with %u adapters, %u each; ns per open:\n", created, Opens);
+    printf("  TAP  %10.1f\n", MeasureOpens(created, FALSE));
+    printf("  diag %10.1f\n", MeasureOpens(created, TRUE));
+
+    for(i = 0; i < created; ++i)
+    {
+        TapHostHaltAdapter(Adapters[i]);
+    }
+
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
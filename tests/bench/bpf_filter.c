@@ -0,0 +1,406 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The decoded BPF interpreter (tapBpfRun) on the noise filters it was
+// added for: SSDP, LLMNR (IPv4 and IPv6) and NetBIOS drops, alone and
+// combined, as tcpdump would compile them for Ethernet, against the
+// frames they drop and the ordinary traffic they let through. Reports
+// ns and packets per second for each program and frame, and for a mix
+// of them all.
+//
+//  bpf_filter [--quick]
+//
+// Each verdict is checked once before it is timed.
+//======================================================================
+
+#include "taphost.h"
+
+#include <time.h>
+
+// Classic BPF encodings, as in <net/bpf.h>.
+#define LD_W_ABS    0x20
+#define LD_H_ABS    0x28
+#define LD_B_ABS    0x30
+#define LD_H_IND    0x48
+#define LDX_MSH     0xb1
+#define JMP_JEQ_K   0x15
+#define JMP_JSET_K  0x45
+#define RET_K       0x06
+
+#define STMT(code, k)           { (code), 0, 0, (k) }
+#define JUMP(code, k, jt, jf)   { (code), (jt), (jf), (k) }
+
+#define ACCEPT      0x40000
+#define DROP        0
+
+#define SSDP_GROUP      0xEFFFFFFA      // 239.255.255.250
+#define LLMNR_GROUP     0xE00000FC      // 224.0.0.252
+
+static ULONG Runs = 10000000;
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+//
+// Programs.
+//
+
+static const TAP_WIN_BPF_INSN AcceptAll[] =
+{
+    STMT(RET_K, ACCEPT),
+};
+
+// udp and dst host 239.255.255.250 and dst port 1900
+static const TAP_WIN_BPF_INSN Ssdp[] =
+{
+    STMT(LD_H_ABS, 12),
+    JUMP(JMP_JEQ_K, 0x0800, 0, 9),
+    STMT(LD_B_ABS, 23),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 7),
+    STMT(LD_W_ABS, 30),
+    JUMP(JMP_JEQ_K, SSDP_GROUP, 0, 5),
+    STMT(LD_H_ABS, 20),
+    JUMP(JMP_JSET_K, 0x1FFF, 3, 0),
+    STMT(LDX_MSH, 14),
+    STMT(LD_H_IND, 16),
+    JUMP(JMP_JEQ_K, 1900, 1, 0),
+    STMT(RET_K, ACCEPT),
+    STMT(RET_K, DROP),
+};
+
+// udp dst port 5355 and (dst host 224.0.0.252 or dst host ff02::1:3)
+static const TAP_WIN_BPF_INSN Llmnr[] =
+{
+    STMT(LD_H_ABS, 12),
+    JUMP(JMP_JEQ_K, 0x0800, 0, 9),
+    STMT(LD_B_ABS, 23),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 20),
+    STMT(LD_W_ABS, 30),
+    JUMP(JMP_JEQ_K, LLMNR_GROUP, 0, 18),
+    STMT(LD_H_ABS, 20),
+    JUMP(JMP_JSET_K, 0x1FFF, 16, 0),
+    STMT(LDX_MSH, 14),
+    STMT(LD_H_IND, 16),
+    JUMP(JMP_JEQ_K, 5355, 14, 13),
+    JUMP(JMP_JEQ_K, 0x86DD, 0, 12),
+    STMT(LD_B_ABS, 20),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 10),
+    STMT(LD_W_ABS, 38),
+    JUMP(JMP_JEQ_K, 0xFF020000, 0, 8),
+    STMT(LD_W_ABS, 42),
+    JUMP(JMP_JEQ_K, 0, 0, 6),
+    STMT(LD_W_ABS, 46),
+    JUMP(JMP_JEQ_K, 0, 0, 4),
+    STMT(LD_W_ABS, 50),
+    JUMP(JMP_JEQ_K, 0x00010003, 0, 2),
+    STMT(LD_H_ABS, 56),
+    JUMP(JMP_JEQ_K, 5355, 1, 0),
+    STMT(RET_K, ACCEPT),
+    STMT(RET_K, DROP),
+};
+
+// udp dst port 137 or udp dst port 138
+static const TAP_WIN_BPF_INSN NetBios[] =
+{
+    STMT(LD_H_ABS, 12),
+    JUMP(JMP_JEQ_K, 0x0800, 0, 8),
+    STMT(LD_B_ABS, 23),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 6),
+    STMT(LD_H_ABS, 20),
+    JUMP(JMP_JSET_K, 0x1FFF, 4, 0),
+    STMT(LDX_MSH, 14),
+    STMT(LD_H_IND, 16),
+    JUMP(JMP_JEQ_K, 137, 2, 0),
+    JUMP(JMP_JEQ_K, 138, 1, 0),
+    STMT(RET_K, ACCEPT),
+    STMT(RET_K, DROP),
+};
+
+// All three, sharing the IPv4 and UDP checks.
+static const TAP_WIN_BPF_INSN Noise[] =
+{
+    STMT(LD_H_ABS, 12),
+    JUMP(JMP_JEQ_K, 0x0800, 0, 14),
+    STMT(LD_B_ABS, 23),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 25),
+    STMT(LD_H_ABS, 20),
+    JUMP(JMP_JSET_K, 0x1FFF, 23, 0),
+    STMT(LDX_MSH, 14),
+    STMT(LD_H_IND, 16),
+    JUMP(JMP_JEQ_K, 137, 21, 0),
+    JUMP(JMP_JEQ_K, 138, 20, 0),
+    JUMP(JMP_JEQ_K, 1900, 0, 2),
+    STMT(LD_W_ABS, 30),
+    JUMP(JMP_JEQ_K, SSDP_GROUP, 17, 16),
+    JUMP(JMP_JEQ_K, 5355, 0, 15),
+    STMT(LD_W_ABS, 30),
+    JUMP(JMP_JEQ_K, LLMNR_GROUP, 14, 13),
+    JUMP(JMP_JEQ_K, 0x86DD, 0, 12),
+    STMT(LD_B_ABS, 20),
+    JUMP(JMP_JEQ_K, IPPROTO_UDP, 0, 10),
+    STMT(LD_W_ABS, 38),
+    JUMP(JMP_JEQ_K, 0xFF020000, 0, 8),
+    STMT(LD_W_ABS, 42),
+    JUMP(JMP_JEQ_K, 0, 0, 6),
+    STMT(LD_W_ABS, 46),
+    JUMP(JMP_JEQ_K, 0, 0, 4),
+    STMT(LD_W_ABS, 50),
+    JUMP(JMP_JEQ_K, 0x00010003, 0, 2),
+    STMT(LD_H_ABS, 56),
+    JUMP(JMP_JEQ_K, 5355, 1, 0),
+    STMT(RET_K, ACCEPT),
+    STMT(RET_K, DROP),
+};
+
+//
+// Frames.
+//
+
+enum
+{
+    FRAME_SSDP,
+    FRAME_LLMNR4,
+    FRAME_LLMNR6,
+    FRAME_NBNS,
+    FRAME_NBDGM,
+    FRAME_TCP,
+    FRAME_ARP,
+    FRAME_COUNT
+};
+
+static const char *FrameNames[FRAME_COUNT] =
+{
+    "ssdp", "llmnr4", "llmnr6", "nbns", "nbdgm", "tcp", "arp"
+};
+
+static UCHAR Frames[FRAME_COUNT][ETHERNET_PACKET_SIZE];
+static ULONG FrameLengths[FRAME_COUNT];
+
+static ULONG
+BuildIPv4(UCHAR *Frame, UCHAR Protocol, ULONG Daddr, USHORT Dport, ULONG Length)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPHDR *ip = (IPHDR *)(eth + 1);
+    UDPHDR *udp = (UDPHDR *)(ip + 1);
+    ULONG i;
+
+    for(i = 0; i < Length; ++i)
+    {
+        Frame[i] = (UCHAR)(i * 13 + 5);
+    }
+
+    memset(eth->dest, 0xFF, sizeof(MACADDR));
+    memcpy(eth->src, "\x02\x00\x5e\x10\x20\x30", sizeof(MACADDR));
+    eth->proto = htons(NDIS_ETH_TYPE_IPV4);
+
+    ip->version_len = 0x45;
+    ip->tos = 0;
+    ip->tot_len = htons((USHORT)(Length - sizeof(ETH_HEADER)));
+    ip->frag_off = 0;
+    ip->ttl = 1;
+    ip->protocol = Protocol;
+    ip->saddr = htonl(0xC0A8010A);
+    ip->daddr = htonl(Daddr);
+
+    // TCP's ports are where UDP's are.
+    udp->source = htons(50000);
+    udp->dest = htons(Dport);
+
+    return Length;
+}
+
+static ULONG
+BuildLlmnr6(UCHAR *Frame)
+{
+    static const UCHAR group[16] =
+        { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0, 0x03 };
+    ULONG length = sizeof(ETH_HEADER) + sizeof(IPV6HDR) + sizeof(UDPHDR) + 32;
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPV6HDR *ipv6 = (IPV6HDR *)(eth + 1);
+    UDPHDR *udp = (UDPHDR *)(ipv6 + 1);
+
+    memset(Frame, 0, length);
+
+    memcpy(eth->dest, "\x33\x33\x00\x01\x00\x03", sizeof(MACADDR));
+    memcpy(eth->src, "\x02\x00\x5e\x10\x20\x30", sizeof(MACADDR));
+    eth->proto = htons(NDIS_ETH_TYPE_IPV6);
+
+    ipv6->version_prio = 0x60;
+    ipv6->payload_len = htons((USHORT)(sizeof(UDPHDR) + 32));
+    ipv6->nexthdr = IPPROTO_UDP;
+    ipv6->hop_limit = 1;
+    ipv6->saddr[0] = 0xfe;
+    ipv6->saddr[1] = 0x80;
+    ipv6->saddr[15] = 0x0a;
+    memcpy(ipv6->daddr, group, 16);
+
+    udp->source = htons(50000);
+    udp->dest = htons(5355);
+    udp->len = ipv6->payload_len;
+
+    return length;
+}
+
+static VOID
+BuildFrames(VOID)
+{
+    ARP_PACKET *arp = (ARP_PACKET *)Frames[FRAME_ARP];
+
+    FrameLengths[FRAME_SSDP] = BuildIPv4(Frames[FRAME_SSDP], IPPROTO_UDP, SSDP_GROUP, 1900, 342);
+    FrameLengths[FRAME_LLMNR4] = BuildIPv4(Frames[FRAME_LLMNR4], IPPROTO_UDP, LLMNR_GROUP, 5355, 75);
+    FrameLengths[FRAME_LLMNR6] = BuildLlmnr6(Frames[FRAME_LLMNR6]);
+    FrameLengths[FRAME_NBNS] = BuildIPv4(Frames[FRAME_NBNS], IPPROTO_UDP, 0xC0A801FF, 137, 92);
+    FrameLengths[FRAME_NBDGM] = BuildIPv4(Frames[FRAME_NBDGM], IPPROTO_UDP, 0xC0A801FF, 138, 243);
+    FrameLengths[FRAME_TCP] = BuildIPv4(Frames[FRAME_TCP], IPPROTO_TCP, 0x5DB8D822, 443,
+        ETHERNET_PACKET_SIZE);
+
+    memset(arp, 0, sizeof(*arp));
+    memset(arp->m_MAC_Destination, 0xFF, sizeof(MACADDR));
+    memcpy(arp->m_MAC_Source, "\x02\x00\x5e\x10\x20\x30", sizeof(MACADDR));
+    arp->m_Proto = htons(NDIS_ETH_TYPE_ARP);
+    arp->m_MAC_AddressType = htons(MAC_ADDR_TYPE);
+    arp->m_PROTO_AddressType = htons(NDIS_ETH_TYPE_IPV4);
+    arp->m_MAC_AddressSize = sizeof(MACADDR);
+    arp->m_PROTO_AddressSize = sizeof(IPADDR);
+    arp->m_ARP_Operation = htons(ARP_REQUEST);
+    arp->m_ARP_IP_Source = htonl(0xC0A8010A);
+    arp->m_ARP_IP_Destination = htonl(0xC0A80101);
+    FrameLengths[FRAME_ARP] = sizeof(*arp);
+}
+
+//
+// Measurement.
+//
+
+typedef struct _BENCH_PROGRAM
+{
+    const char              *Name;
+    const TAP_WIN_BPF_INSN  *Code;
+    ULONG                   Count;
+    ULONG                   Drops;      // Bit n: drops frame n
+} BENCH_PROGRAM;
+
+#define DROPS(n)    (1u << (n))
+
+static const BENCH_PROGRAM Programs[] =
+{
+    { "accept", AcceptAll, ARRAYSIZE(AcceptAll), 0 },
+    { "ssdp", Ssdp, ARRAYSIZE(Ssdp), DROPS(FRAME_SSDP) },
+    { "llmnr", Llmnr, ARRAYSIZE(Llmnr), DROPS(FRAME_LLMNR4) | DROPS(FRAME_LLMNR6) },
+    { "netbios", NetBios, ARRAYSIZE(NetBios), DROPS(FRAME_NBNS) | DROPS(FRAME_NBDGM) },
+    { "noise", Noise, ARRAYSIZE(Noise),
+        DROPS(FRAME_SSDP) | DROPS(FRAME_LLMNR4) | DROPS(FRAME_LLMNR6)
+        | DROPS(FRAME_NBNS) | DROPS(FRAME_NBDGM) },
+};
+
+static volatile ULONG Sink;
+
+// ns per frame for Runs runs over Count frames in turn.
+static double
+Measure(const TAP_BPF_PROGRAM *Program, const ULONG *Indexes, ULONG Count)
+{
+    ULONGLONG start;
+    ULONG result = 0;
+    ULONG i;
+    ULONG j = 0;
+
+    start = NowNs();
+    for(i = 0; i < Runs; ++i)
+    {
+        ULONG frame = Indexes[j];
+
+        result += tapBpfRun(Program, Frames[frame], FrameLengths[frame], FrameLengths[frame]);
+
+        if(++j == Count)
+        {
+            j = 0;
+        }
+    }
+    Sink = result;
+
+    return (double)(NowNs() - start) / Runs;
+}
+
+static VOID
+Report(const char *Frame, const char *Verdict, double Ns)
+{
+    printf("    %-8s %-7s %8.1f %8.2f\n", Frame, Verdict, Ns, 1000.0 / Ns);
+}
+
+int
+main(int argc, char **argv)
+{
+    ULONG mix[FRAME_COUNT];
+    ULONG p;
+    ULONG f;
+
+    if(argc > 1 && strcmp(argv[1], "--quick") == 0)
+    {
+        Runs = 100000;
+    }
+
+    BuildFrames();
+
+    for(f = 0; f < FRAME_COUNT; ++f)
+    {
+        mix[f] = f;
+    }
+
+    printf("tapBpfRun, %u runs each; ns per frame and Mpps:\n", Runs);
+
+    for(p = 0; p < ARRAYSIZE(Programs); ++p)
+    {
+        const BENCH_PROGRAM *bench = &Programs[p];
+        PTAP_BPF_PROGRAM program;
+
+        CHECK_EQ(tapBpfCompile(bench->Code, bench->Count, &program), STATUS_SUCCESS);
+
+        printf("  %s, %u instructions:\n", bench->Name, bench->Count);
+
+        for(f = 0; f < FRAME_COUNT; ++f)
+        {
+            BOOLEAN drop = (bench->Drops & DROPS(f)) != 0;
+
+            CHECK_EQ(tapBpfRun(program, Frames[f], FrameLengths[f], FrameLengths[f]),
+                drop ? DROP : ACCEPT);
+
+            Report(FrameNames[f], drop ? "drop" : "accept", Measure(program, &f, 1));
+        }
+
+        Report("mix", "", Measure(program, mix, FRAME_COUNT));
+
+        tapBpfFree(program);
+    }
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// DHCP masquerade replies (dhcp.c) copied from the adapter's templates
+// and patched (CopyDHCPTemplate, PatchDHCPMsg) against the same replies
+// built from scratch (BuildDHCPMsg), as ProcessDHCP sends them for
+// DISCOVERs and REQUESTs spread over 1 to DHCP_MAX_ADAPTERS adapters,
+// each with its own templates. Reports ns per reply.
+//
+//  dhcp_reply [--quick]
+//
+// The replies of both are checked to be the same first. The adapters
+// are then paused, so each reply is built in full and then refused by
+// IndicateReceivePacket: what is timed is the reply, not its
+// indication. Building from scratch is forced, as in dhcp_test, by
+// setting the template sequence count to 0.
+//======================================================================
+
+#include "taphost.h"
+
+#include <time.h>
+
+#define DHCP_ADAPTER_IP     0x0A000002      // 10.0.0.2
+#define DHCP_SERVER_IP      0x0A000001
+#define DHCP_MAX_ADAPTERS   256
+#define DHCP_MAX_REPLY      1514
+
+static ULONG Replies = 2000000;
+
+static PTAP_ADAPTER_CONTEXT Adapters[DHCP_MAX_ADAPTERS];
+static PFILE_OBJECT Files[DHCP_MAX_ADAPTERS];
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+//
+// The stack: keeps a copy of the last reply, while the adapters run.
+//
+
+static PTAP_ADAPTER_CONTEXT Replying;
+static UCHAR Reply[DHCP_MAX_REPLY];
+static ULONG ReplyLength;
+
+static VOID
+Receive(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(NumberOfNetBufferLists);
+    UNREFERENCED_PARAMETER(ReceiveFlags);
+
+    ReplyLength = WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(NetBufferLists),
+        Reply, sizeof(Reply));
+
+    TapHostReturn(Replying, NetBufferLists);
+}
+
+//
+// The clients: each adapter's own DISCOVER and REQUEST.
+//
+
+typedef struct _REQUEST
+{
+    DHCPPre     Pre;
+    UCHAR       Options[16];
+    int         Optlen;
+} REQUEST;
+
+static REQUEST Requests[DHCP_MAX_ADAPTERS][2];
+
+static VOID
+BuildRequest(REQUEST *Request, PTAP_ADAPTER_CONTEXT Adapter, UCHAR Type, ULONG Xid)
+{
+    DHCPPre *p = &Request->Pre;
+    int optlen = 0;
+
+    memset(Request, 0, sizeof(*Request));
+
+    memset(p->eth.dest, 0xFF, sizeof(MACADDR));
+    memcpy(p->eth.src, Adapter->CurrentAddress, sizeof(MACADDR));
+    p->eth.proto = htons(NDIS_ETH_TYPE_IPV4);
+
+    Request->Options[optlen++] = DHCP_MSG_TYPE;
+    Request->Options[optlen++] = 1;
+    Request->Options[optlen++] = Type;
+    Request->Options[optlen++] = DHCP_END;
+
+    p->ip.version_len = 0x45;
+    p->ip.tot_len = htons((USHORT)(sizeof(IPHDR) + sizeof(UDPHDR) + sizeof(DHCP) + optlen));
+    p->ip.ttl = 64;
+    p->ip.protocol = IPPROTO_UDP;
+    p->ip.daddr = 0xFFFFFFFF;
+
+    p->udp.source = htons(BOOTPC_PORT);
+    p->udp.dest = htons(BOOTPS_PORT);
+    p->udp.len = htons((USHORT)(sizeof(UDPHDR) + sizeof(DHCP) + optlen));
+
+    p->dhcp.op = BOOTREQUEST;
+    p->dhcp.htype = 1;
+    p->dhcp.hlen = sizeof(MACADDR);
+    p->dhcp.xid = Xid;
+    memcpy(p->dhcp.chaddr, Adapter->CurrentAddress, sizeof(MACADDR));
+    p->dhcp.magic = htonl(0x63825363);
+
+    Request->Optlen = optlen;
+}
+
+static VOID
+Send(PTAP_ADAPTER_CONTEXT Adapter, REQUEST *Request)
+{
+    ProcessDHCP(Adapter, &Request->Pre.eth, &Request->Pre.ip, &Request->Pre.udp,
+        &Request->Pre.dhcp, Request->Optlen);
+}
+
+// DHCP masquerade, with the DNS servers and domain OpenVPN pushes.
+static VOID
+Configure(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File)
+{
+    static const UCHAR options[] = {
+        6, 8, 10, 0, 0, 53, 10, 0, 0, 54,
+        15, 11, 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+    };
+    UCHAR buffer[DHCP_USER_SUPPLIED_OPTIONS_BUFFER_SIZE];
+    IPADDR masq[4];
+    ULONG value = TRUE;
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    masq[0] = htonl(DHCP_ADAPTER_IP);
+    masq[1] = htonl(0xFFFFFF00);
+    masq[2] = htonl(DHCP_SERVER_IP);
+    masq[3] = 3600;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, masq,
+        sizeof(masq), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    memcpy(buffer, options, sizeof(options));
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_SET_OPT, buffer,
+        sizeof(options), sizeof(ULONG), NULL), STATUS_SUCCESS);
+}
+
+// Both ways answer Request with the same bytes.
+static VOID
+Compare(PTAP_ADAPTER_CONTEXT Adapter, REQUEST *Request)
+{
+    UCHAR templated[DHCP_MAX_REPLY];
+    ULONG templatedLength;
+    LONG sequence = Adapter->m_dhcp_templates_sequence;
+
+    Replying = Adapter;
+    ReplyLength = 0;
+    Send(Adapter, Request);
+    WdkHostRunDpcs();
+    CHECK(ReplyLength > sizeof(DHCPPre));
+    memcpy(templated, Reply, ReplyLength);
+    templatedLength = ReplyLength;
+
+    Adapter->m_dhcp_templates_sequence = 0;
+    ReplyLength = 0;
+    Send(Adapter, Request);
+    WdkHostRunDpcs();
+    Adapter->m_dhcp_templates_sequence = sequence;
+
+    CHECK_EQ(ReplyLength, templatedLength);
+    CHECK(memcmp(Reply, templated, ReplyLength) == 0);
+}
+
+static ULONG64
+InjectDrops(ULONG Count)
+{
+    TAP_WIN_DROP_STATS drops;
+    ULONG64 total = 0;
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        tapDropStatsQuery(&Adapters[i]->DropStats, 0, &drops);
+        total += drops.Drops[TAP_WIN_DROP_INJECT];
+    }
+
+    return total;
+}
+
+// ns per reply over Count adapters, from the templates or not.
+static double
+Measure(ULONG Count, BOOLEAN Templates)
+{
+    LONG sequences[DHCP_MAX_ADAPTERS];
+    ULONG64 replied = InjectDrops(Count);
+    ULONGLONG start;
+    ULONG i;
+
+    if(!Templates)
+    {
+        for(i = 0; i < Count; ++i)
+        {
+            sequences[i] = Adapters[i]->m_dhcp_templates_sequence;
+            Adapters[i]->m_dhcp_templates_sequence = 0;
+        }
+    }
+
+    start = NowNs();
+    for(i = 0; i < Replies; ++i)
+    {
+        ULONG adapter = i % Count;
+
+        Send(Adapters[adapter], &Requests[adapter][(i / Count) & 1]);
+    }
+    start = NowNs() - start;
+
+    if(!Templates)
+    {
+        for(i = 0; i < Count; ++i)
+        {
+            Adapters[i]->m_dhcp_templates_sequence = sequences[i];
+        }
+    }
+
+    // Every request was answered, and the answer refused.
+    CHECK_EQ(InjectDrops(Count), replied + Replies);
+
+    return (double)start / Replies;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const ULONG counts[] = { 1, 16, DHCP_MAX_ADAPTERS };
+    ULONG i;
+
+    if(argc > 1 && strcmp(argv[1], "--quick") == 0)
+    {
+        Replies = 20000;
+    }
+
+    WdkHostSetReceiveHook(Receive, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+
+    for(i = 0; i < DHCP_MAX_ADAPTERS; ++i)
+    {
+        Adapters[i] = TapHostCreateAdapter(i + 1);
+        CHECK(Adapters[i] != NULL);
+        Files[i] = TapHostOpen(Adapters[i]->DeviceObject);
+        CHECK(Files[i] != NULL);
+
+        Configure(Adapters[i], Files[i]);
+
+        BuildRequest(&Requests[i][0], Adapters[i], DHCPDISCOVER, 0x1000 + i);
+        BuildRequest(&Requests[i][1], Adapters[i], DHCPREQUEST, 0x2000 + i);
+
+        Compare(Adapters[i], &Requests[i][0]);
+        Compare(Adapters[i], &Requests[i][1]);
+
+        CHECK_EQ(TapHostPauseAdapter(Adapters[i]), NDIS_STATUS_SUCCESS);
+    }
+
+    printf("DHCP replies, %u each, OFFER and ACK in turn; ns per reply:\n", Replies);
+    printf("  %8s %10s %10s %8s\n", "adapters", "template", "build", "speedup");
+
+    for(i = 0; i < ARRAYSIZE(counts); ++i)
+    {
+        double templateNs = Measure(counts[i], TRUE);
+        double buildNs = Measure(counts[i], FALSE);
+
+        printf("  %8u %10.1f %10.1f %7.2fx\n", counts[i], templateNs, buildNs, buildNs / templateNs);
+    }
+
+    for(i = 0; i < DHCP_MAX_ADAPTERS; ++i)
+    {
+        TapHostClose(Files[i]);
+        TapHostHaltAdapter(Adapters[i]);
+    }
+
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,596 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Contention on the adapter's send queue, read IRP queue, flow control
+// and adapter locks: producer threads send through one adapter while
+// consumer threads, one handle each in multi-queue mode, keep reads
+// pending on it. Reports the frames read per second, each lock's
+// acquisitions, contention and wait and hold time percentiles from
+// TAP_WIN_IOCTL_GET_LOCK_STATS, and how evenly producers got their
+// frames sent and consumers their frames read.
+//
+//  lock_contention [--quick] [--producers N] [--consumers M] [--seconds S]
+//
+// Without --producers or --consumers, runs 1 to 64 producers against
+// 1, 4 and TAP_WIN_MAX_QUEUES consumers. Each host thread is its own
+// processor. The spin locks are the host stand-ins' atomic spins, and
+// threads are not pinned or kept from being preempted while they hold
+// one, so the numbers are a baseline to compare queueing changes on
+// the same machine rather than what the kernel would see.
+//======================================================================
+
+#include "taphost.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONTENTION_MAX_PRODUCERS    64
+#define CONTENTION_MAX_CONSUMERS    TAP_WIN_MAX_QUEUES
+#define CONTENTION_WINDOW           256     // Sends a producer has in flight
+#define CONTENTION_BATCH            8       // NBLs per send
+#define CONTENTION_FLOWS            16      // UDP flows per producer
+#define CONTENTION_READS            8       // Reads a consumer keeps pending
+#define CONTENTION_READ_SIZE        2048
+#define CONTENTION_FRAME_SIZE       512
+
+typedef struct _CONTENTION_PRODUCER
+{
+    pthread_t           Thread;
+    ULONG               Processor;
+    volatile LONG       Outstanding;
+    volatile LONG       Sent;
+} CONTENTION_PRODUCER;
+
+typedef struct _CONTENTION_CONSUMER
+{
+    pthread_t           Thread;
+    ULONG               Processor;
+    PFILE_OBJECT        File;
+    PIRP                Irps[CONTENTION_READS];
+    UCHAR               Buffers[CONTENTION_READS][CONTENTION_READ_SIZE];
+    volatile LONG       Read;
+} CONTENTION_CONSUMER;
+
+static const char *LockNames[TAP_WIN_LOCK_COUNT] =
+{
+    "adapter", "send-queue", "read-irp-queue", "flow-control",
+};
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static CONTENTION_PRODUCER Producers[CONTENTION_MAX_PRODUCERS];
+static CONTENTION_CONSUMER Consumers[CONTENTION_MAX_CONSUMERS];
+static volatile LONG Started;
+static volatile BOOLEAN StopProducers;
+static volatile BOOLEAN StopConsumers;
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+// Sent NBLs come back here, on whichever thread completes them.
+static VOID
+CompleteSend(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+        CONTENTION_PRODUCER *producer = NetBufferLists->ProtocolReserved[0];
+
+        NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) = NULL;
+        WdkHostFreeNetBufferList(NetBufferLists);
+        InterlockedDecrement(&producer->Outstanding);
+        NetBufferLists = next;
+    }
+}
+
+// A UDP frame of one of the producer's flows.
+static VOID
+BuildFrame(PUCHAR Frame, ULONG Producer, ULONG Flow)
+{
+    PUCHAR ip = Frame + ETHERNET_HEADER_SIZE;
+    PUCHAR udp = ip + IP_HEADER_SIZE;
+    ULONG ipLength = CONTENTION_FRAME_SIZE - ETHERNET_HEADER_SIZE;
+    ULONG udpLength = ipLength - IP_HEADER_SIZE;
+
+    memset(Frame, 0, CONTENTION_FRAME_SIZE);
+    Frame[0] = 0x02;
+    Frame[5] = 0x01;
+    ETH_COPY_NETWORK_ADDRESS(Frame + 6, Adapter->CurrentAddress);
+    Frame[12] = 0x08;
+    ip[0] = 0x45;
+    ip[2] = (UCHAR)(ipLength >> 8);
+    ip[3] = (UCHAR)ipLength;
+    ip[8] = 64;
+    ip[9] = 17;
+    ip[12] = 10;
+    ip[13] = 8;
+    ip[15] = 2;
+    ip[16] = 10;
+    ip[17] = 9;
+    ip[18] = (UCHAR)Producer;
+    ip[19] = 1;
+    udp[0] = (UCHAR)((10000 + Flow) >> 8);
+    udp[1] = (UCHAR)(10000 + Flow);
+    udp[2] = 0x30;
+    udp[3] = 0x39;
+    udp[4] = (UCHAR)(udpLength >> 8);
+    udp[5] = (UCHAR)udpLength;
+}
+
+static VOID
+WaitForStart(VOID)
+{
+    while(!Started)
+    {
+        sched_yield();
+    }
+}
+
+static void *
+ProducerThread(void *Context)
+{
+    CONTENTION_PRODUCER *producer = Context;
+    ULONG index = (ULONG)(producer - Producers);
+    UCHAR frames[CONTENTION_FLOWS][CONTENTION_FRAME_SIZE];
+    ULONG flow = 0;
+    ULONG i;
+
+    WdkHostSetCurrentProcessor(producer->Processor);
+
+    for(i = 0; i < CONTENTION_FLOWS; ++i)
+    {
+        BuildFrame(frames[i], index, i);
+    }
+
+    WaitForStart();
+
+    while(!StopProducers)
+    {
+        PNET_BUFFER_LIST batch = NULL;
+        PNET_BUFFER_LIST *tail = &batch;
+
+        // Held back by flow control, as the stack would be.
+        if(producer->Outstanding + CONTENTION_BATCH > CONTENTION_WINDOW)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for(i = 0; i < CONTENTION_BATCH; ++i)
+        {
+            PNET_BUFFER_LIST nbl = WdkHostAllocateNetBufferList(frames[flow], CONTENTION_FRAME_SIZE);
+
+            nbl->ProtocolReserved[0] = producer;
+            *tail = nbl;
+            tail = &NET_BUFFER_LIST_NEXT_NBL(nbl);
+            flow = (flow + 1) % CONTENTION_FLOWS;
+        }
+
+        InterlockedExchangeAdd(&producer->Outstanding, CONTENTION_BATCH);
+        TapHostSend(Adapter, batch);
+        InterlockedExchangeAdd(&producer->Sent, CONTENTION_BATCH);
+    }
+
+    return NULL;
+}
+
+// Reaps completed reads and reads again until each read pends.
+static BOOLEAN
+PollReads(CONTENTION_CONSUMER *Consumer)
+{
+    BOOLEAN progress = FALSE;
+    ULONG i;
+
+    for(i = 0; i < CONTENTION_READS; ++i)
+    {
+        for(;;)
+        {
+            NTSTATUS status;
+
+            if(Consumer->Irps[i] != NULL)
+            {
+                if(!Consumer->Irps[i]->HostCompleted)
+                {
+                    break;
+                }
+
+                if(NT_SUCCESS(Consumer->Irps[i]->IoStatus.Status))
+                {
+                    InterlockedIncrement(&Consumer->Read);
+                }
+
+                WdkHostFreeIrp(Consumer->Irps[i]);
+                Consumer->Irps[i] = NULL;
+                progress = TRUE;
+            }
+
+            status = TapHostRead(Consumer->File, Consumer->Buffers[i],
+                CONTENTION_READ_SIZE, &Consumer->Irps[i]);
+
+            if(status != STATUS_PENDING)
+            {
+                if(!NT_SUCCESS(status))
+                {
+                    break;
+                }
+
+                InterlockedIncrement(&Consumer->Read);
+                progress = TRUE;
+            }
+        }
+    }
+
+    return progress;
+}
+
+static void *
+ConsumerThread(void *Context)
+{
+    CONTENTION_CONSUMER *consumer = Context;
+
+    WdkHostSetCurrentProcessor(consumer->Processor);
+
+    WaitForStart();
+
+    while(!StopConsumers)
+    {
+        if(!PollReads(consumer))
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+// Jain's fairness index: 1 when all are equal, 1/n when one has all.
+static double
+Fairness(const volatile LONG *Counts, size_t Stride, ULONG Count)
+{
+    double sum = 0;
+    double sumOfSquares = 0;
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        double x = *(const volatile LONG *)((const UCHAR *)Counts + i * Stride);
+
+        sum += x;
+        sumOfSquares += x * x;
+    }
+
+    return sumOfSquares ? (sum * sum) / (Count * sumOfSquares) : 1.0;
+}
+
+// The upper bound of the bucket holding the Percentile'th time, in ns.
+static double
+Percentile(const unsigned __int64 *Histogram, ULONGLONG Frequency, double Percentile)
+{
+    ULONGLONG total = 0;
+    ULONGLONG seen = 0;
+    ULONG i;
+
+    for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS; ++i)
+    {
+        total += Histogram[i];
+    }
+
+    for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += Histogram[i];
+        if(seen != 0 && seen >= total * Percentile)
+        {
+            break;
+        }
+    }
+
+    return (double)(1ull << min(i, TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1)) * 1e9 / (double)Frequency;
+}
+
+static VOID
+LockStats(PFILE_OBJECT File, ULONG Flags, TAP_WIN_LOCK_STATS *Stats)
+{
+    memset(Stats, 0, sizeof(*Stats));
+    memcpy(Stats, &Flags, sizeof(Flags));
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_LOCK_STATS, Stats,
+        sizeof(Flags), sizeof(*Stats), NULL), STATUS_SUCCESS);
+}
+
+static VOID
+RunContention(ULONG Index, ULONG ProducerCount, ULONG ConsumerCount, ULONGLONG DurationNs)
+{
+    TAP_WIN_LOCK_STATS locks;
+    TAP_WIN_DROP_STATS drops;
+    PFILE_OBJECT control;
+    ULONG dropReset = TAP_WIN_DROP_STATS_RESET;
+    ULONG queueCount = ConsumerCount;
+    ULONGLONG start;
+    ULONGLONG elapsed;
+    ULONGLONG deadline;
+    LONG read = 0;
+    LONG sent = 0;
+    ULONG i;
+
+    Adapter = TapHostCreateAdapter(Index);
+    CHECK(Adapter != NULL);
+
+    control = TapHostOpen(Adapter->DiagDeviceObject);
+    CHECK(control != NULL);
+
+    for(i = 0; i < ConsumerCount; ++i)
+    {
+        CONTENTION_CONSUMER *consumer = &Consumers[i];
+
+        memset(consumer->Irps, 0, sizeof(consumer->Irps));
+        consumer->Read = 0;
+        consumer->Processor = 1 + ProducerCount + i;
+        consumer->File = TapHostOpen(Adapter->DeviceObject);
+        CHECK(consumer->File != NULL);
+
+        if(i == 0)
+        {
+            ULONG connected = TRUE;
+
+            CHECK_EQ(TapHostIoctl(consumer->File, TAP_WIN_IOCTL_SET_QUEUE_COUNT,
+                &queueCount, sizeof(queueCount), 0, NULL), STATUS_SUCCESS);
+            CHECK_EQ(TapHostIoctl(consumer->File, TAP_WIN_IOCTL_SET_MEDIA_STATUS,
+                &connected, sizeof(connected), 0, NULL), STATUS_SUCCESS);
+        }
+    }
+
+    for(i = 0; i < ProducerCount; ++i)
+    {
+        Producers[i].Processor = 1 + i;
+        Producers[i].Outstanding = 0;
+        Producers[i].Sent = 0;
+    }
+
+    Started = FALSE;
+    StopProducers = FALSE;
+    StopConsumers = FALSE;
+
+    for(i = 0; i < ConsumerCount; ++i)
+    {
+        CHECK_EQ(pthread_create(&Consumers[i].Thread, NULL, ConsumerThread, &Consumers[i]), 0);
+    }
+
+    for(i = 0; i < ProducerCount; ++i)
+    {
+        CHECK_EQ(pthread_create(&Producers[i].Thread, NULL, ProducerThread, &Producers[i]), 0);
+    }
+
+    LockStats(control, TAP_WIN_LOCK_STATS_ENABLE | TAP_WIN_LOCK_STATS_RESET, &locks);
+    memcpy(&drops, &dropReset, sizeof(dropReset));
+    CHECK_EQ(TapHostIoctl(control, TAP_WIN_IOCTL_GET_DROP_STATS, &drops,
+        sizeof(dropReset), sizeof(drops), NULL), STATUS_SUCCESS);
+
+    start = NowNs();
+    Started = TRUE;
+
+    while(NowNs() - start < DurationNs)
+    {
+        struct timespec millisecond = { 0, 1000000 };
+
+        nanosleep(&millisecond, NULL);
+    }
+
+    for(i = 0; i < ConsumerCount; ++i)
+    {
+        read += Consumers[i].Read;
+    }
+
+    elapsed = NowNs() - start;
+
+    LockStats(control, 0, &locks);
+
+    StopProducers = TRUE;
+
+    for(i = 0; i < ProducerCount; ++i)
+    {
+        CHECK_EQ(pthread_join(Producers[i].Thread, NULL), 0);
+        sent += Producers[i].Sent;
+    }
+
+    // The consumers drain what flow control holds back.
+    deadline = NowNs() + 10000000000ull;
+    for(i = 0; i < ProducerCount; ++i)
+    {
+        while(Producers[i].Outstanding != 0)
+        {
+            CHECK(NowNs() < deadline);
+            sched_yield();
+        }
+    }
+
+    StopConsumers = TRUE;
+
+    for(i = 0; i < ConsumerCount; ++i)
+    {
+        CHECK_EQ(pthread_join(Consumers[i].Thread, NULL), 0);
+    }
+
+    printf("%2u producers %u consumers: %8.0f frames/s read, %u sent, fairness %.3f sent %.3f read\n",
+        ProducerCount, ConsumerCount, (double)read * 1e9 / (double)elapsed, sent,
+        Fairness(&Producers[0].Sent, sizeof(CONTENTION_PRODUCER), ProducerCount),
+        Fairness(&Consumers[0].Read, sizeof(CONTENTION_CONSUMER), ConsumerCount));
+
+    for(i = 0; i < TAP_WIN_LOCK_COUNT; ++i)
+    {
+        const TAP_WIN_LOCK_STAT *lock = &locks.Locks[i];
+
+        if(lock->Acquisitions == 0)
+        {
+            continue;
+        }
+
+        printf("    %-15s %10llu acquired %8llu contended (%.3f%%)"
+            "  wait p50 %.0f p99 %.0f ns  hold p50 %.0f p99 %.0f ns\n",
+            LockNames[i], (unsigned long long)lock->Acquisitions,
+            (unsigned long long)lock->Contended,
+            100.0 * (double)lock->Contended / (double)lock->Acquisitions,
+            lock->Contended ? Percentile(lock->WaitHistogram, locks.Frequency, 0.5) : 0.0,
+            lock->Contended ? Percentile(lock->WaitHistogram, locks.Frequency, 0.99) : 0.0,
+            Percentile(lock->HoldHistogram, locks.Frequency, 0.5),
+            Percentile(lock->HoldHistogram, locks.Frequency, 0.99));
+    }
+
+    memset(&drops, 0, sizeof(drops));
+    CHECK_EQ(TapHostIoctl(control, TAP_WIN_IOCTL_GET_DROP_STATS, &drops,
+        0, sizeof(drops), NULL), STATUS_SUCCESS);
+
+    for(i = 0; i < TAP_WIN_DROP_COUNT; ++i)
+    {
+        if(drops.Drops[i] != 0)
+        {
+            printf("    drop reason %u: %llu\n", i, (unsigned long long)drops.Drops[i]);
+        }
+    }
+
+    // Closing the handles completes the reads still pending.
+    for(i = 0; i < ConsumerCount; ++i)
+    {
+        ULONG j;
+
+        TapHostClose(Consumers[i].File);
+
+        for(j = 0; j < CONTENTION_READS; ++j)
+        {
+            if(Consumers[i].Irps[j] != NULL)
+            {
+                CHECK(Consumers[i].Irps[j]->HostCompleted);
+                WdkHostFreeIrp(Consumers[i].Irps[j]);
+            }
+        }
+    }
+
+    TapHostClose(control);
+    TapHostHaltAdapter(Adapter);
+    Adapter = NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const ULONG producerCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    static const ULONG consumerCounts[] = { 1, 4, CONTENTION_MAX_CONSUMERS };
+    ULONG producers = 0;
+    ULONG consumers = 0;
+    double seconds = 1.0;
+    BOOLEAN quick = FALSE;
+    ULONG index = 1;
+    ULONG i;
+    ULONG j;
+    int arg;
+
+    for(arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--quick") == 0)
+        {
+            quick = TRUE;
+            seconds = 0.05;
+        }
+        else if(strcmp(argv[arg], "--producers") == 0 && arg + 1 < argc)
+        {
+            producers = (ULONG)strtoul(argv[++arg], NULL, 0);
+        }
+        else if(strcmp(argv[arg], "--consumers") == 0 && arg + 1 < argc)
+        {
+            consumers = (ULONG)strtoul(argv[++arg], NULL, 0);
+        }
+        else if(strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc)
+        {
+            seconds = strtod(argv[++arg], NULL);
+        }
+        else
+        {
+            fprintf(stderr, "usage: lock_contention [--quick] [--producers N] [--consumers M] [--seconds S]\n");
+            return 2;
+        }
+    }
+
+    if(producers > CONTENTION_MAX_PRODUCERS || consumers > CONTENTION_MAX_CONSUMERS)
+    {
+        fprintf(stderr, "lock_contention: at most %u producers and %u consumers\n",
+            CONTENTION_MAX_PRODUCERS, CONTENTION_MAX_CONSUMERS);
+        return 2;
+    }
+
+    // Processor 0 is the main thread's.
+    WdkHostSetProcessorCount(1 + CONTENTION_MAX_PRODUCERS + CONTENTION_MAX_CONSUMERS);
+    WdkHostSetSendCompleteHook(CompleteSend, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+
+    // Threads beyond these time-share, and then lock waits are mostly
+    // a holder's preemption.
+    printf("%ld online processors\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    for(i = 0; i < ARRAYSIZE(consumerCounts); ++i)
+    {
+        ULONG consumerCount = consumers ? consumers : consumerCounts[i];
+
+        for(j = 0; j < ARRAYSIZE(producerCounts); ++j)
+        {
+            ULONG producerCount = producers ? producers : producerCounts[j];
+
+            // A short pass over a few of them is enough for ctest.
+            if(quick && !producers && producerCount > 4)
+            {
+                break;
+            }
+
+            RunContention(index++, producerCount, consumerCount, (ULONGLONG)(seconds * 1e9));
+
+            if(producers)
+            {
+                break;
+            }
+        }
+
+        if(consumers || (quick && i == 1))
+        {
+            break;
+        }
+    }
+
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+
+    return 0;
+}
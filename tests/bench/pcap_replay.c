@@ -0,0 +1,1042 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Replays a capture through the adapter's transmit path (frames sent
+// by the stack and read by the user) and its write path (frames
+// written by the user and indicated to the stack), in TAP mode with
+// each PriorityBehavior, in TUN mode and with DHCP masquerade on, and
+// reports the time per frame, the driver's own stage statistics and
+// its drop reasons for each.
+//
+//  pcap_replay [--quick] [--passes N] [capture.pcap | capture.pcapng]
+//
+// Without a capture, a built-in mix of DHCP, ARP, neighbor
+// solicitation, 802.1Q tagged and TCP frames is replayed. Frames are
+// readdressed as the stack or the user would have sent them: from the
+// adapter's MAC on transmit, to it on write, to the TUN peer's MAC in
+// TUN mode, and with an 802.1Q tag moved into the NBL's 802.1Q info on
+// transmit. TUN writes are the IP packets without the Ethernet header.
+// Captures are classic pcap or pcapng (as the diag device writes it),
+// Ethernet only.
+//======================================================================
+
+#include "taphost.h"
+
+#include <time.h>
+
+#define REPLAY_BATCH            32      // NBLs per send, under PACKET_QUEUE_SIZE
+#define REPLAY_READS            8       // Reads kept pending
+#define REPLAY_READ_SIZE        65536
+#define REPLAY_FULL_FRAMES      200000  // Frames replayed per path without --quick
+
+typedef struct _REPLAY_FRAME
+{
+    PUCHAR      Data;
+    ULONG       Length;
+} REPLAY_FRAME;
+
+typedef struct _REPLAY_MODE
+{
+    const char  *Name;
+    BOOLEAN     Tun;
+    BOOLEAN     DhcpMasq;
+    ULONG       PriorityBehavior;
+} REPLAY_MODE;
+
+static const REPLAY_MODE ReplayModes[] =
+{
+    { "tap",            FALSE,  FALSE,  TAP_PRIORITY_BEHAVIOR_NOPRIORITY },
+    { "tap-priority",   FALSE,  FALSE,  TAP_PRIORITY_BEHAVIOR_ENABLED },
+    { "tap-addalways",  FALSE,  FALSE,  TAP_PRIORITY_BEHAVIOR_ADDALWAYS },
+    { "tun",            TRUE,   FALSE,  TAP_PRIORITY_BEHAVIOR_NOPRIORITY },
+    { "dhcp-masq",      FALSE,  TRUE,   TAP_PRIORITY_BEHAVIOR_NOPRIORITY },
+};
+
+static const char *StageNames[TAP_WIN_STAGE_COUNT] =
+{
+    "tx-allocate", "tx-copy", "tx-vlan", "tx-inspect", "tx-queue",
+    "tx-complete", "write-map", "write-strip-8021q", "write-filter",
+    "write-build-nbl", "write-indicate",
+};
+
+static const char *DropNames[TAP_WIN_DROP_COUNT] =
+{
+    "tx-no-reader", "tx-not-ready", "tx-bad-length", "tx-alloc-failed",
+    "tx-get-data-failed", "tx-filtered", "tx-tun-protocol",
+    "tx-tun-bad-size", "tx-tun-not-directed", "tx-no-queue", "tx-flushed",
+    "read-too-small", "write-not-ready", "write-paused", "write-bad-size",
+    "write-filtered", "write-packet-filter", "write-no-resources", "inject",
+    "tx-malformed",
+};
+
+// The replayed addresses: the adapter is 10.8.0.2, its peer (or DHCP
+// server) 10.8.0.1.
+#define REPLAY_LOCAL_IP         0x0A080002
+#define REPLAY_PEER_IP          0x0A080001
+
+// The BOOTP message in an untagged IPv4 UDP frame.
+#define REPLAY_DHCP_OFFSET      (ETHERNET_HEADER_SIZE + IP_HEADER_SIZE + 8)
+
+static REPLAY_FRAME *Capture;
+static ULONG FrameCount;
+static ULONG FrameCapacity;
+
+// NBLs indicated by the driver, until returned.
+static PNET_BUFFER_LIST Indicated;
+static PNET_BUFFER_LIST *IndicatedTail = &Indicated;
+static ULONG IndicatedCount;
+
+static VOID
+AddFrame(const UCHAR *Data, ULONG Length)
+{
+    if(FrameCount == FrameCapacity)
+    {
+        FrameCapacity = FrameCapacity ? FrameCapacity * 2 : 64;
+        Capture = realloc(Capture, FrameCapacity * sizeof(REPLAY_FRAME));
+        CHECK(Capture != NULL);
+    }
+
+    Capture[FrameCount].Data = malloc(Length);
+    CHECK(Capture[FrameCount].Data != NULL);
+    memcpy(Capture[FrameCount].Data, Data, Length);
+    Capture[FrameCount].Length = Length;
+    ++FrameCount;
+}
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+//
+// Capture files.
+//
+
+static ULONG
+Get16(const UCHAR *p, BOOLEAN BigEndian)
+{
+    return BigEndian ? ((ULONG)p[0] << 8) | p[1] : ((ULONG)p[1] << 8) | p[0];
+}
+
+static ULONG
+Get32(const UCHAR *p, BOOLEAN BigEndian)
+{
+    return BigEndian
+        ? ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | p[3]
+        : ((ULONG)p[3] << 24) | ((ULONG)p[2] << 16) | ((ULONG)p[1] << 8) | p[0];
+}
+
+#define PCAP_LINKTYPE_ETHERNET  1
+#define PCAPNG_SHB              0x0A0D0D0A
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_MAX_INTERFACES   64
+
+static BOOLEAN
+ParsePcap(const UCHAR *File, size_t Size)
+{
+    BOOLEAN bigEndian;
+    ULONG magic;
+    size_t offset;
+
+    magic = Get32(File, FALSE);
+
+    if(magic == 0xA1B2C3D4 || magic == 0xA1B23C4D)
+    {
+        bigEndian = FALSE;
+    }
+    else if(magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+    {
+        bigEndian = TRUE;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    if(Size < 24 || Get32(File + 20, bigEndian) != PCAP_LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "pcap_replay: not an Ethernet capture\n");
+        return FALSE;
+    }
+
+    for(offset = 24; offset + 16 <= Size; )
+    {
+        ULONG capturedLength = Get32(File + offset + 8, bigEndian);
+
+        offset += 16;
+        if(capturedLength > Size - offset)
+        {
+            break;
+        }
+
+        AddFrame(File + offset, capturedLength);
+        offset += capturedLength;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+ParsePcapng(const UCHAR *File, size_t Size)
+{
+    UCHAR linkTypes[PCAPNG_MAX_INTERFACES];
+    ULONG interfaces = 0;
+    BOOLEAN bigEndian = FALSE;
+    size_t offset;
+
+    if(Size < 12 || Get32(File, FALSE) != PCAPNG_SHB)
+    {
+        return FALSE;
+    }
+
+    for(offset = 0; offset + 12 <= Size; )
+    {
+        const UCHAR *block = File + offset;
+        ULONG type;
+        ULONG length;
+
+        if(Get32(block, FALSE) == PCAPNG_SHB)
+        {
+            // Each section sets its own byte order and interfaces.
+            bigEndian = (Get32(block + 8, TRUE) == PCAPNG_BYTE_ORDER_MAGIC);
+            interfaces = 0;
+        }
+
+        type = Get32(block, bigEndian);
+        length = Get32(block + 4, bigEndian);
+
+        if(length < 12 || (length & 3) != 0 || length > Size - offset)
+        {
+            break;
+        }
+
+        if(type == PCAPNG_IDB && length >= 20 && interfaces < PCAPNG_MAX_INTERFACES)
+        {
+            linkTypes[interfaces++] =
+                (Get16(block + 8, bigEndian) == PCAP_LINKTYPE_ETHERNET);
+        }
+        else if(type == PCAPNG_EPB && length >= 32)
+        {
+            ULONG interfaceId = Get32(block + 8, bigEndian);
+            ULONG capturedLength = Get32(block + 20, bigEndian);
+
+            if(interfaceId < interfaces
+                && linkTypes[interfaceId]
+                && capturedLength <= length - 32)
+            {
+                AddFrame(block + 28, capturedLength);
+            }
+        }
+
+        offset += length;
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+LoadCapture(const char *Path)
+{
+    FILE *file = fopen(Path, "rb");
+    UCHAR *contents;
+    long size;
+    BOOLEAN parsed;
+
+    if(file == NULL)
+    {
+        perror(Path);
+        return FALSE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    contents = malloc(size > 0 ? size : 1);
+    CHECK(contents != NULL);
+
+    if(size < 4 || fread(contents, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "pcap_replay: %s: short file\n", Path);
+        parsed = FALSE;
+    }
+    else
+    {
+        parsed = ParsePcapng(contents, size) || ParsePcap(contents, size);
+    }
+
+    free(contents);
+    fclose(file);
+
+    return parsed;
+}
+
+//
+// The built-in mix. Addresses that depend on the adapter are filled
+// in when the frames are readdressed.
+//
+
+static VOID
+PutIp(PUCHAR p, ULONG Ip)
+{
+    p[0] = (UCHAR)(Ip >> 24);
+    p[1] = (UCHAR)(Ip >> 16);
+    p[2] = (UCHAR)(Ip >> 8);
+    p[3] = (UCHAR)Ip;
+}
+
+static ULONG
+BuildIpv4(PUCHAR Frame, UCHAR Protocol, ULONG Source, ULONG Destination, ULONG PayloadLength)
+{
+    PUCHAR ip = Frame + ETHERNET_HEADER_SIZE;
+    ULONG totalLength = IP_HEADER_SIZE + PayloadLength;
+
+    Frame[12] = 0x08;
+    Frame[13] = 0x00;
+    ip[0] = 0x45;
+    ip[2] = (UCHAR)(totalLength >> 8);
+    ip[3] = (UCHAR)totalLength;
+    ip[8] = 128;
+    ip[9] = Protocol;
+    PutIp(ip + 12, Source);
+    PutIp(ip + 16, Destination);
+
+    return ETHERNET_HEADER_SIZE + totalLength;
+}
+
+static VOID
+BuildSyntheticCapture(VOID)
+{
+    UCHAR frame[ETHERNET_HEADER_SIZE + 4 + 1500];
+    PUCHAR p;
+    ULONG length;
+    ULONG i;
+
+    // DHCPDISCOVER, broadcast from 0.0.0.0.
+    memset(frame, 0, sizeof(frame));
+    memset(frame, 0xFF, 6);
+    length = BuildIpv4(frame, 17, 0, 0xFFFFFFFF, 8 + 240 + 4);
+    p = frame + ETHERNET_HEADER_SIZE + IP_HEADER_SIZE;
+    p[1] = 68;
+    p[3] = 67;
+    p[4] = (UCHAR)((8 + 240 + 4) >> 8);
+    p[5] = (UCHAR)(8 + 240 + 4);
+    p += 8;
+    p[0] = 1;                       // BOOTREQUEST
+    p[1] = 1;                       // Ethernet
+    p[2] = 6;
+    p[4] = 0x12;                    // xid
+    p[236] = 0x63;                  // Magic cookie
+    p[237] = 0x82;
+    p[238] = 0x53;
+    p[239] = 0x63;
+    p[240] = 53;                    // DHCP message type: DISCOVER
+    p[241] = 1;
+    p[242] = 1;
+    p[243] = 255;
+    AddFrame(frame, length);
+
+    // ARP request for the peer.
+    memset(frame, 0, sizeof(frame));
+    memset(frame, 0xFF, 6);
+    frame[12] = 0x08;
+    frame[13] = 0x06;
+    p = frame + ETHERNET_HEADER_SIZE;
+    p[1] = 1;                       // Ethernet
+    p[2] = 0x08;                    // IPv4
+    p[4] = 6;
+    p[5] = 4;
+    p[7] = 1;                       // Request
+    PutIp(p + 14, REPLAY_LOCAL_IP);
+    PutIp(p + 24, REPLAY_PEER_IP);
+    AddFrame(frame, ETHERNET_HEADER_SIZE + 28);
+
+    // IPv6 neighbor solicitation, to the solicited-node multicast.
+    memset(frame, 0, sizeof(frame));
+    frame[0] = 0x33;
+    frame[1] = 0x33;
+    frame[2] = 0xFF;
+    frame[5] = 0x01;
+    frame[12] = 0x86;
+    frame[13] = 0xDD;
+    p = frame + ETHERNET_HEADER_SIZE;
+    p[0] = 0x60;
+    p[5] = 24;                      // Payload length
+    p[6] = 58;                      // ICMPv6
+    p[7] = 255;
+    p[8] = 0xFE;                    // fe80::2
+    p[9] = 0x80;
+    p[23] = 0x02;
+    p[24] = 0xFF;                   // ff02::1:ff00:1
+    p[25] = 0x02;
+    p[35] = 0x01;
+    p[36] = 0xFF;
+    p[39] = 0x01;
+    p[40] = 135;                    // Neighbor solicitation
+    p[48] = 0xFE;                   // Target fe80::1
+    p[49] = 0x80;
+    p[63] = 0x01;
+    AddFrame(frame, ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE + 24);
+
+    // A bulk TCP transfer to the peer: full segments and ACKs.
+    for(i = 0; i < 8; ++i)
+    {
+        memset(frame, 0, sizeof(frame));
+        frame[5] = 0x01;
+        length = BuildIpv4(frame, 6, REPLAY_LOCAL_IP, REPLAY_PEER_IP,
+            (i & 1) ? 20 : 1480);
+        p = frame + ETHERNET_HEADER_SIZE + IP_HEADER_SIZE;
+        p[1] = 80;
+        p[12] = 0x50;               // Header length
+        p[13] = 0x10;               // ACK
+        AddFrame(frame, max(length, 60));
+    }
+
+    // The same, over IPv6.
+    for(i = 0; i < 4; ++i)
+    {
+        ULONG payloadLength = (i & 1) ? 20 : 1440;
+
+        memset(frame, 0, sizeof(frame));
+        frame[5] = 0x01;
+        frame[12] = 0x86;
+        frame[13] = 0xDD;
+        p = frame + ETHERNET_HEADER_SIZE;
+        p[0] = 0x60;
+        p[4] = (UCHAR)(payloadLength >> 8);
+        p[5] = (UCHAR)payloadLength;
+        p[6] = 6;
+        p[7] = 64;
+        p[8] = 0x20;                // 2001:db8::2 to 2001:db8::1
+        p[9] = 0x01;
+        p[10] = 0x0D;
+        p[11] = 0xB8;
+        p[23] = 0x02;
+        memcpy(p + 24, p + 8, 16);
+        p[39] = 0x01;
+        p[IPV6_HEADER_SIZE + 12] = 0x50;
+        p[IPV6_HEADER_SIZE + 13] = 0x10;
+        AddFrame(frame, ETHERNET_HEADER_SIZE + IPV6_HEADER_SIZE + payloadLength);
+    }
+
+    // UDP tagged with priority 5 on VLAN 0, as a priority-aware peer sends it.
+    memset(frame, 0, sizeof(frame));
+    frame[5] = 0x01;
+    length = BuildIpv4(frame + 4, 17, REPLAY_LOCAL_IP, REPLAY_PEER_IP, 8 + 172);
+    frame[12] = 0x81;
+    frame[13] = 0x00;
+    frame[14] = 5 << 5;
+    frame[15] = 0;
+    frame[16] = 0x08;
+    frame[17] = 0x00;
+    p = frame + ETHERNET_HEADER_SIZE + 4 + IP_HEADER_SIZE;
+    p[1] = 53;
+    p[3] = 53;
+    p[5] = 8 + 172;
+    AddFrame(frame, length + 4);
+}
+
+//
+// Readdressing.
+//
+
+// The Ethernet type, past any 802.1Q tag, and the tag's length.
+static ULONG
+FrameType(const REPLAY_FRAME *Frame, PULONG TagLength)
+{
+    *TagLength = 0;
+
+    if(Frame->Length < ETHERNET_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    if(Frame->Data[12] == 0x81 && Frame->Data[13] == 0x00)
+    {
+        if(Frame->Length < ETHERNET_HEADER_SIZE + 4)
+        {
+            return 0;
+        }
+
+        *TagLength = 4;
+    }
+
+    return Get16(Frame->Data + 12 + *TagLength, TRUE);
+}
+
+// The frame as the stack would send it: NULL if the stack would not.
+static PNET_BUFFER_LIST
+PrepareTransmit(PTAP_ADAPTER_CONTEXT Adapter, const REPLAY_FRAME *Frame, PUCHAR Buffer)
+{
+    NDIS_NET_BUFFER_LIST_8021Q_INFO priority;
+    PNET_BUFFER_LIST nbl;
+    ULONG tagLength;
+    ULONG type = FrameType(Frame, &tagLength);
+    ULONG length;
+
+    if(type == 0)
+    {
+        return NULL;
+    }
+
+    priority.Value = NULL;
+
+    // The stack hands the tag over in the NBL, not the frame.
+    memcpy(Buffer, Frame->Data, 12);
+    if(tagLength != 0)
+    {
+        priority.TagHeader.UserPriority = Frame->Data[14] >> 5;
+        priority.TagHeader.VlanId = Get16(Frame->Data + 14, TRUE) & 0xFFF;
+    }
+    length = Frame->Length - tagLength;
+    memcpy(Buffer + 12, Frame->Data + 12 + tagLength, length - 12);
+
+    ETH_COPY_NETWORK_ADDRESS(Buffer + 6, Adapter->CurrentAddress);
+
+    // ARP's sender and a DHCP client's chaddr name the sender as well.
+    if(type == NDIS_ETH_TYPE_ARP && length >= ETHERNET_HEADER_SIZE + 14)
+    {
+        ETH_COPY_NETWORK_ADDRESS(Buffer + ETHERNET_HEADER_SIZE + 8, Adapter->CurrentAddress);
+    }
+
+    if(type == NDIS_ETH_TYPE_IPV4
+        && length >= REPLAY_DHCP_OFFSET + 34
+        && Buffer[ETHERNET_HEADER_SIZE] == 0x45
+        && Buffer[ETHERNET_HEADER_SIZE + 9] == 17
+        && Get16(Buffer + ETHERNET_HEADER_SIZE + IP_HEADER_SIZE + 2, TRUE) == 67)
+    {
+        ETH_COPY_NETWORK_ADDRESS(Buffer + REPLAY_DHCP_OFFSET + 28, Adapter->CurrentAddress);
+    }
+
+    if(Adapter->m_tun
+        && (type == NDIS_ETH_TYPE_IPV4 || type == NDIS_ETH_TYPE_IPV6)
+        && !ETH_IS_MULTICAST(Buffer))
+    {
+        ETH_COPY_NETWORK_ADDRESS(Buffer, Adapter->m_TapToUser.dest);
+    }
+
+    nbl = WdkHostAllocateNetBufferList(Buffer, length);
+    NET_BUFFER_LIST_INFO(nbl, Ieee8021QNetBufferListInfo) = priority.Value;
+
+    return nbl;
+}
+
+// The frame as the user would write it, in Buffer: 0 if it would not.
+static ULONG
+PrepareWrite(PTAP_ADAPTER_CONTEXT Adapter, const REPLAY_FRAME *Frame, PUCHAR Buffer)
+{
+    ULONG tagLength;
+    ULONG type = FrameType(Frame, &tagLength);
+    ULONG offset;
+
+    if(type == 0)
+    {
+        return 0;
+    }
+
+    if(Adapter->m_tun)
+    {
+        if(type != NDIS_ETH_TYPE_IPV4 && type != NDIS_ETH_TYPE_IPV6)
+        {
+            return 0;
+        }
+
+        offset = ETHERNET_HEADER_SIZE + tagLength;
+        memcpy(Buffer, Frame->Data + offset, Frame->Length - offset);
+        return Frame->Length - offset;
+    }
+
+    memcpy(Buffer, Frame->Data, Frame->Length);
+
+    if(!ETH_IS_MULTICAST(Buffer))
+    {
+        ETH_COPY_NETWORK_ADDRESS(Buffer, Adapter->CurrentAddress);
+    }
+
+    return Frame->Length;
+}
+
+//
+// The stack's side: send completions and receive indications.
+//
+
+static VOID
+FreeSentNetBufferLists(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+
+        NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) = NULL;
+        WdkHostFreeNetBufferList(NetBufferLists);
+        NetBufferLists = next;
+    }
+}
+
+static VOID
+HoldIndicatedNetBufferLists(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    IndicatedCount += NumberOfNetBufferLists;
+
+    // The driver takes these back when the indication returns.
+    if(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES)
+    {
+        return;
+    }
+
+    *IndicatedTail = NetBufferLists;
+    while(*IndicatedTail != NULL)
+    {
+        IndicatedTail = &NET_BUFFER_LIST_NEXT_NBL(*IndicatedTail);
+    }
+}
+
+// Returns what the driver indicated, as the stack would once done.
+static VOID
+ReturnIndicated(PTAP_ADAPTER_CONTEXT Adapter)
+{
+    WdkHostRunDpcs();
+
+    if(Indicated != NULL)
+    {
+        PNET_BUFFER_LIST nbls = Indicated;
+
+        Indicated = NULL;
+        IndicatedTail = &Indicated;
+        TapHostReturn(Adapter, nbls);
+    }
+}
+
+//
+// The user's side: reads kept pending.
+//
+
+typedef struct _REPLAY_READER
+{
+    PFILE_OBJECT    File;
+    PIRP            Irps[REPLAY_READS];
+    PUCHAR          Buffers[REPLAY_READS];
+    ULONG           Frames;
+} REPLAY_READER;
+
+// Reaps completed reads and reads again until each read pends.
+static VOID
+DrainReads(REPLAY_READER *Reader)
+{
+    ULONG i;
+
+    WdkHostRunDpcs();
+
+    for(i = 0; i < REPLAY_READS; ++i)
+    {
+        for(;;)
+        {
+            NTSTATUS status;
+
+            if(Reader->Irps[i] != NULL)
+            {
+                if(!Reader->Irps[i]->HostCompleted)
+                {
+                    break;
+                }
+
+                if(NT_SUCCESS(Reader->Irps[i]->IoStatus.Status))
+                {
+                    ++Reader->Frames;
+                }
+
+                WdkHostFreeIrp(Reader->Irps[i]);
+                Reader->Irps[i] = NULL;
+            }
+
+            status = TapHostRead(Reader->File, Reader->Buffers[i], REPLAY_READ_SIZE, &Reader->Irps[i]);
+
+            if(status != STATUS_PENDING)
+            {
+                CHECK(Reader->Irps[i] == NULL);
+
+                if(!NT_SUCCESS(status))
+                {
+                    break;
+                }
+
+                ++Reader->Frames;
+            }
+        }
+    }
+}
+
+//
+// Statistics.
+//
+
+static VOID
+ControlStageStats(PFILE_OBJECT File, ULONG Flags, ULONG SampleInterval)
+{
+    union
+    {
+        TAP_WIN_STAGE_STATS_CONTROL control;
+        TAP_WIN_STAGE_STATS         stats;
+    } buffer;
+
+    buffer.control.Flags = Flags;
+    buffer.control.SampleInterval = SampleInterval;
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_STAGE_STATS, &buffer,
+        sizeof(buffer.control), sizeof(buffer.stats), NULL), STATUS_SUCCESS);
+}
+
+static VOID
+ReportStats(PFILE_OBJECT File)
+{
+    TAP_WIN_STAGE_STATS stages;
+    TAP_WIN_DROP_STATS drops;
+    ULONG i;
+
+    memset(&stages, 0, sizeof(stages));
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_STAGE_STATS, &stages,
+        0, sizeof(stages), NULL), STATUS_SUCCESS);
+
+    for(i = 0; i < TAP_WIN_STAGE_COUNT; ++i)
+    {
+        if(stages.Stages[i].Samples != 0)
+        {
+            printf("    %-25s %10llu samples %10.0f cycles mean\n", StageNames[i],
+                (unsigned long long)stages.Stages[i].Samples,
+                (double)stages.Stages[i].Cycles / (double)stages.Stages[i].Samples);
+        }
+    }
+
+    memset(&drops, 0, sizeof(drops));
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_DROP_STATS, &drops,
+        0, sizeof(drops), NULL), STATUS_SUCCESS);
+
+    for(i = 0; i < TAP_WIN_DROP_COUNT; ++i)
+    {
+        if(drops.Drops[i] != 0)
+        {
+            printf("    drop %-20s %10llu\n", DropNames[i],
+                (unsigned long long)drops.Drops[i]);
+        }
+    }
+
+    if(drops.Handled != 0)
+    {
+        printf("    %-25s %10llu\n", "handled",
+            (unsigned long long)drops.Handled);
+    }
+}
+
+//
+// The replay.
+//
+
+static VOID
+ConfigureMode(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, const REPLAY_MODE *Mode)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value;
+    IPADDR addresses[4];
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+
+    value = Mode->PriorityBehavior;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_PRIORITY_BEHAVIOR, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    if(Mode->Tun)
+    {
+        addresses[0] = htonl(REPLAY_LOCAL_IP);
+        addresses[1] = htonl(REPLAY_PEER_IP);
+        addresses[2] = 0xFFFFFFFF;
+        CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_TUN, addresses,
+            3 * sizeof(IPADDR), sizeof(ULONG), NULL), STATUS_SUCCESS);
+    }
+
+    if(Mode->DhcpMasq)
+    {
+        addresses[0] = htonl(REPLAY_LOCAL_IP);
+        addresses[1] = htonl(0xFFFFFF00);
+        addresses[2] = htonl(REPLAY_PEER_IP);
+        addresses[3] = 3600;
+        CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, addresses,
+            4 * sizeof(IPADDR), sizeof(ULONG), NULL), STATUS_SUCCESS);
+    }
+
+    value = TRUE;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+}
+
+static VOID
+ReplayTransmit(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, ULONG Frames)
+{
+    REPLAY_READER reader;
+    PUCHAR buffer = malloc(REPLAY_READ_SIZE);
+    ULONGLONG start;
+    ULONGLONG elapsed;
+    ULONG sent = 0;
+    ULONG i;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.File = File;
+    for(i = 0; i < REPLAY_READS; ++i)
+    {
+        reader.Buffers[i] = malloc(REPLAY_READ_SIZE);
+    }
+
+    DrainReads(&reader);
+
+    start = NowNs();
+
+    while(sent < Frames)
+    {
+        PNET_BUFFER_LIST batch = NULL;
+        PNET_BUFFER_LIST *tail = &batch;
+        ULONG count;
+
+        for(count = 0; count < REPLAY_BATCH && sent < Frames; ++sent)
+        {
+            PNET_BUFFER_LIST nbl = PrepareTransmit(Adapter, &Capture[sent % FrameCount], buffer);
+
+            if(nbl != NULL)
+            {
+                *tail = nbl;
+                tail = &NET_BUFFER_LIST_NEXT_NBL(nbl);
+                ++count;
+            }
+        }
+
+        if(batch != NULL)
+        {
+            TapHostSend(Adapter, batch);
+        }
+
+        DrainReads(&reader);
+        ReturnIndicated(Adapter);
+    }
+
+    elapsed = NowNs() - start;
+
+    printf("  transmit: %u frames, %.0f ns/frame, %u read, %u indicated\n",
+        Frames, (double)elapsed / Frames, reader.Frames, IndicatedCount);
+
+    // Closing the handle completes the reads still pending.
+    TapHostClose(File);
+
+    for(i = 0; i < REPLAY_READS; ++i)
+    {
+        if(reader.Irps[i] != NULL)
+        {
+            CHECK(reader.Irps[i]->HostCompleted);
+            WdkHostFreeIrp(reader.Irps[i]);
+        }
+
+        free(reader.Buffers[i]);
+    }
+
+    free(buffer);
+}
+
+static VOID
+ReplayWrite(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, ULONG Frames)
+{
+    PUCHAR buffer = malloc(REPLAY_READ_SIZE);
+    ULONGLONG start;
+    ULONGLONG elapsed;
+    ULONG written = 0;
+    ULONG i;
+
+    IndicatedCount = 0;
+
+    start = NowNs();
+
+    for(i = 0; i < Frames; ++i)
+    {
+        ULONG length = PrepareWrite(Adapter, &Capture[i % FrameCount], buffer);
+        PIRP irp = NULL;
+
+        if(length == 0)
+        {
+            continue;
+        }
+
+        // Pends until the stack returns the NBL.
+        if(TapHostWrite(File, buffer, length, &irp) == STATUS_PENDING)
+        {
+            ReturnIndicated(Adapter);
+            CHECK(irp->HostCompleted);
+            WdkHostFreeIrp(irp);
+        }
+
+        ++written;
+    }
+
+    elapsed = NowNs() - start;
+
+    printf("  write: %u frames, %.0f ns/frame, %u indicated\n",
+        written, written ? (double)elapsed / written : 0.0, IndicatedCount);
+
+    free(buffer);
+}
+
+static VOID
+ReplayMode(const REPLAY_MODE *Mode, ULONG Index, ULONG Frames)
+{
+    PTAP_ADAPTER_CONTEXT adapter;
+    PFILE_OBJECT file;
+    PFILE_OBJECT control;
+
+    adapter = TapHostCreateAdapter(Index);
+    CHECK(adapter != NULL);
+
+    // Statistics are read on the diag device, which stays open while
+    // the replays open and close the (exclusive) TAP device.
+    control = TapHostOpen(adapter->DiagDeviceObject);
+    CHECK(control != NULL);
+
+    printf("%s:\n", Mode->Name);
+
+    file = TapHostOpen(adapter->DeviceObject);
+    CHECK(file != NULL);
+    ConfigureMode(adapter, file, Mode);
+    ControlStageStats(control, TAP_WIN_STAGE_STATS_SET_INTERVAL | TAP_WIN_STAGE_STATS_RESET, 1);
+
+    IndicatedCount = 0;
+    ReplayTransmit(adapter, file, Frames);
+    ReportStats(control);
+
+    // Reset, and write on a fresh handle with the same configuration.
+    ControlStageStats(control, TAP_WIN_STAGE_STATS_SET_INTERVAL | TAP_WIN_STAGE_STATS_RESET, 1);
+    {
+        TAP_WIN_DROP_STATS drops;
+        ULONG flags = TAP_WIN_DROP_STATS_RESET;
+
+        memcpy(&drops, &flags, sizeof(flags));
+        CHECK_EQ(TapHostIoctl(control, TAP_WIN_IOCTL_GET_DROP_STATS, &drops,
+            sizeof(flags), sizeof(drops), NULL), STATUS_SUCCESS);
+    }
+
+    file = TapHostOpen(adapter->DeviceObject);
+    CHECK(file != NULL);
+    ConfigureMode(adapter, file, Mode);
+
+    ReplayWrite(adapter, file, Frames);
+    ReportStats(control);
+
+    TapHostClose(file);
+    TapHostClose(control);
+    ReturnIndicated(adapter);
+
+    TapHostHaltAdapter(adapter);
+}
+
+int
+main(int argc, char **argv)
+{
+    BOOLEAN quick = FALSE;
+    ULONG passes = 0;
+    ULONG frames;
+    ULONG i;
+    int arg;
+
+    for(arg = 1; arg < argc; ++arg)
+    {
+        if(strcmp(argv[arg], "--quick") == 0)
+        {
+            quick = TRUE;
+        }
+        else if(strcmp(argv[arg], "--passes") == 0 && arg + 1 < argc)
+        {
+            passes = (ULONG)strtoul(argv[++arg], NULL, 0);
+        }
+        else if(!LoadCapture(argv[arg]))
+        {
+            fprintf(stderr, "usage: pcap_replay [--quick] [--passes N] [capture.pcap | capture.pcapng]\n");
+            return 2;
+        }
+    }
+
+    if(FrameCount == 0)
+    {
+        BuildSyntheticCapture();
+    }
+
+    if(passes != 0)
+    {
+        frames = passes * FrameCount;
+    }
+    else if(quick)
+    {
+        frames = FrameCount;
+    }
+    else
+    {
+        frames = max(FrameCount, REPLAY_FULL_FRAMES);
+    }
+
+    printf("%u frames in the capture, %u replayed per path\n", FrameCount, frames);
+
+    WdkHostSetSendCompleteHook(FreeSentNetBufferLists, NULL);
+    WdkHostSetReceiveHook(HoldIndicatedNetBufferLists, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+
+    for(i = 0; i < ARRAYSIZE(ReplayModes); ++i)
+    {
+        ReplayMode(&ReplayModes[i], i + 1, frames);
+    }
+
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.Mdls, 0);
+
+    for(i = 0; i < FrameCount; ++i)
+    {
+        free(Capture[i].Data);
+    }
+    free(Capture);
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// What a trace point costs: a record written to the CPU's ring, one
+// dropped by the rate limit, one compiled out by TAP_TRACE_LEVEL, and
+// for comparison the formatted text line the ring replaced. Then the
+// rate-limited path on several threads at once, each its own CPU,
+// which should not slow down as threads are added.
+//
+//  trace_overhead [--quick]
+//======================================================================
+
+#include "taphost.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define OVERHEAD_MAX_THREADS    8
+
+// One clock tick, as KeQueryTickCount counts them on the host.
+#define OVERHEAD_TICK           156250
+
+static ULONG Iterations = 10000000;
+static volatile LONG Ready;
+static volatile BOOLEAN Go;
+
+static ULONGLONG
+NowNs(VOID)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ull + (ULONGLONG)ts.tv_nsec;
+}
+
+static VOID
+Report(const char *Name, ULONGLONG Elapsed, ULONG Count)
+{
+    printf("  %-40s %8.1f ns\n", Name, (double)Elapsed / Count);
+}
+
+// Records within the rate limit: a fresh tick (untimed) before each
+// TAP_TRACE_RATE_LIMIT of them.
+static VOID
+MeasureRecorded(VOID)
+{
+    ULONGLONG elapsed = 0;
+    ULONG count = 0;
+
+    while(count < Iterations)
+    {
+        ULONGLONG start;
+        ULONG i;
+
+        WdkHostAdvanceClock(OVERHEAD_TICK);
+
+        start = NowNs();
+        for(i = 0; i < TAP_TRACE_RATE_LIMIT; ++i)
+        {
+            TAP_TRACE_INFO (TAP_WIN_TRACE_TX_QUEUE_MAX, i, count);
+        }
+        elapsed += NowNs() - start;
+
+        count += TAP_TRACE_RATE_LIMIT;
+    }
+
+    Report("recorded", elapsed, count);
+}
+
+static VOID
+MeasureSuppressed(VOID)
+{
+    ULONGLONG start;
+    ULONG i;
+
+    // Use up this tick's records first.
+    WdkHostAdvanceClock(OVERHEAD_TICK);
+    for(i = 0; i < TAP_TRACE_RATE_LIMIT; ++i)
+    {
+        TAP_TRACE_INFO (TAP_WIN_TRACE_TX_QUEUE_MAX, i, 0);
+    }
+
+    start = NowNs();
+    for(i = 0; i < Iterations; ++i)
+    {
+        TAP_TRACE_INFO (TAP_WIN_TRACE_TX_QUEUE_MAX, i, 0);
+    }
+    Report("suppressed by the rate limit", NowNs() - start, Iterations);
+}
+
+static VOID
+MeasureCompiledOut(VOID)
+{
+    ULONGLONG start;
+    ULONG i;
+
+    CHECK(TAP_WIN_TRACE_LEVEL_VERBOSE > TAP_TRACE_LEVEL);
+
+    start = NowNs();
+    for(i = 0; i < Iterations; ++i)
+    {
+        TAP_TRACE_VERBOSE (TAP_WIN_TRACE_TX_QUEUE_MAX, i, 0);
+        __asm__ __volatile__("" ::: "memory");
+    }
+    Report("verbose, compiled out", NowNs() - start, Iterations);
+}
+
+static VOID
+MeasureTextLine(VOID)
+{
+    char line[256];
+    ULONGLONG start;
+    ULONG i;
+    ULONG count = Iterations / 10;
+
+    start = NowNs();
+    for(i = 0; i < count; ++i)
+    {
+        RtlStringCchPrintfA(line, sizeof(line),
+            "[TAP] %I64u cpu=%u L%u %s %I64x %I64x %I64x %I64x",
+            (ULONG64)KeQueryPerformanceCounter(NULL).QuadPart, 0, 3, "TX_QUEUE_MAX",
+            (ULONG64)i, (ULONG64)count, 0ull, 0ull);
+        __asm__ __volatile__("" : : "r"(line) : "memory");
+    }
+    Report("text line (for comparison)", NowNs() - start, count);
+}
+
+typedef struct _OVERHEAD_THREAD
+{
+    pthread_t       Thread;
+    ULONG           Cpu;
+    ULONGLONG       Elapsed;
+} OVERHEAD_THREAD;
+
+static void *
+SuppressedThread(void *Context)
+{
+    OVERHEAD_THREAD *thread = Context;
+    ULONGLONG start;
+    ULONG i;
+
+    WdkHostSetCurrentProcessor(thread->Cpu);
+
+    for(i = 0; i < TAP_TRACE_RATE_LIMIT; ++i)
+    {
+        TAP_TRACE_INFO (TAP_WIN_TRACE_TX_QUEUE_MAX, i, 0);
+    }
+
+    InterlockedIncrement(&Ready);
+    while(!Go)
+    {
+    }
+
+    start = NowNs();
+    for(i = 0; i < Iterations; ++i)
+    {
+        TAP_TRACE_INFO (TAP_WIN_TRACE_TX_QUEUE_MAX, i, 0);
+    }
+    thread->Elapsed = NowNs() - start;
+
+    return NULL;
+}
+
+static VOID
+MeasureThreads(ULONG Count)
+{
+    OVERHEAD_THREAD threads[OVERHEAD_MAX_THREADS];
+    ULONGLONG elapsed = 0;
+    char name[64];
+    ULONG i;
+
+    WdkHostAdvanceClock(OVERHEAD_TICK);
+
+    Ready = 0;
+    Go = FALSE;
+
+    for(i = 0; i < Count; ++i)
+    {
+        threads[i].Cpu = 1 + i;
+        CHECK_EQ(pthread_create(&threads[i].Thread, NULL, SuppressedThread, &threads[i]), 0);
+    }
+
+    while(Ready != (LONG)Count)
+    {
+    }
+    Go = TRUE;
+
+    for(i = 0; i < Count; ++i)
+    {
+        CHECK_EQ(pthread_join(threads[i].Thread, NULL), 0);
+        elapsed += threads[i].Elapsed;
+    }
+
+    snprintf(name, sizeof(name), "suppressed, %u threads (mean per thread)", Count);
+    Report(name, elapsed / Count, Iterations);
+}
+
+int
+main(int argc, char **argv)
+{
+    TAP_WIN_TRACE_HEADER header;
+    ULONG i;
+
+    if(argc > 1 && strcmp(argv[1], "--quick") == 0)
+    {
+        Iterations = 100000;
+    }
+
+    WdkHostSetProcessorCount(1 + OVERHEAD_MAX_THREADS);
+    WdkHostFreezeClock(1000000);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+
+    printf("per trace point, TAP_TRACE_LEVEL %u:\n", TAP_TRACE_LEVEL);
+
+    MeasureRecorded();
+    MeasureSuppressed();
+    MeasureCompiledOut();
+    MeasureTextLine();
+
+    for(i = 1; i <= OVERHEAD_MAX_THREADS; i *= 2)
+    {
+        MeasureThreads(i);
+    }
+
+    // Everything past the ring or the rate limit was counted.
+    tapTraceRead((PUCHAR)&header, sizeof(header));
+    CHECK(header.RecordsLost != 0);
+    CHECK(header.RecordsSuppressed != 0);
+
+    TapHostUnloadDriver();
+
+    return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The classic BPF verifier and interpreter in bpf.c.
+//======================================================================
+
+#include "taphost.h"
+
+// Classic BPF encodings, as in <net/bpf.h>.
+#define LD_W_ABS    0x20
+#define LD_H_ABS    0x28
+#define LD_B_ABS    0x30
+#define LD_W_IND    0x40
+#define LD_H_IND    0x48
+#define LD_B_IND    0x50
+#define LD_W_LEN    0x80
+#define LD_IMM      0x00
+#define LD_MEM      0x60
+#define LDX_IMM     0x01
+#define LDX_MSH     0xb1
+#define ST          0x02
+#define ALU_ADD_K   0x04
+#define ALU_DIV_K   0x34
+#define ALU_DIV_X   0x3c
+#define ALU_LSH_K   0x64
+#define JMP_JA      0x05
+#define JMP_JEQ_K   0x15
+#define RET_K       0x06
+#define RET_A       0x16
+#define MISC_TAX    0x07
+#define MISC_TXA    0x87
+
+#define STMT(code, k)           { (code), 0, 0, (k) }
+#define JUMP(code, k, jt, jf)   { (code), (jt), (jf), (k) }
+
+static NTSTATUS
+Compile(const TAP_WIN_BPF_INSN *Code, ULONG Count, PTAP_BPF_PROGRAM *Program)
+{
+    NTSTATUS status = tapBpfCompile(Code, Count, Program);
+
+    CHECK(NT_SUCCESS(status) == (*Program != NULL));
+    return status;
+}
+
+static BOOLEAN
+Rejected(const TAP_WIN_BPF_INSN *Code, ULONG Count)
+{
+    PTAP_BPF_PROGRAM program;
+    NTSTATUS status = Compile(Code, Count, &program);
+
+    if(program != NULL)
+    {
+        tapBpfFree(program);
+    }
+
+    return status == STATUS_INVALID_PARAMETER;
+}
+
+static ULONG
+Run(const TAP_WIN_BPF_INSN *Code, ULONG Count,
+    const UCHAR *Frame, ULONG ViewLength, ULONG WireLength)
+{
+    PTAP_BPF_PROGRAM program;
+    ULONG result;
+
+    CHECK_EQ(Compile(Code, Count, &program), STATUS_SUCCESS);
+    result = tapBpfRun(program, Frame, ViewLength, WireLength);
+    tapBpfFree(program);
+
+    return result;
+}
+
+#define REJECTED(...)                                                       \
+    do                                                                      \
+    {                                                                       \
+        static const TAP_WIN_BPF_INSN code_[] = { __VA_ARGS__ };            \
+        CHECK(Rejected(code_, ARRAYSIZE(code_)));                           \
+    } while(0)
+
+#define RUN(frame, view, wire, ...)                                         \
+    ({                                                                      \
+        static const TAP_WIN_BPF_INSN code_[] = { __VA_ARGS__ };            \
+        Run(code_, ARRAYSIZE(code_), (frame), (view), (wire));              \
+    })
+
+static VOID
+TestVerifier(VOID)
+{
+    static const TAP_WIN_BPF_INSN accept[] = { STMT(RET_K, 0xFFFF) };
+    TAP_WIN_BPF_INSN *tooLong;
+    PTAP_BPF_PROGRAM program;
+    ULONG i;
+
+    CHECK_EQ(Compile(accept, 0, &program), STATUS_INVALID_PARAMETER);
+
+    tooLong = calloc(TAP_WIN_FILTER_MAX_INSTRUCTIONS + 1, sizeof(TAP_WIN_BPF_INSN));
+    for(i = 0; i <= TAP_WIN_FILTER_MAX_INSTRUCTIONS; ++i)
+    {
+        tooLong[i].code = RET_K;
+    }
+    CHECK(Rejected(tooLong, TAP_WIN_FILTER_MAX_INSTRUCTIONS + 1));
+    CHECK(!Rejected(tooLong, TAP_WIN_FILTER_MAX_INSTRUCTIONS));
+    free(tooLong);
+
+    // Must end in a return.
+    REJECTED(STMT(LD_IMM, 1));
+    REJECTED(STMT(RET_K, 0), STMT(LD_IMM, 1));
+
+    // Jumps forward, inside the program.
+    REJECTED(STMT(JMP_JA, 1), STMT(RET_K, 0));
+    REJECTED(JUMP(JMP_JEQ_K, 0, 1, 0), STMT(RET_K, 0));
+    REJECTED(JUMP(JMP_JEQ_K, 0, 0, 1), STMT(RET_K, 0));
+    CHECK(!Rejected((TAP_WIN_BPF_INSN[]){ JUMP(JMP_JEQ_K, 0, 1, 0), STMT(RET_K, 0), STMT(RET_K, 1) }, 3));
+
+    // Scratch memory indexes, constant divisors and shift counts.
+    REJECTED(STMT(ST, TAP_BPF_MEMWORDS), STMT(RET_K, 0));
+    REJECTED(STMT(LD_MEM, TAP_BPF_MEMWORDS), STMT(RET_K, 0));
+    REJECTED(STMT(ALU_DIV_K, 0), STMT(RET_K, 0));
+    REJECTED(STMT(ALU_LSH_K, 32), STMT(RET_K, 0));
+
+    // Unknown opcodes.
+    REJECTED(STMT(0xFFFF, 0), STMT(RET_K, 0));
+    REJECTED(STMT(LD_W_ABS | 0x18, 0), STMT(RET_K, 0));
+
+    CHECK_EQ(Compile(accept, 1, &program), STATUS_SUCCESS);
+    tapBpfFree(program);
+}
+
+static VOID
+TestLoads(VOID)
+{
+    UCHAR frame[64];
+    ULONG i;
+
+    for(i = 0; i < sizeof(frame); ++i)
+    {
+        frame[i] = (UCHAR)i;
+    }
+
+    // Absolute loads are big-endian.
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LD_W_ABS, 12), STMT(RET_A, 0)), 0x0C0D0E0F);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LD_H_ABS, 12), STMT(RET_A, 0)), 0x0C0D);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LD_B_ABS, 63), STMT(RET_A, 0)), 63);
+    CHECK_EQ(RUN(frame, 64, 1000, STMT(LD_W_LEN, 0), STMT(RET_A, 0)), 1000);
+
+    // Indexed loads.
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 10), STMT(LD_W_IND, 2), STMT(RET_A, 0)), 0x0C0D0E0F);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 10), STMT(LD_H_IND, 2), STMT(RET_A, 0)), 0x0C0D);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 10), STMT(LD_B_IND, 2), STMT(RET_A, 0)), 12);
+
+    // Past the view but inside the frame: can't tell, so keep it all.
+    CHECK_EQ(RUN(frame, 32, 64, STMT(LD_W_ABS, 30), STMT(RET_K, 1)), 64);
+    CHECK_EQ(RUN(frame, 32, 64, STMT(LDX_IMM, 30), STMT(LD_B_IND, 2), STMT(RET_K, 1)), 64);
+
+    // Past the frame: drop it.
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LD_W_ABS, 61), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LD_B_ABS, MAXULONG), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 60), STMT(LD_W_IND, 1), STMT(RET_K, 1)), 0);
+
+    // X + k wrapping around to a small offset inside the frame is past
+    // it, not a load of frame[(X + k) mod 2^32].
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 0xFFFFFFF0), STMT(LD_W_IND, 0x14), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 0xFFFFFFF0), STMT(LD_H_IND, 0x14), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 0xFFFFFFF0), STMT(LD_B_IND, 0x14), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 1), STMT(LD_B_IND, MAXULONG), STMT(RET_K, 1)), 0);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_IMM, 0), STMT(LD_B_IND, MAXULONG), STMT(RET_K, 1)), 0);
+
+    // And the same wrap with a view shorter than the frame does not keep it.
+    CHECK_EQ(RUN(frame, 32, 64, STMT(LDX_IMM, MAXULONG), STMT(LD_B_IND, 2), STMT(RET_K, 1)), 0);
+
+    // The IPv4 header length idiom.
+    frame[14] = 0x46;
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_MSH, 14), STMT(MISC_TXA, 0), STMT(RET_A, 0)), 24);
+    CHECK_EQ(RUN(frame, 64, 64, STMT(LDX_MSH, 64), STMT(RET_K, 1)), 0);
+}
+
+static VOID
+TestAlu(VOID)
+{
+    UCHAR frame[1] = { 0 };
+
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 7), STMT(ALU_ADD_K, 5), STMT(RET_A, 0)), 12);
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 7), STMT(ALU_LSH_K, 31), STMT(RET_A, 0)), 0x80000000);
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 9), STMT(ALU_DIV_K, 2), STMT(RET_A, 0)), 4);
+
+    // Division by a zero X rejects the frame.
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 9), STMT(LDX_IMM, 0), STMT(ALU_DIV_X, 0), STMT(RET_K, 1)), 0);
+
+    // Scratch memory starts zeroed; ST and LD round trip.
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_MEM, 3), STMT(RET_A, 0)), 0);
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 42), STMT(ST, 15), STMT(LD_IMM, 0),
+        STMT(LD_MEM, 15), STMT(RET_A, 0)), 42);
+
+    // Conditional jumps and TAX.
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 5), STMT(MISC_TAX, 0),
+        JUMP(JMP_JEQ_K, 5, 0, 1), STMT(RET_K, 100), STMT(RET_K, 200)), 100);
+    CHECK_EQ(RUN(frame, 1, 1, STMT(LD_IMM, 6),
+        JUMP(JMP_JEQ_K, 5, 0, 1), STMT(RET_K, 100), STMT(RET_K, 200)), 200);
+    CHECK_EQ(RUN(frame, 1, 1, STMT(JMP_JA, 1), STMT(RET_K, 100), STMT(RET_K, 200)), 200);
+}
+
+int
+main(void)
+{
+    TestVerifier();
+    TestLoads();
+    TestAlu();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
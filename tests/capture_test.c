@@ -0,0 +1,759 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Frame capture (capture.c) end to end: frames sent by the host and
+// written on the TAP handle are captured, drained through the diag
+// device in small reads, and the concatenated output is read back with
+// a strict pcapng parser. Block framing, the section and interface
+// headers, each enhanced packet block's fields and data, the statistics
+// block after an overflow, and 1-in-N sampling are all checked.
+//======================================================================
+
+#include "taphost.h"
+
+// The frozen clock, and the pcapng timestamp it gives (100ns since 1970).
+#define CAPTURE_NOW             5000000000ull
+#define CAPTURE_PCAPNG_TIME     (132223104000000000ull + CAPTURE_NOW - 116444736000000000ull)
+
+#define CAPTURE_MAX_FRAMES      2048
+#define CAPTURE_MAX_OUTPUT      (4 * 1024 * 1024)
+
+#define CAPTURE_PORT_MATCH      5000
+#define CAPTURE_PORT_OTHER      6000
+
+//
+// pcapng, as the parser expects it.
+//
+
+#define SHB_TYPE                0x0A0D0D0A
+#define IDB_TYPE                0x00000001
+#define ISB_TYPE                0x00000005
+#define EPB_TYPE                0x00000006
+
+#define OPT_ENDOFOPT            0
+#define OPT_IF_TSRESOL          9
+#define OPT_EPB_FLAGS           2
+#define OPT_ISB_IFRECV          4
+#define OPT_ISB_IFDROP          5
+
+typedef struct _PARSED_FRAME
+{
+    ULONG64     Timestamp;
+    ULONG       CapturedLength;
+    ULONG       OriginalLength;
+    ULONG       Flags;              // epb_flags, 0 if absent
+    const UCHAR *Data;
+} PARSED_FRAME;
+
+typedef struct _PARSED_CAPTURE
+{
+    ULONG           SnapLength;
+    ULONG           TsResol;
+    ULONG           FrameCount;
+    PARSED_FRAME    Frames[CAPTURE_MAX_FRAMES];
+    ULONG           StatisticsBlocks;
+    ULONG64         IfRecv;
+    ULONG64         IfDrop;
+} PARSED_CAPTURE;
+
+static PARSED_CAPTURE Parsed;
+
+static UCHAR Output[CAPTURE_MAX_OUTPUT];
+static ULONG OutputLength;
+
+// Frames sent or written since the last configure, for sampling.
+static ULONG SentCount;
+
+static ULONG
+Get32(const UCHAR *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+static USHORT
+Get16(const UCHAR *p)
+{
+    return (USHORT)(p[0] | (p[1] << 8));
+}
+
+static ULONG64
+Get64(const UCHAR *p)
+{
+    return Get32(p) | ((ULONG64)Get32(p + 4) << 32);
+}
+
+// Options from Options to End, which must close with opt_endofopt.
+// Calls back with each option; padding must be zero.
+typedef VOID PARSE_OPTION(ULONG Code, const UCHAR *Value, ULONG Length);
+
+static VOID
+ParseOptions(const UCHAR *Options, const UCHAR *End, PARSE_OPTION *Option)
+{
+    for(;;)
+    {
+        ULONG code;
+        ULONG length;
+        ULONG i;
+
+        CHECK(End - Options >= 4);
+        code = Get16(Options);
+        length = Get16(Options + 2);
+        Options += 4;
+
+        if(code == OPT_ENDOFOPT)
+        {
+            CHECK_EQ(length, 0);
+            CHECK(Options == End);
+            return;
+        }
+
+        CHECK((ULONG)(End - Options) >= ((length + 3) & ~3u));
+        Option(code, Options, length);
+
+        for(i = length; i < ((length + 3) & ~3u); ++i)
+        {
+            CHECK_EQ(Options[i], 0);
+        }
+        Options += (length + 3) & ~3u;
+    }
+}
+
+static VOID
+IdbOption(ULONG Code, const UCHAR *Value, ULONG Length)
+{
+    if(Code == OPT_IF_TSRESOL)
+    {
+        CHECK_EQ(Length, 1);
+        Parsed.TsResol = Value[0];
+    }
+}
+
+static PARSED_FRAME *CurrentFrame;
+
+static VOID
+EpbOption(ULONG Code, const UCHAR *Value, ULONG Length)
+{
+    if(Code == OPT_EPB_FLAGS)
+    {
+        CHECK_EQ(Length, 4);
+        CurrentFrame->Flags = Get32(Value);
+    }
+}
+
+static VOID
+IsbOption(ULONG Code, const UCHAR *Value, ULONG Length)
+{
+    if(Code == OPT_ISB_IFRECV)
+    {
+        CHECK_EQ(Length, 8);
+        Parsed.IfRecv = Get64(Value);
+    }
+    else if(Code == OPT_ISB_IFDROP)
+    {
+        CHECK_EQ(Length, 8);
+        Parsed.IfDrop = Get64(Value);
+    }
+}
+
+// Parses Output as one section with one Ethernet interface.
+static VOID
+Parse(VOID)
+{
+    const UCHAR *p = Output;
+    const UCHAR *end = Output + OutputLength;
+    BOOLEAN sawInterface = FALSE;
+
+    memset(&Parsed, 0, sizeof(Parsed));
+
+    // Section header block: magic, version 1.0, section length.
+    CHECK(OutputLength >= 28);
+    CHECK_EQ(Get32(p), SHB_TYPE);
+    CHECK_EQ(Get32(p + 8), 0x1A2B3C4D);
+    CHECK_EQ(Get16(p + 12), 1);
+    CHECK_EQ(Get16(p + 14), 0);
+
+    while(p < end)
+    {
+        const UCHAR *body;
+        const UCHAR *trailer;
+        ULONG type;
+        ULONG length;
+
+        // Every block: type, length, body, the length again.
+        CHECK(end - p >= 12);
+        type = Get32(p);
+        length = Get32(p + 4);
+        CHECK(length >= 12);
+        CHECK_EQ(length % 4, 0);
+        CHECK(length <= (ULONG)(end - p));
+        trailer = p + length - 4;
+        CHECK_EQ(Get32(trailer), length);
+        body = p + 8;
+
+        switch(type)
+        {
+        case SHB_TYPE:
+            // Only the one section, at the start.
+            CHECK(p == Output);
+            CHECK(length >= 28);
+            CHECK(trailer == body + 16 || trailer >= body + 20);
+            break;
+
+        case IDB_TYPE:
+            CHECK(!sawInterface);
+            CHECK(length >= 20);
+            CHECK_EQ(Get16(body), 1);       // LINKTYPE_ETHERNET
+            Parsed.SnapLength = Get32(body + 4);
+            ParseOptions(body + 8, trailer, IdbOption);
+            sawInterface = TRUE;
+            break;
+
+        case EPB_TYPE:
+            {
+                PARSED_FRAME *frame = &Parsed.Frames[Parsed.FrameCount];
+                ULONG padded;
+
+                CHECK(sawInterface);
+                CHECK(Parsed.FrameCount < CAPTURE_MAX_FRAMES);
+                CHECK(length >= 32);
+                CHECK_EQ(Get32(body), 0);   // Interface 0
+
+                frame->Timestamp = ((ULONG64)Get32(body + 4) << 32) | Get32(body + 8);
+                frame->CapturedLength = Get32(body + 12);
+                frame->OriginalLength = Get32(body + 16);
+                frame->Data = body + 20;
+                frame->Flags = 0;
+
+                CHECK(frame->CapturedLength <= frame->OriginalLength);
+                CHECK(frame->CapturedLength <= Parsed.SnapLength);
+
+                padded = (frame->CapturedLength + 3) & ~3u;
+                CHECK(body + 20 + padded <= trailer);
+
+                CurrentFrame = frame;
+                ParseOptions(body + 20 + padded, trailer, EpbOption);
+
+                ++Parsed.FrameCount;
+            }
+            break;
+
+        case ISB_TYPE:
+            CHECK(sawInterface);
+            CHECK(length >= 24);
+            CHECK_EQ(Get32(body), 0);
+            ParseOptions(body + 12, trailer, IsbOption);
+            ++Parsed.StatisticsBlocks;
+            break;
+
+        default:
+            CHECK(!"unexpected block type");
+        }
+
+        p += length;
+    }
+
+    CHECK(sawInterface);
+}
+
+//
+// The driver side.
+//
+
+// Drains the capture in reads of ReadSize bytes, appending to Output.
+static VOID
+Drain(PFILE_OBJECT Control, ULONG ReadSize)
+{
+    static UCHAR buffer[CAPTURE_MAX_OUTPUT];
+
+    for(;;)
+    {
+        ULONG_PTR information = 0;
+
+        CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+            0, ReadSize, &information), STATUS_SUCCESS);
+
+        if(information == 0)
+        {
+            break;
+        }
+
+        CHECK(information <= ReadSize);
+        CHECK(OutputLength + information <= sizeof(Output));
+        memcpy(Output + OutputLength, buffer, information);
+        OutputLength += (ULONG)information;
+    }
+}
+
+static VOID
+ConfigureSampled(PFILE_OBJECT Control, ULONG Flags, ULONG SnapLength, ULONG BufferSize,
+    USHORT EtherType, USHORT Port, ULONG SampleRate)
+{
+    TAP_WIN_CAPTURE_CONFIG config;
+
+    memset(&config, 0, sizeof(config));
+    config.Flags = Flags;
+    config.SnapLength = SnapLength;
+    config.BufferSize = BufferSize;
+    config.EtherType = EtherType;
+    config.Port = Port;
+    config.SampleRate = SampleRate;
+
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_CONFIG, &config,
+        sizeof(config), 0, NULL), STATUS_SUCCESS);
+
+    OutputLength = 0;
+    SentCount = 0;
+}
+
+static VOID
+Configure(PFILE_OBJECT Control, ULONG Flags, ULONG SnapLength, ULONG BufferSize,
+    USHORT EtherType, USHORT Port)
+{
+    ConfigureSampled(Control, Flags, SnapLength, BufferSize, EtherType, Port, 0);
+}
+
+// An Ethernet/IPv4/UDP frame of Length bytes, with a payload pattern
+// that tells frames apart.
+static ULONG
+BuildFrame(PTAP_ADAPTER_CONTEXT Adapter, UCHAR *Buffer, ULONG Length, USHORT Port,
+    ULONG Seed, BOOLEAN ToAdapter)
+{
+    ULONG i;
+
+    memset(Buffer, 0, Length);
+
+    if(ToAdapter)
+    {
+        ETH_COPY_NETWORK_ADDRESS(Buffer, Adapter->CurrentAddress);
+        memcpy(Buffer + 6, "\x02\x00\x00\x00\x00\x02", 6);
+    }
+    else
+    {
+        memcpy(Buffer, "\x02\x00\x00\x00\x00\x02", 6);
+        ETH_COPY_NETWORK_ADDRESS(Buffer + 6, Adapter->CurrentAddress);
+    }
+
+    Buffer[12] = 0x08;
+    Buffer[13] = 0x00;
+
+    Buffer[14] = 0x45;
+    Buffer[16] = (UCHAR)((Length - 14) >> 8);
+    Buffer[17] = (UCHAR)(Length - 14);
+    Buffer[22] = 64;
+    Buffer[23] = IPPROTO_UDP;
+    memcpy(Buffer + 26, "\x0a\x00\x00\x01\x0a\x00\x00\x02", 8);
+
+    Buffer[34] = (UCHAR)(Port >> 8);
+    Buffer[35] = (UCHAR)Port;
+    Buffer[36] = (UCHAR)(Port >> 8);
+    Buffer[37] = (UCHAR)Port;
+    Buffer[38] = (UCHAR)((Length - 34) >> 8);
+    Buffer[39] = (UCHAR)(Length - 34);
+
+    for(i = 42; i < Length; ++i)
+    {
+        Buffer[i] = (UCHAR)(Seed * 7 + i);
+    }
+
+    return Length;
+}
+
+static VOID
+FreeSentNetBufferLists(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+
+        NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) = NULL;
+        WdkHostFreeNetBufferList(NetBufferLists);
+        NetBufferLists = next;
+    }
+}
+
+static PNET_BUFFER_LIST Indicated;
+
+static VOID
+HoldIndicatedNetBufferLists(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(NumberOfNetBufferLists);
+
+    if(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES))
+    {
+        CHECK(Indicated == NULL);
+        Indicated = NetBufferLists;
+    }
+}
+
+// The host sends a frame to the TAP handle.
+static VOID
+Send(PTAP_ADAPTER_CONTEXT Adapter, const UCHAR *Frame, ULONG Length)
+{
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(Frame, Length));
+}
+
+// The TAP handle writes a frame to the host, which takes and returns it.
+static VOID
+Write(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, UCHAR *Frame, ULONG Length)
+{
+    PIRP irp = NULL;
+
+    if(TapHostWrite(File, Frame, Length, &irp) == STATUS_PENDING)
+    {
+        WdkHostRunDpcs();
+        CHECK(Indicated != NULL);
+        TapHostReturn(Adapter, Indicated);
+        Indicated = NULL;
+        CHECK(irp->HostCompleted);
+        WdkHostFreeIrp(irp);
+    }
+}
+
+typedef struct _SENT_FRAME
+{
+    UCHAR       Data[1514];
+    ULONG       Length;
+    ULONG       Direction;
+} SENT_FRAME;
+
+static SENT_FRAME Sent[CAPTURE_MAX_FRAMES];
+
+static VOID
+CheckFrame(const PARSED_FRAME *Frame, const SENT_FRAME *Expected, ULONG SnapLength)
+{
+    ULONG captured = min(Expected->Length, SnapLength);
+
+    CHECK_EQ(Frame->Timestamp, CAPTURE_PCAPNG_TIME);
+    CHECK_EQ(Frame->OriginalLength, Expected->Length);
+    CHECK_EQ(Frame->CapturedLength, captured);
+    CHECK(memcmp(Frame->Data, Expected->Data, captured) == 0);
+
+    // Sent by the host: outbound. Written by the TAP handle: inbound.
+    CHECK_EQ(Frame->Flags & 0x3, Expected->Direction == TAP_WIN_CAPTURE_TX ? 2 : 1);
+}
+
+// Both directions, every length parity, drained in reads that split
+// the output at arbitrary block boundaries.
+static VOID
+TestRoundTrip(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, PFILE_OBJECT Control)
+{
+    ULONG count = 200;
+    ULONG i;
+
+    Configure(Control, TAP_WIN_CAPTURE_TX | TAP_WIN_CAPTURE_RX, 0, 0, 0, 0);
+
+    for(i = 0; i < count; ++i)
+    {
+        SENT_FRAME *frame = &Sent[i];
+        BOOLEAN transmit = (i % 3) != 2;
+
+        frame->Direction = transmit ? TAP_WIN_CAPTURE_TX : TAP_WIN_CAPTURE_RX;
+        frame->Length = BuildFrame(Adapter, frame->Data, 60 + (i * 37) % (1514 - 60 + 1),
+            CAPTURE_PORT_MATCH, i, !transmit);
+
+        if(transmit)
+        {
+            Send(Adapter, frame->Data, frame->Length);
+        }
+        else
+        {
+            Write(Adapter, File, frame->Data, frame->Length);
+        }
+    }
+
+    Drain(Control, 4096);
+    Parse();
+
+    CHECK_EQ(Parsed.SnapLength, 0xFFFF);
+    CHECK_EQ(Parsed.TsResol, 7);
+    CHECK_EQ(Parsed.FrameCount, count);
+    CHECK_EQ(Parsed.StatisticsBlocks, 0);
+
+    for(i = 0; i < count; ++i)
+    {
+        CheckFrame(&Parsed.Frames[i], &Sent[i], 0xFFFF);
+    }
+
+    // Nothing more until more frames arrive; the headers are not repeated.
+    OutputLength = 0;
+    Drain(Control, 4096);
+    CHECK_EQ(OutputLength, 0);
+}
+
+// Snap length, and the EtherType and port filter.
+static VOID
+TestSnapAndFilter(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT Control)
+{
+    SENT_FRAME other;
+    ULONG count = 0;
+    ULONG i;
+
+    Configure(Control, TAP_WIN_CAPTURE_TX, 61, 0, NDIS_ETH_TYPE_IPV4, CAPTURE_PORT_MATCH);
+
+    for(i = 0; i < 50; ++i)
+    {
+        SENT_FRAME *frame = &Sent[count];
+
+        frame->Direction = TAP_WIN_CAPTURE_TX;
+        frame->Length = BuildFrame(Adapter, frame->Data, 60 + i * 29, CAPTURE_PORT_MATCH, i, FALSE);
+        Send(Adapter, frame->Data, frame->Length);
+        ++count;
+
+        // Other port, and not IPv4.
+        other.Length = BuildFrame(Adapter, other.Data, 100, CAPTURE_PORT_OTHER, i, FALSE);
+        Send(Adapter, other.Data, other.Length);
+
+        other.Length = BuildFrame(Adapter, other.Data, 100, CAPTURE_PORT_MATCH, i, FALSE);
+        other.Data[12] = 0x86;
+        other.Data[13] = 0xDD;
+        Send(Adapter, other.Data, other.Length);
+    }
+
+    Drain(Control, 1024);
+    Parse();
+
+    CHECK_EQ(Parsed.SnapLength, 61);
+    CHECK_EQ(Parsed.FrameCount, count);
+
+    for(i = 0; i < count; ++i)
+    {
+        CheckFrame(&Parsed.Frames[i], &Sent[i], 61);
+    }
+}
+
+// A ring too small for what arrives: frames that did not fit are
+// reported in a statistics block once the ring is drained.
+static VOID
+TestOverflow(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT Control)
+{
+    ULONG sent = 100;
+    ULONG i;
+
+    Configure(Control, TAP_WIN_CAPTURE_TX, 0, TAP_CAPTURE_MIN_BUFFER_SIZE, 0, 0);
+
+    for(i = 0; i < sent; ++i)
+    {
+        SENT_FRAME *frame = &Sent[i];
+
+        frame->Direction = TAP_WIN_CAPTURE_TX;
+        frame->Length = BuildFrame(Adapter, frame->Data, 1514, CAPTURE_PORT_MATCH, i, FALSE);
+        Send(Adapter, frame->Data, frame->Length);
+    }
+
+    Drain(Control, 8192);
+    Parse();
+
+    CHECK(Parsed.FrameCount > 0 && Parsed.FrameCount < sent);
+    CHECK_EQ(Parsed.StatisticsBlocks, 1);
+    CHECK_EQ(Parsed.IfRecv, Parsed.FrameCount);
+    CHECK_EQ(Parsed.IfDrop, sent - Parsed.FrameCount);
+
+    // The frames that fit are the first ones.
+    for(i = 0; i < Parsed.FrameCount; ++i)
+    {
+        CheckFrame(&Parsed.Frames[i], &Sent[i], 0xFFFF);
+    }
+
+    // The block closes the drain it reported in, and is not repeated.
+    CHECK_EQ(Get32(Output + OutputLength - 52), ISB_TYPE);
+    {
+        ULONG before = OutputLength;
+
+        Drain(Control, 8192);
+        CHECK_EQ(OutputLength, before);
+    }
+}
+
+// Sends (or, every other one, writes) Count more frames on the capture
+// port, each followed by one sent on another port, and returns how many
+// of the frames since the configure the capture has recorded; each must
+// be every Nth on the port.
+static ULONG
+SendSampled(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, PFILE_OBJECT Control,
+    ULONG Count, ULONG N)
+{
+    SENT_FRAME other;
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        SENT_FRAME *frame = &Sent[SentCount];
+        BOOLEAN transmit = (SentCount % 2) == 0;
+
+        frame->Direction = transmit ? TAP_WIN_CAPTURE_TX : TAP_WIN_CAPTURE_RX;
+        frame->Length = BuildFrame(Adapter, frame->Data, 60 + SentCount,
+            CAPTURE_PORT_MATCH, SentCount, !transmit);
+
+        if(transmit)
+        {
+            Send(Adapter, frame->Data, frame->Length);
+        }
+        else
+        {
+            Write(Adapter, File, frame->Data, frame->Length);
+        }
+
+        // Filtered out, so not counted towards the sample.
+        other.Length = BuildFrame(Adapter, other.Data, 100, CAPTURE_PORT_OTHER, i, FALSE);
+        Send(Adapter, other.Data, other.Length);
+
+        ++SentCount;
+    }
+
+    Drain(Control, 4096);
+    Parse();
+
+    CHECK_EQ(Parsed.StatisticsBlocks, 0);
+
+    for(i = 0; i < Parsed.FrameCount; ++i)
+    {
+        CheckFrame(&Parsed.Frames[i], &Sent[(i + 1) * N - 1], 0xFFFF);
+    }
+
+    return Parsed.FrameCount;
+}
+
+// SampleRate records 1 in N of the frames that pass the filter, in both
+// directions together and across drains, counting afresh on each
+// configure; 0 and 1 record all of them. A configuration shorter than
+// TAP_WIN_CAPTURE_CONFIG is refused and leaves the capture as it was.
+static VOID
+TestSampleRate(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT File, PFILE_OBJECT Control)
+{
+    TAP_WIN_CAPTURE_CONFIG config;
+    ULONG flags = TAP_WIN_CAPTURE_TX | TAP_WIN_CAPTURE_RX;
+    ULONG rates[] = {0, 1, 2, 3, 7};
+    ULONG i;
+
+    for(i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+    {
+        ULONG n = max(rates[i], 1);
+
+        ConfigureSampled(Control, flags, 0, 0, NDIS_ETH_TYPE_IPV4, CAPTURE_PORT_MATCH,
+            rates[i]);
+        CHECK_EQ(SendSampled(Adapter, File, Control, 100, n), 100 / n);
+        CHECK_EQ(SendSampled(Adapter, File, Control, 2 * n, n), 100 / n + 2);
+    }
+
+    // A partial sample does not carry over into a new configuration.
+    ConfigureSampled(Control, flags, 0, 0, NDIS_ETH_TYPE_IPV4, CAPTURE_PORT_MATCH, 4);
+    CHECK_EQ(SendSampled(Adapter, File, Control, 3, 4), 0);
+    ConfigureSampled(Control, flags, 0, 0, NDIS_ETH_TYPE_IPV4, CAPTURE_PORT_MATCH, 4);
+    CHECK_EQ(SendSampled(Adapter, File, Control, 3, 4), 0);
+    CHECK_EQ(SendSampled(Adapter, File, Control, 5, 4), 2);
+
+    ConfigureSampled(Control, flags, 0, 0, NDIS_ETH_TYPE_IPV4, CAPTURE_PORT_MATCH, 5);
+    memset(&config, 0, sizeof(config));
+    config.Flags = flags;
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_CONFIG, &config,
+        FIELD_OFFSET(TAP_WIN_CAPTURE_CONFIG, SampleRate), 0, NULL), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_CONFIG, &config,
+        sizeof(config) - 1, 0, NULL), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(SendSampled(Adapter, File, Control, 20, 5), 4);
+}
+
+// Reads too short for a block, and reads without a capture.
+static VOID
+TestReadErrors(PTAP_ADAPTER_CONTEXT Adapter, PFILE_OBJECT Control)
+{
+    UCHAR buffer[2048];
+    UCHAR frame[1514];
+    ULONG_PTR information;
+
+    Configure(Control, TAP_WIN_CAPTURE_TX, 0, 0, 0, 0);
+
+    // The section and interface headers need 60 bytes.
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+        0, 59, &information), STATUS_BUFFER_TOO_SMALL);
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+        0, 60, &information), STATUS_SUCCESS);
+    CHECK_EQ(information, 60);
+
+    // A 1514 byte frame's block is 1560 bytes.
+    Send(Adapter, frame, BuildFrame(Adapter, frame, 1514, CAPTURE_PORT_MATCH, 0, FALSE));
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+        0, 1559, &information), STATUS_BUFFER_TOO_SMALL);
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+        0, 1560, &information), STATUS_SUCCESS);
+    CHECK_EQ(information, 1560);
+
+    // Stopped.
+    Configure(Control, 0, 0, 0, 0, 0);
+    CHECK_EQ(TapHostIoctl(Control, TAP_WIN_IOCTL_CAPTURE_READ, buffer,
+        0, sizeof(buffer), &information), STATUS_INVALID_DEVICE_STATE);
+}
+
+int
+main(void)
+{
+    PTAP_ADAPTER_CONTEXT adapter;
+    PFILE_OBJECT file;
+    PFILE_OBJECT control;
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value = TRUE;
+
+    WdkHostFreezeClock(CAPTURE_NOW);
+    WdkHostSetSendCompleteHook(FreeSentNetBufferLists, NULL);
+    WdkHostSetReceiveHook(HoldIndicatedNetBufferLists, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+
+    adapter = TapHostCreateAdapter(1);
+    CHECK(adapter != NULL);
+
+    file = TapHostOpen(adapter->DeviceObject);
+    CHECK(file != NULL);
+    control = TapHostOpen(adapter->DiagDeviceObject);
+    CHECK(control != NULL);
+
+    CHECK_EQ(TapHostSetInformation(adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(file, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestRoundTrip(adapter, file, control);
+    TestSnapAndFilter(adapter, control);
+    TestOverflow(adapter, control);
+    TestSampleRate(adapter, file, control);
+    TestReadErrors(adapter, control);
+
+    TapHostClose(control);
+    TapHostClose(file);
+    TapHostHaltAdapter(adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
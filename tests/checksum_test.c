@@ -0,0 +1,191 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// checksum.c against the loops it replaced (oldchecksum.h), on random
+// buffers of every length and alignment the driver can hand it, and
+// the incremental updates against a full recompute.
+//======================================================================
+
+#include "taphost.h"
+#include "oldchecksum.h"
+
+#define MAX_LENGTH      2048
+
+static ULONG64 Seed = 0x9E3779B97F4A7C15ull;
+
+static ULONG
+Random(VOID)
+{
+    // xorshift64*
+    Seed ^= Seed >> 12;
+    Seed ^= Seed << 25;
+    Seed ^= Seed >> 27;
+    return (ULONG)((Seed * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static VOID
+Fill(UCHAR *Buffer, ULONG Length, int Pattern)
+{
+    ULONG i;
+
+    for(i = 0; i < Length; ++i)
+    {
+        Buffer[i] = Pattern < 0 ? (UCHAR)Random() : (UCHAR)Pattern;
+    }
+}
+
+// Every length and misalignment, with random, all-zero and all-ones data.
+static VOID
+TestEquivalence(VOID)
+{
+    static UCHAR storage[MAX_LENGTH + 16];
+    static const int patterns[] = { -1, 0x00, 0xFF };
+    UCHAR saddr[16];
+    UCHAR daddr[16];
+    ULONG p;
+
+    for(p = 0; p < ARRAYSIZE(patterns); ++p)
+    {
+        ULONG length;
+
+        for(length = 0; length <= MAX_LENGTH; ++length)
+        {
+            UCHAR *buf = storage + (length % 8);
+
+            Fill(buf, length, patterns[p]);
+            Fill(saddr, sizeof(saddr), patterns[p]);
+            Fill(daddr, sizeof(daddr), patterns[p]);
+
+            // Header lengths are whole words; the old loop skipped an
+            // odd trailing byte.
+            if((length & 1) == 0)
+            {
+                CHECK_EQ(tapChecksumIPv4Header(buf, length), ip_checksum(buf, length));
+            }
+
+            CHECK_EQ(tapChecksumIPv4Pseudo(buf, length, IPPROTO_UDP, saddr, daddr),
+                udp_checksum(buf, length, saddr, daddr));
+
+            CHECK_EQ(tapChecksumIPv6Pseudo(buf, length, IPPROTO_ICMPV6, saddr, daddr),
+                icmpv6_checksum(buf, length, saddr, daddr));
+        }
+    }
+}
+
+// A checksum summed over several buffers, each split at an even offset.
+static VOID
+TestSplit(VOID)
+{
+    UCHAR buf[MAX_LENGTH];
+    ULONG i;
+
+    for(i = 0; i < 10000; ++i)
+    {
+        ULONG length = Random() % MAX_LENGTH;
+        ULONG split = (Random() % (length + 1)) & ~1u;
+        ULONG64 sum;
+
+        Fill(buf, length, -1);
+
+        sum = tapChecksumAdd(buf, split, 0);
+        sum = tapChecksumAdd(buf + split, length - split, sum);
+
+        CHECK_EQ(tapChecksumFold(sum), tapChecksumFold(tapChecksumAdd(buf, length, 0)));
+    }
+}
+
+// RFC 1624 updates of a 16 and a 32 bit field against a recompute.
+static VOID
+TestUpdate(VOID)
+{
+    UCHAR header[20];
+    ULONG i;
+
+    for(i = 0; i < 100000; ++i)
+    {
+        ULONG offset = (Random() % 8) * 2;
+        USHORT checksum;
+        USHORT old16;
+        USHORT new16;
+        ULONG old32;
+        ULONG new32;
+
+        Fill(header, sizeof(header), -1);
+
+        // Keep one word non-zero, so that the sum is never 0 (where a
+        // recompute gives 0xFFFF and an update 0x0000, both valid).
+        header[0] |= 0x40;
+
+        checksum = tapChecksumIPv4Header(header, sizeof(header));
+
+        old16 = (header[offset + 2] << 8) | header[offset + 3];
+        new16 = (USHORT)Random();
+        header[offset + 2] = (UCHAR)(new16 >> 8);
+        header[offset + 3] = (UCHAR)new16;
+
+        checksum = tapChecksumUpdate16(checksum, old16, new16);
+        CHECK_EQ(checksum, tapChecksumIPv4Header(header, sizeof(header)));
+
+        old32 = ((ULONG)header[offset + 2] << 24) | ((ULONG)header[offset + 3] << 16) |
+            ((ULONG)header[offset + 4] << 8) | header[offset + 5];
+        new32 = Random();
+        header[offset + 2] = (UCHAR)(new32 >> 24);
+        header[offset + 3] = (UCHAR)(new32 >> 16);
+        header[offset + 4] = (UCHAR)(new32 >> 8);
+        header[offset + 5] = (UCHAR)new32;
+
+        checksum = tapChecksumUpdate32(checksum, old32, new32);
+        CHECK_EQ(checksum, tapChecksumIPv4Header(header, sizeof(header)));
+    }
+}
+
+// A header carrying its own checksum sums to zero.
+static VOID
+TestVerify(VOID)
+{
+    UCHAR header[20];
+    USHORT checksum;
+
+    Fill(header, sizeof(header), -1);
+    header[10] = 0;
+    header[11] = 0;
+
+    checksum = tapChecksumIPv4Header(header, sizeof(header));
+    header[10] = (UCHAR)(checksum >> 8);
+    header[11] = (UCHAR)checksum;
+
+    CHECK_EQ(tapChecksumIPv4Header(header, sizeof(header)), 0);
+}
+
+int
+main(void)
+{
+    TestEquivalence();
+    TestSplit();
+    TestUpdate();
+    TestVerify();
+
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Read coalescing (tapProcessSendPacketQueue and tapReadCoalesceDue in
+// txpath.c) on a frozen clock: a read completes once MaxFrames frames
+// are queued or the delay has passed, and each batch after the first
+// waits out a delay of its own rather than the one its predecessor
+// started. A read too short for the oldest frame drops it.
+//======================================================================
+
+#include "taphost.h"
+
+#define COALESCE_NOW            10000000ull     // 1s, in 100ns units
+#define COALESCE_FRAMES         4
+#define COALESCE_DELAY_US       1000
+#define COALESCE_US             10ull           // 100ns units per microsecond
+#define COALESCE_FRAME_LENGTH   60
+#define COALESCE_READ_SIZE      4096
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+
+        NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) = NULL;
+        WdkHostFreeNetBufferList(NetBufferLists);
+        NetBufferLists = next;
+    }
+}
+
+// Sends Count frames, numbered from Sequence, in one call: the queue
+// is processed once, after all are queued.
+static VOID
+Send(ULONG Sequence, ULONG Count)
+{
+    UCHAR frame[COALESCE_FRAME_LENGTH];
+    ETH_HEADER *eth = (ETH_HEADER *)frame;
+    PNET_BUFFER_LIST nbls = NULL;
+    PNET_BUFFER_LIST *tail = &nbls;
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        memset(frame, 0, sizeof(frame));
+        memset(eth->dest, 0xFF, sizeof(MACADDR));
+        ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+        eth->proto = htons(0x88B5);     // Local experimental
+        memcpy(frame + sizeof(ETH_HEADER), &Sequence, sizeof(Sequence));
+        ++Sequence;
+
+        *tail = WdkHostAllocateNetBufferList(frame, sizeof(frame));
+        tail = &NET_BUFFER_LIST_NEXT_NBL(*tail);
+    }
+
+    TapHostSend(Adapter, nbls);
+}
+
+typedef struct _COALESCE_READ
+{
+    PIRP        Irp;
+    UCHAR       Buffer[COALESCE_READ_SIZE];
+} COALESCE_READ;
+
+static VOID
+Read(COALESCE_READ *Read)
+{
+    Read->Irp = NULL;
+    CHECK_EQ(TapHostRead(File, Read->Buffer, sizeof(Read->Buffer), &Read->Irp), STATUS_PENDING);
+}
+
+// Checks a completed read holds Count frames numbered from Sequence,
+// and frees it.
+static VOID
+Reap(COALESCE_READ *Read, ULONG Sequence, ULONG Count)
+{
+    ULONG length;
+    ULONG offset = 0;
+    ULONG frames = 0;
+
+    CHECK(Read->Irp->HostCompleted);
+    CHECK_EQ(Read->Irp->IoStatus.Status, STATUS_SUCCESS);
+    length = (ULONG)Read->Irp->IoStatus.Information;
+
+    while(offset < length)
+    {
+        TAP_WIN_READ_FRAME *header = (TAP_WIN_READ_FRAME *)(Read->Buffer + offset);
+        ULONG sequence;
+
+        CHECK_EQ(header->Length, COALESCE_FRAME_LENGTH);
+        memcpy(&sequence, Read->Buffer + offset + sizeof(*header) + sizeof(ETH_HEADER),
+            sizeof(sequence));
+        CHECK_EQ(sequence, Sequence + frames);
+
+        offset += sizeof(*header) + header->Length;
+        offset = (offset + TAP_WIN_READ_FRAME_ALIGN - 1) & ~(TAP_WIN_READ_FRAME_ALIGN - 1);
+        ++frames;
+    }
+
+    CHECK_EQ(frames, Count);
+
+    WdkHostFreeIrp(Read->Irp);
+    Read->Irp = NULL;
+}
+
+// Moves the clock on, running the coalescing timer's DPC if it fell due.
+static VOID
+Advance(ULONG Microseconds)
+{
+    WdkHostAdvanceClock(Microseconds * COALESCE_US);
+    WdkHostRunDpcs();
+}
+
+// A lone frame is returned when the delay passes, not before.
+static VOID
+TestDelay(VOID)
+{
+    static COALESCE_READ read;
+
+    Read(&read);
+    Send(100, 1);
+    CHECK(!read.Irp->HostCompleted);
+
+    Advance(COALESCE_DELAY_US - 1);
+    CHECK(!read.Irp->HostCompleted);
+
+    Advance(1);
+    Reap(&read, 100, 1);
+}
+
+// MaxFrames frames complete a read at once.
+static VOID
+TestFull(VOID)
+{
+    static COALESCE_READ read;
+
+    Read(&read);
+    Send(200, COALESCE_FRAMES - 1);
+    CHECK(!read.Irp->HostCompleted);
+
+    Send(200 + COALESCE_FRAMES - 1, 1);
+    Reap(&read, 200, COALESCE_FRAMES);
+
+    CHECK(!Adapter->Queues[0].CoalesceTimerArmed);
+}
+
+// The frame left over from a full batch waits a delay counted from when
+// that batch went, not from the first frame of the batch before.
+static VOID
+TestNextBatch(VOID)
+{
+    static COALESCE_READ first;
+    static COALESCE_READ second;
+
+    Read(&first);
+    Read(&second);
+
+    // The first batch starts its delay here.
+    Send(300, 1);
+    Advance(COALESCE_DELAY_US / 2 + 100);
+    CHECK(!first.Irp->HostCompleted);
+
+    // The batch fills; one frame is left.
+    Send(301, COALESCE_FRAMES);
+    Reap(&first, 300, COALESCE_FRAMES);
+    CHECK(!second.Irp->HostCompleted);
+
+    // Past the first batch's deadline; the second's is still ahead.
+    Advance(COALESCE_DELAY_US / 2);
+    CHECK(!second.Irp->HostCompleted);
+
+    Advance(COALESCE_DELAY_US / 2);
+    Reap(&second, 300 + COALESCE_FRAMES, 1);
+}
+
+// Frames left over with no read pending start their own delay when
+// queued; a read posted after it has passed completes at once, one
+// posted before waits for the rest of it.
+static VOID
+TestLateRead(VOID)
+{
+    static COALESCE_READ first;
+    static COALESCE_READ second;
+
+    Read(&first);
+    Send(400, COALESCE_FRAMES + 2);
+    Reap(&first, 400, COALESCE_FRAMES);
+
+    Advance(2 * COALESCE_DELAY_US);
+
+    Read(&second);
+    Reap(&second, 400 + COALESCE_FRAMES, 2);
+
+    Read(&first);
+    Send(500, COALESCE_FRAMES + 1);
+    Reap(&first, 500, COALESCE_FRAMES);
+
+    Advance(COALESCE_DELAY_US / 2);
+
+    Read(&second);
+    CHECK(!second.Irp->HostCompleted);
+
+    Advance(COALESCE_DELAY_US / 2 - 1);
+    CHECK(!second.Irp->HostCompleted);
+
+    Advance(1);
+    Reap(&second, 500 + COALESCE_FRAMES, 1);
+}
+
+// A read with room for just one frame takes one; one without room for
+// even that drops it as too small, and the frames behind it wait.
+static VOID
+TestShortRead(VOID)
+{
+    static COALESCE_READ read;
+    ULONG fits = sizeof(TAP_WIN_READ_FRAME) + COALESCE_FRAME_LENGTH;
+    ULONG64 drops = tapDropStatsTotal(&Adapter->DropStats);
+
+    Send(600, COALESCE_FRAMES);
+
+    read.Irp = NULL;
+    CHECK_EQ(TapHostRead(File, read.Buffer, fits, &read.Irp), STATUS_PENDING);
+    Reap(&read, 600, 1);
+
+    // The rest are fewer than MaxFrames, so wait out the delay.
+    CHECK_EQ(TapHostRead(File, read.Buffer, fits - 1, &read.Irp), STATUS_PENDING);
+    CHECK(!read.Irp->HostCompleted);
+    Advance(COALESCE_DELAY_US);
+    CHECK(read.Irp->HostCompleted);
+    CHECK_EQ(read.Irp->IoStatus.Status, STATUS_BUFFER_OVERFLOW);
+    CHECK_EQ(read.Irp->IoStatus.Information, 0);
+    WdkHostFreeIrp(read.Irp);
+    CHECK_EQ(tapDropStatsTotal(&Adapter->DropStats), drops + 1);
+
+    Read(&read);
+    CHECK(!read.Irp->HostCompleted);
+    Advance(COALESCE_DELAY_US);
+    Reap(&read, 602, COALESCE_FRAMES - 2);
+}
+
+int
+main(void)
+{
+    TAP_WIN_READ_COALESCING coalescing;
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value = TRUE;
+
+    WdkHostFreezeClock(COALESCE_NOW);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    coalescing.MaxFrames = COALESCE_FRAMES;
+    coalescing.MaxBytes = 0;
+    coalescing.MaxMicroseconds = COALESCE_DELAY_US;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_READ_COALESCING, &coalescing,
+        sizeof(coalescing), 0, NULL), STATUS_SUCCESS);
+
+    TestDelay();
+    TestFull();
+    TestNextBatch();
+    TestLateRead();
+    TestShortRead();
+
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
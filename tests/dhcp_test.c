@@ -0,0 +1,406 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// DHCP masquerade replies (dhcp.c): OFFER, ACK and NAK copied from the
+// adapter's templates and patched match, byte for byte, the replies
+// built from scratch, for the adapter and for pool clients, broadcast
+// and unicast, with and without user options. Then replies stay whole
+// while another thread keeps rebuilding the templates, and a request
+// sent through the adapter without options is dropped as malformed
+// rather than counted as answered.
+//======================================================================
+
+#include "taphost.h"
+
+#include <pthread.h>
+
+#define DHCP_ADAPTER_IP     0x0A000002      // 10.0.0.2
+#define DHCP_SERVER_IP      0x0A000001
+#define DHCP_POOL_START     0x0A000064
+#define DHCP_MAX_REPLY      1514
+#define DHCP_RACE_REPLIES   200000
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+//
+// The stack: keeps a copy of the one reply each request gets.
+//
+
+static UCHAR Reply[DHCP_MAX_REPLY];
+static ULONG ReplyLength;
+static ULONG Replies;
+
+static VOID
+Receive(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    PNET_BUFFER_LIST nbl;
+
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(NumberOfNetBufferLists);
+    UNREFERENCED_PARAMETER(ReceiveFlags);
+
+    for(nbl = NetBufferLists; nbl != NULL; nbl = NET_BUFFER_LIST_NEXT_NBL(nbl))
+    {
+        ReplyLength = WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(nbl),
+            Reply, sizeof(Reply));
+        ++Replies;
+    }
+
+    TapHostReturn(Adapter, NetBufferLists);
+}
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+
+        WdkHostFreeNetBufferList(NetBufferLists);
+        NetBufferLists = next;
+    }
+}
+
+//
+// The client.
+//
+
+typedef struct _REQUEST
+{
+    DHCPPre     Pre;
+    UCHAR       Options[16];
+} REQUEST;
+
+// A DISCOVER or REQUEST from Mac, to the server's MAC or broadcast.
+static int
+BuildRequest(REQUEST *Request, const UCHAR *Mac, UCHAR Type, ULONG Xid,
+    ULONG Ciaddr, BOOLEAN Broadcast)
+{
+    DHCPPre *p = &Request->Pre;
+    int optlen = 0;
+
+    memset(Request, 0, sizeof(*Request));
+
+    if(Broadcast)
+    {
+        memset(p->eth.dest, 0xFF, sizeof(MACADDR));
+    }
+    else
+    {
+        memcpy(p->eth.dest, Adapter->m_dhcp_server_mac, sizeof(MACADDR));
+    }
+    memcpy(p->eth.src, Mac, sizeof(MACADDR));
+    p->eth.proto = htons(NDIS_ETH_TYPE_IPV4);
+
+    Request->Options[optlen++] = DHCP_MSG_TYPE;
+    Request->Options[optlen++] = 1;
+    Request->Options[optlen++] = Type;
+    Request->Options[optlen++] = DHCP_END;
+
+    p->ip.version_len = 0x45;
+    p->ip.tot_len = htons((USHORT)(sizeof(IPHDR) + sizeof(UDPHDR) + sizeof(DHCP) + optlen));
+    p->ip.ttl = 64;
+    p->ip.protocol = IPPROTO_UDP;
+    p->ip.daddr = 0xFFFFFFFF;
+
+    p->udp.source = htons(BOOTPC_PORT);
+    p->udp.dest = htons(BOOTPS_PORT);
+    p->udp.len = htons((USHORT)(sizeof(UDPHDR) + sizeof(DHCP) + optlen));
+
+    p->dhcp.op = BOOTREQUEST;
+    p->dhcp.htype = 1;
+    p->dhcp.hlen = sizeof(MACADDR);
+    p->dhcp.xid = Xid;
+    p->dhcp.ciaddr = Ciaddr;
+    memcpy(p->dhcp.chaddr, Mac, sizeof(MACADDR));
+    p->dhcp.magic = htonl(0x63825363);
+
+    return optlen;
+}
+
+// Sends Request; returns the reply's message type.
+static UCHAR
+Send(REQUEST *Request, int Optlen)
+{
+    ULONG replies = Replies;
+    const UCHAR *option;
+
+    ProcessDHCP(Adapter, &Request->Pre.eth, &Request->Pre.ip, &Request->Pre.udp,
+        &Request->Pre.dhcp, Optlen);
+    WdkHostRunDpcs();
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK(ReplyLength > sizeof(DHCPPre) + 3);
+
+    // The message type is the first option.
+    option = Reply + sizeof(DHCPPre);
+    CHECK_EQ(option[0], DHCP_MSG_TYPE);
+
+    return option[2];
+}
+
+// Sends Request answered from the templates, then with them set aside,
+// and checks the two replies are the same and of Type.
+static VOID
+Compare(REQUEST *Request, int Optlen, UCHAR Type)
+{
+    UCHAR templated[DHCP_MAX_REPLY];
+    ULONG templatedLength;
+    LONG sequence = Adapter->m_dhcp_templates_sequence;
+
+    CHECK(sequence != 0 && !(sequence & 1));
+
+    CHECK_EQ(Send(Request, Optlen), Type);
+    memcpy(templated, Reply, ReplyLength);
+    templatedLength = ReplyLength;
+
+    Adapter->m_dhcp_templates_sequence = 0;
+    CHECK_EQ(Send(Request, Optlen), Type);
+    Adapter->m_dhcp_templates_sequence = sequence;
+
+    CHECK_EQ(templatedLength, ReplyLength);
+    CHECK(memcmp(templated, Reply, ReplyLength) == 0);
+}
+
+static VOID
+Configure(ULONG LeaseTime, const UCHAR *Options, ULONG OptionsLength, ULONG PoolCount)
+{
+    IPADDR masq[4];
+
+    masq[0] = htonl(DHCP_ADAPTER_IP);
+    masq[1] = htonl(0xFFFFFF00);
+    masq[2] = htonl(DHCP_SERVER_IP);
+    masq[3] = LeaseTime;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, masq,
+        sizeof(masq), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    if(OptionsLength != 0)
+    {
+        UCHAR buffer[DHCP_USER_SUPPLIED_OPTIONS_BUFFER_SIZE];
+
+        memcpy(buffer, Options, OptionsLength);
+        CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_SET_OPT, buffer,
+            OptionsLength, sizeof(ULONG), NULL), STATUS_SUCCESS);
+    }
+
+    if(PoolCount != 0)
+    {
+        TAP_WIN_DHCP_POOL pool;
+
+        pool.StartAddress = htonl(DHCP_POOL_START);
+        pool.Count = PoolCount;
+        CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_POOL, &pool,
+            sizeof(pool), sizeof(ULONG), NULL), STATUS_SUCCESS);
+    }
+
+    Adapter->m_dhcp_received_discover = FALSE;
+    Adapter->m_dhcp_bad_requests = 0;
+}
+
+static VOID
+TestTemplates(VOID)
+{
+    // DNS servers and a domain name, as OpenVPN pushes them.
+    static const UCHAR options[] = {
+        6, 8, 10, 0, 0, 53, 10, 0, 0, 54,
+        15, 11, 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+    };
+    static const ULONG leaseTimes[] = { 60, 3600, 31536000 };
+    static const UCHAR poolMac[] = { 0x02, 0x00, 0x00, 0x00, 0x10, 0x01 };
+    ULONG i;
+
+    for(i = 0; i < 2 * ARRAYSIZE(leaseTimes); ++i)
+    {
+        BOOLEAN broadcast = (i % 2) == 0;
+        ULONG xid = 0x12345678 * (i + 1);
+        REQUEST request;
+        int optlen;
+
+        Configure(leaseTimes[i / 2], options, (i % 2) ? sizeof(options) : 0, 8);
+
+        // The adapter itself: OFFER, ACK, then NAK for another address.
+        optlen = BuildRequest(&request, Adapter->CurrentAddress, DHCPDISCOVER, xid, 0, broadcast);
+        Compare(&request, optlen, DHCPOFFER);
+
+        optlen = BuildRequest(&request, Adapter->CurrentAddress, DHCPREQUEST, xid + 1, 0, broadcast);
+        Compare(&request, optlen, DHCPACK);
+
+        optlen = BuildRequest(&request, Adapter->CurrentAddress, DHCPREQUEST, xid + 2,
+            htonl(DHCP_ADAPTER_IP + 1), broadcast);
+        Compare(&request, optlen, DHCPNAK);
+
+        // A pool client: a different yiaddr and chaddr.
+        optlen = BuildRequest(&request, poolMac, DHCPDISCOVER, xid + 3, 0, broadcast);
+        Compare(&request, optlen, DHCPOFFER);
+        CHECK_EQ(ntohl(((const DHCPPre *)Reply)->dhcp.yiaddr), DHCP_POOL_START);
+
+        optlen = BuildRequest(&request, poolMac, DHCPREQUEST, xid + 4,
+            htonl(DHCP_POOL_START), broadcast);
+        Compare(&request, optlen, DHCPACK);
+    }
+}
+
+//
+// Rebuilding the templates under the senders.
+//
+
+static volatile LONG Rebuilding;
+
+static PVOID
+RebuildThread(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    while(Rebuilding)
+    {
+        BuildDHCPTemplates(Adapter);
+    }
+
+    return NULL;
+}
+
+// The configuration does not change, so every reply, whether copied
+// from a template or built, must be the same.
+static VOID
+TestRebuildRace(VOID)
+{
+    UCHAR expected[DHCP_MAX_REPLY];
+    ULONG expectedLength;
+    REQUEST request;
+    pthread_t thread;
+    int optlen;
+    ULONG i;
+
+    Configure(3600, NULL, 0, 0);
+
+    optlen = BuildRequest(&request, Adapter->CurrentAddress, DHCPDISCOVER, 0x5EED, 0, TRUE);
+    CHECK_EQ(Send(&request, optlen), DHCPOFFER);
+    memcpy(expected, Reply, ReplyLength);
+    expectedLength = ReplyLength;
+
+    // What a sender on another processor sees mid-rebuild: the
+    // templates are not copied at all.
+    Adapter->m_dhcp_templates_sequence++;
+    memset(Adapter->m_dhcp_templates, 0xEE, sizeof(Adapter->m_dhcp_templates));
+    CHECK_EQ(Send(&request, optlen), DHCPOFFER);
+    CHECK_EQ(ReplyLength, expectedLength);
+    CHECK(memcmp(Reply, expected, expectedLength) == 0);
+    Adapter->m_dhcp_templates_sequence++;
+    BuildDHCPTemplates(Adapter);
+
+    Rebuilding = TRUE;
+    CHECK_EQ(pthread_create(&thread, NULL, RebuildThread, NULL), 0);
+
+    for(i = 0; i < DHCP_RACE_REPLIES; ++i)
+    {
+        CHECK_EQ(Send(&request, optlen), DHCPOFFER);
+        CHECK_EQ(ReplyLength, expectedLength);
+        CHECK(memcmp(Reply, expected, expectedLength) == 0);
+    }
+
+    Rebuilding = FALSE;
+    CHECK_EQ(pthread_join(thread, NULL), 0);
+
+    CHECK(!(Adapter->m_dhcp_templates_sequence & 1));
+}
+
+// Through the adapter's send path: a request with options is answered
+// and counted as handled; one with none is dropped as malformed.
+static VOID
+TestMalformed(VOID)
+{
+    TAP_WIN_DROP_STATS before;
+    TAP_WIN_DROP_STATS after;
+    REQUEST request;
+    ULONG replies;
+    int optlen;
+
+    Configure(3600, NULL, 0, 0);
+
+    optlen = BuildRequest(&request, Adapter->CurrentAddress, DHCPDISCOVER, 0xBAD, 0, TRUE);
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &before);
+    replies = Replies;
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList((PUCHAR)&request,
+        sizeof(DHCPPre) + optlen));
+    WdkHostRunDpcs();
+    tapDropStatsQuery(&Adapter->DropStats, 0, &after);
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK_EQ(after.Handled, before.Handled + 1);
+    CHECK_EQ(after.Drops[TAP_WIN_DROP_TX_MALFORMED], before.Drops[TAP_WIN_DROP_TX_MALFORMED]);
+
+    request.Pre.ip.tot_len = htons((USHORT)(sizeof(IPHDR) + sizeof(UDPHDR) + sizeof(DHCP)));
+    request.Pre.udp.len = htons((USHORT)(sizeof(UDPHDR) + sizeof(DHCP)));
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList((PUCHAR)&request, sizeof(DHCPPre)));
+    WdkHostRunDpcs();
+    tapDropStatsQuery(&Adapter->DropStats, 0, &before);
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK_EQ(before.Handled, after.Handled);
+    CHECK_EQ(before.Drops[TAP_WIN_DROP_TX_MALFORMED], after.Drops[TAP_WIN_DROP_TX_MALFORMED] + 1);
+}
+
+int
+main(void)
+{
+    ULONG value = TRUE;
+
+    WdkHostSetReceiveHook(Receive, NULL);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    // No templates until the server is configured.
+    CHECK_EQ(Adapter->m_dhcp_templates_sequence, 0);
+
+    TestTemplates();
+    TestRebuildRace();
+    TestMalformed();
+
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,586 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The DHCP masquerade address pool (dhcppool.c), driven on a frozen
+// clock: offers, binding, renewal, release and decline, expiry, and the
+// timer wheel across many turns, across idle gaps longer than a turn
+// and across the wrap of the seconds counter. A seeded random replay
+// then checks every answer against a model of the pool.
+//
+//  dhcppool_test [seed]
+//======================================================================
+
+#include "taphost.h"
+
+#define POOL_SECOND         10000000ull     // Clock units
+#define POOL_START          0x0A000064      // 10.0.0.100
+#define POOL_ADAPTER_IP     0x0A000065      // Reserved: the adapter
+#define POOL_SERVER_IP      0x0A000066      // Reserved: the DHCP server
+
+#define MODEL_MAX_LEASES    64
+#define MODEL_MAX_CLIENTS   96
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+static VOID
+Advance(ULONG Seconds)
+{
+    WdkHostAdvanceClock(Seconds * POOL_SECOND);
+}
+
+static ULONG
+Now(VOID)
+{
+    return (ULONG)(KeQueryInterruptTime() / POOL_SECOND);
+}
+
+// Masquerade addresses and lease time, then a pool of Count from POOL_START.
+static VOID
+Configure(ULONG LeaseTime, ULONG Count)
+{
+    IPADDR masq[4];
+    TAP_WIN_DHCP_POOL pool;
+
+    masq[0] = htonl(POOL_ADAPTER_IP);
+    masq[1] = htonl(0xFFFFFF00);
+    masq[2] = htonl(POOL_SERVER_IP);
+    masq[3] = LeaseTime;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, masq,
+        sizeof(masq), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    pool.StartAddress = htonl(POOL_START);
+    pool.Count = Count;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_POOL, &pool,
+        sizeof(pool), sizeof(ULONG), NULL), STATUS_SUCCESS);
+}
+
+static VOID
+Mac(UCHAR *Mac, ULONG Client)
+{
+    Mac[0] = 0x02;
+    Mac[1] = 0x00;
+    Mac[2] = (UCHAR)(Client >> 24);
+    Mac[3] = (UCHAR)(Client >> 16);
+    Mac[4] = (UCHAR)(Client >> 8);
+    Mac[5] = (UCHAR)Client;
+}
+
+// The address offered to Client, host order; 0 if none.
+static ULONG
+Offer(ULONG Client)
+{
+    UCHAR mac[6];
+    IPADDR address;
+
+    Mac(mac, Client);
+    return tapDhcpPoolOffer(Adapter, mac, &address) ? ntohl(address) : 0;
+}
+
+// The address bound for Client, host order; 0 for a NAK.
+static ULONG
+Request(ULONG Client, ULONG Requested)
+{
+    UCHAR mac[6];
+    IPADDR address;
+
+    Mac(mac, Client);
+    return tapDhcpPoolRequest(Adapter, mac, Requested ? htonl(Requested) : 0, &address)
+        ? ntohl(address) : 0;
+}
+
+static VOID
+Release(ULONG Client, ULONG Address, BOOLEAN Declined)
+{
+    UCHAR mac[6];
+
+    Mac(mac, Client);
+    tapDhcpPoolRelease(Adapter, mac, htonl(Address), Declined);
+}
+
+// DISCOVER, REQUEST: the address bound.
+static ULONG
+Lease(ULONG Client)
+{
+    ULONG address = Offer(Client);
+
+    CHECK(address != 0);
+    CHECK_EQ(Request(Client, address), address);
+    return address;
+}
+
+//
+// Directed cases.
+//
+
+static VOID
+TestLease(VOID)
+{
+    ULONG a;
+    ULONG b;
+
+    Configure(3600, 8);
+
+    // The adapter's and the server's addresses are never offered.
+    a = Offer(1);
+    CHECK_EQ(a, POOL_START);
+    CHECK_EQ(Offer(1), a);
+    CHECK_EQ(Request(1, a), a);
+
+    b = Offer(2);
+    CHECK_EQ(b, POOL_START + 3);
+    CHECK_EQ(Request(2, 0), b);
+
+    // A client asking for another's address is NAKed; so is one asking
+    // for an address other than its own, which loses its lease to the
+    // tail of the free list.
+    CHECK_EQ(Request(3, a), 0);
+    CHECK_EQ(Request(2, a), 0);
+    CHECK_EQ(Offer(4), POOL_START + 4);
+
+    // A client without a lease may claim a free address, e.g. after a reboot.
+    CHECK_EQ(Request(5, POOL_START + 7), POOL_START + 7);
+    CHECK_EQ(Request(6, POOL_ADAPTER_IP), 0);
+    CHECK_EQ(Request(6, POOL_START + 8), 0);
+
+    // Exhaustion: 8 addresses, 2 reserved, 3 held; 3 more, then none.
+    CHECK_EQ(Offer(10), POOL_START + 5);
+    CHECK_EQ(Offer(11), POOL_START + 6);
+    CHECK_EQ(Offer(12), b);
+    CHECK_EQ(Offer(13), 0);
+
+    // Released: free at once, and handed out last.
+    Release(1, a, FALSE);
+    CHECK_EQ(Offer(13), a);
+}
+
+static VOID
+TestOfferHold(VOID)
+{
+    ULONG a;
+
+    Configure(3600, 3);
+
+    a = Offer(1);
+    CHECK_EQ(a, POOL_START);
+
+    // Held for TAP_DHCP_OFFER_HOLD seconds; offering again restarts the hold.
+    Advance(TAP_DHCP_OFFER_HOLD - 1);
+    CHECK_EQ(Offer(2), 0);
+    CHECK_EQ(Offer(1), a);
+    Advance(TAP_DHCP_OFFER_HOLD - 1);
+    CHECK_EQ(Offer(2), 0);
+    Advance(1);
+    CHECK_EQ(Offer(2), a);
+
+    // An expired offer can still be requested while the address is free.
+    Advance(TAP_DHCP_OFFER_HOLD);
+    CHECK_EQ(Request(1, a), a);
+}
+
+static VOID
+TestRenewAndExpire(VOID)
+{
+    ULONG lease = 600;
+    ULONG a;
+    ULONG b;
+
+    Configure(lease, 4);
+
+    a = Lease(1);
+    b = Lease(2);
+
+    // Renewed at T/2 twice: alive past its first expiry.
+    Advance(lease / 2);
+    CHECK_EQ(Request(1, a), a);
+    Advance(lease / 2);
+    CHECK_EQ(Request(1, 0), a);
+    Advance(lease / 2);
+
+    // Client 2 expired with the first term; client 1 has T/2 left.
+    CHECK_EQ(Offer(3), b);
+    CHECK_EQ(Offer(1), a);
+    Advance(lease / 2 - 1);
+    CHECK_EQ(Request(1, a), a);
+
+    // The expired client returns: its address went to the tail of the free
+    // list, but client 3's offer lapsed, so it gets it back.
+    Advance(TAP_DHCP_OFFER_HOLD);
+    CHECK_EQ(Offer(2), b);
+
+    // And a lease not renewed lapses at exactly its lease time.
+    Configure(lease, 4);
+    a = Lease(1);
+    Advance(lease - 1);
+    CHECK_EQ(Offer(2), POOL_START + 3);
+    CHECK_EQ(Offer(3), 0);
+    Advance(1);
+    CHECK_EQ(Offer(3), a);
+}
+
+static VOID
+TestDecline(VOID)
+{
+    ULONG lease = 300;
+    ULONG a;
+
+    Configure(lease, 3);
+
+    a = Lease(1);
+    Release(1, a, TRUE);
+
+    // Kept out of the pool for one lease time, from nobody's name.
+    CHECK_EQ(Offer(1), 0);
+    CHECK_EQ(Request(2, a), 0);
+    Advance(lease - 1);
+    CHECK_EQ(Offer(2), 0);
+    Advance(1);
+    CHECK_EQ(Offer(2), a);
+
+    // A release naming someone else's address is ignored.
+    CHECK_EQ(Request(2, a), a);
+    Release(3, a, FALSE);
+    Release(2, a + 1, FALSE);
+    CHECK_EQ(Offer(3), 0);
+}
+
+// Leases longer than a turn of the wheel share slots with shorter ones
+// and must ride out every turn, whether the pool is used each second or
+// left idle for longer than a turn.
+static VOID
+TestWheelWrap(VOID)
+{
+    ULONG lease = TAP_DHCP_WHEEL_SLOTS * 3 + 17;
+    ULONG a;
+    ULONG t;
+
+    Configure(lease, TAP_DHCP_OFFER_HOLD + 4);
+
+    a = Lease(1);
+
+    for(t = 1; t < lease; ++t)
+    {
+        Advance(1);
+
+        // Short offers landing in every slot, expiring as they go.
+        CHECK(Offer(100 + t) != 0);
+        CHECK(Offer(100 + t) != a);
+    }
+
+    CHECK_EQ(Offer(1), a);
+    Advance(1);
+    CHECK_EQ(Request(1, 0), 0);
+
+    // Idle for several turns, with one lease due mid-way and one after.
+    Configure(lease, 6);
+    a = Lease(1);
+    Advance(TAP_DHCP_WHEEL_SLOTS * 2 + 5);
+    {
+        ULONG b = Lease(2);
+
+        Advance(lease - (TAP_DHCP_WHEEL_SLOTS * 2 + 5));
+        CHECK_EQ(Request(2, b), b);
+        CHECK_EQ(Request(1, 0), 0);
+        Advance(TAP_DHCP_WHEEL_SLOTS * 10);
+        CHECK_EQ(Request(2, 0), 0);
+    }
+}
+
+//
+// Random replay against a model.
+//
+
+typedef struct _MODEL_LEASE
+{
+    ULONG   State;      // TAP_DHCP_LEASE_STATE
+    ULONG   Client;
+    ULONG   Expiry;
+} MODEL_LEASE;
+
+static MODEL_LEASE Model[MODEL_MAX_LEASES];
+static ULONG ModelCount;
+static ULONG ModelLeaseTime;
+
+static ULONG64 Seed = 1;
+
+static ULONG
+Random(ULONG Range)
+{
+    Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+    return (ULONG)(Seed >> 33) % Range;
+}
+
+static VOID
+ModelReset(ULONG LeaseTime, ULONG Count)
+{
+    ULONG i;
+
+    ModelCount = Count;
+    ModelLeaseTime = LeaseTime;
+
+    for(i = 0; i < Count; ++i)
+    {
+        ULONG address = POOL_START + i;
+
+        Model[i].State = (address == POOL_ADAPTER_IP || address == POOL_SERVER_IP)
+            ? TapDhcpLeaseReserved : TapDhcpLeaseFree;
+    }
+
+    Configure(LeaseTime, Count);
+}
+
+static VOID
+ModelExpire(ULONG Now)
+{
+    ULONG i;
+
+    for(i = 0; i < ModelCount; ++i)
+    {
+        if((Model[i].State == TapDhcpLeaseOffered
+            || Model[i].State == TapDhcpLeaseBound
+            || Model[i].State == TapDhcpLeaseDeclined)
+            && (LONG)(Model[i].Expiry - Now) <= 0)
+        {
+            Model[i].State = TapDhcpLeaseFree;
+        }
+    }
+}
+
+static MODEL_LEASE *
+ModelOwned(ULONG Client)
+{
+    ULONG i;
+
+    for(i = 0; i < ModelCount; ++i)
+    {
+        if((Model[i].State == TapDhcpLeaseOffered || Model[i].State == TapDhcpLeaseBound)
+            && Model[i].Client == Client)
+        {
+            return &Model[i];
+        }
+    }
+
+    return NULL;
+}
+
+static BOOLEAN
+ModelAnyFree(VOID)
+{
+    ULONG i;
+
+    for(i = 0; i < ModelCount; ++i)
+    {
+        if(Model[i].State == TapDhcpLeaseFree)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static ULONG
+ModelAddress(const MODEL_LEASE *Lease)
+{
+    return POOL_START + (ULONG)(Lease - Model);
+}
+
+static MODEL_LEASE *
+ModelLease(ULONG Address)
+{
+    return (Address - POOL_START < ModelCount) ? &Model[Address - POOL_START] : NULL;
+}
+
+static VOID
+ReplayOffer(ULONG Client)
+{
+    ULONG now = Now();
+    MODEL_LEASE *owned;
+    ULONG address;
+
+    ModelExpire(now);
+    owned = ModelOwned(Client);
+    address = Offer(Client);
+
+    if(owned != NULL)
+    {
+        CHECK_EQ(address, ModelAddress(owned));
+    }
+    else if(address == 0)
+    {
+        CHECK(!ModelAnyFree());
+        return;
+    }
+    else
+    {
+        owned = ModelLease(address);
+        CHECK(owned != NULL);
+        CHECK_EQ(owned->State, TapDhcpLeaseFree);
+        owned->State = TapDhcpLeaseOffered;
+        owned->Client = Client;
+    }
+
+    if(owned->State == TapDhcpLeaseOffered)
+    {
+        owned->Expiry = now + TAP_DHCP_OFFER_HOLD;
+    }
+}
+
+static VOID
+ReplayRequest(ULONG Client, ULONG Requested)
+{
+    ULONG now = Now();
+    MODEL_LEASE *owned;
+    ULONG address;
+
+    ModelExpire(now);
+    owned = ModelOwned(Client);
+    address = Request(Client, Requested);
+
+    if(owned == NULL)
+    {
+        owned = ModelLease(Requested);
+
+        if(owned == NULL || owned->State != TapDhcpLeaseFree)
+        {
+            CHECK_EQ(address, 0);
+            return;
+        }
+
+        owned->Client = Client;
+    }
+    else if(Requested != 0 && Requested != ModelAddress(owned))
+    {
+        CHECK_EQ(address, 0);
+        owned->State = TapDhcpLeaseFree;
+        return;
+    }
+
+    CHECK_EQ(address, ModelAddress(owned));
+    owned->State = TapDhcpLeaseBound;
+    owned->Expiry = now + ModelLeaseTime;
+}
+
+static VOID
+ReplayRelease(ULONG Client, ULONG Address, BOOLEAN Declined)
+{
+    ULONG now = Now();
+    MODEL_LEASE *owned;
+
+    ModelExpire(now);
+    owned = ModelOwned(Client);
+    Release(Client, Address, Declined);
+
+    if(owned != NULL && ModelAddress(owned) == Address)
+    {
+        owned->State = Declined ? TapDhcpLeaseDeclined : TapDhcpLeaseFree;
+        owned->Expiry = now + ModelLeaseTime;
+    }
+}
+
+static VOID
+ReplayRandom(ULONG LeaseTime, ULONG Count, ULONG Steps)
+{
+    ULONG clients = Count + Count / 2;
+    ULONG step;
+
+    ModelReset(LeaseTime, Count);
+
+    for(step = 0; step < Steps; ++step)
+    {
+        ULONG client = 1 + Random(clients);
+        MODEL_LEASE *owned = ModelOwned(client);
+        ULONG address = owned != NULL ? ModelAddress(owned) : POOL_START + Random(Count + 2);
+        ULONG event = Random(100);
+
+        if(event < 30)
+        {
+            ReplayOffer(client);
+        }
+        else if(event < 70)
+        {
+            // Mostly renewals of the client's own address.
+            ReplayRequest(client, Random(4) == 0 ? POOL_START + Random(Count + 2)
+                                : Random(4) == 0 ? 0 : address);
+        }
+        else if(event < 75)
+        {
+            ReplayRelease(client, address, Random(3) == 0);
+        }
+        else if(event < 95)
+        {
+            Advance(Random(LeaseTime / 4 + 2));
+        }
+        else
+        {
+            // Idle for longer than a turn of the wheel.
+            Advance(TAP_DHCP_WHEEL_SLOTS + Random(LeaseTime * 2));
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    ULONG seed = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0) : 1;
+    ULONG i;
+
+    Seed = seed;
+    WdkHostFreezeClock(1000 * POOL_SECOND);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    TestLease();
+    TestOfferHold();
+    TestRenewAndExpire();
+    TestDecline();
+    TestWheelWrap();
+
+    for(i = 0; i < 20; ++i)
+    {
+        static const ULONG leaseTimes[] = { 60, 200, 255, 256, 257, 1000, 3600 };
+
+        ReplayRandom(leaseTimes[i % ARRAYSIZE(leaseTimes)], 8 + Random(MODEL_MAX_LEASES - 8), 20000);
+    }
+
+    // Again as the seconds counter wraps.
+    WdkHostFreezeClock((0x100000000ull - 2000) * POOL_SECOND);
+    TestRenewAndExpire();
+    TestWheelWrap();
+    CHECK(Now() < 0x100000000ull - 2000);
+    ReplayRandom(1000, 32, 20000);
+
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
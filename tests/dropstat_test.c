@@ -0,0 +1,145 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Drop counters (dropstat.h): per-CPU blocks summed on read and reset,
+// frames handled in the driver kept apart from the drops, and counting
+// before the counters exist or after they are freed.
+//======================================================================
+
+#include "taphost.h"
+
+#define DROP_CPUS           4
+
+static TAP_DROP_STATS Stats;
+
+// Counts Reason once on each CPU, Count frames on the last.
+static VOID
+CountOnEach(ULONG Reason, ULONG Count)
+{
+    ULONG cpu;
+
+    for(cpu = 0; cpu < DROP_CPUS; ++cpu)
+    {
+        WdkHostSetCurrentProcessor(cpu);
+        tapDropCount(&Stats, Reason, cpu + 1 == DROP_CPUS ? Count : 1);
+    }
+
+    WdkHostSetCurrentProcessor(0);
+}
+
+// Nothing to count in: no counters yet, or freed.
+static VOID
+TestUnallocated(VOID)
+{
+    TAP_WIN_DROP_STATS copy;
+
+    tapDropCount(&Stats, TAP_WIN_DROP_TX_NO_READER, 1);
+    CHECK_EQ(tapDropStatsTotal(&Stats), 0);
+
+    tapDropStatsQuery(&Stats, 0, &copy);
+    CHECK_EQ(copy.DropCount, TAP_WIN_DROP_COUNT);
+    CHECK_EQ(copy.Handled, 0);
+}
+
+// Each CPU's block is its own whole cache lines.
+static VOID
+TestLayout(VOID)
+{
+    CHECK_EQ(((ULONG_PTR)Stats.Cpus) % TAP_DROP_CACHE_LINE, 0);
+    CHECK_EQ(Stats.CpuCount, DROP_CPUS);
+    CHECK_EQ(sizeof(TAP_DROP_CPU) % TAP_DROP_CACHE_LINE, 0);
+    CHECK((PUCHAR)(Stats.Cpus + DROP_CPUS) <= (PUCHAR)Stats.Allocation + Stats.AllocationSize);
+}
+
+// Counts on every CPU are summed, and RESET zeroes them.
+static VOID
+TestCounts(VOID)
+{
+    TAP_WIN_DROP_STATS copy;
+
+    CountOnEach(TAP_WIN_DROP_TX_NO_READER, 5);
+    CountOnEach(TAP_WIN_DROP_INJECT, 1);
+
+    CHECK_EQ(Stats.Cpus[0].Counters[TAP_WIN_DROP_TX_NO_READER], 1);
+    CHECK_EQ(Stats.Cpus[DROP_CPUS - 1].Counters[TAP_WIN_DROP_TX_NO_READER], 5);
+
+    CHECK_EQ(tapDropStatsTotal(&Stats), (DROP_CPUS - 1) + 5 + DROP_CPUS);
+
+    tapDropStatsQuery(&Stats, TAP_WIN_DROP_STATS_RESET, &copy);
+    CHECK_EQ(copy.Drops[TAP_WIN_DROP_TX_NO_READER], (DROP_CPUS - 1) + 5);
+    CHECK_EQ(copy.Drops[TAP_WIN_DROP_INJECT], DROP_CPUS);
+    CHECK_EQ(copy.Drops[TAP_WIN_DROP_TX_FLUSHED], 0);
+
+    tapDropStatsQuery(&Stats, 0, &copy);
+    CHECK_EQ(copy.Drops[TAP_WIN_DROP_TX_NO_READER], 0);
+    CHECK_EQ(copy.Drops[TAP_WIN_DROP_INJECT], 0);
+    CHECK_EQ(tapDropStatsTotal(&Stats), 0);
+}
+
+// Handled frames are reported on their own and are not in the total.
+static VOID
+TestHandled(VOID)
+{
+    TAP_WIN_DROP_STATS copy;
+    ULONG reason;
+
+    CountOnEach(TAP_DROP_HANDLED, 3);
+    tapDropCount(&Stats, TAP_WIN_DROP_TX_FILTERED, 1);
+
+    CHECK_EQ(tapDropStatsTotal(&Stats), 1);
+
+    tapDropStatsQuery(&Stats, TAP_WIN_DROP_STATS_RESET, &copy);
+    CHECK_EQ(copy.Handled, (DROP_CPUS - 1) + 3);
+
+    for(reason = 0; reason < TAP_WIN_DROP_COUNT; ++reason)
+    {
+        CHECK_EQ(copy.Drops[reason], reason == TAP_WIN_DROP_TX_FILTERED ? 1 : 0);
+    }
+
+    tapDropStatsQuery(&Stats, 0, &copy);
+    CHECK_EQ(copy.Handled, 0);
+}
+
+int
+main(void)
+{
+    WdkHostSetProcessorCount(DROP_CPUS);
+
+    TestUnallocated();
+
+    CHECK_EQ(tapDropStatsInitialize(&Stats), NDIS_STATUS_SUCCESS);
+
+    TestLayout();
+    TestCounts();
+    TestHandled();
+
+    tapDropStatsFree(&Stats);
+
+    TestUnallocated();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
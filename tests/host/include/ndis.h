@@ -0,0 +1,1039 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Host build stand-in for the WDK's ndis.h.
+//
+// NBLs, NBs and MDLs are real structures with the fields the driver
+// touches. Indications and send completions go to hooks a test can set
+// (wdkhost.h). Status and OID values are distinct but are not all the
+// WDK's, and the miniport registration structures carry only the
+// fields this driver fills in.
+//======================================================================
+
+#ifndef __TAP_HOST_NDIS_H
+#define __TAP_HOST_NDIS_H
+
+#include <ntifs.h>
+
+typedef PVOID               NDIS_HANDLE, *PNDIS_HANDLE;
+typedef int                 NDIS_STATUS, *PNDIS_STATUS;
+typedef ULONG               NDIS_OID, *PNDIS_OID;
+typedef ULONG               NDIS_PORT_NUMBER, *PNDIS_PORT_NUMBER;
+typedef UNICODE_STRING      NDIS_STRING, *PNDIS_STRING;
+typedef ULONG               NET_IFINDEX;
+typedef USHORT              NET_IFTYPE;
+
+#define IF_TYPE_PROP_VIRTUAL    53
+
+#define NDIS_STRING_CONST(x)    RTL_CONSTANT_STRING(L ## x)
+
+#define NDIS_DEFAULT_PORT_NUMBER    ((NDIS_PORT_NUMBER)0)
+
+//
+// Status codes
+//
+
+#define NDIS_STATUS_SUCCESS                 ((NDIS_STATUS)STATUS_SUCCESS)
+#define NDIS_STATUS_PENDING                 ((NDIS_STATUS)STATUS_PENDING)
+#define NDIS_STATUS_INDICATION_REQUIRED     ((NDIS_STATUS)0x40010003L)
+#define NDIS_STATUS_MEDIA_CONNECT           ((NDIS_STATUS)0x4001000BL)
+#define NDIS_STATUS_MEDIA_DISCONNECT        ((NDIS_STATUS)0x4001000CL)
+#define NDIS_STATUS_LINK_STATE              ((NDIS_STATUS)0x40010017L)
+#define NDIS_STATUS_FAILURE                 ((NDIS_STATUS)STATUS_UNSUCCESSFUL)
+#define NDIS_STATUS_RESOURCES               ((NDIS_STATUS)STATUS_INSUFFICIENT_RESOURCES)
+#define NDIS_STATUS_NOT_SUPPORTED           ((NDIS_STATUS)STATUS_NOT_SUPPORTED)
+#define NDIS_STATUS_INVALID_LENGTH          ((NDIS_STATUS)0xC0010014L)
+#define NDIS_STATUS_INVALID_DATA            ((NDIS_STATUS)0xC0010015L)
+#define NDIS_STATUS_BUFFER_TOO_SHORT        ((NDIS_STATUS)0xC0010016L)
+#define NDIS_STATUS_MULTICAST_FULL          ((NDIS_STATUS)0xC0010009L)
+#define NDIS_STATUS_RESET_IN_PROGRESS       ((NDIS_STATUS)0xC001000DL)
+#define NDIS_STATUS_MEDIA_DISCONNECTED      ((NDIS_STATUS)0xC001001FL)
+#define NDIS_STATUS_SEND_ABORTED            ((NDIS_STATUS)STATUS_NDIS_REQUEST_ABORTED)
+#define NDIS_STATUS_REQUEST_ABORTED         ((NDIS_STATUS)0xC001000CL)
+#define NDIS_STATUS_PAUSED                  ((NDIS_STATUS)0xC023002AL)
+#define NDIS_STATUS_LOW_POWER_STATE         ((NDIS_STATUS)0xC023002FL)
+#define NDIS_STATUS_INVALID_STATE           ((NDIS_STATUS)STATUS_INVALID_DEVICE_STATE)
+#define NDIS_STATUS_UNSUPPORTED_REVISION    ((NDIS_STATUS)0xC0230033L)
+#define NDIS_STATUS_INVALID_OID             ((NDIS_STATUS)0xC0010017L)
+#define NDIS_STATUS_INVALID_PARAMETER       ((NDIS_STATUS)STATUS_INVALID_PARAMETER)
+
+#define STATUS_NDIS_REQUEST_ABORTED         ((NTSTATUS)0xC023000CL)
+
+//
+// Versions
+//
+
+#define NDIS_RUNTIME_VERSION_620    ((6 << 16) | 20)
+#define NDIS_RUNTIME_VERSION_630    ((6 << 16) | 30)
+
+#define NDIS_SUPPORT_NDIS6          1
+#define NDIS_SUPPORT_NDIS61         1
+#define NDIS_SUPPORT_NDIS620        1
+#define NDIS_SUPPORT_NDIS630        1
+
+UINT NdisGetVersion(VOID);
+
+//
+// Object headers
+//
+
+typedef struct _NDIS_OBJECT_HEADER
+{
+    UCHAR   Type;
+    UCHAR   Revision;
+    USHORT  Size;
+} NDIS_OBJECT_HEADER, *PNDIS_OBJECT_HEADER;
+
+#define NDIS_OBJECT_TYPE_DEFAULT                                0x80
+#define NDIS_OBJECT_TYPE_MINIPORT_INIT_PARAMETERS               0x81
+#define NDIS_OBJECT_TYPE_STATUS_INDICATION                      0x95
+#define NDIS_OBJECT_TYPE_MINIPORT_DRIVER_CHARACTERISTICS        0x8A
+#define NDIS_OBJECT_TYPE_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES 0x9E
+#define NDIS_OBJECT_TYPE_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES    0x9F
+#define NDIS_OBJECT_TYPE_CONFIGURATION_OBJECT                   0xA0
+#define NDIS_OBJECT_TYPE_DEVICE_OBJECT_ATTRIBUTES               0xA1
+
+//
+// Locks and events
+//
+
+typedef struct _NDIS_SPIN_LOCK
+{
+    KSPIN_LOCK  SpinLock;
+    KIRQL       OldIrql;
+} NDIS_SPIN_LOCK, *PNDIS_SPIN_LOCK;
+
+VOID NdisAllocateSpinLock(PNDIS_SPIN_LOCK SpinLock);
+VOID NdisFreeSpinLock(PNDIS_SPIN_LOCK SpinLock);
+VOID NdisAcquireSpinLock(PNDIS_SPIN_LOCK SpinLock);
+VOID NdisReleaseSpinLock(PNDIS_SPIN_LOCK SpinLock);
+VOID NdisDprAcquireSpinLock(PNDIS_SPIN_LOCK SpinLock);
+VOID NdisDprReleaseSpinLock(PNDIS_SPIN_LOCK SpinLock);
+
+typedef struct _NDIS_RW_LOCK_EX NDIS_RW_LOCK_EX, *PNDIS_RW_LOCK_EX;
+
+typedef struct _LOCK_STATE_EX
+{
+    KIRQL   OldIrql;
+    UCHAR   LockState;
+} LOCK_STATE_EX, *PLOCK_STATE_EX;
+
+#define NDIS_RWL_AT_DISPATCH_LEVEL  1
+
+PNDIS_RW_LOCK_EX NdisAllocateRWLock(NDIS_HANDLE NdisHandle);
+VOID NdisFreeRWLock(PNDIS_RW_LOCK_EX Lock);
+VOID NdisAcquireRWLockRead(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState, UCHAR Flags);
+VOID NdisAcquireRWLockWrite(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState, UCHAR Flags);
+VOID NdisReleaseRWLock(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState);
+
+typedef struct _NDIS_EVENT
+{
+    KEVENT  Event;
+} NDIS_EVENT, *PNDIS_EVENT;
+
+VOID NdisInitializeEvent(PNDIS_EVENT Event);
+VOID NdisSetEvent(PNDIS_EVENT Event);
+VOID NdisResetEvent(PNDIS_EVENT Event);
+BOOLEAN NdisWaitEvent(PNDIS_EVENT Event, UINT MsToWait);
+
+#define NdisInterlockedIncrement(p)     InterlockedIncrement(p)
+#define NdisInterlockedDecrement(p)     InterlockedDecrement(p)
+#define NdisInitializeListHead(h)       InitializeListHead(h)
+
+VOID NdisMSleep(ULONG MicrosecondsToSleep);
+VOID NdisGetSystemUpTimeEx(PLARGE_INTEGER pSystemUpTime);
+
+//
+// Memory
+//
+
+typedef enum _EX_POOL_PRIORITY
+{
+    LowPoolPriority,
+    NormalPoolPriority = 16,
+    HighPoolPriority = 32
+} EX_POOL_PRIORITY;
+
+#define NdisMoveMemory(d, s, n)     memmove((d), (s), (n))
+#define NdisZeroMemory(d, n)        memset((d), 0, (n))
+#define NdisFillMemory(d, n, c)     memset((d), (c), (n))
+#define NdisEqualMemory(a, b, n)    (memcmp((a), (b), (n)) == 0)
+
+PVOID NdisAllocateMemoryWithTagPriority(NDIS_HANDLE NdisHandle, UINT Length, ULONG Tag,
+    EX_POOL_PRIORITY Priority);
+NDIS_STATUS NdisAllocateMemoryWithTag(PVOID *VirtualAddress, UINT Length, ULONG Tag);
+VOID NdisFreeMemory(PVOID VirtualAddress, UINT Length, UINT MemoryFlags);
+
+PMDL NdisAllocateMdl(NDIS_HANDLE NdisHandle, PVOID VirtualAddress, UINT Length);
+VOID NdisFreeMdl(PMDL Mdl);
+
+#define NdisQueryMdl(_Mdl, _VirtualAddress, _Length, _Priority)         \
+{                                                                       \
+    if (ARGUMENT_PRESENT(_VirtualAddress))                              \
+    {                                                                   \
+        *(PVOID *)(_VirtualAddress) = MmGetSystemAddressForMdlSafe(_Mdl, _Priority); \
+    }                                                                   \
+    *(_Length) = MmGetMdlByteCount(_Mdl);                               \
+}
+
+#define ARGUMENT_PRESENT(p)     ((p) != NULL)
+
+//
+// Net buffers
+//
+
+typedef struct _NET_BUFFER NET_BUFFER, *PNET_BUFFER;
+typedef struct _NET_BUFFER_LIST NET_BUFFER_LIST, *PNET_BUFFER_LIST;
+
+struct _NET_BUFFER
+{
+    PNET_BUFFER     Next;
+    PMDL            CurrentMdl;
+    ULONG           CurrentMdlOffset;
+    ULONG           DataLength;
+    PMDL            MdlChain;
+    ULONG           DataOffset;
+    PVOID           MiniportReserved[4];
+    PVOID           ProtocolReserved[6];
+};
+
+typedef enum _NDIS_NET_BUFFER_LIST_INFO
+{
+    TcpIpChecksumNetBufferListInfo,
+    TcpLargeSendNetBufferListInfo,
+    Ieee8021QNetBufferListInfo,
+    NetBufferListCancelId,
+    NetBufferListHashValue,
+    NetBufferListHashInfo,
+    MaxNetBufferListInfo
+} NDIS_NET_BUFFER_LIST_INFO;
+
+struct _NET_BUFFER_LIST
+{
+    PNET_BUFFER_LIST    Next;
+    PNET_BUFFER         FirstNetBuffer;
+    PVOID               ProtocolReserved[4];
+    PVOID               MiniportReserved[2];
+    PVOID               Scratch;
+    NDIS_HANDLE         SourceHandle;
+    ULONG               NblFlags;
+    LONG                ChildRefCount;
+    ULONG               Flags;
+    NDIS_STATUS         Status;
+    PVOID               NetBufferListInfo[MaxNetBufferListInfo];
+
+    // Host only: the pool it came from.
+    NDIS_HANDLE         HostPool;
+};
+
+#define NBL_FLAGS_MINIPORT_RESERVED     0x0000F000
+
+#define NET_BUFFER_NEXT_NB(_NB)                 ((_NB)->Next)
+#define NET_BUFFER_FIRST_MDL(_NB)               ((_NB)->MdlChain)
+#define NET_BUFFER_DATA_LENGTH(_NB)             ((_NB)->DataLength)
+#define NET_BUFFER_DATA_OFFSET(_NB)             ((_NB)->DataOffset)
+#define NET_BUFFER_CURRENT_MDL(_NB)             ((_NB)->CurrentMdl)
+#define NET_BUFFER_CURRENT_MDL_OFFSET(_NB)      ((_NB)->CurrentMdlOffset)
+#define NET_BUFFER_MINIPORT_RESERVED(_NB)       ((_NB)->MiniportReserved)
+
+#define NET_BUFFER_LIST_NEXT_NBL(_NBL)          ((_NBL)->Next)
+#define NET_BUFFER_LIST_FIRST_NB(_NBL)          ((_NBL)->FirstNetBuffer)
+#define NET_BUFFER_LIST_FLAGS(_NBL)             ((_NBL)->Flags)
+#define NET_BUFFER_LIST_STATUS(_NBL)            ((_NBL)->Status)
+#define NET_BUFFER_LIST_INFO(_NBL, _Id)         ((_NBL)->NetBufferListInfo[(_Id)])
+#define NDIS_GET_NET_BUFFER_LIST_CANCEL_ID(_NBL) \
+    (NET_BUFFER_LIST_INFO(_NBL, NetBufferListCancelId))
+
+typedef struct _NDIS_NET_BUFFER_LIST_8021Q_INFO
+{
+    union
+    {
+        struct
+        {
+            UINT32  UserPriority:3;
+            UINT32  CanonicalFormatId:1;
+            UINT32  VlanId:12;
+            UINT32  Reserved:16;
+        } TagHeader;
+
+        PVOID   Value;
+    };
+} NDIS_NET_BUFFER_LIST_8021Q_INFO, *PNDIS_NET_BUFFER_LIST_8021Q_INFO;
+
+#define NDIS_PROTOCOL_ID_DEFAULT                0x00
+
+typedef struct _NET_BUFFER_LIST_POOL_PARAMETERS
+{
+    NDIS_OBJECT_HEADER  Header;
+    UCHAR               ProtocolId;
+    BOOLEAN             fAllocateNetBuffer;
+    USHORT              ContextSize;
+    ULONG               PoolTag;
+    ULONG               DataSize;
+} NET_BUFFER_LIST_POOL_PARAMETERS, *PNET_BUFFER_LIST_POOL_PARAMETERS;
+
+#define NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1              1
+#define NDIS_SIZEOF_NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1  sizeof(NET_BUFFER_LIST_POOL_PARAMETERS)
+
+NDIS_HANDLE NdisAllocateNetBufferListPool(NDIS_HANDLE NdisHandle,
+    PNET_BUFFER_LIST_POOL_PARAMETERS Parameters);
+VOID NdisFreeNetBufferListPool(NDIS_HANDLE PoolHandle);
+PNET_BUFFER_LIST NdisAllocateNetBufferAndNetBufferList(NDIS_HANDLE PoolHandle,
+    USHORT ContextSize, USHORT ContextBackFill, PMDL MdlChain, ULONG DataOffset,
+    SIZE_T DataLength);
+VOID NdisFreeNetBufferList(PNET_BUFFER_LIST NetBufferList);
+PVOID NdisGetDataBuffer(PNET_BUFFER NetBuffer, ULONG BytesNeeded, PVOID Storage,
+    UINT AlignMultiple, UINT AlignOffset);
+
+//
+// Send and receive
+//
+
+#define NDIS_SEND_FLAGS_DISPATCH_LEVEL              0x00000001
+#define NDIS_SEND_FLAGS_CHECK_FOR_LOOPBACK          0x00000002
+#define NDIS_SEND_COMPLETE_FLAGS_DISPATCH_LEVEL     0x00000001
+#define NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL           0x00000001
+#define NDIS_RECEIVE_FLAGS_RESOURCES                0x00000002
+#define NDIS_RETURN_FLAGS_DISPATCH_LEVEL            0x00000001
+
+VOID NdisMIndicateReceiveNetBufferLists(NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, NDIS_PORT_NUMBER PortNumber,
+    ULONG NumberOfNetBufferLists, ULONG ReceiveFlags);
+VOID NdisMSendNetBufferListsComplete(NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags);
+
+#define NDIS_PACKET_TYPE_DIRECTED               0x00000001
+#define NDIS_PACKET_TYPE_MULTICAST              0x00000002
+#define NDIS_PACKET_TYPE_ALL_MULTICAST          0x00000004
+#define NDIS_PACKET_TYPE_BROADCAST              0x00000008
+#define NDIS_PACKET_TYPE_PROMISCUOUS            0x00000020
+#define NDIS_PACKET_TYPE_ALL_LOCAL              0x00000080
+
+#define NDIS_ETH_TYPE_IPV4                      0x0800
+#define NDIS_ETH_TYPE_ARP                       0x0806
+#define NDIS_ETH_TYPE_802_1Q                    0x8100
+#define NDIS_ETH_TYPE_IPV6                      0x86DD
+
+#define ETH_LENGTH_OF_ADDRESS                   6
+#define ETH_COPY_NETWORK_ADDRESS(d, s)          memcpy((d), (s), ETH_LENGTH_OF_ADDRESS)
+#define ETH_IS_BROADCAST(a) \
+    (((PUCHAR)(a))[0] == 0xFF && ((PUCHAR)(a))[1] == 0xFF && ((PUCHAR)(a))[2] == 0xFF \
+    && ((PUCHAR)(a))[3] == 0xFF && ((PUCHAR)(a))[4] == 0xFF && ((PUCHAR)(a))[5] == 0xFF)
+#define ETH_IS_MULTICAST(a)                     ((((PUCHAR)(a))[0] & 0x01) != 0)
+#define ETH_COMPARE_NETWORK_ADDRESSES_EQ(a, b, r) \
+    (*(r) = RtlCompareMemory((a), (b), ETH_LENGTH_OF_ADDRESS) != ETH_LENGTH_OF_ADDRESS)
+
+#define NDIS_MAC_OPTION_COPY_LOOKAHEAD_DATA     0x00000001
+#define NDIS_MAC_OPTION_TRANSFERS_NOT_PEND      0x00000004
+#define NDIS_MAC_OPTION_NO_LOOPBACK             0x00000008
+#define NDIS_MAC_OPTION_8021P_PRIORITY          0x00000040
+
+//
+// Media and power
+//
+
+typedef enum _NDIS_MEDIUM
+{
+    NdisMedium802_3
+} NDIS_MEDIUM, *PNDIS_MEDIUM;
+
+typedef enum _NDIS_PHYSICAL_MEDIUM
+{
+    NdisPhysicalMediumUnspecified,
+    NdisPhysicalMedium802_3 = 14
+} NDIS_PHYSICAL_MEDIUM;
+
+typedef enum _NDIS_INTERFACE_TYPE
+{
+    NdisInterfaceInternal = 0,
+    NdisInterfacePci = 5
+} NDIS_INTERFACE_TYPE;
+
+typedef enum _NDIS_HARDWARE_STATUS
+{
+    NdisHardwareStatusReady
+} NDIS_HARDWARE_STATUS;
+
+typedef enum _NDIS_DEVICE_POWER_STATE
+{
+    NdisDeviceStateUnspecified,
+    NdisDeviceStateD0,
+    NdisDeviceStateD1,
+    NdisDeviceStateD2,
+    NdisDeviceStateD3
+} NDIS_DEVICE_POWER_STATE, *PNDIS_DEVICE_POWER_STATE;
+
+typedef enum _NDIS_POWER_PROFILE
+{
+    NdisPowerProfileBattery,
+    NdisPowerProfileAcOnLine
+} NDIS_POWER_PROFILE;
+
+typedef enum _NDIS_MEDIA_CONNECT_STATE
+{
+    MediaConnectStateUnknown,
+    MediaConnectStateConnected,
+    MediaConnectStateDisconnected
+} NDIS_MEDIA_CONNECT_STATE;
+
+typedef enum _NDIS_MEDIA_DUPLEX_STATE
+{
+    MediaDuplexStateUnknown,
+    MediaDuplexStateHalf,
+    MediaDuplexStateFull
+} NDIS_MEDIA_DUPLEX_STATE;
+
+typedef enum _NDIS_SUPPORTED_PAUSE_FUNCTIONS
+{
+    NdisPauseFunctionsUnsupported
+} NDIS_SUPPORTED_PAUSE_FUNCTIONS;
+
+typedef enum _NDIS_INTERRUPT_MODERATION
+{
+    NdisInterruptModerationUnknown,
+    NdisInterruptModerationNotSupported
+} NDIS_INTERRUPT_MODERATION;
+
+typedef enum _NET_IF_ACCESS_TYPE
+{
+    NET_IF_ACCESS_BROADCAST = 2
+} NET_IF_ACCESS_TYPE;
+
+typedef enum _NET_IF_DIRECTION_TYPE
+{
+    NET_IF_DIRECTION_SENDRECEIVE
+} NET_IF_DIRECTION_TYPE;
+
+typedef enum _NET_IF_CONNECTION_TYPE
+{
+    NET_IF_CONNECTION_DEDICATED = 1
+} NET_IF_CONNECTION_TYPE;
+
+typedef enum _NET_IF_MEDIA_CONNECT_STATE
+{
+    NET_IF_MEDIA_CONNECT_STATE_UNUSED
+} NET_IF_MEDIA_CONNECT_STATE;
+
+#define IF_TYPE_ETHERNET_CSMACD                 6
+
+#define NDIS_LINK_STATE_DUPLEX_AUTO_NEGOTIATED  0x00000004
+
+typedef struct _NDIS_LINK_STATE
+{
+    NDIS_OBJECT_HEADER          Header;
+    NDIS_MEDIA_CONNECT_STATE    MediaConnectState;
+    NDIS_MEDIA_DUPLEX_STATE     MediaDuplexState;
+    ULONG64                     XmitLinkSpeed;
+    ULONG64                     RcvLinkSpeed;
+    NDIS_SUPPORTED_PAUSE_FUNCTIONS PauseFunctions;
+    ULONG                       AutoNegotiationFlags;
+} NDIS_LINK_STATE, *PNDIS_LINK_STATE;
+
+#define NDIS_LINK_STATE_REVISION_1              1
+#define NDIS_SIZEOF_LINK_STATE_REVISION_1       sizeof(NDIS_LINK_STATE)
+
+typedef struct _NDIS_PM_CAPABILITIES
+{
+    NDIS_OBJECT_HEADER          Header;
+    ULONG                       Flags;
+    ULONG                       SupportedWoLPacketPatterns;
+    ULONG                       NumTotalWoLPatterns;
+    ULONG                       MaxWoLPatternSize;
+    ULONG                       MaxWoLPatternOffset;
+    ULONG                       MaxWoLPacketSaveBuffer;
+    ULONG                       SupportedProtocolOffloads;
+    ULONG                       NumArpOffloadIPv4Addresses;
+    ULONG                       NumNSOffloadIPv6Addresses;
+    NDIS_DEVICE_POWER_STATE     MinMagicPacketWakeUp;
+    NDIS_DEVICE_POWER_STATE     MinPatternWakeUp;
+    NDIS_DEVICE_POWER_STATE     MinLinkChangeWakeUp;
+} NDIS_PM_CAPABILITIES, *PNDIS_PM_CAPABILITIES;
+
+#define NDIS_PM_CAPABILITIES_REVISION_1             1
+#define NDIS_SIZEOF_NDIS_PM_CAPABILITIES_REVISION_1 sizeof(NDIS_PM_CAPABILITIES)
+
+typedef struct _NDIS_INTERRUPT_MODERATION_PARAMETERS
+{
+    NDIS_OBJECT_HEADER          Header;
+    ULONG                       Flags;
+    NDIS_INTERRUPT_MODERATION   InterruptModeration;
+} NDIS_INTERRUPT_MODERATION_PARAMETERS, *PNDIS_INTERRUPT_MODERATION_PARAMETERS;
+
+#define NDIS_INTERRUPT_MODERATION_PARAMETERS_REVISION_1             1
+#define NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1      \
+    sizeof(NDIS_INTERRUPT_MODERATION_PARAMETERS)
+
+typedef struct _NDIS_STATISTICS_INFO
+{
+    NDIS_OBJECT_HEADER  Header;
+    ULONG               SupportedStatistics;
+    ULONG64             ifInDiscards;
+    ULONG64             ifInErrors;
+    ULONG64             ifHCInOctets;
+    ULONG64             ifHCInUcastPkts;
+    ULONG64             ifHCInMulticastPkts;
+    ULONG64             ifHCInBroadcastPkts;
+    ULONG64             ifHCOutOctets;
+    ULONG64             ifHCOutUcastPkts;
+    ULONG64             ifHCOutMulticastPkts;
+    ULONG64             ifHCOutBroadcastPkts;
+    ULONG64             ifOutErrors;
+    ULONG64             ifOutDiscards;
+    ULONG64             ifHCInUcastOctets;
+    ULONG64             ifHCInMulticastOctets;
+    ULONG64             ifHCInBroadcastOctets;
+    ULONG64             ifHCOutUcastOctets;
+    ULONG64             ifHCOutMulticastOctets;
+    ULONG64             ifHCOutBroadcastOctets;
+} NDIS_STATISTICS_INFO, *PNDIS_STATISTICS_INFO;
+
+#define NDIS_STATISTICS_INFO_REVISION_1             1
+#define NDIS_SIZEOF_STATISTICS_INFO_REVISION_1      sizeof(NDIS_STATISTICS_INFO)
+
+#define NDIS_STATISTICS_FLAGS_VALID_DIRECTED_FRAMES_RCV     0x00000001
+#define NDIS_STATISTICS_FLAGS_VALID_MULTICAST_FRAMES_RCV    0x00000002
+#define NDIS_STATISTICS_FLAGS_VALID_BROADCAST_FRAMES_RCV    0x00000004
+#define NDIS_STATISTICS_FLAGS_VALID_BYTES_RCV               0x00000008
+#define NDIS_STATISTICS_FLAGS_VALID_RCV_DISCARDS            0x00000010
+#define NDIS_STATISTICS_FLAGS_VALID_RCV_ERROR               0x00000020
+#define NDIS_STATISTICS_FLAGS_VALID_DIRECTED_FRAMES_XMIT    0x00000040
+#define NDIS_STATISTICS_FLAGS_VALID_MULTICAST_FRAMES_XMIT   0x00000080
+#define NDIS_STATISTICS_FLAGS_VALID_BROADCAST_FRAMES_XMIT   0x00000100
+#define NDIS_STATISTICS_FLAGS_VALID_BYTES_XMIT              0x00000200
+#define NDIS_STATISTICS_FLAGS_VALID_XMIT_ERROR              0x00000400
+#define NDIS_STATISTICS_FLAGS_VALID_XMIT_DISCARDS           0x00008000
+#define NDIS_STATISTICS_FLAGS_VALID_DIRECTED_BYTES_RCV      0x00010000
+#define NDIS_STATISTICS_FLAGS_VALID_MULTICAST_BYTES_RCV     0x00020000
+#define NDIS_STATISTICS_FLAGS_VALID_BROADCAST_BYTES_RCV     0x00040000
+#define NDIS_STATISTICS_FLAGS_VALID_DIRECTED_BYTES_XMIT     0x00080000
+#define NDIS_STATISTICS_FLAGS_VALID_MULTICAST_BYTES_XMIT    0x00100000
+#define NDIS_STATISTICS_FLAGS_VALID_BROADCAST_BYTES_XMIT    0x00200000
+
+//
+// Status indications
+//
+
+typedef struct _NDIS_STATUS_INDICATION
+{
+    NDIS_OBJECT_HEADER  Header;
+    NDIS_HANDLE         SourceHandle;
+    NDIS_PORT_NUMBER    PortNumber;
+    NDIS_STATUS         StatusCode;
+    ULONG               Flags;
+    NDIS_HANDLE         DestinationHandle;
+    PVOID               RequestId;
+    PVOID               StatusBuffer;
+    ULONG               StatusBufferSize;
+    GUID                Guid;
+    PVOID               NdisReserved[4];
+} NDIS_STATUS_INDICATION, *PNDIS_STATUS_INDICATION;
+
+#define NDIS_STATUS_INDICATION_REVISION_1           1
+#define NDIS_SIZEOF_STATUS_INDICATION_REVISION_1    sizeof(NDIS_STATUS_INDICATION)
+
+VOID NdisMIndicateStatusEx(NDIS_HANDLE MiniportAdapterHandle,
+    PNDIS_STATUS_INDICATION StatusIndication);
+
+//
+// OID requests
+//
+
+typedef enum _NDIS_REQUEST_TYPE
+{
+    NdisRequestQueryInformation,
+    NdisRequestSetInformation,
+    NdisRequestQueryStatistics,
+    NdisRequestOpen,
+    NdisRequestClose,
+    NdisRequestSend,
+    NdisRequestTransferData,
+    NdisRequestReset,
+    NdisRequestGeneric1,
+    NdisRequestGeneric2,
+    NdisRequestGeneric3,
+    NdisRequestGeneric4,
+    NdisRequestMethod = 12
+} NDIS_REQUEST_TYPE;
+
+typedef struct _NDIS_OID_REQUEST
+{
+    NDIS_OBJECT_HEADER  Header;
+    NDIS_REQUEST_TYPE   RequestType;
+    NDIS_PORT_NUMBER    PortNumber;
+    UINT                Timeout;
+    PVOID               RequestId;
+    NDIS_HANDLE         RequestHandle;
+
+    union _REQUEST_DATA
+    {
+        struct _QUERY
+        {
+            NDIS_OID    Oid;
+            PVOID       InformationBuffer;
+            UINT        InformationBufferLength;
+            UINT        BytesWritten;
+            UINT        BytesNeeded;
+        } QUERY_INFORMATION;
+
+        struct _SET
+        {
+            NDIS_OID    Oid;
+            PVOID       InformationBuffer;
+            UINT        InformationBufferLength;
+            UINT        BytesRead;
+            UINT        BytesNeeded;
+        } SET_INFORMATION;
+
+        struct _METHOD
+        {
+            NDIS_OID    Oid;
+            PVOID       InformationBuffer;
+            ULONG       InputBufferLength;
+            ULONG       OutputBufferLength;
+            ULONG       MethodId;
+            UINT        BytesWritten;
+            UINT        BytesRead;
+            UINT        BytesNeeded;
+        } METHOD_INFORMATION;
+    } DATA;
+} NDIS_OID_REQUEST, *PNDIS_OID_REQUEST;
+
+//
+// OIDs
+//
+
+#define OID_GEN_SUPPORTED_LIST                  0x00010101
+#define OID_GEN_HARDWARE_STATUS                 0x00010102
+#define OID_GEN_MEDIA_SUPPORTED                 0x00010103
+#define OID_GEN_MEDIA_IN_USE                    0x00010104
+#define OID_GEN_MAXIMUM_LOOKAHEAD               0x00010105
+#define OID_GEN_MAXIMUM_FRAME_SIZE              0x00010106
+#define OID_GEN_LINK_SPEED                      0x00010107
+#define OID_GEN_TRANSMIT_BUFFER_SPACE           0x00010108
+#define OID_GEN_RECEIVE_BUFFER_SPACE            0x00010109
+#define OID_GEN_TRANSMIT_BLOCK_SIZE             0x0001010A
+#define OID_GEN_RECEIVE_BLOCK_SIZE              0x0001010B
+#define OID_GEN_VENDOR_ID                       0x0001010C
+#define OID_GEN_VENDOR_DESCRIPTION              0x0001010D
+#define OID_GEN_CURRENT_PACKET_FILTER           0x0001010E
+#define OID_GEN_CURRENT_LOOKAHEAD               0x0001010F
+#define OID_GEN_DRIVER_VERSION                  0x00010110
+#define OID_GEN_MAXIMUM_TOTAL_SIZE              0x00010111
+#define OID_GEN_PROTOCOL_OPTIONS                0x00010112
+#define OID_GEN_MAC_OPTIONS                     0x00010113
+#define OID_GEN_MEDIA_CONNECT_STATUS            0x00010114
+#define OID_GEN_MAXIMUM_SEND_PACKETS            0x00010115
+#define OID_GEN_VENDOR_DRIVER_VERSION           0x00010116
+#define OID_GEN_SUPPORTED_GUIDS                 0x00010117
+#define OID_GEN_NETWORK_LAYER_ADDRESSES         0x00010118
+#define OID_GEN_TRANSPORT_HEADER_OFFSET         0x00010119
+#define OID_GEN_MEDIA_CAPABILITIES              0x00010201
+#define OID_GEN_PHYSICAL_MEDIUM                 0x00010202
+#define OID_GEN_RECEIVE_SCALE_CAPABILITIES      0x00010203
+#define OID_GEN_RECEIVE_SCALE_PARAMETERS        0x00010204
+#define OID_GEN_MAC_ADDRESS                     0x00010205
+#define OID_GEN_MAX_LINK_SPEED                  0x00010206
+#define OID_GEN_LINK_STATE                      0x00010207
+#define OID_GEN_LINK_PARAMETERS                 0x00010208
+#define OID_GEN_INTERRUPT_MODERATION            0x00010209
+#define OID_GEN_NDIS_RESERVED_3                 0x0001020A
+#define OID_GEN_NDIS_RESERVED_4                 0x0001020B
+#define OID_GEN_NDIS_RESERVED_5                 0x0001020C
+#define OID_GEN_ENUMERATE_PORTS                 0x0001020D
+#define OID_GEN_PORT_STATE                      0x0001020E
+#define OID_GEN_PORT_AUTHENTICATION_PARAMETERS  0x0001020F
+#define OID_GEN_TIMEOUT_DPC_REQUEST_CAPABILITIES 0x00010210
+#define OID_GEN_PCI_DEVICE_CUSTOM_PROPERTIES    0x00010211
+#define OID_GEN_PHYSICAL_MEDIUM_EX              0x00010212
+#define OID_GEN_MACHINE_NAME                    0x0001021A
+#define OID_GEN_RNDIS_CONFIG_PARAMETER          0x0001021B
+#define OID_GEN_VLAN_ID                         0x0001021C
+#define OID_GEN_RECEIVE_HASH                    0x0001021F
+#define OID_GEN_MINIPORT_RESTART_ATTRIBUTES     0x0001021D
+#define OID_GEN_XMIT_OK                         0x00020101
+#define OID_GEN_RCV_OK                          0x00020102
+#define OID_GEN_BYTES_RCV                       0x00020219
+#define OID_GEN_BYTES_XMIT                      0x0002021A
+#define OID_GEN_XMIT_ERROR                      0x00020103
+#define OID_GEN_RCV_ERROR                       0x00020104
+#define OID_GEN_RCV_NO_BUFFER                   0x00020105
+#define OID_GEN_STATISTICS                      0x00020106
+#define OID_GEN_DIRECTED_BYTES_XMIT             0x00020201
+#define OID_GEN_DIRECTED_FRAMES_XMIT            0x00020202
+#define OID_GEN_MULTICAST_BYTES_XMIT            0x00020203
+#define OID_GEN_MULTICAST_FRAMES_XMIT           0x00020204
+#define OID_GEN_BROADCAST_BYTES_XMIT            0x00020205
+#define OID_GEN_BROADCAST_FRAMES_XMIT           0x00020206
+#define OID_GEN_DIRECTED_BYTES_RCV              0x00020207
+#define OID_GEN_DIRECTED_FRAMES_RCV             0x00020208
+#define OID_GEN_MULTICAST_BYTES_RCV             0x00020209
+#define OID_GEN_MULTICAST_FRAMES_RCV            0x0002020A
+#define OID_GEN_BROADCAST_BYTES_RCV             0x0002020B
+#define OID_GEN_BROADCAST_FRAMES_RCV            0x0002020C
+#define OID_GEN_RCV_CRC_ERROR                   0x0002020D
+#define OID_GEN_TRANSMIT_QUEUE_LENGTH           0x0002020E
+#define OID_GEN_GET_TIME_CAPS                   0x0002020F
+#define OID_GEN_GET_NETCARD_TIME                0x00020210
+#define OID_GEN_NETCARD_LOAD                    0x00020211
+#define OID_GEN_DEVICE_PROFILE                  0x00020212
+#define OID_GEN_INIT_TIME_MS                    0x00020213
+#define OID_GEN_RESET_COUNTS                    0x00020214
+#define OID_GEN_MEDIA_SENSE_COUNTS              0x00020215
+#define OID_GEN_RCV_DISCARDS                    0x0002021B
+#define OID_GEN_XMIT_DISCARDS                   0x0002021C
+#define OID_802_3_PERMANENT_ADDRESS             0x01010101
+#define OID_802_3_CURRENT_ADDRESS               0x01010102
+#define OID_802_3_MULTICAST_LIST                0x01010103
+#define OID_802_3_MAXIMUM_LIST_SIZE             0x01010104
+#define OID_802_3_MAC_OPTIONS                   0x01010105
+#define OID_802_3_ADD_MULTICAST_ADDRESS         0x01010208
+#define OID_802_3_DELETE_MULTICAST_ADDRESS      0x01010209
+#define OID_802_3_RCV_ERROR_ALIGNMENT           0x01020101
+#define OID_802_3_XMIT_ONE_COLLISION            0x01020102
+#define OID_802_3_XMIT_MORE_COLLISIONS          0x01020103
+#define OID_802_3_XMIT_DEFERRED                 0x01020201
+#define OID_802_3_XMIT_MAX_COLLISIONS           0x01020202
+#define OID_802_3_RCV_OVERRUN                   0x01020203
+#define OID_802_3_XMIT_UNDERRUN                 0x01020204
+#define OID_802_3_XMIT_HEARTBEAT_FAILURE        0x01020205
+#define OID_802_3_XMIT_TIMES_CRS_LOST           0x01020206
+#define OID_802_3_XMIT_LATE_COLLISIONS          0x01020207
+#define OID_PNP_CAPABILITIES                    0xFD010100
+#define OID_PNP_SET_POWER                       0xFD010101
+#define OID_PNP_QUERY_POWER                     0xFD010102
+#define OID_PNP_ADD_WAKE_UP_PATTERN             0xFD010103
+#define OID_PNP_REMOVE_WAKE_UP_PATTERN          0xFD010104
+#define OID_PNP_WAKE_UP_PATTERN_LIST            0xFD010105
+#define OID_PNP_ENABLE_WAKE_UP                  0xFD010106
+#define OID_PNP_WAKE_UP_OK                      0xFD020200
+#define OID_PNP_WAKE_UP_ERROR                   0xFD020201
+#define OID_PM_CURRENT_CAPABILITIES             0xFD010107
+#define OID_PM_HARDWARE_CAPABILITIES            0xFD010108
+#define OID_PM_PARAMETERS                       0xFD010109
+#define OID_PM_ADD_WOL_PATTERN                  0xFD01010A
+#define OID_PM_REMOVE_WOL_PATTERN               0xFD01010B
+#define OID_PM_WOL_PATTERN_LIST                 0xFD01010C
+#define OID_TCP_TASK_OFFLOAD                    0xFC010201
+#define OID_TCP_TASK_IPSEC_ADD_SA               0xFC010202
+#define OID_TCP_TASK_IPSEC_DELETE_SA            0xFC010203
+#define OID_TCP_SAN_SUPPORT                     0xFC010204
+#define OID_TCP_TASK_IPSEC_ADD_UDPESP_SA        0xFC010205
+#define OID_TCP_TASK_IPSEC_DELETE_UDPESP_SA     0xFC010206
+#define OID_TCP4_OFFLOAD_STATS                  0xFC010207
+#define OID_TCP6_OFFLOAD_STATS                  0xFC010208
+#define OID_IP4_OFFLOAD_STATS                   0xFC010209
+#define OID_IP6_OFFLOAD_STATS                   0xFC01020A
+#define OID_TCP_OFFLOAD_CURRENT_CONFIG          0xFC01020B
+#define OID_TCP_OFFLOAD_PARAMETERS              0xFC01020C
+#define OID_TCP_OFFLOAD_HARDWARE_CAPABILITIES   0xFC01020D
+#define OID_TCP_CONNECTION_OFFLOAD_CURRENT_CONFIG 0xFC01020E
+#define OID_TCP_CONNECTION_OFFLOAD_HARDWARE_CAPABILITIES 0xFC01020F
+#define OID_OFFLOAD_ENCAPSULATION               0x0101010A
+#define OID_QOS_PARAMETERS                      0x00010222
+#define OID_RECEIVE_FILTER_ALLOCATE_QUEUE       0x00010230
+#define OID_RECEIVE_FILTER_FREE_QUEUE           0x00010231
+#define OID_RECEIVE_FILTER_SET_FILTER           0x00010232
+#define OID_RECEIVE_FILTER_CLEAR_FILTER         0x00010233
+#define OID_RECEIVE_FILTER_QUEUE_ALLOCATION_COMPLETE 0x00010234
+
+//
+// Configuration
+//
+
+typedef enum _NDIS_PARAMETER_TYPE
+{
+    NdisParameterInteger,
+    NdisParameterHexInteger,
+    NdisParameterString,
+    NdisParameterMultiString,
+    NdisParameterBinary
+} NDIS_PARAMETER_TYPE;
+
+typedef struct _NDIS_CONFIGURATION_PARAMETER
+{
+    NDIS_PARAMETER_TYPE ParameterType;
+
+    union
+    {
+        ULONG           IntegerData;
+        NDIS_STRING     StringData;
+    } ParameterData;
+} NDIS_CONFIGURATION_PARAMETER, *PNDIS_CONFIGURATION_PARAMETER;
+
+typedef struct _NDIS_CONFIGURATION_OBJECT
+{
+    NDIS_OBJECT_HEADER  Header;
+    NDIS_HANDLE         NdisHandle;
+    ULONG               Flags;
+} NDIS_CONFIGURATION_OBJECT, *PNDIS_CONFIGURATION_OBJECT;
+
+#define NDIS_CONFIGURATION_OBJECT_REVISION_1            1
+#define NDIS_SIZEOF_CONFIGURATION_OBJECT_REVISION_1     sizeof(NDIS_CONFIGURATION_OBJECT)
+
+NDIS_STATUS NdisOpenConfigurationEx(PNDIS_CONFIGURATION_OBJECT ConfigObject,
+    PNDIS_HANDLE ConfigurationHandle);
+VOID NdisCloseConfiguration(NDIS_HANDLE ConfigurationHandle);
+VOID NdisReadConfiguration(PNDIS_STATUS Status,
+    PNDIS_CONFIGURATION_PARAMETER *ParameterValue, NDIS_HANDLE ConfigurationHandle,
+    PNDIS_STRING Keyword, NDIS_PARAMETER_TYPE ParameterType);
+// The WDK's PVOID * draws a C4047 the driver build ignores; take any pointer.
+VOID NdisReadNetworkAddress(PNDIS_STATUS Status, PVOID NetworkAddress,
+    PUINT NetworkAddressLength, NDIS_HANDLE ConfigurationHandle);
+
+//
+// Miniport driver and adapter registration
+//
+
+typedef struct _NDIS_MINIPORT_INIT_PARAMETERS
+{
+    NDIS_OBJECT_HEADER  Header;
+    ULONG               Flags;
+    NET_IFINDEX         IfIndex;
+} NDIS_MINIPORT_INIT_PARAMETERS, *PNDIS_MINIPORT_INIT_PARAMETERS;
+
+typedef struct _NDIS_MINIPORT_PAUSE_PARAMETERS
+{
+    NDIS_OBJECT_HEADER  Header;
+    ULONG               Flags;
+    ULONG               PauseReason;
+} NDIS_MINIPORT_PAUSE_PARAMETERS, *PNDIS_MINIPORT_PAUSE_PARAMETERS;
+
+typedef struct _NDIS_MINIPORT_RESTART_PARAMETERS
+{
+    NDIS_OBJECT_HEADER  Header;
+    ULONG               Flags;
+} NDIS_MINIPORT_RESTART_PARAMETERS, *PNDIS_MINIPORT_RESTART_PARAMETERS;
+
+typedef enum _NDIS_HALT_ACTION
+{
+    NdisHaltDeviceDisabled,
+    NdisHaltDeviceInstanceDeInstalled,
+    NdisHaltDevicePoweredDown,
+    NdisHaltDeviceSurpriseRemoved
+} NDIS_HALT_ACTION;
+
+typedef enum _NDIS_SHUTDOWN_ACTION
+{
+    NdisShutdownPowerOff,
+    NdisShutdownBugCheck
+} NDIS_SHUTDOWN_ACTION;
+
+typedef enum _NDIS_DEVICE_PNP_EVENT
+{
+    NdisDevicePnPEventQueryRemoved,
+    NdisDevicePnPEventRemoved,
+    NdisDevicePnPEventSurpriseRemoved,
+    NdisDevicePnPEventQueryStopped,
+    NdisDevicePnPEventStopped,
+    NdisDevicePnPEventPowerProfileChanged
+} NDIS_DEVICE_PNP_EVENT;
+
+typedef struct _NET_DEVICE_PNP_EVENT
+{
+    NDIS_OBJECT_HEADER      Header;
+    NDIS_PORT_NUMBER        PortNumber;
+    NDIS_DEVICE_PNP_EVENT   DevicePnPEvent;
+    PVOID                   InformationBuffer;
+    ULONG                   InformationBufferLength;
+} NET_DEVICE_PNP_EVENT, *PNET_DEVICE_PNP_EVENT;
+
+typedef struct _NDIS_RECEIVE_SCALE_CAPABILITIES *PNDIS_RECEIVE_SCALE_CAPABILITIES;
+typedef struct _NDIS_PM_CAPABILITIES_EX *PNDIS_PM_CAPABILITIES_EX;
+
+typedef struct _NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES
+{
+    NDIS_OBJECT_HEADER  Header;
+    NDIS_HANDLE         MiniportAdapterContext;
+    ULONG               AttributeFlags;
+    UINT                CheckForHangTimeInSeconds;
+    NDIS_INTERFACE_TYPE InterfaceType;
+} NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES;
+
+#define NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES_REVISION_1          1
+#define NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES_REVISION_2          2
+#define NDIS_SIZEOF_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES_REVISION_1   \
+    sizeof(NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES)
+#define NDIS_SIZEOF_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES_REVISION_2   \
+    sizeof(NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES)
+
+#define NDIS_MINIPORT_ATTRIBUTES_SURPRISE_REMOVE_OK     0x00000008
+#define NDIS_MINIPORT_ATTRIBUTES_NDIS_WDM               0x00000200
+#define NDIS_MINIPORT_ATTRIBUTES_NO_HALT_ON_SUSPEND     0x00000010
+
+typedef struct _NDIS_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES
+{
+    NDIS_OBJECT_HEADER          Header;
+    ULONG                       Flags;
+    NDIS_MEDIUM                 MediaType;
+    NDIS_PHYSICAL_MEDIUM        PhysicalMediumType;
+    ULONG                       MtuSize;
+    ULONG64                     MaxXmitLinkSpeed;
+    ULONG64                     XmitLinkSpeed;
+    ULONG64                     MaxRcvLinkSpeed;
+    ULONG64                     RcvLinkSpeed;
+    NDIS_MEDIA_CONNECT_STATE    MediaConnectState;
+    NDIS_MEDIA_DUPLEX_STATE     MediaDuplexState;
+    ULONG                       LookaheadSize;
+    PNDIS_PM_CAPABILITIES       PowerManagementCapabilities;
+    ULONG                       MacOptions;
+    ULONG                       SupportedPacketFilters;
+    ULONG                       MaxMulticastListSize;
+    USHORT                      MacAddressLength;
+    UCHAR                       PermanentMacAddress[32];
+    UCHAR                       CurrentMacAddress[32];
+    PNDIS_RECEIVE_SCALE_CAPABILITIES RecvScaleCapabilities;
+    NET_IF_ACCESS_TYPE          AccessType;
+    NET_IF_DIRECTION_TYPE       DirectionType;
+    NET_IF_CONNECTION_TYPE      ConnectionType;
+    NET_IFTYPE                  IfType;
+    BOOLEAN                     IfConnectorPresent;
+    ULONG                       SupportedStatistics;
+    ULONG                       SupportedPauseFunctions;
+    ULONG                       DataBackFillSize;
+    ULONG                       ContextBackFillSize;
+    PNDIS_OID                   SupportedOidList;
+    ULONG                       SupportedOidListLength;
+    ULONG                       AutoNegotiationFlags;
+    PNDIS_PM_CAPABILITIES       PowerManagementCapabilitiesEx;
+} NDIS_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES;
+
+#define NDIS_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES_REVISION_2          2
+#define NDIS_SIZEOF_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES_REVISION_2   \
+    sizeof(NDIS_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES)
+
+typedef union _NDIS_MINIPORT_ADAPTER_ATTRIBUTES
+{
+    NDIS_MINIPORT_ADAPTER_REGISTRATION_ATTRIBUTES   RegistrationAttributes;
+    NDIS_MINIPORT_ADAPTER_GENERAL_ATTRIBUTES        GeneralAttributes;
+} NDIS_MINIPORT_ADAPTER_ATTRIBUTES, *PNDIS_MINIPORT_ADAPTER_ATTRIBUTES;
+
+NDIS_STATUS NdisMSetMiniportAttributes(NDIS_HANDLE NdisMiniportHandle,
+    PNDIS_MINIPORT_ADAPTER_ATTRIBUTES MiniportAttributes);
+
+typedef NDIS_STATUS MINIPORT_SET_OPTIONS(NDIS_HANDLE NdisDriverHandle,
+    NDIS_HANDLE DriverContext);
+typedef NDIS_STATUS MINIPORT_INITIALIZE(NDIS_HANDLE MiniportAdapterHandle,
+    NDIS_HANDLE MiniportDriverContext, PNDIS_MINIPORT_INIT_PARAMETERS MiniportInitParameters);
+typedef VOID MINIPORT_HALT(NDIS_HANDLE MiniportAdapterContext, NDIS_HALT_ACTION HaltAction);
+typedef VOID MINIPORT_UNLOAD(PDRIVER_OBJECT DriverObject);
+typedef NDIS_STATUS MINIPORT_PAUSE(NDIS_HANDLE MiniportAdapterContext,
+    PNDIS_MINIPORT_PAUSE_PARAMETERS PauseParameters);
+typedef NDIS_STATUS MINIPORT_RESTART(NDIS_HANDLE MiniportAdapterContext,
+    PNDIS_MINIPORT_RESTART_PARAMETERS RestartParameters);
+typedef NDIS_STATUS MINIPORT_OID_REQUEST(NDIS_HANDLE MiniportAdapterContext,
+    PNDIS_OID_REQUEST OidRequest);
+typedef VOID MINIPORT_SEND_NET_BUFFER_LISTS(NDIS_HANDLE MiniportAdapterContext,
+    PNET_BUFFER_LIST NetBufferList, NDIS_PORT_NUMBER PortNumber, ULONG SendFlags);
+typedef VOID MINIPORT_RETURN_NET_BUFFER_LISTS(NDIS_HANDLE MiniportAdapterContext,
+    PNET_BUFFER_LIST NetBufferLists, ULONG ReturnFlags);
+typedef VOID MINIPORT_CANCEL_SEND(NDIS_HANDLE MiniportAdapterContext, PVOID CancelId);
+typedef BOOLEAN MINIPORT_CHECK_FOR_HANG(NDIS_HANDLE MiniportAdapterContext);
+typedef NDIS_STATUS MINIPORT_RESET(NDIS_HANDLE MiniportAdapterContext,
+    PBOOLEAN AddressingReset);
+typedef VOID MINIPORT_DEVICE_PNP_EVENT_NOTIFY(NDIS_HANDLE MiniportAdapterContext,
+    PNET_DEVICE_PNP_EVENT NetDevicePnPEvent);
+typedef VOID MINIPORT_SHUTDOWN(NDIS_HANDLE MiniportAdapterContext,
+    NDIS_SHUTDOWN_ACTION ShutdownAction);
+typedef VOID MINIPORT_CANCEL_OID_REQUEST(NDIS_HANDLE MiniportAdapterContext, PVOID RequestId);
+typedef NDIS_STATUS MINIPORT_DIRECT_OID_REQUEST(NDIS_HANDLE MiniportAdapterContext,
+    PNDIS_OID_REQUEST OidRequest);
+typedef VOID MINIPORT_CANCEL_DIRECT_OID_REQUEST(NDIS_HANDLE MiniportAdapterContext,
+    PVOID RequestId);
+
+typedef struct _NDIS_MINIPORT_DRIVER_CHARACTERISTICS
+{
+    NDIS_OBJECT_HEADER                  Header;
+    UCHAR                               MajorNdisVersion;
+    UCHAR                               MinorNdisVersion;
+    UCHAR                               MajorDriverVersion;
+    UCHAR                               MinorDriverVersion;
+    ULONG                               Flags;
+    MINIPORT_SET_OPTIONS                *SetOptionsHandler;
+    MINIPORT_INITIALIZE                 *InitializeHandlerEx;
+    MINIPORT_HALT                       *HaltHandlerEx;
+    MINIPORT_UNLOAD                     *UnloadHandler;
+    MINIPORT_PAUSE                      *PauseHandler;
+    MINIPORT_RESTART                    *RestartHandler;
+    MINIPORT_OID_REQUEST                *OidRequestHandler;
+    MINIPORT_SEND_NET_BUFFER_LISTS      *SendNetBufferListsHandler;
+    MINIPORT_RETURN_NET_BUFFER_LISTS    *ReturnNetBufferListsHandler;
+    MINIPORT_CANCEL_SEND                *CancelSendHandler;
+    MINIPORT_CHECK_FOR_HANG             *CheckForHangHandlerEx;
+    MINIPORT_RESET                      *ResetHandlerEx;
+    MINIPORT_DEVICE_PNP_EVENT_NOTIFY    *DevicePnPEventNotifyHandler;
+    MINIPORT_SHUTDOWN                   *ShutdownHandlerEx;
+    MINIPORT_CANCEL_OID_REQUEST         *CancelOidRequestHandler;
+    MINIPORT_DIRECT_OID_REQUEST         *DirectOidRequestHandler;
+    MINIPORT_CANCEL_DIRECT_OID_REQUEST  *CancelDirectOidRequestHandler;
+} NDIS_MINIPORT_DRIVER_CHARACTERISTICS, *PNDIS_MINIPORT_DRIVER_CHARACTERISTICS;
+
+#define NDIS_MINIPORT_DRIVER_CHARACTERISTICS_REVISION_2         2
+#define NDIS_SIZEOF_MINIPORT_DRIVER_CHARACTERISTICS_REVISION_2  \
+    sizeof(NDIS_MINIPORT_DRIVER_CHARACTERISTICS)
+
+#define NDIS_DECLARE_MINIPORT_DRIVER_CONTEXT(type)
+#define NDIS_DECLARE_MINIPORT_ADAPTER_CONTEXT(type)
+
+NDIS_STATUS NdisMRegisterMiniportDriver(PDRIVER_OBJECT DriverObject,
+    PUNICODE_STRING RegistryPath, NDIS_HANDLE MiniportDriverContext,
+    PNDIS_MINIPORT_DRIVER_CHARACTERISTICS MiniportDriverCharacteristics,
+    PNDIS_HANDLE NdisMiniportDriverHandle);
+VOID NdisMDeregisterMiniportDriver(NDIS_HANDLE NdisMiniportDriverHandle);
+NDIS_STATUS NdisSetOptionalHandlers(NDIS_HANDLE NdisHandle, PVOID OptionalHandlers);
+
+VOID NdisMRestartComplete(NDIS_HANDLE MiniportAdapterHandle, NDIS_STATUS Status);
+VOID NdisMResetComplete(NDIS_HANDLE MiniportAdapterHandle, NDIS_STATUS Status,
+    BOOLEAN AddressingReset);
+VOID NdisMSendComplete(NDIS_HANDLE MiniportAdapterHandle, PVOID Packet, NDIS_STATUS Status);
+VOID NdisMSendResourcesAvailable(NDIS_HANDLE MiniportAdapterHandle);
+VOID NdisMSetAttributesEx(NDIS_HANDLE MiniportAdapterHandle, NDIS_HANDLE MiniportAdapterContext,
+    UINT CheckForHangTimeInSeconds, ULONG AttributeFlags, NDIS_INTERFACE_TYPE AdapterType);
+VOID NdisMRegisterAdapterShutdownHandler(NDIS_HANDLE MiniportHandle, PVOID ShutdownContext,
+    PVOID ShutdownHandler);
+
+//
+// Device objects
+//
+
+typedef struct _NDIS_DEVICE_OBJECT_ATTRIBUTES
+{
+    NDIS_OBJECT_HEADER  Header;
+    PNDIS_STRING        DeviceName;
+    PNDIS_STRING        SymbolicName;
+    PDRIVER_DISPATCH    *MajorFunctions;
+    ULONG               ExtensionSize;
+    PCUNICODE_STRING    DefaultSDDLString;
+    const GUID          *DeviceClassGuid;
+} NDIS_DEVICE_OBJECT_ATTRIBUTES, *PNDIS_DEVICE_OBJECT_ATTRIBUTES;
+
+#define NDIS_DEVICE_OBJECT_ATTRIBUTES_REVISION_1            1
+#define NDIS_SIZEOF_DEVICE_OBJECT_ATTRIBUTES_REVISION_1     sizeof(NDIS_DEVICE_OBJECT_ATTRIBUTES)
+
+NDIS_STATUS NdisRegisterDeviceEx(NDIS_HANDLE NdisObjectHandle,
+    PNDIS_DEVICE_OBJECT_ATTRIBUTES DeviceObjectAttributes, PDEVICE_OBJECT *pDeviceObject,
+    PNDIS_HANDLE NdisDeviceHandle);
+VOID NdisDeregisterDeviceEx(NDIS_HANDLE NdisDeviceHandle);
+
+#endif // __TAP_HOST_NDIS_H
@@ -0,0 +1,930 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Host build stand-in for the WDK's ntifs.h.
+//
+// Just enough of the kernel's types and routines for the driver sources
+// to compile and run in a user-mode test on a Linux host. The routines
+// are implemented in wdkhost.c; wdkhost.h has the knobs tests use to
+// drive the clock, DPCs and the NDIS indications.
+//
+// ULONG and LONG are 32 bits as on Windows. The driver's own uses of
+// long assume LLP64 too; tests/CMakeLists.txt compiles it from copies
+// with long rewritten to int, which this header does not need.
+//======================================================================
+
+#ifndef __TAP_HOST_NTIFS_H
+#define __TAP_HOST_NTIFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+//
+// Compiler
+//
+
+#define __inline                inline
+#define __forceinline           inline __attribute__((always_inline))
+#define FORCEINLINE             static __forceinline
+#define DECLSPEC_CACHEALIGN     __attribute__((aligned(64)))
+#define UNALIGNED
+#define NTAPI
+#define __int64                 long long
+
+#define C_ASSERT(e)             _Static_assert((e), #e)
+
+// No structured exceptions: the guarded block always runs.
+#define __try                   if(1)
+#define __except(filter)        else if(0)
+#define EXCEPTION_EXECUTE_HANDLER   1
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define PAGED_CODE()
+
+#ifndef DBG
+#define DBG 0
+#endif
+
+#if DBG
+#define ASSERT(e)               assert(e)
+#else
+#define ASSERT(e)               ((void)0)
+#endif
+
+#define min(a,b)                (((a) < (b)) ? (a) : (b))
+#define max(a,b)                (((a) > (b)) ? (a) : (b))
+
+#define FIELD_OFFSET(type, field)       ((LONG)offsetof(type, field))
+#define RTL_FIELD_SIZE(type, field)     (sizeof(((type *)0)->field))
+#define RTL_NUMBER_OF(a)                (sizeof(a) / sizeof((a)[0]))
+#define ARRAYSIZE(a)                    RTL_NUMBER_OF(a)
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((char *)(address) - offsetof(type, field)))
+
+//
+// SAL. Annotations compile to nothing.
+//
+
+#define __in
+#define __out
+#define __inout
+#define __in_opt
+#define __out_opt
+#define __inout_opt
+#define __in_bcount(x)
+#define __in_bcount_opt(x)
+#define __out_bcount(x)
+#define __out_bcount_opt(x)
+#define __out_bcount_part(x,y)
+#define __out_ecount(x)
+#define __in_ecount(x)
+#define __drv_maxIRQL(x)
+#define __drv_requiresIRQL(x)
+#define __drv_dispatchType(x)
+#define IN
+#define OUT
+#define OPTIONAL
+#define NOTHING
+#define __fallthrough
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_to_(x,y)
+#define _Must_inspect_result_
+#define _Use_decl_annotations_
+#define _Function_class_(x)
+#define _IRQL_requires_(x)
+#define _IRQL_requires_max_(x)
+#define _IRQL_requires_min_(x)
+#define _IRQL_raises_(x)
+#define _IRQL_saves_global_(x,y)
+#define _IRQL_restores_global_(x,y)
+#define _Requires_lock_held_(x)
+#define _Requires_lock_not_held_(x)
+#define _Acquires_lock_(x)
+#define _Releases_lock_(x)
+#define _Dispatch_type_(x)
+#define _Analysis_assume_(x)
+
+//
+// Basic types
+//
+
+typedef void                VOID, *PVOID, **PPVOID;
+typedef char                CHAR, *PCHAR;
+typedef const char          *PCSTR;
+typedef unsigned char       UCHAR, *PUCHAR;
+typedef short               SHORT, *PSHORT;
+typedef unsigned short      USHORT, *PUSHORT;
+typedef int                 INT, *PINT;
+typedef unsigned int        UINT, *PUINT, UINT32;
+typedef int                 LONG, *PLONG;
+typedef unsigned int        ULONG, *PULONG;
+typedef unsigned int        DWORD, *PDWORD;
+typedef long long           LONGLONG, LONG64, *PLONG64;
+typedef unsigned long long  ULONGLONG, ULONG64, *PULONG64, DWORD64;
+typedef intptr_t            LONG_PTR, *PLONG_PTR;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR, SIZE_T, *PSIZE_T;
+typedef UCHAR               BOOLEAN, *PBOOLEAN;
+typedef wchar_t             WCHAR, *PWCHAR, *PWSTR;
+typedef const wchar_t       *PCWSTR;
+typedef LONG                NTSTATUS;
+typedef PVOID               HANDLE, *PHANDLE;
+typedef ULONG               ACCESS_MASK;
+typedef UCHAR               KIRQL, *PKIRQL;
+typedef CHAR                KPROCESSOR_MODE;
+typedef LONG                KPRIORITY;
+
+C_ASSERT(sizeof(WCHAR) == 2);
+
+#define TRUE                1
+#define FALSE               0
+
+#define MAXUCHAR            0xff
+#define MAXUSHORT           0xffff
+#define MAXULONG            0xffffffffU
+#define MAXLONG             0x7fffffff
+#define MAXULONG64          0xffffffffffffffffULL
+#define MAXLONGLONG         0x7fffffffffffffffLL
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        ULONG   LowPart;
+        LONG    HighPart;
+    };
+    LONGLONG    QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+    ULONG   Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    UCHAR   Data4[8];
+} GUID, *PGUID;
+
+//
+// Status codes
+//
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES          ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_HANDLE           ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_DEVICE_DOES_NOT_EXIST    ((NTSTATUS)0xC00000C0L)
+#define STATUS_REVISION_MISMATCH        ((NTSTATUS)0xC0000059L)
+#define STATUS_NO_SUCH_DEVICE           ((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_NO_MEMORY                ((NTSTATUS)0xC0000017L)
+#define STATUS_ACCESS_DENIED            ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY         ((NTSTATUS)0xC00000A3L)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_DEVICE_STATE     ((NTSTATUS)0xC0000184L)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define STATUS_DEVICE_BUSY              ((NTSTATUS)0x80000011L)
+#define STATUS_INVALID_BUFFER_SIZE      ((NTSTATUS)0xC0000206L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+
+#define NT_SUCCESS(s)                   (((NTSTATUS)(s)) >= 0)
+
+//
+// Doubly and singly linked lists
+//
+
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY  *Flink;
+    struct _LIST_ENTRY  *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+FORCEINLINE VOID
+InitializeListHead(PLIST_ENTRY ListHead)
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+#define IsListEmpty(ListHead)   ((ListHead)->Flink == (ListHead))
+
+FORCEINLINE BOOLEAN
+RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY flink = Entry->Flink;
+    PLIST_ENTRY blink = Entry->Blink;
+
+    blink->Flink = flink;
+    flink->Blink = blink;
+    return (BOOLEAN)(flink == blink);
+}
+
+FORCEINLINE PLIST_ENTRY
+RemoveHeadList(PLIST_ENTRY ListHead)
+{
+    PLIST_ENTRY entry = ListHead->Flink;
+
+    RemoveEntryList(entry);
+    return entry;
+}
+
+FORCEINLINE PLIST_ENTRY
+RemoveTailList(PLIST_ENTRY ListHead)
+{
+    PLIST_ENTRY entry = ListHead->Blink;
+
+    RemoveEntryList(entry);
+    return entry;
+}
+
+FORCEINLINE VOID
+InsertTailList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY blink = ListHead->Blink;
+
+    Entry->Flink = ListHead;
+    Entry->Blink = blink;
+    blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+FORCEINLINE VOID
+InsertHeadList(PLIST_ENTRY ListHead, PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY flink = ListHead->Flink;
+
+    Entry->Flink = flink;
+    Entry->Blink = ListHead;
+    flink->Blink = Entry;
+    ListHead->Flink = Entry;
+}
+
+typedef struct _SINGLE_LIST_ENTRY
+{
+    struct _SINGLE_LIST_ENTRY   *Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY, SLIST_ENTRY, *PSLIST_ENTRY;
+
+// Serialized by a host lock in wdkhost.c rather than a 128-bit CAS.
+typedef struct _SLIST_HEADER
+{
+    PSLIST_ENTRY        Next;
+    USHORT              Depth;
+    volatile LONG       Lock;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+VOID InitializeSListHead(PSLIST_HEADER ListHead);
+PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER ListHead, PSLIST_ENTRY Entry);
+PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER ListHead);
+PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER ListHead);
+#define QueryDepthSList(ListHead)   ((ListHead)->Depth)
+
+//
+// Interlocked operations
+//
+
+#define InterlockedIncrement(p)             __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)             __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p)           __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(p)           __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)           __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v)         __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(p, v)    __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)        __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v)      __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAdd(p, v)                __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAdd64(p, v)              __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedOr(p, v)                 __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedAnd(p, v)                __atomic_fetch_and((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+#define InterlockedCompareExchange64(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+#define InterlockedCompareExchangePointer(p, x, c) \
+    __sync_val_compare_and_swap((p), (c), (x))
+
+#define KeMemoryBarrier()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define _ReadWriteBarrier()         __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor()            __builtin_ia32_pause()
+#define ReadTimeStampCounter()      __builtin_ia32_rdtsc()
+
+#define RtlUshortByteSwap(x)        __builtin_bswap16(x)
+#define RtlUlongByteSwap(x)         __builtin_bswap32(x)
+#define RtlUlonglongByteSwap(x)     __builtin_bswap64(x)
+
+//
+// IRQL, processors and spin locks
+//
+// IRQL is a per-thread value; nothing is masked by raising it. Each
+// host thread is given a processor number, see wdkhost.h.
+//
+
+#define PASSIVE_LEVEL       0
+#define APC_LEVEL           1
+#define DISPATCH_LEVEL      2
+
+#define ALL_PROCESSOR_GROUPS    0xffff
+
+typedef struct _PROCESSOR_NUMBER
+{
+    USHORT  Group;
+    UCHAR   Number;
+    UCHAR   Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+KIRQL KeGetCurrentIrql(VOID);
+VOID KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql);
+VOID KeLowerIrql(KIRQL NewIrql);
+KIRQL KeRaiseIrqlToDpcLevel(VOID);
+
+ULONG KeQueryMaximumProcessorCountEx(USHORT GroupNumber);
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber);
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber);
+#define KeGetCurrentProcessorNumber()   KeGetCurrentProcessorNumberEx(NULL)
+
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock);
+VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql);
+VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql);
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock);
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock);
+BOOLEAN KeTryToAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock);
+
+//
+// Time
+//
+// KeQueryPerformanceCounter runs at 10MHz, the same rate as the system
+// time and interrupt time, and can be frozen by a test (wdkhost.h).
+//
+
+LARGE_INTEGER KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency);
+VOID KeQuerySystemTime(PLARGE_INTEGER CurrentTime);
+VOID KeQueryTickCount(PLARGE_INTEGER TickCount);
+ULONG KeQueryTimeIncrement(VOID);
+ULONGLONG KeQueryInterruptTime(VOID);
+
+//
+// DPCs, timers and events
+//
+// A queued DPC runs when the test calls WdkHostRunDpcs, on the calling
+// thread at DISPATCH_LEVEL. A timer queues its DPC when the host clock
+// passes its due time.
+//
+
+struct _KDPC;
+
+typedef VOID KDEFERRED_ROUTINE(
+    struct _KDPC    *Dpc,
+    PVOID           DeferredContext,
+    PVOID           SystemArgument1,
+    PVOID           SystemArgument2
+    );
+typedef KDEFERRED_ROUTINE *PKDEFERRED_ROUTINE;
+
+typedef struct _KDPC
+{
+    LIST_ENTRY          DpcListEntry;
+    PKDEFERRED_ROUTINE  DeferredRoutine;
+    PVOID               DeferredContext;
+    PVOID               SystemArgument1;
+    PVOID               SystemArgument2;
+    volatile LONG       Inserted;
+} KDPC, *PKDPC, *PRKDPC;
+
+VOID KeInitializeDpc(PKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext);
+BOOLEAN KeInsertQueueDpc(PKDPC Dpc, PVOID SystemArgument1, PVOID SystemArgument2);
+BOOLEAN KeRemoveQueueDpc(PKDPC Dpc);
+VOID KeFlushQueuedDpcs(VOID);
+
+typedef struct _KTIMER
+{
+    LIST_ENTRY          TimerListEntry;
+    ULONGLONG           DueTime;        // Host clock, 100ns units
+    LONG                Period;         // Milliseconds
+    PKDPC               Dpc;
+    BOOLEAN             Inserted;
+} KTIMER, *PKTIMER, *PRKTIMER;
+
+VOID KeInitializeTimer(PKTIMER Timer);
+BOOLEAN KeSetTimer(PKTIMER Timer, LARGE_INTEGER DueTime, PKDPC Dpc);
+BOOLEAN KeSetTimerEx(PKTIMER Timer, LARGE_INTEGER DueTime, LONG Period, PKDPC Dpc);
+BOOLEAN KeCancelTimer(PKTIMER Timer);
+BOOLEAN KeReadStateTimer(PKTIMER Timer);
+
+typedef enum _EVENT_TYPE
+{
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef struct _KEVENT
+{
+    volatile LONG       State;
+    EVENT_TYPE          Type;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+VOID KeInitializeEvent(PKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent(PKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID KeClearEvent(PKEVENT Event);
+LONG KeResetEvent(PKEVENT Event);
+LONG KeReadStateEvent(PKEVENT Event);
+
+#define KernelMode          0
+#define UserMode            1
+
+typedef enum _KWAIT_REASON { Executive } KWAIT_REASON;
+
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+NTSTATUS KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable,
+    PLARGE_INTEGER Interval);
+
+VOID KeBugCheckEx(ULONG BugCheckCode, ULONG_PTR P1, ULONG_PTR P2,
+    ULONG_PTR P3, ULONG_PTR P4);
+
+//
+// Strings
+//
+
+typedef struct _UNICODE_STRING
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PWSTR   Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+typedef struct _STRING
+{
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PCHAR   Buffer;
+} STRING, ANSI_STRING, *PANSI_STRING, *PSTRING;
+
+#define RTL_CONSTANT_STRING(s) \
+    { sizeof(s) - sizeof((s)[0]), sizeof(s), (PWSTR)(s) }
+
+VOID RtlInitUnicodeString(PUNICODE_STRING Destination, PCWSTR Source);
+NTSTATUS RtlAppendUnicodeStringToString(PUNICODE_STRING Destination, PCUNICODE_STRING Source);
+NTSTATUS RtlAppendUnicodeToString(PUNICODE_STRING Destination, PCWSTR Source);
+NTSTATUS RtlUnicodeStringToAnsiString(PANSI_STRING Destination, PCUNICODE_STRING Source,
+    BOOLEAN AllocateDestinationString);
+VOID RtlFreeAnsiString(PANSI_STRING AnsiString);
+NTSTATUS RtlGUIDFromString(PCUNICODE_STRING GuidString, GUID *Guid);
+LONG RtlCompareUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2,
+    BOOLEAN CaseInSensitive);
+
+#define RtlCopyMemory(d, s, n)      memcpy((d), (s), (n))
+#define RtlMoveMemory(d, s, n)      memmove((d), (s), (n))
+#define RtlZeroMemory(d, n)         memset((d), 0, (n))
+#define RtlFillMemory(d, n, c)      memset((d), (c), (n))
+#define RtlEqualMemory(a, b, n)     (memcmp((a), (b), (n)) == 0)
+#define RtlCompareMemory(a, b, n)   WdkHostCompareMemory((a), (b), (n))
+
+SIZE_T WdkHostCompareMemory(const VOID *Source1, const VOID *Source2, SIZE_T Length);
+
+typedef struct _OSVERSIONINFOEXW
+{
+    ULONG   dwOSVersionInfoSize;
+    ULONG   dwMajorVersion;
+    ULONG   dwMinorVersion;
+    ULONG   dwBuildNumber;
+    ULONG   dwPlatformId;
+    WCHAR   szCSDVersion[128];
+    USHORT  wServicePackMajor;
+    USHORT  wServicePackMinor;
+    USHORT  wSuiteMask;
+    UCHAR   wProductType;
+    UCHAR   wReserved;
+} OSVERSIONINFOEXW, RTL_OSVERSIONINFOEXW, *PRTL_OSVERSIONINFOEXW, *POSVERSIONINFOEXW;
+
+#define VER_MINORVERSION            0x0000001
+#define VER_MAJORVERSION            0x0000002
+#define VER_GREATER_EQUAL           3
+#define VER_SET_CONDITION(m, t, c)  ((m) = VerSetConditionMask((m), (t), (c)))
+
+ULONGLONG VerSetConditionMask(ULONGLONG ConditionMask, ULONG TypeMask, UCHAR Condition);
+NTSTATUS RtlVerifyVersionInfo(PRTL_OSVERSIONINFOEXW VersionInfo, ULONG TypeMask,
+    ULONGLONG ConditionMask);
+
+//
+// Memory
+//
+
+#define PAGE_SIZE           0x1000
+#define PAGE_SHIFT          12
+
+typedef enum _POOL_TYPE
+{
+    NonPagedPool,
+    PagedPool,
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+#define POOL_FLAG_NON_PAGED         0x0000000000000040ULL
+#define POOL_FLAG_PAGED             0x0000000000000100ULL
+#define POOL_FLAG_UNINITIALIZED     0x0000000000000002ULL
+
+typedef ULONG64 POOL_FLAGS;
+
+PVOID ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag);
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+VOID ExFreePool(PVOID P);
+
+typedef enum _MM_PAGE_PRIORITY
+{
+    LowPagePriority,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+} MM_PAGE_PRIORITY;
+
+#define MdlMappingNoWrite       0x80000000
+#define MdlMappingNoExecute     0x40000000
+
+typedef enum _MEMORY_CACHING_TYPE
+{
+    MmNonCached,
+    MmCached,
+    MmWriteCombined
+} MEMORY_CACHING_TYPE;
+
+typedef struct _MDL
+{
+    struct _MDL     *Next;
+    SHORT           Size;
+    SHORT           MdlFlags;
+    PVOID           MappedSystemVa;
+    PVOID           StartVa;
+    ULONG           ByteCount;
+    ULONG           ByteOffset;
+} MDL, *PMDL;
+
+#define MDL_SOURCE_IS_NONPAGED_POOL     0x0004
+#define MDL_PAGES_LOCKED                0x0002
+
+#define MmGetMdlVirtualAddress(Mdl) \
+    ((PVOID)((PCHAR)((Mdl)->StartVa) + (Mdl)->ByteOffset))
+#define MmGetMdlByteCount(Mdl)          ((Mdl)->ByteCount)
+#define MmGetMdlByteOffset(Mdl)         ((Mdl)->ByteOffset)
+#define MmGetSystemAddressForMdlSafe(Mdl, Priority) \
+    ((Mdl)->MappedSystemVa)
+
+VOID MmBuildMdlForNonPagedPool(PMDL MemoryDescriptorList);
+PVOID MmMapLockedPagesSpecifyCache(PMDL MemoryDescriptorList, KPROCESSOR_MODE AccessMode,
+    MEMORY_CACHING_TYPE CacheType, PVOID RequestedAddress, ULONG BugCheckOnFailure,
+    ULONG Priority);
+VOID MmUnmapLockedPages(PVOID BaseAddress, PMDL MemoryDescriptorList);
+
+//
+// Objects, processes and the registry
+//
+
+typedef struct _EPROCESS *PEPROCESS;
+typedef struct _ETHREAD *PETHREAD;
+
+PEPROCESS PsGetCurrentProcess(VOID);
+HANDLE PsGetCurrentProcessId(VOID);
+HANDLE PsGetProcessId(PEPROCESS Process);
+
+#define NtCurrentProcess()      ((HANDLE)(LONG_PTR)-1)
+
+typedef struct _PS_CREATE_NOTIFY_INFO *PPS_CREATE_NOTIFY_INFO;
+
+typedef VOID (*PCREATE_PROCESS_NOTIFY_ROUTINE_EX)(
+    PEPROCESS               Process,
+    HANDLE                  ProcessId,
+    PPS_CREATE_NOTIFY_INFO  CreateInfo
+    );
+
+NTSTATUS PsSetCreateProcessNotifyRoutineEx(PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine,
+    BOOLEAN Remove);
+
+typedef struct _OBJECT_ATTRIBUTES
+{
+    ULONG               Length;
+    HANDLE              RootDirectory;
+    PUNICODE_STRING     ObjectName;
+    ULONG               Attributes;
+    PVOID               SecurityDescriptor;
+    PVOID               SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, *POBJECT_ATTRIBUTES;
+
+#define OBJ_CASE_INSENSITIVE    0x00000040L
+#define OBJ_KERNEL_HANDLE       0x00000200L
+
+#define InitializeObjectAttributes(p, n, a, r, s)   \
+{                                                   \
+    (p)->Length = sizeof(OBJECT_ATTRIBUTES);        \
+    (p)->RootDirectory = (r);                       \
+    (p)->Attributes = (a);                          \
+    (p)->ObjectName = (n);                          \
+    (p)->SecurityDescriptor = (s);                  \
+    (p)->SecurityQualityOfService = NULL;           \
+}
+
+VOID ObReferenceObject(PVOID Object);
+VOID ObDereferenceObject(PVOID Object);
+
+#define KEY_QUERY_VALUE         0x0001
+#define KEY_READ                0x20019
+#define SECTION_MAP_READ        0x0004
+#define SECTION_MAP_WRITE       0x0002
+#define SECTION_QUERY           0x0001
+#define SECTION_ALL_ACCESS      0x000F001F
+#define PAGE_READONLY           0x02
+#define PAGE_READWRITE          0x04
+#define SEC_COMMIT              0x08000000
+#define MEM_TOP_DOWN            0x00100000
+
+typedef enum _SECTION_INHERIT
+{
+    ViewShare = 1,
+    ViewUnmap = 2
+} SECTION_INHERIT;
+
+NTSTATUS ZwCreateSection(PHANDLE SectionHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes, PLARGE_INTEGER MaximumSize,
+    ULONG SectionPageProtection, ULONG AllocationAttributes, HANDLE FileHandle);
+NTSTATUS ZwMapViewOfSection(HANDLE SectionHandle, HANDLE ProcessHandle, PVOID *BaseAddress,
+    ULONG_PTR ZeroBits, SIZE_T CommitSize, PLARGE_INTEGER SectionOffset, PSIZE_T ViewSize,
+    SECTION_INHERIT InheritDisposition, ULONG AllocationType, ULONG Win32Protect);
+NTSTATUS ZwUnmapViewOfSection(HANDLE ProcessHandle, PVOID BaseAddress);
+NTSTATUS MmMapViewInSystemSpace(PVOID Section, PVOID *MappedBase, PSIZE_T ViewSize);
+NTSTATUS MmUnmapViewInSystemSpace(PVOID MappedBase);
+NTSTATUS ObReferenceObjectByHandle(HANDLE Handle, ACCESS_MASK DesiredAccess, PVOID ObjectType,
+    KPROCESSOR_MODE AccessMode, PVOID *Object, PVOID HandleInformation);
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS
+{
+    KeyValueBasicInformation,
+    KeyValueFullInformation,
+    KeyValuePartialInformation
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION
+{
+    ULONG   TitleIndex;
+    ULONG   Type;
+    ULONG   DataLength;
+    UCHAR   Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, *PKEY_VALUE_PARTIAL_INFORMATION;
+
+#define REG_SZ          1
+#define REG_DWORD       4
+
+NTSTATUS ZwOpenKey(PHANDLE KeyHandle, ACCESS_MASK DesiredAccess,
+    POBJECT_ATTRIBUTES ObjectAttributes);
+NTSTATUS ZwQueryValueKey(HANDLE KeyHandle, PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass, PVOID KeyValueInformation,
+    ULONG Length, PULONG ResultLength);
+NTSTATUS ZwClose(HANDLE Handle);
+
+//
+// I/O manager
+//
+
+#define FILE_DEVICE_UNKNOWN     0x00000022
+#define FILE_DEVICE_SECURE_OPEN 0x00000100
+#define METHOD_BUFFERED         0
+#define METHOD_IN_DIRECT        1
+#define METHOD_OUT_DIRECT       2
+#define METHOD_NEITHER          3
+#define FILE_ANY_ACCESS         0
+#define FILE_READ_ACCESS        0x0001
+#define FILE_WRITE_ACCESS       0x0002
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define IRP_MJ_CREATE                   0x00
+#define IRP_MJ_CLOSE                    0x02
+#define IRP_MJ_READ                     0x03
+#define IRP_MJ_WRITE                    0x04
+#define IRP_MJ_DEVICE_CONTROL           0x0e
+#define IRP_MJ_CLEANUP                  0x12
+#define IRP_MJ_MAXIMUM_FUNCTION         0x1b
+
+#define IO_NO_INCREMENT                 0
+#define IO_NETWORK_INCREMENT            2
+
+#define DO_DIRECT_IO                    0x00000010
+#define DO_BUFFERED_IO                  0x00000004
+
+struct _IRP;
+struct _DEVICE_OBJECT;
+
+typedef NTSTATUS DRIVER_DISPATCH(struct _DEVICE_OBJECT *DeviceObject, struct _IRP *Irp);
+typedef DRIVER_DISPATCH *PDRIVER_DISPATCH;
+typedef VOID DRIVER_CANCEL(struct _DEVICE_OBJECT *DeviceObject, struct _IRP *Irp);
+typedef DRIVER_CANCEL *PDRIVER_CANCEL;
+
+typedef struct _DRIVER_OBJECT DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef VOID DRIVER_UNLOAD(PDRIVER_OBJECT DriverObject);
+
+struct _DRIVER_OBJECT
+{
+    PVOID               DriverExtension;
+    PDRIVER_DISPATCH    MajorFunction[IRP_MJ_MAXIMUM_FUNCTION + 1];
+    DRIVER_UNLOAD       *DriverUnload;
+};
+
+typedef struct _DEVICE_OBJECT
+{
+    PDRIVER_OBJECT      DriverObject;
+    PVOID               DeviceExtension;
+    ULONG               Flags;
+    ULONG               Characteristics;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _FILE_OBJECT
+{
+    PDEVICE_OBJECT      DeviceObject;
+    PVOID               FsContext;
+    PVOID               FsContext2;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _IO_STATUS_BLOCK
+{
+    NTSTATUS            Status;
+    ULONG_PTR           Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _IO_STACK_LOCATION
+{
+    UCHAR               MajorFunction;
+    UCHAR               MinorFunction;
+    UCHAR               Flags;
+    UCHAR               Control;
+
+    union
+    {
+        struct
+        {
+            ULONG       Length;
+            ULONG       Key;
+            LARGE_INTEGER ByteOffset;
+        } Read;
+
+        struct
+        {
+            ULONG       Length;
+            ULONG       Key;
+            LARGE_INTEGER ByteOffset;
+        } Write;
+
+        struct
+        {
+            ULONG       OutputBufferLength;
+            ULONG       InputBufferLength;
+            ULONG       IoControlCode;
+            PVOID       Type3InputBuffer;
+        } DeviceIoControl;
+    } Parameters;
+
+    PDEVICE_OBJECT      DeviceObject;
+    PFILE_OBJECT        FileObject;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP
+{
+    PMDL                MdlAddress;
+
+    union
+    {
+        PVOID           SystemBuffer;
+    } AssociatedIrp;
+
+    IO_STATUS_BLOCK     IoStatus;
+    KPROCESSOR_MODE     RequestorMode;
+    BOOLEAN             PendingReturned;
+    BOOLEAN             Cancel;
+    KIRQL               CancelIrql;
+    volatile PDRIVER_CANCEL CancelRoutine;
+
+    union
+    {
+        struct
+        {
+            PVOID               DriverContext[4];
+            LIST_ENTRY          ListEntry;
+            PIO_STACK_LOCATION  CurrentStackLocation;
+        } Overlay;
+    } Tail;
+
+    // Host only: the single stack location, and completion state.
+    IO_STACK_LOCATION   HostStack;
+    volatile LONG       HostCompleted;
+} IRP, *PIRP;
+
+#define IoGetCurrentIrpStackLocation(Irp)   ((Irp)->Tail.Overlay.CurrentStackLocation)
+#define IoMarkIrpPending(Irp)               ((Irp)->PendingReturned = TRUE)
+#define IoSetCancelRoutine(Irp, Routine) \
+    ((PDRIVER_CANCEL)InterlockedExchangePointer(&(Irp)->CancelRoutine, (Routine)))
+
+VOID IoCompleteRequest(PIRP Irp, CHAR PriorityBoost);
+VOID IoAcquireCancelSpinLock(PKIRQL Irql);
+VOID IoReleaseCancelSpinLock(KIRQL Irql);
+
+PMDL IoAllocateMdl(PVOID VirtualAddress, ULONG Length, BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota, PIRP Irp);
+VOID IoFreeMdl(PMDL Mdl);
+
+//
+// Cancel-safe IRP queues
+//
+
+struct _IO_CSQ;
+
+typedef struct _IO_CSQ_IRP_CONTEXT
+{
+    ULONG               Type;
+    PIRP                Irp;
+    struct _IO_CSQ      *Csq;
+} IO_CSQ_IRP_CONTEXT, *PIO_CSQ_IRP_CONTEXT;
+
+typedef VOID IO_CSQ_INSERT_IRP(struct _IO_CSQ *Csq, PIRP Irp);
+typedef IO_CSQ_INSERT_IRP *PIO_CSQ_INSERT_IRP;
+typedef VOID IO_CSQ_REMOVE_IRP(struct _IO_CSQ *Csq, PIRP Irp);
+typedef IO_CSQ_REMOVE_IRP *PIO_CSQ_REMOVE_IRP;
+typedef PIRP IO_CSQ_PEEK_NEXT_IRP(struct _IO_CSQ *Csq, PIRP Irp, PVOID PeekContext);
+typedef IO_CSQ_PEEK_NEXT_IRP *PIO_CSQ_PEEK_NEXT_IRP;
+typedef VOID IO_CSQ_ACQUIRE_LOCK(struct _IO_CSQ *Csq, PKIRQL Irql);
+typedef IO_CSQ_ACQUIRE_LOCK *PIO_CSQ_ACQUIRE_LOCK;
+typedef VOID IO_CSQ_RELEASE_LOCK(struct _IO_CSQ *Csq, KIRQL Irql);
+typedef IO_CSQ_RELEASE_LOCK *PIO_CSQ_RELEASE_LOCK;
+typedef VOID IO_CSQ_COMPLETE_CANCELED_IRP(struct _IO_CSQ *Csq, PIRP Irp);
+typedef IO_CSQ_COMPLETE_CANCELED_IRP *PIO_CSQ_COMPLETE_CANCELED_IRP;
+
+typedef struct _IO_CSQ
+{
+    ULONG                           Type;
+    PIO_CSQ_INSERT_IRP              CsqInsertIrp;
+    PIO_CSQ_REMOVE_IRP              CsqRemoveIrp;
+    PIO_CSQ_PEEK_NEXT_IRP           CsqPeekNextIrp;
+    PIO_CSQ_ACQUIRE_LOCK            CsqAcquireLock;
+    PIO_CSQ_RELEASE_LOCK            CsqReleaseLock;
+    PIO_CSQ_COMPLETE_CANCELED_IRP   CsqCompleteCanceledIrp;
+    PVOID                           ReservePointer;
+} IO_CSQ, *PIO_CSQ;
+
+NTSTATUS IoCsqInitialize(PIO_CSQ Csq, PIO_CSQ_INSERT_IRP CsqInsertIrp,
+    PIO_CSQ_REMOVE_IRP CsqRemoveIrp, PIO_CSQ_PEEK_NEXT_IRP CsqPeekNextIrp,
+    PIO_CSQ_ACQUIRE_LOCK CsqAcquireLock, PIO_CSQ_RELEASE_LOCK CsqReleaseLock,
+    PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp);
+VOID IoCsqInsertIrp(PIO_CSQ Csq, PIRP Irp, PIO_CSQ_IRP_CONTEXT Context);
+PIRP IoCsqRemoveNextIrp(PIO_CSQ Csq, PVOID PeekContext);
+PIRP IoCsqRemoveIrp(PIO_CSQ Csq, PIO_CSQ_IRP_CONTEXT Context);
+
+//
+// Debugger output
+//
+
+ULONG DbgPrint(PCSTR Format, ...);
+
+#define DPFLTR_IHVNETWORK_ID    0
+#define DPFLTR_ERROR_LEVEL      0
+ULONG DbgPrintEx(ULONG ComponentId, ULONG Level, PCSTR Format, ...);
+
+#endif // __TAP_HOST_NTIFS_H
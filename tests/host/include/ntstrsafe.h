@@ -0,0 +1,48 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Host build stand-in for the WDK's ntstrsafe.h.
+//======================================================================
+
+#ifndef __TAP_HOST_NTSTRSAFE_H
+#define __TAP_HOST_NTSTRSAFE_H
+
+#include <ntifs.h>
+
+// The driver is not built with UNICODE.
+typedef PCHAR LPTSTR;
+
+#define STRSAFE_IGNORE_NULLS        0x00000100
+#define STRSAFE_FILL_BEHIND_NULL    0x00000200
+
+NTSTATUS RtlStringCchPrintfA(PCHAR Dest, SIZE_T CchDest, PCSTR Format, ...);
+NTSTATUS RtlStringCchPrintfExA(PCHAR Dest, SIZE_T CchDest, PCHAR *DestEnd,
+    SIZE_T *Remaining, ULONG Flags, PCSTR Format, ...);
+NTSTATUS RtlStringCbPrintfA(PCHAR Dest, SIZE_T CbDest, PCSTR Format, ...);
+NTSTATUS RtlStringCchCopyA(PCHAR Dest, SIZE_T CchDest, PCSTR Source);
+NTSTATUS RtlStringCchLengthA(PCSTR Psz, SIZE_T CchMax, SIZE_T *Length);
+NTSTATUS RtlStringCchCopyW(PWCHAR Dest, SIZE_T CchDest, PCWSTR Source);
+
+#endif // __TAP_HOST_NTSTRSAFE_H
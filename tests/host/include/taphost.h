@@ -0,0 +1,109 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Loads the driver on the host and drives adapters and their devices
+// the way NDIS and the I/O manager would. See wdkhost.h for the
+// kernel side.
+//======================================================================
+
+#ifndef __TAP_HOST_TAPHOST_H
+#define __TAP_HOST_TAPHOST_H
+
+#include "tap.h"
+#include "wdkhost.h"
+
+// DriverEntry. EnableTapDiag creates the diag device with each adapter.
+NDIS_STATUS TapHostLoadDriver(BOOLEAN EnableTapDiag);
+VOID TapHostUnloadDriver(VOID);
+
+// Initializes and restarts an adapter; Index picks its instance GUID.
+PTAP_ADAPTER_CONTEXT TapHostCreateAdapter(ULONG Index);
+NDIS_STATUS TapHostPauseAdapter(PTAP_ADAPTER_CONTEXT Adapter);
+NDIS_STATUS TapHostRestartAdapter(PTAP_ADAPTER_CONTEXT Adapter);
+VOID TapHostHaltAdapter(PTAP_ADAPTER_CONTEXT Adapter);
+
+//
+// Handles on the adapter's device (or diag device). Each call builds
+// an IRP, dispatches it and returns its status; STATUS_PENDING means
+// the IRP is still held by the driver and is returned in *Irp (the
+// caller frees it with WdkHostFreeIrp once it completes). The buffer
+// is the IRP's system buffer, and must outlive it.
+//
+
+PFILE_OBJECT TapHostOpen(PDEVICE_OBJECT DeviceObject);
+VOID TapHostClose(PFILE_OBJECT FileObject);
+
+NTSTATUS TapHostIoctl(PFILE_OBJECT FileObject, ULONG IoControlCode,
+    PVOID Buffer, ULONG InputLength, ULONG OutputLength, PULONG_PTR Information);
+
+// An ioctl that may pend; *Irp is always returned, for the caller to free.
+NTSTATUS TapHostIoctlAsync(PFILE_OBJECT FileObject, ULONG IoControlCode,
+    PVOID Buffer, ULONG InputLength, ULONG OutputLength, PIRP *Irp);
+
+NTSTATUS TapHostWrite(PFILE_OBJECT FileObject, PVOID Data, ULONG Length, PIRP *Irp);
+
+NTSTATUS TapHostRead(PFILE_OBJECT FileObject, PVOID Buffer, ULONG Length, PIRP *Irp);
+
+// MiniportSendNetBufferLists on a chain of NBLs.
+VOID TapHostSend(PTAP_ADAPTER_CONTEXT Adapter, PNET_BUFFER_LIST NetBufferLists);
+
+// MiniportReturnNetBufferLists.
+VOID TapHostReturn(PTAP_ADAPTER_CONTEXT Adapter, PNET_BUFFER_LIST NetBufferLists);
+
+// A set OID request, such as OID_GEN_CURRENT_PACKET_FILTER.
+NDIS_STATUS TapHostSetInformation(PTAP_ADAPTER_CONTEXT Adapter, NDIS_OID Oid,
+    PVOID Buffer, ULONG Length);
+
+//
+// Checks for the tests.
+//
+
+#include <stdio.h>
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if(!(cond))                                                         \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                    \
+                __FILE__, __LINE__, #cond);                                 \
+            exit(1);                                                        \
+        }                                                                   \
+    } while(0)
+
+#define CHECK_EQ(a, b)                                                      \
+    do                                                                      \
+    {                                                                       \
+        unsigned long long a_ = (unsigned long long)(a);                    \
+        unsigned long long b_ = (unsigned long long)(b);                    \
+        if(a_ != b_)                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %llu != %llu\n", \
+                __FILE__, __LINE__, #a, #b, a_, b_);                        \
+            exit(1);                                                        \
+        }                                                                   \
+    } while(0)
+
+#endif // __TAP_HOST_TAPHOST_H
@@ -0,0 +1,149 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Knobs the host tests use to drive the WDK stand-ins in wdkhost.c.
+//======================================================================
+
+#ifndef __TAP_HOST_WDKHOST_H
+#define __TAP_HOST_WDKHOST_H
+
+#include "ntifs.h"
+#include "ndis.h"
+
+//
+// Processors. Each host thread runs as one processor, 0 by default.
+//
+
+VOID WdkHostSetProcessorCount(ULONG Count);
+VOID WdkHostSetCurrentProcessor(ULONG Number);
+
+//
+// Clock. Free running (CLOCK_MONOTONIC) until frozen; a frozen clock
+// only moves with WdkHostAdvanceClock, which also fires due timers.
+// Units are 100ns, as for KeQueryInterruptTime.
+//
+
+VOID WdkHostFreezeClock(ULONGLONG Now);
+VOID WdkHostThawClock(VOID);
+VOID WdkHostAdvanceClock(ULONGLONG Delta);
+
+//
+// DPCs. Queued DPCs run on the calling thread at DISPATCH_LEVEL.
+// Returns the number run, including DPCs queued by the DPCs themselves.
+//
+
+ULONG WdkHostRunDpcs(VOID);
+ULONG WdkHostQueuedDpcs(VOID);
+
+//
+// Indications made by the driver. All of them are counted; a hook sees
+// them as well. Without a receive hook the NBLs stay with the "stack"
+// until the test returns them through the miniport's return handler.
+//
+
+typedef VOID WDK_HOST_RECEIVE_HOOK(
+    PVOID               Context,
+    NDIS_HANDLE         MiniportAdapterHandle,
+    PNET_BUFFER_LIST    NetBufferLists,
+    ULONG               NumberOfNetBufferLists,
+    ULONG               ReceiveFlags
+    );
+
+typedef VOID WDK_HOST_SEND_COMPLETE_HOOK(
+    PVOID               Context,
+    NDIS_HANDLE         MiniportAdapterHandle,
+    PNET_BUFFER_LIST    NetBufferLists,
+    ULONG               SendCompleteFlags
+    );
+
+typedef VOID WDK_HOST_IRP_COMPLETE_HOOK(
+    PVOID               Context,
+    PIRP                Irp
+    );
+
+VOID WdkHostSetReceiveHook(WDK_HOST_RECEIVE_HOOK *Hook, PVOID Context);
+VOID WdkHostSetSendCompleteHook(WDK_HOST_SEND_COMPLETE_HOOK *Hook, PVOID Context);
+VOID WdkHostSetIrpCompleteHook(WDK_HOST_IRP_COMPLETE_HOOK *Hook, PVOID Context);
+
+typedef struct _WDK_HOST_COUNTERS
+{
+    LONG        PoolAllocations;        // Outstanding
+    LONG        Mdls;                   // Outstanding
+    LONG        MdlAllocations;         // Total, test MDLs included
+    LONG        UserMappings;           // Outstanding, of locked pages
+    LONG        NetBufferLists;         // Outstanding
+    LONG        ReceiveIndications;     // Calls to NdisMIndicateReceiveNetBufferLists
+    LONG        ReceivedNetBufferLists;
+    LONG        SendCompletions;        // NBLs completed
+    LONG        CompletedIrps;
+    LONG        StatusIndications;
+} WDK_HOST_COUNTERS, *PWDK_HOST_COUNTERS;
+
+extern WDK_HOST_COUNTERS WdkHostCounters;
+
+//
+// IRPs. A test IRP has a single stack location; SystemBuffer and the
+// MDL (if Buffer is non-NULL) both describe Buffer.
+//
+
+PIRP WdkHostAllocateIrp(UCHAR MajorFunction, PVOID Buffer, ULONG Length);
+VOID WdkHostFreeIrp(PIRP Irp);
+
+//
+// Net buffer lists built by a test, one NET_BUFFER over a copy of Data.
+// WdkHostFreeNetBufferList releases both.
+//
+
+PNET_BUFFER_LIST WdkHostAllocateNetBufferList(const VOID *Data, ULONG Length);
+VOID WdkHostFreeNetBufferList(PNET_BUFFER_LIST NetBufferList);
+
+// Copies up to Length bytes of the first NET_BUFFER's data out.
+ULONG WdkHostCopyNetBufferData(PNET_BUFFER NetBuffer, PVOID Buffer, ULONG Length);
+
+//
+// Adapter configuration, as read by NdisReadConfiguration. Keywords
+// not set here are reported as missing.
+//
+
+VOID WdkHostSetConfigurationString(PCWSTR Keyword, PCWSTR Value);
+VOID WdkHostSetConfigurationInteger(PCWSTR Keyword, ULONG Value);
+VOID WdkHostClearConfiguration(VOID);
+
+// What DriverEntry passed to NdisMRegisterMiniportDriver.
+extern NDIS_MINIPORT_DRIVER_CHARACTERISTICS WdkHostMiniportCharacteristics;
+extern NDIS_HANDLE WdkHostMiniportDriverContext;
+
+//
+// Process identity, for code that checks the caller's process. Exiting
+// calls the process notify routine in the exiting process, and fails
+// if locked pages are still mapped into it; those can only be unmapped
+// in the process they were mapped in.
+//
+
+VOID WdkHostSetCurrentProcess(ULONG_PTR ProcessId);
+VOID WdkHostExitProcess(ULONG_PTR ProcessId);
+ULONG WdkHostProcessUserMappings(ULONG_PTR ProcessId);
+
+#endif // __TAP_HOST_WDKHOST_H
@@ -0,0 +1,16 @@
+#
+# cmake -DIN=<file> -DOUT=<file> -P llp64.cmake
+#
+# Copies a driver source with the keyword long replaced by int. The
+# driver is written for LLP64, where long is 32 bits (IPADDR, the
+# packed protocol headers, the ioctl structures); gcc on an LP64 host
+# has no switch for that.
+#
+
+file(READ "${IN}" text)
+
+string(REGEX REPLACE "([^A-Za-z0-9_])long[ \t]+long([^A-Za-z0-9_])" "\\1__int64\\2" text "${text}")
+string(REGEX REPLACE "([^A-Za-z0-9_])long([^A-Za-z0-9_])" "\\1int\\2" text "${text}")
+
+file(WRITE "${OUT}.tmp" "${text}")
+file(RENAME "${OUT}.tmp" "${OUT}")
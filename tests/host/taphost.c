@@ -0,0 +1,306 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Loads the driver on the host; see taphost.h.
+//======================================================================
+
+#include "taphost.h"
+
+static DRIVER_OBJECT HostDriverObject;
+static UNICODE_STRING HostRegistryPath = RTL_CONSTANT_STRING(L"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\tap0901");
+
+NDIS_STATUS
+TapHostLoadDriver(BOOLEAN EnableTapDiag)
+{
+    NDIS_STATUS status;
+
+    status = DriverEntry(&HostDriverObject, &HostRegistryPath);
+
+    // The registry stand-in has no TapDiag value to read.
+    GlobalData.EnableTapDiag = EnableTapDiag;
+
+    return status;
+}
+
+VOID
+TapHostUnloadDriver(VOID)
+{
+    WdkHostMiniportCharacteristics.UnloadHandler(&HostDriverObject);
+}
+
+PTAP_ADAPTER_CONTEXT
+TapHostCreateAdapter(ULONG Index)
+{
+    NDIS_MINIPORT_INIT_PARAMETERS initParameters;
+    NDIS_HANDLE miniportAdapterHandle;
+    PTAP_ADAPTER_CONTEXT adapter = NULL;
+    PLIST_ENTRY entry;
+    WCHAR instanceId[39];
+    static const WCHAR hex[] = L"0123456789ABCDEF";
+    ULONG i;
+
+    // {00000000-0000-0000-0000-0000XXXXXXXX}
+    RtlCopyMemory(instanceId, L"{00000000-0000-0000-0000-000000000000}", sizeof(instanceId));
+    for(i = 0; i < 8; ++i)
+    {
+        instanceId[36 - i] = hex[(Index >> (4 * i)) & 0xF];
+    }
+
+    WdkHostSetConfigurationString(L"NetCfgInstanceId", instanceId);
+
+    // Any unique non-NULL value will do.
+    miniportAdapterHandle = malloc(1);
+
+    NdisZeroMemory(&initParameters, sizeof(initParameters));
+    initParameters.IfIndex = Index;
+
+    if(WdkHostMiniportCharacteristics.InitializeHandlerEx(
+            miniportAdapterHandle,
+            WdkHostMiniportDriverContext,
+            &initParameters) != NDIS_STATUS_SUCCESS)
+    {
+        free(miniportAdapterHandle);
+        return NULL;
+    }
+
+    for(entry = GlobalData.AdapterList.Flink; entry != &GlobalData.AdapterList; entry = entry->Flink)
+    {
+        PTAP_ADAPTER_CONTEXT candidate = CONTAINING_RECORD(entry, TAP_ADAPTER_CONTEXT, AdapterListLink);
+
+        if(candidate->MiniportAdapterHandle == miniportAdapterHandle)
+        {
+            adapter = candidate;
+            break;
+        }
+    }
+
+    CHECK(adapter != NULL);
+    CHECK_EQ(TapHostRestartAdapter(adapter), NDIS_STATUS_SUCCESS);
+
+    return adapter;
+}
+
+NDIS_STATUS
+TapHostPauseAdapter(PTAP_ADAPTER_CONTEXT Adapter)
+{
+    NDIS_MINIPORT_PAUSE_PARAMETERS pauseParameters;
+
+    NdisZeroMemory(&pauseParameters, sizeof(pauseParameters));
+
+    return WdkHostMiniportCharacteristics.PauseHandler(Adapter, &pauseParameters);
+}
+
+NDIS_STATUS
+TapHostRestartAdapter(PTAP_ADAPTER_CONTEXT Adapter)
+{
+    NDIS_MINIPORT_RESTART_PARAMETERS restartParameters;
+
+    NdisZeroMemory(&restartParameters, sizeof(restartParameters));
+
+    return WdkHostMiniportCharacteristics.RestartHandler(Adapter, &restartParameters);
+}
+
+VOID
+TapHostHaltAdapter(PTAP_ADAPTER_CONTEXT Adapter)
+{
+    NDIS_HANDLE miniportAdapterHandle = Adapter->MiniportAdapterHandle;
+
+    if(Adapter->Locked.AdapterState == MiniportRunning)
+    {
+        CHECK_EQ(TapHostPauseAdapter(Adapter), NDIS_STATUS_SUCCESS);
+    }
+
+    WdkHostMiniportCharacteristics.HaltHandlerEx(Adapter, NdisHaltDeviceDisabled);
+    WdkHostRunDpcs();
+
+    free(miniportAdapterHandle);
+}
+
+static NTSTATUS
+TapHostDispatch(PFILE_OBJECT FileObject, PIRP Irp)
+{
+    PDEVICE_OBJECT deviceObject = FileObject->DeviceObject;
+    PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
+
+    irpSp->DeviceObject = deviceObject;
+    irpSp->FileObject = FileObject;
+
+    return deviceObject->DriverObject->MajorFunction[irpSp->MajorFunction](deviceObject, Irp);
+}
+
+PFILE_OBJECT
+TapHostOpen(PDEVICE_OBJECT DeviceObject)
+{
+    PFILE_OBJECT fileObject = calloc(1, sizeof(FILE_OBJECT));
+    PIRP irp = WdkHostAllocateIrp(IRP_MJ_CREATE, NULL, 0);
+    NTSTATUS status;
+
+    fileObject->DeviceObject = DeviceObject;
+
+    status = TapHostDispatch(fileObject, irp);
+    WdkHostFreeIrp(irp);
+
+    if(!NT_SUCCESS(status))
+    {
+        free(fileObject);
+        return NULL;
+    }
+
+    return fileObject;
+}
+
+VOID
+TapHostClose(PFILE_OBJECT FileObject)
+{
+    PIRP irp;
+
+    irp = WdkHostAllocateIrp(IRP_MJ_CLEANUP, NULL, 0);
+    TapHostDispatch(FileObject, irp);
+    WdkHostFreeIrp(irp);
+
+    irp = WdkHostAllocateIrp(IRP_MJ_CLOSE, NULL, 0);
+    TapHostDispatch(FileObject, irp);
+    WdkHostFreeIrp(irp);
+
+    free(FileObject);
+}
+
+NTSTATUS
+TapHostIoctlAsync(PFILE_OBJECT FileObject, ULONG IoControlCode,
+    PVOID Buffer, ULONG InputLength, ULONG OutputLength, PIRP *Irp)
+{
+    PIRP irp = WdkHostAllocateIrp(IRP_MJ_DEVICE_CONTROL, Buffer, max(InputLength, OutputLength));
+    PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(irp);
+    NTSTATUS status;
+
+    irpSp->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+    irpSp->Parameters.DeviceIoControl.InputBufferLength = InputLength;
+    irpSp->Parameters.DeviceIoControl.OutputBufferLength = OutputLength;
+
+    status = TapHostDispatch(FileObject, irp);
+
+    *Irp = irp;
+
+    return status;
+}
+
+NTSTATUS
+TapHostIoctl(PFILE_OBJECT FileObject, ULONG IoControlCode,
+    PVOID Buffer, ULONG InputLength, ULONG OutputLength, PULONG_PTR Information)
+{
+    PIRP irp;
+    NTSTATUS status;
+
+    status = TapHostIoctlAsync(FileObject, IoControlCode, Buffer, InputLength, OutputLength, &irp);
+
+    if(status == STATUS_PENDING)
+    {
+        // Not expected of the ioctls the tests issue synchronously.
+        CHECK(!"ioctl pended");
+    }
+
+    if(Information != NULL)
+    {
+        *Information = irp->IoStatus.Information;
+    }
+
+    WdkHostFreeIrp(irp);
+
+    return status;
+}
+
+NTSTATUS
+TapHostWrite(PFILE_OBJECT FileObject, PVOID Data, ULONG Length, PIRP *Irp)
+{
+    PIRP irp = WdkHostAllocateIrp(IRP_MJ_WRITE, Data, Length);
+    NTSTATUS status;
+
+    status = TapHostDispatch(FileObject, irp);
+
+    if(status == STATUS_PENDING && Irp != NULL)
+    {
+        *Irp = irp;
+        return status;
+    }
+
+    CHECK(status != STATUS_PENDING);
+    WdkHostFreeIrp(irp);
+
+    return status;
+}
+
+NTSTATUS
+TapHostRead(PFILE_OBJECT FileObject, PVOID Buffer, ULONG Length, PIRP *Irp)
+{
+    PIRP irp = WdkHostAllocateIrp(IRP_MJ_READ, Buffer, Length);
+    NTSTATUS status;
+
+    status = TapHostDispatch(FileObject, irp);
+
+    if(status == STATUS_PENDING && Irp != NULL)
+    {
+        *Irp = irp;
+        return status;
+    }
+
+    CHECK(status != STATUS_PENDING);
+    WdkHostFreeIrp(irp);
+
+    return status;
+}
+
+VOID
+TapHostSend(PTAP_ADAPTER_CONTEXT Adapter, PNET_BUFFER_LIST NetBufferLists)
+{
+    WdkHostMiniportCharacteristics.SendNetBufferListsHandler(
+        Adapter, NetBufferLists, NDIS_DEFAULT_PORT_NUMBER, 0);
+}
+
+VOID
+TapHostReturn(PTAP_ADAPTER_CONTEXT Adapter, PNET_BUFFER_LIST NetBufferLists)
+{
+    WdkHostMiniportCharacteristics.ReturnNetBufferListsHandler(Adapter, NetBufferLists, 0);
+}
+
+NDIS_STATUS
+TapHostSetInformation(PTAP_ADAPTER_CONTEXT Adapter, NDIS_OID Oid,
+    PVOID Buffer, ULONG Length)
+{
+    NDIS_OID_REQUEST request;
+    NDIS_STATUS status;
+
+    NdisZeroMemory(&request, sizeof(request));
+    request.RequestType = NdisRequestSetInformation;
+    request.DATA.SET_INFORMATION.Oid = Oid;
+    request.DATA.SET_INFORMATION.InformationBuffer = Buffer;
+    request.DATA.SET_INFORMATION.InformationBufferLength = Length;
+
+    status = WdkHostMiniportCharacteristics.OidRequestHandler(Adapter, &request);
+
+    // The driver completes set requests inline.
+    CHECK(status != NDIS_STATUS_PENDING);
+
+    return status;
+}
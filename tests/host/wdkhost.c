@@ -0,0 +1,2259 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Host implementations of the kernel and NDIS routines the driver
+// calls. Only what the driver and the tests need; see wdkhost.h for
+// the knobs.
+//======================================================================
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "ntifs.h"
+#include "ndis.h"
+#include "ntstrsafe.h"
+#include "wdmsec.h"
+#include "wdkhost.h"
+
+WDK_HOST_COUNTERS WdkHostCounters;
+
+NDIS_MINIPORT_DRIVER_CHARACTERISTICS WdkHostMiniportCharacteristics;
+NDIS_HANDLE WdkHostMiniportDriverContext;
+
+const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_RWX_RES_RWX =
+    RTL_CONSTANT_STRING(L"D:P(A;;GA;;;SY)(A;;GRGWGX;;;BA)(A;;GRGWGX;;;WD)(A;;GRGWGX;;;RC)");
+
+// Serializes the DPC queue, the timer list and the configuration table.
+static pthread_mutex_t HostLock = PTHREAD_MUTEX_INITIALIZER;
+
+// WCHAR is 16 bits (-fshort-wchar); the C library's wcs* routines
+// assume the host's 32-bit wchar_t.
+static SIZE_T
+HostWcslen(PCWSTR String)
+{
+    SIZE_T length = 0;
+
+    while(String[length] != 0)
+    {
+        ++length;
+    }
+
+    return length;
+}
+
+static VOID
+HostWcsCopy(PWSTR Dest, PCWSTR Source, SIZE_T CchDest)
+{
+    SIZE_T i;
+
+    for(i = 0; i + 1 < CchDest && Source[i] != 0; ++i)
+    {
+        Dest[i] = Source[i];
+    }
+
+    Dest[i] = 0;
+}
+
+//======================================================================
+// Processors and IRQL
+//======================================================================
+
+static ULONG ProcessorCount = 4;
+static __thread ULONG CurrentProcessor;
+static __thread KIRQL CurrentIrql;
+
+VOID
+WdkHostSetProcessorCount(ULONG Count)
+{
+    ProcessorCount = Count ? Count : 1;
+}
+
+VOID
+WdkHostSetCurrentProcessor(ULONG Number)
+{
+    CurrentProcessor = Number;
+}
+
+ULONG
+KeQueryMaximumProcessorCountEx(USHORT GroupNumber)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+    return ProcessorCount;
+}
+
+ULONG
+KeQueryActiveProcessorCountEx(USHORT GroupNumber)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+    return ProcessorCount;
+}
+
+ULONG
+KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber)
+{
+    ULONG number = CurrentProcessor % ProcessorCount;
+
+    if(ProcNumber != NULL)
+    {
+        ProcNumber->Group = 0;
+        ProcNumber->Number = (UCHAR)number;
+        ProcNumber->Reserved = 0;
+    }
+
+    return number;
+}
+
+KIRQL
+KeGetCurrentIrql(VOID)
+{
+    return CurrentIrql;
+}
+
+VOID
+KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql)
+{
+    assert(NewIrql >= CurrentIrql);
+    *OldIrql = CurrentIrql;
+    CurrentIrql = NewIrql;
+}
+
+VOID
+KeLowerIrql(KIRQL NewIrql)
+{
+    assert(NewIrql <= CurrentIrql);
+    CurrentIrql = NewIrql;
+}
+
+KIRQL
+KeRaiseIrqlToDpcLevel(VOID)
+{
+    KIRQL oldIrql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    return oldIrql;
+}
+
+//======================================================================
+// Spin locks
+//======================================================================
+
+VOID
+KeInitializeSpinLock(PKSPIN_LOCK SpinLock)
+{
+    *SpinLock = 0;
+}
+
+BOOLEAN
+KeTryToAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    return __atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+VOID
+KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    while(!KeTryToAcquireSpinLockAtDpcLevel(SpinLock))
+    {
+        while(__atomic_load_n(SpinLock, __ATOMIC_RELAXED) != 0)
+        {
+            YieldProcessor();
+        }
+    }
+}
+
+VOID
+KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    assert(*SpinLock != 0);
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+VOID
+KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql)
+{
+    KeRaiseIrql(DISPATCH_LEVEL, OldIrql);
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+}
+
+VOID
+KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql)
+{
+    KeReleaseSpinLockFromDpcLevel(SpinLock);
+    KeLowerIrql(NewIrql);
+}
+
+VOID
+NdisAllocateSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    KeInitializeSpinLock(&SpinLock->SpinLock);
+    SpinLock->OldIrql = PASSIVE_LEVEL;
+}
+
+VOID
+NdisFreeSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    assert(SpinLock->SpinLock == 0);
+}
+
+VOID
+NdisAcquireSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock(&SpinLock->SpinLock, &oldIrql);
+    SpinLock->OldIrql = oldIrql;
+}
+
+VOID
+NdisReleaseSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    KeReleaseSpinLock(&SpinLock->SpinLock, SpinLock->OldIrql);
+}
+
+VOID
+NdisDprAcquireSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    KeAcquireSpinLockAtDpcLevel(&SpinLock->SpinLock);
+}
+
+VOID
+NdisDprReleaseSpinLock(PNDIS_SPIN_LOCK SpinLock)
+{
+    KeReleaseSpinLockFromDpcLevel(&SpinLock->SpinLock);
+}
+
+// Readers count up from zero; a writer holds it at -1.
+struct _NDIS_RW_LOCK_EX
+{
+    volatile LONG   State;
+};
+
+PNDIS_RW_LOCK_EX
+NdisAllocateRWLock(NDIS_HANDLE NdisHandle)
+{
+    UNREFERENCED_PARAMETER(NdisHandle);
+    return calloc(1, sizeof(NDIS_RW_LOCK_EX));
+}
+
+VOID
+NdisFreeRWLock(PNDIS_RW_LOCK_EX Lock)
+{
+    assert(Lock->State == 0);
+    free(Lock);
+}
+
+VOID
+NdisAcquireRWLockRead(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState, UCHAR Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &LockState->OldIrql);
+    LockState->LockState = 1;
+
+    for(;;)
+    {
+        LONG state = __atomic_load_n(&Lock->State, __ATOMIC_RELAXED);
+
+        if(state >= 0
+            && __atomic_compare_exchange_n(&Lock->State, &state, state + 1,
+                FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+
+        YieldProcessor();
+    }
+}
+
+VOID
+NdisAcquireRWLockWrite(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState, UCHAR Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &LockState->OldIrql);
+    LockState->LockState = 2;
+
+    for(;;)
+    {
+        LONG state = 0;
+
+        if(__atomic_compare_exchange_n(&Lock->State, &state, -1,
+                FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+
+        YieldProcessor();
+    }
+}
+
+VOID
+NdisReleaseRWLock(PNDIS_RW_LOCK_EX Lock, PLOCK_STATE_EX LockState)
+{
+    if(LockState->LockState == 2)
+    {
+        __atomic_store_n(&Lock->State, 0, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_sub_fetch(&Lock->State, 1, __ATOMIC_RELEASE);
+    }
+
+    LockState->LockState = 0;
+    KeLowerIrql(LockState->OldIrql);
+}
+
+//======================================================================
+// SLISTs
+//======================================================================
+
+static VOID
+SListLock(PSLIST_HEADER ListHead)
+{
+    while(__atomic_exchange_n(&ListHead->Lock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        YieldProcessor();
+    }
+}
+
+static VOID
+SListUnlock(PSLIST_HEADER ListHead)
+{
+    __atomic_store_n(&ListHead->Lock, 0, __ATOMIC_RELEASE);
+}
+
+VOID
+InitializeSListHead(PSLIST_HEADER ListHead)
+{
+    ListHead->Next = NULL;
+    ListHead->Depth = 0;
+    ListHead->Lock = 0;
+}
+
+PSLIST_ENTRY
+InterlockedPushEntrySList(PSLIST_HEADER ListHead, PSLIST_ENTRY Entry)
+{
+    PSLIST_ENTRY first;
+
+    SListLock(ListHead);
+    first = ListHead->Next;
+    Entry->Next = first;
+    ListHead->Next = Entry;
+    ++ListHead->Depth;
+    SListUnlock(ListHead);
+
+    return first;
+}
+
+PSLIST_ENTRY
+InterlockedPopEntrySList(PSLIST_HEADER ListHead)
+{
+    PSLIST_ENTRY first;
+
+    SListLock(ListHead);
+    first = ListHead->Next;
+    if(first != NULL)
+    {
+        ListHead->Next = first->Next;
+        --ListHead->Depth;
+    }
+    SListUnlock(ListHead);
+
+    return first;
+}
+
+PSLIST_ENTRY
+InterlockedFlushSList(PSLIST_HEADER ListHead)
+{
+    PSLIST_ENTRY first;
+
+    SListLock(ListHead);
+    first = ListHead->Next;
+    ListHead->Next = NULL;
+    ListHead->Depth = 0;
+    SListUnlock(ListHead);
+
+    return first;
+}
+
+//======================================================================
+// Clock
+//======================================================================
+
+static volatile BOOLEAN ClockFrozen;
+static volatile ULONGLONG FrozenNow;
+
+// 100ns units since an arbitrary epoch; never zero.
+static ULONGLONG
+HostNow(VOID)
+{
+    struct timespec ts;
+
+    if(ClockFrozen)
+    {
+        return FrozenNow;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ULONGLONG)ts.tv_sec * 10000000ULL + (ULONGLONG)ts.tv_nsec / 100 + 1;
+}
+
+static VOID HostFireTimers(VOID);
+
+VOID
+WdkHostFreezeClock(ULONGLONG Now)
+{
+    FrozenNow = Now;
+    ClockFrozen = TRUE;
+}
+
+VOID
+WdkHostThawClock(VOID)
+{
+    ClockFrozen = FALSE;
+}
+
+VOID
+WdkHostAdvanceClock(ULONGLONG Delta)
+{
+    assert(ClockFrozen);
+    FrozenNow += Delta;
+    HostFireTimers();
+}
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(PLARGE_INTEGER PerformanceFrequency)
+{
+    LARGE_INTEGER now;
+
+    if(PerformanceFrequency != NULL)
+    {
+        PerformanceFrequency->QuadPart = 10000000;
+    }
+
+    now.QuadPart = (LONGLONG)HostNow();
+    return now;
+}
+
+VOID
+KeQuerySystemTime(PLARGE_INTEGER CurrentTime)
+{
+    // 2020-01-01 in 100ns units since 1601, plus the host clock.
+    CurrentTime->QuadPart = 132223104000000000LL + (LONGLONG)HostNow();
+}
+
+#define HOST_TIME_INCREMENT     156250
+
+VOID
+KeQueryTickCount(PLARGE_INTEGER TickCount)
+{
+    TickCount->QuadPart = (LONGLONG)(HostNow() / HOST_TIME_INCREMENT);
+}
+
+ULONG
+KeQueryTimeIncrement(VOID)
+{
+    return HOST_TIME_INCREMENT;
+}
+
+ULONGLONG
+KeQueryInterruptTime(VOID)
+{
+    return HostNow();
+}
+
+VOID
+NdisGetSystemUpTimeEx(PLARGE_INTEGER pSystemUpTime)
+{
+    pSystemUpTime->QuadPart = (LONGLONG)(HostNow() / 10000);
+}
+
+VOID
+NdisMSleep(ULONG MicrosecondsToSleep)
+{
+    if(ClockFrozen)
+    {
+        WdkHostAdvanceClock((ULONGLONG)MicrosecondsToSleep * 10);
+    }
+    else
+    {
+        usleep(MicrosecondsToSleep);
+    }
+}
+
+NTSTATUS
+KeDelayExecutionThread(KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Interval)
+{
+    LONGLONG interval = Interval->QuadPart;
+
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    if(interval < 0)
+    {
+        interval = -interval;
+    }
+
+    NdisMSleep((ULONG)(interval / 10));
+    return STATUS_SUCCESS;
+}
+
+//======================================================================
+// DPCs and timers
+//======================================================================
+
+static LIST_ENTRY DpcQueue = { &DpcQueue, &DpcQueue };
+
+// DPCs taken off the queue and still running, on any thread.
+static ULONG DpcsRunning;
+static LIST_ENTRY TimerList = { &TimerList, &TimerList };
+
+VOID
+KeInitializeDpc(PKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext)
+{
+    memset(Dpc, 0, sizeof(*Dpc));
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+}
+
+BOOLEAN
+KeInsertQueueDpc(PKDPC Dpc, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    BOOLEAN inserted = FALSE;
+
+    pthread_mutex_lock(&HostLock);
+    if(!Dpc->Inserted)
+    {
+        Dpc->Inserted = TRUE;
+        Dpc->SystemArgument1 = SystemArgument1;
+        Dpc->SystemArgument2 = SystemArgument2;
+        InsertTailList(&DpcQueue, &Dpc->DpcListEntry);
+        inserted = TRUE;
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return inserted;
+}
+
+BOOLEAN
+KeRemoveQueueDpc(PKDPC Dpc)
+{
+    BOOLEAN removed = FALSE;
+
+    pthread_mutex_lock(&HostLock);
+    if(Dpc->Inserted)
+    {
+        Dpc->Inserted = FALSE;
+        RemoveEntryList(&Dpc->DpcListEntry);
+        removed = TRUE;
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return removed;
+}
+
+ULONG
+WdkHostQueuedDpcs(VOID)
+{
+    ULONG count = 0;
+    PLIST_ENTRY entry;
+
+    pthread_mutex_lock(&HostLock);
+    for(entry = DpcQueue.Flink; entry != &DpcQueue; entry = entry->Flink)
+    {
+        ++count;
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return count;
+}
+
+ULONG
+WdkHostRunDpcs(VOID)
+{
+    ULONG count = 0;
+
+    if(!ClockFrozen)
+    {
+        HostFireTimers();
+    }
+
+    for(;;)
+    {
+        PKDPC dpc = NULL;
+        KIRQL oldIrql;
+
+        pthread_mutex_lock(&HostLock);
+        if(!IsListEmpty(&DpcQueue))
+        {
+            dpc = CONTAINING_RECORD(RemoveHeadList(&DpcQueue), KDPC, DpcListEntry);
+            dpc->Inserted = FALSE;
+            ++DpcsRunning;
+        }
+        pthread_mutex_unlock(&HostLock);
+
+        if(dpc == NULL)
+        {
+            break;
+        }
+
+        KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+        dpc->DeferredRoutine(dpc, dpc->DeferredContext,
+            dpc->SystemArgument1, dpc->SystemArgument2);
+        KeLowerIrql(oldIrql);
+
+        pthread_mutex_lock(&HostLock);
+        --DpcsRunning;
+        pthread_mutex_unlock(&HostLock);
+
+        ++count;
+    }
+
+    return count;
+}
+
+VOID
+KeFlushQueuedDpcs(VOID)
+{
+    ULONG running;
+
+    WdkHostRunDpcs();
+
+    // As on Windows, also wait for DPCs other threads are running.
+    do
+    {
+        pthread_mutex_lock(&HostLock);
+        running = DpcsRunning;
+        pthread_mutex_unlock(&HostLock);
+
+        if(running != 0)
+        {
+            sched_yield();
+        }
+    } while(running != 0);
+}
+
+VOID
+KeInitializeTimer(PKTIMER Timer)
+{
+    memset(Timer, 0, sizeof(*Timer));
+}
+
+BOOLEAN
+KeSetTimerEx(PKTIMER Timer, LARGE_INTEGER DueTime, LONG Period, PKDPC Dpc)
+{
+    BOOLEAN wasInserted;
+    ULONGLONG now = HostNow();
+
+    pthread_mutex_lock(&HostLock);
+    wasInserted = Timer->Inserted;
+    if(wasInserted)
+    {
+        RemoveEntryList(&Timer->TimerListEntry);
+    }
+
+    if(DueTime.QuadPart < 0)
+    {
+        Timer->DueTime = now + (ULONGLONG)(-DueTime.QuadPart);
+    }
+    else
+    {
+        LARGE_INTEGER systemTime;
+
+        // Absolute system time; convert back to the host clock.
+        KeQuerySystemTime(&systemTime);
+        Timer->DueTime = now + (DueTime.QuadPart > systemTime.QuadPart
+            ? (ULONGLONG)(DueTime.QuadPart - systemTime.QuadPart) : 0);
+    }
+
+    Timer->Period = Period;
+    Timer->Dpc = Dpc;
+    Timer->Inserted = TRUE;
+    InsertTailList(&TimerList, &Timer->TimerListEntry);
+    pthread_mutex_unlock(&HostLock);
+
+    return wasInserted;
+}
+
+BOOLEAN
+KeSetTimer(PKTIMER Timer, LARGE_INTEGER DueTime, PKDPC Dpc)
+{
+    return KeSetTimerEx(Timer, DueTime, 0, Dpc);
+}
+
+BOOLEAN
+KeCancelTimer(PKTIMER Timer)
+{
+    BOOLEAN wasInserted;
+
+    pthread_mutex_lock(&HostLock);
+    wasInserted = Timer->Inserted;
+    if(wasInserted)
+    {
+        RemoveEntryList(&Timer->TimerListEntry);
+        Timer->Inserted = FALSE;
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return wasInserted;
+}
+
+BOOLEAN
+KeReadStateTimer(PKTIMER Timer)
+{
+    return !Timer->Inserted;
+}
+
+static VOID
+HostFireTimers(VOID)
+{
+    ULONGLONG now = HostNow();
+    PLIST_ENTRY entry;
+    LIST_ENTRY due;
+
+    InitializeListHead(&due);
+
+    pthread_mutex_lock(&HostLock);
+    entry = TimerList.Flink;
+    while(entry != &TimerList)
+    {
+        PKTIMER timer = CONTAINING_RECORD(entry, KTIMER, TimerListEntry);
+
+        entry = entry->Flink;
+
+        if(timer->DueTime > now)
+        {
+            continue;
+        }
+
+        RemoveEntryList(&timer->TimerListEntry);
+        InsertTailList(&due, &timer->TimerListEntry);
+    }
+
+    while(!IsListEmpty(&due))
+    {
+        PKTIMER timer = CONTAINING_RECORD(RemoveHeadList(&due), KTIMER, TimerListEntry);
+
+        if(timer->Period > 0)
+        {
+            timer->DueTime = now + (ULONGLONG)timer->Period * 10000;
+            InsertTailList(&TimerList, &timer->TimerListEntry);
+        }
+        else
+        {
+            timer->Inserted = FALSE;
+        }
+
+        if(timer->Dpc != NULL && !timer->Dpc->Inserted)
+        {
+            timer->Dpc->Inserted = TRUE;
+            timer->Dpc->SystemArgument1 = NULL;
+            timer->Dpc->SystemArgument2 = NULL;
+            InsertTailList(&DpcQueue, &timer->Dpc->DpcListEntry);
+        }
+    }
+    pthread_mutex_unlock(&HostLock);
+}
+
+//======================================================================
+// Events and waits
+//======================================================================
+
+VOID
+KeInitializeEvent(PKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Type = Type;
+    Event->State = State;
+}
+
+LONG
+KeSetEvent(PKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+
+    return __atomic_exchange_n(&Event->State, 1, __ATOMIC_SEQ_CST);
+}
+
+VOID
+KeClearEvent(PKEVENT Event)
+{
+    __atomic_store_n(&Event->State, 0, __ATOMIC_SEQ_CST);
+}
+
+LONG
+KeResetEvent(PKEVENT Event)
+{
+    return __atomic_exchange_n(&Event->State, 0, __ATOMIC_SEQ_CST);
+}
+
+LONG
+KeReadStateEvent(PKEVENT Event)
+{
+    return __atomic_load_n(&Event->State, __ATOMIC_SEQ_CST);
+}
+
+// Polls, running DPCs in between so that a waiter at PASSIVE_LEVEL
+// can be released by the work it is waiting for.
+NTSTATUS
+KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason,
+    KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+    PKEVENT event = (PKEVENT)Object;
+    ULONGLONG deadline = 0;
+
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    if(Timeout != NULL)
+    {
+        deadline = HostNow() + (ULONGLONG)(Timeout->QuadPart < 0
+            ? -Timeout->QuadPart : Timeout->QuadPart);
+    }
+
+    for(;;)
+    {
+        if(event->Type == SynchronizationEvent)
+        {
+            if(__atomic_exchange_n(&event->State, 0, __ATOMIC_SEQ_CST))
+            {
+                return STATUS_SUCCESS;
+            }
+        }
+        else if(KeReadStateEvent(event))
+        {
+            return STATUS_SUCCESS;
+        }
+
+        if(Timeout != NULL && HostNow() >= deadline)
+        {
+            return STATUS_TIMEOUT;
+        }
+
+        if(WdkHostRunDpcs() == 0)
+        {
+            if(ClockFrozen && Timeout != NULL)
+            {
+                WdkHostAdvanceClock(deadline - HostNow());
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+VOID
+NdisInitializeEvent(PNDIS_EVENT Event)
+{
+    KeInitializeEvent(&Event->Event, NotificationEvent, FALSE);
+}
+
+VOID
+NdisSetEvent(PNDIS_EVENT Event)
+{
+    KeSetEvent(&Event->Event, 0, FALSE);
+}
+
+VOID
+NdisResetEvent(PNDIS_EVENT Event)
+{
+    KeResetEvent(&Event->Event);
+}
+
+BOOLEAN
+NdisWaitEvent(PNDIS_EVENT Event, UINT MsToWait)
+{
+    LARGE_INTEGER timeout;
+
+    timeout.QuadPart = -(LONGLONG)MsToWait * 10000;
+
+    return KeWaitForSingleObject(&Event->Event, Executive, KernelMode, FALSE,
+        MsToWait ? &timeout : NULL) == STATUS_SUCCESS;
+}
+
+VOID
+KeBugCheckEx(ULONG BugCheckCode, ULONG_PTR P1, ULONG_PTR P2, ULONG_PTR P3, ULONG_PTR P4)
+{
+    fprintf(stderr, "*** BUGCHECK 0x%08X (%#lx, %#lx, %#lx, %#lx)\n", BugCheckCode,
+        (unsigned long)P1, (unsigned long)P2, (unsigned long)P3, (unsigned long)P4);
+    abort();
+}
+
+//======================================================================
+// Pool and MDLs
+//======================================================================
+
+PVOID
+ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    PVOID p;
+
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+
+    p = malloc(NumberOfBytes ? NumberOfBytes : 1);
+    if(p != NULL)
+    {
+        InterlockedIncrement(&WdkHostCounters.PoolAllocations);
+    }
+
+    return p;
+}
+
+PVOID
+ExAllocatePool2(POOL_FLAGS Flags, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    PVOID p = ExAllocatePoolWithTag(NonPagedPoolNx, NumberOfBytes, Tag);
+
+    if(p != NULL && !(Flags & POOL_FLAG_UNINITIALIZED))
+    {
+        memset(p, 0, NumberOfBytes);
+    }
+
+    return p;
+}
+
+VOID
+ExFreePool(PVOID P)
+{
+    assert(P != NULL);
+    InterlockedDecrement(&WdkHostCounters.PoolAllocations);
+    free(P);
+}
+
+VOID
+ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(Tag);
+    ExFreePool(P);
+}
+
+PVOID
+NdisAllocateMemoryWithTagPriority(NDIS_HANDLE NdisHandle, UINT Length, ULONG Tag,
+    EX_POOL_PRIORITY Priority)
+{
+    UNREFERENCED_PARAMETER(NdisHandle);
+    UNREFERENCED_PARAMETER(Priority);
+
+    return ExAllocatePoolWithTag(NonPagedPoolNx, Length, Tag);
+}
+
+NDIS_STATUS
+NdisAllocateMemoryWithTag(PVOID *VirtualAddress, UINT Length, ULONG Tag)
+{
+    *VirtualAddress = ExAllocatePoolWithTag(NonPagedPoolNx, Length, Tag);
+
+    return *VirtualAddress != NULL ? NDIS_STATUS_SUCCESS : NDIS_STATUS_FAILURE;
+}
+
+VOID
+NdisFreeMemory(PVOID VirtualAddress, UINT Length, UINT MemoryFlags)
+{
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(MemoryFlags);
+
+    ExFreePool(VirtualAddress);
+}
+
+static PMDL
+HostAllocateMdl(PVOID VirtualAddress, ULONG Length)
+{
+    PMDL mdl = calloc(1, sizeof(MDL));
+
+    if(mdl != NULL)
+    {
+        mdl->StartVa = VirtualAddress;
+        mdl->ByteCount = Length;
+        mdl->MappedSystemVa = VirtualAddress;
+        mdl->MdlFlags = MDL_SOURCE_IS_NONPAGED_POOL;
+        InterlockedIncrement(&WdkHostCounters.Mdls);
+        InterlockedIncrement(&WdkHostCounters.MdlAllocations);
+    }
+
+    return mdl;
+}
+
+PMDL
+NdisAllocateMdl(NDIS_HANDLE NdisHandle, PVOID VirtualAddress, UINT Length)
+{
+    UNREFERENCED_PARAMETER(NdisHandle);
+    return HostAllocateMdl(VirtualAddress, Length);
+}
+
+VOID
+NdisFreeMdl(PMDL Mdl)
+{
+    InterlockedDecrement(&WdkHostCounters.Mdls);
+    free(Mdl);
+}
+
+PMDL
+IoAllocateMdl(PVOID VirtualAddress, ULONG Length, BOOLEAN SecondaryBuffer,
+    BOOLEAN ChargeQuota, PIRP Irp)
+{
+    PMDL mdl = HostAllocateMdl(VirtualAddress, Length);
+
+    UNREFERENCED_PARAMETER(SecondaryBuffer);
+    UNREFERENCED_PARAMETER(ChargeQuota);
+
+    if(mdl != NULL)
+    {
+        mdl->MdlFlags = 0;
+        if(Irp != NULL)
+        {
+            Irp->MdlAddress = mdl;
+        }
+    }
+
+    return mdl;
+}
+
+VOID
+IoFreeMdl(PMDL Mdl)
+{
+    NdisFreeMdl(Mdl);
+}
+
+VOID
+MmBuildMdlForNonPagedPool(PMDL MemoryDescriptorList)
+{
+    MemoryDescriptorList->MappedSystemVa = MmGetMdlVirtualAddress(MemoryDescriptorList);
+    MemoryDescriptorList->MdlFlags |= MDL_SOURCE_IS_NONPAGED_POOL;
+}
+
+// One address space: a user mapping is the system address. Each is
+// remembered with its process, which alone can unmap it.
+#define HOST_MAX_USER_MAPPINGS  64
+
+static struct
+{
+    PVOID       Address;
+    ULONG_PTR   ProcessId;
+} UserMappings[HOST_MAX_USER_MAPPINGS];
+
+PVOID
+MmMapLockedPagesSpecifyCache(PMDL MemoryDescriptorList, KPROCESSOR_MODE AccessMode,
+    MEMORY_CACHING_TYPE CacheType, PVOID RequestedAddress, ULONG BugCheckOnFailure,
+    ULONG Priority)
+{
+    PVOID address = MmGetMdlVirtualAddress(MemoryDescriptorList);
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(CacheType);
+    UNREFERENCED_PARAMETER(RequestedAddress);
+    UNREFERENCED_PARAMETER(BugCheckOnFailure);
+    UNREFERENCED_PARAMETER(Priority);
+
+    if(AccessMode != UserMode)
+    {
+        return address;
+    }
+
+    pthread_mutex_lock(&HostLock);
+    for(i = 0; i < HOST_MAX_USER_MAPPINGS && UserMappings[i].Address != NULL; ++i)
+    {
+    }
+    if(i == HOST_MAX_USER_MAPPINGS)
+    {
+        fprintf(stderr, "*** Too many user mappings\n");
+        abort();
+    }
+    UserMappings[i].Address = address;
+    UserMappings[i].ProcessId = (ULONG_PTR)PsGetCurrentProcessId();
+    pthread_mutex_unlock(&HostLock);
+
+    InterlockedIncrement(&WdkHostCounters.UserMappings);
+
+    return address;
+}
+
+VOID
+MmUnmapLockedPages(PVOID BaseAddress, PMDL MemoryDescriptorList)
+{
+    ULONG_PTR processId = (ULONG_PTR)PsGetCurrentProcessId();
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(MemoryDescriptorList);
+
+    pthread_mutex_lock(&HostLock);
+    for(i = 0; i < HOST_MAX_USER_MAPPINGS; ++i)
+    {
+        if(UserMappings[i].Address == BaseAddress && UserMappings[i].ProcessId == processId)
+        {
+            break;
+        }
+    }
+    if(i == HOST_MAX_USER_MAPPINGS)
+    {
+        fprintf(stderr, "*** Unmapping %p, not mapped in process %#lx\n",
+            BaseAddress, (unsigned long)processId);
+        abort();
+    }
+    UserMappings[i].Address = NULL;
+    pthread_mutex_unlock(&HostLock);
+
+    InterlockedDecrement(&WdkHostCounters.UserMappings);
+}
+
+ULONG
+WdkHostProcessUserMappings(ULONG_PTR ProcessId)
+{
+    ULONG count = 0;
+    ULONG i;
+
+    pthread_mutex_lock(&HostLock);
+    for(i = 0; i < HOST_MAX_USER_MAPPINGS; ++i)
+    {
+        if(UserMappings[i].Address != NULL && UserMappings[i].ProcessId == ProcessId)
+        {
+            ++count;
+        }
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return count;
+}
+
+SIZE_T
+WdkHostCompareMemory(const VOID *Source1, const VOID *Source2, SIZE_T Length)
+{
+    const UCHAR *a = Source1;
+    const UCHAR *b = Source2;
+    SIZE_T i;
+
+    for(i = 0; i < Length && a[i] == b[i]; ++i)
+    {
+    }
+
+    return i;
+}
+
+//======================================================================
+// Net buffer lists
+//======================================================================
+
+typedef struct _HOST_NBL_POOL
+{
+    NDIS_HANDLE                     NdisHandle;
+    NET_BUFFER_LIST_POOL_PARAMETERS Parameters;
+} HOST_NBL_POOL, *PHOST_NBL_POOL;
+
+typedef struct _HOST_NBL
+{
+    NET_BUFFER_LIST     NetBufferList;
+    NET_BUFFER          NetBuffer;
+} HOST_NBL, *PHOST_NBL;
+
+// The pool of NBLs built by WdkHostAllocateNetBufferList.
+static HOST_NBL_POOL TestPool;
+
+NDIS_HANDLE
+NdisAllocateNetBufferListPool(NDIS_HANDLE NdisHandle,
+    PNET_BUFFER_LIST_POOL_PARAMETERS Parameters)
+{
+    PHOST_NBL_POOL pool = calloc(1, sizeof(HOST_NBL_POOL));
+
+    if(pool != NULL)
+    {
+        pool->NdisHandle = NdisHandle;
+        pool->Parameters = *Parameters;
+    }
+
+    return pool;
+}
+
+VOID
+NdisFreeNetBufferListPool(NDIS_HANDLE PoolHandle)
+{
+    free(PoolHandle);
+}
+
+static VOID
+HostSetNetBufferData(PNET_BUFFER NetBuffer, PMDL MdlChain, ULONG DataOffset, ULONG DataLength)
+{
+    PMDL mdl = MdlChain;
+    ULONG offset = DataOffset;
+
+    NetBuffer->MdlChain = MdlChain;
+    NetBuffer->DataOffset = DataOffset;
+    NetBuffer->DataLength = DataLength;
+
+    while(mdl != NULL && offset >= MmGetMdlByteCount(mdl) && mdl->Next != NULL)
+    {
+        offset -= MmGetMdlByteCount(mdl);
+        mdl = mdl->Next;
+    }
+
+    NetBuffer->CurrentMdl = mdl;
+    NetBuffer->CurrentMdlOffset = offset;
+}
+
+PNET_BUFFER_LIST
+NdisAllocateNetBufferAndNetBufferList(NDIS_HANDLE PoolHandle,
+    USHORT ContextSize, USHORT ContextBackFill, PMDL MdlChain, ULONG DataOffset,
+    SIZE_T DataLength)
+{
+    PHOST_NBL_POOL pool = (PHOST_NBL_POOL)PoolHandle;
+    PHOST_NBL hostNbl;
+
+    UNREFERENCED_PARAMETER(ContextSize);
+    UNREFERENCED_PARAMETER(ContextBackFill);
+
+    hostNbl = calloc(1, sizeof(HOST_NBL));
+    if(hostNbl == NULL)
+    {
+        return NULL;
+    }
+
+    hostNbl->NetBufferList.FirstNetBuffer = &hostNbl->NetBuffer;
+    hostNbl->NetBufferList.SourceHandle = pool->NdisHandle;
+    hostNbl->NetBufferList.HostPool = pool;
+    HostSetNetBufferData(&hostNbl->NetBuffer, MdlChain, DataOffset, (ULONG)DataLength);
+
+    InterlockedIncrement(&WdkHostCounters.NetBufferLists);
+
+    return &hostNbl->NetBufferList;
+}
+
+VOID
+NdisFreeNetBufferList(PNET_BUFFER_LIST NetBufferList)
+{
+    InterlockedDecrement(&WdkHostCounters.NetBufferLists);
+    free(CONTAINING_RECORD(NetBufferList, HOST_NBL, NetBufferList));
+}
+
+PVOID
+NdisGetDataBuffer(PNET_BUFFER NetBuffer, ULONG BytesNeeded, PVOID Storage,
+    UINT AlignMultiple, UINT AlignOffset)
+{
+    PMDL mdl = NetBuffer->CurrentMdl;
+    ULONG offset = NetBuffer->CurrentMdlOffset;
+    PUCHAR out = Storage;
+    ULONG copied = 0;
+
+    UNREFERENCED_PARAMETER(AlignMultiple);
+    UNREFERENCED_PARAMETER(AlignOffset);
+
+    if(BytesNeeded == 0 || BytesNeeded > NetBuffer->DataLength || mdl == NULL)
+    {
+        return NULL;
+    }
+
+    if(MmGetMdlByteCount(mdl) - offset >= BytesNeeded)
+    {
+        return (PUCHAR)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority) + offset;
+    }
+
+    if(Storage == NULL)
+    {
+        return NULL;
+    }
+
+    while(mdl != NULL && copied < BytesNeeded)
+    {
+        ULONG chunk = min(MmGetMdlByteCount(mdl) - offset, BytesNeeded - copied);
+
+        memcpy(out + copied,
+            (PUCHAR)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority) + offset, chunk);
+        copied += chunk;
+        offset = 0;
+        mdl = mdl->Next;
+    }
+
+    return copied == BytesNeeded ? Storage : NULL;
+}
+
+PNET_BUFFER_LIST
+WdkHostAllocateNetBufferList(const VOID *Data, ULONG Length)
+{
+    PVOID buffer = malloc(Length ? Length : 1);
+    PMDL mdl;
+
+    memcpy(buffer, Data, Length);
+    mdl = HostAllocateMdl(buffer, Length);
+
+    return NdisAllocateNetBufferAndNetBufferList(&TestPool, 0, 0, mdl, 0, Length);
+}
+
+VOID
+WdkHostFreeNetBufferList(PNET_BUFFER_LIST NetBufferList)
+{
+    PNET_BUFFER nb = NET_BUFFER_LIST_FIRST_NB(NetBufferList);
+    PMDL mdl = NET_BUFFER_FIRST_MDL(nb);
+
+    assert(NetBufferList->HostPool == &TestPool);
+
+    while(mdl != NULL)
+    {
+        PMDL next = mdl->Next;
+
+        free(mdl->StartVa);
+        NdisFreeMdl(mdl);
+        mdl = next;
+    }
+
+    NdisFreeNetBufferList(NetBufferList);
+}
+
+ULONG
+WdkHostCopyNetBufferData(PNET_BUFFER NetBuffer, PVOID Buffer, ULONG Length)
+{
+    PMDL mdl = NetBuffer->CurrentMdl;
+    ULONG offset = NetBuffer->CurrentMdlOffset;
+    ULONG remaining = min(Length, NetBuffer->DataLength);
+    ULONG copied = 0;
+
+    while(mdl != NULL && copied < remaining)
+    {
+        ULONG chunk = min(MmGetMdlByteCount(mdl) - offset, remaining - copied);
+
+        memcpy((PUCHAR)Buffer + copied,
+            (PUCHAR)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority) + offset, chunk);
+        copied += chunk;
+        offset = 0;
+        mdl = mdl->Next;
+    }
+
+    return copied;
+}
+
+//======================================================================
+// Indications
+//======================================================================
+
+static WDK_HOST_RECEIVE_HOOK *ReceiveHook;
+static PVOID ReceiveHookContext;
+static WDK_HOST_SEND_COMPLETE_HOOK *SendCompleteHook;
+static PVOID SendCompleteHookContext;
+static WDK_HOST_IRP_COMPLETE_HOOK *IrpCompleteHook;
+static PVOID IrpCompleteHookContext;
+
+VOID
+WdkHostSetReceiveHook(WDK_HOST_RECEIVE_HOOK *Hook, PVOID Context)
+{
+    ReceiveHook = Hook;
+    ReceiveHookContext = Context;
+}
+
+VOID
+WdkHostSetSendCompleteHook(WDK_HOST_SEND_COMPLETE_HOOK *Hook, PVOID Context)
+{
+    SendCompleteHook = Hook;
+    SendCompleteHookContext = Context;
+}
+
+VOID
+WdkHostSetIrpCompleteHook(WDK_HOST_IRP_COMPLETE_HOOK *Hook, PVOID Context)
+{
+    IrpCompleteHook = Hook;
+    IrpCompleteHookContext = Context;
+}
+
+VOID
+NdisMIndicateReceiveNetBufferLists(NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, NDIS_PORT_NUMBER PortNumber,
+    ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(PortNumber);
+
+    InterlockedIncrement(&WdkHostCounters.ReceiveIndications);
+    InterlockedAdd(&WdkHostCounters.ReceivedNetBufferLists, (LONG)NumberOfNetBufferLists);
+
+    if(ReceiveHook != NULL)
+    {
+        ReceiveHook(ReceiveHookContext, MiniportAdapterHandle, NetBufferLists,
+            NumberOfNetBufferLists, ReceiveFlags);
+    }
+}
+
+VOID
+NdisMSendNetBufferListsComplete(NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    PNET_BUFFER_LIST nbl;
+
+    for(nbl = NetBufferLists; nbl != NULL; nbl = NET_BUFFER_LIST_NEXT_NBL(nbl))
+    {
+        InterlockedIncrement(&WdkHostCounters.SendCompletions);
+    }
+
+    if(SendCompleteHook != NULL)
+    {
+        SendCompleteHook(SendCompleteHookContext, MiniportAdapterHandle,
+            NetBufferLists, SendCompleteFlags);
+    }
+}
+
+VOID
+NdisMIndicateStatusEx(NDIS_HANDLE MiniportAdapterHandle,
+    PNDIS_STATUS_INDICATION StatusIndication)
+{
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(StatusIndication);
+
+    InterlockedIncrement(&WdkHostCounters.StatusIndications);
+}
+
+//======================================================================
+// IRPs and cancel-safe queues
+//======================================================================
+
+PIRP
+WdkHostAllocateIrp(UCHAR MajorFunction, PVOID Buffer, ULONG Length)
+{
+    PIRP irp = calloc(1, sizeof(IRP));
+
+    irp->Tail.Overlay.CurrentStackLocation = &irp->HostStack;
+    irp->HostStack.MajorFunction = MajorFunction;
+    irp->AssociatedIrp.SystemBuffer = Buffer;
+    irp->RequestorMode = UserMode;
+
+    switch(MajorFunction)
+    {
+    case IRP_MJ_READ:
+        irp->HostStack.Parameters.Read.Length = Length;
+        break;
+
+    case IRP_MJ_WRITE:
+        irp->HostStack.Parameters.Write.Length = Length;
+        break;
+
+    default:
+        irp->HostStack.Parameters.DeviceIoControl.OutputBufferLength = Length;
+        irp->HostStack.Parameters.DeviceIoControl.InputBufferLength = Length;
+        break;
+    }
+
+    if(Buffer != NULL)
+    {
+        irp->MdlAddress = HostAllocateMdl(Buffer, Length);
+    }
+
+    return irp;
+}
+
+VOID
+WdkHostFreeIrp(PIRP Irp)
+{
+    if(Irp->MdlAddress != NULL)
+    {
+        NdisFreeMdl(Irp->MdlAddress);
+    }
+
+    free(Irp);
+}
+
+VOID
+IoCompleteRequest(PIRP Irp, CHAR PriorityBoost)
+{
+    UNREFERENCED_PARAMETER(PriorityBoost);
+
+    assert(Irp->HostCompleted == 0);
+    Irp->HostCompleted = 1;
+    InterlockedIncrement(&WdkHostCounters.CompletedIrps);
+
+    if(IrpCompleteHook != NULL)
+    {
+        IrpCompleteHook(IrpCompleteHookContext, Irp);
+    }
+}
+
+static KSPIN_LOCK CancelSpinLock;
+
+VOID
+IoAcquireCancelSpinLock(PKIRQL Irql)
+{
+    KeAcquireSpinLock(&CancelSpinLock, Irql);
+}
+
+VOID
+IoReleaseCancelSpinLock(KIRQL Irql)
+{
+    KeReleaseSpinLock(&CancelSpinLock, Irql);
+}
+
+NTSTATUS
+IoCsqInitialize(PIO_CSQ Csq, PIO_CSQ_INSERT_IRP CsqInsertIrp,
+    PIO_CSQ_REMOVE_IRP CsqRemoveIrp, PIO_CSQ_PEEK_NEXT_IRP CsqPeekNextIrp,
+    PIO_CSQ_ACQUIRE_LOCK CsqAcquireLock, PIO_CSQ_RELEASE_LOCK CsqReleaseLock,
+    PIO_CSQ_COMPLETE_CANCELED_IRP CsqCompleteCanceledIrp)
+{
+    memset(Csq, 0, sizeof(*Csq));
+    Csq->CsqInsertIrp = CsqInsertIrp;
+    Csq->CsqRemoveIrp = CsqRemoveIrp;
+    Csq->CsqPeekNextIrp = CsqPeekNextIrp;
+    Csq->CsqAcquireLock = CsqAcquireLock;
+    Csq->CsqReleaseLock = CsqReleaseLock;
+    Csq->CsqCompleteCanceledIrp = CsqCompleteCanceledIrp;
+
+    return STATUS_SUCCESS;
+}
+
+// Cancellation is not simulated; an inserted IRP stays queued until
+// it is removed.
+VOID
+IoCsqInsertIrp(PIO_CSQ Csq, PIRP Irp, PIO_CSQ_IRP_CONTEXT Context)
+{
+    KIRQL irql;
+
+    Csq->CsqAcquireLock(Csq, &irql);
+
+    if(Context != NULL)
+    {
+        Context->Irp = Irp;
+        Context->Csq = Csq;
+    }
+
+    Irp->Tail.Overlay.DriverContext[3] = Context;
+    IoMarkIrpPending(Irp);
+    Csq->CsqInsertIrp(Csq, Irp);
+
+    Csq->CsqReleaseLock(Csq, irql);
+}
+
+PIRP
+IoCsqRemoveNextIrp(PIO_CSQ Csq, PVOID PeekContext)
+{
+    KIRQL irql;
+    PIRP irp;
+
+    Csq->CsqAcquireLock(Csq, &irql);
+
+    irp = Csq->CsqPeekNextIrp(Csq, NULL, PeekContext);
+    if(irp != NULL)
+    {
+        PIO_CSQ_IRP_CONTEXT context = irp->Tail.Overlay.DriverContext[3];
+
+        Csq->CsqRemoveIrp(Csq, irp);
+        if(context != NULL)
+        {
+            context->Irp = NULL;
+        }
+        irp->Tail.Overlay.DriverContext[3] = NULL;
+    }
+
+    Csq->CsqReleaseLock(Csq, irql);
+
+    return irp;
+}
+
+PIRP
+IoCsqRemoveIrp(PIO_CSQ Csq, PIO_CSQ_IRP_CONTEXT Context)
+{
+    KIRQL irql;
+    PIRP irp;
+
+    Csq->CsqAcquireLock(Csq, &irql);
+
+    irp = Context->Irp;
+    if(irp != NULL)
+    {
+        Context->Irp = NULL;
+        irp->Tail.Overlay.DriverContext[3] = NULL;
+        Csq->CsqRemoveIrp(Csq, irp);
+    }
+
+    Csq->CsqReleaseLock(Csq, irql);
+
+    return irp;
+}
+
+//======================================================================
+// Processes and objects
+//======================================================================
+
+static __thread ULONG_PTR CurrentProcessId = 4;
+static PCREATE_PROCESS_NOTIFY_ROUTINE_EX ProcessNotifyRoutine;
+
+VOID
+WdkHostSetCurrentProcess(ULONG_PTR ProcessId)
+{
+    CurrentProcessId = ProcessId;
+}
+
+// The exit notification runs in the exiting process. Its address space
+// must then have no locked pages mapped (PROCESS_HAS_LOCKED_PAGES).
+VOID
+WdkHostExitProcess(ULONG_PTR ProcessId)
+{
+    ULONG_PTR current = CurrentProcessId;
+
+    CurrentProcessId = ProcessId;
+
+    if(ProcessNotifyRoutine != NULL)
+    {
+        ProcessNotifyRoutine((PEPROCESS)ProcessId, (HANDLE)ProcessId, NULL);
+    }
+
+    if(WdkHostProcessUserMappings(ProcessId) != 0)
+    {
+        KeBugCheckEx(0x76 /* PROCESS_HAS_LOCKED_PAGES */, 0, ProcessId,
+            WdkHostProcessUserMappings(ProcessId), 0);
+    }
+
+    CurrentProcessId = current;
+}
+
+// A process is identified by its id.
+PEPROCESS
+PsGetCurrentProcess(VOID)
+{
+    return (PEPROCESS)CurrentProcessId;
+}
+
+HANDLE
+PsGetCurrentProcessId(VOID)
+{
+    return (HANDLE)CurrentProcessId;
+}
+
+HANDLE
+PsGetProcessId(PEPROCESS Process)
+{
+    return (HANDLE)Process;
+}
+
+NTSTATUS
+PsSetCreateProcessNotifyRoutineEx(PCREATE_PROCESS_NOTIFY_ROUTINE_EX NotifyRoutine,
+    BOOLEAN Remove)
+{
+    if(Remove)
+    {
+        if(ProcessNotifyRoutine != NotifyRoutine)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        ProcessNotifyRoutine = NULL;
+    }
+    else
+    {
+        if(ProcessNotifyRoutine != NULL)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        ProcessNotifyRoutine = NotifyRoutine;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ObReferenceObject(PVOID Object)
+{
+    UNREFERENCED_PARAMETER(Object);
+}
+
+VOID
+ObDereferenceObject(PVOID Object)
+{
+    UNREFERENCED_PARAMETER(Object);
+}
+
+//======================================================================
+// Registry and configuration
+//======================================================================
+
+#define HOST_MAX_CONFIGURATION  16
+
+typedef struct _HOST_CONFIGURATION
+{
+    WCHAR                           Keyword[64];
+    WCHAR                           String[64];
+    NDIS_CONFIGURATION_PARAMETER    Parameter;
+} HOST_CONFIGURATION;
+
+static HOST_CONFIGURATION Configuration[HOST_MAX_CONFIGURATION];
+static ULONG ConfigurationCount;
+
+static HOST_CONFIGURATION *
+HostFindConfiguration(PCWSTR Keyword, USHORT KeywordLength)
+{
+    ULONG i;
+
+    for(i = 0; i < ConfigurationCount; ++i)
+    {
+        if(HostWcslen(Configuration[i].Keyword) * sizeof(WCHAR) == KeywordLength
+            && memcmp(Configuration[i].Keyword, Keyword, KeywordLength) == 0)
+        {
+            return &Configuration[i];
+        }
+    }
+
+    return NULL;
+}
+
+static HOST_CONFIGURATION *
+HostAddConfiguration(PCWSTR Keyword)
+{
+    HOST_CONFIGURATION *config;
+
+    pthread_mutex_lock(&HostLock);
+    config = HostFindConfiguration(Keyword, (USHORT)(HostWcslen(Keyword) * sizeof(WCHAR)));
+    if(config == NULL)
+    {
+        assert(ConfigurationCount < HOST_MAX_CONFIGURATION);
+        config = &Configuration[ConfigurationCount++];
+        HostWcsCopy(config->Keyword, Keyword, 64);
+    }
+    pthread_mutex_unlock(&HostLock);
+
+    return config;
+}
+
+VOID
+WdkHostSetConfigurationString(PCWSTR Keyword, PCWSTR Value)
+{
+    HOST_CONFIGURATION *config = HostAddConfiguration(Keyword);
+
+    HostWcsCopy(config->String, Value, 64);
+    config->Parameter.ParameterType = NdisParameterString;
+    RtlInitUnicodeString(&config->Parameter.ParameterData.StringData, config->String);
+}
+
+VOID
+WdkHostSetConfigurationInteger(PCWSTR Keyword, ULONG Value)
+{
+    HOST_CONFIGURATION *config = HostAddConfiguration(Keyword);
+
+    config->Parameter.ParameterType = NdisParameterInteger;
+    config->Parameter.ParameterData.IntegerData = Value;
+}
+
+VOID
+WdkHostClearConfiguration(VOID)
+{
+    pthread_mutex_lock(&HostLock);
+    memset(Configuration, 0, sizeof(Configuration));
+    ConfigurationCount = 0;
+    pthread_mutex_unlock(&HostLock);
+}
+
+NDIS_STATUS
+NdisOpenConfigurationEx(PNDIS_CONFIGURATION_OBJECT ConfigObject,
+    PNDIS_HANDLE ConfigurationHandle)
+{
+    UNREFERENCED_PARAMETER(ConfigObject);
+
+    *ConfigurationHandle = (NDIS_HANDLE)Configuration;
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NdisCloseConfiguration(NDIS_HANDLE ConfigurationHandle)
+{
+    UNREFERENCED_PARAMETER(ConfigurationHandle);
+}
+
+VOID
+NdisReadConfiguration(PNDIS_STATUS Status,
+    PNDIS_CONFIGURATION_PARAMETER *ParameterValue, NDIS_HANDLE ConfigurationHandle,
+    PNDIS_STRING Keyword, NDIS_PARAMETER_TYPE ParameterType)
+{
+    HOST_CONFIGURATION *config;
+
+    UNREFERENCED_PARAMETER(ConfigurationHandle);
+    UNREFERENCED_PARAMETER(ParameterType);
+
+    pthread_mutex_lock(&HostLock);
+    config = HostFindConfiguration(Keyword->Buffer, Keyword->Length);
+    pthread_mutex_unlock(&HostLock);
+
+    if(config == NULL)
+    {
+        *Status = NDIS_STATUS_FAILURE;
+        return;
+    }
+
+    *ParameterValue = &config->Parameter;
+    *Status = NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NdisReadNetworkAddress(PNDIS_STATUS Status, PVOID NetworkAddress,
+    PUINT NetworkAddressLength, NDIS_HANDLE ConfigurationHandle)
+{
+    UNREFERENCED_PARAMETER(NetworkAddress);
+    UNREFERENCED_PARAMETER(ConfigurationHandle);
+
+    *NetworkAddressLength = 0;
+    *Status = NDIS_STATUS_FAILURE;
+}
+
+NTSTATUS
+ZwOpenKey(PHANDLE KeyHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes)
+{
+    UNREFERENCED_PARAMETER(DesiredAccess);
+    UNREFERENCED_PARAMETER(ObjectAttributes);
+
+    *KeyHandle = NULL;
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+NTSTATUS
+ZwQueryValueKey(HANDLE KeyHandle, PUNICODE_STRING ValueName,
+    KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass, PVOID KeyValueInformation,
+    ULONG Length, PULONG ResultLength)
+{
+    UNREFERENCED_PARAMETER(KeyHandle);
+    UNREFERENCED_PARAMETER(ValueName);
+    UNREFERENCED_PARAMETER(KeyValueInformationClass);
+    UNREFERENCED_PARAMETER(KeyValueInformation);
+    UNREFERENCED_PARAMETER(Length);
+
+    *ResultLength = 0;
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+NTSTATUS
+ZwClose(HANDLE Handle)
+{
+    UNREFERENCED_PARAMETER(Handle);
+    return STATUS_SUCCESS;
+}
+
+//======================================================================
+// Strings and versions
+//======================================================================
+
+VOID
+RtlInitUnicodeString(PUNICODE_STRING Destination, PCWSTR Source)
+{
+    Destination->Buffer = (PWSTR)Source;
+    Destination->Length = Source ? (USHORT)(HostWcslen(Source) * sizeof(WCHAR)) : 0;
+    Destination->MaximumLength = Source ? Destination->Length + sizeof(WCHAR) : 0;
+}
+
+NTSTATUS
+RtlAppendUnicodeStringToString(PUNICODE_STRING Destination, PCUNICODE_STRING Source)
+{
+    if(Destination->Length + Source->Length > Destination->MaximumLength)
+    {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    memcpy((PUCHAR)Destination->Buffer + Destination->Length, Source->Buffer, Source->Length);
+    Destination->Length += Source->Length;
+
+    if(Destination->Length + sizeof(WCHAR) <= Destination->MaximumLength)
+    {
+        Destination->Buffer[Destination->Length / sizeof(WCHAR)] = 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlAppendUnicodeToString(PUNICODE_STRING Destination, PCWSTR Source)
+{
+    UNICODE_STRING source;
+
+    RtlInitUnicodeString(&source, Source);
+    return RtlAppendUnicodeStringToString(Destination, &source);
+}
+
+NTSTATUS
+RtlUnicodeStringToAnsiString(PANSI_STRING Destination, PCUNICODE_STRING Source,
+    BOOLEAN AllocateDestinationString)
+{
+    USHORT count = Source->Length / sizeof(WCHAR);
+    USHORT i;
+
+    if(AllocateDestinationString)
+    {
+        Destination->Buffer = ExAllocatePoolWithTag(NonPagedPoolNx, count + 1, 0);
+        if(Destination->Buffer == NULL)
+        {
+            return STATUS_NO_MEMORY;
+        }
+        Destination->MaximumLength = count + 1;
+    }
+    else if(count + 1 > Destination->MaximumLength)
+    {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for(i = 0; i < count; ++i)
+    {
+        Destination->Buffer[i] = (CHAR)Source->Buffer[i];
+    }
+
+    Destination->Buffer[count] = '\0';
+    Destination->Length = count;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RtlFreeAnsiString(PANSI_STRING AnsiString)
+{
+    if(AnsiString->Buffer != NULL)
+    {
+        ExFreePool(AnsiString->Buffer);
+        AnsiString->Buffer = NULL;
+    }
+}
+
+// "{XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}"
+NTSTATUS
+RtlGUIDFromString(PCUNICODE_STRING GuidString, GUID *Guid)
+{
+    char text[39];
+    unsigned int d1, d2, d3, b[8];
+    USHORT i;
+
+    if(GuidString->Length != 38 * sizeof(WCHAR))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for(i = 0; i < 38; ++i)
+    {
+        text[i] = (char)GuidString->Buffer[i];
+    }
+    text[38] = '\0';
+
+    if(sscanf(text, "{%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x}",
+            &d1, &d2, &d3, &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6], &b[7]) != 11)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Guid->Data1 = d1;
+    Guid->Data2 = (USHORT)d2;
+    Guid->Data3 = (USHORT)d3;
+    for(i = 0; i < 8; ++i)
+    {
+        Guid->Data4[i] = (UCHAR)b[i];
+    }
+
+    return STATUS_SUCCESS;
+}
+
+LONG
+RtlCompareUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2,
+    BOOLEAN CaseInSensitive)
+{
+    USHORT n1 = String1->Length / sizeof(WCHAR);
+    USHORT n2 = String2->Length / sizeof(WCHAR);
+    USHORT i;
+
+    for(i = 0; i < n1 && i < n2; ++i)
+    {
+        WCHAR c1 = String1->Buffer[i];
+        WCHAR c2 = String2->Buffer[i];
+
+        if(CaseInSensitive)
+        {
+            c1 = (c1 >= 'a' && c1 <= 'z') ? c1 - 32 : c1;
+            c2 = (c2 >= 'a' && c2 <= 'z') ? c2 - 32 : c2;
+        }
+
+        if(c1 != c2)
+        {
+            return (LONG)c1 - (LONG)c2;
+        }
+    }
+
+    return (LONG)n1 - (LONG)n2;
+}
+
+// The driver prints with %wZ and %ws; the host printf knows neither,
+// so those arguments are consumed and printed as '?'.
+static NTSTATUS
+HostFormat(PCHAR Dest, SIZE_T CchDest, PCHAR *DestEnd, PCSTR Format, va_list Args)
+{
+    char format[1024];
+    const char *in;
+    char *out = format;
+    int length;
+
+    for(in = Format; *in != '\0' && out < format + sizeof(format) - 2; ++in)
+    {
+        if(in[0] == '%' && in[1] == 'w' && (in[2] == 'Z' || in[2] == 's'))
+        {
+            *out++ = '%';
+            *out++ = 'p';
+            in += 2;
+            continue;
+        }
+
+        *out++ = *in;
+    }
+    *out = '\0';
+
+    if(CchDest == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    length = vsnprintf(Dest, CchDest, format, Args);
+
+    if(DestEnd != NULL)
+    {
+        *DestEnd = Dest + min((SIZE_T)length, CchDest - 1);
+    }
+
+    return (SIZE_T)length < CchDest ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+}
+
+NTSTATUS
+RtlStringCchPrintfA(PCHAR Dest, SIZE_T CchDest, PCSTR Format, ...)
+{
+    NTSTATUS status;
+    va_list args;
+
+    va_start(args, Format);
+    status = HostFormat(Dest, CchDest, NULL, Format, args);
+    va_end(args);
+
+    return status;
+}
+
+NTSTATUS
+RtlStringCbPrintfA(PCHAR Dest, SIZE_T CbDest, PCSTR Format, ...)
+{
+    NTSTATUS status;
+    va_list args;
+
+    va_start(args, Format);
+    status = HostFormat(Dest, CbDest, NULL, Format, args);
+    va_end(args);
+
+    return status;
+}
+
+NTSTATUS
+RtlStringCchPrintfExA(PCHAR Dest, SIZE_T CchDest, PCHAR *DestEnd,
+    SIZE_T *Remaining, ULONG Flags, PCSTR Format, ...)
+{
+    NTSTATUS status;
+    va_list args;
+
+    UNREFERENCED_PARAMETER(Flags);
+
+    va_start(args, Format);
+    status = HostFormat(Dest, CchDest, DestEnd, Format, args);
+    va_end(args);
+
+    if(Remaining != NULL)
+    {
+        *Remaining = CchDest - strlen(Dest);
+    }
+
+    return status;
+}
+
+NTSTATUS
+RtlStringCchCopyA(PCHAR Dest, SIZE_T CchDest, PCSTR Source)
+{
+    SIZE_T length = strlen(Source);
+
+    if(CchDest == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if(length >= CchDest)
+    {
+        memcpy(Dest, Source, CchDest - 1);
+        Dest[CchDest - 1] = '\0';
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    memcpy(Dest, Source, length + 1);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlStringCchLengthA(PCSTR Psz, SIZE_T CchMax, SIZE_T *Length)
+{
+    SIZE_T length = strnlen(Psz, CchMax);
+
+    if(length == CchMax)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if(Length != NULL)
+    {
+        *Length = length;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlStringCchCopyW(PWCHAR Dest, SIZE_T CchDest, PCWSTR Source)
+{
+    SIZE_T i;
+
+    if(CchDest == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    for(i = 0; i + 1 < CchDest && Source[i] != 0; ++i)
+    {
+        Dest[i] = Source[i];
+    }
+    Dest[i] = 0;
+
+    return Source[i] == 0 ? STATUS_SUCCESS : STATUS_BUFFER_OVERFLOW;
+}
+
+ULONGLONG
+VerSetConditionMask(ULONGLONG ConditionMask, ULONG TypeMask, UCHAR Condition)
+{
+    UNREFERENCED_PARAMETER(TypeMask);
+    UNREFERENCED_PARAMETER(Condition);
+
+    return ConditionMask;
+}
+
+// The host claims to be Windows 10.
+NTSTATUS
+RtlVerifyVersionInfo(PRTL_OSVERSIONINFOEXW VersionInfo, ULONG TypeMask,
+    ULONGLONG ConditionMask)
+{
+    UNREFERENCED_PARAMETER(TypeMask);
+    UNREFERENCED_PARAMETER(ConditionMask);
+
+    return (VersionInfo->dwMajorVersion < 10
+            || (VersionInfo->dwMajorVersion == 10 && VersionInfo->dwMinorVersion == 0))
+        ? STATUS_SUCCESS : STATUS_REVISION_MISMATCH;
+}
+
+UINT
+NdisGetVersion(VOID)
+{
+    return NDIS_RUNTIME_VERSION_630;
+}
+
+ULONG
+DbgPrint(PCSTR Format, ...)
+{
+    UNREFERENCED_PARAMETER(Format);
+    return 0;
+}
+
+ULONG
+DbgPrintEx(ULONG ComponentId, ULONG Level, PCSTR Format, ...)
+{
+    UNREFERENCED_PARAMETER(ComponentId);
+    UNREFERENCED_PARAMETER(Level);
+    UNREFERENCED_PARAMETER(Format);
+    return 0;
+}
+
+//======================================================================
+// Miniport registration
+//======================================================================
+
+static int MiniportDriverHandle;
+
+NDIS_STATUS
+NdisMRegisterMiniportDriver(PDRIVER_OBJECT DriverObject,
+    PUNICODE_STRING RegistryPath, NDIS_HANDLE MiniportDriverContext,
+    PNDIS_MINIPORT_DRIVER_CHARACTERISTICS MiniportDriverCharacteristics,
+    PNDIS_HANDLE NdisMiniportDriverHandle)
+{
+    UNREFERENCED_PARAMETER(DriverObject);
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    WdkHostMiniportCharacteristics = *MiniportDriverCharacteristics;
+    WdkHostMiniportDriverContext = MiniportDriverContext;
+    *NdisMiniportDriverHandle = &MiniportDriverHandle;
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NdisMDeregisterMiniportDriver(NDIS_HANDLE NdisMiniportDriverHandle)
+{
+    UNREFERENCED_PARAMETER(NdisMiniportDriverHandle);
+    memset(&WdkHostMiniportCharacteristics, 0, sizeof(WdkHostMiniportCharacteristics));
+}
+
+NDIS_STATUS
+NdisMSetMiniportAttributes(NDIS_HANDLE NdisMiniportHandle,
+    PNDIS_MINIPORT_ADAPTER_ATTRIBUTES MiniportAttributes)
+{
+    UNREFERENCED_PARAMETER(NdisMiniportHandle);
+    UNREFERENCED_PARAMETER(MiniportAttributes);
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+typedef struct _HOST_DEVICE
+{
+    DEVICE_OBJECT   DeviceObject;
+    DRIVER_OBJECT   DriverObject;
+} HOST_DEVICE, *PHOST_DEVICE;
+
+NDIS_STATUS
+NdisRegisterDeviceEx(NDIS_HANDLE NdisObjectHandle,
+    PNDIS_DEVICE_OBJECT_ATTRIBUTES DeviceObjectAttributes, PDEVICE_OBJECT *pDeviceObject,
+    PNDIS_HANDLE NdisDeviceHandle)
+{
+    PHOST_DEVICE device = calloc(1, sizeof(HOST_DEVICE) + DeviceObjectAttributes->ExtensionSize);
+    ULONG i;
+
+    UNREFERENCED_PARAMETER(NdisObjectHandle);
+
+    if(device == NULL)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    device->DeviceObject.DriverObject = &device->DriverObject;
+    device->DeviceObject.DeviceExtension = DeviceObjectAttributes->ExtensionSize ? device + 1 : NULL;
+
+    for(i = 0; i <= IRP_MJ_MAXIMUM_FUNCTION; ++i)
+    {
+        device->DriverObject.MajorFunction[i] = DeviceObjectAttributes->MajorFunctions[i];
+    }
+
+    *pDeviceObject = &device->DeviceObject;
+    *NdisDeviceHandle = device;
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+VOID
+NdisDeregisterDeviceEx(NDIS_HANDLE NdisDeviceHandle)
+{
+    free(NdisDeviceHandle);
+}
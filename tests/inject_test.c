@@ -0,0 +1,371 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The queue of driver-generated frames (ARP, DHCP and ND replies) in
+// rxpath.c: IndicateReceivePacket queues, tapInjectDpc indicates, and
+// AdapterPause drains through tapInjectQueueFlush. Covers the queue
+// filling up, order within and across batches, a pause with frames
+// queued and one racing a thread that keeps injecting.
+//======================================================================
+
+#include "taphost.h"
+
+#include <pthread.h>
+
+#define INJECT_FRAME_LENGTH     60
+#define INJECT_RACE_FRAMES      20000
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+//
+// The stack: takes each indication, checks the order of what it is
+// given and either holds the NBLs or returns them at once.
+//
+
+static volatile LONG Indications;
+static volatile LONG Indicated;
+static ULONG NextSequence;
+static BOOLEAN CheckOrder = TRUE;
+static BOOLEAN ReturnAtOnce;
+static PNET_BUFFER_LIST Held;
+static PNET_BUFFER_LIST *HeldTail = &Held;
+
+static ULONG
+Sequence(PNET_BUFFER_LIST NetBufferList)
+{
+    UCHAR frame[INJECT_FRAME_LENGTH];
+
+    CHECK_EQ(WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(NetBufferList),
+        frame, sizeof(frame)), INJECT_FRAME_LENGTH);
+
+    return frame[14] | (frame[15] << 8) | (frame[16] << 16) | ((ULONG)frame[17] << 24);
+}
+
+static VOID
+Receive(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    PNET_BUFFER_LIST nbl;
+    ULONG count = 0;
+
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    // Indicated from the DPC, never with resources to be taken back.
+    CHECK(ReceiveFlags & NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL);
+    CHECK(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES));
+
+    for(nbl = NetBufferLists; nbl != NULL; nbl = NET_BUFFER_LIST_NEXT_NBL(nbl))
+    {
+        if(CheckOrder)
+        {
+            CHECK_EQ(Sequence(nbl), NextSequence);
+            ++NextSequence;
+        }
+        ++count;
+    }
+
+    CHECK_EQ(count, NumberOfNetBufferLists);
+    InterlockedIncrement(&Indications);
+    InterlockedExchangeAdd(&Indicated, (LONG)count);
+
+    if(ReturnAtOnce)
+    {
+        TapHostReturn(Adapter, NetBufferLists);
+        return;
+    }
+
+    *HeldTail = NetBufferLists;
+    while(*HeldTail != NULL)
+    {
+        HeldTail = &NET_BUFFER_LIST_NEXT_NBL(*HeldTail);
+    }
+}
+
+static VOID
+ReturnHeld(VOID)
+{
+    if(Held != NULL)
+    {
+        PNET_BUFFER_LIST nbls = Held;
+
+        Held = NULL;
+        HeldTail = &Held;
+        TapHostReturn(Adapter, nbls);
+    }
+}
+
+static VOID
+Inject(ULONG Sequence)
+{
+    UCHAR frame[INJECT_FRAME_LENGTH];
+
+    memset(frame, 0, sizeof(frame));
+    memset(frame, 0xFF, 6);
+    ETH_COPY_NETWORK_ADDRESS(frame + 6, Adapter->CurrentAddress);
+    frame[12] = 0x88;
+    frame[13] = 0xB5;   // Local experimental
+    frame[14] = (UCHAR)Sequence;
+    frame[15] = (UCHAR)(Sequence >> 8);
+    frame[16] = (UCHAR)(Sequence >> 16);
+    frame[17] = (UCHAR)(Sequence >> 24);
+
+    IndicateReceivePacket(Adapter, frame, sizeof(frame));
+}
+
+static ULONG64
+InjectDrops(VOID)
+{
+    TAP_WIN_DROP_STATS drops;
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+    return drops.Drops[TAP_WIN_DROP_INJECT];
+}
+
+// Queued frames wait for the DPC and go up as one chain, in order.
+static VOID
+TestOrder(VOID)
+{
+    ULONG sequence = NextSequence;
+    ULONG batch;
+
+    for(batch = 1; batch <= INJECT_QUEUE_SIZE; ++batch)
+    {
+        ULONG i;
+        LONG indications = Indications;
+
+        for(i = 0; i < batch; ++i)
+        {
+            Inject(sequence++);
+        }
+
+        CHECK_EQ(Adapter->InjectPacketQueue.Count, batch);
+        CHECK_EQ(Indications, indications);
+
+        // One DPC, however many frames.
+        CHECK_EQ(WdkHostQueuedDpcs(), 1);
+        CHECK_EQ(WdkHostRunDpcs(), 1);
+        CHECK_EQ(Indications, indications + 1);
+        CHECK_EQ(Adapter->InjectPacketQueue.Count, 0);
+        CHECK_EQ(NextSequence, sequence);
+    }
+
+    CHECK_EQ(Adapter->InjectPacketQueue.MaxCount, INJECT_QUEUE_SIZE);
+    CHECK_EQ(Adapter->ReceiveNblInFlightCount, Indicated);
+
+    ReturnHeld();
+    CHECK_EQ(Adapter->ReceiveNblInFlightCount, 0);
+}
+
+// Past INJECT_QUEUE_SIZE frames are dropped, and counted, until the
+// DPC has run; those queued still go up in order.
+static VOID
+TestQueueFull(VOID)
+{
+    ULONG64 drops = InjectDrops();
+    ULONG sequence = NextSequence;
+    LONG mdls = WdkHostCounters.Mdls;
+    ULONG i;
+
+    for(i = 0; i < INJECT_QUEUE_SIZE; ++i)
+    {
+        Inject(sequence++);
+    }
+
+    for(i = 0; i < 5; ++i)
+    {
+        Inject(0xDEAD0000 + i);
+    }
+
+    CHECK_EQ(Adapter->InjectPacketQueue.Count, INJECT_QUEUE_SIZE);
+    CHECK_EQ(InjectDrops(), drops + 5);
+
+    WdkHostRunDpcs();
+    CHECK_EQ(NextSequence, sequence);
+
+    // Room again.
+    Inject(sequence++);
+    WdkHostRunDpcs();
+    CHECK_EQ(NextSequence, sequence);
+    CHECK_EQ(InjectDrops(), drops + 5);
+
+    ReturnHeld();
+    CHECK_EQ(WdkHostCounters.Mdls, mdls);
+}
+
+// A pause with frames queued drops them rather than indicating them
+// while paused; frames injected while paused are dropped at once.
+static VOID
+TestPauseDrain(VOID)
+{
+    ULONG64 drops = InjectDrops();
+    LONG indications = Indications;
+    LONG allocations;
+    ULONG i;
+
+    for(i = 0; i < 7; ++i)
+    {
+        Inject(0xDEAD0000 + i);
+    }
+
+    allocations = WdkHostCounters.PoolAllocations;
+
+    CHECK_EQ(TapHostPauseAdapter(Adapter), NDIS_STATUS_SUCCESS);
+
+    CHECK_EQ(Indications, indications);
+    CHECK_EQ(Adapter->InjectPacketQueue.Count, 0);
+    CHECK_EQ(WdkHostQueuedDpcs(), 0);
+    CHECK_EQ(InjectDrops(), drops + 7);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, allocations - 7);
+
+    Inject(0xDEAD0000);
+    CHECK_EQ(Adapter->InjectPacketQueue.Count, 0);
+    CHECK_EQ(InjectDrops(), drops + 8);
+    WdkHostRunDpcs();
+    CHECK_EQ(Indications, indications);
+
+    // And after a restart frames go up again.
+    CHECK_EQ(TapHostRestartAdapter(Adapter), NDIS_STATUS_SUCCESS);
+    Inject(NextSequence);
+    WdkHostRunDpcs();
+    CHECK_EQ(Indications, indications + 1);
+    ReturnHeld();
+}
+
+//
+// A pause racing an injecting thread.
+//
+
+static volatile BOOLEAN Stop;
+static volatile LONG Injected;
+
+static void *
+Injector(void *Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    WdkHostSetCurrentProcessor(1);
+
+    while(!Stop)
+    {
+        Inject(0);
+        InterlockedIncrement(&Injected);
+
+        if((Injected & 7) == 0)
+        {
+            WdkHostRunDpcs();
+        }
+    }
+
+    WdkHostRunDpcs();
+
+    return NULL;
+}
+
+static VOID
+TestPauseRace(VOID)
+{
+    pthread_t thread;
+    ULONG64 drops = InjectDrops();
+    LONG indicated = Indicated;
+    LONG indicatedAtPause;
+    ULONG round;
+
+    CheckOrder = FALSE;
+    ReturnAtOnce = TRUE;
+
+    Stop = FALSE;
+    Injected = 0;
+    CHECK_EQ(pthread_create(&thread, NULL, Injector, NULL), 0);
+
+    for(round = 0; round < 20; ++round)
+    {
+        while(Injected < (LONG)(round + 1) * (INJECT_RACE_FRAMES / 40))
+        {
+            sched_yield();
+        }
+
+        CHECK_EQ(TapHostPauseAdapter(Adapter), NDIS_STATUS_SUCCESS);
+
+        // Nothing goes up while paused, and nothing is left in flight.
+        indicatedAtPause = Indicated;
+        CHECK_EQ(Adapter->ReceiveNblInFlightCount, 0);
+
+        while(Injected < (LONG)(round + 1) * (INJECT_RACE_FRAMES / 40) + 100)
+        {
+            sched_yield();
+        }
+
+        CHECK_EQ(Indicated, indicatedAtPause);
+        CHECK_EQ(TapHostRestartAdapter(Adapter), NDIS_STATUS_SUCCESS);
+    }
+
+    Stop = TRUE;
+    CHECK_EQ(pthread_join(thread, NULL), 0);
+    WdkHostRunDpcs();
+
+    // Every frame was either indicated or counted as dropped.
+    CHECK_EQ((ULONG64)(Indicated - indicated) + (InjectDrops() - drops), (ULONG64)Injected);
+    CHECK_EQ(Adapter->InjectPacketQueue.Count, 0);
+    CHECK_EQ(Adapter->ReceiveNblInFlightCount, 0);
+
+    CheckOrder = TRUE;
+    ReturnAtOnce = FALSE;
+}
+
+int
+main(void)
+{
+    ULONG value = TRUE;
+
+    WdkHostSetProcessorCount(2);
+    WdkHostSetReceiveHook(Receive, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestOrder();
+    TestQueueFull();
+    TestPauseDrain();
+    TestPauseRace();
+
+    // Frames still queued at halt are freed.
+    Inject(0xDEAD0000);
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.Mdls, 0);
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
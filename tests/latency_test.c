@@ -0,0 +1,398 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Latency histograms (latency.c) on a frozen clock: the log-linear
+// buckets, queue delay and stack hold times counted only while
+// collection is enabled, per-CPU histograms summed on read, reset, and
+// write timestamps measured only to the indication.
+//======================================================================
+
+#include "taphost.h"
+
+#define LATENCY_NOW             1000000ull
+#define LATENCY_CPUS            4
+#define LATENCY_FRAME_LENGTH    60
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+// Indications held by the "stack" until returned.
+static PNET_BUFFER_LIST Indicated;
+
+static VOID
+HoldIndications(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    CHECK_EQ(NumberOfNetBufferLists, 1);
+    CHECK(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES));
+    CHECK(Indicated == NULL);
+    Indicated = NetBufferLists;
+}
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    CHECK(NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) == NULL);
+    WdkHostFreeNetBufferList(NetBufferLists);
+}
+
+// Returns the statistics, with Flags as input, or none if ~0.
+static VOID
+Query(ULONG Flags, TAP_WIN_LATENCY_STATS *Stats)
+{
+    memcpy(Stats, &Flags, sizeof(Flags));
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_LATENCY_STATS, Stats,
+        Flags == ~0u ? 0 : sizeof(Flags), sizeof(*Stats), NULL), STATUS_SUCCESS);
+}
+
+static VOID
+Frame(UCHAR *Frame, BOOLEAN Write)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+
+    memset(Frame, 0, LATENCY_FRAME_LENGTH);
+    memset(eth->dest, 0xFF, sizeof(MACADDR));
+    memset(eth->src, 0x02, sizeof(MACADDR));
+    if(!Write)
+    {
+        ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    }
+    eth->proto = htons(0x88B5);     // Local experimental
+}
+
+// Sends a frame, lets it wait Ticks and reads it.
+static VOID
+Queue(ULONG64 Ticks)
+{
+    static UCHAR readBuffer[2048];
+    UCHAR frame[LATENCY_FRAME_LENGTH];
+    PIRP irp = NULL;
+
+    Frame(frame, FALSE);
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(frame, sizeof(frame)));
+
+    WdkHostAdvanceClock(Ticks);
+
+    CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Information, LATENCY_FRAME_LENGTH);
+    WdkHostFreeIrp(irp);
+}
+
+// Writes a frame, followed by Trailer if not NULL, and returns what was
+// indicated after Ticks; Between runs while the stack holds it.
+static VOID
+Write(const TAP_WIN_WRITE_TIMESTAMP *Trailer, ULONG64 Ticks, VOID (*Between)(VOID))
+{
+    UCHAR frame[LATENCY_FRAME_LENGTH + sizeof(TAP_WIN_WRITE_TIMESTAMP)];
+    ULONG length = LATENCY_FRAME_LENGTH;
+    PNET_BUFFER_LIST nbl;
+    PIRP irp = NULL;
+
+    Frame(frame, TRUE);
+
+    if(Trailer != NULL)
+    {
+        memcpy(frame + length, Trailer, sizeof(*Trailer));
+        length += sizeof(*Trailer);
+    }
+
+    CHECK_EQ(TapHostWrite(File, frame, length, &irp), STATUS_PENDING);
+    CHECK(Indicated != NULL);
+    CHECK_EQ(NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(Indicated)), LATENCY_FRAME_LENGTH);
+
+    if(Between != NULL)
+    {
+        Between();
+    }
+
+    WdkHostAdvanceClock(Ticks);
+
+    nbl = Indicated;
+    Indicated = NULL;
+    TapHostReturn(Adapter, nbl);
+
+    CHECK(irp->HostCompleted);
+    WdkHostFreeIrp(irp);
+}
+
+static VOID
+Hold(ULONG64 Ticks, VOID (*Between)(VOID))
+{
+    Write(NULL, Ticks, Between);
+}
+
+static VOID
+Enable(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+
+    Query(TAP_WIN_LATENCY_STATS_ENABLE, &stats);
+}
+
+// Bucket i < S holds i; bucket i >= S starts at (S + i % S) << (i / S - 1)
+// and is 1 << (i / S - 1) wide; the last also holds everything larger.
+static VOID
+TestBuckets(VOID)
+{
+    const ULONG s = TAP_WIN_LATENCY_SUB_BUCKETS;
+    ULONG i;
+
+    for(i = 0; i < TAP_WIN_LATENCY_BUCKETS; ++i)
+    {
+        ULONG64 start = i < s ? i : (ULONG64)(s + i % s) << (i / s - 1);
+        ULONG64 width = i < s ? 1 : 1ull << (i / s - 1);
+
+        CHECK_EQ(tapLatencyBucket(start), i);
+        CHECK_EQ(tapLatencyBucket(start + width - 1), i);
+
+        if(i + 1 < TAP_WIN_LATENCY_BUCKETS)
+        {
+            CHECK_EQ(tapLatencyBucket(start + width), i + 1);
+        }
+    }
+
+    CHECK_EQ(tapLatencyBucket(~0ull), TAP_WIN_LATENCY_BUCKETS - 1);
+}
+
+// Nothing is counted, and no histograms exist, until enabled.
+static VOID
+TestOff(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+
+    Queue(100);
+    Hold(100, NULL);
+
+    Query(~0u, &stats);
+    CHECK_EQ(stats.Enabled, 0);
+    CHECK_EQ(stats.QueueDelay.Count, 0);
+    CHECK_EQ(stats.StackHold.Count, 0);
+    CHECK(Adapter->Latency.Cpus == NULL);
+}
+
+// Each frame is counted once, at its time and in its bucket, on the
+// histograms of the CPU it was measured on; the read sums them.
+static VOID
+TestCounts(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+    ULONG cpu;
+
+    Enable();
+
+    for(cpu = 0; cpu < LATENCY_CPUS; ++cpu)
+    {
+        WdkHostSetCurrentProcessor(cpu);
+        Queue(1000 << cpu);
+        Hold(50, NULL);
+    }
+
+    WdkHostSetCurrentProcessor(0);
+
+    for(cpu = 0; cpu < LATENCY_CPUS; ++cpu)
+    {
+        CHECK_EQ(Adapter->Latency.Cpus[cpu].Histograms[TAP_LATENCY_QUEUE_DELAY].Count, 1);
+        CHECK_EQ(Adapter->Latency.Cpus[cpu].Histograms[TAP_LATENCY_STACK_HOLD].Count, 1);
+    }
+
+    Query(TAP_WIN_LATENCY_STATS_ENABLE | TAP_WIN_LATENCY_STATS_RESET, &stats);
+    CHECK_EQ(stats.Enabled, 1);
+    CHECK_EQ(stats.Frequency, 10000000);
+    CHECK_EQ(stats.QueueDelay.Count, LATENCY_CPUS);
+    CHECK_EQ(stats.QueueDelay.Sum, 1000 + 2000 + 4000 + 8000);
+
+    for(cpu = 0; cpu < LATENCY_CPUS; ++cpu)
+    {
+        CHECK_EQ(stats.QueueDelay.Buckets[tapLatencyBucket(1000 << cpu)], 1);
+    }
+
+    CHECK_EQ(stats.StackHold.Count, LATENCY_CPUS);
+    CHECK_EQ(stats.StackHold.Sum, LATENCY_CPUS * 50);
+    CHECK_EQ(stats.StackHold.Buckets[tapLatencyBucket(50)], LATENCY_CPUS);
+
+    for(cpu = 0; cpu < LATENCY_CPUS; ++cpu)
+    {
+        CHECK_EQ(Adapter->Latency.Cpus[cpu].Histograms[TAP_LATENCY_QUEUE_DELAY].Count, 0);
+    }
+
+    // The reset zeroed them.
+    Query(~0u, &stats);
+    CHECK_EQ(stats.QueueDelay.Count, 0);
+    CHECK_EQ(stats.StackHold.Count, 0);
+}
+
+static VOID
+Disable(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+
+    Query(0, &stats);
+}
+
+// An indication made with collection on and returned with it off is
+// not counted, nor one made with it off and returned with it on.
+static VOID
+TestSwitch(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+
+    Hold(50, Disable);
+    Hold(50, Enable);
+
+    Query(~0u, &stats);
+    CHECK_EQ(stats.Enabled, 1);
+    CHECK_EQ(stats.StackHold.Count, 0);
+
+    Hold(50, NULL);
+    Query(~0u, &stats);
+    CHECK_EQ(stats.StackHold.Count, 1);
+}
+
+// The flags are those of the lock statistics: ENABLE is 0x1 and RESET
+// 0x2. A read reports the counts before resetting them.
+static VOID
+TestFlags(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+
+    CHECK_EQ(TAP_WIN_LATENCY_STATS_ENABLE, TAP_WIN_LOCK_STATS_ENABLE);
+    CHECK_EQ(TAP_WIN_LATENCY_STATS_RESET, TAP_WIN_LOCK_STATS_RESET);
+
+    Query(0x3, &stats);
+    Hold(50, NULL);
+
+    // Enabled, not reset.
+    Query(0x1, &stats);
+    CHECK_EQ(stats.Enabled, 1);
+    CHECK_EQ(stats.StackHold.Count, 1);
+
+    // Reset, and disabled.
+    Query(0x2, &stats);
+    CHECK_EQ(stats.Enabled, 1);
+    CHECK_EQ(stats.StackHold.Count, 1);
+
+    Hold(50, NULL);
+    Query(0, &stats);
+    CHECK_EQ(stats.Enabled, 0);
+    CHECK_EQ(stats.StackHold.Count, 0);
+
+    Enable();
+}
+
+// A write's timestamp is measured to its indication and no further; the
+// stack hold time is measured from the driver's own indication time.
+static VOID
+TestWriteTimestamp(VOID)
+{
+    TAP_WIN_LATENCY_STATS stats;
+    TAP_WIN_WRITE_TIMESTAMP trailer;
+    ULONG flags = TAP_WIN_TIMESTAMP_WRITE;
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &flags,
+        sizeof(flags), 0, NULL), STATUS_SUCCESS);
+
+    Query(TAP_WIN_LATENCY_STATS_ENABLE | TAP_WIN_LATENCY_STATS_RESET, &stats);
+
+    // Written 300 ticks ago.
+    trailer.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart - 300;
+    Write(&trailer, 50, NULL);
+
+    // From a clock ahead of the driver's.
+    trailer.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart + 1000;
+    Write(&trailer, 50, NULL);
+
+    // None sent.
+    trailer.Timestamp = 0;
+    Write(&trailer, 50, NULL);
+
+    Query(TAP_WIN_LATENCY_STATS_ENABLE | TAP_WIN_LATENCY_STATS_RESET, &stats);
+    CHECK_EQ(stats.WriteToIndicate.Count, 2);
+    CHECK_EQ(stats.WriteToIndicate.Sum, 300);
+    CHECK_EQ(stats.WriteToIndicate.Buckets[tapLatencyBucket(300)], 1);
+    CHECK_EQ(stats.WriteToIndicate.Buckets[0], 1);
+    CHECK_EQ(stats.StackHold.Count, 3);
+    CHECK_EQ(stats.StackHold.Sum, 3 * 50);
+
+    // Not measured while collection is off.
+    trailer.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart - 300;
+    Query(0, &stats);
+    Write(&trailer, 50, NULL);
+    Query(TAP_WIN_LATENCY_STATS_ENABLE, &stats);
+    CHECK_EQ(stats.WriteToIndicate.Count, 0);
+
+    flags = 0;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &flags,
+        sizeof(flags), 0, NULL), STATUS_SUCCESS);
+}
+
+int
+main(void)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value = TRUE;
+
+    WdkHostSetProcessorCount(LATENCY_CPUS);
+    WdkHostFreezeClock(LATENCY_NOW);
+    WdkHostSetReceiveHook(HoldIndications, NULL);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestBuckets();
+    TestOff();
+    TestCounts();
+    TestSwitch();
+    TestFlags();
+    TestWriteTimestamp();
+
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
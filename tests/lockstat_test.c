@@ -0,0 +1,187 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Spin lock statistics (lockstat.c): the log2 histogram buckets, hold
+// times on a frozen clock, and the timed adapter lock, which must give
+// back the IRQL it was acquired at whether or not collection changed
+// while it was held.
+//======================================================================
+
+#include "taphost.h"
+
+#define LOCK_NOW            1000000ull
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+
+static VOID
+Query(ULONG Flags, TAP_WIN_LOCK_STATS *Stats)
+{
+    CHECK_EQ(tapLockStatsQuery(Adapter, &Flags, Stats), STATUS_SUCCESS);
+}
+
+static ULONG64
+Sum(const unsigned __int64 *Histogram)
+{
+    ULONG64 sum = 0;
+    ULONG i;
+
+    for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS; ++i)
+    {
+        sum += Histogram[i];
+    }
+
+    return sum;
+}
+
+// Bucket i holds [2^(i-1), 2^i); the last everything beyond.
+static VOID
+TestBuckets(VOID)
+{
+    ULONG i;
+
+    CHECK_EQ(tapHistogramBucket(0, TAP_WIN_LOCK_HISTOGRAM_BUCKETS), 0);
+    CHECK_EQ(tapHistogramBucket(1, TAP_WIN_LOCK_HISTOGRAM_BUCKETS), 1);
+
+    for(i = 1; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1; ++i)
+    {
+        CHECK_EQ(tapHistogramBucket(1ull << (i - 1), TAP_WIN_LOCK_HISTOGRAM_BUCKETS), i);
+        CHECK_EQ(tapHistogramBucket((1ull << i) - 1, TAP_WIN_LOCK_HISTOGRAM_BUCKETS), i);
+    }
+
+    CHECK_EQ(tapHistogramBucket(1ull << (TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 2),
+        TAP_WIN_LOCK_HISTOGRAM_BUCKETS), TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1);
+    CHECK_EQ(tapHistogramBucket(~0ull, TAP_WIN_LOCK_HISTOGRAM_BUCKETS),
+        TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1);
+    CHECK_EQ(tapHistogramBucket(~0ull, 2), 1);
+}
+
+// Each hold lands in the bucket of its length in counter ticks.
+static VOID
+TestHoldTimes(VOID)
+{
+    TAP_WIN_LOCK_STATS stats;
+    ULONG i;
+
+    Query(TAP_WIN_LOCK_STATS_ENABLE | TAP_WIN_LOCK_STATS_RESET, &stats);
+
+    for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1; ++i)
+    {
+        tapAdapterAcquireLock(Adapter, FALSE);
+        WdkHostAdvanceClock(i == 0 ? 0 : 1ull << (i - 1));
+        tapAdapterReleaseLock(Adapter, FALSE);
+    }
+
+    Query(TAP_WIN_LOCK_STATS_ENABLE | TAP_WIN_LOCK_STATS_RESET, &stats);
+
+    CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].Acquisitions, TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1);
+    CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].Contended, 0);
+    CHECK_EQ(Sum(stats.Locks[TAP_WIN_LOCK_ADAPTER].WaitHistogram), 0);
+
+    for(i = 0; i < TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1; ++i)
+    {
+        CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].HoldHistogram[i], 1);
+    }
+
+    CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].HoldHistogram[TAP_WIN_LOCK_HISTOGRAM_BUCKETS - 1], 0);
+
+    // The other locks were not touched.
+    CHECK_EQ(stats.Locks[TAP_WIN_LOCK_FLOW_CONTROL].Acquisitions, 0);
+
+    // Reset zeroed them.
+    Query(0, &stats);
+    CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].Acquisitions, 0);
+    CHECK_EQ(Sum(stats.Locks[TAP_WIN_LOCK_ADAPTER].HoldHistogram), 0);
+}
+
+// The timed adapter lock keeps the IRQL to restore in the adapter, not
+// in the NDIS_SPIN_LOCK, whose fields belong to NDIS; and a lock taken
+// with collection in one state is released correctly in the other.
+static VOID
+TestIrql(VOID)
+{
+    TAP_WIN_LOCK_STATS stats;
+    KIRQL irql;
+    ULONG enable;
+
+    for(enable = 0; enable < 2; ++enable)
+    {
+        ULONG flags = enable ? TAP_WIN_LOCK_STATS_ENABLE : 0;
+        ULONG other = enable ? 0 : TAP_WIN_LOCK_STATS_ENABLE;
+
+        // From PASSIVE_LEVEL.
+        Query(flags | TAP_WIN_LOCK_STATS_RESET, &stats);
+        CHECK_EQ(KeGetCurrentIrql(), PASSIVE_LEVEL);
+        Adapter->AdapterLock.OldIrql = 0x5A;
+        tapAdapterAcquireLock(Adapter, FALSE);
+        CHECK_EQ(KeGetCurrentIrql(), DISPATCH_LEVEL);
+        if(enable)
+        {
+            CHECK_EQ(Adapter->AdapterLock.OldIrql, 0x5A);
+        }
+        tapAdapterReleaseLock(Adapter, FALSE);
+        CHECK_EQ(KeGetCurrentIrql(), PASSIVE_LEVEL);
+
+        // Collection switched while held.
+        tapAdapterAcquireLock(Adapter, FALSE);
+        Query(other, &stats);
+        tapAdapterReleaseLock(Adapter, FALSE);
+        CHECK_EQ(KeGetCurrentIrql(), PASSIVE_LEVEL);
+
+        // From DISPATCH_LEVEL.
+        Query(flags, &stats);
+        KeRaiseIrql(DISPATCH_LEVEL, &irql);
+        tapAdapterAcquireLock(Adapter, TRUE);
+        tapAdapterReleaseLock(Adapter, TRUE);
+        CHECK_EQ(KeGetCurrentIrql(), DISPATCH_LEVEL);
+        KeLowerIrql(irql);
+
+        Query(0, &stats);
+        CHECK_EQ(stats.Locks[TAP_WIN_LOCK_ADAPTER].Acquisitions, enable ? 3 : 0);
+        CHECK_EQ(Sum(stats.Locks[TAP_WIN_LOCK_ADAPTER].HoldHistogram), enable ? 3 : 0);
+    }
+
+    Adapter->AdapterLock.OldIrql = PASSIVE_LEVEL;
+}
+
+int
+main(void)
+{
+    WdkHostFreezeClock(LOCK_NOW);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+
+    TestBuckets();
+    TestHoldTimes();
+    TestIrql();
+
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
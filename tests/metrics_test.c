@@ -0,0 +1,368 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Metrics (metrics.c): the snapshot encoding of every adapter's
+// counters, and the waiting request completing on a change in activity
+// or state, on its period, or on cleanup.
+//======================================================================
+
+#include "taphost.h"
+
+#define METRICS_NOW         10000000ull     // 1s, in 100ns units
+#define METRICS_TICK        (TAP_METRICS_POLL_INTERVAL * 10000ull)
+#define METRICS_ADAPTERS    2
+
+typedef struct _METRICS_BUFFER
+{
+    TAP_WIN_METRICS         Header;
+    TAP_WIN_ADAPTER_METRICS Records[METRICS_ADAPTERS + 1];
+} METRICS_BUFFER;
+
+static PTAP_ADAPTER_CONTEXT Adapters[METRICS_ADAPTERS];
+
+static NTSTATUS
+Snapshot(PFILE_OBJECT File, METRICS_BUFFER *Buffer, ULONG Length, ULONG_PTR *Information)
+{
+    memset(Buffer, 0xCC, sizeof(*Buffer));
+
+    return TapHostIoctl(File, TAP_WIN_IOCTL_GET_METRICS, Buffer, 0, Length, Information);
+}
+
+// Issue a waiting request; returns its IRP, still pending.
+static PIRP
+Wait(PFILE_OBJECT File, METRICS_BUFFER *Buffer, ULONG Period, ULONG64 Threshold)
+{
+    TAP_WIN_METRICS_REQUEST request = {TAP_WIN_METRICS_WAIT, Period, Threshold};
+    PIRP irp;
+
+    memset(Buffer, 0, sizeof(*Buffer));
+    memcpy(Buffer, &request, sizeof(request));
+
+    CHECK_EQ(TapHostIoctlAsync(File, TAP_WIN_IOCTL_GET_METRICS, Buffer,
+        sizeof(request), sizeof(*Buffer), &irp), STATUS_PENDING);
+    CHECK(!irp->HostCompleted);
+
+    return irp;
+}
+
+// One poll of the waiting requests.
+static VOID
+Tick(VOID)
+{
+    WdkHostAdvanceClock(METRICS_TICK);
+    WdkHostRunDpcs();
+}
+
+static VOID
+CheckHeader(const METRICS_BUFFER *Buffer, ULONG Count, ULONG Returned)
+{
+    CHECK_EQ(Buffer->Header.AdapterCount, Count);
+    CHECK_EQ(Buffer->Header.AdapterReturned, Returned);
+    CHECK_EQ(Buffer->Header.RecordLength, sizeof(TAP_WIN_ADAPTER_METRICS));
+    CHECK_EQ(Buffer->Header.Reserved, 0);
+    CHECK_EQ(Buffer->Header.Frequency, 10000000);
+    CHECK_EQ(Buffer->Header.Timestamp, KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+// Each record carries its adapter's counters, summed as documented, in
+// the order the adapters were added.
+static VOID
+TestEncoding(PFILE_OBJECT File)
+{
+    PTAP_ADAPTER_CONTEXT adapter = Adapters[1];
+    METRICS_BUFFER buffer;
+    TAP_WIN_ADAPTER_METRICS *record = &buffer.Records[1];
+    ULONG_PTR information;
+
+    adapter->FramesTxDirected = 1;
+    adapter->FramesTxMulticast = 2;
+    adapter->FramesTxBroadcast = 4;
+    adapter->BytesTxDirected = 100;
+    adapter->BytesTxMulticast = 200;
+    adapter->BytesTxBroadcast = 400;
+    adapter->FramesRxDirected = 10;
+    adapter->FramesRxMulticast = 20;
+    adapter->FramesRxBroadcast = 40;
+    adapter->BytesRxDirected = 1000;
+    adapter->BytesRxMulticast = 2000;
+    adapter->BytesRxBroadcast = 4000;
+    adapter->TransmitFailuresOther = 3;
+    adapter->RxResourceErrors = 5;
+
+    TAP_DROP(adapter, TAP_WIN_DROP_TX_NO_READER);
+    TAP_DROP(adapter, TAP_WIN_DROP_TX_FILTERED);
+
+    // Handled frames are not drops.
+    TAP_HANDLED(adapter);
+
+    CHECK_EQ(Snapshot(File, &buffer, sizeof(buffer), &information), STATUS_SUCCESS);
+    CHECK_EQ(information, sizeof(TAP_WIN_METRICS) + METRICS_ADAPTERS * sizeof(TAP_WIN_ADAPTER_METRICS));
+    CheckHeader(&buffer, METRICS_ADAPTERS, METRICS_ADAPTERS);
+
+    CHECK(memcmp(buffer.Records[0].InstanceId, &Adapters[0]->NetCfgInstanceGuid, 16) == 0);
+    CHECK(memcmp(record->InstanceId, &adapter->NetCfgInstanceGuid, 16) == 0);
+    CHECK(memcmp(record->InstanceId, buffer.Records[0].InstanceId, 16) != 0);
+
+    CHECK_EQ(record->State, tapAdapterStatsState(adapter));
+    CHECK_EQ(record->State, TAP_WIN_STATS_STATE_RUNNING
+        | TAP_WIN_STATS_STATE_INTERFACE_UP
+        | TAP_WIN_STATS_STATE_MEDIA_CONNECTED);
+    CHECK_EQ(buffer.Records[0].State, 0);
+    CHECK_EQ(record->ActiveQueueCount, adapter->ActiveQueueCount);
+    CHECK_EQ(record->QueuedFrames, 0);
+    CHECK_EQ(record->PendingReads, 0);
+    CHECK_EQ(record->FramesTx, 7);
+    CHECK_EQ(record->BytesTx, 700);
+    CHECK_EQ(record->FramesRx, 70);
+    CHECK_EQ(record->BytesRx, 7000);
+    CHECK_EQ(record->Errors, 8);
+    CHECK_EQ(record->Drops, 2);
+
+    CHECK_EQ(buffer.Records[0].FramesTx, 0);
+    CHECK_EQ(buffer.Records[0].Drops, 0);
+
+    // Nothing past the last record is written.
+    CHECK_EQ(buffer.Records[METRICS_ADAPTERS].State, 0xCCCCCCCC);
+}
+
+// A short buffer gets the first records and the full count; one
+// without room for the header gets nothing.
+static VOID
+TestShortBuffer(PFILE_OBJECT File)
+{
+    METRICS_BUFFER buffer;
+    ULONG_PTR information;
+    ULONG length = sizeof(TAP_WIN_METRICS) + sizeof(TAP_WIN_ADAPTER_METRICS) + 1;
+
+    CHECK_EQ(Snapshot(File, &buffer, length, &information), STATUS_SUCCESS);
+    CHECK_EQ(information, length - 1);
+    CheckHeader(&buffer, METRICS_ADAPTERS, 1);
+    CHECK(memcmp(buffer.Records[0].InstanceId, &Adapters[0]->NetCfgInstanceGuid, 16) == 0);
+    CHECK_EQ(buffer.Records[1].State, 0xCCCCCCCC);
+
+    CHECK_EQ(Snapshot(File, &buffer, sizeof(TAP_WIN_METRICS), &information), STATUS_SUCCESS);
+    CHECK_EQ(information, sizeof(TAP_WIN_METRICS));
+    CheckHeader(&buffer, METRICS_ADAPTERS, 0);
+
+    CHECK_EQ(Snapshot(File, &buffer, sizeof(TAP_WIN_METRICS) - 1, &information), STATUS_BUFFER_TOO_SMALL);
+    CHECK_EQ(information, 0);
+}
+
+// Waiting needs a period.
+static VOID
+TestNoPeriod(PFILE_OBJECT File)
+{
+    TAP_WIN_METRICS_REQUEST request = {TAP_WIN_METRICS_WAIT, 0, 0};
+    METRICS_BUFFER buffer;
+    ULONG_PTR information;
+
+    memset(&buffer, 0, sizeof(buffer));
+    memcpy(&buffer, &request, sizeof(request));
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_METRICS, &buffer,
+        sizeof(request), sizeof(buffer), &information), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(information, 0);
+    CHECK(!Adapters[0]->MetricsWait.TimerArmed);
+}
+
+// Completes once activity on any adapter, handled frames aside, moves
+// by more than the threshold, and then stops the timer.
+static VOID
+TestThreshold(PFILE_OBJECT File)
+{
+    PTAP_ADAPTER_CONTEXT adapter = Adapters[1];
+    METRICS_BUFFER buffer;
+    PIRP irp = Wait(File, &buffer, 60000, 3);
+
+    CHECK(Adapters[0]->MetricsWait.TimerArmed);
+    CHECK_EQ(Adapters[0]->MetricsWait.Queue.Count, 1);
+
+    adapter->FramesTxDirected += 1;
+    adapter->FramesRxBroadcast += 1;
+    TAP_DROP(adapter, TAP_WIN_DROP_TX_NOT_READY);
+    TAP_HANDLED(adapter);
+    Tick();
+    CHECK(!irp->HostCompleted);
+
+    adapter->FramesRxDirected += 1;
+    CHECK(!irp->HostCompleted);
+    Tick();
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    CHECK_EQ(irp->IoStatus.Information, sizeof(TAP_WIN_METRICS) + METRICS_ADAPTERS * sizeof(TAP_WIN_ADAPTER_METRICS));
+    CheckHeader(&buffer, METRICS_ADAPTERS, METRICS_ADAPTERS);
+    CHECK_EQ(buffer.Records[1].FramesTx, 8);
+    CHECK_EQ(buffer.Records[1].FramesRx, 72);
+    CHECK_EQ(buffer.Records[1].Drops, 3);
+    WdkHostFreeIrp(irp);
+
+    CHECK_EQ(Adapters[0]->MetricsWait.Queue.Count, 0);
+    CHECK(!Adapters[0]->MetricsWait.TimerArmed);
+}
+
+// Without a change, completes when its period has passed.
+static VOID
+TestPeriod(PFILE_OBJECT File)
+{
+    METRICS_BUFFER buffer;
+    PIRP irp = Wait(File, &buffer, 4 * TAP_METRICS_POLL_INTERVAL, 0);
+    ULONG i;
+
+    for(i = 0; i < 3; ++i)
+    {
+        Tick();
+        CHECK(!irp->HostCompleted);
+    }
+
+    Tick();
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    CheckHeader(&buffer, METRICS_ADAPTERS, METRICS_ADAPTERS);
+    WdkHostFreeIrp(irp);
+
+    CHECK(!Adapters[0]->MetricsWait.TimerArmed);
+}
+
+// An adapter changing state, or coming and going, completes it with
+// no change in activity.
+static VOID
+TestState(PFILE_OBJECT File)
+{
+    METRICS_BUFFER buffer;
+    PTAP_ADAPTER_CONTEXT added;
+    PIRP irp = Wait(File, &buffer, 60000, 0);
+
+    CHECK_EQ(TapHostPauseAdapter(Adapters[1]), NDIS_STATUS_SUCCESS);
+    Tick();
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    CHECK(!(buffer.Records[1].State & TAP_WIN_STATS_STATE_RUNNING));
+    WdkHostFreeIrp(irp);
+
+    irp = Wait(File, &buffer, 60000, 0);
+    CHECK_EQ(TapHostRestartAdapter(Adapters[1]), NDIS_STATUS_SUCCESS);
+    Tick();
+    CHECK(irp->HostCompleted);
+    CHECK(buffer.Records[1].State & TAP_WIN_STATS_STATE_RUNNING);
+    WdkHostFreeIrp(irp);
+
+    irp = Wait(File, &buffer, 60000, 0);
+    added = TapHostCreateAdapter(METRICS_ADAPTERS + 1);
+    CHECK(added != NULL);
+    Tick();
+    CHECK(irp->HostCompleted);
+    CheckHeader(&buffer, METRICS_ADAPTERS + 1, METRICS_ADAPTERS + 1);
+    WdkHostFreeIrp(irp);
+
+    irp = Wait(File, &buffer, 60000, 0);
+    TapHostHaltAdapter(added);
+    Tick();
+    CHECK(irp->HostCompleted);
+    CheckHeader(&buffer, METRICS_ADAPTERS, METRICS_ADAPTERS);
+    WdkHostFreeIrp(irp);
+}
+
+// Cleanup of the handle cancels its requests and no one else's.
+static VOID
+TestCleanup(PFILE_OBJECT File)
+{
+    PFILE_OBJECT other = TapHostOpen(Adapters[0]->DiagDeviceObject);
+    METRICS_BUFFER buffer;
+    METRICS_BUFFER otherBuffer;
+    PIRP irp;
+    PIRP otherIrp;
+
+    CHECK(other != NULL);
+
+    irp = Wait(File, &buffer, 60000, 0);
+    otherIrp = Wait(other, &otherBuffer, 60000, 0);
+
+    TapHostClose(other);
+    CHECK(otherIrp->HostCompleted);
+    CHECK_EQ(otherIrp->IoStatus.Status, STATUS_CANCELLED);
+    CHECK_EQ(otherIrp->IoStatus.Information, 0);
+    CHECK(!irp->HostCompleted);
+    WdkHostFreeIrp(otherIrp);
+
+    TapHostClose(File);
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_CANCELLED);
+    WdkHostFreeIrp(irp);
+
+    // The next poll finds the queue empty.
+    CHECK(Adapters[0]->MetricsWait.TimerArmed);
+    Tick();
+    CHECK(!Adapters[0]->MetricsWait.TimerArmed);
+}
+
+int
+main(void)
+{
+    PFILE_OBJECT file;
+    PFILE_OBJECT tap;
+    ULONG value = 1;
+    ULONG i;
+
+    WdkHostFreezeClock(METRICS_NOW);
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+
+    for(i = 0; i < METRICS_ADAPTERS; ++i)
+    {
+        Adapters[i] = TapHostCreateAdapter(i + 1);
+        CHECK(Adapters[i] != NULL);
+        CHECK(Adapters[i]->DiagDeviceObject != NULL);
+    }
+
+    // The second adapter is up and connected, the first idle.
+    tap = TapHostOpen(Adapters[1]->DeviceObject);
+    CHECK(tap != NULL);
+    CHECK_EQ(TapHostIoctl(tap, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    file = TapHostOpen(Adapters[0]->DiagDeviceObject);
+    CHECK(file != NULL);
+
+    TestEncoding(file);
+    TestShortBuffer(file);
+    TestNoPeriod(file);
+    TestThreshold(file);
+    TestPeriod(file);
+    TestState(file);
+    TestCleanup(file);
+
+    TapHostClose(tap);
+
+    for(i = 0; i < METRICS_ADAPTERS; ++i)
+    {
+        TapHostHaltAdapter(Adapters[i]);
+    }
+
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Multi-queue mode (tapQueueOpen and friends in device.c, tapFlowHash
+// and flow control in txpath.c): the limit SET_QUEUE_COUNT accepts,
+// flows hashed to one handle in both directions and spread over all
+// of them, an NBL held back for a full queue while the others drain,
+// and a handle's cleanup flushing its own queue only, the adapter
+// being reset when the last handle goes.
+//======================================================================
+
+#include "taphost.h"
+
+#define MQ_QUEUES           4
+#define MQ_FLOWS            256
+#define MQ_FRAME_LENGTH     (sizeof(ETH_HEADER) + sizeof(IPHDR) + sizeof(UDPHDR) + 18)
+#define MQ_FULL_LENGTH      ETHERNET_PACKET_SIZE
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT Files[MQ_QUEUES];
+static ULONG Completed;
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    while(NetBufferLists != NULL)
+    {
+        PNET_BUFFER_LIST next = NET_BUFFER_LIST_NEXT_NBL(NetBufferLists);
+
+        NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) = NULL;
+        WdkHostFreeNetBufferList(NetBufferLists);
+        NetBufferLists = next;
+        ++Completed;
+    }
+}
+
+//
+// Handles.
+//
+
+static NTSTATUS
+SetQueueCount(PFILE_OBJECT File, ULONG Count)
+{
+    return TapHostIoctl(File, TAP_WIN_IOCTL_SET_QUEUE_COUNT, &Count,
+        sizeof(Count), sizeof(ULONG), NULL);
+}
+
+// Opens Count handles, with the limit set to Count, and connects the
+// medium.
+static VOID
+OpenQueues(ULONG Count)
+{
+    ULONG value = TRUE;
+    ULONG i;
+
+    Files[0] = TapHostOpen(Adapter->DeviceObject);
+    CHECK(Files[0] != NULL);
+    CHECK_EQ(SetQueueCount(Files[0], Count), STATUS_SUCCESS);
+
+    for(i = 1; i < Count; ++i)
+    {
+        Files[i] = TapHostOpen(Adapter->DeviceObject);
+        CHECK(Files[i] != NULL);
+    }
+
+    CHECK_EQ(TapHostIoctl(Files[0], TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+    CHECK_EQ(Adapter->ActiveQueueCount, Count);
+}
+
+static VOID
+CloseQueues(ULONG Count)
+{
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        TapHostClose(Files[i]);
+        Files[i] = NULL;
+    }
+
+    CHECK_EQ(Adapter->ActiveQueueCount, 0);
+}
+
+// The handle reading the queue in slot Slot.
+static ULONG
+HandleOf(ULONG Slot)
+{
+    ULONG i;
+
+    for(i = 0; i < MQ_QUEUES; ++i)
+    {
+        if(Files[i] != NULL && (PTAP_QUEUE)Files[i]->FsContext2 == &Adapter->Queues[Slot])
+        {
+            return i;
+        }
+    }
+
+    CHECK(FALSE);
+    return 0;
+}
+
+//
+// Frames, as the host sends them through the adapter.
+//
+
+static ULONG
+BuildUdp(UCHAR *Frame, ULONG Length, ULONG Saddr, ULONG Daddr, USHORT Sport, USHORT Dport)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPHDR *ip = (IPHDR *)(eth + 1);
+    UDPHDR *udp = (UDPHDR *)(ip + 1);
+
+    memset(Frame, 0, Length);
+
+    memset(eth->dest, 0xFF, sizeof(MACADDR));
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(NDIS_ETH_TYPE_IPV4);
+
+    ip->version_len = 0x45;
+    ip->tot_len = htons((USHORT)(Length - sizeof(ETH_HEADER)));
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->saddr = htonl(Saddr);
+    ip->daddr = htonl(Daddr);
+
+    udp->source = htons(Sport);
+    udp->dest = htons(Dport);
+    udp->len = htons((USHORT)(Length - sizeof(ETH_HEADER) - sizeof(IPHDR)));
+
+    return Length;
+}
+
+static ULONG
+BuildTcp6(UCHAR *Frame, UCHAR Saddr, UCHAR Daddr, USHORT Sport, USHORT Dport)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPV6HDR *ipv6 = (IPV6HDR *)(eth + 1);
+    USHORT *ports = (USHORT *)(ipv6 + 1);
+    ULONG length = sizeof(ETH_HEADER) + sizeof(IPV6HDR) + 20;
+
+    memset(Frame, 0, length);
+
+    ETH_COPY_NETWORK_ADDRESS(eth->dest, Adapter->CurrentAddress);
+    eth->dest[0] ^= 0x02;
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(NDIS_ETH_TYPE_IPV6);
+
+    ipv6->version_prio = 0x60;
+    ipv6->payload_len = htons(20);
+    ipv6->nexthdr = IPPROTO_TCP;
+    ipv6->hop_limit = 64;
+    ipv6->saddr[0] = 0xfd;
+    ipv6->saddr[15] = Saddr;
+    ipv6->daddr[0] = 0xfd;
+    ipv6->daddr[15] = Daddr;
+
+    ports[0] = htons(Sport);
+    ports[1] = htons(Dport);
+
+    return length;
+}
+
+static VOID
+Send(const UCHAR *Frame, ULONG Length)
+{
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(Frame, Length));
+}
+
+// Sends a frame and returns the slot of the one queue it was added to.
+static ULONG
+Which(const UCHAR *Frame, ULONG Length)
+{
+    ULONG before[TAP_WIN_MAX_QUEUES];
+    ULONG slot = TAP_WIN_MAX_QUEUES;
+    ULONG i;
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        before[i] = Adapter->Queues[i].SendPacketQueue.Count;
+    }
+
+    Send(Frame, Length);
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        if(Adapter->Queues[i].SendPacketQueue.Count != before[i])
+        {
+            CHECK_EQ(Adapter->Queues[i].SendPacketQueue.Count, before[i] + 1);
+            CHECK_EQ(slot, TAP_WIN_MAX_QUEUES);
+            slot = i;
+        }
+    }
+
+    CHECK(slot < TAP_WIN_MAX_QUEUES);
+    return slot;
+}
+
+static ULONG64
+Flushed(VOID)
+{
+    TAP_WIN_DROP_STATS drops;
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+    return drops.Drops[TAP_WIN_DROP_TX_FLUSHED];
+}
+
+//
+// The tests.
+//
+
+// The count is from 1 to TAP_WIN_MAX_QUEUES, and not below the number
+// of handles open. It reverts to 1 when the last handle closes.
+static VOID
+TestQueueCount(VOID)
+{
+    ULONG count = 2;
+    ULONG i;
+
+    Files[0] = TapHostOpen(Adapter->DeviceObject);
+    CHECK(Files[0] != NULL);
+
+    // One handle until the count is raised.
+    CHECK(TapHostOpen(Adapter->DeviceObject) == NULL);
+
+    CHECK_EQ(SetQueueCount(Files[0], 0), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(SetQueueCount(Files[0], TAP_WIN_MAX_QUEUES + 1), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(TapHostIoctl(Files[0], TAP_WIN_IOCTL_SET_QUEUE_COUNT, &count,
+        sizeof(count) - 1, sizeof(ULONG), NULL), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Adapter->QueueLimit, 1);
+
+    CHECK_EQ(SetQueueCount(Files[0], 3), STATUS_SUCCESS);
+
+    for(i = 1; i < 3; ++i)
+    {
+        Files[i] = TapHostOpen(Adapter->DeviceObject);
+        CHECK(Files[i] != NULL);
+    }
+
+    CHECK(TapHostOpen(Adapter->DeviceObject) == NULL);
+    CHECK_EQ(Adapter->ActiveQueueCount, 3);
+
+    // Not below the handles open, from any of them.
+    CHECK_EQ(SetQueueCount(Files[2], 2), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Adapter->QueueLimit, 3);
+
+    CHECK_EQ(SetQueueCount(Files[1], TAP_WIN_MAX_QUEUES), STATUS_SUCCESS);
+
+    for(i = 3; i < MQ_QUEUES; ++i)
+    {
+        Files[i] = TapHostOpen(Adapter->DeviceObject);
+        CHECK(Files[i] != NULL);
+    }
+
+    CHECK_EQ(SetQueueCount(Files[0], MQ_QUEUES), STATUS_SUCCESS);
+    CHECK(TapHostOpen(Adapter->DeviceObject) == NULL);
+
+    // A closed handle's slot is free for the next open.
+    TapHostClose(Files[2]);
+    Files[2] = TapHostOpen(Adapter->DeviceObject);
+    CHECK(Files[2] != NULL);
+
+    CloseQueues(MQ_QUEUES);
+
+    Files[0] = TapHostOpen(Adapter->DeviceObject);
+    CHECK(Files[0] != NULL);
+    CHECK_EQ(Adapter->QueueLimit, 1);
+
+    CHECK(TapHostOpen(Adapter->DeviceObject) == NULL);
+
+    CloseQueues(1);
+}
+
+// Both directions of a flow are read from one handle; flows spread over
+// every handle; frames that are not IP all go to one.
+static VOID
+TestFlowHash(VOID)
+{
+    UCHAR frame[MQ_FRAME_LENGTH];
+    ULONG perQueue[TAP_WIN_MAX_QUEUES];
+    IPHDR *ip = (IPHDR *)(frame + sizeof(ETH_HEADER));
+    UDPHDR *udp = (UDPHDR *)(ip + 1);
+    ULONG slot;
+    ULONG i;
+
+    OpenQueues(MQ_QUEUES);
+
+    memset(perQueue, 0, sizeof(perQueue));
+
+    for(i = 0; i < MQ_FLOWS; ++i)
+    {
+        ULONG client = 0x0A000002 + (i % 7);
+        USHORT port = (USHORT)(40000 + i);
+
+        slot = Which(frame, BuildUdp(frame, sizeof(frame), client, 0x0A010001, port, 53));
+        CHECK_EQ(Which(frame, BuildUdp(frame, sizeof(frame), 0x0A010001, client, 53, port)), slot);
+        ++perQueue[slot];
+
+        slot = Which(frame, BuildTcp6(frame, (UCHAR)i, 0x80, port, 443));
+        CHECK_EQ(Which(frame, BuildTcp6(frame, 0x80, (UCHAR)i, 443, port)), slot);
+        ++perQueue[slot];
+    }
+
+    // Every handle gets at least half its share.
+    for(i = 0; i < MQ_QUEUES; ++i)
+    {
+        CHECK(perQueue[((PTAP_QUEUE)Files[i]->FsContext2) - Adapter->Queues]
+            >= 2 * MQ_FLOWS / MQ_QUEUES / 2);
+    }
+
+    // Fragments of a datagram stay together, whatever follows their
+    // IP header.
+    BuildUdp(frame, sizeof(frame), 0x0A000002, 0x0A010001, 1000, 2000);
+    ip->frag_off = htons(0x2000);
+    slot = Which(frame, sizeof(frame));
+    for(i = 0; i < 8; ++i)
+    {
+        ip->frag_off = htons((USHORT)(185 * (i + 1)));
+        udp->source = htons((USHORT)(0x1234 + 77 * i));
+        udp->dest = htons((USHORT)(0x5678 - 31 * i));
+        CHECK_EQ(Which(frame, sizeof(frame)), slot);
+    }
+
+    // ARP, and anything else not IP, hashes to the first active queue.
+    for(i = 0; i < 8; ++i)
+    {
+        BuildUdp(frame, sizeof(frame), 0x0A000002 + i, 0x0A010001, 1000 + (USHORT)i, 2000);
+        ((ETH_HEADER *)frame)->proto = htons(NDIS_ETH_TYPE_ARP);
+        CHECK_EQ(Which(frame, sizeof(frame)), Adapter->ActiveQueues[0]);
+    }
+
+    CloseQueues(MQ_QUEUES);
+}
+
+// An NBL whose frame leaves its queue over TAP_BUFFER_SIZE is held
+// until that handle reads the queue down; flows to other handles are
+// completed, and read, meanwhile.
+static VOID
+TestFlowControl(VOID)
+{
+    static UCHAR frame[MQ_FULL_LENGTH];
+    static UCHAR readBuffer[2048];
+    PTAP_QUEUE fullQueue;
+    PTAP_QUEUE otherQueue;
+    ULONG full;
+    ULONG other;
+    ULONG sent = Completed;
+    ULONG reads = 0;
+    USHORT port;
+    PIRP irp = NULL;
+
+    OpenQueues(2);
+
+    full = Which(frame, BuildUdp(frame, sizeof(frame), 0x0A000002, 0x0A010001, 1000, 2000));
+    ++sent;
+
+    // Another flow, on the other handle.
+    for(port = 1001; ; ++port)
+    {
+        other = Which(frame, BuildUdp(frame, MQ_FRAME_LENGTH, 0x0A000002, 0x0A010001, port, 2000));
+        ++sent;
+        if(other != full)
+        {
+            break;
+        }
+    }
+
+    fullQueue = &Adapter->Queues[full];
+    otherQueue = &Adapter->Queues[other];
+    CHECK_EQ(Completed, sent);
+
+    // Fill the first queue until an NBL is held back.
+    BuildUdp(frame, sizeof(frame), 0x0A000002, 0x0A010001, 1000, 2000);
+    while(Completed == sent)
+    {
+        Send(frame, sizeof(frame));
+        ++sent;
+        CHECK(sent < 2 * TAP_BUFFER_SIZE / MQ_FULL_LENGTH);
+    }
+
+    CHECK_EQ(Completed, sent - 1);
+    CHECK(fullQueue->SendPacketQueue.TotalBytes > TAP_BUFFER_SIZE);
+    CHECK(fullQueue->FlowControlHasPackets);
+
+    // The other handle reads what it has, and sends to it complete.
+    while(otherQueue->SendPacketQueue.Count > 0)
+    {
+        CHECK_EQ(TapHostRead(Files[HandleOf(other)], readBuffer, sizeof(readBuffer), &irp),
+            STATUS_PENDING);
+        CHECK(irp->HostCompleted);
+        WdkHostFreeIrp(irp);
+    }
+
+    CHECK_EQ(TapHostRead(Files[HandleOf(other)], readBuffer, sizeof(readBuffer), &irp),
+        STATUS_PENDING);
+    CHECK(!irp->HostCompleted);
+
+    BuildUdp(frame, MQ_FRAME_LENGTH, 0x0A000002, 0x0A010001, port, 2000);
+    Send(frame, MQ_FRAME_LENGTH);
+    ++sent;
+
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Information, MQ_FRAME_LENGTH);
+    WdkHostFreeIrp(irp);
+    CHECK_EQ(Completed, sent - 1);
+    CHECK(!otherQueue->FlowControlHasPackets);
+
+    // Reading the full queue below its limit releases the held NBL.
+    while(Completed != sent)
+    {
+        CHECK(reads < 2);
+        CHECK_EQ(TapHostRead(Files[HandleOf(full)], readBuffer, sizeof(readBuffer), &irp),
+            STATUS_PENDING);
+        CHECK(irp->HostCompleted);
+        WdkHostFreeIrp(irp);
+        ++reads;
+    }
+
+    CHECK(fullQueue->SendPacketQueue.TotalBytes < TAP_BUFFER_SIZE);
+    CHECK(!fullQueue->FlowControlHasPackets);
+
+    CloseQueues(2);
+    CHECK_EQ(Completed, sent);
+}
+
+// Closing one handle flushes only its own queue, and leaves the adapter
+// as it is; closing the last one disconnects and resets it.
+static VOID
+TestCleanup(VOID)
+{
+    UCHAR frame[MQ_FRAME_LENGTH];
+    TAP_WIN_READ_COALESCING coalescing;
+    ULONG counts[TAP_WIN_MAX_QUEUES];
+    ULONG64 flushed;
+    ULONG closedSlot;
+    ULONG closed;
+    ULONG i;
+
+    OpenQueues(MQ_QUEUES);
+
+    coalescing.MaxFrames = 2;
+    coalescing.MaxBytes = 0;
+    coalescing.MaxMicroseconds = 0;
+    CHECK_EQ(TapHostIoctl(Files[0], TAP_WIN_IOCTL_SET_READ_COALESCING, &coalescing,
+        sizeof(coalescing), 0, NULL), STATUS_SUCCESS);
+
+    for(i = 0; i < MQ_FLOWS; ++i)
+    {
+        BuildUdp(frame, sizeof(frame), 0x0A000002, 0x0A010001, (USHORT)(1000 + i), 2000);
+        Send(frame, sizeof(frame));
+    }
+
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        counts[i] = Adapter->Queues[i].SendPacketQueue.Count;
+    }
+
+    closed = 1;
+    closedSlot = (ULONG)((PTAP_QUEUE)Files[closed]->FsContext2 - Adapter->Queues);
+    CHECK(counts[closedSlot] > 0);
+    flushed = Flushed();
+
+    TapHostClose(Files[closed]);
+    Files[closed] = NULL;
+
+    CHECK_EQ(Flushed(), flushed + counts[closedSlot]);
+    CHECK_EQ(Adapter->ActiveQueueCount, MQ_QUEUES - 1);
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        CHECK_EQ(Adapter->Queues[i].SendPacketQueue.Count, (i == closedSlot) ? 0 : counts[i]);
+    }
+
+    // Still up, with its settings.
+    CHECK(Adapter->LogicalMediaState);
+    CHECK_EQ(Adapter->ReadCoalesce.MaxFrames, 2);
+
+    // New flows skip the closed handle.
+    for(i = 0; i < MQ_FLOWS; ++i)
+    {
+        BuildUdp(frame, sizeof(frame), 0x0A000002, 0x0A010001, (USHORT)(3000 + i), 2000);
+        CHECK(Which(frame, sizeof(frame)) != closedSlot);
+    }
+
+    for(i = 0; i < MQ_QUEUES; ++i)
+    {
+        if(Files[i] != NULL && i != MQ_QUEUES - 1)
+        {
+            TapHostClose(Files[i]);
+            Files[i] = NULL;
+            CHECK(Adapter->LogicalMediaState);
+        }
+    }
+
+    TapHostClose(Files[MQ_QUEUES - 1]);
+    Files[MQ_QUEUES - 1] = NULL;
+
+    CHECK_EQ(Adapter->ActiveQueueCount, 0);
+    CHECK(!Adapter->LogicalMediaState);
+    CHECK_EQ(Adapter->ReadCoalesce.MaxFrames, 0);
+    for(i = 0; i < TAP_WIN_MAX_QUEUES; ++i)
+    {
+        CHECK_EQ(Adapter->Queues[i].SendPacketQueue.Count, 0);
+    }
+}
+
+int
+main(void)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+
+    TestQueueCount();
+    TestFlowHash();
+    TestFlowControl();
+    TestCleanup();
+
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,649 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The IPv6 neighbor discovery proxy (ndproxy.c): which solicitations
+// it answers and what it answers them with, and longest prefix
+// matching in its table against a brute force search.
+//======================================================================
+
+#include "taphost.h"
+
+#define NS_LENGTH           (sizeof(ETH_HEADER) + sizeof(IPV6HDR) + sizeof(ICMPV6_NS) + 8)
+
+#define TABLE_RANDOM_ENTRIES    TAP_WIN_ND_PROXY_MAX_ENTRIES
+#define TABLE_RANDOM_LOOKUPS    20000
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+static const UCHAR HostAddress[16] =
+    { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 };
+
+//
+// What the driver indicates to the host.
+//
+
+static UCHAR Advertisement[256];
+static ULONG AdvertisementLength;
+static ULONG Advertisements;
+static PNET_BUFFER_LIST Indicated;
+
+static VOID
+TakeIndications(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    CHECK_EQ(NumberOfNetBufferLists, 1);
+
+    AdvertisementLength = WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(NetBufferLists),
+        Advertisement, sizeof(Advertisement));
+    ++Advertisements;
+
+    if(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES))
+    {
+        CHECK(Indicated == NULL);
+        Indicated = NetBufferLists;
+    }
+}
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    CHECK(NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) == NULL);
+    WdkHostFreeNetBufferList(NetBufferLists);
+}
+
+// Runs the inject DPC and returns what it indicated.
+static VOID
+ReturnIndicated(VOID)
+{
+    WdkHostRunDpcs();
+
+    if(Indicated != NULL)
+    {
+        PNET_BUFFER_LIST nbl = Indicated;
+
+        Indicated = NULL;
+        TapHostReturn(Adapter, nbl);
+    }
+}
+
+//
+// Solicitations.
+//
+
+static VOID
+SolicitedNode(UCHAR *Address, const UCHAR *Target)
+{
+    static const UCHAR prefix[13] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff };
+
+    memcpy(Address, prefix, sizeof(prefix));
+    memcpy(Address + 13, Target + 13, 3);
+}
+
+// A neighbor solicitation from the host for Target: to its solicited-node
+// address, or from :: for a DAD probe.
+static ULONG
+BuildSolicitation(UCHAR *Frame, const UCHAR *Target, BOOLEAN Dad)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPV6HDR *ipv6 = (IPV6HDR *)(eth + 1);
+    ICMPV6_NS *ns = (ICMPV6_NS *)(ipv6 + 1);
+    UCHAR *option = (UCHAR *)(ns + 1);
+
+    memset(Frame, 0, NS_LENGTH);
+
+    eth->dest[0] = 0x33;
+    eth->dest[1] = 0x33;
+    eth->dest[2] = 0xff;
+    memcpy(eth->dest + 3, Target + 13, 3);
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(NDIS_ETH_TYPE_IPV6);
+
+    ipv6->version_prio = 0x60;
+    ipv6->payload_len = htons(sizeof(ICMPV6_NS) + 8);
+    ipv6->nexthdr = IPPROTO_ICMPV6;
+    ipv6->hop_limit = 255;
+    SolicitedNode(ipv6->daddr, Target);
+
+    ns->type = ICMPV6_TYPE_NS;
+    ns->code = ICMPV6_CODE_0;
+    memcpy(ns->target_addr, Target, 16);
+
+    if(!Dad)
+    {
+        memcpy(ipv6->saddr, HostAddress, 16);
+
+        // Source link-layer address.
+        option[0] = 1;
+        option[1] = 1;
+        ETH_COPY_NETWORK_ADDRESS(option + 2, Adapter->CurrentAddress);
+    }
+
+    ns->checksum = htons(tapChecksumIPv6Pseudo((UCHAR *)ns, sizeof(ICMPV6_NS) + 8,
+        IPPROTO_ICMPV6, ipv6->saddr, ipv6->daddr));
+
+    return NS_LENGTH;
+}
+
+// tapNdProxyProcess on a frame; if answered, the advertisement is checked
+// against the solicitation and Mac and its flags returned in *RsoBits.
+static BOOLEAN
+Process(UCHAR *Frame, ULONG Length, const UCHAR *Mac, UCHAR *RsoBits)
+{
+    const ETH_HEADER *eth = (const ETH_HEADER *)Frame;
+    const IPV6HDR *ipv6 = (const IPV6HDR *)(eth + 1);
+    const ICMPV6_NS *ns = (const ICMPV6_NS *)(ipv6 + 1);
+    const ICMPV6_NA_PKT *na = (const ICMPV6_NA_PKT *)Advertisement;
+    ULONG before = Advertisements;
+    BOOLEAN dad = (memcmp(ipv6->saddr, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16) == 0);
+
+    if(!tapNdProxyProcess(Adapter, Frame, Length))
+    {
+        ReturnIndicated();
+        CHECK_EQ(Advertisements, before);
+        return FALSE;
+    }
+
+    ReturnIndicated();
+    CHECK_EQ(Advertisements, before + 1);
+    CHECK(AdvertisementLength >= sizeof(ICMPV6_NA_PKT));
+
+    CHECK(memcmp(na->eth.src, Mac, 6) == 0);
+    CHECK_EQ(ntohs(na->eth.proto), NDIS_ETH_TYPE_IPV6);
+    CHECK_EQ(na->ipv6.nexthdr, IPPROTO_ICMPV6);
+    CHECK_EQ(na->ipv6.hop_limit, 255);
+    CHECK_EQ(ntohs(na->ipv6.payload_len), sizeof(ICMPV6_NA));
+    CHECK(memcmp(na->ipv6.saddr, ns->target_addr, 16) == 0);
+
+    // Answered to the solicitor, or for DAD to all nodes.
+    if(dad)
+    {
+        CHECK(memcmp(na->eth.dest, "\x33\x33\x00\x00\x00\x01", 6) == 0);
+        CHECK(memcmp(na->ipv6.daddr, "\xff\x02\0\0\0\0\0\0\0\0\0\0\0\0\0\x01", 16) == 0);
+        CHECK_EQ(na->icmpv6.rso_bits & ICMPV6_NA_SOLICITED, 0);
+    }
+    else
+    {
+        CHECK(memcmp(na->eth.dest, eth->src, 6) == 0);
+        CHECK(memcmp(na->ipv6.daddr, ipv6->saddr, 16) == 0);
+        CHECK(na->icmpv6.rso_bits & ICMPV6_NA_SOLICITED);
+    }
+
+    CHECK_EQ(na->icmpv6.type, ICMPV6_TYPE_NA);
+    CHECK_EQ(na->icmpv6.code, ICMPV6_CODE_0);
+    CHECK(memcmp(na->icmpv6.target_addr, ns->target_addr, 16) == 0);
+    CHECK_EQ(na->icmpv6.opt_type, ICMPV6_OPTION_TLLA);
+    CHECK_EQ(na->icmpv6.opt_length, ICMPV6_LENGTH_TLLA);
+    CHECK(memcmp(na->icmpv6.target_macaddr, Mac, 6) == 0);
+
+    // The checksum covers the pseudo header: verifying sums to zero.
+    CHECK_EQ(tapChecksumIPv6Pseudo((const UCHAR *)&na->icmpv6, sizeof(ICMPV6_NA),
+        IPPROTO_ICMPV6, na->ipv6.saddr, na->ipv6.daddr), 0);
+
+    *RsoBits = na->icmpv6.rso_bits;
+    return TRUE;
+}
+
+//
+// The table.
+//
+
+static TAP_WIN_ND_PROXY *Config;
+
+static NTSTATUS
+Configure(const TAP_WIN_ND_PROXY_ENTRY *Entries, ULONG Count)
+{
+    ULONG length = FIELD_OFFSET(TAP_WIN_ND_PROXY, Entries) + max(Count, 1) * sizeof(TAP_WIN_ND_PROXY_ENTRY);
+
+    Config->EntryCount = Count;
+    memcpy(Config->Entries, Entries, Count * sizeof(TAP_WIN_ND_PROXY_ENTRY));
+
+    return TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_ND_PROXY, Config, length, sizeof(ULONG), NULL);
+}
+
+static VOID
+Entry(TAP_WIN_ND_PROXY_ENTRY *Entry, const char *Address, ULONG PrefixLength, UCHAR MacTag)
+{
+    memset(Entry, 0, sizeof(*Entry));
+    memcpy(Entry->Address, Address, 16);
+    Entry->PrefixLength = (UCHAR)PrefixLength;
+    memcpy(Entry->Mac, "\x02\x00\x00\x00\x00", 5);
+    Entry->Mac[5] = MacTag;
+}
+
+// The tag of the MAC the proxy answers Target with, 0 if it does not.
+static UCHAR
+Lookup(const char *Target, BOOLEAN Dad)
+{
+    UCHAR frame[NS_LENGTH];
+    UCHAR rso;
+    UCHAR mac[6];
+
+    BuildSolicitation(frame, (const UCHAR *)Target, Dad);
+
+    // The MAC is checked by Process against what was advertised: learn it first.
+    if(!tapNdProxyProcess(Adapter, frame, NS_LENGTH))
+    {
+        ReturnIndicated();
+        return 0;
+    }
+
+    ReturnIndicated();
+    memcpy(mac, ((const ICMPV6_NA_PKT *)Advertisement)->icmpv6.target_macaddr, 6);
+
+    CHECK(Process(frame, NS_LENGTH, mac, &rso));
+    return mac[5];
+}
+
+static VOID
+TestLongestPrefix(VOID)
+{
+    TAP_WIN_ND_PROXY_ENTRY entries[8];
+
+    //                           2001:db8:...
+    Entry(&entries[0], "\x20\x01\x0d\xb8\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 48, 1);
+    Entry(&entries[1], "\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x00", 64, 2);
+    Entry(&entries[2], "\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x99", 128, 3);
+    // Not byte aligned, with host bits set in the configured address.
+    Entry(&entries[3], "\x20\x01\x0d\xb8\x00\x01\x00\x0f\xff\xff\x00\x00\x00\x00\x00\x00", 61, 4);
+    // A duplicate of entries[1] after masking: the first wins.
+    Entry(&entries[4], "\x20\x01\x0d\xb8\x00\x01\x00\x02\x12\x34\x00\x00\x00\x00\x00\x00", 64, 5);
+    Entry(&entries[5], "\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x99", 127, 6);
+
+    CHECK_EQ(Configure(entries, 6), STATUS_SUCCESS);
+
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x99", FALSE), 3);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x98", FALSE), 6);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x97", FALSE), 2);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x03\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 1);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x08\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 4);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x0f\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 4);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x10\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 1);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x02\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 0);
+
+    // DAD probes are answered for /128 entries only, with Override set;
+    // so are ordinary solicitations for them.
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x99", TRUE), 3);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x98", TRUE), 0);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x03\x00\x00\x00\x00\x00\x00\x00\x01", TRUE), 0);
+    CHECK(((const ICMPV6_NA_PKT *)Advertisement)->icmpv6.rso_bits & ICMPV6_NA_OVERRIDE);
+
+    {
+        UCHAR frame[NS_LENGTH];
+        UCHAR rso;
+        UCHAR mac[6] = { 0x02, 0, 0, 0, 0, 2 };
+
+        BuildSolicitation(frame, (const UCHAR *)"\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x01", FALSE);
+        CHECK(Process(frame, NS_LENGTH, mac, &rso));
+        CHECK_EQ(rso, ICMPV6_NA_SOLICITED);
+    }
+
+    // A /0 entry answers for everything not covered by a longer one.
+    Entry(&entries[6], "\x30\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 0, 7);
+    CHECK_EQ(Configure(entries, 7), STATUS_SUCCESS);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x02\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 7);
+    CHECK_EQ(Lookup("\xfe\x80\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 7);
+    CHECK_EQ(Lookup("\x20\x01\x0d\xb8\x00\x01\x00\x02\x00\x00\x00\x00\x00\x00\x00\x99", FALSE), 3);
+
+    // Rejected configurations leave the table as it was.
+    Entry(&entries[7], "\x20\x01\x0d\xb8\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 129, 8);
+    CHECK(Configure(entries, 8) != STATUS_SUCCESS);
+    CHECK_EQ(Lookup("\xfe\x80\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 7);
+
+    Config->EntryCount = TAP_WIN_ND_PROXY_MAX_ENTRIES + 1;
+    CHECK(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_ND_PROXY, Config,
+        FIELD_OFFSET(TAP_WIN_ND_PROXY, Entries) + TAP_WIN_ND_PROXY_MAX_ENTRIES * sizeof(TAP_WIN_ND_PROXY_ENTRY),
+        sizeof(ULONG), NULL) != STATUS_SUCCESS);
+    CHECK_EQ(Lookup("\xfe\x80\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01", FALSE), 7);
+
+    // No entries: off.
+    CHECK_EQ(Configure(entries, 0), STATUS_SUCCESS);
+    CHECK(Adapter->NdProxy == NULL);
+}
+
+// Solicitations the proxy must leave alone, each one field off a good one.
+static VOID
+TestParser(VOID)
+{
+    static const UCHAR target[16] =
+        { 0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0x42 };
+    TAP_WIN_ND_PROXY_ENTRY entry;
+    UCHAR frame[NS_LENGTH];
+    UCHAR mac[6] = { 0x02, 0, 0, 0, 0, 9 };
+    IPV6HDR *ipv6 = (IPV6HDR *)(frame + sizeof(ETH_HEADER));
+    ICMPV6_NS *ns = (ICMPV6_NS *)(ipv6 + 1);
+    UCHAR rso;
+    ULONG i;
+
+    Entry(&entry, (const char *)target, 64, 9);
+    CHECK_EQ(Configure(&entry, 1), STATUS_SUCCESS);
+
+    BuildSolicitation(frame, target, FALSE);
+    CHECK(Process(frame, NS_LENGTH, mac, &rso));
+
+    // To the target itself (neighbor unreachability detection).
+    memcpy(ipv6->daddr, target, 16);
+    CHECK(Process(frame, NS_LENGTH, mac, &rso));
+
+    // ... but a DAD probe must go to the solicited-node address.
+    memset(ipv6->saddr, 0, 16);
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    // Truncated, down to the Ethernet header.
+    BuildSolicitation(frame, target, FALSE);
+    CHECK(Process(frame, sizeof(ETH_HEADER) + sizeof(IPV6HDR) + sizeof(ICMPV6_NS), mac, &rso));
+    for(i = sizeof(ETH_HEADER); i < sizeof(ETH_HEADER) + sizeof(IPV6HDR) + sizeof(ICMPV6_NS); ++i)
+    {
+        CHECK(!Process(frame, i, mac, &rso));
+    }
+
+    BuildSolicitation(frame, target, FALSE);
+    ipv6->nexthdr = 0;      // Hop-by-hop options: not followed
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    BuildSolicitation(frame, target, FALSE);
+    ipv6->hop_limit = 254;  // Forwarded
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    BuildSolicitation(frame, target, FALSE);
+    ipv6->payload_len = htons(sizeof(ICMPV6_NS) - 1);
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    BuildSolicitation(frame, target, FALSE);
+    ns->type = ICMPV6_TYPE_NA;
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    BuildSolicitation(frame, target, FALSE);
+    ns->code = 1;
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    // Another target's solicited-node address.
+    BuildSolicitation(frame, target, FALSE);
+    ipv6->daddr[15] ^= 1;
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    BuildSolicitation(frame, target, FALSE);
+    ipv6->daddr[11] = 0;
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    // A multicast target, even one covered by an entry.
+    Entry(&entry, "\xff\x02\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 8, 9);
+    CHECK_EQ(Configure(&entry, 1), STATUS_SUCCESS);
+    BuildSolicitation(frame, (const UCHAR *)"\xff\x02\0\0\0\0\0\0\0\0\0\0\0\0\0\x42", FALSE);
+    CHECK(!Process(frame, NS_LENGTH, mac, &rso));
+
+    CHECK_EQ(Configure(&entry, 0), STATUS_SUCCESS);
+}
+
+// In TUN mode the peer's MAC is advertised, whatever the entry says.
+static VOID
+TestTun(VOID)
+{
+    static const UCHAR target[16] =
+        { 0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0x42 };
+    TAP_WIN_ND_PROXY_ENTRY entry;
+    UCHAR frame[NS_LENGTH];
+    IPADDR addresses[3];
+    UCHAR rso;
+
+    addresses[0] = htonl(0x0A000001);
+    addresses[1] = htonl(0x0A000002);
+    addresses[2] = 0xFFFFFFFF;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_TUN, addresses,
+        sizeof(addresses), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    Entry(&entry, (const char *)target, 64, 9);
+    CHECK_EQ(Configure(&entry, 1), STATUS_SUCCESS);
+
+    BuildSolicitation(frame, target, FALSE);
+    CHECK(Process(frame, NS_LENGTH, Adapter->m_TapToUser.dest, &rso));
+
+    CHECK_EQ(Configure(&entry, 0), STATUS_SUCCESS);
+    Adapter->m_tun = FALSE;
+}
+
+// A solicitation the host sends through the adapter is answered, not
+// queued to the handle; one the table does not cover reaches the handle.
+static VOID
+TestTransmit(VOID)
+{
+    static const UCHAR covered[16] =
+        { 0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0x42 };
+    static const UCHAR other[16] =
+        { 0x20, 0x01, 0x0d, 0xb8, 0, 9, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0x42 };
+    static UCHAR readBuffer[2048];
+    TAP_WIN_ND_PROXY_ENTRY entry;
+    UCHAR frame[NS_LENGTH];
+    PIRP irp = NULL;
+    ULONG before;
+
+    Entry(&entry, (const char *)covered, 64, 9);
+    CHECK_EQ(Configure(&entry, 1), STATUS_SUCCESS);
+
+    CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+
+    before = Advertisements;
+    BuildSolicitation(frame, covered, FALSE);
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(frame, NS_LENGTH));
+    ReturnIndicated();
+    CHECK_EQ(Advertisements, before + 1);
+    CHECK(!irp->HostCompleted);
+
+    BuildSolicitation(frame, other, FALSE);
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(frame, NS_LENGTH));
+    ReturnIndicated();
+    CHECK_EQ(Advertisements, before + 1);
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Information, NS_LENGTH);
+    CHECK(memcmp(readBuffer, frame, NS_LENGTH) == 0);
+    WdkHostFreeIrp(irp);
+
+    CHECK_EQ(Configure(&entry, 0), STATUS_SUCCESS);
+}
+
+//
+// A full table of random prefixes against a brute force search.
+//
+
+static ULONG64 Seed = 7;
+
+static ULONG
+Random(ULONG Range)
+{
+    Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+    return (ULONG)(Seed >> 33) % Range;
+}
+
+static BOOLEAN
+Covers(const TAP_WIN_ND_PROXY_ENTRY *Entry, const UCHAR *Address)
+{
+    ULONG bits = Entry->PrefixLength;
+    ULONG i;
+
+    for(i = 0; bits > 0; ++i, bits -= min(bits, 8))
+    {
+        UCHAR mask = (UCHAR)(0xFF00 >> min(bits, 8));
+
+        if((Entry->Address[i] ^ Address[i]) & mask)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static const TAP_WIN_ND_PROXY_ENTRY *
+BruteForce(const TAP_WIN_ND_PROXY_ENTRY *Entries, ULONG Count, const UCHAR *Address)
+{
+    const TAP_WIN_ND_PROXY_ENTRY *best = NULL;
+    ULONG i;
+
+    for(i = 0; i < Count; ++i)
+    {
+        // Longest wins; of equal ones the first.
+        if(Covers(&Entries[i], Address)
+            && (best == NULL || Entries[i].PrefixLength > best->PrefixLength))
+        {
+            best = &Entries[i];
+        }
+    }
+
+    return best;
+}
+
+static VOID
+RandomAddress(UCHAR *Address)
+{
+    static const UCHAR bases[4][4] =
+    {
+        { 0x20, 0x01, 0x0d, 0xb8 },
+        { 0x20, 0x01, 0x0d, 0xb9 },
+        { 0x2a, 0x00, 0x14, 0x50 },
+        { 0xfd, 0x00, 0x00, 0x00 },
+    };
+    ULONG i;
+
+    // Few distinct high bits, so that prefixes nest and collide.
+    memcpy(Address, bases[Random(4)], 4);
+    for(i = 4; i < 16; ++i)
+    {
+        Address[i] = (UCHAR)(i < 8 ? Random(4) : Random(256));
+    }
+}
+
+static VOID
+TestRandomTable(VOID)
+{
+    static TAP_WIN_ND_PROXY_ENTRY entries[TABLE_RANDOM_ENTRIES];
+    static const UCHAR lengths[] = { 16, 30, 32, 45, 48, 56, 61, 64, 72, 96, 112, 120, 127, 128 };
+    ULONG i;
+
+    for(i = 0; i < TABLE_RANDOM_ENTRIES; ++i)
+    {
+        RandomAddress(entries[i].Address);
+        entries[i].PrefixLength = lengths[Random(ARRAYSIZE(lengths))];
+        entries[i].Mac[0] = 0x02;
+        entries[i].Mac[4] = (UCHAR)(i >> 8);
+        entries[i].Mac[5] = (UCHAR)i;
+        entries[i].Reserved = 0;
+    }
+
+    CHECK_EQ(Configure(entries, TABLE_RANDOM_ENTRIES), STATUS_SUCCESS);
+
+    for(i = 0; i < TABLE_RANDOM_LOOKUPS; ++i)
+    {
+        const TAP_WIN_ND_PROXY_ENTRY *expected;
+        UCHAR target[16];
+        UCHAR frame[NS_LENGTH];
+        UCHAR rso;
+
+        // Half near an entry, half anywhere.
+        if(i & 1)
+        {
+            const TAP_WIN_ND_PROXY_ENTRY *near = &entries[Random(TABLE_RANDOM_ENTRIES)];
+            ULONG keep = Random(near->PrefixLength + 1);
+            ULONG b;
+
+            RandomAddress(target);
+            for(b = 0; b < keep; ++b)
+            {
+                UCHAR mask = (UCHAR)(0x80 >> (b % 8));
+
+                target[b / 8] = (target[b / 8] & ~mask) | (near->Address[b / 8] & mask);
+            }
+        }
+        else
+        {
+            RandomAddress(target);
+        }
+
+        expected = BruteForce(entries, TABLE_RANDOM_ENTRIES, target);
+        BuildSolicitation(frame, target, FALSE);
+
+        if(expected == NULL)
+        {
+            CHECK(!Process(frame, NS_LENGTH, NULL, &rso));
+        }
+        else
+        {
+            CHECK(Process(frame, NS_LENGTH, expected->Mac, &rso));
+            CHECK_EQ(!!(rso & ICMPV6_NA_OVERRIDE), expected->PrefixLength == 128);
+        }
+    }
+
+    CHECK_EQ(Configure(entries, 0), STATUS_SUCCESS);
+}
+
+int
+main(void)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_ALL_MULTICAST;
+    ULONG value = TRUE;
+
+    Config = malloc(FIELD_OFFSET(TAP_WIN_ND_PROXY, Entries)
+        + TAP_WIN_ND_PROXY_MAX_ENTRIES * sizeof(TAP_WIN_ND_PROXY_ENTRY));
+    CHECK(Config != NULL);
+
+    WdkHostSetReceiveHook(TakeIndications, NULL);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestLongestPrefix();
+    TestParser();
+    TestTransmit();
+    TestRandomTable();
+    TestTun();
+
+    TapHostClose(File);
+    ReturnIndicated();
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    free(Config);
+
+    return 0;
+}
@@ -0,0 +1,469 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Proxy ARP (proxyarp.c), through the adapter: ARP requests the host
+// sends are answered from the table, longest prefix first, or passed
+// to the handle; probes and announcements always are. Senders of ARP
+// frames written to the handle are learned, recycled least recently
+// seen first and forgotten after five minutes, and never override a
+// configured /32.
+//======================================================================
+
+#include "taphost.h"
+
+#define PROXY_NOW           10000000ull     // 1s, in 100ns units
+#define PROXY_SECOND        10000000ull
+#define PROXY_HOST_IP       0x0A000002      // 10.0.0.2
+#define PROXY_MAX_ENTRIES   8
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+//
+// What the driver indicates to the host.
+//
+
+static ARP_PACKET Reply;
+static ULONG Replies;
+static PNET_BUFFER_LIST Indicated;
+
+static VOID
+TakeIndications(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    CHECK_EQ(NumberOfNetBufferLists, 1);
+
+    memset(&Reply, 0, sizeof(Reply));
+    WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(NetBufferLists),
+        (PUCHAR)&Reply, sizeof(Reply));
+    ++Replies;
+
+    if(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES))
+    {
+        CHECK(Indicated == NULL);
+        Indicated = NetBufferLists;
+    }
+}
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    CHECK(NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) == NULL);
+    WdkHostFreeNetBufferList(NetBufferLists);
+}
+
+// Runs the inject DPC and returns what it indicated.
+static VOID
+ReturnIndicated(VOID)
+{
+    WdkHostRunDpcs();
+
+    if(Indicated != NULL)
+    {
+        PNET_BUFFER_LIST nbl = Indicated;
+
+        Indicated = NULL;
+        TapHostReturn(Adapter, nbl);
+    }
+}
+
+//
+// ARP frames.
+//
+
+static VOID
+Mac(UCHAR *Mac, UCHAR Tag)
+{
+    memcpy(Mac, "\x02\x00\x5e\x00\x00", 5);
+    Mac[5] = Tag;
+}
+
+static VOID
+BuildArp(ARP_PACKET *Arp, USHORT Operation, const UCHAR *SenderMac, ULONG SenderIp, ULONG TargetIp)
+{
+    memset(Arp, 0, sizeof(*Arp));
+
+    memset(Arp->m_MAC_Destination, 0xFF, sizeof(MACADDR));
+    ETH_COPY_NETWORK_ADDRESS(Arp->m_MAC_Source, SenderMac);
+    Arp->m_Proto = htons(NDIS_ETH_TYPE_ARP);
+    Arp->m_MAC_AddressType = htons(MAC_ADDR_TYPE);
+    Arp->m_PROTO_AddressType = htons(NDIS_ETH_TYPE_IPV4);
+    Arp->m_MAC_AddressSize = sizeof(MACADDR);
+    Arp->m_PROTO_AddressSize = sizeof(IPADDR);
+    Arp->m_ARP_Operation = htons(Operation);
+    ETH_COPY_NETWORK_ADDRESS(Arp->m_ARP_MAC_Source, SenderMac);
+    Arp->m_ARP_IP_Source = htonl(SenderIp);
+    Arp->m_ARP_IP_Destination = htonl(TargetIp);
+}
+
+// Sends Request from the host. Returns the tag of the MAC it was
+// answered with, having checked the reply, or 0 if it was passed to
+// the handle instead.
+static UCHAR
+Send(const ARP_PACKET *Request)
+{
+    static UCHAR readBuffer[2048];
+    ULONG replies = Replies;
+    PIRP irp = NULL;
+
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList((PUCHAR)Request, sizeof(*Request)));
+    ReturnIndicated();
+
+    if(Replies == replies)
+    {
+        CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+        CHECK(irp->HostCompleted);
+        CHECK_EQ(irp->IoStatus.Information, sizeof(*Request));
+        CHECK(memcmp(readBuffer, Request, sizeof(*Request)) == 0);
+        WdkHostFreeIrp(irp);
+        return 0;
+    }
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK_EQ(Adapter->Queues[0].SendPacketQueue.Count, 0);
+
+    CHECK_EQ(Reply.m_Proto, htons(NDIS_ETH_TYPE_ARP));
+    CHECK_EQ(Reply.m_ARP_Operation, htons(ARP_REPLY));
+    CHECK(memcmp(Reply.m_MAC_Destination, Request->m_ARP_MAC_Source, sizeof(MACADDR)) == 0);
+    CHECK(memcmp(Reply.m_ARP_MAC_Destination, Request->m_ARP_MAC_Source, sizeof(MACADDR)) == 0);
+    CHECK(memcmp(Reply.m_MAC_Source, Reply.m_ARP_MAC_Source, sizeof(MACADDR)) == 0);
+    CHECK_EQ(Reply.m_ARP_IP_Source, Request->m_ARP_IP_Destination);
+    CHECK_EQ(Reply.m_ARP_IP_Destination, Request->m_ARP_IP_Source);
+
+    return Reply.m_ARP_MAC_Source[5];
+}
+
+// The tag Target is answered with, for a request from the host.
+static UCHAR
+Ask(ULONG Target)
+{
+    ARP_PACKET request;
+
+    BuildArp(&request, ARP_REQUEST, Adapter->CurrentAddress, PROXY_HOST_IP, Target);
+    return Send(&request);
+}
+
+// Writes an ARP reply from Sender, with the MAC tagged Tag, to the
+// handle; it reaches the host as well.
+static VOID
+Write(ULONG Sender, UCHAR Tag)
+{
+    ARP_PACKET frame;
+    UCHAR mac[6];
+    PIRP irp = NULL;
+
+    Mac(mac, Tag);
+    BuildArp(&frame, ARP_REPLY, mac, Sender, PROXY_HOST_IP);
+    ETH_COPY_NETWORK_ADDRESS(frame.m_MAC_Destination, Adapter->CurrentAddress);
+    ETH_COPY_NETWORK_ADDRESS(frame.m_ARP_MAC_Destination, Adapter->CurrentAddress);
+
+    CHECK_EQ(TapHostWrite(File, &frame, sizeof(frame), &irp), STATUS_PENDING);
+    ReturnIndicated();
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    WdkHostFreeIrp(irp);
+}
+
+//
+// The table.
+//
+
+static TAP_WIN_PROXY_ARP *Config;
+
+static VOID
+Entry(TAP_WIN_PROXY_ARP_ENTRY *Entry, ULONG Address, ULONG PrefixLength, UCHAR Tag)
+{
+    memset(Entry, 0, sizeof(*Entry));
+    Entry->Address = htonl(Address);
+    Entry->PrefixLength = (UCHAR)PrefixLength;
+    Mac(Entry->Mac, Tag);
+}
+
+static NTSTATUS
+Configure(ULONG Flags, const TAP_WIN_PROXY_ARP_ENTRY *Entries, ULONG Count)
+{
+    ULONG length = FIELD_OFFSET(TAP_WIN_PROXY_ARP, Entries) + Count * sizeof(TAP_WIN_PROXY_ARP_ENTRY);
+
+    CHECK(Count <= PROXY_MAX_ENTRIES);
+
+    Config->Flags = Flags;
+    Config->EntryCount = Count;
+    memcpy(Config->Entries, Entries, Count * sizeof(TAP_WIN_PROXY_ARP_ENTRY));
+
+    return TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_PROXY_ARP, Config, length, sizeof(ULONG), NULL);
+}
+
+//
+// The tests.
+//
+
+// The longest covering prefix answers, whatever the order it was
+// configured in; of duplicates the first does.
+static VOID
+TestLongestPrefix(VOID)
+{
+    TAP_WIN_PROXY_ARP_ENTRY entries[PROXY_MAX_ENTRIES];
+    TAP_WIN_PROXY_ARP_ENTRY reversed[PROXY_MAX_ENTRIES];
+    ULONG pass;
+    ULONG i;
+
+    Entry(&entries[0], 0x0A010000, 16, 1);      // 10.1.0.0/16
+    Entry(&entries[1], 0x0A010200, 24, 2);      // 10.1.2.0/24
+    Entry(&entries[2], 0x0A010203, 32, 3);      // 10.1.2.3/32
+    Entry(&entries[3], 0x0A0102FF, 24, 4);      // 10.1.2.0/24 again, host bits set
+    Entry(&entries[4], 0xAC100000, 12, 5);      // 172.16.0.0/12
+
+    for(i = 0; i < 5; ++i)
+    {
+        reversed[i] = entries[4 - i];
+    }
+
+    for(pass = 0; pass < 2; ++pass)
+    {
+        CHECK_EQ(Configure(0, pass ? reversed : entries, 5), STATUS_SUCCESS);
+
+        CHECK_EQ(Ask(0x0A010203), 3);
+        CHECK_EQ(Ask(0x0A010204), pass ? 4 : 2);
+        CHECK_EQ(Ask(0x0A0102FE), pass ? 4 : 2);
+        CHECK_EQ(Ask(0x0A01FF01), 1);
+        CHECK_EQ(Ask(0x0A020203), 0);
+        CHECK_EQ(Ask(0xAC1F0001), 5);
+        CHECK_EQ(Ask(0xAC200001), 0);
+    }
+
+    // A default route covers the rest.
+    Entry(&entries[5], 0, 0, 6);
+    CHECK_EQ(Configure(0, entries, 6), STATUS_SUCCESS);
+    CHECK_EQ(Ask(0x0A020203), 6);
+    CHECK_EQ(Ask(0x0A010203), 3);
+
+    // Prefixes longer than 32 are refused, leaving the table alone.
+    Entry(&entries[6], 0x0A030000, 33, 7);
+    CHECK_EQ(Configure(0, entries, 7), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Configure(TAP_WIN_PROXY_ARP_LEARN << 1, entries, 1), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Ask(0x0A020203), 6);
+
+    CHECK_EQ(Configure(0, NULL, 0), STATUS_SUCCESS);
+    CHECK(Adapter->ProxyArp == NULL);
+    CHECK_EQ(Ask(0x0A010203), 0);
+}
+
+// Address probes (from 0.0.0.0), announcements (for the sender's own
+// address) and anything but a request reach the handle.
+static VOID
+TestIgnored(VOID)
+{
+    TAP_WIN_PROXY_ARP_ENTRY entry;
+    ARP_PACKET request;
+
+    Entry(&entry, 0, 0, 1);
+    CHECK_EQ(Configure(0, &entry, 1), STATUS_SUCCESS);
+
+    BuildArp(&request, ARP_REQUEST, Adapter->CurrentAddress, 0, 0x0A000005);
+    CHECK_EQ(Send(&request), 0);
+
+    BuildArp(&request, ARP_REQUEST, Adapter->CurrentAddress, 0x0A000005, 0x0A000005);
+    CHECK_EQ(Send(&request), 0);
+
+    BuildArp(&request, ARP_REPLY, Adapter->CurrentAddress, PROXY_HOST_IP, 0x0A000005);
+    CHECK_EQ(Send(&request), 0);
+
+    BuildArp(&request, ARP_REQUEST, Adapter->CurrentAddress, PROXY_HOST_IP, 0x0A000005);
+    request.m_PROTO_AddressType = htons(NDIS_ETH_TYPE_IPV6);
+    CHECK_EQ(Send(&request), 0);
+
+    BuildArp(&request, ARP_REQUEST, Adapter->CurrentAddress, PROXY_HOST_IP, 0x0A000005);
+    CHECK_EQ(Send(&request), 1);
+
+    CHECK_EQ(Configure(0, NULL, 0), STATUS_SUCCESS);
+}
+
+// With TAP_WIN_PROXY_ARP_LEARN, the sender of an ARP frame written to
+// the handle is answered for, with its latest MAC, until five minutes
+// after it was last seen; without it nothing is learned.
+static VOID
+TestLearn(VOID)
+{
+    ARP_PACKET frame;
+    UCHAR mac[6];
+    PIRP irp = NULL;
+
+    CHECK_EQ(Configure(0, NULL, 0), STATUS_SUCCESS);
+    Write(0x0A050007, 0x20);
+    CHECK_EQ(Ask(0x0A050007), 0);
+
+    CHECK_EQ(Configure(TAP_WIN_PROXY_ARP_LEARN, NULL, 0), STATUS_SUCCESS);
+    CHECK(Adapter->ProxyArp != NULL);
+    CHECK_EQ(Ask(0x0A050007), 0);
+
+    Write(0x0A050007, 0x21);
+    CHECK_EQ(Ask(0x0A050007), 0x21);
+    CHECK_EQ(Ask(0x0A050008), 0);
+
+    Write(0x0A050007, 0x22);
+    CHECK_EQ(Ask(0x0A050007), 0x22);
+
+    // Not from 0.0.0.0, nor a multicast MAC.
+    Write(0, 0x23);
+    CHECK_EQ(Ask(0), 0);
+    Mac(mac, 0x24);
+    mac[0] |= 0x01;
+    BuildArp(&frame, ARP_REPLY, mac, 0x0A050009, PROXY_HOST_IP);
+    CHECK_EQ(TapHostWrite(File, &frame, sizeof(frame), &irp), STATUS_PENDING);
+    ReturnIndicated();
+    CHECK(irp->HostCompleted);
+    WdkHostFreeIrp(irp);
+    CHECK_EQ(Ask(0x0A050009), 0);
+
+    // Five minutes to the second, then forgotten.
+    WdkHostAdvanceClock(TAP_PROXY_ARP_LEARN_AGE * PROXY_SECOND);
+    CHECK_EQ(Ask(0x0A050007), 0x22);
+    WdkHostAdvanceClock(PROXY_SECOND);
+    CHECK_EQ(Ask(0x0A050007), 0);
+
+    // Seen again, answered again.
+    Write(0x0A050007, 0x25);
+    CHECK_EQ(Ask(0x0A050007), 0x25);
+
+    // Reconfiguring forgets.
+    CHECK_EQ(Configure(TAP_WIN_PROXY_ARP_LEARN, NULL, 0), STATUS_SUCCESS);
+    CHECK_EQ(Ask(0x0A050007), 0);
+}
+
+// Once TAP_PROXY_ARP_MAX_LEARNED hosts are learned, the next one takes
+// the entry of the one least recently seen.
+static VOID
+TestRecycle(VOID)
+{
+    ULONG i;
+
+    CHECK_EQ(Configure(TAP_WIN_PROXY_ARP_LEARN, NULL, 0), STATUS_SUCCESS);
+
+    for(i = 0; i < TAP_PROXY_ARP_MAX_LEARNED; ++i)
+    {
+        Write(0x0A060000 + i, (UCHAR)(i | 1));
+    }
+
+    // Seen again: now the most recent.
+    Write(0x0A060000, 0x41);
+
+    Write(0x0A070000, 0x43);
+    CHECK_EQ(Ask(0x0A070000), 0x43);
+    CHECK_EQ(Ask(0x0A060000), 0x41);
+    CHECK_EQ(Ask(0x0A060001), 0);
+    CHECK_EQ(Ask(0x0A060002), 3);
+
+    Write(0x0A070001, 0x45);
+    CHECK_EQ(Ask(0x0A070001), 0x45);
+    CHECK_EQ(Ask(0x0A060002), 0);
+    CHECK_EQ(Ask(0x0A060003), 3);
+    CHECK_EQ(Ask(0x0A060000 + TAP_PROXY_ARP_MAX_LEARNED - 1), 0xFF);
+
+    CHECK_EQ(Configure(0, NULL, 0), STATUS_SUCCESS);
+}
+
+// A configured /32 keeps its MAC whatever the handle writes; a learned
+// /32 is longer than any other configured prefix, so it wins over it.
+static VOID
+TestConfiguredFirst(VOID)
+{
+    TAP_WIN_PROXY_ARP_ENTRY entries[2];
+
+    Entry(&entries[0], 0x0A080001, 32, 0x51);
+    Entry(&entries[1], 0x0A080000, 24, 0x52);
+    CHECK_EQ(Configure(TAP_WIN_PROXY_ARP_LEARN, entries, 2), STATUS_SUCCESS);
+
+    Write(0x0A080001, 0x61);
+    CHECK_EQ(Ask(0x0A080001), 0x51);
+
+    // Nor does it age.
+    WdkHostAdvanceClock((TAP_PROXY_ARP_LEARN_AGE + 1) * PROXY_SECOND);
+    CHECK_EQ(Ask(0x0A080001), 0x51);
+
+    CHECK_EQ(Ask(0x0A080002), 0x52);
+    Write(0x0A080002, 0x62);
+    CHECK_EQ(Ask(0x0A080002), 0x62);
+    CHECK_EQ(Ask(0x0A080003), 0x52);
+
+    // Once the learned one ages out, the prefix answers again.
+    WdkHostAdvanceClock((TAP_PROXY_ARP_LEARN_AGE + 1) * PROXY_SECOND);
+    CHECK_EQ(Ask(0x0A080002), 0x52);
+
+    CHECK_EQ(Configure(0, NULL, 0), STATUS_SUCCESS);
+}
+
+int
+main(void)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value = TRUE;
+
+    Config = malloc(FIELD_OFFSET(TAP_WIN_PROXY_ARP, Entries)
+        + PROXY_MAX_ENTRIES * sizeof(TAP_WIN_PROXY_ARP_ENTRY));
+    CHECK(Config != NULL);
+
+    WdkHostFreezeClock(PROXY_NOW);
+    WdkHostSetReceiveHook(TakeIndications, NULL);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestLongestPrefix();
+    TestIgnored();
+    TestLearn();
+    TestRecycle();
+    TestConfiguredFirst();
+
+    TapHostClose(File);
+    ReturnIndicated();
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    free(Config);
+
+    return 0;
+}
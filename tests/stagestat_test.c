@@ -0,0 +1,163 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Stage timing (stagestat.h): which stages of a sampled operation are
+// counted and on which CPU's counters, including an operation that
+// moves to another CPU while it is timed.
+//======================================================================
+
+#include "taphost.h"
+
+#define STAGE_CPUS          4
+
+static TAP_STAGE_STATS Stats;
+
+static struct
+{
+    TAP_WIN_STAGE_STATS     Total;
+    TAP_WIN_STAGE_CPU_STATS Cpus[STAGE_CPUS];
+} Buffer;
+
+// Returns the counters and zeroes them, setting the interval.
+static VOID
+Query(ULONG SampleInterval)
+{
+    TAP_WIN_STAGE_STATS_CONTROL control;
+    BOOLEAN allocated = (Stats.Cpus != NULL);
+    ULONG written;
+
+    control.Flags = TAP_WIN_STAGE_STATS_SET_INTERVAL | TAP_WIN_STAGE_STATS_RESET;
+    control.SampleInterval = SampleInterval;
+
+    CHECK_EQ(tapStageStatsQuery(&Stats, &control, (PUCHAR)&Buffer, sizeof(Buffer), &written),
+        STATUS_SUCCESS);
+
+    // The per-CPU counters follow once sampling has been on.
+    CHECK_EQ(written, allocated ? sizeof(Buffer) : sizeof(Buffer.Total));
+}
+
+static ULONG64
+Samples(ULONG Cpu, ULONG Stage)
+{
+    return Buffer.Cpus[Cpu].Stages[Stage].Samples;
+}
+
+// One operation: each stage marked once, on CPU Cpu.
+static VOID
+Operation(ULONG Cpu)
+{
+    TAP_STAGE_TIMER timer;
+    ULONG stage;
+
+    WdkHostSetCurrentProcessor(Cpu);
+    tapStageTimerStart(&Stats, &timer);
+
+    for(stage = 0; stage < TAP_WIN_STAGE_COUNT; ++stage)
+    {
+        tapStageTimerMark(&timer, stage);
+    }
+}
+
+// Every operation is sampled with an interval of 1, one in N otherwise,
+// each on the counters of its CPU.
+static VOID
+TestInterval(VOID)
+{
+    ULONG i;
+
+    Query(1);
+
+    for(i = 0; i < 10; ++i)
+    {
+        Operation(1);
+    }
+
+    Query(5);
+    CHECK_EQ(Samples(1, TAP_WIN_STAGE_TX_COPY), 10);
+    CHECK_EQ(Samples(0, TAP_WIN_STAGE_TX_COPY), 0);
+    CHECK_EQ(Buffer.Total.Stages[TAP_WIN_STAGE_TX_COPY].Samples, 10);
+
+    for(i = 0; i < 20; ++i)
+    {
+        Operation(2);
+    }
+
+    Query(0);
+    CHECK_EQ(Samples(2, TAP_WIN_STAGE_TX_ALLOCATE), 4);
+    CHECK_EQ(Samples(2, TAP_WIN_STAGE_WRITE_INDICATE), 4);
+
+    // Off: nothing counted.
+    Operation(2);
+    Query(1);
+    CHECK_EQ(Buffer.Total.Stages[TAP_WIN_STAGE_TX_ALLOCATE].Samples, 0);
+}
+
+// A stage the operation moved CPU in is discarded; the stages before
+// and after it are counted, on the CPU it started on.
+static VOID
+TestMigration(VOID)
+{
+    TAP_STAGE_TIMER timer;
+
+    Query(1);
+
+    WdkHostSetCurrentProcessor(1);
+    tapStageTimerStart(&Stats, &timer);
+    tapStageTimerMark(&timer, TAP_WIN_STAGE_WRITE_MAP);
+
+    WdkHostSetCurrentProcessor(3);
+    tapStageTimerMark(&timer, TAP_WIN_STAGE_WRITE_FILTER);
+    tapStageTimerMark(&timer, TAP_WIN_STAGE_WRITE_BUILD_NBL);
+
+    // Moved again, then skipped: the skip starts the next stage afresh.
+    WdkHostSetCurrentProcessor(0);
+    tapStageTimerSkip(&timer);
+    tapStageTimerMark(&timer, TAP_WIN_STAGE_WRITE_INDICATE);
+
+    Query(0);
+    CHECK_EQ(Samples(1, TAP_WIN_STAGE_WRITE_MAP), 1);
+    CHECK_EQ(Samples(1, TAP_WIN_STAGE_WRITE_FILTER), 0);
+    CHECK_EQ(Samples(1, TAP_WIN_STAGE_WRITE_BUILD_NBL), 1);
+    CHECK_EQ(Samples(1, TAP_WIN_STAGE_WRITE_INDICATE), 1);
+    CHECK_EQ(Buffer.Total.Stages[TAP_WIN_STAGE_WRITE_FILTER].Samples, 0);
+    CHECK_EQ(Buffer.Total.Stages[TAP_WIN_STAGE_WRITE_BUILD_NBL].Samples, 1);
+    CHECK_EQ(Samples(3, TAP_WIN_STAGE_WRITE_BUILD_NBL), 0);
+}
+
+int
+main(void)
+{
+    WdkHostSetProcessorCount(STAGE_CPUS);
+
+    TestInterval();
+    TestMigration();
+
+    tapStageStatsFree(&Stats);
+    WdkHostSetCurrentProcessor(0);
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Statistics page (statpage.c): mapped only by the process that opened
+// the diag handle, unmapped in that process whether the handle is
+// cleaned up there or elsewhere, and read consistently under its
+// sequence count while the DPC rewrites it.
+//======================================================================
+
+#include "taphost.h"
+
+#include <pthread.h>
+
+#define STATS_NOW           10000000ull     // 1s, in 100ns units
+#define STATS_INTERVAL      (TAP_STATS_PAGE_INTERVAL * 10000ull)
+#define STATS_OWNER         100
+#define STATS_OTHER         200
+#define STATS_UPDATES       100000
+#define STATS_FRAME_BYTES   60
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+
+static NTSTATUS
+Map(PFILE_OBJECT File, ULONG64 *Address)
+{
+    ULONG_PTR information = 0;
+    NTSTATUS status;
+
+    *Address = 0;
+    status = TapHostIoctl(File, TAP_WIN_IOCTL_MAP_STATS_PAGE, Address,
+        0, sizeof(*Address), &information);
+    CHECK_EQ(information, NT_SUCCESS(status) ? sizeof(*Address) : 0);
+
+    return status;
+}
+
+static PFILE_OBJECT
+OpenAs(ULONG_PTR Process)
+{
+    PFILE_OBJECT file;
+
+    WdkHostSetCurrentProcess(Process);
+    file = TapHostOpen(Adapter->DiagDeviceObject);
+    CHECK(file != NULL);
+
+    return file;
+}
+
+static VOID
+CloseAs(ULONG_PTR Process, PFILE_OBJECT File)
+{
+    WdkHostSetCurrentProcess(Process);
+    TapHostClose(File);
+}
+
+// Only the opener maps; a second map on the handle returns the first.
+static VOID
+TestOwner(VOID)
+{
+    PFILE_OBJECT file = OpenAs(STATS_OWNER);
+    LONG refCount = Adapter->RefCount;
+    ULONG64 address;
+    ULONG64 again;
+
+    WdkHostSetCurrentProcess(STATS_OTHER);
+    CHECK_EQ(Map(file, &address), STATUS_ACCESS_DENIED);
+    CHECK_EQ(WdkHostCounters.UserMappings, 0);
+
+    WdkHostSetCurrentProcess(STATS_OWNER);
+    CHECK_EQ(Map(file, &address), STATUS_SUCCESS);
+    CHECK(address == (ULONG64)(ULONG_PTR)Adapter->StatsPage.Page);
+    CHECK_EQ(Map(file, &again), STATUS_SUCCESS);
+    CHECK(again == address);
+
+    CHECK_EQ(WdkHostProcessUserMappings(STATS_OWNER), 1);
+    CHECK_EQ(Adapter->StatsPage.MappingCount, 1);
+    CHECK_EQ(Adapter->RefCount, refCount + 1);
+    CHECK_EQ(Adapter->StatsPage.Page->Version, TAP_WIN_STATS_PAGE_VERSION);
+    CHECK_EQ(Adapter->StatsPage.Page->Sequence % 2, 0);
+
+    CloseAs(STATS_OWNER, file);
+
+    CHECK_EQ(WdkHostCounters.UserMappings, 0);
+    CHECK_EQ(Adapter->StatsPage.MappingCount, 0);
+    CHECK_EQ(Adapter->RefCount, refCount - 1);
+}
+
+// A handle cleaned up in another process leaves the mapping, and the
+// adapter, until the process that made it exits.
+static VOID
+TestCleanupElsewhere(VOID)
+{
+    PFILE_OBJECT file = OpenAs(STATS_OWNER);
+    LONG refCount = Adapter->RefCount;
+    ULONG64 address;
+
+    CHECK_EQ(Map(file, &address), STATUS_SUCCESS);
+
+    CloseAs(STATS_OTHER, file);
+
+    CHECK_EQ(WdkHostProcessUserMappings(STATS_OWNER), 1);
+    CHECK_EQ(Adapter->StatsPage.MappingCount, 1);
+    CHECK_EQ(Adapter->RefCount, refCount);
+
+    WdkHostExitProcess(STATS_OTHER);
+    CHECK_EQ(WdkHostProcessUserMappings(STATS_OWNER), 1);
+
+    WdkHostExitProcess(STATS_OWNER);
+
+    CHECK_EQ(WdkHostCounters.UserMappings, 0);
+    CHECK_EQ(Adapter->StatsPage.MappingCount, 0);
+    CHECK_EQ(Adapter->RefCount, refCount - 1);
+}
+
+// The owner exiting with the handle still open elsewhere unmaps it; the
+// handle's cleanup then has nothing to do.
+static VOID
+TestExitFirst(VOID)
+{
+    PFILE_OBJECT file = OpenAs(STATS_OWNER);
+    ULONG64 address;
+
+    CHECK_EQ(Map(file, &address), STATUS_SUCCESS);
+
+    WdkHostExitProcess(STATS_OWNER);
+
+    CHECK_EQ(WdkHostCounters.UserMappings, 0);
+    CHECK_EQ(Adapter->StatsPage.MappingCount, 0);
+
+    CloseAs(STATS_OTHER, file);
+}
+
+//
+// The sequence count. The writer publishes frames and bytes that always
+// agree; a reader following the documented protocol must never see them
+// disagree.
+//
+
+static volatile LONG ReaderDone;
+
+typedef struct _STATS_READER
+{
+    const volatile TAP_WIN_STATS_PAGE *Page;
+    ULONG                       Reads;
+    ULONG                       Retries;
+    ULONG64                     LastFrames;
+} STATS_READER;
+
+static void *
+Reader(void *Context)
+{
+    STATS_READER *reader = Context;
+    const volatile TAP_WIN_STATS_PAGE *page = reader->Page;
+    ULONG64 framesRx;
+    ULONG64 bytesTx;
+    ULONG64 framesTx;
+    ULONG seq;
+
+    while(!ReaderDone)
+    {
+        for(;;)
+        {
+            seq = page->Sequence;
+            KeMemoryBarrier();
+
+            // Against the order they are written in, so a copy made
+            // while the writer is part way through disagrees.
+            framesRx = page->FramesRxDirected;
+            bytesTx = page->BytesTxDirected;
+            framesTx = page->FramesTxDirected;
+
+            KeMemoryBarrier();
+
+            if(!(seq & 1) && seq == page->Sequence)
+            {
+                break;
+            }
+
+            ++reader->Retries;
+        }
+
+        CHECK_EQ(bytesTx, framesTx * STATS_FRAME_BYTES);
+        CHECK_EQ(framesRx, framesTx);
+        CHECK(framesTx >= reader->LastFrames);
+
+        reader->LastFrames = framesTx;
+        ++reader->Reads;
+    }
+
+    return NULL;
+}
+
+static VOID
+TestSequence(VOID)
+{
+    PFILE_OBJECT file = OpenAs(STATS_OWNER);
+    TAP_WIN_STATS_PAGE *page;
+    STATS_READER reader;
+    pthread_t thread;
+    ULONG64 address;
+    ULONG sequence;
+    ULONG i;
+
+    CHECK_EQ(Map(file, &address), STATUS_SUCCESS);
+    page = (TAP_WIN_STATS_PAGE *)(ULONG_PTR)address;
+
+    // Each timer tick is one update, leaving the count even and 2 on.
+    sequence = page->Sequence;
+    WdkHostAdvanceClock(STATS_INTERVAL);
+    WdkHostRunDpcs();
+    CHECK_EQ(page->Sequence, sequence + 2);
+
+    memset(&reader, 0, sizeof(reader));
+    reader.Page = page;
+    ReaderDone = 0;
+    CHECK_EQ(pthread_create(&thread, NULL, Reader, &reader), 0);
+
+    for(i = 1; i <= STATS_UPDATES; ++i)
+    {
+        Adapter->FramesTxDirected = i;
+        Adapter->BytesTxDirected = (ULONG64)i * STATS_FRAME_BYTES;
+        Adapter->FramesRxDirected = i;
+
+        WdkHostAdvanceClock(STATS_INTERVAL);
+        WdkHostRunDpcs();
+    }
+
+    InterlockedExchange(&ReaderDone, 1);
+    CHECK_EQ(pthread_join(thread, NULL), 0);
+
+    CHECK(reader.Reads > 0);
+    CHECK_EQ(page->Sequence, sequence + 2 * (STATS_UPDATES + 1));
+    CHECK_EQ(page->FramesTxDirected, STATS_UPDATES);
+
+    printf("statpage: %u consistent reads, %u retries\n", reader.Reads, reader.Retries);
+
+    CloseAs(STATS_OWNER, file);
+
+    // No updates once unmapped.
+    sequence = page->Sequence;
+    WdkHostAdvanceClock(STATS_INTERVAL);
+    WdkHostRunDpcs();
+    CHECK_EQ(page->Sequence, sequence);
+
+    Adapter->FramesTxDirected = 0;
+    Adapter->BytesTxDirected = 0;
+    Adapter->FramesRxDirected = 0;
+}
+
+int
+main(void)
+{
+    WdkHostFreezeClock(STATS_NOW);
+
+    CHECK_EQ(TapHostLoadDriver(TRUE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    CHECK(Adapter->DiagDeviceObject != NULL);
+
+    TestOwner();
+    TestCleanupElsewhere();
+    TestExitFirst();
+    TestSequence();
+
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.UserMappings, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
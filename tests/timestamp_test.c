@@ -0,0 +1,393 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// Read timestamps (tapCopyReadTimestamp in txpath.c) on a frozen clock:
+// the TAP_WIN_READ_TIMESTAMP ahead of each frame read, with and without
+// its QueueDelay, in single-frame reads and behind each header of a
+// coalesced one; the header counted when a frame is fitted to the read
+// buffer; and the frames still read in the order they were sent.
+//======================================================================
+
+#include "taphost.h"
+
+#define STAMP_NOW           1000000ull
+#define STAMP_FRAME_LENGTH  60
+#define STAMP_FRAMES        5
+#define STAMP_READ_SIZE     4096
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    CHECK(NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) == NULL);
+    WdkHostFreeNetBufferList(NetBufferLists);
+}
+
+static ULONG64
+Now(VOID)
+{
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+static VOID
+SetFlags(ULONG Flags)
+{
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &Flags,
+        sizeof(Flags), sizeof(ULONG), NULL), STATUS_SUCCESS);
+}
+
+static VOID
+SetCoalescing(ULONG MaxFrames)
+{
+    TAP_WIN_READ_COALESCING coalescing;
+
+    coalescing.MaxFrames = MaxFrames;
+    coalescing.MaxBytes = 0;
+    coalescing.MaxMicroseconds = 0;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_READ_COALESCING, &coalescing,
+        sizeof(coalescing), 0, NULL), STATUS_SUCCESS);
+}
+
+// Frame Sequence is STAMP_FRAME_LENGTH + Sequence % 3 bytes long, so
+// that headers in a coalesced read fall at different alignments.
+static ULONG
+FrameLength(ULONG Sequence)
+{
+    return STAMP_FRAME_LENGTH + Sequence % 3;
+}
+
+static VOID
+Send(ULONG Sequence)
+{
+    UCHAR frame[STAMP_FRAME_LENGTH + 2];
+    ETH_HEADER *eth = (ETH_HEADER *)frame;
+
+    memset(frame, (int)Sequence, sizeof(frame));
+    memset(eth->dest, 0xFF, sizeof(MACADDR));
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(0x88B5);     // Local experimental
+    memcpy(frame + sizeof(ETH_HEADER), &Sequence, sizeof(Sequence));
+
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(frame, FrameLength(Sequence)));
+}
+
+static ULONG64
+TooSmall(VOID)
+{
+    TAP_WIN_DROP_STATS drops;
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+    return drops.Drops[TAP_WIN_DROP_READ_TOO_SMALL];
+}
+
+// Reads into a Length byte buffer; returns the IRP, completed.
+static PIRP
+Read(UCHAR *Buffer, ULONG Length)
+{
+    PIRP irp = NULL;
+
+    CHECK_EQ(TapHostRead(File, Buffer, Length, &irp), STATUS_PENDING);
+    CHECK(irp->HostCompleted);
+    return irp;
+}
+
+// Checks the timestamp and frame at Data: frame Sequence, queued at
+// EnqueueTime and read at ReadTime.
+static VOID
+CheckFrame(const UCHAR *Data, ULONG Flags, ULONG Sequence, ULONG64 EnqueueTime, ULONG64 ReadTime)
+{
+    TAP_WIN_READ_TIMESTAMP timestamp;
+    ULONG headerLength = TAP_WIN_READ_TIMESTAMP_LENGTH(Flags);
+    ULONG sequence;
+
+    // Possibly unaligned.
+    memset(&timestamp, 0, sizeof(timestamp));
+    memcpy(&timestamp, Data, headerLength);
+
+    CHECK_EQ(timestamp.EnqueueTime, EnqueueTime);
+    if(Flags & TAP_WIN_TIMESTAMP_QUEUE_DELAY)
+    {
+        CHECK_EQ(timestamp.QueueDelay, ReadTime - EnqueueTime);
+    }
+
+    memcpy(&sequence, Data + headerLength + sizeof(ETH_HEADER), sizeof(sequence));
+    CHECK_EQ(sequence, Sequence);
+    CHECK_EQ(Data[headerLength + FrameLength(Sequence) - 1], (UCHAR)Sequence);
+}
+
+//
+// The tests.
+//
+
+// The header is an EnqueueTime, then with QUEUE_DELAY a QueueDelay, with
+// no padding; QUEUE_DELAY is refused without READ.
+static VOID
+TestLayout(VOID)
+{
+    ULONG flags;
+
+    CHECK_EQ(FIELD_OFFSET(TAP_WIN_READ_TIMESTAMP, EnqueueTime), 0);
+    CHECK_EQ(FIELD_OFFSET(TAP_WIN_READ_TIMESTAMP, QueueDelay), 8);
+    CHECK_EQ(sizeof(TAP_WIN_READ_TIMESTAMP), 16);
+    CHECK_EQ(sizeof(TAP_WIN_WRITE_TIMESTAMP), 8);
+    CHECK_EQ(TAP_WIN_READ_TIMESTAMP_LENGTH(TAP_WIN_TIMESTAMP_READ), 8);
+    CHECK_EQ(TAP_WIN_READ_TIMESTAMP_LENGTH(TAP_WIN_TIMESTAMP_READ | TAP_WIN_TIMESTAMP_QUEUE_DELAY), 16);
+    CHECK_EQ(TAP_WIN_READ_TIMESTAMP_LENGTH(TAP_WIN_TIMESTAMP_FLAGS), 16);
+
+    flags = TAP_WIN_TIMESTAMP_QUEUE_DELAY;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &flags,
+        sizeof(flags), sizeof(ULONG), NULL), STATUS_INVALID_PARAMETER);
+    flags = TAP_WIN_TIMESTAMP_FLAGS + 1;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &flags,
+        sizeof(flags), sizeof(ULONG), NULL), STATUS_INVALID_PARAMETER);
+    flags = TAP_WIN_TIMESTAMP_READ;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_TIMESTAMPS, &flags,
+        sizeof(flags) - 1, sizeof(ULONG), NULL), STATUS_INVALID_PARAMETER);
+    CHECK_EQ(Adapter->TimestampFlags, 0);
+}
+
+// One frame per read: the timestamp, then the frame. A frame read as
+// soon as it is sent has waited no time at all.
+static VOID
+TestSingle(ULONG Flags)
+{
+    static UCHAR buffer[STAMP_READ_SIZE];
+    ULONG headerLength = TAP_WIN_READ_TIMESTAMP_LENGTH(Flags);
+    ULONG64 enqueueTimes[STAMP_FRAMES];
+    ULONG64 readTime;
+    PIRP irp = NULL;
+    ULONG i;
+
+    SetFlags(Flags);
+
+    for(i = 0; i < STAMP_FRAMES; ++i)
+    {
+        enqueueTimes[i] = Now();
+        Send(i);
+        WdkHostAdvanceClock(1000 * (i + 1));
+    }
+
+    for(i = 0; i < STAMP_FRAMES; ++i)
+    {
+        readTime = Now();
+        irp = Read(buffer, sizeof(buffer));
+        CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+        CHECK_EQ(irp->IoStatus.Information, headerLength + FrameLength(i));
+        CheckFrame(buffer, Flags, i, enqueueTimes[i], readTime);
+        WdkHostFreeIrp(irp);
+        WdkHostAdvanceClock(70);
+    }
+
+    CHECK_EQ(TapHostRead(File, buffer, sizeof(buffer), &irp), STATUS_PENDING);
+    CHECK(!irp->HostCompleted);
+    readTime = Now();
+    Send(STAMP_FRAMES);
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Information, headerLength + FrameLength(STAMP_FRAMES));
+    CheckFrame(buffer, Flags, STAMP_FRAMES, readTime, readTime);
+    WdkHostFreeIrp(irp);
+
+    SetFlags(0);
+}
+
+// Each frame of a coalesced read is a TAP_WIN_READ_FRAME header whose
+// Length counts the frame only, then the timestamp, then the frame.
+static VOID
+TestCoalesced(ULONG Flags)
+{
+    static UCHAR buffer[STAMP_READ_SIZE];
+    ULONG headerLength = TAP_WIN_READ_TIMESTAMP_LENGTH(Flags);
+    ULONG64 enqueueTimes[STAMP_FRAMES];
+    ULONG64 readTime;
+    ULONG offset = 0;
+    ULONG length;
+    PIRP irp;
+    ULONG i;
+
+    SetFlags(Flags);
+    SetCoalescing(STAMP_FRAMES);
+
+    for(i = 0; i < STAMP_FRAMES; ++i)
+    {
+        enqueueTimes[i] = Now();
+        Send(i);
+        WdkHostAdvanceClock(300 + i);
+    }
+
+    readTime = Now();
+    irp = Read(buffer, sizeof(buffer));
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    length = (ULONG)irp->IoStatus.Information;
+
+    for(i = 0; i < STAMP_FRAMES; ++i)
+    {
+        const TAP_WIN_READ_FRAME *header = (const TAP_WIN_READ_FRAME *)(buffer + offset);
+
+        CHECK(offset + sizeof(*header) + headerLength + FrameLength(i) <= length);
+        CHECK_EQ(header->Length, FrameLength(i));
+        CheckFrame(buffer + offset + sizeof(*header), Flags, i, enqueueTimes[i], readTime);
+
+        offset += sizeof(*header) + headerLength + header->Length;
+        if(i == STAMP_FRAMES - 1)
+        {
+            CHECK_EQ(offset, length);
+        }
+        offset = (offset + TAP_WIN_READ_FRAME_ALIGN - 1) & ~(TAP_WIN_READ_FRAME_ALIGN - 1);
+    }
+
+    WdkHostFreeIrp(irp);
+
+    SetCoalescing(0);
+    SetFlags(0);
+}
+
+// A read buffer must hold the timestamp as well as the frame: one byte
+// short, the frame is dropped and the read fails.
+static VOID
+TestFit(ULONG Flags, BOOLEAN Coalesced)
+{
+    static UCHAR buffer[STAMP_READ_SIZE];
+    ULONG length = TAP_WIN_READ_TIMESTAMP_LENGTH(Flags) + FrameLength(0);
+    ULONG64 tooSmall = TooSmall();
+    PIRP irp;
+
+    if(Coalesced)
+    {
+        length += sizeof(TAP_WIN_READ_FRAME);
+        SetCoalescing(STAMP_FRAMES);
+    }
+
+    SetFlags(Flags);
+
+    Send(0);
+    Send(3);
+    WdkHostAdvanceClock(10);
+
+    irp = Read(buffer, length - 1);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_BUFFER_OVERFLOW);
+    CHECK_EQ(irp->IoStatus.Information, 0);
+    CHECK_EQ(TooSmall(), tooSmall + 1);
+    WdkHostFreeIrp(irp);
+
+    // The next frame fits exactly.
+    irp = Read(buffer, length);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    CHECK_EQ(irp->IoStatus.Information, length);
+    CHECK_EQ(TooSmall(), tooSmall + 1);
+    WdkHostFreeIrp(irp);
+
+    // Without timestamps the same buffer has room to spare.
+    SetFlags(0);
+    Send(3);
+    WdkHostAdvanceClock(10);
+    irp = Read(buffer, length - 1);
+    CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+    WdkHostFreeIrp(irp);
+
+    if(Coalesced)
+    {
+        SetCoalescing(0);
+    }
+}
+
+// Timestamps are off again when the device is next opened.
+static VOID
+TestReopen(VOID)
+{
+    static UCHAR buffer[STAMP_READ_SIZE];
+    ULONG value = TRUE;
+    PIRP irp;
+
+    SetFlags(TAP_WIN_TIMESTAMP_READ | TAP_WIN_TIMESTAMP_QUEUE_DELAY);
+
+    TapHostClose(File);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    Send(1);
+    irp = Read(buffer, sizeof(buffer));
+    CHECK_EQ(irp->IoStatus.Information, FrameLength(1));
+    WdkHostFreeIrp(irp);
+}
+
+int
+main(void)
+{
+    static const ULONG flags[] =
+    {
+        TAP_WIN_TIMESTAMP_READ,
+        TAP_WIN_TIMESTAMP_READ | TAP_WIN_TIMESTAMP_QUEUE_DELAY,
+        TAP_WIN_TIMESTAMP_FLAGS,
+    };
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    ULONG value = TRUE;
+    ULONG i;
+
+    WdkHostFreezeClock(STAMP_NOW);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+
+    TestLayout();
+
+    for(i = 0; i < ARRAYSIZE(flags); ++i)
+    {
+        TestSingle(flags[i]);
+        TestCoalesced(flags[i]);
+        TestFit(flags[i], FALSE);
+        TestFit(flags[i], TRUE);
+    }
+
+    TestReopen();
+
+    TapHostClose(File);
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
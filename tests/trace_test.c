@@ -0,0 +1,226 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The per-CPU trace rings in trace.c, drained with
+// TAP_WIN_IOCTL_GET_TRACE.
+//
+//  trace_test [trace.bin]
+//
+// With a file name, also writes out what it drained, which the
+// trace_decode test feeds to tracedecode.py.
+//======================================================================
+
+#include "taphost.h"
+
+// Past what a one byte Cpu could hold.
+#define TRACE_CPU_COUNT     320
+#define TRACE_HIGH_CPU      300
+
+// One clock tick, as KeQueryTickCount counts them on the host.
+#define TRACE_TICK          156250
+
+typedef struct _TRACE_BUFFER
+{
+    TAP_WIN_TRACE_HEADER    Header;
+    TAP_WIN_TRACE_RECORD    Records[TAP_TRACE_RING_SIZE * 4];
+} TRACE_BUFFER;
+
+static TRACE_BUFFER Buffer;
+
+static ULONG
+Drain(PFILE_OBJECT File, ULONG Length)
+{
+    ULONG_PTR information;
+
+    memset(&Buffer, 0xCC, sizeof(Buffer));
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_GET_TRACE, &Buffer, 0, Length, &information),
+        STATUS_SUCCESS);
+    CHECK_EQ(information, sizeof(TAP_WIN_TRACE_HEADER)
+        + Buffer.Header.RecordCount * sizeof(TAP_WIN_TRACE_RECORD));
+    CHECK_EQ(Buffer.Header.RecordSize, sizeof(TAP_WIN_TRACE_RECORD));
+
+    return Buffer.Header.RecordCount;
+}
+
+static VOID
+Write(ULONG Cpu, USHORT EventId, ULONG64 Arg0)
+{
+    WdkHostSetCurrentProcessor(Cpu);
+    tapTraceWrite(EventId, TAP_WIN_TRACE_LEVEL_INFO, Arg0, Arg0 + 1, 0, 0);
+    WdkHostSetCurrentProcessor(0);
+}
+
+static VOID
+TestRecords(PFILE_OBJECT File, const char *DumpPath)
+{
+    ULONG i;
+
+    CHECK_EQ(sizeof(TAP_WIN_TRACE_RECORD), 56);
+
+    Drain(File, sizeof(Buffer));
+
+    Write(3, TAP_WIN_TRACE_TX_QUEUE_MAX, 10);
+    WdkHostAdvanceClock(100);
+    Write(TRACE_HIGH_CPU, TAP_WIN_TRACE_TX_FLUSH, 20);
+    WdkHostAdvanceClock(100);
+    Write(TRACE_CPU_COUNT - 1, TAP_WIN_TRACE_WRITE_ALLOC_FAILED, 30);
+
+    CHECK_EQ(Drain(File, sizeof(Buffer)), 3);
+    CHECK_EQ(Buffer.Header.RecordsLost, 0);
+    CHECK_EQ(Buffer.Header.RecordsSuppressed, 0);
+    CHECK_EQ(Buffer.Header.TimestampFrequency, 10000000);
+
+    for(i = 0; i < 3; ++i)
+    {
+        const TAP_WIN_TRACE_RECORD *record = &Buffer.Records[i];
+
+        CHECK_EQ(record->Level, TAP_WIN_TRACE_LEVEL_INFO);
+        CHECK_EQ(record->Reserved, 0);
+        CHECK_EQ(record->Reserved2, 0);
+        CHECK_EQ(record->Args[1], record->Args[0] + 1);
+
+        switch(record->EventId)
+        {
+        case TAP_WIN_TRACE_TX_QUEUE_MAX:
+            CHECK_EQ(record->Cpu, 3);
+            CHECK_EQ(record->Args[0], 10);
+            break;
+
+        case TAP_WIN_TRACE_TX_FLUSH:
+            CHECK_EQ(record->Cpu, TRACE_HIGH_CPU);
+            CHECK_EQ(record->Args[0], 20);
+            break;
+
+        case TAP_WIN_TRACE_WRITE_ALLOC_FAILED:
+            CHECK_EQ(record->Cpu, TRACE_CPU_COUNT - 1);
+            CHECK_EQ(record->Args[0], 30);
+            break;
+
+        default:
+            CHECK(!"unexpected event");
+        }
+    }
+
+    if(DumpPath != NULL)
+    {
+        FILE *dump = fopen(DumpPath, "wb");
+
+        CHECK(dump != NULL);
+        CHECK_EQ(fwrite(&Buffer, sizeof(TAP_WIN_TRACE_HEADER) + 3 * sizeof(TAP_WIN_TRACE_RECORD), 1, dump), 1);
+        fclose(dump);
+    }
+
+    CHECK_EQ(Drain(File, sizeof(Buffer)), 0);
+}
+
+static VOID
+TestRateLimit(PFILE_OBJECT File)
+{
+    ULONG i;
+
+    WdkHostAdvanceClock(TRACE_TICK);
+
+    for(i = 0; i < TAP_TRACE_RATE_LIMIT + 10; ++i)
+    {
+        Write(TRACE_HIGH_CPU, TAP_WIN_TRACE_TX_FLUSH, i);
+    }
+
+    // The next tick takes records again.
+    WdkHostAdvanceClock(TRACE_TICK);
+    Write(TRACE_HIGH_CPU, TAP_WIN_TRACE_TX_FLUSH, 1000);
+
+    CHECK_EQ(Drain(File, sizeof(Buffer)), TAP_TRACE_RATE_LIMIT + 1);
+    CHECK_EQ(Buffer.Header.RecordsSuppressed, 10);
+    CHECK_EQ(Buffer.Records[TAP_TRACE_RATE_LIMIT].Args[0], 1000);
+
+    for(i = 0; i <= TAP_TRACE_RATE_LIMIT; ++i)
+    {
+        CHECK_EQ(Buffer.Records[i].Cpu, TRACE_HIGH_CPU);
+    }
+}
+
+static VOID
+TestWrap(PFILE_OBJECT File)
+{
+    ULONG i;
+
+    // Lap the ring: the oldest records are lost, the newest kept.
+    for(i = 0; i < TAP_TRACE_RING_SIZE + 40; ++i)
+    {
+        if(i % TAP_TRACE_RATE_LIMIT == 0)
+        {
+            WdkHostAdvanceClock(TRACE_TICK);
+        }
+
+        Write(TRACE_HIGH_CPU, TAP_WIN_TRACE_TX_FLUSH, i);
+    }
+
+    // The oldest slot is also the one the writer fills next, so a full
+    // ring gives up one record more.
+    CHECK_EQ(Drain(File, sizeof(Buffer)), TAP_TRACE_RING_SIZE - 1);
+    CHECK_EQ(Buffer.Header.RecordsLost, 41);
+    CHECK_EQ(Buffer.Records[0].Args[0], 41);
+    CHECK_EQ(Buffer.Records[TAP_TRACE_RING_SIZE - 2].Args[0], TAP_TRACE_RING_SIZE + 39);
+
+    // A short buffer drains what fits, and the rest on the next call.
+    WdkHostAdvanceClock(TRACE_TICK);
+    for(i = 0; i < 5; ++i)
+    {
+        Write(7, TAP_WIN_TRACE_TX_FLUSH, i);
+    }
+
+    CHECK_EQ(Drain(File, sizeof(TAP_WIN_TRACE_HEADER) + 2 * sizeof(TAP_WIN_TRACE_RECORD)), 2);
+    CHECK_EQ(Buffer.Records[1].Args[0], 1);
+    CHECK_EQ(Drain(File, sizeof(Buffer)), 3);
+    CHECK_EQ(Buffer.Records[0].Args[0], 2);
+}
+
+int
+main(int argc, char **argv)
+{
+    PTAP_ADAPTER_CONTEXT adapter;
+    PFILE_OBJECT file;
+
+    WdkHostSetProcessorCount(TRACE_CPU_COUNT);
+    WdkHostFreezeClock(1000000);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    CHECK_EQ(g_TapTrace.RingCount, TRACE_CPU_COUNT);
+
+    adapter = TapHostCreateAdapter(1);
+    CHECK(adapter != NULL);
+    file = TapHostOpen(adapter->DeviceObject);
+    CHECK(file != NULL);
+
+    TestRecords(file, argc > 1 ? argv[1] : NULL);
+    TestRateLimit(file);
+    TestWrap(file);
+
+    TapHostClose(file);
+    TapHostHaltAdapter(adapter);
+    TapHostUnloadDriver();
+
+    return 0;
+}
@@ -0,0 +1,480 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// TUN mode transmits (tapAdapterTransmitTun): what the reader gets for
+// IPv4 and IPv6 packets, which frames are dropped and why, and the
+// ARP requests and neighbor solicitations answered in the driver.
+//======================================================================
+
+#include "taphost.h"
+
+// The adapter is 10.8.0.2, its peer's network 10.8.0.0/24.
+#define TUN_LOCAL_IP        0x0A080002
+#define TUN_NETWORK         0x0A080000
+#define TUN_NETMASK         0xFFFFFF00
+
+#define NS_LENGTH           (sizeof(ETH_HEADER) + sizeof(IPV6HDR) + sizeof(ICMPV6_NS))
+
+static PTAP_ADAPTER_CONTEXT Adapter;
+static PFILE_OBJECT File;
+
+//
+// What the driver indicates to the host.
+//
+
+static UCHAR Reply[256];
+static ULONG ReplyLength;
+static ULONG Replies;
+static PNET_BUFFER_LIST Indicated;
+
+static VOID
+TakeIndications(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG NumberOfNetBufferLists, ULONG ReceiveFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+
+    CHECK_EQ(NumberOfNetBufferLists, 1);
+
+    ReplyLength = WdkHostCopyNetBufferData(NET_BUFFER_LIST_FIRST_NB(NetBufferLists),
+        Reply, sizeof(Reply));
+    ++Replies;
+
+    if(!(ReceiveFlags & NDIS_RECEIVE_FLAGS_RESOURCES))
+    {
+        CHECK(Indicated == NULL);
+        Indicated = NetBufferLists;
+    }
+}
+
+static VOID
+FreeSent(PVOID Context, NDIS_HANDLE MiniportAdapterHandle,
+    PNET_BUFFER_LIST NetBufferLists, ULONG SendCompleteFlags)
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(MiniportAdapterHandle);
+    UNREFERENCED_PARAMETER(SendCompleteFlags);
+
+    CHECK(NET_BUFFER_LIST_NEXT_NBL(NetBufferLists) == NULL);
+    WdkHostFreeNetBufferList(NetBufferLists);
+}
+
+// Runs the inject DPC and returns what it indicated.
+static VOID
+ReturnIndicated(VOID)
+{
+    WdkHostRunDpcs();
+
+    if(Indicated != NULL)
+    {
+        PNET_BUFFER_LIST nbl = Indicated;
+
+        Indicated = NULL;
+        TapHostReturn(Adapter, nbl);
+    }
+}
+
+static ULONG64
+Drops(ULONG Reason)
+{
+    TAP_WIN_DROP_STATS drops;
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+    return drops.Drops[Reason];
+}
+
+static ULONG64
+Handled(VOID)
+{
+    TAP_WIN_DROP_STATS drops;
+
+    tapDropStatsQuery(&Adapter->DropStats, 0, &drops);
+    return drops.Handled;
+}
+
+static VOID
+Send(const UCHAR *Frame, ULONG Length)
+{
+    TapHostSend(Adapter, WdkHostAllocateNetBufferList(Frame, Length));
+    ReturnIndicated();
+}
+
+//
+// Frames, as the host sends them through the adapter.
+//
+
+static ULONG
+BuildIPv4(UCHAR *Frame, ULONG Length, BOOLEAN Directed)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPHDR *ip = (IPHDR *)(eth + 1);
+    ULONG i;
+
+    for(i = 0; i < Length; ++i)
+    {
+        Frame[i] = (UCHAR)(i * 7 + 3);
+    }
+
+    if(Directed)
+    {
+        memcpy(eth, &Adapter->m_TapToUser, sizeof(ETH_HEADER));
+    }
+    else
+    {
+        memset(eth->dest, 0xFF, sizeof(MACADDR));
+        ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+        eth->proto = htons(NDIS_ETH_TYPE_IPV4);
+    }
+
+    ip->version_len = 0x45;
+    ip->tot_len = htons((USHORT)(Length - sizeof(ETH_HEADER)));
+    ip->protocol = IPPROTO_UDP;
+    ip->saddr = htonl(TUN_LOCAL_IP);
+    ip->daddr = htonl(TUN_NETWORK | 5);
+
+    return Length;
+}
+
+static ULONG
+BuildIPv6(UCHAR *Frame, ULONG Length)
+{
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPV6HDR *ipv6 = (IPV6HDR *)(eth + 1);
+    ULONG i;
+
+    for(i = 0; i < Length; ++i)
+    {
+        Frame[i] = (UCHAR)(i * 5 + 1);
+    }
+
+    ETH_COPY_NETWORK_ADDRESS(eth->dest, Adapter->m_TapToUser.dest);
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(NDIS_ETH_TYPE_IPV6);
+
+    ipv6->version_prio = 0x60;
+    ipv6->payload_len = htons((USHORT)(Length - sizeof(ETH_HEADER) - sizeof(IPV6HDR)));
+    ipv6->nexthdr = IPPROTO_UDP;
+
+    return Length;
+}
+
+// An ARP request from the adapter for Target.
+static VOID
+BuildArpRequest(ARP_PACKET *Arp, ULONG Target)
+{
+    memset(Arp, 0, sizeof(*Arp));
+
+    memset(Arp->m_MAC_Destination, 0xFF, sizeof(MACADDR));
+    ETH_COPY_NETWORK_ADDRESS(Arp->m_MAC_Source, Adapter->PermanentAddress);
+    Arp->m_Proto = htons(NDIS_ETH_TYPE_ARP);
+    Arp->m_MAC_AddressType = htons(MAC_ADDR_TYPE);
+    Arp->m_PROTO_AddressType = htons(NDIS_ETH_TYPE_IPV4);
+    Arp->m_MAC_AddressSize = sizeof(MACADDR);
+    Arp->m_PROTO_AddressSize = sizeof(IPADDR);
+    Arp->m_ARP_Operation = htons(ARP_REQUEST);
+    ETH_COPY_NETWORK_ADDRESS(Arp->m_ARP_MAC_Source, Adapter->PermanentAddress);
+    Arp->m_ARP_IP_Source = htonl(TUN_LOCAL_IP);
+    Arp->m_ARP_IP_Destination = htonl(Target);
+}
+
+// A neighbor solicitation for fe80::8, OpenVPN's "handled by the driver"
+// next hop, to its solicited-node address.
+static VOID
+BuildSolicitation(UCHAR *Frame)
+{
+    static const UCHAR solicitedNode[16] =
+        { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff, 0, 0, 0x08 };
+    static const UCHAR target[16] =
+        { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x08 };
+    ETH_HEADER *eth = (ETH_HEADER *)Frame;
+    IPV6HDR *ipv6 = (IPV6HDR *)(eth + 1);
+    ICMPV6_NS *ns = (ICMPV6_NS *)(ipv6 + 1);
+
+    memset(Frame, 0, NS_LENGTH);
+
+    eth->dest[0] = 0x33;
+    eth->dest[1] = 0x33;
+    eth->dest[2] = 0xff;
+    eth->dest[5] = 0x08;
+    ETH_COPY_NETWORK_ADDRESS(eth->src, Adapter->CurrentAddress);
+    eth->proto = htons(NDIS_ETH_TYPE_IPV6);
+
+    ipv6->version_prio = 0x60;
+    ipv6->payload_len = htons(sizeof(ICMPV6_NS));
+    ipv6->nexthdr = IPPROTO_ICMPV6;
+    ipv6->hop_limit = 255;
+    ipv6->saddr[0] = 0xfe;
+    ipv6->saddr[1] = 0x80;
+    ipv6->saddr[15] = 0x02;
+    memcpy(ipv6->daddr, solicitedNode, 16);
+
+    ns->type = ICMPV6_TYPE_NS;
+    ns->code = ICMPV6_CODE_0;
+    memcpy(ns->target_addr, target, 16);
+}
+
+static VOID
+ConfigureTun(VOID)
+{
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED
+                        | NDIS_PACKET_TYPE_ALL_MULTICAST
+                        | NDIS_PACKET_TYPE_BROADCAST;
+    IPADDR addresses[3];
+    ULONG value = TRUE;
+
+    CHECK_EQ(TapHostSetInformation(Adapter, OID_GEN_CURRENT_PACKET_FILTER,
+        &packetFilter, sizeof(packetFilter)), NDIS_STATUS_SUCCESS);
+
+    addresses[0] = htonl(TUN_LOCAL_IP);
+    addresses[1] = htonl(TUN_NETWORK);
+    addresses[2] = htonl(TUN_NETMASK);
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_TUN, addresses,
+        sizeof(addresses), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_SET_MEDIA_STATUS, &value,
+        sizeof(value), 0, NULL), STATUS_SUCCESS);
+}
+
+//
+// The tests.
+//
+
+// The reader gets the IP packet without the Ethernet header, whatever
+// its length.
+static VOID
+TestPayload(VOID)
+{
+    static UCHAR frame[1514];
+    static UCHAR readBuffer[2048];
+    static const ULONG lengths[] = { 34, 35, 60, 64, 577, 1514 };
+    ULONG i;
+    ULONG ipv6;
+
+    for(ipv6 = 0; ipv6 < 2; ++ipv6)
+    {
+        for(i = 0; i < ARRAYSIZE(lengths); ++i)
+        {
+            ULONG length = lengths[i] + (ipv6 ? 20 : 0);
+            PIRP irp = NULL;
+
+            if(length > sizeof(frame))
+            {
+                continue;
+            }
+
+            length = ipv6 ? BuildIPv6(frame, length) : BuildIPv4(frame, length, TRUE);
+
+            CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+            Send(frame, length);
+
+            CHECK(irp->HostCompleted);
+            CHECK_EQ(irp->IoStatus.Status, STATUS_SUCCESS);
+            CHECK_EQ(irp->IoStatus.Information, length - sizeof(ETH_HEADER));
+            CHECK(memcmp(readBuffer, frame + sizeof(ETH_HEADER), length - sizeof(ETH_HEADER)) == 0);
+            WdkHostFreeIrp(irp);
+        }
+    }
+
+    CHECK_EQ(Replies, 0);
+}
+
+// Frames that cannot go to the reader are dropped, by reason, and the
+// read stays pending.
+static VOID
+TestDrops(VOID)
+{
+    static UCHAR frame[128];
+    static UCHAR readBuffer[2048];
+    ETH_HEADER *eth = (ETH_HEADER *)frame;
+    ULONG64 notDirected = Drops(TAP_WIN_DROP_TX_TUN_NOT_DIRECTED);
+    ULONG64 badSize = Drops(TAP_WIN_DROP_TX_TUN_BAD_SIZE);
+    ULONG64 protocol = Drops(TAP_WIN_DROP_TX_TUN_PROTOCOL);
+    PIRP irp = NULL;
+
+    CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+
+    // IPv4 broadcast, DHCP masquerade off.
+    Send(frame, BuildIPv4(frame, 60, FALSE));
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_TUN_NOT_DIRECTED), notDirected + 1);
+
+    // IPv6 shorter than its header. Anything shorter than an IPv4
+    // header never gets this far (TAP_WIN_DROP_TX_BAD_LENGTH).
+    Send(frame, BuildIPv6(frame, sizeof(ETH_HEADER) + IPV6_HEADER_SIZE - 1));
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_TUN_BAD_SIZE), badSize + 1);
+
+    // ARP of the wrong size.
+    BuildArpRequest((ARP_PACKET *)frame, TUN_NETWORK | 5);
+    Send(frame, sizeof(ARP_PACKET) + 1);
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_TUN_BAD_SIZE), badSize + 2);
+
+    // Neither ARP nor IP.
+    BuildIPv4(frame, 60, TRUE);
+    eth->proto = htons(0x88B5);
+    Send(frame, 60);
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_TUN_PROTOCOL), protocol + 1);
+
+    CHECK(!irp->HostCompleted);
+    CHECK_EQ(Replies, 0);
+
+    // Closing the handle completes it.
+    TapHostClose(File);
+    CHECK(irp->HostCompleted);
+    WdkHostFreeIrp(irp);
+
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+    ConfigureTun();
+}
+
+// An ARP request for an address in the peer's network is answered with
+// the peer's MAC and counted as handled; one outside it, or for the
+// adapter's own address, gets no answer and is counted as not directed.
+static VOID
+TestArp(VOID)
+{
+    ARP_PACKET request;
+    const ARP_PACKET *reply = (const ARP_PACKET *)Reply;
+    ULONG64 handled = Handled();
+    ULONG64 notDirected = Drops(TAP_WIN_DROP_TX_TUN_NOT_DIRECTED);
+    ULONG replies = Replies;
+
+    BuildArpRequest(&request, TUN_NETWORK | 5);
+    Send((PUCHAR)&request, sizeof(request));
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK(ReplyLength >= sizeof(ARP_PACKET));   // Padded to the minimum frame
+    CHECK_EQ(reply->m_ARP_Operation, htons(ARP_REPLY));
+    CHECK(memcmp(reply->m_MAC_Source, Adapter->m_TapToUser.dest, sizeof(MACADDR)) == 0);
+    CHECK(memcmp(reply->m_ARP_MAC_Source, Adapter->m_TapToUser.dest, sizeof(MACADDR)) == 0);
+    CHECK(memcmp(reply->m_MAC_Destination, Adapter->PermanentAddress, sizeof(MACADDR)) == 0);
+    CHECK_EQ(reply->m_ARP_IP_Source, htonl(TUN_NETWORK | 5));
+    CHECK_EQ(reply->m_ARP_IP_Destination, htonl(TUN_LOCAL_IP));
+    CHECK_EQ(Handled(), handled + 1);
+
+    BuildArpRequest(&request, 0x0A090001);
+    Send((PUCHAR)&request, sizeof(request));
+    BuildArpRequest(&request, TUN_LOCAL_IP);
+    Send((PUCHAR)&request, sizeof(request));
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK_EQ(Handled(), handled + 1);
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_TUN_NOT_DIRECTED), notDirected + 2);
+}
+
+// A solicitation for fe80::8 is answered for the peer, not queued; other
+// IPv6 multicasts reach the reader.
+static VOID
+TestNeighborDiscovery(VOID)
+{
+    static UCHAR readBuffer[2048];
+    UCHAR frame[NS_LENGTH];
+    const ETH_HEADER *eth = (const ETH_HEADER *)Reply;
+    const IPV6HDR *ipv6 = (const IPV6HDR *)(eth + 1);
+    ULONG64 handled = Handled();
+    ULONG replies = Replies;
+    PIRP irp = NULL;
+
+    CHECK_EQ(TapHostRead(File, readBuffer, sizeof(readBuffer), &irp), STATUS_PENDING);
+
+    BuildSolicitation(frame);
+    Send(frame, NS_LENGTH);
+
+    CHECK(!irp->HostCompleted);
+    CHECK_EQ(Replies, replies + 1);
+    CHECK_EQ(Handled(), handled + 1);
+    CHECK_EQ(eth->proto, htons(NDIS_ETH_TYPE_IPV6));
+    CHECK(memcmp(eth->src, Adapter->m_TapToUser.dest, sizeof(MACADDR)) == 0);
+    CHECK_EQ(ipv6->nexthdr, IPPROTO_ICMPV6);
+    CHECK_EQ(Reply[sizeof(ETH_HEADER) + sizeof(IPV6HDR)], ICMPV6_TYPE_NA);
+
+    // Another target: passed to the reader.
+    frame[NS_LENGTH - 1] = 0x09;
+    Send(frame, NS_LENGTH);
+
+    CHECK_EQ(Replies, replies + 1);
+    CHECK(irp->HostCompleted);
+    CHECK_EQ(irp->IoStatus.Information, NS_LENGTH - sizeof(ETH_HEADER));
+    CHECK(memcmp(readBuffer, frame + sizeof(ETH_HEADER), NS_LENGTH - sizeof(ETH_HEADER)) == 0);
+    WdkHostFreeIrp(irp);
+}
+
+// With DHCP masquerade on, a broadcast DHCP request without options is
+// dropped as malformed, not counted as answered.
+static VOID
+TestDhcpMalformed(VOID)
+{
+    static UCHAR frame[sizeof(ETH_HEADER) + sizeof(IPHDR) + sizeof(UDPHDR) + sizeof(DHCP)];
+    UDPHDR *udp = (UDPHDR *)(frame + sizeof(ETH_HEADER) + sizeof(IPHDR));
+    IPADDR masq[4];
+    ULONG64 handled = Handled();
+    ULONG64 malformed = Drops(TAP_WIN_DROP_TX_MALFORMED);
+    ULONG replies = Replies;
+
+    masq[0] = htonl(TUN_LOCAL_IP);
+    masq[1] = htonl(TUN_NETMASK);
+    masq[2] = htonl(TUN_NETWORK | 0xFE);
+    masq[3] = 3600;
+    CHECK_EQ(TapHostIoctl(File, TAP_WIN_IOCTL_CONFIG_DHCP_MASQ, masq,
+        sizeof(masq), sizeof(ULONG), NULL), STATUS_SUCCESS);
+
+    BuildIPv4(frame, sizeof(frame), FALSE);
+    udp->dest = htons(BOOTPS_PORT);
+    Send(frame, sizeof(frame));
+
+    CHECK_EQ(Drops(TAP_WIN_DROP_TX_MALFORMED), malformed + 1);
+    CHECK_EQ(Handled(), handled);
+    CHECK_EQ(Replies, replies);
+}
+
+int
+main(void)
+{
+    WdkHostSetReceiveHook(TakeIndications, NULL);
+    WdkHostSetSendCompleteHook(FreeSent, NULL);
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+    Adapter = TapHostCreateAdapter(1);
+    CHECK(Adapter != NULL);
+    File = TapHostOpen(Adapter->DeviceObject);
+    CHECK(File != NULL);
+
+    ConfigureTun();
+
+    TestPayload();
+    TestDrops();
+    TestArp();
+    TestNeighborDiscovery();
+    TestDhcpMalformed();
+
+    TapHostClose(File);
+    ReturnIndicated();
+    TapHostHaltAdapter(Adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+    CHECK_EQ(WdkHostCounters.PoolAllocations, 0);
+
+    return 0;
+}
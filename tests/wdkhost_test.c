@@ -0,0 +1,166 @@
+/*
+ *  TAP-Windows -- A kernel driver to provide virtual tap
+ *                 device functionality on Windows.
+ *
+ *  This code was inspired by the CIPE-Win32 driver by Damion K. Wilson.
+ *
+ *  This source code is Copyright (C) 2002-2014 OpenVPN Technologies, Inc.,
+ *  and is released under the GPL version 2 (see below).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program (see the file COPYING included with this
+ *  distribution); if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//======================================================================
+// The host stand-ins themselves, and a load/unload of the driver with
+// one adapter and an open handle.
+//======================================================================
+
+#include "taphost.h"
+
+static ULONG DpcRuns;
+
+static VOID
+CountDpc(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    CHECK_EQ(KeGetCurrentIrql(), DISPATCH_LEVEL);
+    ++DpcRuns;
+}
+
+static VOID
+TestTimers(VOID)
+{
+    KDPC dpc;
+    KTIMER timer;
+    LARGE_INTEGER dueTime;
+
+    WdkHostFreezeClock(1000000);
+
+    KeInitializeDpc(&dpc, CountDpc, NULL);
+    KeInitializeTimer(&timer);
+
+    dueTime.QuadPart = -10000;      // 1ms
+    KeSetTimerEx(&timer, dueTime, 5, &dpc);
+
+    WdkHostAdvanceClock(9999);
+    CHECK_EQ(WdkHostRunDpcs(), 0);
+
+    WdkHostAdvanceClock(1);
+    CHECK_EQ(WdkHostRunDpcs(), 1);
+
+    // Periodic: 5ms later, again.
+    WdkHostAdvanceClock(50000);
+    CHECK_EQ(WdkHostRunDpcs(), 1);
+
+    CHECK(KeCancelTimer(&timer));
+    WdkHostAdvanceClock(50000);
+    CHECK_EQ(WdkHostRunDpcs(), 0);
+    CHECK_EQ(DpcRuns, 2);
+
+    // A DPC is queued once however often it is inserted.
+    CHECK(KeInsertQueueDpc(&dpc, NULL, NULL));
+    CHECK(!KeInsertQueueDpc(&dpc, NULL, NULL));
+    CHECK_EQ(WdkHostQueuedDpcs(), 1);
+    CHECK_EQ(WdkHostRunDpcs(), 1);
+
+    WdkHostThawClock();
+}
+
+static VOID
+TestNetBuffers(VOID)
+{
+    UCHAR data[100];
+    UCHAR storage[100];
+    UCHAR copy[100];
+    PNET_BUFFER_LIST nbl;
+    PNET_BUFFER nb;
+    PMDL second;
+    PUCHAR view;
+    ULONG i;
+
+    for(i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = (UCHAR)i;
+    }
+
+    nbl = WdkHostAllocateNetBufferList(data, 60);
+    nb = NET_BUFFER_LIST_FIRST_NB(nbl);
+
+    // Chain a second MDL of 40 bytes and extend the data over it.
+    second = NdisAllocateMdl(NULL, malloc(40), 40);
+    memcpy(MmGetMdlVirtualAddress(second), data + 60, 40);
+    NET_BUFFER_FIRST_MDL(nb)->Next = second;
+    NET_BUFFER_DATA_LENGTH(nb) = 100;
+
+    // Contiguous in the first MDL: a pointer into it.
+    view = NdisGetDataBuffer(nb, 60, storage, 1, 0);
+    CHECK(view == MmGetMdlVirtualAddress(NET_BUFFER_FIRST_MDL(nb)));
+
+    // Across both: copied to storage, or NULL without it.
+    CHECK(NdisGetDataBuffer(nb, 61, NULL, 1, 0) == NULL);
+    view = NdisGetDataBuffer(nb, 100, storage, 1, 0);
+    CHECK(view == storage);
+    CHECK(memcmp(storage, data, 100) == 0);
+    CHECK(NdisGetDataBuffer(nb, 101, storage, 1, 0) == NULL);
+
+    CHECK_EQ(WdkHostCopyNetBufferData(nb, copy, sizeof(copy)), 100);
+    CHECK(memcmp(copy, data, 100) == 0);
+
+    WdkHostFreeNetBufferList(nbl);
+    CHECK_EQ(WdkHostCounters.Mdls, 0);
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+}
+
+static VOID
+TestDriver(VOID)
+{
+    PTAP_ADAPTER_CONTEXT adapter;
+    PFILE_OBJECT file;
+    LONG poolAllocations = WdkHostCounters.PoolAllocations;
+
+    CHECK_EQ(TapHostLoadDriver(FALSE), NDIS_STATUS_SUCCESS);
+
+    adapter = TapHostCreateAdapter(1);
+    CHECK(adapter != NULL);
+    CHECK_EQ(adapter->Locked.AdapterState, MiniportRunning);
+    CHECK(tapAdapterContextFromDeviceObject(adapter->DeviceObject) == adapter);
+    tapAdapterContextDereference(adapter);
+
+    file = TapHostOpen(adapter->DeviceObject);
+    CHECK(file != NULL);
+    CHECK(file->FsContext == adapter);
+    TapHostClose(file);
+
+    TapHostHaltAdapter(adapter);
+    TapHostUnloadDriver();
+
+    CHECK_EQ(WdkHostCounters.PoolAllocations, poolAllocations);
+    CHECK_EQ(WdkHostCounters.Mdls, 0);
+    CHECK_EQ(WdkHostCounters.NetBufferLists, 0);
+}
+
+int
+main(void)
+{
+    TestTimers();
+    TestNetBuffers();
+    TestDriver();
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+# decode TAP-Windows binary trace records
+#
+# Input is what TAP_WIN_IOCTL_GET_TRACE returned, one or more output
+# buffers written back to back: each a TAP_WIN_TRACE_HEADER followed by
+# RecordCount TAP_WIN_TRACE_RECORDs (see src/tap-windows.h).  Records of
+# all CPUs are merged on their timestamps and printed one per line, with
+# event names, levels and argument names taken from tap-windows.h.
+
+import sys, os, re, struct
+
+# TAP_WIN_TRACE_HEADER: RecordCount, RecordsLost, RecordsSuppressed,
+# RecordSize, TimestampFrequency
+HEADER = struct.Struct('<IIIIQ')
+
+# TAP_WIN_TRACE_RECORD: Timestamp, Sequence, EventId, Level, Reserved, Cpu,
+# Reserved2, Args[4]
+RECORD = struct.Struct('<QIHBBII4Q')
+
+class TraceHeader(object):
+    # #define TAP_WIN_TRACE_<NAME> <value> /* arg, arg (detail), ... */
+    define = re.compile(r"#define\s+TAP_WIN_TRACE_(\w+)\s+(\d+)\s*(?:/\*\s*(.*?)\s*\*/)?")
+
+    def __init__(self, path):
+        self.events = {}        # id -> (name, [arg names])
+        self.levels = {}        # level -> name
+        if path is None:
+            return
+        with open(path) as f:
+            for line in f:
+                m = self.define.match(line.strip())
+                if not m:
+                    continue
+                name, value, comment = m.group(1), int(m.group(2)), m.group(3)
+                if name.startswith('LEVEL_'):
+                    self.levels[value] = name[len('LEVEL_'):]
+                elif name != 'MAX_EVENT':
+                    self.events[value] = (name, self.arg_names(comment))
+
+    @staticmethod
+    def arg_names(comment):
+        # Split on the commas outside parentheses.
+        names, depth, name = [], 0, ''
+        for c in comment or '':
+            if c == ',' and depth == 0:
+                names.append(name.strip())
+                name = ''
+                continue
+            depth += {'(': 1, ')': -1}.get(c, 0)
+            name += c
+        if name.strip():
+            names.append(name.strip())
+        return [re.sub(r"\s*\(.*\)", "", n).replace(' ', '_') for n in names]
+
+    def format(self, event_id, level, args):
+        name, arg_names = self.events.get(event_id, ("EVENT_%u" % event_id, []))
+        level_name = self.levels.get(level, "L%u" % level)
+        fields = []
+        for i, value in enumerate(args):
+            if i < len(arg_names):
+                fields.append("%s=%u" % (arg_names[i], value))
+            elif value:
+                fields.append("arg%u=0x%x" % (i, value))
+        return "%-7s %s %s" % (level_name, name, " ".join(fields))
+
+def read_trace(data):
+    """Returns (records, totals) from concatenated GET_TRACE output.
+    A record is (timestamp, cpu, sequence, event, level, args)."""
+    records = []
+    totals = {'lost': 0, 'suppressed': 0, 'frequency': 0}
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        count, lost, suppressed, record_size, frequency = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        totals['lost'] += lost
+        totals['suppressed'] += suppressed
+        totals['frequency'] = frequency or totals['frequency']
+        if record_size != RECORD.size:
+            raise ValueError("unknown record size %u at offset %u" % (record_size, offset))
+        if offset + count * RECORD.size > len(data):
+            raise ValueError("truncated: %u records at offset %u" % (count, offset))
+        for i in range(count):
+            timestamp, sequence, event, level, _, cpu, _, a0, a1, a2, a3 = \
+                RECORD.unpack_from(data, offset)
+            offset += RECORD.size
+            records.append((timestamp, cpu, sequence, event, level, (a0, a1, a2, a3)))
+    if offset != len(data):
+        raise ValueError("%u trailing bytes" % (len(data) - offset))
+    return records, totals
+
+def decode(data, header, absolute=False, out=sys.stdout):
+    records, totals = read_trace(data)
+    records.sort(key=lambda r: (r[0], r[1], r[2]))
+    frequency = totals['frequency'] or 1
+    start = records[0][0] if records and not absolute else 0
+    for timestamp, cpu, sequence, event, level, args in records:
+        out.write("%14.6f cpu=%-3u seq=%-10u %s\n" % (
+            float(timestamp - start) / frequency, cpu, sequence,
+            header.format(event, level, args)))
+    return len(records), totals
+
+if __name__ == '__main__':
+    import optparse
+
+    default_header = os.path.join(os.path.dirname(os.path.realpath(__file__)), 'src', 'tap-windows.h')
+
+    op = optparse.OptionParser(usage="usage: %prog [options] trace.bin ...")
+    op.add_option("--header", dest="header", metavar="TAP-WINDOWS.H",
+                  default=default_header if os.path.isfile(default_header) else None,
+                  help="tap-windows.h giving event names (default %s)" % default_header)
+    op.add_option("-a", "--absolute", action="store_true", dest="absolute",
+                  help="print raw performance counter times in seconds, not times since the first record")
+    (opt, args) = op.parse_args()
+
+    if not args:
+        op.error("no trace file given")
+
+    data = b''
+    for path in args:
+        with open(path, 'rb') as f:
+            data += f.read()
+
+    try:
+        count, totals = decode(data, TraceHeader(opt.header), opt.absolute)
+    except ValueError as e:
+        sys.stderr.write("tracedecode: %s\n" % e)
+        sys.exit(1)
+
+    sys.stderr.write("%u records, %u lost, %u suppressed\n" % (count, totals['lost'], totals['suppressed']))